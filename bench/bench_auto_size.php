@@ -0,0 +1,52 @@
+<?php
+/*
+ * Bench: write a mixed grid with autoSize() measuring every cell and with
+ * a 1000-row sample.
+ *
+ * Default 100k rows × 10 cols (1M cells). Override via env:
+ *   BENCH_ROWS=1000000 BENCH_COLS=27 php bench/bench_auto_size.php
+ */
+require __DIR__ . '/_lib.php';
+bench_require_extension();
+
+$rows = (int) (getenv('BENCH_ROWS') ?: 100000);
+$cols = (int) (getenv('BENCH_COLS') ?: 10);
+$dir  = bench_tmp_dir();
+$path = $dir . '/bench_auto_size.xlsx';
+
+$results = [];
+
+foreach (['every_cell' => 0, 'sample_1000' => 1000] as $name => $sample) {
+    $results[] = bench_record('auto_size_' . $name, function () use ($rows, $cols, $dir, $path, $sample) {
+        $excel = new \Vtiful\Kernel\Excel(['path' => $dir]);
+        $excel->fileName('bench_auto_size.xlsx')->autoSize(null, $sample);
+
+        $header = [];
+        for ($c = 0; $c < $cols; $c++) {
+            $header[] = "col$c";
+        }
+        $excel->header($header);
+
+        for ($r = 0; $r < $rows; $r++) {
+            $row = [];
+            for ($c = 0; $c < $cols; $c++) {
+                switch ($c % 3) {
+                    case 0:  $row[] = "name $r"; break;
+                    case 1:  $row[] = $r * $cols + $c; break;
+                    default: $row[] = ($r * $cols + $c) / 100; break;
+                }
+            }
+            $excel->data([$row]);
+        }
+        $excel->output();
+
+        return ['rows' => $rows, 'cols' => $cols, 'file_bytes' => filesize($path)];
+    }, ['mode' => 'normal', 'sample_rows' => $sample]);
+
+    @unlink($path);
+}
+
+bench_emit_json([
+    'benchmark' => 'auto_size',
+    'results'   => $results,
+]);
@@ -34,7 +34,6 @@ if test "$PHP_XLSWRITER" != "no"; then
     library/libexpat/expat/lib/xmlrole.c \
     library/libexpat/expat/lib/xmltok.c \
     library/libxlsx/third_party/tmpfileplus/tmpfileplus.c \
-    library/libxlsx/third_party/dtoa/emyg_dtoa.c \
     library/libxlsx/src/app.c \
     library/libxlsx/src/chart.c \
     library/libxlsx/src/chartsheet.c \
@@ -43,6 +42,7 @@ if test "$PHP_XLSWRITER" != "no"; then
     library/libxlsx/src/core.c \
     library/libxlsx/src/custom.c \
     library/libxlsx/src/drawing.c \
+    library/libxlsx/src/dtoa.c \
     library/libxlsx/src/format.c \
     library/libxlsx/src/hash_table.c \
     library/libxlsx/src/metadata.c \
@@ -64,6 +64,8 @@ if test "$PHP_XLSWRITER" != "no"; then
     library/libxlsx/src/source_package.c \
     library/libxlsx/src/edit.c \
     library/libxlsx/src/formula.c \
+    library/libxlsx/src/recalc.c \
+    library/libxlsx/src/reader_eval.c \
     library/libxlsx/src/common.c \
     library/libxlsx/src/xlsx_util.c \
     library/libxlsx/src/zip_io.c \
@@ -133,7 +135,6 @@ if test "$PHP_XLSWRITER" != "no"; then
     PHP_ADD_BUILD_DIR([PHP_EXT_BUILDDIR/library/libexpat/expat/lib])
     PHP_ADD_BUILD_DIR([PHP_EXT_BUILDDIR/library/libxlsx/third_party/minizip])
     PHP_ADD_BUILD_DIR([PHP_EXT_BUILDDIR/library/libxlsx/third_party/tmpfileplus])
-    PHP_ADD_BUILD_DIR([PHP_EXT_BUILDDIR/library/libxlsx/third_party/dtoa])
     PHP_ADD_BUILD_DIR([PHP_EXT_BUILDDIR/library/libxlsx/third_party/md5])
 
     LIBOPT="$LIBOPT -DXML_POOR_ENTROPY -DUSE_DTOA_LIBRARY"
@@ -25,6 +25,7 @@
 #define V_XLS_CONST_READ_TYPE_DOUBLE   "TYPE_DOUBLE"
 #define V_XLS_CONST_READ_TYPE_STRING   "TYPE_STRING"
 #define V_XLS_CONST_READ_TYPE_DATETIME "TYPE_TIMESTAMP"
+#define V_XLS_CONST_WRITE_TYPE_BOOL    "TYPE_BOOL"
 
 #define V_XLS_CONST_READ_SKIP_NONE        "SKIP_NONE"
 #define V_XLS_CONST_READ_SKIP_EMPTY_ROW   "SKIP_EMPTY_ROW"
@@ -39,6 +40,7 @@
 #define READ_TYPE_INT      0x02
 #define READ_TYPE_DOUBLE   0x04
 #define READ_TYPE_DATETIME 0x08
+#define WRITE_TYPE_BOOL    0x10
 
 #define GET_CONFIG_PATH(dir_path_res, class_name, object)                                          \
     do {                                                                                           \
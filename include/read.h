@@ -28,7 +28,7 @@ int  sheet_read_row(lxlsx_reader_worksheet *ws);
 
 void           sheet_list(lxlsx_reader_workbook *wb, zval *zv_result_t);
 void           sheet_list_with_meta(lxlsx_reader_workbook *wb, zval *zv_result_t);
-lxlsx_reader_workbook  *file_open (const char *directory, const char *file_name);
+lxlsx_reader_workbook  *file_open (const char *path, const lxlsx_edit_open_options *options, lxlsx_workbook **edit_workbook);
 lxlsx_reader_worksheet *sheet_open(lxlsx_reader_workbook *wb, const zend_string *zs_sheet_name_t, const zend_long zl_flag);
 
 void skip_rows          (struct xls_resource_read_t *r, zval *zv_type_t, zend_long data_type_default, zend_long zl_skip_row);
@@ -30,6 +30,8 @@
 #include "libxlsx/packager.h"
 #include "libxlsx/format.h"
 #include "libxlsx/formula.h"
+#include "libxlsx/recalc.h"
+#include "libxlsx/reader_eval.h"
 
 #include "common.h"
 #include "php_xlswriter.h"
@@ -62,6 +64,11 @@ typedef struct xls_resource_read_t {
     size_t         expected_row_nr;
     size_t         pending_synth_rows;
     zval           pending_real_row;
+
+    /* Formula evaluator of the open sheet, opened by the first
+     * nextRowWithFormula(true), and the sheet's name (NULL: the first). */
+    lxlsx_reader_eval *eval;
+    zend_string    *sheet_name;
 } xls_resource_read_t;
 
 typedef struct {
@@ -82,35 +89,108 @@ enum xlswirter_printed_direction {
     XLSWRITER_PRINTED_PORTRAIT,
 };
 
+/* Per-column auto-size state: the widest estimate so far and how many cells
+ * of the column have been offered for sampling. */
+typedef struct {
+    double         width;
+    zend_ulong     seen;
+} xls_auto_width_t;
+
 typedef struct {
     lxlsx_workbook  *workbook;
     lxlsx_worksheet *worksheet;
     /* Auto-size tracking: per-column maximum estimated display width,
      * accumulated during writes (only while auto_size_enabled) so the widths
      * can be applied before the worksheet is packaged. Lazily allocated on
-     * first tracked write; reset on sheet switch. */
-    double        *auto_widths;
+     * first tracked write; reset on sheet switch. With auto_size_sample > 0
+     * only the first auto_size_sample cells of a column and every
+     * auto_size_sample-th cell after that are measured. */
+    xls_auto_width_t *auto_widths;
     size_t         auto_widths_n;
     int            auto_size_enabled;
     lxlsx_col_t      auto_size_first_col;
     lxlsx_col_t      auto_size_last_col;
+    zend_ulong     auto_size_sample;
+    /* Compiled formulas shared by computeFormula() and evaluateFormula(),
+     * created on first use. They don't depend on the workbook, so the cache
+     * lives until the object is closed. */
+    lxlsx_formula_cache *formula_cache;
 } xls_resource_write_t;
 
 /* Auto-size helpers (forward declarations — defined in kernel/write.c). */
 double xls_estimate_cell_width(zval *value);
+void   xls_auto_size_cell(xls_resource_write_t *res, lxlsx_col_t col, zval *value);
 void   xls_track_auto_width(xls_resource_write_t *res, lxlsx_col_t col, double width);
 void   xls_auto_widths_reset(xls_resource_write_t *res);
 void   xls_auto_widths_apply(xls_resource_write_t *res, lxlsx_col_t first_col, lxlsx_col_t last_col);
 void   xls_auto_widths_flush(xls_resource_write_t *res);
 
+/* Default-timezone offset cache used while converting unix timestamps; see
+ * xls_local_time() in kernel/common.c. batch is set when the cache lives
+ * across many conversions, which makes widening its span worthwhile, and
+ * unsorted once the timestamps turned out not to be in time order. */
+typedef struct {
+    timelib_tzinfo *tz;
+    zend_long       lo;
+    zend_long       hi;
+    zend_long       period;
+    zend_long       offset;
+    uint8_t         ready;
+    uint8_t         batch;
+    uint8_t         unsorted;
+} xls_tz_cache;
+
+/* Date columns marked with dateColumns(), resolved once per data()/header()
+ * call: formats[col] is the date format of a marked column, NULL otherwise. */
+typedef struct {
+    lxlsx_format **formats;
+    lxlsx_col_t    count;
+    xls_tz_cache   tz;
+} xls_date_columns_t;
+
+/* One column of a dataColumns() call: the PHP array holding the column's
+ * values, an iteration cursor into it, and the declared TYPE_* (0 = infer
+ * from each value). */
+typedef struct {
+    HashTable     *values;
+    HashPosition   pos;
+    lxlsx_col_t    col;
+    zend_long      type;
+    lxlsx_format  *format;
+} xls_column_t;
+
 typedef struct {
     lxlsx_format  *format;
 } xls_resource_format_t;
 
+/* A registerFormat() id: the format it stands for, and the last number
+ * format passed along with it to insertText() / insertDate() together with
+ * the format the two resolved to. */
+typedef struct {
+    lxlsx_format  *format;
+    zend_string   *num_format;
+    lxlsx_format  *with_num_format;
+} xls_format_id_t;
+
+/* maps caches the formats built by object_format(); ids is the flat table
+ * behind registerFormat(), indexed by the returned format id. */
 typedef struct {
-    HashTable *maps;
+    HashTable       *maps;
+    xls_format_id_t *ids;
+    uint32_t         ids_count;
+    uint32_t         ids_size;
 } xls_resource_formats_cache_t;
 
+/* Drop the registered ids; defined in kernel/common.c. */
+void xls_format_ids_clean(xls_resource_formats_cache_t *cache);
+
+/* Column => format table resolved once per data()/dataFrom() call from a map
+ * of registered format ids. Columns without an entry stay NULL. */
+typedef struct {
+    lxlsx_format **formats;
+    lxlsx_col_t    count;
+} xls_column_formats_t;
+
 typedef struct {
     lxlsx_data_validation *validation;
 } xls_resource_validation_t;
@@ -133,11 +213,16 @@ typedef struct _vtiful_xls_object {
     xls_resource_formats_cache_t formats_cache_ptr;
     lxlsx_row_col_options          *row_options;
     uint8_t                      compute_formula;  /* auto-evaluate insertFormula */
+    HashTable                    *date_columns;    /* column => date num format */
     zend_object                  zo;
 } xls_object;
 
+/* A Format builder edits a private scratch format; toResource() (and the
+ * other places that consume a Format) interns it into `workbook`, so every
+ * builder with the same properties ends up on one workbook format. */
 typedef struct _vtiful_format_object {
     xls_resource_format_t ptr;
+    lxlsx_workbook *workbook;
     zend_object zo;
 } lxlsx_format_object;
 
@@ -373,6 +458,17 @@ static inline void php_vtiful_reset_reader_state(xls_resource_read_t *read_ptr)
     }
 
     ZVAL_NULL(&read_ptr->pending_real_row);
+
+    if (read_ptr->eval != NULL) {
+        lxlsx_reader_eval_close(read_ptr->eval);
+        read_ptr->eval = NULL;
+    }
+
+    if (read_ptr->sheet_name != NULL) {
+        zend_string_release(read_ptr->sheet_name);
+        read_ptr->sheet_name = NULL;
+    }
+
     read_ptr->cols               = 0;
     read_ptr->expected_row_nr    = 1;
     read_ptr->pending_synth_rows = 0;
@@ -387,6 +483,19 @@ static inline void php_vtiful_close_resource(zend_object *obj) {
 
     SHEET_LINE_INIT(intern);
 
+    /* An openFile() reader borrows from the edit workbook: close it first. */
+    if (intern->read_ptr.sheet_t != NULL) {
+        lxlsx_reader_worksheet_close(intern->read_ptr.sheet_t);
+        intern->read_ptr.sheet_t = NULL;
+    }
+
+    if (intern->read_ptr.file_t != NULL) {
+        lxlsx_reader_workbook_close(intern->read_ptr.file_t);
+        intern->read_ptr.file_t = NULL;
+    }
+
+    php_vtiful_reset_reader_state(&intern->read_ptr);
+
     if (intern->write_ptr.workbook != NULL) {
         lxlsx_workbook_free(intern->write_ptr.workbook);
         intern->write_ptr.workbook = NULL;
@@ -395,6 +504,11 @@ static inline void php_vtiful_close_resource(zend_object *obj) {
 
     xls_auto_widths_reset(&intern->write_ptr);
 
+    if (intern->write_ptr.formula_cache != NULL) {
+        lxlsx_formula_cache_free(intern->write_ptr.formula_cache);
+        intern->write_ptr.formula_cache = NULL;
+    }
+
     if (intern->lxlsx_format_ptr.format != NULL) {
         intern->lxlsx_format_ptr.format = NULL;
     }
@@ -408,23 +522,25 @@ static inline void php_vtiful_close_resource(zend_object *obj) {
         intern->formats_cache_ptr.maps = NULL;
     }
 
+    if (intern->formats_cache_ptr.ids != NULL) {
+        xls_format_ids_clean(&intern->formats_cache_ptr);
+        efree(intern->formats_cache_ptr.ids);
+        intern->formats_cache_ptr.ids = NULL;
+        intern->formats_cache_ptr.ids_count = 0;
+        intern->formats_cache_ptr.ids_size  = 0;
+    }
+
     if (intern->row_options != NULL) {
         efree(intern->row_options);
         intern->row_options = NULL;
     }
 
-    if (intern->read_ptr.sheet_t != NULL) {
-        lxlsx_reader_worksheet_close(intern->read_ptr.sheet_t);
-        intern->read_ptr.sheet_t = NULL;
+    if (intern->date_columns != NULL) {
+        zend_hash_destroy(intern->date_columns);
+        efree(intern->date_columns);
+        intern->date_columns = NULL;
     }
 
-    if (intern->read_ptr.file_t != NULL) {
-        lxlsx_reader_workbook_close(intern->read_ptr.file_t);
-        intern->read_ptr.file_t = NULL;
-    }
-
-    php_vtiful_reset_reader_state(&intern->read_ptr);
-
     intern->read_ptr.data_type_default = READ_TYPE_EMPTY;
 }
 
@@ -455,7 +571,6 @@ void gridlines(xls_resource_write_t *res, zend_long option);
 void printed_scale(xls_resource_write_t *res, zend_long scale);
 void auto_filter(zend_string *range, xls_resource_write_t *res);
 void protection(xls_resource_write_t *res, zend_string *password);
-void lxlsx_format_copy(lxlsx_format *new_format, lxlsx_format *other_format);
 void printed_direction(xls_resource_write_t *res, unsigned int direction);
 void xls_file_path(zend_string *file_name, zval *dir_path, zval *file_path);
 void freeze_panes(xls_resource_write_t *res, zend_long row, zend_long column);
@@ -474,11 +589,15 @@ void image_opt_writer(zval *value, zend_long row, zend_long columns, lxlsx_image
 void formula_writer(zend_string *value, zend_long row, zend_long columns, xls_resource_write_t *res, lxlsx_format *format);
 void formula_writer_calc(zend_string *value, zend_long row, zend_long columns, xls_resource_write_t *res, lxlsx_format *format);
 void formula_resolver(void *ctx, lxlsx_row_t row, lxlsx_col_t col, lxlsx_value *out);
+void formula_range_resolver(void *ctx, lxlsx_row_t first_row, lxlsx_col_t first_col,
+                            lxlsx_row_t last_row, lxlsx_col_t last_col, lxlsx_range_sink *sink);
 void dynamic_formula_writer(zend_string *value, zend_long row, zend_long columns, xls_resource_write_t *res, lxlsx_format *format);
 void dynamic_array_formula_writer(zend_string *value, zend_long first_row, zend_long first_col,
                                   zend_long last_row, zend_long last_col,
                                   xls_resource_write_t *res, lxlsx_format *format);
 void type_writer(zval *value, zend_long row, zend_long columns, xls_resource_write_t *res, zend_string *format, lxlsx_format *lxlsx_format_handle);
+lxlsx_error date_writer(xls_resource_write_t *res, zend_long row, zend_long columns, zend_long local, lxlsx_format *format);
+lxlsx_error columns_writer(xls_column_t *columns, uint32_t count, zend_long row, uint32_t rows, xls_resource_write_t *res, lxlsx_row_col_options *row_options);
 void rich_string_writer(zend_long row, zend_long columns, xls_resource_write_t *res, zval *rich_strings, lxlsx_format *format);
 void datetime_writer(lxlsx_datetime *datetime, zend_long row, zend_long columns, zend_string *format, xls_resource_write_t *res, lxlsx_format *lxlsx_format_handle);
 void url_writer(zend_long row, zend_long columns, xls_resource_write_t *res, zend_string *url, zend_string *text, zend_string *tool_tip, lxlsx_format *format);
@@ -523,9 +642,21 @@ lxlsx_error lxlsx_workbook_file(xls_resource_write_t *self);
 void formula_ast_parse(const char *src, size_t n, zval *return_value);
 
 lxlsx_datetime timestamp_to_datetime(zend_long timestamp);
+lxlsx_datetime xls_local_time_to_datetime(zend_long local);
+void xls_tz_cache_init(xls_tz_cache *cache, int batch);
+zend_long xls_local_time(xls_tz_cache *cache, zend_long timestamp);
+int xls_date_value(xls_tz_cache *cache, zval *value, zend_long *local);
+void xls_date_columns_init(xls_object *obj, xls_date_columns_t *dates, lxlsx_format *lxlsx_format_handle);
+void xls_date_columns_free(xls_date_columns_t *dates);
 zend_string* char_join_to_zend_str(const char *left, const char *right);
 zend_string* str_pick_up(zend_string *left, const char *right, size_t len);
 
 lxlsx_format* object_format(xls_object *obj, zend_string *format, lxlsx_format *lxlsx_format_handle);
+zend_long xls_format_register(xls_object *obj, lxlsx_format *format);
+int xls_format_get(xls_object *obj, zval *handle, lxlsx_format **format);
+lxlsx_format* xls_format_with(xls_object *obj, zval *handle, lxlsx_format *format, zend_string *num_format);
+lxlsx_format *xls_format_object_intern(lxlsx_format_object *obj);
+int xls_column_formats_init(xls_object *obj, xls_column_formats_t *formats, zval *map);
+void xls_column_formats_free(xls_column_formats_t *formats);
 
 #endif
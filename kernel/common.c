@@ -92,23 +92,225 @@ void call_object_method(zval *object, const char *function_name, uint32_t param_
 /* }}} */
 
 /* {{{ */
-lxlsx_datetime timestamp_to_datetime(zend_long timestamp)
+static void xls_tz_lookup(timelib_tzinfo *tz, zend_long timestamp, zend_long *offset, zend_long *period)
+{
+    timelib_time_offset *info = timelib_get_time_zone_info((timelib_sll)timestamp, tz);
+
+    *offset = info->offset;
+    *period = (zend_long)info->transition_time;
+
+    timelib_time_offset_dtor(info);
+}
+/* }}} */
+
+/* {{{ */
+void xls_tz_cache_init(xls_tz_cache *cache, int batch)
+{
+    memset(cache, 0, sizeof(xls_tz_cache));
+    cache->tz    = get_timezone_info();
+    cache->batch = batch != 0;
+}
+/* }}} */
+
+/* {{{ xls_local_time
+ * Shift a unix timestamp into the default timezone. The cache remembers the
+ * offset of one transition period together with the span [lo, hi] known to
+ * lie inside it; a lookup outside that span asks timelib once. A batch cache
+ * then gallops forward so that time-ordered columns stay on the cached offset.
+ * Once a lookup falls behind the span the input isn't time-ordered, and from
+ * then on, as for a one-off conversion, each lookup is a single one. */
+zend_long xls_local_time(xls_tz_cache *cache, zend_long timestamp)
+{
+    zend_long offset, period, next_offset, next_period, step;
+
+    if (cache->tz == NULL) {
+        return timestamp;
+    }
+
+    if (cache->ready && timestamp >= cache->lo && timestamp <= cache->hi) {
+        return timestamp + cache->offset;
+    }
+
+    xls_tz_lookup(cache->tz, timestamp, &offset, &period);
+
+    if (cache->ready && timestamp < cache->hi) {
+        cache->unsorted = 1;
+    }
+
+    if (cache->ready && period == cache->period && offset == cache->offset) {
+        if (timestamp < cache->lo) cache->lo = timestamp;
+        if (timestamp > cache->hi) cache->hi = timestamp;
+    } else {
+        cache->ready  = 1;
+        cache->period = period;
+        cache->offset = offset;
+        cache->lo     = period < timestamp ? period : timestamp;
+        cache->hi     = timestamp;
+    }
+
+    if (!cache->batch || cache->unsorted) {
+        return timestamp + offset;
+    }
+
+    for (step = 86400; step <= 86400 * 256; step *= 2) {
+        xls_tz_lookup(cache->tz, cache->hi + step, &next_offset, &next_period);
+
+        if (next_period != cache->period || next_offset != cache->offset) {
+            break;
+        }
+
+        cache->hi += step;
+    }
+
+    return timestamp + offset;
+}
+/* }}} */
+
+/* {{{ xls_local_time_to_datetime
+ * Split seconds since 1970-01-01 (already in local time) into calendar
+ * fields, using the days-to-civil algorithm from H. Hinnant's date library. */
+lxlsx_datetime xls_local_time_to_datetime(zend_long local)
 {
-    int yearLocal   = php_idate('Y', timestamp, 0);
-    int monthLocal  = php_idate('m', timestamp, 0);
-    int dayLocal    = php_idate('d', timestamp, 0);
-    int hourLocal   = php_idate('H', timestamp, 0);
-    int minuteLocal = php_idate('i', timestamp, 0);
-    int secondLocal = php_idate('s', timestamp, 0);
+    zend_long days = local / 86400, seconds = local % 86400, era, year;
+    unsigned int doe, yoe, doy, mp, month, day;
+
+    if (seconds < 0) {
+        seconds += 86400;
+        days--;
+    }
+
+    days += 719468;
+    era   = (days >= 0 ? days : days - 146096) / 146097;
+    doe   = (unsigned int)(days - era * 146097);
+    yoe   = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    year  = (zend_long)yoe + era * 400;
+    doy   = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp    = (5 * doy + 2) / 153;
+    day   = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
 
     lxlsx_datetime datetime = {
-            yearLocal, monthLocal, dayLocal, hourLocal, minuteLocal, secondLocal
+            (int)(year + (month <= 2)), (int)month, (int)day,
+            (int)(seconds / 3600), (int)(seconds % 3600 / 60), (double)(seconds % 60)
     };
 
     return datetime;
 }
 /* }}} */
 
+/* {{{ xls_date_value
+ * Resolve a date cell value, a unix timestamp or a DateTimeInterface, to
+ * local seconds since 1970-01-01. DateTimeInterface values keep their own
+ * timezone. */
+int xls_date_value(xls_tz_cache *cache, zval *value, zend_long *local)
+{
+    ZVAL_DEREF(value);
+
+    if (Z_TYPE_P(value) == IS_LONG) {
+        *local = xls_local_time(cache, Z_LVAL_P(value));
+        return SUCCESS;
+    }
+
+    if (Z_TYPE_P(value) == IS_OBJECT && instanceof_function(Z_OBJCE_P(value), php_date_get_interface_ce())) {
+        php_date_obj *date = Z_PHPDATE_P(value);
+        zend_long year, month, era;
+        unsigned int yoe, doy, doe;
+
+        if (date->time == NULL) {
+            return FAILURE;
+        }
+
+        /* civil-to-days, the inverse of xls_local_time_to_datetime() */
+        year  = (zend_long)date->time->y;
+        month = (zend_long)date->time->m;
+        year -= month <= 2;
+        era   = (year >= 0 ? year : year - 399) / 400;
+        yoe   = (unsigned int)(year - era * 400);
+        doy   = (unsigned int)((153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + date->time->d - 1);
+        doe   = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+        *local = (era * 146097 + (zend_long)doe - 719468) * 86400
+                 + (zend_long)(date->time->h * 3600 + date->time->i * 60 + date->time->s);
+        return SUCCESS;
+    }
+
+    return FAILURE;
+}
+/* }}} */
+
+/* {{{ xls_date_columns_init
+ * Resolve the columns marked with dateColumns() into a flat column => format
+ * table for one write call. Unmarked columns stay NULL. */
+void xls_date_columns_init(xls_object *obj, xls_date_columns_t *dates, lxlsx_format *lxlsx_format_handle)
+{
+    zend_ulong col;
+    zval *format;
+    zend_string *default_format = NULL;
+
+    memset(dates, 0, sizeof(xls_date_columns_t));
+
+    if (obj->date_columns == NULL || zend_hash_num_elements(obj->date_columns) == 0) {
+        return;
+    }
+
+    ZEND_HASH_FOREACH_NUM_KEY(obj->date_columns, col) {
+        if (col >= dates->count) {
+            dates->count = (lxlsx_col_t)(col + 1);
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    dates->formats = ecalloc(dates->count, sizeof(lxlsx_format *));
+
+    ZEND_HASH_FOREACH_NUM_KEY_VAL(obj->date_columns, col, format) {
+        if (Z_TYPE_P(format) == IS_STRING && Z_STRLEN_P(format) > 0) {
+            dates->formats[col] = object_format(obj, Z_STR_P(format), lxlsx_format_handle);
+            continue;
+        }
+
+        if (Z_TYPE_P(format) == IS_LONG && (zend_ulong)Z_LVAL_P(format) < obj->formats_cache_ptr.ids_count) {
+            dates->formats[col] = obj->formats_cache_ptr.ids[Z_LVAL_P(format)].format;
+            continue;
+        }
+
+        if (default_format == NULL) {
+            default_format = zend_string_init(ZEND_STRL("yyyy-mm-dd hh:mm:ss"), 0);
+        }
+
+        dates->formats[col] = object_format(obj, default_format, lxlsx_format_handle);
+    } ZEND_HASH_FOREACH_END();
+
+    if (default_format != NULL) {
+        zend_string_release(default_format);
+    }
+
+    xls_tz_cache_init(&dates->tz, 1);
+}
+/* }}} */
+
+/* {{{ */
+void xls_date_columns_free(xls_date_columns_t *dates)
+{
+    if (dates->formats != NULL) {
+        efree(dates->formats);
+        dates->formats = NULL;
+    }
+}
+/* }}} */
+
+/* {{{ */
+lxlsx_datetime timestamp_to_datetime(zend_long timestamp)
+{
+    timelib_tzinfo *tz = get_timezone_info();
+    zend_long offset = 0, period = 0;
+
+    if (tz != NULL) {
+        xls_tz_lookup(tz, timestamp, &offset, &period);
+    }
+
+    return xls_local_time_to_datetime(timestamp + offset);
+}
+/* }}} */
+
 /* {{{ */
 lxlsx_format* object_format(xls_object *obj, zend_string *format, lxlsx_format *lxlsx_format_handle)
 {
@@ -138,7 +340,12 @@ lxlsx_format* object_format(xls_object *obj, zend_string *format, lxlsx_format *
             return (lxlsx_format *)exit_format;
         }
 
-        lxlsx_format *new_format = lxlsx_workbook_add_format((&obj->write_ptr)->workbook);
+        lxlsx_format scratch;
+
+        memcpy(&scratch, lxlsx_format_handle, sizeof(lxlsx_format));
+        lxlsx_format_set_num_format(&scratch, ZSTR_VAL(format));
+
+        lxlsx_format *new_format = lxlsx_workbook_intern_format((&obj->write_ptr)->workbook, &scratch);
 
         if (new_format == NULL) {
             zend_string_release(_format_key);
@@ -146,9 +353,6 @@ lxlsx_format* object_format(xls_object *obj, zend_string *format, lxlsx_format *
             return lxlsx_format_handle;
         }
 
-        lxlsx_format_copy(new_format, lxlsx_format_handle);
-        lxlsx_format_set_num_format(new_format, ZSTR_VAL(format));
-
         zend_hash_str_add_ptr(obj->formats_cache_ptr.maps, ZSTR_VAL(_format_key), ZSTR_LEN(_format_key), new_format);
 
         zend_string_release(_format_key);
@@ -167,13 +371,21 @@ lxlsx_format* object_format(xls_object *obj, zend_string *format, lxlsx_format *
             return (lxlsx_format *)exit_format;
         }
 
-        lxlsx_format *new_format = lxlsx_workbook_add_format((&obj->write_ptr)->workbook);
+        lxlsx_format *scratch = lxlsx_format_new();
 
-        if (new_format == NULL) {
+        if (scratch == NULL) {
             return NULL;
         }
 
-        lxlsx_format_set_num_format(new_format, ZSTR_VAL(format));
+        lxlsx_format_set_num_format(scratch, ZSTR_VAL(format));
+
+        lxlsx_format *new_format = lxlsx_workbook_intern_format((&obj->write_ptr)->workbook, scratch);
+
+        lxlsx_format_free(scratch);
+
+        if (new_format == NULL) {
+            return NULL;
+        }
 
         zend_hash_str_add_ptr(obj->formats_cache_ptr.maps, ZSTR_VAL(format), ZSTR_LEN(format), new_format);
 
@@ -182,4 +394,169 @@ lxlsx_format* object_format(xls_object *obj, zend_string *format, lxlsx_format *
 
     return lxlsx_format_handle;
 }
-/* }}} */
\ No newline at end of file
+/* }}} */
+/* {{{ xls_format_register
+ * Append a resolved format to the registerFormat() table and return its id.
+ * Registering the same format twice returns the id it already has. */
+zend_long xls_format_register(xls_object *obj, lxlsx_format *format)
+{
+    xls_resource_formats_cache_t *cache = &obj->formats_cache_ptr;
+    uint32_t id;
+
+    for (id = 0; id < cache->ids_count; ++id) {
+        if (cache->ids[id].format == format) {
+            return id;
+        }
+    }
+
+    if (cache->ids_count == cache->ids_size) {
+        cache->ids_size = cache->ids_size == 0 ? 8 : cache->ids_size * 2;
+        cache->ids      = erealloc(cache->ids, cache->ids_size * sizeof(xls_format_id_t));
+    }
+
+    cache->ids[cache->ids_count].format          = format;
+    cache->ids[cache->ids_count].num_format      = NULL;
+    cache->ids[cache->ids_count].with_num_format = NULL;
+
+    return cache->ids_count++;
+}
+/* }}} */
+
+/* {{{ xls_format_ids_clean */
+void xls_format_ids_clean(xls_resource_formats_cache_t *cache)
+{
+    uint32_t id;
+
+    for (id = 0; id < cache->ids_count; ++id) {
+        if (cache->ids[id].num_format != NULL) {
+            zend_string_release(cache->ids[id].num_format);
+        }
+    }
+
+    cache->ids_count = 0;
+}
+/* }}} */
+
+/* {{{ xls_format_with
+ * object_format() for insertText() and insertDate(). A registered id given
+ * with a number format remembers the last format the pair resolved to, so
+ * a loop passing the same pair skips building the cache key and its lookup. */
+lxlsx_format* xls_format_with(xls_object *obj, zval *handle, lxlsx_format *format, zend_string *num_format)
+{
+    xls_format_id_t *id;
+
+    if (handle == NULL || Z_TYPE_P(handle) != IS_LONG || num_format == NULL || ZSTR_LEN(num_format) == 0) {
+        return object_format(obj, num_format, format);
+    }
+
+    id = &obj->formats_cache_ptr.ids[Z_LVAL_P(handle)];
+
+    if (id->num_format != NULL && zend_string_equals(id->num_format, num_format)) {
+        return id->with_num_format;
+    }
+
+    if (id->num_format != NULL) {
+        zend_string_release(id->num_format);
+    }
+
+    id->num_format      = zend_string_copy(num_format);
+    id->with_num_format = object_format(obj, num_format, format);
+
+    return id->with_num_format;
+}
+/* }}} */
+
+/* {{{ xls_format_get
+ * Resolve a format argument that is either a format resource or an id
+ * returned by registerFormat(). NULL leaves *format untouched. */
+int xls_format_get(xls_object *obj, zval *handle, lxlsx_format **format)
+{
+    if (handle == NULL || Z_TYPE_P(handle) == IS_NULL) {
+        return SUCCESS;
+    }
+
+    if (Z_TYPE_P(handle) == IS_LONG) {
+        if (Z_LVAL_P(handle) < 0 || (zend_ulong)Z_LVAL_P(handle) >= obj->formats_cache_ptr.ids_count) {
+            zend_throw_exception(vtiful_exception_ce, "Format id is not registered", 240);
+            return FAILURE;
+        }
+
+        *format = obj->formats_cache_ptr.ids[Z_LVAL_P(handle)].format;
+        return SUCCESS;
+    }
+
+    if (Z_TYPE_P(handle) == IS_RESOURCE) {
+        *format = zval_get_format(handle);
+        return EG(exception) ? FAILURE : SUCCESS;
+    }
+
+    zend_throw_exception(vtiful_exception_ce, "Format must be a format resource or a registered format id", 240);
+    return FAILURE;
+}
+/* }}} */
+
+/* {{{ xls_column_formats_init
+ * Resolve a column => format id map ("B", "B:D" or an int column as key) into
+ * a flat column => format table for one write call. */
+int xls_column_formats_init(xls_object *obj, xls_column_formats_t *formats, zval *map)
+{
+    zend_ulong index;
+    zend_string *key;
+    zval *handle;
+    lxlsx_col_t col, first_col, last_col;
+
+    memset(formats, 0, sizeof(xls_column_formats_t));
+
+    if (map == NULL || zend_hash_num_elements(Z_ARRVAL_P(map)) == 0) {
+        return SUCCESS;
+    }
+
+    ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(map), index, key, handle) {
+        lxlsx_format *format = NULL;
+
+        if (key == NULL) {
+            first_col = last_col = (lxlsx_col_t)index;
+        } else {
+            first_col = lxlsx_name_to_col(ZSTR_VAL(key));
+            last_col  = strchr(ZSTR_VAL(key), ':') ? lxlsx_name_to_col_2(ZSTR_VAL(key)) : first_col;
+        }
+
+        if ((key == NULL && index >= LXLSX_COL_MAX) || first_col > last_col || last_col >= LXLSX_COL_MAX) {
+            xls_column_formats_free(formats);
+            zend_throw_exception(vtiful_exception_ce, "Worksheet row or column index out of range", 180);
+            return FAILURE;
+        }
+
+        ZVAL_DEREF(handle);
+
+        if (xls_format_get(obj, handle, &format) == FAILURE) {
+            xls_column_formats_free(formats);
+            return FAILURE;
+        }
+
+        if (last_col >= formats->count) {
+            formats->formats = erealloc(formats->formats, (last_col + 1) * sizeof(lxlsx_format *));
+            memset(formats->formats + formats->count, 0, (last_col + 1 - formats->count) * sizeof(lxlsx_format *));
+            formats->count = last_col + 1;
+        }
+
+        for (col = first_col; col <= last_col; col++) {
+            formats->formats[col] = format;
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    return SUCCESS;
+}
+/* }}} */
+
+/* {{{ */
+void xls_column_formats_free(xls_column_formats_t *formats)
+{
+    if (formats->formats != NULL) {
+        efree(formats->formats);
+        formats->formats = NULL;
+    }
+
+    formats->count = 0;
+}
+/* }}} */
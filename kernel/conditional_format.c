@@ -355,7 +355,7 @@ PHP_METHOD(vtiful_cond_format, format)
         fmt = (lxlsx_format *)zend_fetch_resource(Z_RES_P(handle), VTIFUL_RESOURCE_NAME, le_xls_writer);
     } else if (Z_TYPE_P(handle) == IS_OBJECT && instanceof_function(Z_OBJCE_P(handle), vtiful_format_ce)) {
         lxlsx_format_object *fo = Z_FORMAT_P(handle);
-        fmt = fo->ptr.format;
+        fmt = xls_format_object_intern(fo);
     }
 
     CF_FIELD()->format = fmt;
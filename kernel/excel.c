@@ -36,12 +36,16 @@ static void reset_write_workbook_state(xls_object *obj)
 
     xls_auto_widths_reset(&obj->write_ptr);
     obj->write_ptr.auto_size_enabled = 0;
+    obj->write_ptr.auto_size_sample = 0;
     obj->lxlsx_format_ptr.format = NULL;
 
     if (obj->formats_cache_ptr.maps != NULL) {
         zend_hash_clean(obj->formats_cache_ptr.maps);
     }
 
+    /* Registered ids point into the workbook that was just freed. */
+    xls_format_ids_clean(&obj->formats_cache_ptr);
+
     if (obj->row_options != NULL) {
         efree(obj->row_options);
         obj->row_options = NULL;
@@ -72,14 +76,20 @@ PHP_VTIFUL_API zend_object *vtiful_xls_objects_new(zend_class_entry *ce)
 
     intern->read_ptr.file_t  = NULL;
     intern->read_ptr.sheet_t = NULL;
+    intern->read_ptr.eval    = NULL;
+    intern->read_ptr.sheet_name = NULL;
     ZVAL_NULL(&intern->read_ptr.pending_real_row);
     php_vtiful_reset_reader_state(&intern->read_ptr);
 
     intern->lxlsx_format_ptr.format  = NULL;
     intern->write_ptr.workbook = NULL;
     intern->row_options        = NULL;
+    intern->date_columns       = NULL;
 
-    intern->formats_cache_ptr.maps = formats_cache_ht;
+    intern->formats_cache_ptr.maps      = formats_cache_ht;
+    intern->formats_cache_ptr.ids       = NULL;
+    intern->formats_cache_ptr.ids_count = 0;
+    intern->formats_cache_ptr.ids_size  = 0;
 
     intern->read_ptr.data_type_default = READ_TYPE_EMPTY;
 
@@ -117,6 +127,7 @@ ZEND_BEGIN_ARG_INFO_EX(xls_const_memory_arginfo, 0, 0, 1)
                 ZEND_ARG_INFO(0, file_name)
                 ZEND_ARG_INFO(0, sheet_name)
                 ZEND_ARG_INFO(0, use_zip64)
+                ZEND_ARG_INFO(0, row_window)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_file_add_sheet, 0, 0, 1)
@@ -142,6 +153,18 @@ ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_data_arginfo, 0, 0, 1)
                 ZEND_ARG_INFO(0, data)
+                ZEND_ARG_INFO(0, formats)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(xls_data_from_arginfo, 0, 0, 1)
+                ZEND_ARG_INFO(0, rows)
+                ZEND_ARG_INFO(0, formats)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(xls_data_columns_arginfo, 0, 0, 1)
+                ZEND_ARG_INFO(0, columns)
+                ZEND_ARG_INFO(0, types)
+                ZEND_ARG_INFO(0, formats)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_output_arginfo, 0, 0, 0)
@@ -166,6 +189,10 @@ ZEND_BEGIN_ARG_INFO_EX(xls_insert_rtext_arginfo, 0, 0, 3)
                 ZEND_ARG_INFO(0, lxlsx_format_handle)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(xls_date_columns_arginfo, 0, 0, 1)
+                ZEND_ARG_INFO(0, columns)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(xls_insert_date_arginfo, 0, 0, 3)
                 ZEND_ARG_INFO(0, row)
                 ZEND_ARG_INFO(0, column)
@@ -270,6 +297,7 @@ ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_auto_size_arginfo, 0, 0, 0)
                 ZEND_ARG_INFO(0, range)
+                ZEND_ARG_INFO(0, sample_rows)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_get_curr_line_arginfo, 0, 0, 0)
@@ -290,6 +318,11 @@ ZEND_BEGIN_ARG_INFO_EX(xls_set_global_format, 0, 0, 1)
                 ZEND_ARG_INFO(0, lxlsx_format_handle)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(xls_register_format_arginfo, 0, 0, 1)
+                ZEND_ARG_INFO(0, lxlsx_format_handle)
+                ZEND_ARG_INFO(0, format)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(xls_set_default_row_options_arginfo, 0, 0, 0)
                 ZEND_ARG_INFO(0, level)
                 ZEND_ARG_INFO(0, collapsed)
@@ -305,6 +338,7 @@ ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_open_file_arginfo, 0, 0, 1)
                 ZEND_ARG_INFO(0, zs_file_name)
+                ZEND_ARG_INFO(0, cache_template)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_open_sheet_arginfo, 0, 0, 0)
@@ -312,6 +346,21 @@ ZEND_BEGIN_ARG_INFO_EX(xls_open_sheet_arginfo, 0, 0, 0)
                 ZEND_ARG_INFO(0, zl_flag)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(xls_append_rows_arginfo, 0, 0, 0)
+                ZEND_ARG_INFO(0, shared_strings)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(xls_concat_arginfo, 0, 0, 2)
+                ZEND_ARG_INFO(0, paths)
+                ZEND_ARG_INFO(0, zs_file_name)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(xls_extract_sheet_arginfo, 0, 0, 3)
+                ZEND_ARG_INFO(0, zs_source_name)
+                ZEND_ARG_INFO(0, zs_sheet_name)
+                ZEND_ARG_INFO(0, zs_file_name)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(xls_put_csv_arginfo, 0, 0, 1)
                 ZEND_ARG_INFO(0, fp)
                 ZEND_ARG_INFO(0, delimiter_str)
@@ -377,6 +426,12 @@ ZEND_BEGIN_ARG_INFO_EX(xls_compute_formula_arginfo, 0, 0, 0)
     ZEND_ARG_INFO(0, enable)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(xls_formula_cache_stats_arginfo, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(xls_template_cache_stats_arginfo, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(xls_get_page_setup_arginfo, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
@@ -421,6 +476,7 @@ ZEND_BEGIN_ARG_INFO_EX(xls_next_cell_callback_arginfo, 0, 0, 1)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_next_row_with_formula_arginfo, 0, 0, 0)
+                ZEND_ARG_INFO(0, evaluate)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(xls_get_style_format_arginfo, 0, 0, 1)
@@ -799,24 +855,35 @@ PHP_METHOD(vtiful_xls, activateSheet)
 }
 /* }}} */
 
-/** {{{ \Vtiful\Kernel\Excel::constMemory(string $fileName [, string $sheetName])
+/** {{{ \Vtiful\Kernel\Excel::constMemory(string $fileName [, string $sheetName, bool $useZip64, int $rowWindow])
+ *
+ * $rowWindow keeps the last N rows of the sheet in memory: cells in those rows
+ * can still be written (or read back by formula evaluation) until a row more
+ * than N rows further down is written. 0 keeps the single-row behaviour.
  */
 PHP_METHOD(vtiful_xls, constMemory)
 {
     char *sheet_name = NULL;
     zend_bool use_zip64 = LXLSX_TRUE;
+    zend_long row_window = 0;
     zval file_path, *dir_path = NULL;
     zend_string *zs_file_name = NULL, *zs_sheet_name = NULL;
 
-    ZEND_PARSE_PARAMETERS_START(1, 3)
+    ZEND_PARSE_PARAMETERS_START(1, 4)
             Z_PARAM_STR(zs_file_name)
             Z_PARAM_OPTIONAL
             Z_PARAM_STR_OR_NULL(zs_sheet_name)
             Z_PARAM_BOOL_OR_NULL(use_zip64, _dummy)
+            Z_PARAM_LONG(row_window)
     ZEND_PARSE_PARAMETERS_END();
 
     if (reject_empty_sheet_name(zs_sheet_name)) return;
 
+    if (row_window < 0 || row_window > LXLSX_ROW_MAX) {
+        zend_throw_exception(vtiful_exception_ce, "Invalid const memory row window", 130);
+        return;
+    }
+
     ZVAL_COPY(return_value, getThis());
 
     GET_CONFIG_PATH(dir_path, vtiful_xls_ce, PROP_OBJ(return_value));
@@ -829,7 +896,8 @@ PHP_METHOD(vtiful_xls, constMemory)
         lxlsx_workbook_options options = {
             .constant_memory = LXLSX_TRUE,
             .tmpdir = NULL,
-            .use_zip64 = use_zip64
+            .use_zip64 = use_zip64,
+            .constant_memory_window = (lxlsx_row_t) row_window
         };
 
         if(zs_sheet_name != NULL) {
@@ -896,8 +964,9 @@ PHP_METHOD(vtiful_xls, getCurrentLine)
  */
 PHP_METHOD(vtiful_xls, header)
 {
-    zend_long header_l_key;
+    zend_long header_l_key, local;
     lxlsx_format *lxlsx_format_handle = NULL;
+    xls_date_columns_t dates;
     zval *header = NULL, *header_value = NULL, *zv_format_handle = NULL;;
 
     ZEND_PARSE_PARAMETERS_START(1, 2)
@@ -929,10 +998,25 @@ PHP_METHOD(vtiful_xls, header)
         lxlsx_format_handle = zval_get_format(zv_format_handle);
     }
 
+    xls_date_columns_init(obj, &dates, lxlsx_format_handle);
+
     ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL_P(header), header_l_key, header_value)
-         type_writer(header_value, 0, header_l_key, &obj->write_ptr, NULL, object_format(obj, NULL, lxlsx_format_handle));
+        if ((zend_ulong)header_l_key < dates.count && dates.formats[header_l_key] != NULL
+            && xls_date_value(&dates.tz, header_value, &local) == SUCCESS) {
+            lxlsx_error error = date_writer(&obj->write_ptr, 0, header_l_key, local, dates.formats[header_l_key]);
+
+            if (error != LXLSX_NO_ERROR) {
+                xls_date_columns_free(&dates);
+                WORKSHEET_WRITER_EXCEPTION(error);
+            }
+            continue;
+        }
+
+        type_writer(header_value, 0, header_l_key, &obj->write_ptr, NULL, object_format(obj, NULL, lxlsx_format_handle));
     ZEND_HASH_FOREACH_END();
 
+    xls_date_columns_free(&dates);
+
     // When inserting the header for the first time, the row number is incremented by one,
     // and there is no need to increment by one again for subsequent calls.
     if (obj->write_line == 0) {
@@ -941,16 +1025,66 @@ PHP_METHOD(vtiful_xls, header)
 }
 /* }}} */
 
-/** {{{ \Vtiful\Kernel\Excel::data(array $data)
- */
-PHP_METHOD(vtiful_xls, data)
+/* Write one data() row at the current line and advance it. Non-array rows
+ * are skipped without consuming a line. Timestamps and DateTimeInterface
+ * values in columns marked by dateColumns() are written as dates. */
+static void xls_data_row(xls_object *obj, zval *data_r_value, xls_date_columns_t *dates, xls_column_formats_t *formats)
 {
     zend_ulong column_index = 0, index;
     zend_string *key;
-    zval *data = NULL, *data_r_value = NULL;
+    zval *data = NULL;
+    zend_long local;
 
-    ZEND_PARSE_PARAMETERS_START(1, 1)
+    ZVAL_DEREF(data_r_value);
+
+    if(Z_TYPE_P(data_r_value) != IS_ARRAY) {
+        return;
+    }
+
+    if (obj->row_options != NULL) {
+        WORKSHEET_WRITER_EXCEPTION(
+                lxlsx_worksheet_set_row_opt(obj->write_ptr.worksheet, SHEET_CURRENT_LINE(obj), LXLSX_DEF_ROW_HEIGHT, NULL, obj->row_options));
+    }
+
+    ZEND_HASH_FOREACH_KEY_VAL_IND(Z_ARRVAL_P(data_r_value), index, key, data) {
+        // numeric index rewriting
+        if (key == NULL) {
+            column_index = index;
+        }
+
+        if (column_index < dates->count && dates->formats[column_index] != NULL
+            && xls_date_value(&dates->tz, data, &local) == SUCCESS) {
+            WORKSHEET_WRITER_EXCEPTION(
+                    date_writer(&obj->write_ptr, SHEET_CURRENT_LINE(obj), column_index, local, dates->formats[column_index]));
+        } else if (column_index < formats->count && formats->formats[column_index] != NULL) {
+            type_writer(data, SHEET_CURRENT_LINE(obj), column_index, &obj->write_ptr, NULL, formats->formats[column_index]);
+        } else {
+            type_writer(data, SHEET_CURRENT_LINE(obj), column_index, &obj->write_ptr, NULL,
+                        object_format(obj, NULL, obj->lxlsx_format_ptr.format));
+        }
+
+        // next number index
+        ++column_index;
+    } ZEND_HASH_FOREACH_END();
+
+    SHEET_LINE_ADD(obj)
+}
+
+/** {{{ \Vtiful\Kernel\Excel::data(array $data[, array $formats])
+ *
+ * $formats maps a column (int or "B" / "B:D") to a format id returned by
+ * registerFormat().
+ */
+PHP_METHOD(vtiful_xls, data)
+{
+    zval *data = NULL, *data_r_value = NULL, *formats_map = NULL;
+    xls_date_columns_t dates;
+    xls_column_formats_t formats;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
             Z_PARAM_ARRAY(data)
+            Z_PARAM_OPTIONAL
+            Z_PARAM_ARRAY_OR_NULL(formats_map)
     ZEND_PARSE_PARAMETERS_END();
 
     ZVAL_COPY(return_value, getThis());
@@ -959,36 +1093,222 @@ PHP_METHOD(vtiful_xls, data)
 
     WORKBOOK_NOT_INITIALIZED(obj);
 
+    if (xls_column_formats_init(obj, &formats, formats_map) == FAILURE) {
+        return;
+    }
+
+    xls_date_columns_init(obj, &dates, obj->lxlsx_format_ptr.format);
+
     ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(data), data_r_value)
-        if (Z_TYPE_P(data_r_value) == IS_REFERENCE) {
-            data_r_value = Z_REFVAL_P(data_r_value);
+        xls_data_row(obj, data_r_value, &dates, &formats);
+
+        if (EG(exception)) {
+            break;
         }
+    ZEND_HASH_FOREACH_END();
 
-        if(Z_TYPE_P(data_r_value) != IS_ARRAY) {
-            continue;
+    xls_date_columns_free(&dates);
+    xls_column_formats_free(&formats);
+}
+/* }}} */
+
+/** {{{ \Vtiful\Kernel\Excel::dataFrom(iterable $rows [, array $formats])
+ *
+ * Same as data(), but pulls the rows from an array or any Traversable
+ * (Generator, Iterator, IteratorAggregate, PDOStatement) through the engine
+ * iterator, so each row is written and released before the next one is
+ * fetched. $formats is the same column map as data().
+ */
+PHP_METHOD(vtiful_xls, dataFrom)
+{
+    zval *rows = NULL, *data_r_value = NULL, *formats_map = NULL;
+    zend_object_iterator *iter = NULL;
+    zend_class_entry *ce = NULL;
+    xls_date_columns_t dates;
+    xls_column_formats_t formats;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+            Z_PARAM_ZVAL(rows)
+            Z_PARAM_OPTIONAL
+            Z_PARAM_ARRAY_OR_NULL(formats_map)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ZVAL_COPY(return_value, getThis());
+
+    xls_object *obj = Z_XLS_P(getThis());
+
+    WORKBOOK_NOT_INITIALIZED(obj);
+
+    if (Z_TYPE_P(rows) != IS_ARRAY && (Z_TYPE_P(rows) != IS_OBJECT || (ce = Z_OBJCE_P(rows))->get_iterator == NULL)) {
+        zend_throw_exception(vtiful_exception_ce, "The rows must be an array or Traversable", 230);
+        return;
+    }
+
+    if (xls_column_formats_init(obj, &formats, formats_map) == FAILURE) {
+        return;
+    }
+
+    xls_date_columns_init(obj, &dates, obj->lxlsx_format_ptr.format);
+
+    if (Z_TYPE_P(rows) == IS_ARRAY) {
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(rows), data_r_value)
+            xls_data_row(obj, data_r_value, &dates, &formats);
+
+            if (EG(exception)) {
+                break;
+            }
+        ZEND_HASH_FOREACH_END();
+
+        xls_date_columns_free(&dates);
+        xls_column_formats_free(&formats);
+        return;
+    }
+
+    iter = ce->get_iterator(ce, rows, 0);
+    if (iter == NULL || EG(exception)) {
+        if (iter != NULL) {
+            zend_iterator_dtor(iter);
         }
+        xls_date_columns_free(&dates);
+        xls_column_formats_free(&formats);
+        return;
+    }
 
-        if (obj->row_options != NULL) {
-            WORKSHEET_WRITER_EXCEPTION(
-                    lxlsx_worksheet_set_row_opt(obj->write_ptr.worksheet, SHEET_CURRENT_LINE(obj), LXLSX_DEF_ROW_HEIGHT, NULL, obj->row_options));
+    if (iter->funcs->rewind) {
+        iter->funcs->rewind(iter);
+    }
+
+    while (!EG(exception) && iter->funcs->valid(iter) == SUCCESS) {
+        data_r_value = iter->funcs->get_current_data(iter);
+        if (EG(exception) || data_r_value == NULL) {
+            break;
+        }
+
+        xls_data_row(obj, data_r_value, &dates, &formats);
+        if (EG(exception)) {
+            break;
+        }
+
+        iter->funcs->move_forward(iter);
+    }
+
+    zend_iterator_dtor(iter);
+    xls_date_columns_free(&dates);
+    xls_column_formats_free(&formats);
+}
+/* }}} */
+
+/** {{{ \Vtiful\Kernel\Excel::dataColumns(array $columns [, array $types, array $formats])
+ *
+ * Column-shaped counterpart of data(): $columns holds one array of values per
+ * column, $types maps a column key to Excel::TYPE_INT, TYPE_DOUBLE,
+ * TYPE_STRING, TYPE_TIMESTAMP or TYPE_BOOL. Columns without a type are
+ * inferred per value like data(). $formats maps a column key to a format id
+ * from registerFormat(). Rows are written from the current line.
+ */
+PHP_METHOD(vtiful_xls, dataColumns)
+{
+    uint32_t count = 0, rows = 0;
+    zend_ulong column_index = 0, index;
+    zend_string *key, *date_format = NULL;
+    zval *columns = NULL, *types = NULL, *formats_map = NULL, *column_value = NULL, *type = NULL;
+    xls_column_t *column_list = NULL;
+    xls_column_formats_t formats;
+    lxlsx_error error;
+
+    ZEND_PARSE_PARAMETERS_START(1, 3)
+            Z_PARAM_ARRAY(columns)
+            Z_PARAM_OPTIONAL
+            Z_PARAM_ARRAY_OR_NULL(types)
+            Z_PARAM_ARRAY_OR_NULL(formats_map)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ZVAL_COPY(return_value, getThis());
+
+    xls_object *obj = Z_XLS_P(getThis());
+
+    WORKBOOK_NOT_INITIALIZED(obj);
+
+    if (zend_hash_num_elements(Z_ARRVAL_P(columns)) == 0) {
+        return;
+    }
+
+    if (xls_column_formats_init(obj, &formats, formats_map) == FAILURE) {
+        return;
+    }
+
+    column_list = ecalloc(zend_hash_num_elements(Z_ARRVAL_P(columns)), sizeof(xls_column_t));
+
+    ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(columns), index, key, column_value) {
+        // numeric index rewriting
+        if (key == NULL) {
+            column_index = index;
         }
 
-        column_index = 0;
+        ZVAL_DEREF(column_value);
+
+        if (Z_TYPE_P(column_value) == IS_ARRAY && column_index < LXLSX_COL_MAX) {
+            xls_column_t *column = &column_list[count++];
+
+            column->values = Z_ARRVAL_P(column_value);
+            column->col    = (lxlsx_col_t)column_index;
+            column->type   = READ_TYPE_EMPTY;
 
-        ZEND_HASH_FOREACH_KEY_VAL_IND(Z_ARRVAL_P(data_r_value), index, key, data) {
-            // numeric index rewriting
-            if (key == NULL) {
-                column_index = index;
+            if (types != NULL) {
+                type = key == NULL ? zend_hash_index_find(Z_ARRVAL_P(types), index) : zend_hash_find(Z_ARRVAL_P(types), key);
             }
-            type_writer(data, SHEET_CURRENT_LINE(obj), column_index, &obj->write_ptr, NULL,
-                        object_format(obj, NULL, obj->lxlsx_format_ptr.format));
 
-            // next number index
-            ++column_index;
-        } ZEND_HASH_FOREACH_END();
+            if (type != NULL) {
+                column->type = zval_get_long(type);
+                type = NULL;
 
-        SHEET_LINE_ADD(obj)
-    ZEND_HASH_FOREACH_END();
+                if (column->type != READ_TYPE_INT && column->type != READ_TYPE_DOUBLE && column->type != READ_TYPE_STRING
+                    && column->type != READ_TYPE_DATETIME && column->type != WRITE_TYPE_BOOL) {
+                    efree(column_list);
+                    xls_column_formats_free(&formats);
+
+                    if (date_format != NULL) {
+                        zend_string_release(date_format);
+                    }
+
+                    zend_throw_exception(vtiful_exception_ce, "Invalid data type", 220);
+                    return;
+                }
+            }
+
+            if (column_index < formats.count && formats.formats[column_index] != NULL) {
+                column->format = formats.formats[column_index];
+            } else if (column->type == READ_TYPE_DATETIME) {
+                if (date_format == NULL) {
+                    date_format = zend_string_init(ZEND_STRL("yyyy-mm-dd hh:mm:ss"), 0);
+                }
+
+                column->format = object_format(obj, date_format, obj->lxlsx_format_ptr.format);
+            } else {
+                column->format = object_format(obj, NULL, obj->lxlsx_format_ptr.format);
+            }
+
+            if (zend_hash_num_elements(column->values) > rows) {
+                rows = zend_hash_num_elements(column->values);
+            }
+        }
+
+        // next number index
+        ++column_index;
+    } ZEND_HASH_FOREACH_END();
+
+    if (date_format != NULL) {
+        zend_string_release(date_format);
+    }
+
+    error = columns_writer(column_list, count, SHEET_CURRENT_LINE(obj), rows, &obj->write_ptr, obj->row_options);
+
+    efree(column_list);
+    xls_column_formats_free(&formats);
+
+    WORKSHEET_WRITER_EXCEPTION(error);
+
+    SHEET_LINE_SET(obj, SHEET_CURRENT_LINE(obj) + rows);
 }
 /* }}} */
 
@@ -1047,7 +1367,20 @@ PHP_METHOD(vtiful_xls, output)
     /* Apply any tracked auto-size widths before the workbook is packaged. */
     xls_auto_widths_flush(&obj->write_ptr);
 
-    error = lxlsx_workbook_file(&obj->write_ptr);
+    /* With every cell written now, evaluate the formulas in dependency order
+     * and store their results. */
+    error = LXLSX_NO_ERROR;
+    if (obj->compute_formula) {
+        if (obj->write_ptr.formula_cache == NULL) {
+            obj->write_ptr.formula_cache = lxlsx_formula_cache_new(0);
+        }
+        error = lxlsx_recalc_workbook(obj->write_ptr.workbook,
+                                      obj->write_ptr.formula_cache, NULL);
+    }
+
+    if (error == LXLSX_NO_ERROR) {
+        error = lxlsx_workbook_file(&obj->write_ptr);
+    }
     if (error > LXLSX_NO_ERROR) {
         if (filename_replaced) {
             free(obj->write_ptr.workbook->filename);
@@ -1087,7 +1420,7 @@ PHP_METHOD(vtiful_xls, getHandle)
 }
 /* }}} */
 
-/** {{{ \Vtiful\Kernel\Excel::insertText(int $row, int $column, string|int|double $data[, string $format, resource $formatHandle])
+/** {{{ \Vtiful\Kernel\Excel::insertText(int $row, int $column, string|int|double $data[, string $format, resource|int $formatHandle])
  */
 PHP_METHOD(vtiful_xls, insertText)
 {
@@ -1101,7 +1434,7 @@ PHP_METHOD(vtiful_xls, insertText)
             Z_PARAM_ZVAL(data)
             Z_PARAM_OPTIONAL
             Z_PARAM_STR_OR_NULL(format)
-            Z_PARAM_RESOURCE_OR_NULL(lxlsx_format_handle)
+            Z_PARAM_ZVAL(lxlsx_format_handle)
     ZEND_PARSE_PARAMETERS_END();
 
     ZVAL_COPY(return_value, getThis());
@@ -1110,13 +1443,15 @@ PHP_METHOD(vtiful_xls, insertText)
 
     WORKBOOK_NOT_INITIALIZED(obj);
 
-    SHEET_LINE_SET(obj, row);
+    lxlsx_format *handle = obj->lxlsx_format_ptr.format;
 
-    if (lxlsx_format_handle != NULL) {
-        type_writer(data, row, column, &obj->write_ptr, format, object_format(obj, format, zval_get_format(lxlsx_format_handle)));
-    } else {
-        type_writer(data, row, column, &obj->write_ptr, format, object_format(obj, format, obj->lxlsx_format_ptr.format));
+    if (xls_format_get(obj, lxlsx_format_handle, &handle) == FAILURE) {
+        return;
     }
+
+    SHEET_LINE_SET(obj, row);
+
+    type_writer(data, row, column, &obj->write_ptr, format, xls_format_with(obj, lxlsx_format_handle, handle, format));
 }
 /* }}} */
 
@@ -1151,13 +1486,74 @@ PHP_METHOD(vtiful_xls, insertRichText)
 }
 /* }}} */
 
-/** {{{ \Vtiful\Kernel\Excel::insertDate(int $row, int $column, int $timestamp[, string $format, resource $formatHandle])
+/** {{{ \Vtiful\Kernel\Excel::dateColumns(array $columns)
+ *
+ * Mark columns whose timestamp / DateTimeInterface values header(), data() and
+ * dataFrom() write as dates. Keys are column indexes or letters ("B", "B:D"),
+ * values the number format (null or "" for "yyyy-mm-dd hh:mm:ss") or a
+ * format id from registerFormat(). An empty array clears the marks.
+ */
+PHP_METHOD(vtiful_xls, dateColumns)
+{
+    zend_ulong index;
+    zend_string *key;
+    zval *columns = NULL, *format = NULL, value;
+    lxlsx_col_t first_col, last_col, col;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+            Z_PARAM_ARRAY(columns)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ZVAL_COPY(return_value, getThis());
+
+    xls_object *obj = Z_XLS_P(getThis());
+
+    if (obj->date_columns == NULL) {
+        ALLOC_HASHTABLE(obj->date_columns);
+        zend_hash_init(obj->date_columns, 8, NULL, ZVAL_PTR_DTOR, 0);
+    }
+
+    zend_hash_clean(obj->date_columns);
+
+    ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(columns), index, key, format) {
+        ZVAL_DEREF(format);
+
+        if (key == NULL) {
+            first_col = last_col = (lxlsx_col_t)index;
+        } else {
+            first_col = lxlsx_name_to_col(ZSTR_VAL(key));
+            last_col  = strchr(ZSTR_VAL(key), ':') ? lxlsx_name_to_col_2(ZSTR_VAL(key)) : first_col;
+        }
+
+        if ((key == NULL && index >= LXLSX_COL_MAX) || first_col > last_col || last_col >= LXLSX_COL_MAX) {
+            zend_throw_exception(vtiful_exception_ce, "Worksheet row or column index out of range", 180);
+            return;
+        }
+
+        for (col = first_col; col <= last_col; col++) {
+            if (Z_TYPE_P(format) == IS_STRING) {
+                ZVAL_STR_COPY(&value, Z_STR_P(format));
+            } else if (Z_TYPE_P(format) == IS_LONG) {
+                ZVAL_LONG(&value, Z_LVAL_P(format));
+            } else {
+                ZVAL_NULL(&value);
+            }
+
+            zend_hash_index_update(obj->date_columns, col, &value);
+        }
+    } ZEND_HASH_FOREACH_END();
+}
+/* }}} */
+
+/** {{{ \Vtiful\Kernel\Excel::insertDate(int $row, int $column, int|DateTimeInterface $timestamp[, string $format, resource|int $formatHandle])
  */
 PHP_METHOD(vtiful_xls, insertDate)
 {
     zval *data = NULL, *lxlsx_format_handle = NULL;
-    zend_long row = 0, column = 0;
+    zend_long row = 0, column = 0, local = 0;
     zend_string *format = NULL, *default_format = NULL;
+    xls_tz_cache tz;
+    lxlsx_error error;
 
     ZEND_PARSE_PARAMETERS_START(3, 5)
             Z_PARAM_LONG(row)
@@ -1165,7 +1561,7 @@ PHP_METHOD(vtiful_xls, insertDate)
             Z_PARAM_ZVAL(data)
             Z_PARAM_OPTIONAL
             Z_PARAM_STR_OR_NULL(format)
-            Z_PARAM_RESOURCE_OR_NULL(lxlsx_format_handle)
+            Z_PARAM_ZVAL(lxlsx_format_handle)
     ZEND_PARSE_PARAMETERS_END();
 
     ZVAL_COPY(return_value, getThis());
@@ -1173,31 +1569,43 @@ PHP_METHOD(vtiful_xls, insertDate)
     xls_object *obj = Z_XLS_P(getThis());
 
     WORKBOOK_NOT_INITIALIZED(obj);
+
+    lxlsx_format *handle = obj->lxlsx_format_ptr.format;
+
+    if (xls_format_get(obj, lxlsx_format_handle, &handle) == FAILURE) {
+        return;
+    }
+
     SHEET_LINE_SET(obj, row);
 
-    if (Z_TYPE_P(data) != IS_LONG) {
+    xls_tz_cache_init(&tz, 0);
+
+    if (xls_date_value(&tz, data, &local) == FAILURE) {
         zend_throw_exception(vtiful_exception_ce, "timestamp is long", 160);
         return;
     }
 
+    // A registered format id already carries its number format
+    if (lxlsx_format_handle != NULL && Z_TYPE_P(lxlsx_format_handle) == IS_LONG
+        && (format == NULL || ZSTR_LEN(format) == 0)) {
+        WORKSHEET_WRITER_EXCEPTION(date_writer(&obj->write_ptr, row, column, local, handle));
+        return;
+    }
+
     // Default datetime format
     if (format == NULL || (format != NULL && ZSTR_LEN(format) == 0)) {
         default_format = zend_string_init(ZEND_STRL("yyyy-mm-dd hh:mm:ss"), 0);
         format = default_format;
     }
 
-    lxlsx_datetime datetime = timestamp_to_datetime(data->value.lval);
-
-    if (lxlsx_format_handle != NULL) {
-        datetime_writer(&datetime, row, column, format, &obj->write_ptr, object_format(obj, format, zval_get_format(lxlsx_format_handle)));
-    } else {
-        datetime_writer(&datetime, row, column, format, &obj->write_ptr, object_format(obj, format, obj->lxlsx_format_ptr.format));
-    }
+    error = date_writer(&obj->write_ptr, row, column, local, xls_format_with(obj, lxlsx_format_handle, handle, format));
 
     // Release default format
     if (default_format != NULL) {
         zend_string_release(default_format);
     }
+
+    WORKSHEET_WRITER_EXCEPTION(error);
 }
 /* }}} */
 
@@ -1627,7 +2035,7 @@ PHP_METHOD(vtiful_xls, setRow)
 }
 /* }}} */
 
-/** {{{ \Vtiful\Kernel\Excel::autoSize([string $range])
+/** {{{ \Vtiful\Kernel\Excel::autoSize([string $range[, int $sampleRows]])
  *  Enables automatic column-width sizing for the active worksheet and
  *  (optionally) restricts it to an A1 range such as "A:Z" or "A1:J100".
  *  From this point on every written cell contributes its display width to a
@@ -1637,14 +2045,20 @@ PHP_METHOD(vtiful_xls, setRow)
  *  Widths are estimates from character counts (wide/CJK code points count as
  *  2); they approximate but cannot exactly match Excel's own auto-fit, which
  *  depends on font metrics only the application knows.
+ *  A positive $sampleRows measures only the first $sampleRows cells of each
+ *  column and every $sampleRows-th cell after that, which keeps auto-sizing
+ *  cheap on long exports whose columns have a stable shape. The default (0)
+ *  measures every cell.
  */
 PHP_METHOD(vtiful_xls, autoSize)
 {
     zend_string *range = NULL;
+    zend_long sample_rows = 0;
 
-    ZEND_PARSE_PARAMETERS_START(0, 1)
+    ZEND_PARSE_PARAMETERS_START(0, 2)
             Z_PARAM_OPTIONAL
             Z_PARAM_STR_OR_NULL(range)
+            Z_PARAM_LONG(sample_rows)
     ZEND_PARSE_PARAMETERS_END();
 
     ZVAL_COPY(return_value, getThis());
@@ -1654,6 +2068,7 @@ PHP_METHOD(vtiful_xls, autoSize)
     WORKBOOK_NOT_INITIALIZED(obj);
 
     obj->write_ptr.auto_size_enabled = 1;
+    obj->write_ptr.auto_size_sample = sample_rows > 0 ? (zend_ulong)sample_rows : 0;
     if (range != NULL && ZSTR_LEN(range) > 0) {
         obj->write_ptr.auto_size_first_col = lxlsx_name_to_col(ZSTR_VAL(range));
         obj->write_ptr.auto_size_last_col  = lxlsx_name_to_col_2(ZSTR_VAL(range));
@@ -1730,6 +2145,40 @@ PHP_METHOD(vtiful_xls, defaultFormat)
 }
 /* }}} */
 
+/** {{{ \Vtiful\Kernel\Excel::registerFormat(?resource $formatHandle[, string $format]): int
+ *
+ * Resolve a format handle and number format once and return a small integer
+ * id. insertText(), insertDate() and the column format maps of data(),
+ * dataFrom() and dataColumns() accept the id in place of a format handle and
+ * look it up in a flat table, without building a cache key per cell. An id
+ * passed to insertText() / insertDate() along with a number format keeps the
+ * format that pair last resolved to, so repeating the pair is a string compare.
+ */
+PHP_METHOD(vtiful_xls, registerFormat)
+{
+    zend_string *format = NULL;
+    zval *lxlsx_format_handle = NULL;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+            Z_PARAM_RESOURCE_OR_NULL(lxlsx_format_handle)
+            Z_PARAM_OPTIONAL
+            Z_PARAM_STR_OR_NULL(format)
+    ZEND_PARSE_PARAMETERS_END();
+
+    xls_object *obj = Z_XLS_P(getThis());
+
+    WORKBOOK_NOT_INITIALIZED(obj);
+
+    lxlsx_format *handle = zval_get_format(lxlsx_format_handle);
+
+    if (EG(exception)) {
+        return;
+    }
+
+    RETURN_LONG(xls_format_register(obj, object_format(obj, format, handle)));
+}
+/* }}} */
+
 /** {{{ \Vtiful\Kernel\Excel::defaultRowOptions(int $level = 0, bool $collapsed = false, bool $hidden = false)
  */
 PHP_METHOD(vtiful_xls, defaultRowOptions)
@@ -2707,11 +3156,15 @@ PHP_METHOD(vtiful_xls, openFile)
     zval file_path;
     zval *zv_config_path = NULL;
     zend_string *zs_file_name = NULL;
+    zend_bool cache_template = 0;
     lxlsx_reader_workbook *wb = NULL;
     lxlsx_workbook *edit_workbook = NULL;
+    lxlsx_edit_open_options open_options = {0};
 
-    ZEND_PARSE_PARAMETERS_START(1, 1)
+    ZEND_PARSE_PARAMETERS_START(1, 2)
         Z_PARAM_STR(zs_file_name)
+        Z_PARAM_OPTIONAL
+        Z_PARAM_BOOL(cache_template)
     ZEND_PARSE_PARAMETERS_END();
 
     ZVAL_COPY(return_value, getThis());
@@ -2732,17 +3185,13 @@ PHP_METHOD(vtiful_xls, openFile)
         obj->read_ptr.file_t = NULL;
     }
 
-    wb = file_open(Z_STRVAL_P(zv_config_path), ZSTR_VAL(zs_file_name));
-    if (wb == NULL) {
-        return;
-    }
-
     xls_file_path(zs_file_name, zv_config_path, &file_path);
-    edit_workbook = lxlsx_workbook_open(Z_STRVAL(file_path));
-    if (edit_workbook == NULL) {
-        lxlsx_reader_workbook_close(wb);
+    /* The template cache outlives the request, so repeated jobs on the same
+     * template skip reading and parsing it. */
+    open_options.cache_template = cache_template;
+    wb = file_open(Z_STRVAL(file_path), &open_options, &edit_workbook);
+    if (wb == NULL) {
         zval_ptr_dtor(&file_path);
-        zend_throw_exception(vtiful_exception_ce, "Open workbook for editing failed", 131);
         return;
     }
 
@@ -2751,8 +3200,8 @@ PHP_METHOD(vtiful_xls, openFile)
     lxlsx_worksheet *edit_worksheet = lxlsx_workbook_get_worksheet_by_name(edit_workbook, lxlsx_reader_workbook_sheet_name(wb, 0));
 
     if (edit_worksheet == NULL) {
-        lxlsx_workbook_free(edit_workbook);
         lxlsx_reader_workbook_close(wb);
+        lxlsx_workbook_free(edit_workbook);
         zval_ptr_dtor(&file_path);
         zend_throw_exception(vtiful_exception_ce, "Open worksheet for editing failed", 133);
         return;
@@ -2798,6 +3247,9 @@ PHP_METHOD(vtiful_xls, openSheet)
 
     obj->read_ptr.sheet_flag = zl_flag;
     obj->read_ptr.sheet_t = sheet_open(obj->read_ptr.file_t, zs_sheet_name, zl_flag);
+    if (obj->read_ptr.sheet_t != NULL && zs_sheet_name != NULL) {
+        obj->read_ptr.sheet_name = zend_string_copy(zs_sheet_name);
+    }
     if (obj->read_ptr.sheet_t != NULL && obj->write_ptr.workbook != NULL && lxlsx_workbook_is_edit(obj->write_ptr.workbook)) {
         const char *sheet_name = zs_sheet_name != NULL
             ? ZSTR_VAL(zs_sheet_name)
@@ -2816,6 +3268,136 @@ PHP_METHOD(vtiful_xls, openSheet)
 }
 /* }}} */
 
+/** {{{ \Vtiful\Kernel\Excel::appendRows(bool $sharedStrings = false)
+ *  Edit mode: move the current line below the last row of the open sheet and
+ *  write the following rows straight into an append block, in row order.
+ */
+PHP_METHOD(vtiful_xls, appendRows)
+{
+    zend_bool shared_strings = 0;
+    lxlsx_edit_append_options options;
+    lxlsx_row_t first_row = 0;
+    lxlsx_error error;
+
+    ZEND_PARSE_PARAMETERS_START(0, 1)
+            Z_PARAM_OPTIONAL
+            Z_PARAM_BOOL(shared_strings)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ZVAL_COPY(return_value, getThis());
+
+    xls_object *obj = Z_XLS_P(getThis());
+
+    WORKBOOK_NOT_INITIALIZED(obj);
+
+    if (!lxlsx_workbook_is_edit(obj->write_ptr.workbook)) {
+        zend_throw_exception(vtiful_exception_ce, "appendRows() is only supported after openFile()", 135);
+        return;
+    }
+
+    options.shared_strings = shared_strings ? 1 : 0;
+    error = lxlsx_worksheet_append_rows(obj->write_ptr.worksheet, &options, &first_row);
+    WORKSHEET_WRITER_EXCEPTION(error);
+
+    SHEET_LINE_SET(obj, first_row);
+}
+/* }}} */
+
+/** {{{ \Vtiful\Kernel\Excel::concat(array $paths, string $fileName)
+ *  Append the worksheets of every file after the first one's into $fileName.
+ *  Unchanged sheets are copied without being recompressed.
+ */
+PHP_METHOD(vtiful_xls, concat)
+{
+    zval *zv_paths = NULL, *zv_path = NULL;
+    zval *zv_config_path = NULL;
+    zval output_path, *resolved = NULL;
+    zend_string *zs_file_name = NULL;
+    const char **paths = NULL;
+    uint32_t count = 0, i = 0;
+    lxlsx_error error;
+
+    ZEND_PARSE_PARAMETERS_START(2, 2)
+            Z_PARAM_ARRAY(zv_paths)
+            Z_PARAM_STR(zs_file_name)
+    ZEND_PARSE_PARAMETERS_END();
+
+    count = zend_hash_num_elements(Z_ARRVAL_P(zv_paths));
+    if (count == 0) {
+        zend_throw_exception(vtiful_exception_ce, "concat() needs at least one file", 136);
+        return;
+    }
+
+    GET_CONFIG_PATH(zv_config_path, vtiful_xls_ce, PROP_OBJ(getThis()));
+
+    resolved = ecalloc(count, sizeof(zval));
+    paths = ecalloc(count, sizeof(char *));
+
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(zv_paths), zv_path) {
+        zend_string *zs_path = zval_get_string(zv_path);
+
+        xls_file_path(zs_path, zv_config_path, &resolved[i]);
+        paths[i] = Z_STRVAL(resolved[i]);
+        zend_string_release(zs_path);
+        i++;
+    } ZEND_HASH_FOREACH_END();
+
+    xls_file_path(zs_file_name, zv_config_path, &output_path);
+
+    error = lxlsx_edit_concat(paths, count, Z_STRVAL(output_path));
+
+    for (i = 0; i < count; i++) {
+        zval_ptr_dtor(&resolved[i]);
+    }
+    efree(resolved);
+    efree(paths);
+
+    if (error != LXLSX_NO_ERROR) {
+        zval_ptr_dtor(&output_path);
+        zend_throw_exception(vtiful_exception_ce, exception_message_map(error), error);
+        return;
+    }
+
+    RETURN_ZVAL(&output_path, 0, 1);
+}
+/* }}} */
+
+/** {{{ \Vtiful\Kernel\Excel::extractSheet(string $source, string $sheetName, string $fileName)
+ *  Write one worksheet of $source to $fileName as a workbook of its own. Its
+ *  parts are copied without being recompressed.
+ */
+PHP_METHOD(vtiful_xls, extractSheet)
+{
+    zval *zv_config_path = NULL;
+    zval source_path, output_path;
+    zend_string *zs_source_name = NULL, *zs_sheet_name = NULL, *zs_file_name = NULL;
+    lxlsx_error error;
+
+    ZEND_PARSE_PARAMETERS_START(3, 3)
+            Z_PARAM_STR(zs_source_name)
+            Z_PARAM_STR(zs_sheet_name)
+            Z_PARAM_STR(zs_file_name)
+    ZEND_PARSE_PARAMETERS_END();
+
+    GET_CONFIG_PATH(zv_config_path, vtiful_xls_ce, PROP_OBJ(getThis()));
+
+    xls_file_path(zs_source_name, zv_config_path, &source_path);
+    xls_file_path(zs_file_name, zv_config_path, &output_path);
+
+    error = lxlsx_edit_extract_sheet(Z_STRVAL(source_path), ZSTR_VAL(zs_sheet_name),
+                                     Z_STRVAL(output_path));
+    zval_ptr_dtor(&source_path);
+
+    if (error != LXLSX_NO_ERROR) {
+        zval_ptr_dtor(&output_path);
+        zend_throw_exception(vtiful_exception_ce, exception_message_map(error), error);
+        return;
+    }
+
+    RETURN_ZVAL(&output_path, 0, 1);
+}
+/* }}} */
+
 /** {{{ \Vtiful\Kernel\Excel::sheetList()
  */
 PHP_METHOD(vtiful_xls, sheetList)
@@ -3271,33 +3853,16 @@ PHP_METHOD(vtiful_xls, getFormulaAst)
 /* }}} */
 
 /*
- * Resolve a cell reference for evaluateFormula() against the in-memory write
- * worksheet. Only cells retained in memory are visible — in constant-memory
- * mode already-flushed cells read back as blank. Allocates out->string with
- * libc strdup because the engine frees it with free().
+ * Read a write-side cell as a formula value. Strings are borrowed from the
+ * cell, the caller copies them if the engine is to own them.
  */
-void formula_resolver(void *ctx, lxlsx_row_t row, lxlsx_col_t col,
-                              lxlsx_value *out)
+static void formula_cell_value(const lxlsx_cell *c, lxlsx_value *out)
 {
-    lxlsx_worksheet *ws = (lxlsx_worksheet *) ctx;
-    lxlsx_row *r;
-    lxlsx_cell *c;
-
     out->kind = LXLSX_VAL_BLANK;
     out->number = 0.0;
     out->string = NULL;
     out->error = LXLSX_FERR_NONE;
 
-    if (!ws)
-        return;
-
-    r = lxlsx_worksheet_find_row(ws, row);
-    if (!r)
-        return;
-    c = lxlsx_worksheet_find_cell_in_row(r, col);
-    if (!c)
-        return;
-
     switch (c->type) {
     case NUMBER_CELL:
         out->kind = LXLSX_VAL_NUMBER;
@@ -3310,13 +3875,13 @@ void formula_resolver(void *ctx, lxlsx_row_t row, lxlsx_col_t col,
     case STRING_CELL:
         if (c->data.writer.value.shared_string.string) {
             out->kind = LXLSX_VAL_STRING;
-            out->string = strdup(c->data.writer.value.shared_string.string);
+            out->string = (char *) c->data.writer.value.shared_string.string;
         }
         break;
     case INLINE_STRING_CELL:
         if (c->data.writer.value.string) {
             out->kind = LXLSX_VAL_STRING;
-            out->string = strdup(c->data.writer.value.string);
+            out->string = (char *) c->data.writer.value.string;
         }
         break;
     case FORMULA_CELL:
@@ -3324,7 +3889,7 @@ void formula_resolver(void *ctx, lxlsx_row_t row, lxlsx_col_t col,
         if (c->data.writer.value.formula) {
             if (c->data.writer.value.formula->result_string) {
                 out->kind = LXLSX_VAL_STRING;
-                out->string = strdup(c->data.writer.value.formula->result_string);
+                out->string = (char *) c->data.writer.value.formula->result_string;
             } else {
                 out->kind = LXLSX_VAL_NUMBER;
                 out->number = c->data.writer.value.formula->result;
@@ -3336,6 +3901,134 @@ void formula_resolver(void *ctx, lxlsx_row_t row, lxlsx_col_t col,
     }
 }
 
+/*
+ * Resolve a cell reference for evaluateFormula() against the in-memory write
+ * worksheet. Only cells retained in memory are visible — in constant-memory
+ * mode already-flushed cells read back as blank. Allocates out->string with
+ * libc strdup because the engine frees it with free().
+ */
+void formula_resolver(void *ctx, lxlsx_row_t row, lxlsx_col_t col,
+                              lxlsx_value *out)
+{
+    lxlsx_worksheet *ws = (lxlsx_worksheet *) ctx;
+    lxlsx_row *r;
+    lxlsx_cell *c;
+
+    out->kind = LXLSX_VAL_BLANK;
+    out->number = 0.0;
+    out->string = NULL;
+    out->error = LXLSX_FERR_NONE;
+
+    if (!ws)
+        return;
+
+    r = lxlsx_worksheet_find_row(ws, row);
+    if (!r)
+        return;
+    c = lxlsx_worksheet_find_cell_in_row(r, col);
+    if (!c)
+        return;
+
+    formula_cell_value(c, out);
+
+    if (out->kind == LXLSX_VAL_STRING) {
+        out->string = strdup(out->string);
+        if (!out->string) {
+            out->kind = LXLSX_VAL_BLANK;
+        }
+    }
+}
+
+/* Numbers passed to the formula engine per lxlsx_range_sink_numbers() call. */
+#define FORMULA_RANGE_RUN 256
+
+/*
+ * Resolve a range for the aggregate functions by walking the worksheet's rows
+ * and cells in order, one tree search per row rather than per cell. Numbers
+ * are handed over in runs and strings are borrowed, not copied.
+ */
+void formula_range_resolver(void *ctx, lxlsx_row_t first_row, lxlsx_col_t first_col,
+                            lxlsx_row_t last_row, lxlsx_col_t last_col, lxlsx_range_sink *sink)
+{
+    lxlsx_worksheet *ws = (lxlsx_worksheet *) ctx;
+    double numbers[FORMULA_RANGE_RUN];
+    size_t count = 0;
+    lxlsx_row *r;
+    lxlsx_cell *c;
+    lxlsx_value value;
+
+    if (!ws)
+        return;
+
+    for (r = lxlsx_worksheet_find_row_from(ws, first_row);
+         r != NULL && r->row_num <= last_row; r = lxlsx_worksheet_next_row(r)) {
+
+        for (c = lxlsx_worksheet_find_cell_from(r, first_col);
+             c != NULL && c->col_num <= last_col; c = lxlsx_worksheet_next_cell(c)) {
+
+            formula_cell_value(c, &value);
+
+            if (value.kind == LXLSX_VAL_NUMBER) {
+                numbers[count++] = value.number;
+                if (count == FORMULA_RANGE_RUN) {
+                    if (!lxlsx_range_sink_numbers(sink, numbers, count)) {
+                        return;
+                    }
+                    count = 0;
+                }
+                continue;
+            }
+
+            if (value.kind == LXLSX_VAL_BLANK) {
+                continue;
+            }
+
+            if (count > 0 && !lxlsx_range_sink_numbers(sink, numbers, count)) {
+                return;
+            }
+            count = 0;
+
+            if (!lxlsx_range_sink_value(sink, &value)) {
+                return;
+            }
+        }
+    }
+
+    if (count > 0) {
+        lxlsx_range_sink_numbers(sink, numbers, count);
+    }
+}
+
+/* An evaluated formula value as PHP: integral numbers as int, errors as their
+ * Excel string like "#DIV/0!", blank as null. */
+static void formula_value_to_zval(zval *out, const lxlsx_value *value)
+{
+    switch (value->kind) {
+    case LXLSX_VAL_NUMBER: {
+        double d = value->number;
+        if (d == (double) (zend_long) d) {
+            ZVAL_LONG(out, (zend_long) d);
+        } else {
+            ZVAL_DOUBLE(out, d);
+        }
+        break;
+    }
+    case LXLSX_VAL_BOOL:
+        ZVAL_BOOL(out, value->number != 0.0);
+        break;
+    case LXLSX_VAL_STRING:
+        ZVAL_STRING(out, value->string ? value->string : "");
+        break;
+    case LXLSX_VAL_ERROR:
+        ZVAL_STRING(out, lxlsx_formula_error_string(value->error));
+        break;
+    case LXLSX_VAL_BLANK:
+    default:
+        ZVAL_NULL(out);
+        break;
+    }
+}
+
 /** {{{ \Vtiful\Kernel\Excel::evaluateFormula(string $formula): mixed
  *  Evaluate an Excel formula and return the computed value (int/float/string/
  *  bool, or the Excel error string like "#DIV/0!"). Cell references resolve
@@ -3358,48 +4051,32 @@ PHP_METHOD(vtiful_xls, evaluateFormula)
     obj = Z_XLS_P(getThis());
     ws = obj->write_ptr.workbook ? obj->write_ptr.worksheet : NULL;
 
-    err = lxlsx_formula_eval(ZSTR_VAL(formula),
-                             ws ? formula_resolver : NULL, ws, &out);
+    if (obj->write_ptr.formula_cache == NULL) {
+        obj->write_ptr.formula_cache = lxlsx_formula_cache_new(0);
+    }
+
+    err = lxlsx_formula_eval_at(obj->write_ptr.formula_cache, ZSTR_VAL(formula), 0, 0,
+                                ws ? formula_resolver : NULL,
+                                ws ? formula_range_resolver : NULL, ws, &out);
     if (err != LXLSX_NO_ERROR) {
         zend_throw_exception(vtiful_exception_ce, "Evaluate formula failed", err);
         return;
     }
 
-    switch (out.kind) {
-    case LXLSX_VAL_NUMBER: {
-        double d = out.number;
-        if (d == (double) (zend_long) d) {
-            RETVAL_LONG((zend_long) d);
-        } else {
-            RETVAL_DOUBLE(d);
-        }
-        break;
-    }
-    case LXLSX_VAL_BOOL:
-        RETVAL_BOOL(out.number != 0.0);
-        break;
-    case LXLSX_VAL_STRING:
-        RETVAL_STRING(out.string ? out.string : "");
-        break;
-    case LXLSX_VAL_ERROR:
-        RETVAL_STRING(lxlsx_formula_error_string(out.error));
-        break;
-    case LXLSX_VAL_BLANK:
-    default:
-        RETVAL_NULL();
-        break;
-    }
-
+    formula_value_to_zval(return_value, &out);
     lxlsx_value_free(&out);
 }
 /* }}} */
 
 /** {{{ \Vtiful\Kernel\Excel::computeFormula(bool $enable = true): static
- *  Enable compute-on-write: subsequent insertFormula() calls evaluate the
- *  formula against the cells written so far and store the computed value as the
- *  cached result, so the saved file shows correct values before Excel recalcs.
- *  Off by default (formulas keep a 0 cached result). Best in normal mode;
- *  in constant-memory mode references to flushed cells resolve as blank.
+ *  Enable compute-on-write: formulas written by subsequent insertFormula()
+ *  calls get their computed value as the cached result, so the saved file
+ *  shows correct values before Excel recalcs. In normal mode output()
+ *  evaluates them once, in dependency order, so formulas referring to cells
+ *  written after them get correct results too. Off by default (formulas keep
+ *  a 0 cached result). In constant-memory mode there is no recalculation at
+ *  output(): each formula is evaluated as it is inserted, and references to
+ *  flushed or not-yet-written cells resolve as blank.
  */
 PHP_METHOD(vtiful_xls, computeFormula)
 {
@@ -3418,6 +4095,44 @@ PHP_METHOD(vtiful_xls, computeFormula)
 }
 /* }}} */
 
+/** {{{ \Vtiful\Kernel\Excel::formulaCacheStats(): array
+ *  Returns ['hits' => int, 'misses' => int, 'entries' => int, 'capacity' => int]
+ *  for the compiled-formula cache used by computeFormula() and
+ *  evaluateFormula(). A formula copied down a column
+ *  (B2*C2, B3*C3, ...) is one entry: it is compiled once and hit afterwards.
+ */
+PHP_METHOD(vtiful_xls, formulaCacheStats)
+{
+    lxlsx_formula_cache *cache = Z_XLS_P(getThis())->write_ptr.formula_cache;
+
+    array_init(return_value);
+    add_assoc_long(return_value, "hits",     cache ? (zend_long)cache->hits : 0);
+    add_assoc_long(return_value, "misses",   cache ? (zend_long)cache->misses : 0);
+    add_assoc_long(return_value, "entries",  cache ? (zend_long)cache->entries : 0);
+    add_assoc_long(return_value, "capacity", cache ? (zend_long)cache->max_entries
+                                                   : LXLSX_FORMULA_CACHE_DEFAULT_ENTRIES);
+}
+/* }}} */
+
+/** {{{ \Vtiful\Kernel\Excel::templateCacheStats(): array
+ *  Returns ['hits' => int, 'misses' => int, 'entries' => int, 'bytes' => int]
+ *  for the process-wide template cache used by openFile($file, true). A hit
+ *  opens the file without reading or parsing it; a miss reads and parses it.
+ */
+PHP_METHOD(vtiful_xls, templateCacheStats)
+{
+    lxlsx_edit_template_stats stats;
+
+    lxlsx_edit_template_cache_stats(&stats);
+
+    array_init(return_value);
+    add_assoc_long(return_value, "hits",    (zend_long)stats.hits);
+    add_assoc_long(return_value, "misses",  (zend_long)stats.misses);
+    add_assoc_long(return_value, "entries", (zend_long)stats.entries);
+    add_assoc_long(return_value, "bytes",   (zend_long)stats.bytes);
+}
+/* }}} */
+
 /** {{{ \Vtiful\Kernel\Excel::getDataValidations()
  *  Returns [{type, operator, formula1, formula2, allow_blank, show_drop_down,
  *  show_input_message, show_error_message, error_style, prompt, prompt_title,
@@ -3942,18 +4657,43 @@ static void build_rich_cell(zval *out, const lxlsx_cell *c, const lxlsx_reader_w
     }
 }
 
-/** {{{ \Vtiful\Kernel\Excel::nextRowWithFormula()
+/** {{{ \Vtiful\Kernel\Excel::nextRowWithFormula(bool $evaluate = false)
+ *  With $evaluate, formula cells also get an "evaluated" key: the formula
+ *  computed from the cells of the sheet, for files whose cached results are
+ *  missing or stale. The cells referred to are read on demand through a second
+ *  handle on the file, only as far down as the rows referred to.
  */
 PHP_METHOD(vtiful_xls, nextRowWithFormula)
 {
     xls_object *obj = Z_XLS_P(getThis());
     lxlsx_cell    cell;
     int         skip_merged_foll;
+    zend_bool   evaluate = 0;
+
+    ZEND_PARSE_PARAMETERS_START(0, 1)
+        Z_PARAM_OPTIONAL
+        Z_PARAM_BOOL(evaluate)
+    ZEND_PARSE_PARAMETERS_END();
 
     if (!obj->read_ptr.sheet_t) {
         RETURN_NULL();
     }
 
+    if (evaluate && obj->read_ptr.eval == NULL) {
+        zval *file_path, rv;
+        lxlsx_reader_error err;
+
+        file_path = zend_read_property(vtiful_xls_ce, PROP_OBJ(getThis()), ZEND_STRL(V_XLS_FIL), 0, &rv TSRMLS_DC);
+        err = Z_TYPE_P(file_path) != IS_STRING ? LXLSX_READER_ERROR_FILE_OPEN_FAILED
+            : lxlsx_reader_eval_open(Z_STRVAL_P(file_path),
+                                     obj->read_ptr.sheet_name ? ZSTR_VAL(obj->read_ptr.sheet_name) : NULL,
+                                     NULL, &obj->read_ptr.eval);
+        if (err != LXLSX_READER_NO_ERROR) {
+            zend_throw_exception(vtiful_exception_ce, "Open formula evaluator failed", err);
+            return;
+        }
+    }
+
     /* nextRowWithFormula surfaces per-cell hyperlink URLs, which live in
      * sheet metadata. Trigger a lazy metadata load now, while the data zip
      * entry is still closed (minizip allows only one open entry at a time,
@@ -3977,6 +4717,21 @@ PHP_METHOD(vtiful_xls, nextRowWithFormula)
         }
         zval rich;
         build_rich_cell(&rich, &cell, obj->read_ptr.sheet_t);
+        if (evaluate && cell.type == FORMULA_CELL) {
+            lxlsx_value value;
+            lxlsx_error err = lxlsx_reader_eval_cell(obj->read_ptr.eval, &cell, &value);
+            zval evaluated;
+
+            if (err != LXLSX_NO_ERROR) {
+                zval_ptr_dtor(&rich);
+                zend_throw_exception(vtiful_exception_ce, "Evaluate formula failed", err);
+                return;
+            }
+
+            formula_value_to_zval(&evaluated, &value);
+            lxlsx_value_free(&value);
+            add_assoc_zval(&rich, "evaluated", &evaluated);
+        }
         add_index_zval(return_value, idx, &rich);
     }
 }
@@ -4401,12 +5156,15 @@ zend_function_entry xls_methods[] = {
         PHP_ME(vtiful_xls, constMemory,       xls_const_memory_arginfo,            ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, header,            xls_header_arginfo,                  ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, data,              xls_data_arginfo,                    ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, dataFrom,          xls_data_from_arginfo,               ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, dataColumns,       xls_data_columns_arginfo,            ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, output,            xls_output_arginfo,                  ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, getHandle,         xls_get_handle_arginfo,              ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, autoFilter,        xls_auto_filter_arginfo,             ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, insertText,        xls_insert_text_arginfo,             ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, insertRichText,    xls_insert_rtext_arginfo,            ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, insertDate,        xls_insert_date_arginfo,             ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, dateColumns,       xls_date_columns_arginfo,            ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, insertChart,       xls_insert_chart_arginfo,            ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, insertUrl,         xls_insert_url_arginfo,              ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, insertImage,       xls_insert_image_arginfo,            ZEND_ACC_PUBLIC)
@@ -4423,6 +5181,7 @@ zend_function_entry xls_methods[] = {
         PHP_ME(vtiful_xls, getCurrentLine,    xls_get_curr_line_arginfo,           ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, setCurrentLine,    xls_set_curr_line_arginfo,           ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, defaultFormat,     xls_set_global_format,               ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, registerFormat,    xls_register_format_arginfo,         ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, defaultRowOptions, xls_set_default_row_options_arginfo, ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, outlineSettings,   xls_set_outline_settings_arginfo,    ZEND_ACC_PUBLIC)
 
@@ -4470,6 +5229,9 @@ zend_function_entry xls_methods[] = {
 
         PHP_ME(vtiful_xls, openFile,         xls_open_file_arginfo,          ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, openSheet,        xls_open_sheet_arginfo,         ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, appendRows,       xls_append_rows_arginfo,        ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, concat,           xls_concat_arginfo,             ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, extractSheet,     xls_extract_sheet_arginfo,      ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, putCSV,           xls_put_csv_arginfo,            ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, putCSVCallback,   xls_put_csv_callback_arginfo,   ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, sheetList,        xls_sheet_list_arginfo,         ZEND_ACC_PUBLIC)
@@ -4487,6 +5249,8 @@ zend_function_entry xls_methods[] = {
         PHP_ME(vtiful_xls, getFormulaAst,         xls_get_formula_ast_arginfo,         ZEND_ACC_PUBLIC|ZEND_ACC_STATIC)
         PHP_ME(vtiful_xls, evaluateFormula,       xls_evaluate_formula_arginfo,        ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, computeFormula,        xls_compute_formula_arginfo,         ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, formulaCacheStats,     xls_formula_cache_stats_arginfo,     ZEND_ACC_PUBLIC)
+        PHP_ME(vtiful_xls, templateCacheStats,    xls_template_cache_stats_arginfo,    ZEND_ACC_PUBLIC|ZEND_ACC_STATIC)
         PHP_ME(vtiful_xls, getPageSetup,          xls_get_page_setup_arginfo,          ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, nextRowRich,           xls_next_row_rich_arginfo,           ZEND_ACC_PUBLIC)
         PHP_ME(vtiful_xls, getConditionalFormats, xls_get_conditional_formats_arginfo, ZEND_ACC_PUBLIC)
@@ -4596,6 +5360,7 @@ VTIFUL_STARTUP_FUNCTION(excel) {
     REGISTER_CLASS_CONST_LONG(vtiful_xls_ce, V_XLS_CONST_READ_TYPE_DOUBLE,   READ_TYPE_DOUBLE);
     REGISTER_CLASS_CONST_LONG(vtiful_xls_ce, V_XLS_CONST_READ_TYPE_STRING,   READ_TYPE_STRING);
     REGISTER_CLASS_CONST_LONG(vtiful_xls_ce, V_XLS_CONST_READ_TYPE_DATETIME, READ_TYPE_DATETIME);
+    REGISTER_CLASS_CONST_LONG(vtiful_xls_ce, V_XLS_CONST_WRITE_TYPE_BOOL,    WRITE_TYPE_BOOL);
 
     return SUCCESS;
 }
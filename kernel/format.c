@@ -32,6 +32,7 @@ PHP_VTIFUL_API zend_object *lxlsx_format_objects_new(zend_class_entry *ce)
     object_properties_init(&format->zo, ce);
 
     format->ptr.format  = NULL;
+    format->workbook    = NULL;
     format->zo.handlers = &lxlsx_format_handlers;
 
     return &format->zo;
@@ -45,7 +46,8 @@ static void lxlsx_format_objects_free(zend_object *object)
     lxlsx_format_object *intern = php_vtiful_format_fetch_object(object);
 
     if (intern->ptr.format != NULL) {
-        // free by workbook
+        /* The scratch format is ours; interned copies belong to the workbook. */
+        lxlsx_format_free(intern->ptr.format);
         intern->ptr.format = NULL;
     }
 
@@ -166,11 +168,27 @@ PHP_METHOD(vtiful_format, __construct)
     obj = Z_FORMAT_P(getThis());
 
     if (obj->ptr.format == NULL) {
-        obj->ptr.format = lxlsx_workbook_add_format(xls_res->workbook);
+        obj->ptr.format = lxlsx_format_new();
+        obj->workbook   = xls_res->workbook;
     }
 }
 /* }}} */
 
+/* {{{ xls_format_object_intern
+ * Resolve a Format builder to the workbook format with the same properties,
+ * creating it on first use. Builders that set identical properties (for
+ * example one per cell in a loop) all resolve to the same lxlsx_format, so
+ * the workbook only holds unique styles. */
+lxlsx_format *xls_format_object_intern(lxlsx_format_object *obj)
+{
+    if (obj->ptr.format == NULL || obj->workbook == NULL) {
+        return NULL;
+    }
+
+    return lxlsx_workbook_intern_format(obj->workbook, obj->ptr.format);
+}
+/* }}} */
+
 /** {{{ \Vtiful\Kernel\Format::bold()
  */
 PHP_METHOD(vtiful_format, bold)
@@ -579,7 +597,7 @@ PHP_METHOD(vtiful_format, toResource)
 {
     lxlsx_format_object *obj = Z_FORMAT_P(getThis());
 
-    RETURN_RES(zend_register_resource(obj->ptr.format, le_xls_writer));
+    RETURN_RES(zend_register_resource(xls_format_object_intern(obj), le_xls_writer));
 }
 /* }}} */
 
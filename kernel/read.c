@@ -45,32 +45,37 @@ static void cell_text_view(const lxlsx_cell *c, const char **out_ptr, size_t *ou
 /* Open helpers                                                              */
 /* ------------------------------------------------------------------------- */
 
-lxlsx_reader_workbook *file_open(const char *directory, const char *file_name) {
-    char         *path = (char *)emalloc(strlen(directory) + strlen(file_name) + 2);
-    lxlsx_reader_workbook *wb   = NULL;
+/* Open path for editing, and a reader on it that shares the edit session's
+ * parsed workbook, so the file is parsed once (not at all on a template cache
+ * hit). The reader must be closed before *edit_workbook is freed. */
+lxlsx_reader_workbook *file_open(const char *path, const lxlsx_edit_open_options *options, lxlsx_workbook **edit_workbook) {
+    lxlsx_reader_workbook *wb = NULL;
+    lxlsx_workbook *workbook;
     lxlsx_reader_error     rc;
 
-    strcpy(path, directory);
-    strcat(path, "/");
-    strcat(path, file_name);
-
     if (file_exists(path) == XLSWRITER_FALSE) {
         zend_string *message = char_join_to_zend_str("File not found, file path:", path);
         zend_throw_exception(vtiful_exception_ce, ZSTR_VAL(message), 121);
         zend_string_free(message);
-        efree(path);
         return NULL;
     }
 
-    rc = lxlsx_reader_workbook_open(path, &wb);
+    workbook = lxlsx_workbook_open_opt(path, options);
+    if (workbook == NULL) {
+        zend_throw_exception(vtiful_exception_ce, "Open workbook for editing failed", 131);
+        return NULL;
+    }
+
+    rc = lxlsx_edit_open_reader(workbook->edit_session, &wb);
     if (rc != LXLSX_READER_NO_ERROR || wb == NULL) {
         zend_string *message = char_join_to_zend_str("Failed to open file, file path:", path);
         zend_throw_exception(vtiful_exception_ce, ZSTR_VAL(message), 100);
         zend_string_free(message);
-        efree(path);
+        lxlsx_workbook_free(workbook);
         return NULL;
     }
-    efree(path);
+
+    *edit_workbook = workbook;
     return wb;
 }
 
@@ -252,7 +252,7 @@ PHP_METHOD(vtiful_table, columns)
             } else if (Z_TYPE_P(v) == IS_OBJECT &&
                        instanceof_function(Z_OBJCE_P(v), vtiful_format_ce)) {
                 lxlsx_format_object *fo = Z_FORMAT_P(v);
-                col->format = fo->ptr.format;
+                col->format = xls_format_object_intern(fo);
             }
         }
 
@@ -264,7 +264,7 @@ PHP_METHOD(vtiful_table, columns)
             } else if (Z_TYPE_P(v) == IS_OBJECT &&
                        instanceof_function(Z_OBJCE_P(v), vtiful_format_ce)) {
                 lxlsx_format_object *fo = Z_FORMAT_P(v);
-                col->header_format = fo->ptr.format;
+                col->header_format = xls_format_object_intern(fo);
             }
         }
 
@@ -73,17 +73,62 @@ static double utf8_display_width(const char *s, size_t len)
     double width = 0;
     while (pos < len) {
         uint32_t cp;
+        size_t ascii = lxlsx_non_ascii_scan(s + pos, len - pos);
+
+        /* ASCII runs are one column per byte. */
+        width += (double)ascii;
+        pos += ascii;
+        if (pos == len) break;
+
         utf8_next(str, len, &pos, &cp);
         width += xls_codepoint_is_wide(cp) ? 2 : 1;
     }
     return width;
 }
 
-/* Estimate a cell's display width in Excel column-width units. Converts the
- * value to its string form and measures it (wide/CJK codepoints count as 2).
- * Clamped to Excel's maximum column width (255). No extra margin is added:
- * libxlsxwriter already bakes in Excel's standard column margin (~0.71) when
- * the width is written, which matches what Excel's own auto-fit produces. */
+/* Display width of an integer: its digit count plus the sign. */
+static double xls_long_width(zend_long value)
+{
+    zend_ulong u = value < 0 ? (zend_ulong)0 - (zend_ulong)value : (zend_ulong)value;
+    double width = value < 0 ? 2 : 1;
+
+    while (u >= 100) { u /= 100; width += 2; }
+    if (u >= 10) width++;
+    return width;
+}
+
+/* Display width of a double in the General format. Integral values are
+ * counted like integers; anything else is measured from the shortest
+ * round-trip form, falling back to Excel's 15 significant digits when that
+ * form is longer. */
+static double xls_double_width(double value)
+{
+    char buf[LXLSX_DTOA_SIZE];
+    size_t len, i, digits = 0;
+
+    if (value > -1e15 && value < 1e15 && value == (double)(zend_long)value) {
+        return xls_long_width((zend_long)value);
+    }
+
+    len = lxlsx_dtoa(value, buf);
+    for (i = 0; i < len && buf[i] != 'E'; i++) {
+        if (buf[i] >= '0' && buf[i] <= '9') digits++;
+    }
+
+    if (digits > 15) {
+        len = (size_t)snprintf(buf, sizeof(buf), "%.15G", value);
+    }
+
+    return (double)len;
+}
+
+/* Estimate a cell's display width in Excel column-width units. Strings are
+ * measured in place (wide/CJK codepoints count as 2), numbers from their
+ * formatted digit count and booleans as TRUE/FALSE; other values are
+ * converted to their string form. Clamped to Excel's maximum column width
+ * (255). No extra margin is added: libxlsxwriter already bakes in Excel's
+ * standard column margin (~0.71) when the width is written, which matches
+ * what Excel's own auto-fit produces. */
 #define LXLSX_MAX_COL_WIDTH 255.0
 
 double xls_estimate_cell_width(zval *value)
@@ -91,39 +136,87 @@ double xls_estimate_cell_width(zval *value)
     zend_string *s;
     double width;
 
-    if (value == NULL || Z_TYPE_P(value) == IS_NULL) return 0.0;
+    if (value == NULL) return 0.0;
 
-    s = zval_get_string(value);
-    width = utf8_display_width(ZSTR_VAL(s), ZSTR_LEN(s));
-    zend_string_release(s);
+    switch (Z_TYPE_P(value)) {
+        case IS_NULL:
+            return 0.0;
+        case IS_STRING:
+            width = utf8_display_width(Z_STRVAL_P(value), Z_STRLEN_P(value));
+            break;
+        case IS_LONG:
+            return xls_long_width(Z_LVAL_P(value));
+        case IS_DOUBLE:
+            return xls_double_width(Z_DVAL_P(value));
+        case IS_TRUE:
+            return 4.0;
+        case IS_FALSE:
+            return 5.0;
+        default:
+            s = zval_get_string(value);
+            width = utf8_display_width(ZSTR_VAL(s), ZSTR_LEN(s));
+            zend_string_release(s);
+            break;
+    }
 
     if (width > LXLSX_MAX_COL_WIDTH) width = LXLSX_MAX_COL_WIDTH;
     return width;
 }
 
-/* Grow the per-column width map to cover `col` and keep the max. */
-void xls_track_auto_width(xls_resource_write_t *res, lxlsx_col_t col, double width)
+/* Grow the per-column width map to cover `col` and return its slot. */
+static xls_auto_width_t *xls_auto_width_slot(xls_resource_write_t *res, lxlsx_col_t col)
 {
-    size_t need, i;
-    double *grown;
-
-    if (res == NULL || col >= LXLSX_COL_MAX || width <= 0.0) return;
+    size_t need;
 
     if (res->auto_widths == NULL) {
         need = (size_t)col + 1;
         if (need < 16) need = 16;
-        res->auto_widths = (double *)ecalloc(need, sizeof(double));
+        res->auto_widths = (xls_auto_width_t *)ecalloc(need, sizeof(xls_auto_width_t));
         res->auto_widths_n = need;
     } else if ((size_t)col >= res->auto_widths_n) {
         need = res->auto_widths_n;
         while (need <= (size_t)col) need *= 2;
-        grown = (double *)erealloc(res->auto_widths, need * sizeof(double));
-        for (i = res->auto_widths_n; i < need; i++) grown[i] = 0.0;
-        res->auto_widths = grown;
+        res->auto_widths = (xls_auto_width_t *)erealloc(res->auto_widths, need * sizeof(xls_auto_width_t));
+        memset(res->auto_widths + res->auto_widths_n, 0, (need - res->auto_widths_n) * sizeof(xls_auto_width_t));
         res->auto_widths_n = need;
     }
 
-    if (width > res->auto_widths[col]) res->auto_widths[col] = width;
+    return &res->auto_widths[col];
+}
+
+/* Measure a written cell unless the column's sample is already complete:
+ * with a sample size N, the first N cells of each column are measured and
+ * then every N-th one, so long exports converge without estimating every
+ * row. The caller has checked that `col` is inside the auto-size range. */
+void xls_auto_size_cell(xls_resource_write_t *res, lxlsx_col_t col, zval *value)
+{
+    xls_auto_width_t *slot;
+    zend_ulong seen;
+    double width;
+
+    if (col >= LXLSX_COL_MAX) return;
+
+    slot = xls_auto_width_slot(res, col);
+    seen = slot->seen++;
+
+    if (res->auto_size_sample > 0 && seen >= res->auto_size_sample
+        && seen % res->auto_size_sample != 0) {
+        return;
+    }
+
+    width = xls_estimate_cell_width(value);
+    if (width > slot->width) slot->width = width;
+}
+
+/* Keep the maximum width for `col`. */
+void xls_track_auto_width(xls_resource_write_t *res, lxlsx_col_t col, double width)
+{
+    xls_auto_width_t *slot;
+
+    if (res == NULL || col >= LXLSX_COL_MAX || width <= 0.0) return;
+
+    slot = xls_auto_width_slot(res, col);
+    if (width > slot->width) slot->width = width;
 }
 
 void xls_auto_widths_reset(xls_resource_write_t *res)
@@ -145,9 +238,9 @@ void xls_auto_widths_apply(xls_resource_write_t *res, lxlsx_col_t first_col, lxl
     if (first_col > last_col) { lxlsx_col_t t = first_col; first_col = last_col; last_col = t; }
     for (c = first_col; c <= last_col; c++) {
         if (c >= res->auto_widths_n) break;
-        if (res->auto_widths[c] > 0.0) {
+        if (res->auto_widths[c].width > 0.0) {
             lxlsx_error err = lxlsx_worksheet_set_column_opt(res->worksheet, c, c,
-                                                     res->auto_widths[c], NULL, NULL);
+                                                     res->auto_widths[c].width, NULL, NULL);
             if (err != LXLSX_NO_ERROR) {
                 php_error_docref(NULL, E_WARNING,
                     "autoSize: could not set column %u width (%s)",
@@ -178,7 +271,7 @@ void type_writer(zval *value, zend_long row, zend_long columns, xls_resource_wri
     zend_uchar value_type = Z_TYPE_P(value);
 
     if (res->auto_size_enabled && lxlsx_col >= res->auto_size_first_col && lxlsx_col <= res->auto_size_last_col) {
-        xls_track_auto_width(res, lxlsx_col, xls_estimate_cell_width(value));
+        xls_auto_size_cell(res, lxlsx_col, value);
     }
 
     if (value_type == IS_STRING) {
@@ -236,6 +329,146 @@ void type_writer(zval *value, zend_long row, zend_long columns, xls_resource_wri
     }
 }
 
+/*
+ * Write a date from local seconds since 1970-01-01. Dates Excel can show
+ * (1900-03-01 onwards, or 1904-01-01 onwards with the 1904 epoch, up to year
+ * 9999) are turned into the serial number directly; this gives the same value
+ * as lxlsx_datetime_to_excel_date_with_epoch() without the calendar walk.
+ * Anything else, and edit sessions, go through lxlsx_worksheet_write_datetime().
+ */
+lxlsx_error date_writer(xls_resource_write_t *res, zend_long row, zend_long columns, zend_long local, lxlsx_format *format)
+{
+    lxlsx_worksheet *worksheet = res->worksheet;
+    lxlsx_col_t lxlsx_col = (lxlsx_col_t)columns;
+    lxlsx_row_t lxlsx_row = (lxlsx_row_t)row;
+    zend_long days = local / 86400, seconds = local % 86400;
+
+    if (seconds < 0) {
+        seconds += 86400;
+        days--;
+    }
+
+    if (res->auto_size_enabled && format != NULL && lxlsx_col >= res->auto_size_first_col && lxlsx_col <= res->auto_size_last_col) {
+        xls_track_auto_width(res, lxlsx_col, (double)strlen(format->num_format));
+    }
+
+    if (!worksheet->is_edit && days < 2932897) {
+        if (!worksheet->use_1904_epoch && days >= -25508) {
+            return lxlsx_worksheet_write_number(worksheet, lxlsx_row, lxlsx_col,
+                                                (double)(days + 25569) + seconds / (24 * 60 * 60.0), format);
+        }
+
+        if (worksheet->use_1904_epoch && days >= -24107) {
+            return lxlsx_worksheet_write_number(worksheet, lxlsx_row, lxlsx_col,
+                                                (double)(days + 24107) + seconds / (24 * 60 * 60.0), format);
+        }
+    }
+
+    lxlsx_datetime datetime = xls_local_time_to_datetime(local);
+
+    return lxlsx_worksheet_write_datetime(worksheet, lxlsx_row, lxlsx_col, &datetime, format);
+}
+
+/*
+ * Write `rows` rows of column-shaped data starting at `row`. Each column is
+ * walked with its own cursor and written with its declared type, so the
+ * per-cell work is a switch on a type fixed for the whole call instead of
+ * type_writer()'s zval dispatch. NULL and missing values leave the cell empty.
+ */
+lxlsx_error columns_writer(xls_column_t *columns, uint32_t count, zend_long row, uint32_t rows, xls_resource_write_t *res, lxlsx_row_col_options *row_options)
+{
+    uint32_t r, i;
+    lxlsx_error error = LXLSX_NO_ERROR;
+    lxlsx_worksheet *worksheet = res->worksheet;
+    xls_tz_cache tz;
+
+    xls_tz_cache_init(&tz, 1);
+
+    for (i = 0; i < count; i++) {
+        zend_hash_internal_pointer_reset_ex(columns[i].values, &columns[i].pos);
+    }
+
+    for (r = 0; r < rows; r++) {
+        lxlsx_row_t lxlsx_row = (lxlsx_row_t)(row + r);
+
+        if (row_options != NULL) {
+            error = lxlsx_worksheet_set_row_opt(worksheet, lxlsx_row, LXLSX_DEF_ROW_HEIGHT, NULL, row_options);
+            if (error != LXLSX_NO_ERROR) return error;
+        }
+
+        for (i = 0; i < count; i++) {
+            xls_column_t *column = &columns[i];
+            zval *value = zend_hash_get_current_data_ex(column->values, &column->pos);
+            zend_long type = column->type;
+
+            if (value == NULL) {
+                continue;
+            }
+
+            zend_hash_move_forward_ex(column->values, &column->pos);
+            ZVAL_DEREF(value);
+
+            if (Z_TYPE_P(value) == IS_NULL) {
+                continue;
+            }
+
+            if (res->auto_size_enabled && column->col >= res->auto_size_first_col && column->col <= res->auto_size_last_col) {
+                xls_auto_size_cell(res, column->col, value);
+            }
+
+            if (type == READ_TYPE_EMPTY) {
+                switch (Z_TYPE_P(value)) {
+                    case IS_STRING: type = READ_TYPE_STRING; break;
+                    case IS_LONG:   type = READ_TYPE_INT;    break;
+                    case IS_DOUBLE: type = READ_TYPE_DOUBLE; break;
+                    case IS_TRUE:
+                    case IS_FALSE:  type = WRITE_TYPE_BOOL;  break;
+                    default:        continue;
+                }
+            }
+
+            switch (type) {
+                case READ_TYPE_INT:
+                    error = lxlsx_worksheet_write_number(worksheet, lxlsx_row, column->col, (double)zval_get_long(value), column->format);
+                    break;
+
+                case READ_TYPE_DOUBLE:
+                    error = lxlsx_worksheet_write_number(worksheet, lxlsx_row, column->col, zval_get_double(value), column->format);
+                    break;
+
+                case READ_TYPE_DATETIME: {
+                    zend_long local;
+
+                    if (xls_date_value(&tz, value, &local) == FAILURE) {
+                        local = xls_local_time(&tz, zval_get_long(value));
+                    }
+
+                    error = date_writer(res, lxlsx_row, column->col, local, column->format);
+                    break;
+                }
+
+                case WRITE_TYPE_BOOL:
+                    error = lxlsx_worksheet_write_boolean(worksheet, lxlsx_row, column->col, zend_is_true(value), column->format);
+                    break;
+
+                default:
+                    if (Z_TYPE_P(value) == IS_STRING) {
+                        error = lxlsx_worksheet_write_string(worksheet, lxlsx_row, column->col, Z_STRVAL_P(value), column->format);
+                    } else {
+                        zend_string *_zs_value = zval_get_string(value);
+                        error = lxlsx_worksheet_write_string(worksheet, lxlsx_row, column->col, ZSTR_VAL(_zs_value), column->format);
+                        zend_string_release(_zs_value);
+                    }
+                    break;
+            }
+
+            if (error != LXLSX_NO_ERROR) return error;
+        }
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
 /*
  * Write the rich string to the file
  */
@@ -288,87 +521,6 @@ void rich_string_writer(zend_long row, zend_long columns, xls_resource_write_t *
     efree(rich_string_list);
 }
 
-void lxlsx_format_copy(lxlsx_format *new_format, lxlsx_format *other_format)
-{
-    /* Font-family string: previously skipped, causing every clone to fall
-     * back to the workbook default (Calibri). Reported as #545 / #472:
-     * insertText() with both a num-format string and a format resource
-     * dropped the caller's font(). num_format/font_scheme/has_font flags
-     * are in the same boat — copy them all. */
-    memcpy(new_format->font_name,   other_format->font_name,   LXLSX_FORMAT_FIELD_LEN);
-    memcpy(new_format->font_scheme, other_format->font_scheme, LXLSX_FORMAT_FIELD_LEN);
-    new_format->has_font     = other_format->has_font;
-    new_format->has_dxf_font = other_format->has_dxf_font;
-
-    new_format->bold = other_format->bold;
-    new_format->bg_color = other_format->bg_color;
-    new_format->border_count = other_format->border_count;
-    new_format->border_index = other_format->border_index;
-    new_format->bottom = other_format->bottom;
-    new_format->bottom_color = other_format->bottom_color;
-    new_format->color_indexed = other_format->color_indexed;
-    new_format->diag_border = other_format->diag_border;
-    new_format->diag_color = other_format->diag_color;
-
-    new_format->font_size = other_format->font_size;
-    new_format->bold = other_format->bold;
-    new_format->italic = other_format->italic;
-    new_format->font_color = other_format->font_color;
-    new_format->underline = other_format->underline;
-    new_format->font_strikeout = other_format->font_strikeout;
-    new_format->font_outline = other_format->font_outline;
-    new_format->font_shadow = other_format->font_shadow;
-    new_format->font_script = other_format->font_script;
-    new_format->font_family = other_format->font_family;
-    new_format->font_charset = other_format->font_charset;
-    new_format->font_condense = other_format->font_condense;
-    new_format->font_extend = other_format->font_extend;
-    new_format->theme = other_format->theme;
-    new_format->hyperlink = other_format->hyperlink;
-
-    new_format->hidden = other_format->hidden;
-    new_format->locked = other_format->locked;
-
-    new_format->text_h_align = other_format->text_h_align;
-    new_format->text_wrap = other_format->text_wrap;
-    new_format->text_v_align = other_format->text_v_align;
-    new_format->text_justlast = other_format->text_justlast;
-    new_format->rotation = other_format->rotation;
-
-    new_format->fg_color = other_format->fg_color;
-    new_format->bg_color = other_format->bg_color;
-    new_format->pattern = other_format->pattern;
-    new_format->has_fill = other_format->has_fill;
-    new_format->has_dxf_fill = other_format->has_dxf_fill;
-    new_format->fill_index = other_format->fill_index;
-    new_format->fill_count = other_format->fill_count;
-
-    new_format->border_index = other_format->border_index;
-    new_format->has_border = other_format->has_border;
-    new_format->has_dxf_border = other_format->has_dxf_border;
-    new_format->border_count = other_format->border_count;
-
-    new_format->bottom = other_format->bottom;
-    new_format->diag_border = other_format->diag_border;
-    new_format->diag_type = other_format->diag_type;
-    new_format->left = other_format->left;
-    new_format->right = other_format->right;
-    new_format->top = other_format->top;
-    new_format->bottom_color = other_format->bottom_color;
-    new_format->diag_color = other_format->diag_color;
-    new_format->left_color = other_format->left_color;
-    new_format->right_color = other_format->right_color;
-    new_format->top_color = other_format->top_color;
-
-    new_format->indent = other_format->indent;
-    new_format->shrink = other_format->shrink;
-    new_format->merge_range = other_format->merge_range;
-    new_format->reading_order = other_format->reading_order;
-    new_format->just_distrib = other_format->just_distrib;
-    new_format->color_indexed = other_format->color_indexed;
-    new_format->font_only = other_format->font_only;
-}
-
 void url_writer(zend_long row, zend_long columns, xls_resource_write_t *res, zend_string *url, zend_string *text, zend_string *tool_tip, lxlsx_format *format)
 {
     int error = lxlsx_worksheet_write_url_opt(res->worksheet, (lxlsx_row_t)row, (lxlsx_col_t)columns, ZSTR_VAL(url), format,
@@ -412,10 +564,14 @@ void formula_writer(zend_string *value, zend_long row, zend_long columns, xls_re
 }
 
 /*
- * Like formula_writer but evaluates the formula against the cells written so
- * far and stores the computed value as the cached result (compute-on-write).
- * References to not-yet-written cells (or already-flushed cells in
- * constant-memory mode) resolve as blank, matching evaluateFormula().
+ * Like formula_writer but stores the computed value as the cached result
+ * (compute-on-write). A worksheet that output() recalculates gets a plain
+ * formula here, so each formula is evaluated once, with every cell written.
+ * In constant-memory and edit mode there is no such pass: the formula is
+ * evaluated now against the cells written so far, and references to
+ * not-yet-written or already-flushed cells resolve as blank, matching
+ * evaluateFormula(). The formula is compiled relative to its cell, so one
+ * copied down a column is parsed once and then taken from res->formula_cache.
  */
 void formula_writer_calc(zend_string *value, zend_long row, zend_long columns, xls_resource_write_t *res, lxlsx_format *format)
 {
@@ -423,7 +579,18 @@ void formula_writer_calc(zend_string *value, zend_long row, zend_long columns, x
     lxlsx_value out;
     lxlsx_error err;
 
-    if (lxlsx_formula_eval(f, formula_resolver, res->worksheet, &out) != LXLSX_NO_ERROR) {
+    if (!res->worksheet->optimize && !res->worksheet->is_edit) {
+        formula_writer(value, row, columns, res, format);
+        return;
+    }
+
+    if (res->formula_cache == NULL) {
+        res->formula_cache = lxlsx_formula_cache_new(0);
+    }
+
+    if (lxlsx_formula_eval_at(res->formula_cache, f, (lxlsx_row_t)row, (lxlsx_col_t)columns,
+                              formula_resolver, formula_range_resolver,
+                              res->worksheet, &out) != LXLSX_NO_ERROR) {
         /* engine-level failure: fall back to a plain formula (cached 0). */
         WORKSHEET_WRITER_EXCEPTION(
             lxlsx_worksheet_write_formula(res->worksheet, (lxlsx_row_t)row, (lxlsx_col_t)columns, f, format));
@@ -930,7 +1097,10 @@ lxlsx_error
 lxlsx_workbook_file(xls_resource_write_t *self)
 {
     if (lxlsx_workbook_is_edit(self->workbook)) {
-        return lxlsx_workbook_save_as(self->workbook, self->workbook->filename);
+        /* Saving back over the opened file only appends the changed parts. */
+        lxlsx_edit_save_options options = {1, 0};
+
+        return lxlsx_workbook_save_as_opt(self->workbook, self->workbook->filename, &options);
     }
 
     return lxlsx_workbook_assemble(self->workbook);
@@ -63,11 +63,22 @@ typedef struct {
     int                is_dynamic;
 } lxlsx_cell_formula;
 
+/* Role of a formula cell in a writer-side shared formula group. */
+enum lxlsx_shared_formula_role {
+    LXLSX_SHARED_FORMULA_NONE = 0,
+    LXLSX_SHARED_FORMULA_ANCHOR,
+    LXLSX_SHARED_FORMULA_FOLLOWER
+};
+
 typedef struct {
     const char *formula;
     double      result;
     const char *range;
     const char *result_string;
+    /* Set while the sheet is written, see _worksheet_prepare_shared_formulas(). */
+    uint8_t     shared;
+    uint32_t    shared_si;
+    lxlsx_row_t shared_last_row;
 } lxlsx_cell_writer_formula;
 
 typedef struct {
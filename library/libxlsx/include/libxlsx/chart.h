@@ -617,9 +617,14 @@ typedef struct lxlsx_series_range {
     uint8_t ignore_cache;
 
     uint8_t has_string_cache;
-    uint16_t num_data_points;
+    uint32_t num_data_points;
     struct lxlsx_series_data_points *data_cache;
 
+    /* Points filled in by the worksheet as the referenced cells are
+     * written. See lxlsx_workbook_capture_chart_range(). */
+    struct lxlsx_series_data_point *captured;
+    uint32_t num_captured;
+
 } lxlsx_series_range;
 
 typedef struct lxlsx_series_data_point {
@@ -1256,6 +1261,9 @@ typedef struct lxlsx_chart {
     uint8_t default_label_position;
     uint8_t is_protected;
 
+    /* The owning workbook, used to capture series data as it is written. */
+    struct lxlsx_workbook *workbook;
+
     STAILQ_ENTRY (lxlsx_chart) ordered_list_pointers;
     STAILQ_ENTRY (lxlsx_chart) list_pointers;
 
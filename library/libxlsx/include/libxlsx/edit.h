@@ -21,15 +21,98 @@ extern "C" {
 
 typedef struct lxlsx_edit_session lxlsx_edit_session;
 struct lxlsx_chart;  /* defined in chart.h; only used here as an opaque pointer */
+struct lxlsx_reader_workbook;  /* defined in workbook.h; opaque here as well */
 
+/*
+ * Options for lxlsx_edit_save_as_opt().
+ *
+ * - `in_place`: when saving over the file the session was opened from, write
+ *   only the changed parts after the existing entries (plus a new central
+ *   directory) instead of rewriting the whole package. The superseded parts
+ *   stay in the file as dead space.
+ * - `compact_ratio`: rewrite the whole package anyway, dropping all dead
+ *   space, once it would exceed this share of the file. 0 uses
+ *   LXLSX_SOURCE_PACKAGE_COMPACT_RATIO. A save that is not in place always
+ *   writes a compact package.
+ */
+typedef struct lxlsx_edit_save_options {
+    uint8_t in_place;
+    double compact_ratio;
+} lxlsx_edit_save_options;
+
+/*
+ * Options for lxlsx_edit_open_opt().
+ *
+ * - `cache_template`: share the parsed source package and workbook metadata
+ *   through a process-wide cache keyed by path, modification time and size.
+ *   Opening the same unchanged file again skips reading and parsing it; each
+ *   session only holds its own changes. See lxlsx_edit_template_cache_limit().
+ */
+typedef struct lxlsx_edit_open_options {
+    uint8_t cache_template;
+} lxlsx_edit_open_options;
+
+/* Default byte budget of the template cache (source package bytes). */
+#define LXLSX_EDIT_TEMPLATE_CACHE_BYTES (64 * 1024 * 1024)
+
+/*
+ * Open an edit session on path. The file is mapped rather than read into
+ * memory: only the central directory and the parts the session reads or
+ * rewrites are paged in, and untouched parts are copied to the output straight
+ * from the mapping, so a session on a package of several GB needs memory for
+ * its parsed metadata and changes, not for the package. Another process must
+ * not truncate or rewrite the file in place while a session, or a cached
+ * template, is open on it; saves by this library over the file replace it
+ * instead. On Windows the file is read into memory whole.
+ */
 lxlsx_edit_session *lxlsx_edit_open(const char *path);
+lxlsx_edit_session *lxlsx_edit_open_opt(const char *path,
+                                        const lxlsx_edit_open_options *options);
+
+/*
+ * Set the byte budget of the template cache; 0 restores the default. Least
+ * recently opened templates are dropped first once it is exceeded. Templates
+ * still used by open sessions are freed when their last session closes.
+ */
+void lxlsx_edit_template_cache_limit(size_t max_bytes);
+
+/* Drop every cached template, e.g. at process shutdown. */
+void lxlsx_edit_template_cache_clear(void);
+
+/*
+ * Template cache counters. `hits` counts opens served from the cache and
+ * `misses` opens that read and parsed the file; both only grow. `entries` and
+ * `bytes` describe what is cached now.
+ */
+typedef struct lxlsx_edit_template_stats {
+    uint64_t hits;
+    uint64_t misses;
+    size_t entries;
+    size_t bytes;
+} lxlsx_edit_template_stats;
+
+void lxlsx_edit_template_cache_stats(lxlsx_edit_template_stats *stats);
+
 lxlsx_error         lxlsx_edit_save_as(lxlsx_edit_session *session,
                                        const char *path);
+lxlsx_error         lxlsx_edit_save_as_opt(lxlsx_edit_session *session,
+                                           const char *path,
+                                           const lxlsx_edit_save_options *options);
 void                lxlsx_edit_close(lxlsx_edit_session *session);
 size_t              lxlsx_edit_sheet_count(lxlsx_edit_session *session);
 const char         *lxlsx_edit_sheet_name(lxlsx_edit_session *session,
                                           size_t index);
 
+/*
+ * Open a reader on the package the session was opened from. The reader shares
+ * the session's parsed workbook metadata (sheets, styles, shared strings), so
+ * opening it parses nothing; only the worksheets opened through it are read.
+ * It sees the package as opened, not the session's changes. Close it with
+ * lxlsx_reader_workbook_close() before closing the session.
+ */
+lxlsx_reader_error  lxlsx_edit_open_reader(lxlsx_edit_session *session,
+                                           struct lxlsx_reader_workbook **out);
+
 /*
  * If sheet_name is NULL, edits target the first worksheet in workbook order.
  */
@@ -105,6 +188,34 @@ lxlsx_error lxlsx_edit_set_row_height(lxlsx_edit_session *session,
                                       lxlsx_row_t row,
                                       double height);
 
+/*
+ * Options for lxlsx_edit_append_begin().
+ *
+ * - `shared_strings`: store appended strings in the package's shared strings
+ *   part, de-duplicated, instead of inline. Ignored if the package has no
+ *   shared strings part.
+ */
+typedef struct lxlsx_edit_append_options {
+    uint8_t shared_strings;
+} lxlsx_edit_append_options;
+
+/*
+ * Start appending rows below the last existing row of a sheet (and below any
+ * row already edited in this session). *first_row receives the first 0-based
+ * row of the append region.
+ *
+ * Value setters aimed at that region then skip the per-cell change list: the
+ * cells are serialized straight into a block of <row> elements that is
+ * written before </sheetData> on save. They must arrive in row order, and in
+ * column order within a row; rewriting the last cell replaces it. Formats,
+ * number formats and row heights apply to the last cell / current row only.
+ * options may be NULL for the defaults.
+ */
+lxlsx_error lxlsx_edit_append_begin(lxlsx_edit_session *session,
+                                    const char *sheet_name,
+                                    const lxlsx_edit_append_options *options,
+                                    lxlsx_row_t *first_row);
+
 /*
  * Append a brand-new worksheet to the workbook. `xml` is the complete
  * worksheet part content. On save it becomes a new xl/worksheets/sheetN.xml and
@@ -144,6 +255,41 @@ lxlsx_error lxlsx_edit_add_chart(lxlsx_edit_session *session,
                                  lxlsx_row_t row, lxlsx_col_t col,
                                  struct lxlsx_chart *chart);
 
+/*
+ * Concatenate workbooks into `out`: the first of `paths` is copied whole and
+ * the worksheets of the others are appended after its own, in order. Sheet
+ * parts keep their compressed bytes when their style and shared string
+ * indices need no renumbering, and are rewritten on the fly otherwise; the
+ * parts they reference (drawings, charts, images, comments, tables) are
+ * copied under new names. Styles and shared strings are merged and
+ * de-duplicated. A name already taken becomes "Name (2)". Defined names of
+ * the appended files are not carried over, and references to a renamed sheet
+ * are not rewritten. Sheets with pivot tables are rejected with
+ * LXLSX_ERROR_FEATURE_NOT_SUPPORTED.
+ *
+ * The files are mapped as by lxlsx_edit_open() and merged one at a time, so
+ * the parsed metadata of only one appended file is held at once. What stays in
+ * memory until the output is written: the first file's edit session, the
+ * merged styles.xml and shared strings with an index of their distinct
+ * records, and per appended file a map from its style and string indices to
+ * the output's (a few words per record).
+ */
+lxlsx_error lxlsx_edit_concat(const char *const *paths, size_t path_count,
+                              const char *out);
+
+/*
+ * Write worksheet `sheet_name` of `path` to `out` as a workbook of its own.
+ * Only the parts the sheet and the workbook reach are kept: the other sheets
+ * and their drawings, charts, images, comments and tables are left out, as
+ * are the calculation chain and pivot caches. Kept parts are copied with
+ * their compressed bytes; styles and shared strings stay whole, so the sheet
+ * needs no renumbering. Defined names scoped to or referring to the other
+ * sheets are dropped. Sheets with pivot tables are rejected with
+ * LXLSX_ERROR_FEATURE_NOT_SUPPORTED.
+ */
+lxlsx_error lxlsx_edit_extract_sheet(const char *path, const char *sheet_name,
+                                     const char *out);
+
 #ifdef __cplusplus
 }
 #endif
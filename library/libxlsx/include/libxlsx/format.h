@@ -505,6 +505,7 @@ lxlsx_format *lxlsx_format_new(void);
 void lxlsx_format_free(lxlsx_format *format);
 int32_t lxlsx_format_get_xf_index(lxlsx_format *format);
 int32_t lxlsx_format_get_dxf_index(lxlsx_format *format);
+lxlsx_format *lxlsx_format_get_intern_key(lxlsx_format *format);
 lxlsx_font *lxlsx_format_get_font_key(lxlsx_format *format);
 lxlsx_border *lxlsx_format_get_border_key(lxlsx_format *format);
 lxlsx_fill *lxlsx_format_get_fill_key(lxlsx_format *format);
@@ -60,12 +60,65 @@ typedef void (*lxlsx_formula_resolver)(void *ctx,
                                        lxlsx_row_t row, lxlsx_col_t col,
                                        lxlsx_value *out);
 
+/*
+ * Receives the cells of a range from a lxlsx_formula_range_resolver. Runs of
+ * numbers go to lxlsx_range_sink_numbers() and other non-blank values, one at
+ * a time in row-major order, to lxlsx_range_sink_value(). Both return 0 once
+ * the range's result is known (e.g. an error was seen) and the resolver can
+ * stop.
+ */
+typedef struct lxlsx_range_sink lxlsx_range_sink;
+
+/*
+ * Resolve all cells of the 0-based range first_row:first_col to
+ * last_row:last_col into sink, skipping blank cells. Used for the range
+ * arguments of SUM, AVERAGE, COUNT, COUNTA, MIN and MAX so that the caller
+ * can walk its storage in order rather than look up each cell.
+ */
+typedef void (*lxlsx_formula_range_resolver)(void *ctx,
+                                             lxlsx_row_t first_row,
+                                             lxlsx_col_t first_col,
+                                             lxlsx_row_t last_row,
+                                             lxlsx_col_t last_col,
+                                             lxlsx_range_sink *sink);
+
+/* Pass count numeric cells of a range to the sink. */
+int lxlsx_range_sink_numbers(lxlsx_range_sink *sink, const double *numbers,
+                             size_t count);
+
+/* Pass one non-numeric cell of a range to the sink. The value, including a
+ * string, is only borrowed for the call. */
+int lxlsx_range_sink_value(lxlsx_range_sink *sink, const lxlsx_value *value);
+
 /* Release any heap held by a value (the string) and reset it to BLANK. */
 void lxlsx_value_free(lxlsx_value *value);
 
 /* Map an error kind to its Excel string ("#DIV/0!", ...). Never NULL. */
 const char *lxlsx_formula_error_string(lxlsx_formula_error error);
 
+/* Default bound of a formula cache, in compiled formulas. */
+#define LXLSX_FORMULA_CACHE_DEFAULT_ENTRIES 4096
+
+/*
+ * Compiled formulas keyed by their text with cell references in R1C1 form
+ * relative to the cell the formula is evaluated for, so a formula copied down
+ * a column (B2*C2, B3*C3, ...) is parsed once. When max_entries formulas are
+ * cached the cache is emptied and refilled. hits and misses count lookups.
+ */
+typedef struct lxlsx_formula_cache {
+    struct lxlsx_hash_table *compiled;
+    uint32_t entries;
+    uint32_t max_entries;
+    uint64_t hits;
+    uint64_t misses;
+} lxlsx_formula_cache;
+
+/* Create a formula cache holding up to max_entries formulas (0 = default). */
+lxlsx_formula_cache *lxlsx_formula_cache_new(uint32_t max_entries);
+
+/* Free a formula cache and its compiled formulas. NULL is ignored. */
+void lxlsx_formula_cache_free(lxlsx_formula_cache *cache);
+
 /*
  * Evaluate an Excel formula (without the leading '='). On success returns
  * LXLSX_NO_ERROR and writes the result to *out (which may itself be an
@@ -78,6 +131,115 @@ lxlsx_error lxlsx_formula_eval(const char *formula,
                                lxlsx_formula_resolver resolver, void *ctx,
                                lxlsx_value *out);
 
+/*
+ * As lxlsx_formula_eval() for a formula in the 0-based cell row/col, using the
+ * compiled form from cache when the same formula relative to its cell was
+ * seen before. cache may be NULL to compile the formula for this call only.
+ * range_resolver may be NULL, in which case ranges are resolved cell by cell
+ * through resolver.
+ */
+lxlsx_error lxlsx_formula_eval_at(lxlsx_formula_cache *cache,
+                                  const char *formula,
+                                  lxlsx_row_t row, lxlsx_col_t col,
+                                  lxlsx_formula_resolver resolver,
+                                  lxlsx_formula_range_resolver range_resolver,
+                                  void *ctx, lxlsx_value *out);
+
+/*
+ * As lxlsx_formula_eval_at() for a formula written in the 0-based cell
+ * from_row/from_col and copied to row/col, with its relative references
+ * moved along, as for the cells of a shared formula. References moved off
+ * the sheet evaluate to #REF!.
+ */
+lxlsx_error lxlsx_formula_eval_copied(lxlsx_formula_cache *cache,
+                                      const char *formula,
+                                      lxlsx_row_t from_row,
+                                      lxlsx_col_t from_col,
+                                      lxlsx_row_t row, lxlsx_col_t col,
+                                      lxlsx_formula_resolver resolver,
+                                      lxlsx_formula_range_resolver range_resolver,
+                                      void *ctx, lxlsx_value *out);
+
+/*
+ * Receives one cell or range a formula refers to, as a 0-based range bound to
+ * the cell the formula is in. A single cell comes as a range of one cell.
+ */
+typedef void (*lxlsx_formula_ref_visitor)(void *ctx,
+                                          lxlsx_row_t first_row,
+                                          lxlsx_col_t first_col,
+                                          lxlsx_row_t last_row,
+                                          lxlsx_col_t last_col);
+
+/*
+ * Pass each reference of a formula in the 0-based cell row/col to visit, in
+ * the order they appear. Sheet qualifiers are ignored as they are when the
+ * formula is evaluated, and references that fall off the sheet are skipped.
+ * cache is used as in lxlsx_formula_eval_at() and may be NULL.
+ */
+lxlsx_error lxlsx_formula_refs_at(lxlsx_formula_cache *cache,
+                                  const char *formula,
+                                  lxlsx_row_t row, lxlsx_col_t col,
+                                  lxlsx_formula_ref_visitor visit, void *ctx);
+
+/* As lxlsx_formula_refs_at() for a formula copied, see
+ * lxlsx_formula_eval_copied(). */
+lxlsx_error lxlsx_formula_refs_copied(lxlsx_formula_cache *cache,
+                                      const char *formula,
+                                      lxlsx_row_t from_row,
+                                      lxlsx_col_t from_col,
+                                      lxlsx_row_t row, lxlsx_col_t col,
+                                      lxlsx_formula_ref_visitor visit,
+                                      void *ctx);
+
+/*
+ * Whether formula a in the 0-based cell a_row/a_col and formula b in
+ * b_row/b_col are the same formula relative to their cells, as when one is
+ * the other copied, i.e. they share a compiled form in a formula cache.
+ */
+int lxlsx_formula_same_relative(const char *a, lxlsx_row_t a_row,
+                                lxlsx_col_t a_col, const char *b,
+                                lxlsx_row_t b_row, lxlsx_col_t b_col);
+
+/*
+ * The key lxlsx_formula_same_relative() compares for formula in the 0-based
+ * cell row/col; formulas with equal keys are the same relative formula. The
+ * key is built in buf when it fits in cap bytes and allocated otherwise, so
+ * free() it when it isn't buf. Returns NULL when the formula has no key.
+ */
+char *lxlsx_formula_relative_key(const char *formula, lxlsx_row_t row,
+                                 lxlsx_col_t col, char *buf, size_t cap,
+                                 size_t *key_len);
+
+/*
+ * Resolve count cells of column col from first_row down for
+ * lxlsx_formula_eval_column(): set values[i] and numeric[i] for a number, a
+ * boolean (1.0/0.0) or a blank cell (0.0), and clear numeric[i] otherwise.
+ */
+typedef void (*lxlsx_formula_column_resolver)(void *ctx,
+                                              lxlsx_row_t first_row,
+                                              lxlsx_col_t col, uint32_t count,
+                                              double *values,
+                                              uint8_t *numeric);
+
+/*
+ * Evaluate a formula copied down count cells of column col from first_row,
+ * one formula relative to each cell, on whole columns of numbers at a time
+ * rather than cell by cell. Only formulas of numbers, cell references and the
+ * + - * / ^ and unary operators are evaluated this way; others return
+ * LXLSX_ERROR_FEATURE_NOT_SUPPORTED. results[i] gets the number of row
+ * first_row + i where done[i] is set. Rows reading a cell that isn't a
+ * number, or dividing by zero, are left with done[i] clear for the caller to
+ * evaluate with lxlsx_formula_eval_at(). A count of 0 only checks whether
+ * the formula can be evaluated this way; results and done may then be NULL.
+ */
+lxlsx_error lxlsx_formula_eval_column(lxlsx_formula_cache *cache,
+                                      const char *formula,
+                                      lxlsx_row_t first_row, lxlsx_col_t col,
+                                      uint32_t count,
+                                      lxlsx_formula_column_resolver resolver,
+                                      void *ctx, double *results,
+                                      uint8_t *done);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,40 +15,44 @@
 
 /* Macro to loop over hash table elements in insertion order. */
 #define LXLSX_FOREACH_ORDERED(elem, hash_table) \
-    STAILQ_FOREACH((elem), (hash_table)->order_list, lxlsx_hash_order_pointers)
-
-/* List declarations. */
-STAILQ_HEAD(lxlsx_hash_order_list, lxlsx_hash_element);
-SLIST_HEAD(lxlsx_hash_bucket_list, lxlsx_hash_element);
-
-/* LXLSX_HASH hash table struct. */
-typedef struct lxlsx_hash_table {
-    uint32_t num_buckets;
-    uint32_t used_buckets;
-    uint32_t unique_count;
-    uint8_t free_key;
-    uint8_t free_value;
-
-    struct lxlsx_hash_order_list *order_list;
-    struct lxlsx_hash_bucket_list **buckets;
-} lxlsx_hash_table;
+    for ((elem) = (hash_table)->elements; \
+         (elem) < (hash_table)->elements + (hash_table)->unique_count; \
+         (elem)++)
 
 /*
  * LXLSX_HASH table element struct.
  *
- * The hash elements contain pointers to allow them to be stored in
- * lists in the the hash table buckets and also pointers to track the
- * insertion order in a separate list.
+ * The elements are stored inline, in insertion order, in a single array
+ * owned by the table. The cached hash avoids re-hashing the key when the
+ * table grows. Since the array is reallocated as it grows, a returned
+ * element pointer is only valid until the next insertion.
  */
 typedef struct lxlsx_hash_element {
     void *key;
     void *value;
     size_t key_len;
-
-    STAILQ_ENTRY (lxlsx_hash_element) lxlsx_hash_order_pointers;
-    SLIST_ENTRY (lxlsx_hash_element) lxlsx_hash_list_pointers;
+    uint64_t hash;
 } lxlsx_hash_element;
 
+/*
+ * LXLSX_HASH open addressing slot. The index is 1-based so that a zeroed
+ * slot is empty and the upper hash bits are kept to skip most key compares.
+ */
+typedef struct lxlsx_hash_slot {
+    uint32_t hash;
+    uint32_t index;
+} lxlsx_hash_slot;
+
+/* LXLSX_HASH hash table struct. */
+typedef struct lxlsx_hash_table {
+    uint32_t num_buckets;
+    uint32_t unique_count;
+    uint8_t free_key;
+    uint8_t free_value;
+
+    lxlsx_hash_slot *buckets;
+    lxlsx_hash_element *elements;
+} lxlsx_hash_table;
 
  /* *INDENT-OFF* */
 #ifdef __cplusplus
@@ -60,6 +64,7 @@ lxlsx_hash_element *lxlsx_hash_key_exists(lxlsx_hash_table *lxlsx_hash, void *ke
                                       size_t key_len);
 lxlsx_hash_element *lxlsx_insert_hash_element(lxlsx_hash_table *lxlsx_hash, void *key,
                                           void *value, size_t key_len);
+void lxlsx_hash_remove_last(lxlsx_hash_table *lxlsx_hash);
 lxlsx_hash_table *lxlsx_hash_new(uint32_t num_buckets, uint8_t free_key,
                              uint8_t free_value);
 void lxlsx_hash_free(lxlsx_hash_table *lxlsx_hash);
@@ -67,6 +72,8 @@ void lxlsx_hash_free(lxlsx_hash_table *lxlsx_hash);
 /* Declarations required for unit testing. */
 #ifdef TESTING
 
+uint64_t _generate_hash_key(const void *data, size_t data_len);
+
 #endif
 
 /* *INDENT-OFF* */
@@ -0,0 +1,78 @@
+/*
+ * libxlsx
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/**
+ * @file reader_eval.h
+ *
+ * @brief Evaluation of the formula cells of a worksheet being read.
+ *
+ * Files written by other producers may carry no cached formula results, or
+ * stale ones. An evaluator computes them with the formula engine (see
+ * formula.h) from the cells of the worksheet itself. The cells a formula
+ * refers to are read on demand into a column store: only the columns referred
+ * to are kept, and the worksheet is streamed only as far down as the rows
+ * referred to. Formula cells referred to are evaluated in turn, once each.
+ *
+ * The evaluator reads the file through its own handle, so it can be used
+ * while another lxlsx_reader_worksheet of the same file is mid-stream, e.g.
+ * on the formula cells lxlsx_reader_worksheet_next_cell() returns.
+ */
+#ifndef __LXLSX_READER_EVAL_H__
+#define __LXLSX_READER_EVAL_H__
+
+#include "common.h"
+#include "formula.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lxlsx_reader_eval lxlsx_reader_eval;
+
+/* Counts of an evaluator, since it was opened. */
+typedef struct lxlsx_reader_eval_stats {
+    uint32_t passes;     /* times the worksheet was streamed from the start */
+    uint32_t rows;       /* rows streamed */
+    uint32_t columns;    /* columns held in the column store */
+    uint32_t cells;      /* cells held, including blanks between them */
+    uint32_t evaluated;  /* formula cells of the worksheet evaluated */
+} lxlsx_reader_eval_stats;
+
+/*
+ * Open an evaluator on worksheet sheet_name of the file, or the first
+ * worksheet when sheet_name is NULL. cache may be NULL to use one owned by
+ * the evaluator.
+ */
+lxlsx_reader_error lxlsx_reader_eval_open(const char *filename,
+                                          const char *sheet_name,
+                                          lxlsx_formula_cache *cache,
+                                          lxlsx_reader_eval **out);
+
+/*
+ * Evaluate a formula cell returned by the reader for the same worksheet, as
+ * its 1-based row_num/col_num. The cells of a shared formula are evaluated
+ * from the formula of the first cell of the group. A cell that isn't a
+ * formula gets its own value. A circular reference reads as 0.
+ */
+lxlsx_error lxlsx_reader_eval_cell(lxlsx_reader_eval *eval,
+                                   const lxlsx_cell *cell, lxlsx_value *out);
+
+/* The value of the 0-based cell row/col, its formula evaluated if it has
+ * one. */
+lxlsx_error lxlsx_reader_eval_at(lxlsx_reader_eval *eval, lxlsx_row_t row,
+                                 lxlsx_col_t col, lxlsx_value *out);
+
+void lxlsx_reader_eval_stats_get(const lxlsx_reader_eval *eval,
+                                 lxlsx_reader_eval_stats *stats);
+
+/* Close an evaluator. NULL is ignored. */
+void lxlsx_reader_eval_close(lxlsx_reader_eval *eval);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LXLSX_READER_EVAL_H__ */
@@ -0,0 +1,81 @@
+/*
+ * libxlsx
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/**
+ * @file recalc.h
+ *
+ * @brief Recalculation of the formula cells of a write-side worksheet.
+ *
+ * The formula cells of a worksheet are ordered by the cells they refer to and
+ * evaluated once each with the formula engine (see formula.h), so that their
+ * cached results no longer depend on the order the cells were written in.
+ * References resolve on the formula's own worksheet, as they do for
+ * lxlsx_formula_eval_at(), so formulas referring to another worksheet
+ * (Sheet2!A1) are not recalculated: they keep the result they were written
+ * with, and formulas referring to them read that result.
+ */
+#ifndef __LXLSX_RECALC_H__
+#define __LXLSX_RECALC_H__
+
+#include "common.h"
+#include "formula.h"
+#include "workbook.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lxlsx_recalc lxlsx_recalc;
+
+/* Counts of a recalculation pass. */
+typedef struct lxlsx_recalc_stats {
+    uint32_t formulas;   /* formula cells recalculated, see above */
+    uint32_t evaluated;  /* formulas evaluated by this pass */
+    uint32_t vectorized; /* of those, evaluated a column at a time */
+    uint32_t circular;   /* formulas on or behind a circular reference */
+} lxlsx_recalc_stats;
+
+/* Changed cells tracked between passes before a full pass is cheaper. */
+#define LXLSX_RECALC_CHANGED_MAX 4096
+
+/*
+ * Recalculate the formula cells of a worksheet and store their results as the
+ * cached values written to the file. Formulas on a circular reference, and
+ * the formulas that depend on them, get 0 as Excel shows them.
+ *
+ * A formula copied down a column, built of numbers, cell references and
+ * arithmetic, is evaluated on whole columns of numbers at a time (see
+ * lxlsx_formula_eval_column()).
+ *
+ * The first pass builds the dependency graph and evaluates every formula.
+ * After that the worksheet records the cells written to it, and a later pass
+ * evaluates only the formulas that refer to them and the formulas depending
+ * on those. Writing a formula cell, or over one, rebuilds the graph.
+ *
+ * cache may be NULL to use one owned by the worksheet. Worksheets in
+ * constant_memory mode, whose rows are written out as they go, and edit-mode
+ * worksheets are left as they are. stats may be NULL.
+ */
+lxlsx_error lxlsx_recalc_worksheet(lxlsx_worksheet *worksheet,
+                                   lxlsx_formula_cache *cache,
+                                   lxlsx_recalc_stats *stats);
+
+/* As lxlsx_recalc_worksheet() for every worksheet; stats are summed. */
+lxlsx_error lxlsx_recalc_workbook(lxlsx_workbook *workbook,
+                                  lxlsx_formula_cache *cache,
+                                  lxlsx_recalc_stats *stats);
+
+/* Declarations required for the worksheet. */
+void lxlsx_recalc_cell_written(lxlsx_recalc *recalc,
+                               lxlsx_row_t row, lxlsx_col_t col,
+                               const lxlsx_cell *cell);
+void lxlsx_recalc_free(lxlsx_recalc *recalc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LXLSX_RECALC_H__ */
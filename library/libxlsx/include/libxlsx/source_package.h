@@ -34,17 +34,42 @@ typedef struct {
     uint32_t    external_attr;
 } lxlsx_source_package_entry_info;
 
+typedef struct lxlsx_source_package_entry_stream lxlsx_source_package_entry_stream;
+typedef struct lxlsx_source_package_sink lxlsx_source_package_sink;
+
+/* Rewrites an entry as a stream: reads the original content from `in` and
+ * writes the new content to `out`, which CRCs and compresses it on the fly,
+ * so neither side ever has to exist as a whole in memory. */
+typedef lxlsx_error (*lxlsx_source_package_transform)(
+    void *ctx,
+    lxlsx_source_package_entry_stream *in,
+    lxlsx_source_package_sink *out);
+
 typedef struct {
     size_t               entry_index;
     const unsigned char *data;
     size_t               size;
 } lxlsx_source_package_replacement;
 
-/* A brand-new part to append to the package (e.g. a new worksheet). */
+/* An entry replaced by streaming it through a transform. */
+typedef struct {
+    size_t                         entry_index;
+    lxlsx_source_package_transform transform;
+    void                          *ctx;
+} lxlsx_source_package_stream_replacement;
+
+/* A brand-new part to append to the package (e.g. a new worksheet). When
+ * `source` is set, data/size are ignored and entry `source_index` of that
+ * package is copied instead: its compressed bytes verbatim, or streamed
+ * through `transform` when one is given. */
 typedef struct {
     const char          *name;   /* zip member name, e.g. xl/worksheets/sheet3.xml */
     const unsigned char *data;
     size_t               size;
+    const lxlsx_source_package    *source;
+    size_t                         source_index;
+    lxlsx_source_package_transform transform;
+    void                          *ctx;
 } lxlsx_source_package_addition;
 
 lxlsx_error lxlsx_source_package_open(const char *path,
@@ -68,6 +93,25 @@ lxlsx_error lxlsx_source_package_read_entry(const lxlsx_source_package *package,
                                             size_t *out_len);
 void lxlsx_source_package_free_buffer(void *buffer);
 
+/* Incremental reader over an entry's uncompressed content. Each read returns
+ * up to `cap` bytes; *got is 0 once the entry is exhausted. */
+lxlsx_error lxlsx_source_package_entry_stream_open(
+    const lxlsx_source_package *package,
+    size_t index,
+    lxlsx_source_package_entry_stream **out);
+lxlsx_error lxlsx_source_package_entry_stream_read(
+    lxlsx_source_package_entry_stream *stream,
+    void *buf,
+    size_t cap,
+    size_t *got);
+void lxlsx_source_package_entry_stream_close(
+    lxlsx_source_package_entry_stream *stream);
+
+/* Append bytes to a streamed replacement (see lxlsx_source_package_transform). */
+lxlsx_error lxlsx_source_package_sink_write(lxlsx_source_package_sink *sink,
+                                            const void *data,
+                                            size_t len);
+
 /* Return the untouched local-file record slice for an entry in the original
  * XLSX package. This is intended for tests and diagnostics that need to verify
  * byte-for-byte preservation of entries not replaced by edit output. The
@@ -95,6 +139,39 @@ lxlsx_error lxlsx_source_package_save_with_changes(
     const lxlsx_source_package_addition *additions,
     size_t addition_count);
 
+/* Like save_with_changes, plus entries rewritten by streaming transforms. */
+lxlsx_error lxlsx_source_package_save_streamed(
+    const lxlsx_source_package *package,
+    const char *path,
+    const lxlsx_source_package_replacement *replacements,
+    size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
+    const lxlsx_source_package_addition *additions,
+    size_t addition_count);
+
+/* Default share of the file that may be superseded records before an in-place
+ * save compacts the package instead (see save_in_place). */
+#define LXLSX_SOURCE_PACKAGE_COMPACT_RATIO 0.5
+
+/* Save the changes back into `path`, the file the package was read from,
+ * without copying the untouched entries: the changed and added local records,
+ * then a new central directory and EOCD, are written over the old directory.
+ * The records they supersede stay behind as dead space. Once that would exceed
+ * compact_ratio of the file (<= 0 for the default), or if the file no longer
+ * matches the package, the whole package is rewritten instead, which drops
+ * all dead space. */
+lxlsx_error lxlsx_source_package_save_in_place(
+    const lxlsx_source_package *package,
+    const char *path,
+    const lxlsx_source_package_replacement *replacements,
+    size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
+    const lxlsx_source_package_addition *additions,
+    size_t addition_count,
+    double compact_ratio);
+
 #ifdef __cplusplus
 }
 #endif
@@ -301,9 +301,15 @@ FILE *lxlsx_fopen(const char *filename, const char *mode);
 lxlsx_error lxlsx_capture_filehandle(FILE *fh, char *buffer, size_t buffer_size,
                                      char **out, size_t *out_len);
 
-/* Use the third party dtoa function to avoid locale issues with sprintf
- * double formatting. Otherwise we use a simple macro that falls back to the
- * default c-lib sprintf.
+/* Shortest round-trip, locale independent double formatting. The buffer must
+ * hold at least LXLSX_DTOA_SIZE bytes. Returns the length written.
+ */
+#define LXLSX_DTOA_SIZE 26
+size_t lxlsx_dtoa(double value, char *buffer);
+
+/* Use the dtoa formatter to avoid locale issues with sprintf double
+ * formatting. Otherwise we use a simple macro that falls back to the default
+ * c-lib sprintf.
  */
 #ifdef USE_DTOA_LIBRARY
 int lxlsx_sprintf_dbl(char *data, double number);
@@ -253,6 +253,12 @@ typedef struct lxlsx_doc_properties {
  * - `output_buffer_size`: Used with output_buffer to get the size of the
  *   created buffer. This option can only be used if filename is NULL.
  *
+ * - `constant_memory_window`: Used with `constant_memory` to keep the last N
+ *   rows of each worksheet in memory instead of only the current one. Rows
+ *   inside the window can still be written to, in any order; once a row falls
+ *   more than N rows behind the highest row written it is flushed to the temp
+ *   file and freed. A value of 0 or 1 gives the default single-row behavior.
+ *
  * @note In `constant_memory` mode each row of in-memory data is written to
  * disk and then freed when a new row is started via one of the
  * `lxlsx_worksheet_write_*()` functions. Therefore, once this option is active data
@@ -282,6 +288,9 @@ typedef struct lxlsx_workbook_options {
 
     /** Used with output_buffer to get the size of the created buffer */
     size_t *output_buffer_size;
+
+    /** Number of trailing rows kept editable in constant_memory mode. */
+    lxlsx_row_t constant_memory_window;
 } lxlsx_workbook_options;
 
 /**
@@ -350,6 +359,7 @@ typedef struct lxlsx_workbook {
 
     lxlsx_hash_table *used_xf_formats;
     lxlsx_hash_table *used_dxf_formats;
+    lxlsx_hash_table *interned_formats;
 
     char *vba_project;
     char *vba_project_signature;
@@ -461,6 +471,16 @@ lxlsx_workbook *lxlsx_workbook_new_opt(const char *filename,
  */
 lxlsx_workbook *lxlsx_workbook_open(const char *filename);
 
+/**
+ * @brief Open an existing workbook for editing with edit open options.
+ *
+ * Like lxlsx_workbook_open(), but with #lxlsx_edit_open_options, e.g. to
+ * share the parsed file through the template cache when the same template is
+ * opened over and over.
+ */
+lxlsx_workbook *lxlsx_workbook_open_opt(const char *filename,
+                                        const lxlsx_edit_open_options *options);
+
 /**
  * @brief Save an opened workbook without freeing it.
  *
@@ -471,6 +491,16 @@ lxlsx_workbook *lxlsx_workbook_open(const char *filename);
 lxlsx_error lxlsx_workbook_save_as(lxlsx_workbook *workbook,
                                    const char *path);
 
+/**
+ * @brief Save an opened workbook with edit save options.
+ *
+ * Like lxlsx_workbook_save_as(), but with #lxlsx_edit_save_options, e.g. to
+ * append only the changed parts when saving back over the opened file.
+ */
+lxlsx_error lxlsx_workbook_save_as_opt(lxlsx_workbook *workbook,
+                                       const char *path,
+                                       const lxlsx_edit_save_options *options);
+
 uint8_t lxlsx_workbook_is_edit(lxlsx_workbook *workbook);
 
 /**
@@ -596,6 +626,37 @@ lxlsx_chartsheet *lxlsx_workbook_add_chartsheet(lxlsx_workbook *workbook,
  */
 lxlsx_format *lxlsx_workbook_add_format(lxlsx_workbook *workbook);
 
+/**
+ * @brief Return the workbook format with the same properties as a template.
+ *
+ * @param workbook Pointer to a lxlsx_workbook instance.
+ * @param format   Format whose properties to look up. It isn't retained and
+ *                 doesn't need to belong to the workbook.
+ *
+ * @return A lxlsx_format instance owned by the workbook, or NULL on memory
+ *         error.
+ *
+ * The `lxlsx_workbook_intern_format()` function returns the format created by
+ * an earlier call with identical properties, or adds a copy of `format` to
+ * the workbook the first time. Code that builds the same style many times,
+ * for example once per cell, then keeps a single format per distinct style:
+ *
+ * @code
+ *    lxlsx_format *scratch = lxlsx_format_new();
+ *    lxlsx_format_set_bold(scratch);
+ *
+ *    // Both calls return the same workbook format.
+ *    lxlsx_format *bold1 = lxlsx_workbook_intern_format(workbook, scratch);
+ *    lxlsx_format *bold2 = lxlsx_workbook_intern_format(workbook, scratch);
+ *
+ *    lxlsx_format_free(scratch);
+ * @endcode
+ *
+ * Interned formats are shared, so they shouldn't be modified afterwards.
+ */
+lxlsx_format *lxlsx_workbook_intern_format(lxlsx_workbook *workbook,
+                                           lxlsx_format *format);
+
 /**
  * @brief Create a new chart to be added to a worksheet:
  *
@@ -1156,6 +1217,8 @@ void lxlsx_workbook_free(lxlsx_workbook *workbook);
 void lxlsx_workbook_assemble_xml_file(lxlsx_workbook *workbook);
 void lxlsx_workbook_set_default_xf_indices(lxlsx_workbook *workbook);
 void lxlsx_workbook_unset_default_url_format(lxlsx_workbook *workbook);
+lxlsx_error lxlsx_workbook_capture_chart_range(lxlsx_workbook *workbook,
+                                               lxlsx_series_range *range);
 
 /* Declarations required for unit testing. */
 #ifdef TESTING
@@ -1174,6 +1237,8 @@ STATIC void _write_calc_pr(lxlsx_workbook *self);
 STATIC void _write_defined_name(lxlsx_workbook *self,
                                 lxlsx_defined_name *define_name);
 STATIC void _write_defined_names(lxlsx_workbook *self);
+STATIC void _populate_range_data_cache(lxlsx_workbook *self,
+                                       lxlsx_series_range *range);
 
 STATIC lxlsx_error _store_defined_name(lxlsx_workbook *self, const char *name,
                                      const char *lxlsx_app_name,
@@ -750,6 +750,7 @@ struct lxlsx_table_rows {
     RB_GENERATE_INSERT(name, type, field, cmp, static)    \
     RB_GENERATE_REMOVE(name, type, field, static)         \
     RB_GENERATE_FIND(name, type, field, cmp, static)      \
+    RB_GENERATE_NFIND(name, type, field, cmp, static)     \
     RB_GENERATE_NEXT(name, type, field, static)           \
     RB_GENERATE_MINMAX(name, type, field, static)         \
     /* Add unused struct to allow adding a semicolon */   \
@@ -761,6 +762,7 @@ struct lxlsx_table_rows {
     RB_GENERATE_INSERT(name, type, field, cmp, static)    \
     RB_GENERATE_REMOVE(name, type, field, static)         \
     RB_GENERATE_FIND(name, type, field, cmp, static)      \
+    RB_GENERATE_NFIND(name, type, field, cmp, static)     \
     RB_GENERATE_NEXT(name, type, field, static)           \
     RB_GENERATE_MINMAX(name, type, field, static)         \
     /* Add unused struct to allow adding a semicolon */   \
@@ -2164,6 +2166,7 @@ typedef struct lxlsx_worksheet {
     uint8_t row_size_changed;
     uint8_t optimize;
     struct lxlsx_row *optimize_row;
+    lxlsx_row_t optimize_window;
 
     uint16_t fit_height;
     uint16_t fit_width;
@@ -2297,6 +2300,19 @@ typedef struct lxlsx_worksheet {
     lxlsx_filter_rule_obj **filter_rules;
     lxlsx_col_t num_filter_rules;
 
+    /* Chart ranges that capture cell values as they are written, and the
+     * bounding box of all of them for a quick rejection test. */
+    lxlsx_series_range **chart_ranges;
+    uint32_t chart_range_count;
+    uint32_t chart_range_size;
+    lxlsx_row_t chart_first_row;
+    lxlsx_row_t chart_last_row;
+    lxlsx_col_t chart_first_col;
+    lxlsx_col_t chart_last_col;
+
+    /* Formula dependency graph, set up by lxlsx_recalc_worksheet(). */
+    struct lxlsx_recalc *recalc;
+
     STAILQ_ENTRY (lxlsx_worksheet) list_pointers;
 
 } lxlsx_worksheet;
@@ -2308,6 +2324,7 @@ typedef struct lxlsx_worksheet_init_data {
     uint16_t index;
     uint8_t hidden;
     uint8_t optimize;
+    lxlsx_row_t optimize_window;
     uint16_t *active_sheet;
     uint16_t *first_sheet;
     lxlsx_sst *sst;
@@ -3326,6 +3343,25 @@ lxlsx_error lxlsx_worksheet_set_row_opt(lxlsx_worksheet *worksheet,
                                 lxlsx_format *format,
                                 lxlsx_row_col_options *options);
 
+/**
+ * @brief Append rows below the existing data of an opened worksheet.
+ *
+ * @param worksheet Pointer to a lxlsx_worksheet instance.
+ * @param options   Optional #lxlsx_edit_append_options, or NULL.
+ * @param first_row Receives the first zero indexed row below the data.
+ *
+ * @return A #lxlsx_error code.
+ *
+ * Only valid for worksheets of a workbook opened with lxlsx_workbook_open(),
+ * otherwise #LXLSX_ERROR_FEATURE_NOT_SUPPORTED is returned. Cells written from
+ * `first_row` on are serialized directly into the rows appended on save,
+ * instead of being queued as individual cell edits, so they must be written
+ * in row by row order. See lxlsx_edit_append_begin().
+ */
+lxlsx_error lxlsx_worksheet_append_rows(lxlsx_worksheet *worksheet,
+                                        const lxlsx_edit_append_options *options,
+                                        lxlsx_row_t *first_row);
+
 /**
  * @brief Set the properties for a row of cells, with the height in pixels.
  *
@@ -5921,6 +5957,15 @@ void lxlsx_worksheet_prepare_tables(lxlsx_worksheet *worksheet,
 
 lxlsx_row *lxlsx_worksheet_find_row(lxlsx_worksheet *worksheet, lxlsx_row_t row_num);
 lxlsx_cell *lxlsx_worksheet_find_cell_in_row(lxlsx_row *row, lxlsx_col_t col_num);
+lxlsx_row *lxlsx_worksheet_find_row_from(lxlsx_worksheet *worksheet,
+                                         lxlsx_row_t row_num);
+lxlsx_row *lxlsx_worksheet_next_row(lxlsx_row *row);
+lxlsx_cell *lxlsx_worksheet_find_cell_from(lxlsx_row *row, lxlsx_col_t col_num);
+lxlsx_cell *lxlsx_worksheet_next_cell(lxlsx_cell *cell);
+void lxlsx_worksheet_fill_data_point(lxlsx_series_data_point *data_point,
+                                     lxlsx_cell *cell);
+lxlsx_error lxlsx_worksheet_capture_range(lxlsx_worksheet *worksheet,
+                                          lxlsx_series_range *range);
 /*
  * External functions to call intern XML functions shared with chartsheet.
  */
@@ -5947,6 +5992,8 @@ STATIC void _worksheet_write_sheet_view(lxlsx_worksheet *worksheet);
 STATIC void _worksheet_write_sheet_views(lxlsx_worksheet *worksheet);
 STATIC void _worksheet_write_sheet_format_pr(lxlsx_worksheet *worksheet);
 STATIC void _worksheet_write_sheet_data(lxlsx_worksheet *worksheet);
+STATIC uint8_t _formula_is_row_shift(const char *above, const char *below);
+STATIC void _worksheet_prepare_shared_formulas(lxlsx_worksheet *worksheet);
 STATIC void _worksheet_write_page_margins(lxlsx_worksheet *worksheet);
 STATIC void _worksheet_write_page_setup(lxlsx_worksheet *worksheet);
 STATIC void _worksheet_write_col_info(lxlsx_worksheet *worksheet,
@@ -52,57 +52,78 @@ extern "C" {
 #endif
 /* *INDENT-ON* */
 
-/* Attribute used in XML elements. */
+/* Number of attributes and bytes of attribute text held on the stack by a
+ * lxlsx_xml_attribute_list before it falls back to the heap. */
+#define LXLSX_XML_INLINE_ATTRIBUTES 32
+#define LXLSX_XML_ATTRIBUTE_POOL    2048
+
+/* Attribute used in XML elements. The key and value are stored back to back
+ * ("key\0value\0") in the list's pool, or in a heap block when the pool is
+ * full. */
 struct lxlsx_xml_attribute {
-    char key[LXLSX_MAX_ATTRIBUTE_LENGTH];
-    char value[LXLSX_MAX_ATTRIBUTE_LENGTH];
-
-    /* Make the struct a queue.h list element. */
-    STAILQ_ENTRY (lxlsx_xml_attribute) list_entries;
+    char *key;
+    char *value;
+    uint16_t key_len;
+    uint16_t value_len;
+    uint8_t heap;
 };
 
-/* Use queue.h macros to define the lxlsx_xml_attribute_list type. */
-STAILQ_HEAD(lxlsx_xml_attribute_list, lxlsx_xml_attribute);
-
-/* Create a new attribute struct to add to a lxlsx_xml_attribute_list. */
-struct lxlsx_xml_attribute *lxlsx_new_attribute_str(const char *key,
-                                            const char *value);
-struct lxlsx_xml_attribute *lxlsx_new_attribute_int(const char *key, int32_t value);
-struct lxlsx_xml_attribute *lxlsx_new_attribute_dbl(const char *key, double value);
+/* Stack resident attribute list. Declared as a local in each part writer
+ * and filled with the LXLSX_PUSH_ATTRIBUTES_* macros. */
+struct lxlsx_xml_attribute_list {
+    struct lxlsx_xml_attribute *items;
+    size_t count;
+    size_t capacity;
+    size_t pool_len;
+    struct lxlsx_xml_attribute inline_items[LXLSX_XML_INLINE_ATTRIBUTES];
+    char pool[LXLSX_XML_ATTRIBUTE_POOL];
+};
 
-/* Macro to initialize the lxlsx_xml_attribute_list pointers. */
+/* Add attributes to a lxlsx_xml_attribute_list. */
+void lxlsx_xml_attributes_init(struct lxlsx_xml_attribute_list *attributes);
+void lxlsx_xml_attributes_free(struct lxlsx_xml_attribute_list *attributes);
+struct lxlsx_xml_attribute *lxlsx_xml_push_attribute_str(struct lxlsx_xml_attribute_list *attributes,
+                                                         const char *key,
+                                                         const char *value);
+struct lxlsx_xml_attribute *lxlsx_xml_push_attribute_int(struct lxlsx_xml_attribute_list *attributes,
+                                                         const char *key,
+                                                         int32_t value);
+struct lxlsx_xml_attribute *lxlsx_xml_push_attribute_dbl(struct lxlsx_xml_attribute_list *attributes,
+                                                         const char *key,
+                                                         double value);
+
+/* Macro to initialize the lxlsx_xml_attribute_list. */
 #define LXLSX_INIT_ATTRIBUTES()                                 \
-    STAILQ_INIT(&attributes)
+    lxlsx_xml_attributes_init(&attributes)
 
 /* Macro to add attribute string elements to lxlsx_xml_attribute_list. */
 #define LXLSX_PUSH_ATTRIBUTES_STR(key, value)                   \
     do {                                                      \
-    attribute = lxlsx_new_attribute_str((key), (value));        \
-    STAILQ_INSERT_TAIL(&attributes, attribute, list_entries); \
+    attribute = lxlsx_xml_push_attribute_str(&attributes, (key), (value)); \
     } while (0)
 
 /* Macro to add attribute int values to lxlsx_xml_attribute_list. */
 #define LXLSX_PUSH_ATTRIBUTES_INT(key, value)                   \
     do {                                                      \
-    attribute = lxlsx_new_attribute_int((key), (value));        \
-    STAILQ_INSERT_TAIL(&attributes, attribute, list_entries); \
+    attribute = lxlsx_xml_push_attribute_int(&attributes, (key), (value)); \
     } while (0)
 
 /* Macro to add attribute double values to lxlsx_xml_attribute_list. */
 #define LXLSX_PUSH_ATTRIBUTES_DBL(key, value)                   \
     do {                                                      \
-    attribute = lxlsx_new_attribute_dbl((key), (value));        \
-    STAILQ_INSERT_TAIL(&attributes, attribute, list_entries); \
+    attribute = lxlsx_xml_push_attribute_dbl(&attributes, (key), (value)); \
     } while (0)
 
-/* Macro to free lxlsx_xml_attribute_list and attribute. */
+/* Macro to check whether any attribute has been added. */
+#define LXLSX_ATTRIBUTES_EMPTY()                                \
+    (attributes.count == 0)
+
+/* Macro to release any heap spill of the lxlsx_xml_attribute_list. The list
+ * is left empty and can be reused without another LXLSX_INIT_ATTRIBUTES(). */
 #define LXLSX_FREE_ATTRIBUTES()                                 \
     do {                                                      \
-        while (!STAILQ_EMPTY(&attributes)) {                  \
-            attribute = STAILQ_FIRST(&attributes);            \
-            STAILQ_REMOVE_HEAD(&attributes, list_entries);    \
-            free(attribute);                                  \
-        }                                                     \
+        (void) attribute;                                     \
+        lxlsx_xml_attributes_free(&attributes);               \
     } while (0)
 
 /**
@@ -181,6 +202,13 @@ void lxlsx_xml_data_element(FILE *xmlfile,
 
 void lxlsx_xml_rich_si_element(FILE *xmlfile, const char *string);
 
+/* Vectorized byte scans, selected for the running CPU by lxlsx_scan_init().
+ * Each returns the offset of the first matching byte, or len. */
+void lxlsx_scan_init(void);
+size_t lxlsx_xml_escape_scan(const char *data, size_t len);
+size_t lxlsx_control_char_scan(const char *data, size_t len);
+size_t lxlsx_non_ascii_scan(const char *data, size_t len);
+
 uint8_t lxlsx_has_control_characters(const char *string);
 char *lxlsx_escape_control_characters(const char *string);
 char *lxlsx_escape_url_characters(const char *string, uint8_t escape_hash);
@@ -50,6 +50,9 @@ struct lxlsx_reader_workbook {
     lxlsx_reader_defined_name_entry *defined_names;
     size_t                  defined_name_count;
     size_t                  defined_name_cap;
+
+    /* Set on a view: everything above but zip belongs to base. */
+    const lxlsx_reader_workbook *base;
 };
 
 /* Conditional formats (§8.2.3): one owned cfRule entry. Defined at file scope
@@ -376,6 +379,18 @@ lxlsx_reader_error lxlsx_reader_worksheet_ensure_data_open(lxlsx_reader_workshee
 lxlsx_reader_error lxlsx_reader_workbook_open_memory_borrowed(const void *data,
                                       size_t len,
                                       lxlsx_reader_workbook **out);
+lxlsx_reader_error lxlsx_reader_workbook_open_memory_borrowed_ex(const void *data,
+                                      size_t len,
+                                      const lxlsx_reader_open_options *opts,
+                                      lxlsx_reader_workbook **out);
+
+/* Open a view of base: a workbook reading the same package bytes (data, len)
+ * through its own zip handle, sharing base's parsed sheets, styles, shared
+ * strings and defined names instead of parsing them again. base must outlive
+ * the view and must not be modified meanwhile. */
+lxlsx_reader_error lxlsx_reader_workbook_open_view(const lxlsx_reader_workbook *base,
+                                      const void *data, size_t len,
+                                      lxlsx_reader_workbook **out);
 
 /* worksheet_meta.c */
 lxlsx_reader_error lxlsx_reader_worksheet_meta_load(lxlsx_reader_worksheet *ws);
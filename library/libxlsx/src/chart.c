@@ -11,6 +11,7 @@
 #include "libxlsx/xmlwriter.h"
 #include "libxlsx/chart.h"
 #include "libxlsx/utility.h"
+#include "libxlsx/workbook.h"
 
 /*
  * Forward declarations.
@@ -26,6 +27,22 @@ STATIC void _chart_axis_set_default_num_format(lxlsx_chart_axis *axis,
  *
  ****************************************************************************/
 
+/*
+ * Free the points captured for a series range as its cells were written.
+ */
+STATIC void
+_chart_free_captured(lxlsx_series_range *range)
+{
+    uint32_t i;
+
+    for (i = 0; i < range->num_captured; i++)
+        free(range->captured[i].string);
+
+    free(range->captured);
+    range->captured = NULL;
+    range->num_captured = 0;
+}
+
 /*
  * Free a series range object.
  */
@@ -40,14 +57,19 @@ _chart_free_range(lxlsx_series_range *range)
     if (range->data_cache) {
         while (!STAILQ_EMPTY(range->data_cache)) {
             data_point = STAILQ_FIRST(range->data_cache);
-            free(data_point->string);
             STAILQ_REMOVE_HEAD(range->data_cache, list_pointers);
 
-            free(data_point);
+            /* Captured points are owned by the captured array. */
+            if (!range->captured) {
+                free(data_point->string);
+                free(data_point);
+            }
         }
         free(range->data_cache);
     }
 
+    _chart_free_captured(range);
+
     free(range->formula);
     free(range->sheetname);
     free(range);
@@ -581,7 +603,11 @@ _chart_set_range(lxlsx_series_range *range, const char *sheetname,
 {
     char formula[LXLSX_MAX_FORMULA_RANGE_LENGTH] = { 0 };
 
+    /* Any data captured for a previous definition no longer applies. */
+    _chart_free_captured(range);
+
     /* Set the range properties. */
+    free(range->sheetname);
     range->sheetname = lxlsx_strdup(sheetname);
     range->first_row = first_row;
     range->first_col = first_col;
@@ -1284,7 +1310,7 @@ _chart_write_a_body_pr(lxlsx_chart *self, int32_t rotation,
  * Write the <c:ptCount> element.
  */
 STATIC void
-_chart_write_pt_count(lxlsx_chart *self, uint16_t num_data_points)
+_chart_write_pt_count(lxlsx_chart *self, uint32_t num_data_points)
 {
     struct lxlsx_xml_attribute_list attributes;
     struct lxlsx_xml_attribute *attribute;
@@ -1332,7 +1358,7 @@ _chart_write_f(lxlsx_chart *self, char *formula)
  * Write the <c:pt> element.
  */
 STATIC void
-_chart_write_pt(lxlsx_chart *self, uint16_t index,
+_chart_write_pt(lxlsx_chart *self, uint32_t index,
                 lxlsx_series_data_point *data_point)
 {
     struct lxlsx_xml_attribute_list attributes;
@@ -1361,7 +1387,7 @@ _chart_write_pt(lxlsx_chart *self, uint16_t index,
  * Write the <c:pt> element.
  */
 STATIC void
-_chart_write_num_pt(lxlsx_chart *self, uint16_t index,
+_chart_write_num_pt(lxlsx_chart *self, uint32_t index,
                     lxlsx_series_data_point *data_point)
 {
     struct lxlsx_xml_attribute_list attributes;
@@ -1399,7 +1425,7 @@ STATIC void
 _chart_write_num_cache(lxlsx_chart *self, lxlsx_series_range *range)
 {
     lxlsx_series_data_point *data_point;
-    uint16_t index = 0;
+    uint32_t index = 0;
 
     lxlsx_xml_start_tag(self->file, "c:numCache", NULL);
 
@@ -1425,7 +1451,7 @@ STATIC void
 _chart_write_str_cache(lxlsx_chart *self, lxlsx_series_range *range)
 {
     lxlsx_series_data_point *data_point;
-    uint16_t index = 0;
+    uint32_t index = 0;
 
     lxlsx_xml_start_tag(self->file, "c:strCache", NULL);
 
@@ -5401,6 +5427,13 @@ lxlsx_chart_add_series(lxlsx_chart *self, const char *categories, const char *va
     if (_chart_init_data_cache(series->title.range) != LXLSX_NO_ERROR)
         goto mem_error;
 
+    /* Capture the series data as it is written, where the ranges refer to
+     * existing worksheets, instead of reading it back at close. */
+    if (self->workbook) {
+        lxlsx_workbook_capture_chart_range(self->workbook, series->categories);
+        lxlsx_workbook_capture_chart_range(self->workbook, series->values);
+    }
+
     if (self->type == LXLSX_CHART_SCATTER_SMOOTH)
         series->smooth = LXLSX_TRUE;
 
@@ -5,12 +5,15 @@
  */
 
 #include <ctype.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "libxlsx/edit.h"
+#include "libxlsx/hash_table.h"
 #include "libxlsx/source_package.h"
 #include "libxlsx/utility.h"
 #include "libxlsx/worksheet.h"
@@ -94,9 +97,52 @@ typedef struct {
     lxlsx_chart *chart;    /* borrowed; owned by the workbook */
 } lxlsx_edit_chart;
 
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} lxlsx_edit_buf;
+
+/*
+ * Rows appended below a sheet's existing data (lxlsx_edit_append_begin()).
+ * Cells are serialized into xml as they are set, so saving only copies the
+ * block in before </sheetData>. The last cell and the open row are kept
+ * addressable so that a format or a height set right after them can still be
+ * spliced into their start tags.
+ */
+typedef struct {
+    const char *target;         /* the reader workbook's sheet target */
+    lxlsx_edit_buf xml;         /* the appended <row> elements */
+    lxlsx_row_t first_row;
+    lxlsx_row_t row;            /* the open row */
+    lxlsx_col_t col;            /* its last cell */
+    int row_open;
+    int has_cell;               /* the open row has a cell */
+    int cell_shared;            /* ... which references a shared string */
+    size_t cell_string;         /* ... that it added, 1-based, or 0 */
+    int shared_strings;
+    size_t row_attr_at;         /* end of the open row's r= attribute */
+    size_t row_attr_len;        /* length of the ht= attributes after it */
+    size_t cell_at;             /* offset of the last cell */
+    size_t cell_attr_at;        /* end of its r= attribute */
+    size_t cell_attr_len;       /* length of the s= attribute after it */
+} lxlsx_edit_append;
+
+/* A style used by appended cells; resolved to a new xf on save. */
+typedef struct {
+    lxlsx_format *style;        /* format snapshot, or NULL */
+    char *number_format;        /* number format code, or NULL */
+    int style_index;            /* xf index assigned on save */
+} lxlsx_edit_append_style;
+
+typedef struct lxlsx_edit_template lxlsx_edit_template;
+
 struct lxlsx_edit_session {
+    char *path;   /* the file the package was read from */
     lxlsx_source_package *package;
     lxlsx_reader_workbook *workbook;
+    /* Cache entry that owns package and workbook, if opened through it. */
+    lxlsx_edit_template *shared;
     lxlsx_edit_change *changes;
     size_t change_count;
     size_t change_cap;
@@ -118,19 +164,25 @@ struct lxlsx_edit_session {
     lxlsx_edit_chart *charts;
     size_t chart_count;
     size_t chart_cap;
+    lxlsx_edit_append *appends;
+    size_t append_count;
+    size_t append_cap;
+    /* Appended cells carry their final s= index, so the styles they need get
+     * the first xf indices after the existing cellXfs on save. */
+    lxlsx_edit_append_style *append_styles;
+    size_t append_style_count;
+    size_t append_style_cap;
+    size_t append_xf_base;
+    int append_xf_base_known;
+    /* Strings appended as shared strings, after the part's existing <si>. */
+    lxlsx_hash_table *append_strings;
+    size_t append_sst_base;
+    size_t append_sst_refs;
 };
 
-typedef struct {
-    char *data;
-    size_t len;
-    size_t cap;
-} lxlsx_edit_buf;
-
 typedef struct {
     char *target;
     size_t entry_index;
-    unsigned char *xml;
-    size_t xml_len;
     const lxlsx_edit_change **changes;
     size_t change_count;
     size_t change_cap;
@@ -145,6 +197,7 @@ typedef struct {
     size_t row_dim_cap;
     int    has_drawing;     /* a <drawing r:id> ref must be spliced in */
     size_t drawing_rid;     /* the worksheet-rels rId for that drawing */
+    const lxlsx_edit_append *append;  /* rows appended after the data */
 } lxlsx_dirty_sheet;
 
 #define LXLSX_EDIT_CELL_CLOSE       "</c>"
@@ -253,6 +306,32 @@ static char *dup_range(const char *start, size_t len)
     return lxlsx_reader_strndup(start, len);
 }
 
+/* Length-aware substring search. */
+static const char *mem_find(const char *hay, size_t haylen, const char *needle)
+{
+    size_t nl = strlen(needle);
+    size_t i;
+    if (nl == 0 || haylen < nl)
+        return NULL;
+    for (i = 0; i + nl <= haylen; i++) {
+        if (memcmp(hay + i, needle, nl) == 0)
+            return hay + i;
+    }
+    return NULL;
+}
+
+static size_t parse_count_attr(const char *open, const char *gt)
+{
+    const char *c = mem_find(open, (size_t)(gt - open), "count=\"");
+    size_t v = 0;
+    if (c) {
+        c += strlen("count=\"");
+        while (c < gt && *c >= '0' && *c <= '9')
+            v = v * 10 + (size_t)(*c++ - '0');
+    }
+    return v;
+}
+
 static int edit_buf_write_callback(void *userdata, const char *data, size_t len)
 {
     return buf_append((lxlsx_edit_buf *)userdata, data, len);
@@ -374,8 +453,9 @@ static int xml_local_name_eq(const char *start, size_t len, const char *name)
     return strlen(name) == local_len && strncmp(local, name, local_len) == 0;
 }
 
-static char *extract_attr(const char *tag_start, const char *tag_end,
-                          const char *name)
+/* Find the value of attribute `name` in a tag, without copying it. */
+static int find_attr(const char *tag_start, const char *tag_end,
+                     const char *name, const char **value, size_t *value_len)
 {
     const char *p = tag_start + 1;
 
@@ -416,12 +496,26 @@ static char *extract_attr(const char *tag_start, const char *tag_end,
             p++;
         if (p >= tag_end)
             break;
-        if (xml_local_name_eq(attr_start, (size_t)(attr_end - attr_start), name))
-            return dup_range(value_start, (size_t)(p - value_start));
+        if (xml_local_name_eq(attr_start, (size_t)(attr_end - attr_start), name)) {
+            *value = value_start;
+            *value_len = (size_t)(p - value_start);
+            return 1;
+        }
         p++;
     }
 
-    return NULL;
+    return 0;
+}
+
+static char *extract_attr(const char *tag_start, const char *tag_end,
+                          const char *name)
+{
+    const char *value;
+    size_t value_len;
+
+    if (!find_attr(tag_start, tag_end, name, &value, &value_len))
+        return NULL;
+    return dup_range(value, value_len);
 }
 
 static int is_self_closing(const char *tag_start, const char *tag_end)
@@ -613,42 +707,6 @@ static int find_matching_end_tag(const char *start, const char *limit,
     return 0;
 }
 
-static int find_sheet_data(const char *xml, size_t len,
-                           const char **sheet_start,
-                           const char **sheet_end,
-                           const char **tag_end,
-                           const char **close_start)
-{
-    const char *limit = xml + len;
-    const char *p = xml;
-    lxlsx_edit_xml_tag tag;
-
-    while (xml_next_tag(p, limit, &tag)) {
-        lxlsx_edit_xml_tag close_tag;
-
-        p = tag.end + 1;
-        if (tag.is_end || !tag_name_is(&tag, "sheetData"))
-            continue;
-
-        *sheet_start = tag.start;
-        *tag_end = tag.end;
-        if (close_start)
-            *close_start = NULL;
-        if (tag.is_self_closing) {
-            *sheet_end = tag.end + 1;
-            return 1;
-        }
-        if (!find_matching_end_tag(tag.end + 1, limit, "sheetData", &close_tag))
-            return 0;
-        *sheet_end = close_tag.end + 1;
-        if (close_start)
-            *close_start = close_tag.start;
-        return 1;
-    }
-
-    return 0;
-}
-
 static int looks_numeric(const char *str)
 {
     char *end = NULL;
@@ -658,12 +716,37 @@ static int looks_numeric(const char *str)
     return end && *end == 0;
 }
 
+/*
+ * The digits of "%.17g", with a fast path for the integral values that make up
+ * most bulk data: below 1e16 they print as plain digits either way.
+ */
+static int buf_append_number(lxlsx_edit_buf *buf, double value)
+{
+    char number[64];
+
+    if (value > -1e16 && value < 1e16 && value == (double)(int64_t)value &&
+        (value != 0 || !signbit(value))) {
+        char *p = number + sizeof(number);
+        uint64_t u = value < 0 ? (uint64_t)(-(int64_t)value) : (uint64_t)value;
+
+        do {
+            *--p = (char)('0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (value < 0)
+            *--p = '-';
+        return buf_append(buf, p, (size_t)(number + sizeof(number) - p));
+    }
+
+    snprintf(number, sizeof(number), "%.17g", value);
+    return buf_append_s(buf, number);
+}
+
 static lxlsx_error append_cell_xml(lxlsx_edit_buf *buf,
                                    const lxlsx_edit_change *change,
                                    const char *ref,
                                    const char *style)
 {
-    char number[64];
     char style_buf[16];
 
     /* A restyle change overrides the original cell's s= index. */
@@ -672,7 +755,9 @@ static lxlsx_error append_cell_xml(lxlsx_edit_buf *buf,
         style = style_buf;
     }
 
-    if (buf_appendf(buf, "<c r=\"%s\"", ref) != 0)
+    if (buf_append_s(buf, "<c r=\"") != 0 ||
+        buf_append_s(buf, ref) != 0 ||
+        buf_append(buf, "\"", 1) != 0)
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
     if (style && *style) {
         if (buf_appendf(buf, " s=\"%s\"", style) != 0)
@@ -697,9 +782,8 @@ static lxlsx_error append_cell_xml(lxlsx_edit_buf *buf,
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
     if (change->type == LXLSX_EDIT_CHANGE_NUMBER) {
-        snprintf(number, sizeof(number), "%.17g", change->number);
         if (buf_append_s(buf, "<v>") != 0 ||
-            buf_append_s(buf, number) != 0 ||
+            buf_append_number(buf, change->number) != 0 ||
             buf_append_s(buf, "</v>") != 0)
             return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
     } else if (change->type == LXLSX_EDIT_CHANGE_STRING) {
@@ -1019,201 +1103,344 @@ static lxlsx_error append_existing_row_xml(
     return LXLSX_NO_ERROR;
 }
 
-static lxlsx_error append_missing_rows_until(
-    lxlsx_edit_buf *out,
-    const lxlsx_edit_prepared_change *prepared,
-    size_t prepared_count,
-    size_t *index,
-    lxlsx_row_t before_row,
-    int bounded)
-{
-    while (*index < prepared_count &&
-           (!bounded || prepared[*index].change->row < before_row)) {
-        lxlsx_row_t row = prepared[*index].change->row;
-        const char *row_ref = prepared[*index].row_ref;
-        size_t next = *index + 1;
-        lxlsx_error err;
+/*
+ * Compare only the style fields the snapshots emit into styles.xml (font, fill,
+ * border, number format, alignment) — never the whole struct: lxlsx_format
+ * carries live pointers, xf indices and inter-field padding that memcpy doesn't
+ * normalize, so a raw memcmp made dedup unreliable (style bloat) and read
+ * padding (UB-adjacent).
+ */
+static int format_style_equal(const lxlsx_format *a, const lxlsx_format *b)
+{
+    return a->bold == b->bold && a->italic == b->italic &&
+           a->underline == b->underline &&
+           a->font_strikeout == b->font_strikeout &&
+           a->font_color == b->font_color &&
+           a->font_size == b->font_size &&
+           strcmp(a->font_name, b->font_name) == 0 &&
+           a->pattern == b->pattern &&
+           a->fg_color == b->fg_color && a->bg_color == b->bg_color &&
+           a->left == b->left && a->right == b->right &&
+           a->top == b->top && a->bottom == b->bottom &&
+           a->diag_border == b->diag_border && a->diag_type == b->diag_type &&
+           a->left_color == b->left_color && a->right_color == b->right_color &&
+           a->top_color == b->top_color && a->bottom_color == b->bottom_color &&
+           a->diag_color == b->diag_color &&
+           strcmp(a->num_format, b->num_format) == 0 &&
+           a->text_h_align == b->text_h_align &&
+           a->text_v_align == b->text_v_align &&
+           a->text_wrap == b->text_wrap;
+}
 
-        while (next < prepared_count && prepared[next].change->row == row)
-            next++;
+static const char *sheet_target(lxlsx_edit_session *session, const char *sheet_name)
+{
+    size_t i;
+    lxlsx_reader_workbook *wb = session ? session->workbook : NULL;
+    if (!wb || wb->sheet_count == 0)
+        return NULL;
+    if (!sheet_name)
+        return wb->sheets[0].target;
+    for (i = 0; i < wb->sheet_count; i++) {
+        if (wb->sheets[i].name && strcmp(wb->sheets[i].name, sheet_name) == 0)
+            return wb->sheets[i].target;
+    }
+    return NULL;
+}
 
-        err = append_new_row_xml(out, row_ref, prepared + *index,
-                                 next - *index);
-        if (err != LXLSX_NO_ERROR)
-            return err;
-        *index = next;
+static lxlsx_edit_append *find_append(lxlsx_edit_session *session,
+                                      const char *target)
+{
+    size_t i;
+    for (i = 0; i < session->append_count; i++) {
+        if (session->appends[i].target == target)
+            return &session->appends[i];
     }
+    return NULL;
+}
 
-    return LXLSX_NO_ERROR;
+/* Replace old_len bytes at `at` with data. */
+static int buf_splice(lxlsx_edit_buf *buf, size_t at, size_t old_len,
+                      const char *data, size_t len)
+{
+    if (buf_reserve(buf, buf->len - old_len + len + 1) != 0)
+        return -1;
+    memmove(buf->data + at + len, buf->data + at + old_len,
+            buf->len - at - old_len + 1);
+    memcpy(buf->data + at, data, len);
+    buf->len = buf->len - old_len + len;
+    return 0;
 }
 
-static lxlsx_error patch_xml_with_changes(unsigned char **xml, size_t *xml_len,
-                                          const lxlsx_edit_change **changes,
-                                          size_t change_count)
+/* Close the open appended row, if any, and start <row r="row">. */
+static lxlsx_error append_open_row(lxlsx_edit_append *a, lxlsx_row_t row)
 {
-    const char *xml_start = (const char *)*xml;
-    const char *xml_end = xml_start + *xml_len;
-    lxlsx_edit_prepared_change *prepared = NULL;
-    size_t prepared_count = 0;
-    lxlsx_edit_buf out = {0};
-    const char *sheet_start = NULL;
-    const char *sheet_end = NULL;
-    const char *sheet_tag_end = NULL;
-    const char *sheet_close_start = NULL;
-    lxlsx_error err;
-    size_t change_index = 0;
+    char ref[16];
+    int n;
 
-    err = prepare_sheet_changes(changes, change_count, &prepared,
-                                &prepared_count);
-    if (err != LXLSX_NO_ERROR)
-        return err;
+    if (a->row_open && buf_append_s(&a->xml, LXLSX_EDIT_ROW_CLOSE) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
-    if (!find_sheet_data(xml_start, *xml_len, &sheet_start, &sheet_end,
-                         &sheet_tag_end, &sheet_close_start)) {
-        err = LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
-        goto done;
-    }
+    n = snprintf(ref, sizeof(ref), "%u", (unsigned int)row + 1);
+    if (buf_append_s(&a->xml, "<row r=\"") != 0 ||
+        buf_append(&a->xml, ref, (size_t)n) != 0 ||
+        buf_append(&a->xml, "\"", 1) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    a->row_attr_at = a->xml.len;
+    a->row_attr_len = 0;
+    if (buf_append(&a->xml, ">", 1) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
-    if (!sheet_close_start) {
-        const char *prefix_end = self_closing_prefix_end(sheet_start,
-                                                         sheet_tag_end);
-        if (buf_append(&out, xml_start, (size_t)(prefix_end - xml_start)) != 0 ||
-            buf_append_s(&out, ">") != 0) {
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-            goto done;
+    a->row = row;
+    a->row_open = 1;
+    a->has_cell = 0;
+    a->cell_shared = 0;
+    a->cell_string = 0;
+    return LXLSX_NO_ERROR;
+}
+
+/* Make `row` the open appended row. Rows only move forward. */
+static lxlsx_error append_seek_row(lxlsx_edit_append *a, lxlsx_row_t row)
+{
+    if (a->row_open && row == a->row)
+        return LXLSX_NO_ERROR;
+    if (a->row_open && row < a->row)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+    return append_open_row(a, row);
+}
+
+/* Index of an appended shared string, adding it on first use; *added is
+ * set when it was added. */
+static lxlsx_error append_shared_string(lxlsx_edit_session *session,
+                                        const char *string, size_t *index,
+                                        int *added)
+{
+    lxlsx_hash_element *element;
+    size_t len = strlen(string);
+
+    element = lxlsx_hash_key_exists(session->append_strings, (void *)string,
+                                    len);
+    *added = !element;
+    if (!element) {
+        char *key = strdup(string);
+        if (!key)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        element = lxlsx_insert_hash_element(session->append_strings, key,
+                                            NULL, len);
+        if (!element) {
+            free(key);
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
         }
+    }
 
-        err = append_missing_rows_until(&out, prepared, prepared_count,
-                                        &change_index, 0, 0);
-        if (err != LXLSX_NO_ERROR)
-            goto done;
+    *index = session->append_sst_base +
+             (size_t)(element - session->append_strings->elements);
+    return LXLSX_NO_ERROR;
+}
 
-        if (buf_append_matching_end_tag(&out, sheet_start, sheet_tag_end) != 0 ||
-            buf_append(&out, sheet_end, (size_t)(xml_end - sheet_end)) != 0) {
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-            goto done;
+/* Serialize a cell aimed at the append region onto the block. */
+static lxlsx_error append_block_cell(lxlsx_edit_session *session,
+                                     lxlsx_edit_append *a,
+                                     const lxlsx_edit_change *cell)
+{
+    char ref[LXLSX_MAX_CELL_NAME_LENGTH];
+    lxlsx_error err;
+
+    if (a->row_open && cell->row == a->row && a->has_cell) {
+        if (cell->col < a->col)
+            return LXLSX_ERROR_PARAMETER_VALIDATION;
+        if (cell->col == a->col) {
+            /* Rewriting the last cell replaces it. A string only it added
+             * goes too, unless another sheet has added one since. */
+            a->xml.len = a->cell_at;
+            a->xml.data[a->xml.len] = 0;
+            if (a->cell_shared)
+                session->append_sst_refs--;
+            if (a->cell_string &&
+                a->cell_string == session->append_strings->unique_count)
+                lxlsx_hash_remove_last(session->append_strings);
         }
-    } else {
-        const char *pos = xml_start;
-        const char *p = sheet_tag_end + 1;
-        lxlsx_edit_xml_tag tag;
+    }
 
-        while (xml_next_tag(p, sheet_close_start, &tag)) {
-            const char *row_end;
-            const char *row_close_start = NULL;
-            char *row_ref_attr = NULL;
-            lxlsx_row_t xml_row = 0;
-            int valid_row = 0;
+    err = append_seek_row(a, cell->row);
+    if (err != LXLSX_NO_ERROR)
+        return err;
 
-            p = tag.end + 1;
-            if (tag.is_end || !tag_name_is(&tag, "row"))
-                continue;
+    lxlsx_rowcol_to_cell(ref, cell->row, cell->col);
+    a->cell_at = a->xml.len;
+    a->cell_attr_at = a->cell_at + strlen("<c r=\"") + strlen(ref) + 1;
+    a->cell_attr_len = 0;
+    a->cell_shared = 0;
+    a->cell_string = 0;
 
-            if (tag.is_self_closing) {
-                row_end = tag.end + 1;
-            } else {
-                lxlsx_edit_xml_tag close_tag;
-                if (!find_matching_end_tag(tag.end + 1, sheet_close_start,
-                                           "row", &close_tag))
-                    goto malformed;
-                row_close_start = close_tag.start;
-                row_end = close_tag.end + 1;
-            }
+    if (cell->type == LXLSX_EDIT_CHANGE_STRING && a->shared_strings) {
+        size_t index;
+        int added;
 
-            row_ref_attr = extract_attr(tag.start, tag.end, "r");
-            valid_row = parse_row_ref(row_ref_attr, &xml_row);
-            free(row_ref_attr);
+        err = append_shared_string(session, cell->string, &index, &added);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        if (added)
+            a->cell_string = session->append_strings->unique_count;
+        if (buf_append_s(&a->xml, "<c r=\"") != 0 ||
+            buf_append_s(&a->xml, ref) != 0 ||
+            buf_append_s(&a->xml, "\" t=\"s\"><v>") != 0 ||
+            buf_append_number(&a->xml, (double)index) != 0 ||
+            buf_append_s(&a->xml, "</v>" LXLSX_EDIT_CELL_CLOSE) != 0)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        a->cell_shared = 1;
+        session->append_sst_refs++;
+    } else {
+        err = append_cell_xml(&a->xml, cell, ref, NULL);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+    }
 
-            if (!valid_row) {
-                p = row_end;
-                continue;
-            }
+    a->col = cell->col;
+    a->has_cell = 1;
+    return LXLSX_NO_ERROR;
+}
 
-            if (buf_append(&out, pos, (size_t)(tag.start - pos)) != 0) {
-                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-                goto done;
-            }
+/* The cellXfs count of the source styles.xml. */
+static lxlsx_error read_xf_count(lxlsx_edit_session *session, size_t *count)
+{
+    unsigned char *xml = NULL;
+    size_t xml_len = 0;
+    const char *open;
+    const char *gt = NULL;
+    lxlsx_error err;
+    int entry;
 
-            if (append_missing_rows_until(&out, prepared, prepared_count,
-                                          &change_index, xml_row, 1)
-                != LXLSX_NO_ERROR) {
-                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-                goto done;
-            }
+    entry = lxlsx_source_package_find_first(session->package, "xl/styles.xml");
+    if (entry < 0)
+        return LXLSX_ERROR_ZIP_FILE_ADD;
+    err = lxlsx_source_package_read_entry(session->package, (size_t)entry,
+                                          &xml, &xml_len);
+    if (err != LXLSX_NO_ERROR)
+        return err;
 
-            if (change_index < prepared_count &&
-                prepared[change_index].change->row == xml_row) {
-                size_t next = change_index + 1;
-                lxlsx_error row_err;
-                while (next < prepared_count &&
-                       prepared[next].change->row == xml_row)
-                    next++;
+    open = mem_find((const char *)xml, xml_len, "<cellXfs");
+    if (open)
+        gt = (const char *)memchr(open, '>',
+                                  xml_len - (size_t)(open - (const char *)xml));
+    if (gt)
+        *count = parse_count_attr(open, gt);
+    else
+        err = LXLSX_ERROR_PARAMETER_VALIDATION;
 
-                row_err = append_existing_row_xml(&out, tag.start, row_end,
-                                                  tag.end, row_close_start,
-                                                  prepared + change_index,
-                                                  next - change_index);
-                if (row_err != LXLSX_NO_ERROR) {
-                    err = row_err;
-                    goto done;
-                }
-                change_index = next;
-            } else if (buf_append(&out, tag.start,
-                                  (size_t)(row_end - tag.start)) != 0) {
-                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-                goto done;
-            }
+    free(xml);
+    return err;
+}
 
-            pos = row_end;
-            p = row_end;
-        }
+/*
+ * The xf index for an appended style: either a format snapshot (owned by this
+ * call) or a number format code. Equal styles share one xf.
+ */
+static lxlsx_error append_style_xf(lxlsx_edit_session *session,
+                                   lxlsx_format *style,
+                                   const char *number_format, size_t *xf)
+{
+    lxlsx_edit_append_style *entry;
+    lxlsx_error err;
+    size_t i;
 
-        if (buf_append(&out, pos, (size_t)(sheet_close_start - pos)) != 0) {
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-            goto done;
+    if (!session->append_xf_base_known) {
+        err = read_xf_count(session, &session->append_xf_base);
+        if (err != LXLSX_NO_ERROR) {
+            free(style);
+            return err;
         }
+        session->append_xf_base_known = 1;
+    }
 
-        err = append_missing_rows_until(&out, prepared, prepared_count,
-                                        &change_index, 0, 0);
-        if (err != LXLSX_NO_ERROR)
-            goto done;
-
-        if (buf_append(&out, sheet_close_start,
-                       (size_t)(xml_end - sheet_close_start)) != 0) {
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-            goto done;
+    /* Appended rows tend to repeat the latest styles; look there first. */
+    for (i = session->append_style_count; i > 0; i--) {
+        entry = &session->append_styles[i - 1];
+        if (style ? entry->style && format_style_equal(entry->style, style)
+                  : entry->number_format &&
+                    strcmp(entry->number_format, number_format) == 0) {
+            free(style);
+            *xf = session->append_xf_base + i - 1;
+            return LXLSX_NO_ERROR;
         }
     }
 
-    free(*xml);
-    *xml = (unsigned char *)out.data;
-    *xml_len = out.len;
-    out.data = NULL;
-    err = LXLSX_NO_ERROR;
-    goto done;
+    if (session->append_style_count >= session->append_style_cap) {
+        size_t cap = session->append_style_cap ? session->append_style_cap * 2 : 8;
+        lxlsx_edit_append_style *next = (lxlsx_edit_append_style *)realloc(
+            session->append_styles, cap * sizeof(*next));
+        if (!next) {
+            free(style);
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        }
+        session->append_styles = next;
+        session->append_style_cap = cap;
+    }
 
-malformed:
-    err = LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+    entry = &session->append_styles[session->append_style_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->style_index = -1;
+    entry->style = style;
+    if (!style) {
+        entry->number_format = strdup(number_format);
+        if (!entry->number_format)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
 
-done:
-    free(out.data);
-    free_prepared_changes(prepared, prepared_count);
-    return err;
+    *xf = session->append_xf_base + session->append_style_count++;
+    return LXLSX_NO_ERROR;
 }
 
-static const char *sheet_target(lxlsx_edit_session *session, const char *sheet_name)
+/* Point the last appended cell at a style (see append_style_xf()). */
+static lxlsx_error append_block_style(lxlsx_edit_session *session,
+                                      lxlsx_edit_append *a,
+                                      lxlsx_row_t row, lxlsx_col_t col,
+                                      lxlsx_format *style,
+                                      const char *number_format)
 {
-    size_t i;
-    lxlsx_reader_workbook *wb = session ? session->workbook : NULL;
-    if (!wb || wb->sheet_count == 0)
-        return NULL;
-    if (!sheet_name)
-        return wb->sheets[0].target;
-    for (i = 0; i < wb->sheet_count; i++) {
-        if (wb->sheets[i].name && strcmp(wb->sheets[i].name, sheet_name) == 0)
-            return wb->sheets[i].target;
+    char attr[32];
+    size_t xf;
+    lxlsx_error err;
+    int n;
+
+    if (!a->row_open || !a->has_cell || row != a->row || col != a->col) {
+        free(style);
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
     }
-    return NULL;
+
+    err = append_style_xf(session, style, number_format, &xf);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+
+    n = snprintf(attr, sizeof(attr), " s=\"%zu\"", xf);
+    if (buf_splice(&a->xml, a->cell_attr_at, a->cell_attr_len, attr,
+                   (size_t)n) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    a->cell_attr_len = (size_t)n;
+    return LXLSX_NO_ERROR;
+}
+
+/* Set the height of the open appended row, or of a new one after it. */
+static lxlsx_error append_block_row_height(lxlsx_edit_append *a,
+                                           lxlsx_row_t row, double height)
+{
+    char attr[64];
+    lxlsx_error err;
+    int n;
+
+    err = append_seek_row(a, row);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+
+    n = snprintf(attr, sizeof(attr), " ht=\"%g\" customHeight=\"1\"", height);
+    if (buf_splice(&a->xml, a->row_attr_at, a->row_attr_len, attr,
+                   (size_t)n) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    if (a->has_cell) {
+        a->cell_at = a->cell_at - a->row_attr_len + (size_t)n;
+        a->cell_attr_at = a->cell_attr_at - a->row_attr_len + (size_t)n;
+    }
+    a->row_attr_len = (size_t)n;
+    return LXLSX_NO_ERROR;
 }
 
 static lxlsx_error append_change(lxlsx_edit_session *session,
@@ -1229,6 +1456,7 @@ static lxlsx_error append_change(lxlsx_edit_session *session,
 {
     const char *target;
     lxlsx_edit_change *change;
+    lxlsx_edit_append *append;
 
     if (!session)
         return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
@@ -1241,6 +1469,24 @@ static lxlsx_error append_change(lxlsx_edit_session *session,
     if (!target)
         return LXLSX_ERROR_PARAMETER_VALIDATION;
 
+    /* Cells below the existing rows go straight into the append block. */
+    append = find_append(session, target);
+    if (append && row >= append->first_row) {
+        lxlsx_edit_change cell;
+
+        memset(&cell, 0, sizeof(cell));
+        cell.row = row;
+        cell.col = col;
+        cell.type = type;
+        cell.number = number;
+        cell.boolean = boolean ? 1 : 0;
+        cell.string = (char *)string;
+        cell.formula = (char *)formula;
+        cell.cached_result = (char *)cached_result;
+        cell.style_index = -1;
+        return append_block_cell(session, append, &cell);
+    }
+
     if (session->change_count >= session->change_cap) {
         size_t cap = session->change_cap ? session->change_cap * 2 : 8;
         lxlsx_edit_change *next =
@@ -1282,11 +1528,335 @@ static lxlsx_error append_change(lxlsx_edit_session *session,
     return LXLSX_NO_ERROR;
 }
 
-lxlsx_edit_session *lxlsx_edit_open(const char *path)
+/*****************************************************************************
+ *
+ * Template cache.
+ *
+ * Opened source packages and their parsed workbook metadata are immutable, so
+ * sessions on the same unchanged file can share them. Entries are keyed by
+ * path, modification time and size, and reference counted: the cache holds
+ * one reference and every session using the entry another.
+ *
+ ****************************************************************************/
+
+struct lxlsx_edit_template {
+    char *path;
+    int64_t mtime;
+    long mtime_nsec;
+    uint64_t size;
+    lxlsx_source_package *package;
+    lxlsx_reader_workbook *workbook;
+    size_t refs;
+    uint64_t last_use;
+    lxlsx_edit_template *next;
+};
+
+static lxlsx_edit_template *template_cache;
+static size_t template_cache_bytes;
+static size_t template_cache_max = LXLSX_EDIT_TEMPLATE_CACHE_BYTES;
+static uint64_t template_cache_clock;
+static uint64_t template_cache_hits;
+static uint64_t template_cache_misses;
+
+/* The critical sections are a few pointer updates, so a spin lock will do and
+ * keeps the library free of a thread library dependency. */
+#if defined(_MSC_VER)
+#include <intrin.h>
+static volatile long template_cache_busy;
+
+static void template_cache_lock(void)
 {
-    lxlsx_edit_session *session;
+    while (_InterlockedExchange(&template_cache_busy, 1))
+        ;
+}
+
+static void template_cache_unlock(void)
+{
+    _InterlockedExchange(&template_cache_busy, 0);
+}
+#else
+static int template_cache_busy;
+
+static void template_cache_lock(void)
+{
+    while (__atomic_exchange_n(&template_cache_busy, 1, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static void template_cache_unlock(void)
+{
+    __atomic_store_n(&template_cache_busy, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+static int template_stat(const char *path, int64_t *mtime, long *mtime_nsec,
+                         uint64_t *size)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+        return -1;
+    *mtime = (int64_t)st.st_mtime;
+#if defined(__APPLE__)
+    *mtime_nsec = (long)st.st_mtimespec.tv_nsec;
+#elif defined(st_mtime)
+    /* glibc and the BSDs define st_mtime on top of a timespec st_mtim. */
+    *mtime_nsec = (long)st.st_mtim.tv_nsec;
+#else
+    *mtime_nsec = 0;
+#endif
+    *size = (uint64_t)st.st_size;
+    return 0;
+}
+
+/* Open the package at path and the reader workbook on it. sst_mode STREAMING
+ * leaves the shared strings unparsed, for callers that only need the
+ * workbook's sheets and part names. */
+static lxlsx_error open_source_ex(const char *path,
+                                  lxlsx_reader_sst_mode sst_mode,
+                                  lxlsx_source_package **package,
+                                  lxlsx_reader_workbook **workbook)
+{
+    lxlsx_reader_open_options opts = {0};
     size_t data_len = 0;
     const unsigned char *data;
+    lxlsx_error err;
+
+    err = lxlsx_source_package_open(path, package);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+
+    opts.sst_mode = sst_mode;
+    data = lxlsx_source_package_data(*package, &data_len);
+    if (lxlsx_reader_workbook_open_memory_borrowed_ex(data, data_len, &opts,
+                                                      workbook)
+        != LXLSX_READER_NO_ERROR) {
+        lxlsx_source_package_close(*package);
+        *package = NULL;
+        return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+    }
+    return LXLSX_NO_ERROR;
+}
+
+static lxlsx_error open_source(const char *path, lxlsx_source_package **package,
+                               lxlsx_reader_workbook **workbook)
+{
+    return open_source_ex(path, LXLSX_READER_SST_MODE_FULL, package, workbook);
+}
+
+static void template_free(lxlsx_edit_template *entry)
+{
+    lxlsx_reader_workbook_close(entry->workbook);
+    lxlsx_source_package_close(entry->package);
+    free(entry->path);
+    free(entry);
+}
+
+/* Free a chain of entries that were unlinked with no references left. */
+static void template_free_chain(lxlsx_edit_template *entry)
+{
+    lxlsx_edit_template *next;
+
+    for (; entry; entry = next) {
+        next = entry->next;
+        template_free(entry);
+    }
+}
+
+/* Drop the cache's reference to *link and unlink it; the entry is moved to
+ * *freed when no session uses it. Called with the lock held. */
+static void template_unlink(lxlsx_edit_template **link,
+                            lxlsx_edit_template **freed)
+{
+    lxlsx_edit_template *entry = *link;
+
+    *link = entry->next;
+    template_cache_bytes -= (size_t)entry->size;
+    entry->next = NULL;
+    if (--entry->refs == 0) {
+        entry->next = *freed;
+        *freed = entry;
+    }
+}
+
+/* Evict least recently used entries until the budget is met. Called with the
+ * lock held. */
+static void template_evict(lxlsx_edit_template **freed)
+{
+    while (template_cache && template_cache_bytes > template_cache_max) {
+        lxlsx_edit_template **oldest = &template_cache;
+        lxlsx_edit_template **link;
+
+        for (link = &template_cache; *link; link = &(*link)->next) {
+            if ((*link)->last_use < (*oldest)->last_use)
+                oldest = link;
+        }
+        template_unlink(oldest, freed);
+    }
+}
+
+static void template_release(lxlsx_edit_template *entry)
+{
+    size_t refs;
+
+    template_cache_lock();
+    refs = --entry->refs;
+    template_cache_unlock();
+    if (refs == 0)
+        template_free(entry);
+}
+
+/* Forget cached entries of a path, e.g. after saving over it. */
+static void template_forget(const char *path)
+{
+    lxlsx_edit_template *freed = NULL;
+    lxlsx_edit_template **link;
+
+    template_cache_lock();
+    for (link = &template_cache; *link;) {
+        if (strcmp((*link)->path, path) == 0)
+            template_unlink(link, &freed);
+        else
+            link = &(*link)->next;
+    }
+    template_cache_unlock();
+    template_free_chain(freed);
+}
+
+/* Find a cached entry for the file at path, or read and cache it. Returns an
+ * entry with a reference for the caller, or NULL on error. */
+static lxlsx_edit_template *template_acquire(const char *path)
+{
+    lxlsx_edit_template *entry = NULL;
+    lxlsx_edit_template *freed = NULL;
+    lxlsx_edit_template **link;
+    int64_t mtime, check_mtime;
+    long nsec, check_nsec;
+    uint64_t size, check_size;
+
+    if (template_stat(path, &mtime, &nsec, &size) != 0)
+        return NULL;
+
+    template_cache_lock();
+    for (link = &template_cache; *link; link = &(*link)->next) {
+        if (strcmp((*link)->path, path) != 0)
+            continue;
+        if ((*link)->mtime == mtime && (*link)->mtime_nsec == nsec &&
+            (*link)->size == size) {
+            entry = *link;
+            entry->refs++;
+            entry->last_use = ++template_cache_clock;
+            template_cache_hits++;
+        } else {
+            /* The file changed since it was cached. */
+            template_unlink(link, &freed);
+        }
+        break;
+    }
+    if (!entry)
+        template_cache_misses++;
+    template_cache_unlock();
+    template_free_chain(freed);
+    if (entry)
+        return entry;
+
+    /* Read the file outside the lock. */
+    entry = (lxlsx_edit_template *)calloc(1, sizeof(*entry));
+    if (!entry)
+        return NULL;
+    entry->path = strdup(path);
+    if (!entry->path ||
+        open_source(path, &entry->package, &entry->workbook) != LXLSX_NO_ERROR) {
+        free(entry->path);
+        free(entry);
+        return NULL;
+    }
+    entry->mtime = mtime;
+    entry->mtime_nsec = nsec;
+    entry->size = size;
+    entry->refs = 1;
+
+    /* Only cache what was read if the file did not change meanwhile, and if
+     * it fits the budget at all. */
+    if (template_stat(path, &check_mtime, &check_nsec, &check_size) != 0 ||
+        check_mtime != mtime || check_nsec != nsec || check_size != size ||
+        size > template_cache_max)
+        return entry;
+
+    template_cache_lock();
+    for (link = &template_cache; *link; link = &(*link)->next) {
+        lxlsx_edit_template *other = *link;
+        if (strcmp(other->path, path) == 0 && other->mtime == mtime &&
+            other->mtime_nsec == nsec && other->size == size) {
+            /* Another thread cached it first: use that one. */
+            other->refs++;
+            other->last_use = ++template_cache_clock;
+            entry->next = freed;
+            freed = entry;
+            entry = other;
+            break;
+        }
+    }
+    if (!*link) {
+        entry->refs++;
+        entry->last_use = ++template_cache_clock;
+        entry->next = template_cache;
+        template_cache = entry;
+        template_cache_bytes += (size_t)size;
+        template_evict(&freed);
+    }
+    template_cache_unlock();
+    template_free_chain(freed);
+    return entry;
+}
+
+void lxlsx_edit_template_cache_limit(size_t max_bytes)
+{
+    lxlsx_edit_template *freed = NULL;
+
+    template_cache_lock();
+    template_cache_max = max_bytes ? max_bytes : LXLSX_EDIT_TEMPLATE_CACHE_BYTES;
+    template_evict(&freed);
+    template_cache_unlock();
+    template_free_chain(freed);
+}
+
+void lxlsx_edit_template_cache_stats(lxlsx_edit_template_stats *stats)
+{
+    lxlsx_edit_template *entry;
+
+    if (!stats)
+        return;
+    memset(stats, 0, sizeof(*stats));
+    template_cache_lock();
+    stats->hits = template_cache_hits;
+    stats->misses = template_cache_misses;
+    for (entry = template_cache; entry; entry = entry->next)
+        stats->entries++;
+    stats->bytes = template_cache_bytes;
+    template_cache_unlock();
+}
+
+void lxlsx_edit_template_cache_clear(void)
+{
+    lxlsx_edit_template *freed = NULL;
+
+    template_cache_lock();
+    while (template_cache)
+        template_unlink(&template_cache, &freed);
+    template_cache_unlock();
+    template_free_chain(freed);
+}
+
+lxlsx_edit_session *lxlsx_edit_open(const char *path)
+{
+    return lxlsx_edit_open_opt(path, NULL);
+}
+
+lxlsx_edit_session *lxlsx_edit_open_opt(const char *path,
+                                        const lxlsx_edit_open_options *options)
+{
+    lxlsx_edit_session *session;
 
     if (!path)
         return NULL;
@@ -1295,15 +1865,27 @@ lxlsx_edit_session *lxlsx_edit_open(const char *path)
     if (!session)
         return NULL;
 
-    if (lxlsx_source_package_open(path, &session->package) != LXLSX_NO_ERROR) {
+    session->path = strdup(path);
+    if (!session->path) {
         free(session);
         return NULL;
     }
 
-    data = lxlsx_source_package_data(session->package, &data_len);
-    if (lxlsx_reader_workbook_open_memory_borrowed(data, data_len, &session->workbook)
-        != LXLSX_READER_NO_ERROR) {
-        lxlsx_source_package_close(session->package);
+    if (options && options->cache_template) {
+        session->shared = template_acquire(path);
+        if (!session->shared) {
+            free(session->path);
+            free(session);
+            return NULL;
+        }
+        session->package = session->shared->package;
+        session->workbook = session->shared->workbook;
+        return session;
+    }
+
+    if (open_source(path, &session->package, &session->workbook)
+        != LXLSX_NO_ERROR) {
+        free(session->path);
         free(session);
         return NULL;
     }
@@ -1351,11 +1933,39 @@ void lxlsx_edit_close(lxlsx_edit_session *session)
     for (i = 0; i < session->chart_count; i++)
         free(session->charts[i].target);
     free(session->charts);
-    lxlsx_reader_workbook_close(session->workbook);
-    lxlsx_source_package_close(session->package);
+    for (i = 0; i < session->append_count; i++)
+        free(session->appends[i].xml.data);
+    free(session->appends);
+    for (i = 0; i < session->append_style_count; i++) {
+        free(session->append_styles[i].style);
+        free(session->append_styles[i].number_format);
+    }
+    free(session->append_styles);
+    lxlsx_hash_free(session->append_strings);
+    if (session->shared) {
+        template_release(session->shared);
+    } else {
+        lxlsx_reader_workbook_close(session->workbook);
+        lxlsx_source_package_close(session->package);
+    }
+    free(session->path);
     free(session);
 }
 
+lxlsx_reader_error lxlsx_edit_open_reader(lxlsx_edit_session *session,
+                                          lxlsx_reader_workbook **out)
+{
+    const unsigned char *data;
+    size_t data_len = 0;
+
+    if (!session || !out)
+        return LXLSX_READER_ERROR_NULL_PARAMETER;
+
+    data = lxlsx_source_package_data(session->package, &data_len);
+    return lxlsx_reader_workbook_open_view(session->workbook, data, data_len,
+                                           out);
+}
+
 size_t lxlsx_edit_sheet_count(lxlsx_edit_session *session)
 {
     if (!session || !session->workbook)
@@ -1421,6 +2031,7 @@ lxlsx_error lxlsx_edit_set_number_format(lxlsx_edit_session *session,
                                          const char *format_code)
 {
     const char *target;
+    lxlsx_edit_append *append;
     size_t i;
 
     if (!session || !format_code || !*format_code)
@@ -1430,6 +2041,10 @@ lxlsx_error lxlsx_edit_set_number_format(lxlsx_edit_session *session,
     if (!target)
         return LXLSX_ERROR_PARAMETER_VALIDATION;
 
+    append = find_append(session, target);
+    if (append && row >= append->first_row)
+        return append_block_style(session, append, row, col, NULL, format_code);
+
     /* Attach the format to the most recent value change for this cell (the
      * caller writes the value immediately before requesting the format). */
     for (i = session->change_count; i > 0; i--) {
@@ -1446,6 +2061,43 @@ lxlsx_error lxlsx_edit_set_number_format(lxlsx_edit_session *session,
     return LXLSX_ERROR_PARAMETER_VALIDATION;
 }
 
+/*
+ * Shallow snapshot of a format: only scalar style fields are read later, so the
+ * format object's lifetime no longer matters.
+ */
+static lxlsx_format *snapshot_format(const lxlsx_format *format)
+{
+    lxlsx_format *copy = (lxlsx_format *)malloc(sizeof(lxlsx_format));
+    if (!copy)
+        return NULL;
+    memcpy(copy, format, sizeof(lxlsx_format));
+
+    /* Replicate the writer's solid-fill fg/bg normalization so a
+     * Format::background() color lands in fgColor like create mode
+     * (see lxlsx_workbook fill prep). */
+    if (copy->pattern == LXLSX_PATTERN_SOLID &&
+        copy->bg_color != LXLSX_COLOR_UNSET &&
+        copy->fg_color != LXLSX_COLOR_UNSET) {
+        lxlsx_color_t t = copy->fg_color;
+        copy->fg_color = copy->bg_color;
+        copy->bg_color = t;
+    }
+    if (copy->pattern <= LXLSX_PATTERN_SOLID &&
+        copy->bg_color != LXLSX_COLOR_UNSET &&
+        copy->fg_color == LXLSX_COLOR_UNSET) {
+        copy->fg_color = copy->bg_color;
+        copy->bg_color = LXLSX_COLOR_UNSET;
+        copy->pattern = LXLSX_PATTERN_SOLID;
+    }
+    if (copy->pattern <= LXLSX_PATTERN_SOLID &&
+        copy->bg_color == LXLSX_COLOR_UNSET &&
+        copy->fg_color != LXLSX_COLOR_UNSET) {
+        copy->pattern = LXLSX_PATTERN_SOLID;
+    }
+
+    return copy;
+}
+
 lxlsx_error lxlsx_edit_set_format(lxlsx_edit_session *session,
                                   const char *sheet_name,
                                   lxlsx_row_t row,
@@ -1453,6 +2105,7 @@ lxlsx_error lxlsx_edit_set_format(lxlsx_edit_session *session,
                                   const lxlsx_format *format)
 {
     const char *target;
+    lxlsx_edit_append *append;
     size_t i;
 
     if (!session || !format)
@@ -1462,39 +2115,20 @@ lxlsx_error lxlsx_edit_set_format(lxlsx_edit_session *session,
     if (!target)
         return LXLSX_ERROR_PARAMETER_VALIDATION;
 
+    append = find_append(session, target);
+    if (append && row >= append->first_row) {
+        lxlsx_format *copy = snapshot_format(format);
+        if (!copy)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        return append_block_style(session, append, row, col, copy, NULL);
+    }
+
     for (i = session->change_count; i > 0; i--) {
         lxlsx_edit_change *c = &session->changes[i - 1];
         if (c->row == row && c->col == col && strcmp(c->target, target) == 0) {
-            /* Shallow snapshot: only scalar style fields are read later, so the
-             * format object's lifetime no longer matters. */
-            lxlsx_format *copy = (lxlsx_format *)malloc(sizeof(lxlsx_format));
+            lxlsx_format *copy = snapshot_format(format);
             if (!copy)
                 return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-            memcpy(copy, format, sizeof(lxlsx_format));
-
-            /* Replicate the writer's solid-fill fg/bg normalization so a
-             * Format::background() color lands in fgColor like create mode
-             * (see lxlsx_workbook fill prep). */
-            if (copy->pattern == LXLSX_PATTERN_SOLID &&
-                copy->bg_color != LXLSX_COLOR_UNSET &&
-                copy->fg_color != LXLSX_COLOR_UNSET) {
-                lxlsx_color_t t = copy->fg_color;
-                copy->fg_color = copy->bg_color;
-                copy->bg_color = t;
-            }
-            if (copy->pattern <= LXLSX_PATTERN_SOLID &&
-                copy->bg_color != LXLSX_COLOR_UNSET &&
-                copy->fg_color == LXLSX_COLOR_UNSET) {
-                copy->fg_color = copy->bg_color;
-                copy->bg_color = LXLSX_COLOR_UNSET;
-                copy->pattern = LXLSX_PATTERN_SOLID;
-            }
-            if (copy->pattern <= LXLSX_PATTERN_SOLID &&
-                copy->bg_color == LXLSX_COLOR_UNSET &&
-                copy->fg_color != LXLSX_COLOR_UNSET) {
-                copy->pattern = LXLSX_PATTERN_SOLID;
-            }
-
             free(c->style);
             c->style = copy;
             return LXLSX_NO_ERROR;
@@ -1725,6 +2359,7 @@ lxlsx_error lxlsx_edit_set_row_height(lxlsx_edit_session *session,
                                      double height)
 {
     const char *target;
+    lxlsx_edit_append *append;
     lxlsx_edit_row_dim *r;
 
     if (!session)
@@ -1736,6 +2371,10 @@ lxlsx_error lxlsx_edit_set_row_height(lxlsx_edit_session *session,
     if (!target)
         return LXLSX_ERROR_PARAMETER_VALIDATION;
 
+    append = find_append(session, target);
+    if (append && row >= append->first_row)
+        return append_block_row_height(append, row, height);
+
     if (session->row_dim_count >= session->row_dim_cap) {
         size_t cap = session->row_dim_cap ? session->row_dim_cap * 2 : 8;
         lxlsx_edit_row_dim *next = (lxlsx_edit_row_dim *)realloc(session->row_dims, cap * sizeof(*next));
@@ -1760,7 +2399,6 @@ static void free_dirty_sheets(lxlsx_dirty_sheet *sheets, size_t count)
     size_t i;
     for (i = 0; i < count; i++) {
         free(sheets[i].target);
-        free(sheets[i].xml);
         free(sheets[i].changes);
         free(sheets[i].merges);
         free(sheets[i].cols);
@@ -1805,6 +2443,20 @@ static lxlsx_error dirty_sheet_add_col(lxlsx_dirty_sheet *sheet,
     return LXLSX_NO_ERROR;
 }
 
+/* By row, then in the order the heights were set, which is their order in
+ * the session. */
+static int row_dim_cmp(const void *a, const void *b)
+{
+    const lxlsx_edit_row_dim *left = *(const lxlsx_edit_row_dim *const *)a;
+    const lxlsx_edit_row_dim *right = *(const lxlsx_edit_row_dim *const *)b;
+
+    if (left->row != right->row)
+        return left->row < right->row ? -1 : 1;
+    if (left != right)
+        return left < right ? -1 : 1;
+    return 0;
+}
+
 static lxlsx_error dirty_sheet_add_row_dim(lxlsx_dirty_sheet *sheet,
                                            const lxlsx_edit_row_dim *rd)
 {
@@ -1842,7 +2494,6 @@ static lxlsx_error get_dirty_sheet(lxlsx_edit_session *session,
 {
     lxlsx_dirty_sheet *sheet = find_dirty_sheet(*sheets, *count, target);
     int entry_index;
-    lxlsx_error err;
 
     if (sheet) {
         *out = sheet;
@@ -1870,14 +2521,6 @@ static lxlsx_error get_dirty_sheet(lxlsx_edit_session *session,
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
     sheet->entry_index = (size_t)entry_index;
 
-    err = lxlsx_source_package_read_entry(session->package, sheet->entry_index,
-                                          &sheet->xml, &sheet->xml_len);
-    if (err != LXLSX_NO_ERROR) {
-        free(sheet->target);
-        memset(sheet, 0, sizeof(*sheet));
-        return err;
-    }
-
     (*count)++;
     *out = sheet;
     return LXLSX_NO_ERROR;
@@ -1903,20 +2546,6 @@ static lxlsx_error dirty_sheet_add_change(lxlsx_dirty_sheet *sheet,
     return LXLSX_NO_ERROR;
 }
 
-/* Length-aware substring search. */
-static const char *mem_find(const char *hay, size_t haylen, const char *needle)
-{
-    size_t nl = strlen(needle);
-    size_t i;
-    if (nl == 0 || haylen < nl)
-        return NULL;
-    for (i = 0; i + nl <= haylen; i++) {
-        if (memcmp(hay + i, needle, nl) == 0)
-            return hay + i;
-    }
-    return NULL;
-}
-
 /*
  * ECMA-376 child element order for <worksheet>. Used to insert a new child at
  * the schema-correct position when it is absent — so we never place, say,
@@ -2292,1395 +2921,4785 @@ done:
     return err;
 }
 
-static int append_attr_escaped(lxlsx_edit_buf *buf, const char *s)
+/* Inflated worksheet bytes are pulled from the source package in chunks of
+ * this size. */
+#define LXLSX_EDIT_STREAM_CHUNK 65536
+
+/*
+ * A dirty worksheet being patched on its way from the source package to the
+ * output. The window holds only inflated bytes that haven't been written out
+ * yet: the part before <sheetData>, one (possibly incomplete) row, or the part
+ * after </sheetData>. Memory is therefore bounded by the largest row and the
+ * change set, not by the size of the sheet.
+ */
+typedef struct {
+    const lxlsx_dirty_sheet *sheet;
+    lxlsx_source_package_entry_stream *in;
+    lxlsx_source_package_sink *out;
+    lxlsx_edit_buf window;
+    size_t pos;                 /* window bytes already written out */
+    int eof;
+    int done;                   /* the whole part has been written */
+    lxlsx_edit_prepared_change *prepared;
+    size_t prepared_count;
+    size_t change_index;
+    size_t row_dim_index;       /* first row height not below the stream */
+    lxlsx_edit_buf row;         /* scratch for one rebuilt row */
+} lxlsx_edit_sheet_stream;
+
+/* Drop the written part of the window and append the next inflated chunk. */
+static lxlsx_error sheet_stream_fill(lxlsx_edit_sheet_stream *s)
 {
-    for (; *s; s++) {
-        const char *rep = NULL;
-        switch (*s) {
-        case '&': rep = "&amp;"; break;
-        case '<': rep = "&lt;"; break;
-        case '>': rep = "&gt;"; break;
-        case '"': rep = "&quot;"; break;
-        default: break;
-        }
-        if (rep) { if (buf_append_s(buf, rep) != 0) return -1; }
-        else if (buf_append(buf, s, 1) != 0) return -1;
+    size_t got = 0;
+    lxlsx_error err;
+
+    if (s->pos > 0) {
+        memmove(s->window.data, s->window.data + s->pos, s->window.len - s->pos);
+        s->window.len -= s->pos;
+        s->pos = 0;
     }
-    return 0;
+    if (buf_reserve(&s->window, s->window.len + LXLSX_EDIT_STREAM_CHUNK + 1) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    err = lxlsx_source_package_entry_stream_read(
+        s->in, s->window.data + s->window.len, LXLSX_EDIT_STREAM_CHUNK, &got);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    s->window.len += got;
+    s->window.data[s->window.len] = 0;
+    if (got == 0)
+        s->eof = 1;
+    return LXLSX_NO_ERROR;
 }
 
-static size_t parse_count_attr(const char *open, const char *gt)
+/* Read the rest of the entry and hand the unwritten bytes over to the caller
+ * as a malloc'd buffer, for the buffer-based patchers. */
+static lxlsx_error sheet_stream_take_rest(lxlsx_edit_sheet_stream *s,
+                                          unsigned char **xml, size_t *xml_len)
 {
-    const char *c = mem_find(open, (size_t)(gt - open), "count=\"");
-    size_t v = 0;
-    if (c) {
-        c += strlen("count=\"");
-        while (c < gt && *c >= '0' && *c <= '9')
-            v = v * 10 + (size_t)(*c++ - '0');
+    lxlsx_error err;
+
+    while (!s->eof) {
+        err = sheet_stream_fill(s);
+        if (err != LXLSX_NO_ERROR)
+            return err;
     }
-    return v;
+    if (s->pos > 0) {
+        memmove(s->window.data, s->window.data + s->pos, s->window.len - s->pos);
+        s->window.len -= s->pos;
+        s->pos = 0;
+    }
+
+    *xml = (unsigned char *)s->window.data;
+    *xml_len = s->window.len;
+    memset(&s->window, 0, sizeof(s->window));
+    return LXLSX_NO_ERROR;
 }
 
-/*
- * Insert `entries` into the <tag> collection of `src`, bumping its count by
- * `added`. If the collection is absent it is created right after the opening
- * tag of `create_after` (a parent element). Returns a fresh buffer.
- */
-static lxlsx_error splice_collection(const char *src, size_t srclen,
-                                     const char *tag, const char *entries,
-                                     size_t added, const char *create_after,
-                                     char **out_data, size_t *out_len)
+static lxlsx_error sheet_stream_emit(lxlsx_edit_sheet_stream *s,
+                                     const char *data, size_t len)
 {
-    lxlsx_edit_buf out = {0};
-    char openpat[32], openbuf[48], closebuf[32];
-    const char *t, *gt;
-    lxlsx_error err = LXLSX_ERROR_PARAMETER_VALIDATION;
+    return lxlsx_source_package_sink_write(s->out, data, len);
+}
 
-    snprintf(openpat, sizeof(openpat), "<%s", tag);
-    snprintf(closebuf, sizeof(closebuf), "</%s>", tag);
-    t = mem_find(src, srclen, openpat);
+/* The number of heights set for row, from s->row_dim_index on. Rows are
+ * streamed in order, so the sorted heights are walked alongside them. */
+static size_t sheet_stream_row_dims(lxlsx_edit_sheet_stream *s,
+                                    lxlsx_row_t row)
+{
+    const lxlsx_dirty_sheet *sheet = s->sheet;
+    size_t next;
 
-    if (t) {
-        size_t total;
-        int self_closing;
-        gt = (const char *)memchr(t, '>', srclen - (size_t)(t - src));
-        if (!gt) goto done;
-        self_closing = (gt > t && gt[-1] == '/');
-        total = parse_count_attr(t, gt) + added;
-        snprintf(openbuf, sizeof(openbuf), "<%s count=\"%zu\">", tag, total);
-        if (buf_append(&out, src, (size_t)(t - src)) != 0 ||
-            buf_append_s(&out, openbuf) != 0) goto oom;
-        if (self_closing) {
-            if (buf_append_s(&out, entries) != 0 ||
-                buf_append_s(&out, closebuf) != 0 ||
-                buf_append(&out, gt + 1, srclen - (size_t)(gt + 1 - src)) != 0) goto oom;
-        } else {
-            const char *close = mem_find(gt, srclen - (size_t)(gt - src), closebuf);
-            if (!close) goto done;
-            if (buf_append(&out, gt + 1, (size_t)(close - (gt + 1))) != 0 ||
-                buf_append_s(&out, entries) != 0 ||
-                buf_append(&out, close, srclen - (size_t)(close - src)) != 0) goto oom;
-        }
-    } else {
-        char parentpat[32];
-        const char *a, *agt, *after;
-        snprintf(parentpat, sizeof(parentpat), "<%s", create_after);
-        a = mem_find(src, srclen, parentpat);
-        if (!a) goto done;
-        agt = (const char *)memchr(a, '>', srclen - (size_t)(a - src));
-        if (!agt) goto done;
-        after = agt + 1;
-        snprintf(openbuf, sizeof(openbuf), "<%s count=\"%zu\">", tag, added);
-        if (buf_append(&out, src, (size_t)(after - src)) != 0 ||
-            buf_append_s(&out, openbuf) != 0 ||
-            buf_append_s(&out, entries) != 0 ||
-            buf_append_s(&out, closebuf) != 0 ||
-            buf_append(&out, after, srclen - (size_t)(after - src)) != 0) goto oom;
-    }
+    while (s->row_dim_index < sheet->row_dim_count &&
+           sheet->row_dims[s->row_dim_index]->row < row)
+        s->row_dim_index++;
 
-    *out_data = out.data;
-    *out_len = out.len;
-    return LXLSX_NO_ERROR;
+    next = s->row_dim_index;
+    while (next < sheet->row_dim_count && sheet->row_dims[next]->row == row)
+        next++;
+    return next - s->row_dim_index;
+}
 
-oom:
-    err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-done:
-    free(out.data);
+/* Write out the row rebuilt in s->row, applying its height if one was set. */
+static lxlsx_error sheet_stream_emit_row(lxlsx_edit_sheet_stream *s,
+                                         lxlsx_row_t row)
+{
+    size_t dims = sheet_stream_row_dims(s, row);
+    lxlsx_error err;
+
+    if (dims) {
+        unsigned char *xml = (unsigned char *)s->row.data;
+        size_t xml_len = s->row.len;
+
+        err = patch_xml_with_row_dims(&xml, &xml_len,
+                                      s->sheet->row_dims + s->row_dim_index,
+                                      dims);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        s->row.data = (char *)xml;
+        s->row.len = xml_len;
+        s->row.cap = xml_len + 1;
+    }
+
+    err = sheet_stream_emit(s, s->row.data, s->row.len);
+    s->row.len = 0;
     return err;
 }
 
-/*
- * Inject one numFmt + one cellXf per unique requested number-format code into
- * styles.xml, assign each requesting change its new xf index, and produce a
- * styles.xml replacement. *produced is set to 1 when a replacement was made.
- */
-static const char *h_align_str(uint8_t a)
+/* Write the rows that only exist as changes, up to (not including)
+ * before_row, or all remaining ones when unbounded. */
+static lxlsx_error sheet_stream_new_rows(lxlsx_edit_sheet_stream *s,
+                                         lxlsx_row_t before_row, int bounded)
 {
-    switch (a) {
-    case 1: return "left";   case 2: return "center"; case 3: return "right";
-    case 4: return "fill";   case 5: return "justify";
-    case 6: return "centerContinuous"; case 7: return "distributed";
-    default: return NULL;
+    const lxlsx_edit_prepared_change *prepared = s->prepared;
+
+    while (s->change_index < s->prepared_count &&
+           (!bounded || prepared[s->change_index].change->row < before_row)) {
+        lxlsx_row_t row = prepared[s->change_index].change->row;
+        size_t next = s->change_index + 1;
+        lxlsx_error err;
+
+        while (next < s->prepared_count && prepared[next].change->row == row)
+            next++;
+
+        err = append_new_row_xml(&s->row, prepared[s->change_index].row_ref,
+                                 prepared + s->change_index,
+                                 next - s->change_index);
+        if (err == LXLSX_NO_ERROR)
+            err = sheet_stream_emit_row(s, row);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        s->change_index = next;
     }
+
+    return LXLSX_NO_ERROR;
 }
 
-static const char *v_align_str(uint8_t a)
+/* At </sheetData>: the remaining change-only rows, then the appended rows. */
+static lxlsx_error sheet_stream_last_rows(lxlsx_edit_sheet_stream *s)
 {
-    switch (a) {
-    case 8: return "top";    case 9: return "bottom"; case 10: return "center";
-    case 11: return "justify"; case 12: return "distributed";
-    default: return NULL;
+    const lxlsx_edit_append *append = s->sheet->append;
+    lxlsx_error err;
+
+    err = sheet_stream_new_rows(s, 0, 0);
+    if (err == LXLSX_NO_ERROR && append && append->row_open) {
+        err = sheet_stream_emit(s, append->xml.data, append->xml.len);
+        if (err == LXLSX_NO_ERROR)
+            err = sheet_stream_emit(s, LXLSX_EDIT_ROW_CLOSE,
+                                    strlen(LXLSX_EDIT_ROW_CLOSE));
     }
+
+    return err;
 }
 
 /*
- * Compare only the style fields the snapshots emit into styles.xml (font, fill,
- * border) — never the whole struct: lxlsx_format carries live pointers, xf
- * indices and inter-field padding that memcpy doesn't normalize, so a raw
- * memcmp made dedup unreliable (style bloat) and read padding (UB-adjacent).
+ * A worksheet without <sheetData>: there are no rows to merge changes into,
+ * so apply the structural patches to the (small) part as a whole.
  */
-static int format_style_equal(const lxlsx_format *a, const lxlsx_format *b)
+static lxlsx_error sheet_stream_whole(lxlsx_edit_sheet_stream *s)
 {
-    return a->bold == b->bold && a->italic == b->italic &&
-           a->underline == b->underline &&
-           a->font_strikeout == b->font_strikeout &&
-           a->font_color == b->font_color &&
-           a->font_size == b->font_size &&
-           strcmp(a->font_name, b->font_name) == 0 &&
-           a->pattern == b->pattern &&
-           a->fg_color == b->fg_color && a->bg_color == b->bg_color &&
-           a->left == b->left && a->right == b->right &&
-           a->top == b->top && a->bottom == b->bottom &&
-           a->diag_border == b->diag_border && a->diag_type == b->diag_type &&
-           a->left_color == b->left_color && a->right_color == b->right_color &&
-           a->top_color == b->top_color && a->bottom_color == b->bottom_color &&
-           a->diag_color == b->diag_color;
-}
+    const lxlsx_dirty_sheet *sheet = s->sheet;
+    unsigned char *xml = NULL;
+    size_t xml_len = 0;
+    lxlsx_error err;
 
-static int fmt_has_fill(const lxlsx_format *f)
-{
-    return f->pattern > 0 || f->fg_color != LXLSX_COLOR_UNSET;
+    if (s->prepared_count > 0 || sheet->append)
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+
+    s->done = 1;
+    err = sheet_stream_take_rest(s, &xml, &xml_len);
+    if (err == LXLSX_NO_ERROR)
+        err = patch_xml_with_merges(&xml, &xml_len, sheet->merges,
+                                    sheet->merge_count);
+    if (err == LXLSX_NO_ERROR)
+        err = patch_xml_with_cols(&xml, &xml_len, sheet->cols,
+                                  sheet->col_count);
+    if (err == LXLSX_NO_ERROR)
+        err = patch_xml_with_row_dims(&xml, &xml_len, sheet->row_dims,
+                                      sheet->row_dim_count);
+    if (err == LXLSX_NO_ERROR && sheet->has_drawing)
+        err = patch_xml_with_drawing(&xml, &xml_len, sheet->drawing_rid);
+    if (err == LXLSX_NO_ERROR)
+        err = sheet_stream_emit(s, (const char *)xml, xml_len);
+
+    free(xml);
+    return err;
 }
 
-static int emit_font_fragment(lxlsx_edit_buf *b, const lxlsx_format *f)
+/*
+ * Everything up to and including the <sheetData> start tag. It only holds
+ * sheet properties, views and <cols>, so it is patched with the column widths
+ * as a whole. *in_rows is set when the rows follow.
+ */
+static lxlsx_error sheet_stream_head(lxlsx_edit_sheet_stream *s, int *in_rows)
 {
-    char tmp[48];
-    const char *name = f->font_name[0] ? f->font_name : "Calibri";
-    if (buf_append_s(b, "<font>") != 0) return -1;
-    if (f->bold && buf_append_s(b, "<b/>") != 0) return -1;
-    if (f->italic && buf_append_s(b, "<i/>") != 0) return -1;
-    if (f->font_strikeout && buf_append_s(b, "<strike/>") != 0) return -1;
-    if (f->underline) {
-        if (buf_append_s(b, f->underline == 2 ? "<u val=\"double\"/>" : "<u/>") != 0)
-            return -1;
+    const lxlsx_dirty_sheet *sheet = s->sheet;
+    lxlsx_edit_xml_tag tag;
+    unsigned char *head = NULL;
+    const char *open;
+    size_t scan = 0;
+    size_t head_len;
+    size_t open_len;
+    lxlsx_error err;
+
+    *in_rows = 0;
+
+    for (;;) {
+        const char *base;
+        const char *p;
+
+        err = sheet_stream_fill(s);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+
+        base = s->window.data;
+        p = base + scan;
+        while (xml_next_tag(p, base + s->window.len, &tag)) {
+            p = tag.end + 1;
+            if (!tag.is_end && tag_name_is(&tag, "sheetData"))
+                goto found;
+            scan = (size_t)(p - base);
+        }
+
+        if (s->eof)
+            return sheet_stream_whole(s);
     }
-    snprintf(tmp, sizeof(tmp), "<sz val=\"%g\"/>", f->font_size > 0 ? f->font_size : 11.0);
-    if (buf_append_s(b, tmp) != 0) return -1;
-    if (f->font_color != LXLSX_COLOR_UNSET) {
-        snprintf(tmp, sizeof(tmp), "<color rgb=\"FF%06X\"/>",
-                 (unsigned)(f->font_color & LXLSX_COLOR_MASK));
-        if (buf_append_s(b, tmp) != 0) return -1;
+
+found:
+    head_len = (size_t)(tag.end + 1 - s->window.data);
+    open_len = (size_t)(tag.end + 1 - tag.start);
+    s->pos = head_len;
+
+    head = (unsigned char *)malloc(head_len + 1);
+    if (!head)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    memcpy(head, s->window.data, head_len);
+    head[head_len] = 0;
+
+    /* New columns are inserted before <sheetData>, so its start tag stays at
+     * the end of the patched head. */
+    err = patch_xml_with_cols(&head, &head_len, sheet->cols, sheet->col_count);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+    open = (const char *)head + head_len - open_len;
+
+    if (tag.is_self_closing && (s->prepared_count > 0 || sheet->append)) {
+        const char *close = open + open_len - 1;
+        const char *prefix_end = self_closing_prefix_end(open, close);
+
+        err = sheet_stream_emit(s, (const char *)head,
+                                (size_t)(prefix_end - (const char *)head));
+        if (err == LXLSX_NO_ERROR)
+            err = sheet_stream_emit(s, ">", 1);
+        if (err == LXLSX_NO_ERROR)
+            err = sheet_stream_last_rows(s);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        if (buf_append_matching_end_tag(&s->row, open, close) != 0) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            goto done;
+        }
+        err = sheet_stream_emit(s, s->row.data, s->row.len);
+        s->row.len = 0;
+    } else {
+        err = sheet_stream_emit(s, (const char *)head, head_len);
+        *in_rows = !tag.is_self_closing;
     }
-    if (buf_append_s(b, "<name val=\"") != 0 ||
-        append_attr_escaped(b, name) != 0 ||
-        buf_append_s(b, "\"/><family val=\"2\"/></font>") != 0)
-        return -1;
-    return 0;
+
+done:
+    free(head);
+    return err;
 }
 
-static int emit_fill_fragment(lxlsx_edit_buf *b, const lxlsx_format *f)
+/*
+ * The end tag of <sheetData> in [p, limit), or NULL. *safe is set to where
+ * an incomplete tag starts (or limit): what precedes it has been scanned.
+ */
+static const char *find_sheet_data_end(const char *p, const char *limit,
+                                       const char **safe)
 {
-    static const char *pats[] = {
-        "none", "solid", "mediumGray", "darkGray", "lightGray",
-        "darkHorizontal", "darkVertical", "darkDown", "darkUp", "darkGrid",
-        "darkTrellis", "lightHorizontal", "lightVertical", "lightDown",
-        "lightUp", "lightGrid", "lightTrellis", "gray125", "gray0625"
-    };
-    uint8_t p = f->pattern ? f->pattern : 1;  /* fg set but no pattern -> solid */
-    char tmp[48];
-    if (p >= sizeof(pats) / sizeof(pats[0])) p = 1;
-    if (buf_append_s(b, "<fill><patternFill patternType=\"") != 0 ||
-        buf_append_s(b, pats[p]) != 0 || buf_append_s(b, "\">") != 0)
-        return -1;
-    if (f->fg_color != LXLSX_COLOR_UNSET) {
-        snprintf(tmp, sizeof(tmp), "<fgColor rgb=\"FF%06X\"/>",
-                 (unsigned)(f->fg_color & LXLSX_COLOR_MASK));
-        if (buf_append_s(b, tmp) != 0) return -1;
-    }
-    if (f->bg_color != LXLSX_COLOR_UNSET) {
-        snprintf(tmp, sizeof(tmp), "<bgColor rgb=\"FF%06X\"/>",
-                 (unsigned)(f->bg_color & LXLSX_COLOR_MASK));
-        if (buf_append_s(b, tmp) != 0) return -1;
-    } else if (buf_append_s(b, "<bgColor indexed=\"64\"/>") != 0) {
-        return -1;
+    *safe = limit;
+    while (p < limit &&
+           (p = (const char *)memchr(p, '<', (size_t)(limit - p))) != NULL) {
+        const char *name = p + 2;
+        const char *gt;
+        const char *colon;
+
+        if (limit - p < 2) {
+            *safe = p;
+            return NULL;
+        }
+        if (p[1] == '!') {
+            const char *next = skip_special_tag(p, limit);
+            if (!next) {
+                *safe = p;
+                return NULL;
+            }
+            p = next;
+            continue;
+        }
+        if (p[1] != '/') {
+            p++;
+            continue;
+        }
+
+        gt = (const char *)memchr(name, '>', (size_t)(limit - name));
+        if (!gt) {
+            *safe = p;
+            return NULL;
+        }
+        colon = (const char *)memchr(name, ':', (size_t)(gt - name));
+        if (colon)
+            name = colon + 1;
+        while (gt > name && isspace((unsigned char)gt[-1]))
+            gt--;
+        if (gt - name == 9 && memcmp(name, "sheetData", 9) == 0)
+            return p;
+        p = name;
     }
-    return buf_append_s(b, "</patternFill></fill>");
-}
 
-static int fmt_has_border(const lxlsx_format *f)
-{
-    return f->top || f->bottom || f->left || f->right ||
-           f->diag_border || f->diag_type;
+    return NULL;
 }
 
-static const char *border_style_str(uint8_t s)
+/*
+ * No existing row is rebuilt: copy the rows through to </sheetData> without
+ * parsing them, then add the new ones.
+ */
+static lxlsx_error sheet_stream_copy_rows(lxlsx_edit_sheet_stream *s)
 {
-    static const char *styles[] = {
-        "none", "thin", "medium", "dashed", "dotted", "thick", "double",
-        "hair", "mediumDashed", "dashDot", "mediumDashDot", "dashDotDot",
-        "mediumDashDotDot", "slantDashDot"
-    };
-    if (s >= sizeof(styles) / sizeof(styles[0])) s = 1;
-    return styles[s];
-}
+    lxlsx_error err;
 
-static int emit_sub_border(lxlsx_edit_buf *b, const char *type, uint8_t style,
-                           lxlsx_color_t color)
-{
-    char tmp[48];
-    if (!style) {
-        snprintf(tmp, sizeof(tmp), "<%s/>", type);
-        return buf_append_s(b, tmp);
+    for (;;) {
+        const char *base = s->window.data;
+        const char *p = base + s->pos;
+        const char *safe;
+        const char *end = find_sheet_data_end(p, base + s->window.len, &safe);
+
+        if (end) {
+            err = sheet_stream_emit(s, p, (size_t)(end - p));
+            if (err != LXLSX_NO_ERROR)
+                return err;
+            s->pos = (size_t)(end - base);
+            return sheet_stream_last_rows(s);
+        }
+
+        err = sheet_stream_emit(s, p, (size_t)(safe - p));
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        s->pos = (size_t)(safe - base);
+
+        if (s->eof)
+            return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+        err = sheet_stream_fill(s);
+        if (err != LXLSX_NO_ERROR)
+            return err;
     }
-    snprintf(tmp, sizeof(tmp), "<%s style=\"%s\">", type, border_style_str(style));
-    if (buf_append_s(b, tmp) != 0) return -1;
-    if (color != LXLSX_COLOR_UNSET)
-        snprintf(tmp, sizeof(tmp), "<color rgb=\"FF%06X\"/>", (unsigned)(color & LXLSX_COLOR_MASK));
-    else
-        snprintf(tmp, sizeof(tmp), "<color auto=\"1\"/>");
-    if (buf_append_s(b, tmp) != 0) return -1;
-    snprintf(tmp, sizeof(tmp), "</%s>", type);
-    return buf_append_s(b, tmp);
 }
 
-static int emit_border_fragment(lxlsx_edit_buf *b, const lxlsx_format *f)
+/*
+ * The rows of <sheetData>, one complete <row> at a time: untouched rows are
+ * written through verbatim, changed rows are rebuilt, and rows that only
+ * exist as changes are inserted in order. Returns at </sheetData>, which is
+ * left in the window for the tail.
+ */
+static lxlsx_error sheet_stream_rows(lxlsx_edit_sheet_stream *s)
 {
-    uint8_t diag = f->diag_border;
-    if (f->diag_type && !diag) diag = 1;  /* thin default, mirrors writer */
-    if (buf_append_s(b, "<border") != 0) return -1;
-    if (f->diag_type == 1 && buf_append_s(b, " diagonalUp=\"1\"") != 0) return -1;
-    if (f->diag_type == 2 && buf_append_s(b, " diagonalDown=\"1\"") != 0) return -1;
-    if (f->diag_type == 3 &&
-        buf_append_s(b, " diagonalUp=\"1\" diagonalDown=\"1\"") != 0) return -1;
-    if (buf_append_s(b, ">") != 0) return -1;
-    if (emit_sub_border(b, "left", f->left, f->left_color) != 0) return -1;
-    if (emit_sub_border(b, "right", f->right, f->right_color) != 0) return -1;
-    if (emit_sub_border(b, "top", f->top, f->top_color) != 0) return -1;
-    if (emit_sub_border(b, "bottom", f->bottom, f->bottom_color) != 0) return -1;
-    if (emit_sub_border(b, "diagonal", diag, f->diag_color) != 0) return -1;
-    return buf_append_s(b, "</border>");
+    lxlsx_error err;
+
+    if (s->prepared_count == 0 && s->sheet->row_dim_count == 0)
+        return sheet_stream_copy_rows(s);
+
+    for (;;) {
+        const char *base = s->window.data;
+        const char *limit = base + s->window.len;
+        const char *p = base + s->pos;
+        lxlsx_edit_xml_tag tag;
+
+        while (xml_next_tag(p, limit, &tag)) {
+            lxlsx_edit_xml_tag close_tag;
+            const char *row_end;
+            const char *row_close_start = NULL;
+            char *row_ref_attr;
+            lxlsx_row_t xml_row = 0;
+            int valid_row;
+
+            if (tag.is_end && tag_name_is(&tag, "sheetData")) {
+                err = sheet_stream_emit(s, base + s->pos,
+                                        (size_t)(tag.start - (base + s->pos)));
+                if (err != LXLSX_NO_ERROR)
+                    return err;
+                s->pos = (size_t)(tag.start - base);
+                return sheet_stream_last_rows(s);
+            }
+
+            p = tag.end + 1;
+            if (tag.is_end || !tag_name_is(&tag, "row"))
+                continue;
+
+            if (tag.is_self_closing) {
+                row_end = tag.end + 1;
+            } else if (find_matching_end_tag(tag.end + 1, limit, "row",
+                                             &close_tag)) {
+                row_close_start = close_tag.start;
+                row_end = close_tag.end + 1;
+            } else {
+                break;
+            }
+
+            err = sheet_stream_emit(s, base + s->pos,
+                                    (size_t)(tag.start - (base + s->pos)));
+            if (err != LXLSX_NO_ERROR)
+                return err;
+
+            row_ref_attr = extract_attr(tag.start, tag.end, "r");
+            valid_row = parse_row_ref(row_ref_attr, &xml_row);
+            free(row_ref_attr);
+
+            if (!valid_row) {
+                err = sheet_stream_emit(s, tag.start,
+                                        (size_t)(row_end - tag.start));
+            } else {
+                err = sheet_stream_new_rows(s, xml_row, 1);
+                if (err != LXLSX_NO_ERROR)
+                    return err;
+
+                if (s->change_index < s->prepared_count &&
+                    s->prepared[s->change_index].change->row == xml_row) {
+                    size_t next = s->change_index + 1;
+
+                    while (next < s->prepared_count &&
+                           s->prepared[next].change->row == xml_row)
+                        next++;
+                    err = append_existing_row_xml(&s->row, tag.start, row_end,
+                                                  tag.end, row_close_start,
+                                                  s->prepared + s->change_index,
+                                                  next - s->change_index);
+                    if (err == LXLSX_NO_ERROR)
+                        err = sheet_stream_emit_row(s, xml_row);
+                    s->change_index = next;
+                } else if (sheet_stream_row_dims(s, xml_row)) {
+                    if (buf_append(&s->row, tag.start,
+                                   (size_t)(row_end - tag.start)) != 0)
+                        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                    err = sheet_stream_emit_row(s, xml_row);
+                } else {
+                    err = sheet_stream_emit(s, tag.start,
+                                            (size_t)(row_end - tag.start));
+                }
+            }
+            if (err != LXLSX_NO_ERROR)
+                return err;
+
+            s->pos = (size_t)(row_end - base);
+            p = row_end;
+        }
+
+        /* The next row (or </sheetData>) isn't complete in the window. */
+        if (s->eof)
+            return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+        err = sheet_stream_fill(s);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+    }
 }
 
-static int emit_xf_fragment(lxlsx_edit_buf *b, size_t num_id, size_t font_id,
-                            size_t fill_id, size_t border_id,
-                            const lxlsx_format *f, int has_num)
+/* </sheetData> onwards: merged ranges and the drawing reference go here. */
+static lxlsx_error sheet_stream_tail(lxlsx_edit_sheet_stream *s)
 {
-    char head[160];
-    const char *h = f ? h_align_str(f->text_h_align) : NULL;
-    const char *v = f ? v_align_str(f->text_v_align) : NULL;
-    int wrap = f ? f->text_wrap : 0;
-    int has_align = (h || v || wrap);
+    const lxlsx_dirty_sheet *sheet = s->sheet;
+    unsigned char *xml = NULL;
+    size_t xml_len = 0;
+    lxlsx_error err;
 
-    snprintf(head, sizeof(head),
-             "<xf numFmtId=\"%zu\" fontId=\"%zu\" fillId=\"%zu\" borderId=\"%zu\" xfId=\"0\"",
-             num_id, font_id, fill_id, border_id);
-    if (buf_append_s(b, head) != 0) return -1;
-    if (has_num && buf_append_s(b, " applyNumberFormat=\"1\"") != 0) return -1;
-    if (f && buf_append_s(b, " applyFont=\"1\"") != 0) return -1;
-    if (f && fmt_has_fill(f) && buf_append_s(b, " applyFill=\"1\"") != 0) return -1;
-    if (f && fmt_has_border(f) && buf_append_s(b, " applyBorder=\"1\"") != 0) return -1;
-    if (has_align && buf_append_s(b, " applyAlignment=\"1\"") != 0) return -1;
-    if (!has_align)
-        return buf_append_s(b, "/>");
-    if (buf_append_s(b, "><alignment") != 0) return -1;
-    if (h && (buf_append_s(b, " horizontal=\"") != 0 || buf_append_s(b, h) != 0 ||
-              buf_append_s(b, "\"") != 0)) return -1;
-    if (v && (buf_append_s(b, " vertical=\"") != 0 || buf_append_s(b, v) != 0 ||
-              buf_append_s(b, "\"") != 0)) return -1;
-    if (wrap && buf_append_s(b, " wrapText=\"1\"") != 0) return -1;
-    return buf_append_s(b, "/></xf>");
+    err = sheet_stream_take_rest(s, &xml, &xml_len);
+    if (err == LXLSX_NO_ERROR)
+        err = patch_xml_with_merges(&xml, &xml_len, sheet->merges,
+                                    sheet->merge_count);
+    if (err == LXLSX_NO_ERROR && sheet->has_drawing)
+        err = patch_xml_with_drawing(&xml, &xml_len, sheet->drawing_rid);
+    if (err == LXLSX_NO_ERROR)
+        err = sheet_stream_emit(s, (const char *)xml, xml_len);
+
+    free(xml);
+    return err;
 }
 
-/*
- * Inject the styles required by restyle/number-format edits into styles.xml:
- * one font/fill/numFmt/xf per unique applied format (deduped), plus a numFmt+xf
- * per unique standalone number-format code. Assigns each change its new xf index
- * and produces a styles.xml replacement.
- */
-static lxlsx_error inject_cell_styles(
-    lxlsx_edit_session *session, lxlsx_source_package_replacement *rep,
-    int *produced)
+/* lxlsx_source_package_transform that applies a dirty sheet's edits. */
+static lxlsx_error patch_sheet_stream(void *ctx,
+                                      lxlsx_source_package_entry_stream *in,
+                                      lxlsx_source_package_sink *out)
 {
-    unsigned char *xml = NULL;
-    size_t xmllen = 0;
-    char *b1 = NULL, *b2 = NULL, *b3 = NULL, *final = NULL;
-    size_t l1, l2, l3, finallen;
-    lxlsx_edit_buf fonts = {0}, fills = {0}, borders = {0}, numfmts = {0}, xfents = {0};
-    char *b4 = NULL; size_t l4;
-    /* dedup tables */
-    const lxlsx_format **fmts = NULL; size_t *fmt_xf = NULL, nfmt = 0, capfmt = 0;
-    const char **codes = NULL; size_t *code_xf = NULL, ncode = 0, capcode = 0;
-    size_t next_font, next_fill, next_border, next_xf, next_numid;
-    size_t nfonts_add = 0, nfills_add = 0, nborders_add = 0, nnum_add = 0, nxf_add = 0;
+    const lxlsx_dirty_sheet *sheet = (const lxlsx_dirty_sheet *)ctx;
+    lxlsx_edit_sheet_stream s;
     lxlsx_error err = LXLSX_NO_ERROR;
-    int entry;
-    size_t i, j;
-    const char *mc, *gt, *p, *end;
+    int in_rows = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.sheet = sheet;
+    s.in = in;
+    s.out = out;
+
+    if (sheet->change_count > 0)
+        err = prepare_sheet_changes(sheet->changes, sheet->change_count,
+                                    &s.prepared, &s.prepared_count);
+    if (err == LXLSX_NO_ERROR)
+        err = sheet_stream_head(&s, &in_rows);
+    if (err == LXLSX_NO_ERROR && in_rows)
+        err = sheet_stream_rows(&s);
+    if (err == LXLSX_NO_ERROR && !s.done)
+        err = sheet_stream_tail(&s);
+
+    free(s.window.data);
+    free(s.row.data);
+    free_prepared_changes(s.prepared, s.prepared_count);
+    return err;
+}
 
-    *produced = 0;
+/* Copy a start tag's name and attributes, leaving out two of them. The tag
+ * is left open (no '>' or '/>'). */
+static int buf_append_open_tag_without(lxlsx_edit_buf *buf,
+                                       const char *tag_start,
+                                       const char *tag_end,
+                                       const char *drop1, const char *drop2)
+{
+    const char *p = tag_start + 1;
 
-    /* Nothing to do unless some change carries a style or number format. */
-    for (i = 0; i < session->change_count; i++)
-        if (session->changes[i].style || session->changes[i].number_format)
+    while (p < tag_end && !isspace((unsigned char)*p) &&
+           *p != '>' && *p != '/')
+        p++;
+    if (buf_append(buf, tag_start, (size_t)(p - tag_start)) != 0)
+        return -1;
+
+    while (p < tag_end) {
+        const char *attr_start;
+        const char *attr_end;
+        char quote;
+
+        while (p < tag_end && isspace((unsigned char)*p))
+            p++;
+        if (p >= tag_end || *p == '/' || *p == '>')
             break;
-    if (i == session->change_count)
-        goto done;
 
-    entry = lxlsx_source_package_find_first(session->package, "xl/styles.xml");
-    if (entry < 0) { err = LXLSX_ERROR_ZIP_FILE_ADD; goto done; }
-    err = lxlsx_source_package_read_entry(session->package, (size_t)entry,
-                                          &xml, &xmllen);
-    if (err != LXLSX_NO_ERROR) goto done;
+        attr_start = p;
+        while (p < tag_end && *p != '=' && !isspace((unsigned char)*p) &&
+               *p != '>' && *p != '/')
+            p++;
+        attr_end = p;
+        while (p < tag_end && *p != '"' && *p != '\'')
+            p++;
+        if (p >= tag_end)
+            break;
+        quote = *p++;
+        while (p < tag_end && *p != quote)
+            p++;
+        if (p >= tag_end)
+            break;
+        p++;
 
-    {
-        const char *t;
-        t = mem_find((const char *)xml, xmllen, "<fonts");
-        gt = t ? (const char *)memchr(t, '>', xmllen - (size_t)(t - (const char *)xml)) : NULL;
-        next_font = (t && gt) ? parse_count_attr(t, gt) : 1;
-        t = mem_find((const char *)xml, xmllen, "<fills");
-        gt = t ? (const char *)memchr(t, '>', xmllen - (size_t)(t - (const char *)xml)) : NULL;
-        next_fill = (t && gt) ? parse_count_attr(t, gt) : 2;
-        t = mem_find((const char *)xml, xmllen, "<borders");
-        gt = t ? (const char *)memchr(t, '>', xmllen - (size_t)(t - (const char *)xml)) : NULL;
-        next_border = (t && gt) ? parse_count_attr(t, gt) : 1;
-        mc = mem_find((const char *)xml, xmllen, "<cellXfs");
-        if (!mc) { err = LXLSX_ERROR_PARAMETER_VALIDATION; goto done; }
-        gt = (const char *)memchr(mc, '>', xmllen - (size_t)(mc - (const char *)xml));
-        if (!gt) { err = LXLSX_ERROR_PARAMETER_VALIDATION; goto done; }
-        next_xf = parse_count_attr(mc, gt);
+        if (xml_local_name_eq(attr_start, (size_t)(attr_end - attr_start), drop1) ||
+            xml_local_name_eq(attr_start, (size_t)(attr_end - attr_start), drop2))
+            continue;
+        if (buf_append(buf, " ", 1) != 0 ||
+            buf_append(buf, attr_start, (size_t)(p - attr_start)) != 0)
+            return -1;
     }
 
-    /* Next custom numFmtId (custom ids are >= 164). */
-    next_numid = 163;
-    p = (const char *)xml;
-    end = p + xmllen;
-    while ((p = mem_find(p, (size_t)(end - p), "numFmtId=\"")) != NULL) {
-        size_t val = 0;
-        p += strlen("numFmtId=\"");
-        while (p < end && *p >= '0' && *p <= '9')
-            val = val * 10 + (size_t)(*p++ - '0');
-        if (val > next_numid) next_numid = val;
+    return 0;
+}
+
+/* Write the <si> entries of the appended shared strings. */
+static lxlsx_error sst_stream_strings(lxlsx_edit_sheet_stream *s,
+                                      const lxlsx_hash_table *strings)
+{
+    lxlsx_hash_element *element;
+    lxlsx_error err;
+
+    LXLSX_FOREACH_ORDERED(element, strings) {
+        const char *string = (const char *)element->key;
+
+        if (buf_append_s(&s->row, "<si><t") != 0 ||
+            (needs_xml_space_preserve(string) &&
+             buf_append_s(&s->row, " xml:space=\"preserve\"") != 0) ||
+            buf_append(&s->row, ">", 1) != 0 ||
+            append_xml_escaped(&s->row, string) != 0 ||
+            buf_append_s(&s->row, "</t></si>") != 0)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+        if (s->row.len >= LXLSX_EDIT_STREAM_CHUNK) {
+            err = sheet_stream_emit(s, s->row.data, s->row.len);
+            if (err != LXLSX_NO_ERROR)
+                return err;
+            s->row.len = 0;
+        }
     }
-    next_numid += 1;
 
-    for (i = 0; i < session->change_count; i++) {
-        lxlsx_edit_change *ch = &session->changes[i];
+    err = sheet_stream_emit(s, s->row.data, s->row.len);
+    s->row.len = 0;
+    return err;
+}
 
-        if (ch->style) {
-            size_t font_id, fill_id = 0, border_id = 0, num_id = 0;
-            int has_num = 0, found = 0;
-            for (j = 0; j < nfmt; j++) {
-                if (format_style_equal(fmts[j], ch->style)) {
-                    ch->style_index = (int)fmt_xf[j];
-                    found = 1; break;
-                }
-            }
-            if (found) continue;
+/*
+ * lxlsx_source_package_transform for the shared strings part: the appended
+ * strings go in before </sst>, and count= / uniqueCount= are brought up to
+ * date. The existing entries are copied through untouched.
+ */
+static lxlsx_error patch_sst_stream(void *ctx,
+                                    lxlsx_source_package_entry_stream *in,
+                                    lxlsx_source_package_sink *out)
+{
+    const lxlsx_edit_session *session = (const lxlsx_edit_session *)ctx;
+    const lxlsx_hash_table *strings = session->append_strings;
+    lxlsx_edit_sheet_stream s;
+    lxlsx_edit_xml_tag tag;
+    lxlsx_edit_buf open = {0};
+    char *count = NULL;
+    const char *base;
+    const char *last;
+    size_t scan = 0;
+    lxlsx_error err;
 
-            font_id = next_font++; nfonts_add++;
-            if (emit_font_fragment(&fonts, ch->style) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-            if (fmt_has_fill(ch->style)) {
-                fill_id = next_fill++; nfills_add++;
-                if (emit_fill_fragment(&fills, ch->style) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-            }
-            if (fmt_has_border(ch->style)) {
-                border_id = next_border++; nborders_add++;
-                if (emit_border_fragment(&borders, ch->style) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-            }
-            if (ch->style->num_format[0]) {
-                char head[48];
-                num_id = next_numid++; nnum_add++; has_num = 1;
-                snprintf(head, sizeof(head), "<numFmt numFmtId=\"%zu\" formatCode=\"", num_id);
-                if (buf_append_s(&numfmts, head) != 0 ||
-                    append_attr_escaped(&numfmts, ch->style->num_format) != 0 ||
-                    buf_append_s(&numfmts, "\"/>") != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-            }
-            if (emit_xf_fragment(&xfents, num_id, font_id, fill_id, border_id, ch->style, has_num) != 0) {
-                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done;
-            }
-            nxf_add++;
-            ch->style_index = (int)next_xf++;
+    memset(&s, 0, sizeof(s));
+    s.in = in;
+    s.out = out;
 
-            if (nfmt >= capfmt) {
-                size_t nc = capfmt ? capfmt * 2 : 8;
-                const lxlsx_format **nf = (const lxlsx_format **)realloc(fmts, nc * sizeof(*nf));
-                size_t *nx = (size_t *)realloc(fmt_xf, nc * sizeof(*nx));
-                if (!nf || !nx) { free(nf); free(nx); err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-                fmts = nf; fmt_xf = nx; capfmt = nc;
+    for (;;) {
+        const char *p;
+
+        err = sheet_stream_fill(&s);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+
+        base = s.window.data;
+        p = base + scan;
+        while (xml_next_tag(p, base + s.window.len, &tag)) {
+            p = tag.end + 1;
+            if (!tag.is_end && tag_name_is(&tag, "sst"))
+                goto found;
+            scan = (size_t)(p - base);
+        }
+
+        if (s.eof) {
+            err = LXLSX_ERROR_PARAMETER_VALIDATION;
+            goto done;
+        }
+    }
+
+found:
+    count = extract_attr(tag.start, tag.end, "count");
+    if (buf_append_open_tag_without(&open, tag.start, tag.end, "count",
+                                    "uniqueCount") != 0 ||
+        (count && buf_appendf(&open, " count=\"%zu\"",
+                              (size_t)strtoul(count, NULL, 10) +
+                              session->append_sst_refs) != 0) ||
+        buf_appendf(&open, " uniqueCount=\"%zu\">",
+                    session->append_sst_base +
+                    (size_t)strings->unique_count) != 0) {
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        goto done;
+    }
+
+    err = sheet_stream_emit(&s, base, (size_t)(tag.start - base));
+    if (err == LXLSX_NO_ERROR)
+        err = sheet_stream_emit(&s, open.data, open.len);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+    s.pos = (size_t)(tag.end + 1 - base);
+
+    if (tag.is_self_closing) {
+        err = sst_stream_strings(&s, strings);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        if (buf_append_matching_end_tag(&s.row, tag.start, tag.end) != 0) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            goto done;
+        }
+        err = sheet_stream_emit(&s, s.row.data, s.row.len);
+        s.row.len = 0;
+        if (err == LXLSX_NO_ERROR)
+            err = sheet_stream_emit(&s, s.window.data + s.pos,
+                                    s.window.len - s.pos);
+        while (err == LXLSX_NO_ERROR && !s.eof) {
+            s.pos = s.window.len;
+            err = sheet_stream_fill(&s);
+            if (err == LXLSX_NO_ERROR)
+                err = sheet_stream_emit(&s, s.window.data, s.window.len);
+        }
+        goto done;
+    }
+
+    /* </sst> is the last tag of the part: copy up to the last '<' seen
+     * so far until the whole entry has been read. */
+    for (;;) {
+        base = s.window.data;
+        last = NULL;
+        for (scan = s.window.len; scan > s.pos; scan--) {
+            if (base[scan - 1] == '<') {
+                last = base + scan - 1;
+                break;
             }
-            fmts[nfmt] = ch->style; fmt_xf[nfmt] = (size_t)ch->style_index; nfmt++;
-        } else if (ch->number_format) {
-            char head[48];
+        }
+        if (s.eof)
+            break;
+        if (last) {
+            err = sheet_stream_emit(&s, base + s.pos,
+                                    (size_t)(last - (base + s.pos)));
+            if (err != LXLSX_NO_ERROR)
+                goto done;
+            s.pos = (size_t)(last - base);
+        }
+        err = sheet_stream_fill(&s);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+    }
+
+    if (!last) {
+        err = LXLSX_ERROR_PARAMETER_VALIDATION;
+        goto done;
+    }
+    err = sheet_stream_emit(&s, base + s.pos, (size_t)(last - (base + s.pos)));
+    if (err == LXLSX_NO_ERROR)
+        err = sst_stream_strings(&s, strings);
+    if (err == LXLSX_NO_ERROR)
+        err = sheet_stream_emit(&s, last, (size_t)(base + s.window.len - last));
+
+done:
+    free(count);
+    free(open.data);
+    free(s.window.data);
+    free(s.row.data);
+    return err;
+}
+
+/*
+ * The row after the last <row> of a worksheet part (0 if it has none). Rows
+ * without r= follow the one before them.
+ */
+static lxlsx_error scan_next_row(lxlsx_edit_session *session,
+                                 const char *target, lxlsx_row_t *next_row)
+{
+    lxlsx_edit_sheet_stream s;
+    lxlsx_row_t next = 0;
+    lxlsx_error err;
+    int entry;
+
+    entry = lxlsx_source_package_find_first(session->package, target);
+    if (entry < 0)
+        return LXLSX_ERROR_ZIP_FILE_ADD;
+
+    memset(&s, 0, sizeof(s));
+    err = lxlsx_source_package_entry_stream_open(session->package,
+                                                 (size_t)entry, &s.in);
+    while (err == LXLSX_NO_ERROR && !s.done) {
+        lxlsx_edit_xml_tag tag;
+        const char *p;
+
+        err = sheet_stream_fill(&s);
+        if (err != LXLSX_NO_ERROR)
+            break;
+
+        p = s.window.data + s.pos;
+        while (xml_next_tag(p, s.window.data + s.window.len, &tag)) {
+            if (tag_name_is(&tag, "sheetData") &&
+                (tag.is_end || tag.is_self_closing)) {
+                s.done = 1;
+                break;
+            }
+            if (!tag.is_end && tag_name_is(&tag, "row")) {
+                char *ref = extract_attr(tag.start, tag.end, "r");
+                lxlsx_row_t row;
+
+                if (parse_row_ref(ref, &row) && row >= next)
+                    next = row + 1;
+                else if (!ref)
+                    next++;
+                free(ref);
+            }
+            p = tag.end + 1;
+            s.pos = (size_t)(p - s.window.data);
+        }
+        if (s.eof)
+            s.done = 1;
+    }
+
+    lxlsx_source_package_entry_stream_close(s.in);
+    free(s.window.data);
+    *next_row = next;
+    return err;
+}
+
+/* Number of <si> entries in the shared strings part. */
+static lxlsx_error count_shared_strings(lxlsx_edit_session *session,
+                                        int entry, size_t *count)
+{
+    lxlsx_edit_sheet_stream s;
+    lxlsx_error err;
+
+    *count = 0;
+    memset(&s, 0, sizeof(s));
+    err = lxlsx_source_package_entry_stream_open(session->package,
+                                                 (size_t)entry, &s.in);
+    while (err == LXLSX_NO_ERROR && !s.eof) {
+        lxlsx_edit_xml_tag tag;
+        const char *p;
+
+        err = sheet_stream_fill(&s);
+        if (err != LXLSX_NO_ERROR)
+            break;
+
+        p = s.window.data + s.pos;
+        while (xml_next_tag(p, s.window.data + s.window.len, &tag)) {
+            if (!tag.is_end && tag_name_is(&tag, "si"))
+                (*count)++;
+            p = tag.end + 1;
+            s.pos = (size_t)(p - s.window.data);
+        }
+    }
+
+    lxlsx_source_package_entry_stream_close(s.in);
+    free(s.window.data);
+    return err;
+}
+
+/* Set up the appended shared strings, numbered after the part's existing
+ * ones. *available stays 0 if the package has no shared strings part. */
+static lxlsx_error append_strings_init(lxlsx_edit_session *session,
+                                       int *available)
+{
+    const char *path = session->workbook->sst_path;
+    lxlsx_error err;
+    int entry;
+
+    *available = 0;
+    if (session->append_strings) {
+        *available = 1;
+        return LXLSX_NO_ERROR;
+    }
+    if (!path)
+        return LXLSX_NO_ERROR;
+    entry = lxlsx_source_package_find_first(session->package, path);
+    if (entry < 0)
+        return LXLSX_NO_ERROR;
+
+    err = count_shared_strings(session, entry, &session->append_sst_base);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    session->append_strings = lxlsx_hash_new(128, 1, 0);
+    if (!session->append_strings)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    *available = 1;
+    return LXLSX_NO_ERROR;
+}
+
+lxlsx_error lxlsx_edit_append_begin(lxlsx_edit_session *session,
+                                    const char *sheet_name,
+                                    const lxlsx_edit_append_options *options,
+                                    lxlsx_row_t *first_row)
+{
+    const char *target;
+    lxlsx_edit_append *append;
+    lxlsx_row_t next = 0;
+    int shared_strings = 0;
+    lxlsx_error err;
+    size_t i;
+
+    if (!session || !first_row)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    target = sheet_target(session, sheet_name);
+    if (!target)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    /* Appending again carries on below the rows appended so far. */
+    append = find_append(session, target);
+    if (append) {
+        *first_row = append->row_open ? append->row + 1 : append->first_row;
+        return LXLSX_NO_ERROR;
+    }
+
+    err = scan_next_row(session, target, &next);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    for (i = 0; i < session->change_count; i++) {
+        const lxlsx_edit_change *c = &session->changes[i];
+        if (c->row >= next && strcmp(c->target, target) == 0)
+            next = c->row + 1;
+    }
+    if (next >= LXLSX_ROW_MAX)
+        return LXLSX_ERROR_WORKSHEET_INDEX_OUT_OF_RANGE;
+
+    if (options && options->shared_strings) {
+        err = append_strings_init(session, &shared_strings);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+    }
+
+    if (session->append_count >= session->append_cap) {
+        size_t cap = session->append_cap ? session->append_cap * 2 : 4;
+        lxlsx_edit_append *grown = (lxlsx_edit_append *)realloc(
+            session->appends, cap * sizeof(*grown));
+        if (!grown)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        session->appends = grown;
+        session->append_cap = cap;
+    }
+
+    append = &session->appends[session->append_count++];
+    memset(append, 0, sizeof(*append));
+    append->target = target;
+    append->first_row = next;
+    append->shared_strings = shared_strings;
+
+    *first_row = next;
+    return LXLSX_NO_ERROR;
+}
+
+static int append_attr_escaped(lxlsx_edit_buf *buf, const char *s)
+{
+    for (; *s; s++) {
+        const char *rep = NULL;
+        switch (*s) {
+        case '&': rep = "&amp;"; break;
+        case '<': rep = "&lt;"; break;
+        case '>': rep = "&gt;"; break;
+        case '"': rep = "&quot;"; break;
+        default: break;
+        }
+        if (rep) { if (buf_append_s(buf, rep) != 0) return -1; }
+        else if (buf_append(buf, s, 1) != 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * Insert `entries` into the <tag> collection of `src`, bumping its count by
+ * `added`. If the collection is absent it is created right after the opening
+ * tag of `create_after` (a parent element). Returns a fresh buffer.
+ */
+static lxlsx_error splice_collection(const char *src, size_t srclen,
+                                     const char *tag, const char *entries,
+                                     size_t added, const char *create_after,
+                                     char **out_data, size_t *out_len)
+{
+    lxlsx_edit_buf out = {0};
+    char openpat[32], openbuf[48], closebuf[32];
+    const char *t, *gt;
+    lxlsx_error err = LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    snprintf(openpat, sizeof(openpat), "<%s", tag);
+    snprintf(closebuf, sizeof(closebuf), "</%s>", tag);
+    t = mem_find(src, srclen, openpat);
+
+    if (t) {
+        size_t total;
+        int self_closing;
+        gt = (const char *)memchr(t, '>', srclen - (size_t)(t - src));
+        if (!gt) goto done;
+        self_closing = (gt > t && gt[-1] == '/');
+        total = parse_count_attr(t, gt) + added;
+        snprintf(openbuf, sizeof(openbuf), "<%s count=\"%zu\">", tag, total);
+        if (buf_append(&out, src, (size_t)(t - src)) != 0 ||
+            buf_append_s(&out, openbuf) != 0) goto oom;
+        if (self_closing) {
+            if (buf_append_s(&out, entries) != 0 ||
+                buf_append_s(&out, closebuf) != 0 ||
+                buf_append(&out, gt + 1, srclen - (size_t)(gt + 1 - src)) != 0) goto oom;
+        } else {
+            const char *close = mem_find(gt, srclen - (size_t)(gt - src), closebuf);
+            if (!close) goto done;
+            if (buf_append(&out, gt + 1, (size_t)(close - (gt + 1))) != 0 ||
+                buf_append_s(&out, entries) != 0 ||
+                buf_append(&out, close, srclen - (size_t)(close - src)) != 0) goto oom;
+        }
+    } else {
+        char parentpat[32];
+        const char *a, *agt, *after;
+        snprintf(parentpat, sizeof(parentpat), "<%s", create_after);
+        a = mem_find(src, srclen, parentpat);
+        if (!a) goto done;
+        agt = (const char *)memchr(a, '>', srclen - (size_t)(a - src));
+        if (!agt) goto done;
+        after = agt + 1;
+        snprintf(openbuf, sizeof(openbuf), "<%s count=\"%zu\">", tag, added);
+        if (buf_append(&out, src, (size_t)(after - src)) != 0 ||
+            buf_append_s(&out, openbuf) != 0 ||
+            buf_append_s(&out, entries) != 0 ||
+            buf_append_s(&out, closebuf) != 0 ||
+            buf_append(&out, after, srclen - (size_t)(after - src)) != 0) goto oom;
+    }
+
+    *out_data = out.data;
+    *out_len = out.len;
+    return LXLSX_NO_ERROR;
+
+oom:
+    err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+done:
+    free(out.data);
+    return err;
+}
+
+/*
+ * Inject one numFmt + one cellXf per unique requested number-format code into
+ * styles.xml, assign each requesting change its new xf index, and produce a
+ * styles.xml replacement. *produced is set to 1 when a replacement was made.
+ */
+static const char *h_align_str(uint8_t a)
+{
+    switch (a) {
+    case 1: return "left";   case 2: return "center"; case 3: return "right";
+    case 4: return "fill";   case 5: return "justify";
+    case 6: return "centerContinuous"; case 7: return "distributed";
+    default: return NULL;
+    }
+}
+
+static const char *v_align_str(uint8_t a)
+{
+    switch (a) {
+    case 8: return "top";    case 9: return "bottom"; case 10: return "center";
+    case 11: return "justify"; case 12: return "distributed";
+    default: return NULL;
+    }
+}
+
+static int fmt_has_fill(const lxlsx_format *f)
+{
+    return f->pattern > 0 || f->fg_color != LXLSX_COLOR_UNSET;
+}
+
+static int emit_font_fragment(lxlsx_edit_buf *b, const lxlsx_format *f)
+{
+    char tmp[48];
+    const char *name = f->font_name[0] ? f->font_name : "Calibri";
+    if (buf_append_s(b, "<font>") != 0) return -1;
+    if (f->bold && buf_append_s(b, "<b/>") != 0) return -1;
+    if (f->italic && buf_append_s(b, "<i/>") != 0) return -1;
+    if (f->font_strikeout && buf_append_s(b, "<strike/>") != 0) return -1;
+    if (f->underline) {
+        if (buf_append_s(b, f->underline == 2 ? "<u val=\"double\"/>" : "<u/>") != 0)
+            return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "<sz val=\"%g\"/>", f->font_size > 0 ? f->font_size : 11.0);
+    if (buf_append_s(b, tmp) != 0) return -1;
+    if (f->font_color != LXLSX_COLOR_UNSET) {
+        snprintf(tmp, sizeof(tmp), "<color rgb=\"FF%06X\"/>",
+                 (unsigned)(f->font_color & LXLSX_COLOR_MASK));
+        if (buf_append_s(b, tmp) != 0) return -1;
+    }
+    if (buf_append_s(b, "<name val=\"") != 0 ||
+        append_attr_escaped(b, name) != 0 ||
+        buf_append_s(b, "\"/><family val=\"2\"/></font>") != 0)
+        return -1;
+    return 0;
+}
+
+static int emit_fill_fragment(lxlsx_edit_buf *b, const lxlsx_format *f)
+{
+    static const char *pats[] = {
+        "none", "solid", "mediumGray", "darkGray", "lightGray",
+        "darkHorizontal", "darkVertical", "darkDown", "darkUp", "darkGrid",
+        "darkTrellis", "lightHorizontal", "lightVertical", "lightDown",
+        "lightUp", "lightGrid", "lightTrellis", "gray125", "gray0625"
+    };
+    uint8_t p = f->pattern ? f->pattern : 1;  /* fg set but no pattern -> solid */
+    char tmp[48];
+    if (p >= sizeof(pats) / sizeof(pats[0])) p = 1;
+    if (buf_append_s(b, "<fill><patternFill patternType=\"") != 0 ||
+        buf_append_s(b, pats[p]) != 0 || buf_append_s(b, "\">") != 0)
+        return -1;
+    if (f->fg_color != LXLSX_COLOR_UNSET) {
+        snprintf(tmp, sizeof(tmp), "<fgColor rgb=\"FF%06X\"/>",
+                 (unsigned)(f->fg_color & LXLSX_COLOR_MASK));
+        if (buf_append_s(b, tmp) != 0) return -1;
+    }
+    if (f->bg_color != LXLSX_COLOR_UNSET) {
+        snprintf(tmp, sizeof(tmp), "<bgColor rgb=\"FF%06X\"/>",
+                 (unsigned)(f->bg_color & LXLSX_COLOR_MASK));
+        if (buf_append_s(b, tmp) != 0) return -1;
+    } else if (buf_append_s(b, "<bgColor indexed=\"64\"/>") != 0) {
+        return -1;
+    }
+    return buf_append_s(b, "</patternFill></fill>");
+}
+
+static int fmt_has_border(const lxlsx_format *f)
+{
+    return f->top || f->bottom || f->left || f->right ||
+           f->diag_border || f->diag_type;
+}
+
+static const char *border_style_str(uint8_t s)
+{
+    static const char *styles[] = {
+        "none", "thin", "medium", "dashed", "dotted", "thick", "double",
+        "hair", "mediumDashed", "dashDot", "mediumDashDot", "dashDotDot",
+        "mediumDashDotDot", "slantDashDot"
+    };
+    if (s >= sizeof(styles) / sizeof(styles[0])) s = 1;
+    return styles[s];
+}
+
+static int emit_sub_border(lxlsx_edit_buf *b, const char *type, uint8_t style,
+                           lxlsx_color_t color)
+{
+    char tmp[48];
+    if (!style) {
+        snprintf(tmp, sizeof(tmp), "<%s/>", type);
+        return buf_append_s(b, tmp);
+    }
+    snprintf(tmp, sizeof(tmp), "<%s style=\"%s\">", type, border_style_str(style));
+    if (buf_append_s(b, tmp) != 0) return -1;
+    if (color != LXLSX_COLOR_UNSET)
+        snprintf(tmp, sizeof(tmp), "<color rgb=\"FF%06X\"/>", (unsigned)(color & LXLSX_COLOR_MASK));
+    else
+        snprintf(tmp, sizeof(tmp), "<color auto=\"1\"/>");
+    if (buf_append_s(b, tmp) != 0) return -1;
+    snprintf(tmp, sizeof(tmp), "</%s>", type);
+    return buf_append_s(b, tmp);
+}
+
+static int emit_border_fragment(lxlsx_edit_buf *b, const lxlsx_format *f)
+{
+    uint8_t diag = f->diag_border;
+    if (f->diag_type && !diag) diag = 1;  /* thin default, mirrors writer */
+    if (buf_append_s(b, "<border") != 0) return -1;
+    if (f->diag_type == 1 && buf_append_s(b, " diagonalUp=\"1\"") != 0) return -1;
+    if (f->diag_type == 2 && buf_append_s(b, " diagonalDown=\"1\"") != 0) return -1;
+    if (f->diag_type == 3 &&
+        buf_append_s(b, " diagonalUp=\"1\" diagonalDown=\"1\"") != 0) return -1;
+    if (buf_append_s(b, ">") != 0) return -1;
+    if (emit_sub_border(b, "left", f->left, f->left_color) != 0) return -1;
+    if (emit_sub_border(b, "right", f->right, f->right_color) != 0) return -1;
+    if (emit_sub_border(b, "top", f->top, f->top_color) != 0) return -1;
+    if (emit_sub_border(b, "bottom", f->bottom, f->bottom_color) != 0) return -1;
+    if (emit_sub_border(b, "diagonal", diag, f->diag_color) != 0) return -1;
+    return buf_append_s(b, "</border>");
+}
+
+static int emit_xf_fragment(lxlsx_edit_buf *b, size_t num_id, size_t font_id,
+                            size_t fill_id, size_t border_id,
+                            const lxlsx_format *f, int has_num)
+{
+    char head[160];
+    const char *h = f ? h_align_str(f->text_h_align) : NULL;
+    const char *v = f ? v_align_str(f->text_v_align) : NULL;
+    int wrap = f ? f->text_wrap : 0;
+    int has_align = (h || v || wrap);
+
+    snprintf(head, sizeof(head),
+             "<xf numFmtId=\"%zu\" fontId=\"%zu\" fillId=\"%zu\" borderId=\"%zu\" xfId=\"0\"",
+             num_id, font_id, fill_id, border_id);
+    if (buf_append_s(b, head) != 0) return -1;
+    if (has_num && buf_append_s(b, " applyNumberFormat=\"1\"") != 0) return -1;
+    if (f && buf_append_s(b, " applyFont=\"1\"") != 0) return -1;
+    if (f && fmt_has_fill(f) && buf_append_s(b, " applyFill=\"1\"") != 0) return -1;
+    if (f && fmt_has_border(f) && buf_append_s(b, " applyBorder=\"1\"") != 0) return -1;
+    if (has_align && buf_append_s(b, " applyAlignment=\"1\"") != 0) return -1;
+    if (!has_align)
+        return buf_append_s(b, "/>");
+    if (buf_append_s(b, "><alignment") != 0) return -1;
+    if (h && (buf_append_s(b, " horizontal=\"") != 0 || buf_append_s(b, h) != 0 ||
+              buf_append_s(b, "\"") != 0)) return -1;
+    if (v && (buf_append_s(b, " vertical=\"") != 0 || buf_append_s(b, v) != 0 ||
+              buf_append_s(b, "\"") != 0)) return -1;
+    if (wrap && buf_append_s(b, " wrapText=\"1\"") != 0) return -1;
+    return buf_append_s(b, "/></xf>");
+}
+
+/*
+ * Inject the styles required by restyle/number-format edits into styles.xml:
+ * one font/fill/numFmt/xf per unique applied format (deduped), plus a numFmt+xf
+ * per unique standalone number-format code. Assigns each change its new xf index
+ * and produces a styles.xml replacement.
+ */
+static lxlsx_error inject_cell_styles(
+    lxlsx_edit_session *session, lxlsx_source_package_replacement *rep,
+    int *produced)
+{
+    unsigned char *xml = NULL;
+    size_t xmllen = 0;
+    char *b1 = NULL, *b2 = NULL, *b3 = NULL, *final = NULL;
+    size_t l1, l2, l3, finallen;
+    lxlsx_edit_buf fonts = {0}, fills = {0}, borders = {0}, numfmts = {0}, xfents = {0};
+    char *b4 = NULL; size_t l4;
+    /* dedup tables */
+    const lxlsx_format **fmts = NULL; size_t *fmt_xf = NULL, nfmt = 0, capfmt = 0;
+    const char **codes = NULL; size_t *code_xf = NULL, ncode = 0, capcode = 0;
+    size_t next_font, next_fill, next_border, next_xf, next_numid;
+    size_t nfonts_add = 0, nfills_add = 0, nborders_add = 0, nnum_add = 0, nxf_add = 0;
+    lxlsx_error err = LXLSX_NO_ERROR;
+    int entry;
+    size_t i, j;
+    const char *mc, *gt, *p, *end;
+
+    *produced = 0;
+
+    /* Nothing to do unless some change carries a style or number format. */
+    for (i = 0; i < session->change_count; i++)
+        if (session->changes[i].style || session->changes[i].number_format)
+            break;
+    if (i == session->change_count && session->append_style_count == 0)
+        goto done;
+
+    entry = lxlsx_source_package_find_first(session->package, "xl/styles.xml");
+    if (entry < 0) { err = LXLSX_ERROR_ZIP_FILE_ADD; goto done; }
+    err = lxlsx_source_package_read_entry(session->package, (size_t)entry,
+                                          &xml, &xmllen);
+    if (err != LXLSX_NO_ERROR) goto done;
+
+    {
+        const char *t;
+        t = mem_find((const char *)xml, xmllen, "<fonts");
+        gt = t ? (const char *)memchr(t, '>', xmllen - (size_t)(t - (const char *)xml)) : NULL;
+        next_font = (t && gt) ? parse_count_attr(t, gt) : 1;
+        t = mem_find((const char *)xml, xmllen, "<fills");
+        gt = t ? (const char *)memchr(t, '>', xmllen - (size_t)(t - (const char *)xml)) : NULL;
+        next_fill = (t && gt) ? parse_count_attr(t, gt) : 2;
+        t = mem_find((const char *)xml, xmllen, "<borders");
+        gt = t ? (const char *)memchr(t, '>', xmllen - (size_t)(t - (const char *)xml)) : NULL;
+        next_border = (t && gt) ? parse_count_attr(t, gt) : 1;
+        mc = mem_find((const char *)xml, xmllen, "<cellXfs");
+        if (!mc) { err = LXLSX_ERROR_PARAMETER_VALIDATION; goto done; }
+        gt = (const char *)memchr(mc, '>', xmllen - (size_t)(mc - (const char *)xml));
+        if (!gt) { err = LXLSX_ERROR_PARAMETER_VALIDATION; goto done; }
+        next_xf = parse_count_attr(mc, gt);
+    }
+
+    /* Next custom numFmtId (custom ids are >= 164). */
+    next_numid = 163;
+    p = (const char *)xml;
+    end = p + xmllen;
+    while ((p = mem_find(p, (size_t)(end - p), "numFmtId=\"")) != NULL) {
+        size_t val = 0;
+        p += strlen("numFmtId=\"");
+        while (p < end && *p >= '0' && *p <= '9')
+            val = val * 10 + (size_t)(*p++ - '0');
+        if (val > next_numid) next_numid = val;
+    }
+    next_numid += 1;
+
+    /* Appended cells were serialized pointing at the first new xfs, so their
+     * (already unique) styles go first, in order. */
+    for (i = 0; i < session->append_style_count + session->change_count; i++) {
+        const lxlsx_format *style;
+        const char *number_format;
+        int *style_index;
+
+        if (i < session->append_style_count) {
+            lxlsx_edit_append_style *as = &session->append_styles[i];
+            style = as->style;
+            number_format = as->number_format;
+            style_index = &as->style_index;
+        } else {
+            lxlsx_edit_change *ch = &session->changes[i - session->append_style_count];
+            style = ch->style;
+            number_format = ch->number_format;
+            style_index = &ch->style_index;
+        }
+
+        if (style) {
+            size_t font_id, fill_id = 0, border_id = 0, num_id = 0;
+            int has_num = 0, found = 0;
+            for (j = 0; j < nfmt; j++) {
+                if (format_style_equal(fmts[j], style)) {
+                    *style_index = (int)fmt_xf[j];
+                    found = 1; break;
+                }
+            }
+            if (found) continue;
+
+            font_id = next_font++; nfonts_add++;
+            if (emit_font_fragment(&fonts, style) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            if (fmt_has_fill(style)) {
+                fill_id = next_fill++; nfills_add++;
+                if (emit_fill_fragment(&fills, style) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            }
+            if (fmt_has_border(style)) {
+                border_id = next_border++; nborders_add++;
+                if (emit_border_fragment(&borders, style) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            }
+            if (style->num_format[0]) {
+                char head[48];
+                num_id = next_numid++; nnum_add++; has_num = 1;
+                snprintf(head, sizeof(head), "<numFmt numFmtId=\"%zu\" formatCode=\"", num_id);
+                if (buf_append_s(&numfmts, head) != 0 ||
+                    append_attr_escaped(&numfmts, style->num_format) != 0 ||
+                    buf_append_s(&numfmts, "\"/>") != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            }
+            if (emit_xf_fragment(&xfents, num_id, font_id, fill_id, border_id, style, has_num) != 0) {
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done;
+            }
+            nxf_add++;
+            *style_index = (int)next_xf++;
+
+            if (nfmt >= capfmt) {
+                size_t nc = capfmt ? capfmt * 2 : 8;
+                const lxlsx_format **nf = (const lxlsx_format **)realloc(fmts, nc * sizeof(*nf));
+                size_t *nx = (size_t *)realloc(fmt_xf, nc * sizeof(*nx));
+                if (!nf || !nx) { free(nf); free(nx); err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+                fmts = nf; fmt_xf = nx; capfmt = nc;
+            }
+            fmts[nfmt] = style; fmt_xf[nfmt] = (size_t)*style_index; nfmt++;
+        } else if (number_format) {
+            char head[48];
             size_t num_id;
             int found = 0;
             for (j = 0; j < ncode; j++) {
-                if (strcmp(codes[j], ch->number_format) == 0) {
-                    ch->style_index = (int)code_xf[j]; found = 1; break;
+                if (strcmp(codes[j], number_format) == 0) {
+                    *style_index = (int)code_xf[j]; found = 1; break;
                 }
             }
-            if (found) continue;
+            if (found) continue;
+
+            num_id = next_numid++; nnum_add++;
+            snprintf(head, sizeof(head), "<numFmt numFmtId=\"%zu\" formatCode=\"", num_id);
+            if (buf_append_s(&numfmts, head) != 0 ||
+                append_attr_escaped(&numfmts, number_format) != 0 ||
+                buf_append_s(&numfmts, "\"/>") != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            if (emit_xf_fragment(&xfents, num_id, 0, 0, 0, NULL, 1) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            nxf_add++;
+            *style_index = (int)next_xf++;
+
+            if (ncode >= capcode) {
+                size_t nc = capcode ? capcode * 2 : 8;
+                const char **ncc = (const char **)realloc(codes, nc * sizeof(*ncc));
+                size_t *nx = (size_t *)realloc(code_xf, nc * sizeof(*nx));
+                if (!ncc || !nx) { free(ncc); free(nx); err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+                codes = ncc; code_xf = nx; capcode = nc;
+            }
+            codes[ncode] = number_format; code_xf[ncode] = (size_t)*style_index; ncode++;
+        }
+    }
+
+    for (i = 0; i < session->append_style_count; i++) {
+        if (session->append_styles[i].style_index !=
+            (int)(session->append_xf_base + i)) {
+            err = LXLSX_ERROR_PARAMETER_VALIDATION;
+            goto done;
+        }
+    }
+
+    if (nxf_add == 0)
+        goto done;
+
+    /* Splice each collection (order doesn't matter between distinct tags). */
+    err = splice_collection((const char *)xml, xmllen, "fonts",
+                            fonts.data ? fonts.data : "", nfonts_add, "styleSheet", &b1, &l1);
+    if (err != LXLSX_NO_ERROR) goto done;
+    err = splice_collection(b1, l1, "fills",
+                            fills.data ? fills.data : "", nfills_add, "styleSheet", &b2, &l2);
+    if (err != LXLSX_NO_ERROR) goto done;
+    err = splice_collection(b2, l2, "borders",
+                            borders.data ? borders.data : "", nborders_add, "styleSheet", &b3, &l3);
+    if (err != LXLSX_NO_ERROR) goto done;
+    err = splice_collection(b3, l3, "numFmts",
+                            numfmts.data ? numfmts.data : "", nnum_add, "styleSheet", &b4, &l4);
+    if (err != LXLSX_NO_ERROR) goto done;
+    err = splice_collection(b4, l4, "cellXfs",
+                            xfents.data ? xfents.data : "", nxf_add, "styleSheet", &final, &finallen);
+    if (err != LXLSX_NO_ERROR) goto done;
+
+    rep->entry_index = (size_t)entry;
+    rep->data = (const unsigned char *)final;
+    rep->size = finallen;
+    final = NULL;
+    *produced = 1;
+
+done:
+    free(fmts); free(fmt_xf); free(codes); free(code_xf);
+    free(xml); free(b1); free(b2); free(b3); free(b4); free(final);
+    free(fonts.data); free(fills.data); free(borders.data);
+    free(numfmts.data); free(xfents.data);
+    return err;
+}
+
+/* Largest N among existing xl/worksheets/sheetN.xml parts. */
+static size_t max_existing_sheet_num(lxlsx_edit_session *session)
+{
+    size_t n = lxlsx_source_package_entry_count(session->package), i, maxv = 0;
+    for (i = 0; i < n; i++) {
+        const lxlsx_source_package_entry_info *info =
+            lxlsx_source_package_entry_info_at(session->package, i);
+        size_t pos = 19, v = 0;
+        int has = 0;
+        if (!info || info->name_len < 24) continue;
+        if (memcmp(info->name, "xl/worksheets/sheet", 19) != 0) continue;
+        while (pos < info->name_len && info->name[pos] >= '0' && info->name[pos] <= '9') {
+            v = v * 10 + (size_t)(info->name[pos] - '0'); pos++; has = 1;
+        }
+        if (has && info->name_len - pos == 4 &&
+            memcmp(info->name + pos, ".xml", 4) == 0 && v > maxv)
+            maxv = v;
+    }
+    return maxv;
+}
+
+/* Largest integer following each occurrence of `needle` in [buf, buf+len). */
+static size_t scan_max_after(const unsigned char *buf, size_t len, const char *needle)
+{
+    const char *p = (const char *)buf, *end = p + len;
+    size_t maxv = 0;
+    while ((p = mem_find(p, (size_t)(end - p), needle)) != NULL) {
+        size_t v = 0;
+        p += strlen(needle);
+        while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (size_t)(*p++ - '0');
+        if (v > maxv) maxv = v;
+    }
+    return maxv;
+}
+
+/* Largest integer immediately following `prefix` across all part names (e.g.
+ * "xl/media/image" -> highest existing image index, any extension). */
+static size_t max_existing_indexed(lxlsx_edit_session *session, const char *prefix)
+{
+    size_t plen = strlen(prefix);
+    size_t n = lxlsx_source_package_entry_count(session->package), i, maxv = 0;
+    for (i = 0; i < n; i++) {
+        const lxlsx_source_package_entry_info *info =
+            lxlsx_source_package_entry_info_at(session->package, i);
+        size_t pos = plen, v = 0;
+        int has = 0;
+        if (!info || info->name_len <= plen) continue;
+        if (memcmp(info->name, prefix, plen) != 0) continue;
+        while (pos < info->name_len &&
+               info->name[pos] >= '0' && info->name[pos] <= '9') {
+            v = v * 10 + (size_t)(info->name[pos] - '0'); pos++; has = 1;
+        }
+        if (has && v > maxv) maxv = v;
+    }
+    return maxv;
+}
+
+/* Package content type for a supported image extension, or NULL. */
+static const char *image_ct_for_ext(const char *ext)
+{
+    if (strcmp(ext, "png") == 0)  return "image/png";
+    if (strcmp(ext, "jpeg") == 0) return "image/jpeg";
+    if (strcmp(ext, "bmp") == 0)  return "image/bmp";
+    if (strcmp(ext, "gif") == 0)  return "image/gif";
+    return NULL;
+}
+
+/* "xl/worksheets/sheet1.xml" -> "xl/worksheets/_rels/sheet1.xml.rels". */
+static int derive_rels_path(const char *part, char *out, size_t outsz)
+{
+    const char *slash = strrchr(part, '/');
+    int n;
+    if (!slash)
+        return -1;
+    n = snprintf(out, outsz, "%.*s/_rels/%s.rels",
+                 (int)(slash - part), part, slash + 1);
+    return (n > 0 && (size_t)n < outsz) ? 0 : -1;
+}
+
+/* Read a package part, insert `insert` before `close_tag`, produce a replacement. */
+static lxlsx_error part_insert_before(lxlsx_edit_session *session,
+                                      const char *part, const char *close_tag,
+                                      const char *insert,
+                                      lxlsx_source_package_replacement *rep)
+{
+    unsigned char *xml = NULL;
+    size_t xmllen = 0;
+    int idx;
+    const char *pos;
+    lxlsx_edit_buf out = {0};
+    lxlsx_error err;
+
+    idx = lxlsx_source_package_find_first(session->package, part);
+    if (idx < 0) return LXLSX_ERROR_ZIP_FILE_ADD;
+    err = lxlsx_source_package_read_entry(session->package, (size_t)idx, &xml, &xmllen);
+    if (err != LXLSX_NO_ERROR) return err;
+    pos = mem_find((const char *)xml, xmllen, close_tag);
+    if (!pos) { free(xml); return LXLSX_ERROR_PARAMETER_VALIDATION; }
+
+    if (buf_append(&out, (const char *)xml, (size_t)(pos - (const char *)xml)) != 0 ||
+        buf_append_s(&out, insert) != 0 ||
+        buf_append(&out, pos, xmllen - (size_t)(pos - (const char *)xml)) != 0) {
+        free(xml); free(out.data); return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+    free(xml);
+    rep->entry_index = (size_t)idx;
+    rep->data = (const unsigned char *)out.data;
+    rep->size = out.len;
+    return LXLSX_NO_ERROR;
+}
+
+#define LXLSX_WS_REL_TYPE "http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet"
+#define LXLSX_WS_CT "application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml"
+
+/*
+ * Multi-part composition accumulator. Collects brand-new parts (additions) and
+ * per-part fragment insertions (materialised as replacements at finalize time),
+ * aggregating every insertion that targets the same part into ONE replacement.
+ *
+ * That aggregation is the point: several features patch the same metadata part
+ * (e.g. [Content_Types].xml gets a worksheet Override from add-sheet and an
+ * image Default from add-image). Patching it twice independently — each off the
+ * original bytes — would drop one. A brand-new rels part is just an addition, so
+ * no separate "create rels" path is needed. add-sheet uses this today;
+ * add-image/chart build on the same API. Borrowed `data` pointers handed to
+ * composer_add_part must outlive the save (callers pass session-owned buffers).
+ */
+typedef struct {
+    char          *part;       /* host part to patch (owned) */
+    char          *close_tag;  /* token to insert the fragment before (owned) */
+    lxlsx_edit_buf frag;       /* aggregated fragment */
+} lxlsx_composer_patch;
+
+typedef struct {
+    lxlsx_edit_session            *session;
+    lxlsx_source_package_addition *adds;   /* names always owned; data owned iff adds_owned[i] */
+    int                           *adds_owned;
+    size_t                         add_count, add_cap;
+    lxlsx_composer_patch          *patches;
+    size_t                         patch_count, patch_cap;
+    int                            oom;    /* sticky out-of-memory flag */
+} lxlsx_composer;
+
+static void composer_init(lxlsx_composer *c, lxlsx_edit_session *session)
+{
+    memset(c, 0, sizeof(*c));
+    c->session = session;
+}
+
+static void composer_free(lxlsx_composer *c)
+{
+    size_t i;
+    for (i = 0; i < c->add_count; i++) {
+        free((void *)(uintptr_t)c->adds[i].name);
+        if (c->adds_owned[i])
+            free((void *)(uintptr_t)c->adds[i].data);
+    }
+    free(c->adds);
+    free(c->adds_owned);
+    for (i = 0; i < c->patch_count; i++) {
+        free(c->patches[i].part);
+        free(c->patches[i].close_tag);
+        free(c->patches[i].frag.data);
+    }
+    free(c->patches);
+    memset(c, 0, sizeof(*c));
+}
+
+/* Append a brand-new part. `name` is always copied. `data` is copied when
+ * copy != 0 (callers passing a temporary buffer); when copy == 0 the data is
+ * borrowed and must outlive the save (session-owned buffers like image bytes or
+ * a new sheet's XML) — this avoids duplicating large payloads. */
+static void composer_add_part(lxlsx_composer *c, const char *name,
+                              const unsigned char *data, size_t size, int copy)
+{
+    lxlsx_source_package_addition *a;
+    char *name_copy;
+    unsigned char *data_ptr;
+    if (c->oom)
+        return;
+    if (c->add_count >= c->add_cap) {
+        size_t cap = c->add_cap ? c->add_cap * 2 : 4;
+        lxlsx_source_package_addition *next = (lxlsx_source_package_addition *)
+            realloc(c->adds, cap * sizeof(*next));
+        int *owned;
+        if (!next) { c->oom = 1; return; }
+        c->adds = next;
+        owned = (int *)realloc(c->adds_owned, cap * sizeof(*owned));
+        if (!owned) { c->oom = 1; return; }
+        c->adds_owned = owned;
+        c->add_cap = cap;
+    }
+    name_copy = strdup(name);
+    if (!name_copy) { c->oom = 1; return; }
+    if (copy && size) {
+        data_ptr = (unsigned char *)malloc(size);
+        if (!data_ptr) { free(name_copy); c->oom = 1; return; }
+        memcpy(data_ptr, data, size);
+    } else {
+        data_ptr = (unsigned char *)data;  /* borrowed (or empty) */
+    }
+    a = &c->adds[c->add_count];
+    memset(a, 0, sizeof(*a));
+    a->name = name_copy;
+    a->data = data_ptr;
+    a->size = size;
+    c->adds_owned[c->add_count] = (copy && size) ? 1 : 0;
+    c->add_count++;
+}
+
+/* Return the aggregation buffer for `part` (created on first use), so the caller
+ * can append fragments to it. Insertions accumulate before `close_tag`. NULL on
+ * OOM (the sticky flag is also set, so callers may defer the check). */
+static lxlsx_edit_buf *composer_part_buf(lxlsx_composer *c, const char *part,
+                                         const char *close_tag)
+{
+    size_t i;
+    lxlsx_composer_patch *p;
+    if (c->oom)
+        return NULL;
+    for (i = 0; i < c->patch_count; i++) {
+        if (strcmp(c->patches[i].part, part) == 0)
+            return &c->patches[i].frag;
+    }
+    if (c->patch_count >= c->patch_cap) {
+        size_t cap = c->patch_cap ? c->patch_cap * 2 : 4;
+        lxlsx_composer_patch *next = (lxlsx_composer_patch *)
+            realloc(c->patches, cap * sizeof(*next));
+        if (!next) { c->oom = 1; return NULL; }
+        c->patches = next;
+        c->patch_cap = cap;
+    }
+    p = &c->patches[c->patch_count];
+    memset(p, 0, sizeof(*p));
+    p->part = strdup(part);
+    p->close_tag = strdup(close_tag);
+    if (!p->part || !p->close_tag) {
+        free(p->part);
+        free(p->close_tag);
+        c->oom = 1;
+        return NULL;
+    }
+    c->patch_count++;
+    return &p->frag;
+}
+
+/* Materialise: additions array (caller frees the array, not the borrowed data)
+ * plus one replacement per patched part (caller frees each .data and the
+ * array). */
+static lxlsx_error composer_finalize(lxlsx_composer *c,
+                                     lxlsx_source_package_addition **add_out,
+                                     size_t *n_add_out,
+                                     lxlsx_source_package_replacement **rep_out,
+                                     size_t *n_rep_out)
+{
+    lxlsx_source_package_addition *adds = NULL;
+    lxlsx_source_package_replacement *reps = NULL;
+    size_t i, produced = 0;
+    lxlsx_error err;
+
+    *add_out = NULL; *n_add_out = 0; *rep_out = NULL; *n_rep_out = 0;
+    if (c->oom)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    if (c->add_count) {
+        adds = (lxlsx_source_package_addition *)calloc(c->add_count, sizeof(*adds));
+        if (!adds)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        memcpy(adds, c->adds, c->add_count * sizeof(*adds));
+    }
+    if (c->patch_count) {
+        reps = (lxlsx_source_package_replacement *)
+            calloc(c->patch_count, sizeof(*reps));
+        if (!reps) { free(adds); return LXLSX_ERROR_MEMORY_MALLOC_FAILED; }
+    }
+    for (i = 0; i < c->patch_count; i++) {
+        err = part_insert_before(c->session, c->patches[i].part,
+                                 c->patches[i].close_tag,
+                                 c->patches[i].frag.data ? c->patches[i].frag.data : "",
+                                 &reps[produced]);
+        if (err != LXLSX_NO_ERROR) {
+            size_t j;
+            for (j = 0; j < produced; j++)
+                free((void *)reps[j].data);
+            free(reps);
+            free(adds);
+            return err;
+        }
+        produced++;
+    }
+
+    *add_out = adds;
+    *n_add_out = c->add_count;
+    *rep_out = reps;
+    *n_rep_out = produced;
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * Register the session's new worksheets onto a composer: a new sheetN.xml part
+ * each, plus <sheet>/<Relationship>/<Override> fragments for workbook.xml, its
+ * rels and [Content_Types].xml.
+ */
+static lxlsx_error prepare_new_sheets(lxlsx_edit_session *session,
+                                      lxlsx_composer *c)
+{
+    lxlsx_edit_buf *wb, *rel, *ct;
+    unsigned char *wbxml = NULL, *relxml = NULL;
+    size_t wblen = 0, rellen = 0;
+    size_t next_num, next_sid, next_rid, i;
+    int idx;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    if (session->new_sheet_count == 0)
+        return LXLSX_NO_ERROR;
+
+    next_num = max_existing_sheet_num(session) + 1;
+
+    /* Parse next sheetId from workbook.xml and next rId from its rels. */
+    idx = lxlsx_source_package_find_first(session->package, "xl/workbook.xml");
+    if (idx < 0) { err = LXLSX_ERROR_ZIP_FILE_ADD; goto done; }
+    err = lxlsx_source_package_read_entry(session->package, (size_t)idx, &wbxml, &wblen);
+    if (err != LXLSX_NO_ERROR) goto done;
+    next_sid = scan_max_after(wbxml, wblen, "sheetId=\"") + 1;
+
+    idx = lxlsx_source_package_find_first(session->package, "xl/_rels/workbook.xml.rels");
+    if (idx < 0) { err = LXLSX_ERROR_ZIP_FILE_ADD; goto done; }
+    err = lxlsx_source_package_read_entry(session->package, (size_t)idx, &relxml, &rellen);
+    if (err != LXLSX_NO_ERROR) goto done;
+    next_rid = scan_max_after(relxml, rellen, "Id=\"rId") + 1;
+
+    wb  = composer_part_buf(c, "xl/workbook.xml", "</sheets>");
+    rel = composer_part_buf(c, "xl/_rels/workbook.xml.rels", "</Relationships>");
+    ct  = composer_part_buf(c, "[Content_Types].xml", "</Types>");
+    if (!wb || !rel || !ct) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+
+    for (i = 0; i < session->new_sheet_count; i++) {
+        lxlsx_edit_new_sheet *s = &session->new_sheets[i];
+        char fn[48], frag[256];
+        size_t num = next_num + i, sid = next_sid + i, rid = next_rid + i;
+
+        snprintf(fn, sizeof(fn), "xl/worksheets/sheet%zu.xml", num);
+        composer_add_part(c, fn, (const unsigned char *)s->xml, s->xml_len, 0);
+
+        if (buf_append_s(wb, "<sheet name=\"") != 0 ||
+            append_attr_escaped(wb, s->name) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+        snprintf(frag, sizeof(frag), "\" sheetId=\"%zu\" r:id=\"rId%zu\"/>", sid, rid);
+        if (buf_append_s(wb, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+
+        snprintf(frag, sizeof(frag),
+                 "<Relationship Id=\"rId%zu\" Type=\"%s\" Target=\"worksheets/sheet%zu.xml\"/>",
+                 rid, LXLSX_WS_REL_TYPE, num);
+        if (buf_append_s(rel, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+
+        snprintf(frag, sizeof(frag),
+                 "<Override PartName=\"/xl/worksheets/sheet%zu.xml\" ContentType=\"%s\"/>",
+                 num, LXLSX_WS_CT);
+        if (buf_append_s(ct, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+    }
+
+    if (c->oom)
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+done:
+    free(wbxml);
+    free(relxml);
+    return err;
+}
+
+#define LXLSX_IMG_REL_TYPE  "http://schemas.openxmlformats.org/officeDocument/2006/relationships/image"
+#define LXLSX_DRAW_REL_TYPE "http://schemas.openxmlformats.org/officeDocument/2006/relationships/drawing"
+#define LXLSX_DRAW_CT       "application/vnd.openxmlformats-officedocument.drawing+xml"
+#define LXLSX_PKG_RELS_NS   "http://schemas.openxmlformats.org/package/2006/relationships"
+
+/*
+ * Synthesise the parts behind the session's images: one media part per image, a
+ * drawing part + its rels per worksheet, the content-type entries, and the
+ * worksheet rels (patched or created). The worksheet's own <drawing r:id> ref
+ * is left to the dirty-sheet patch loop (so it composes with cell edits on the
+ * same sheet) — recorded here via has_drawing/drawing_rid. Images are anchored
+ * with oneCellAnchor sized from the precomputed EMU extents.
+ */
+/* Append target to the list if not already present (linear; lists are tiny). */
+static int add_unique_target(const char ***list, size_t *n, size_t *cap,
+                             const char *target)
+{
+    size_t i;
+    for (i = 0; i < *n; i++)
+        if (strcmp((*list)[i], target) == 0)
+            return 0;
+    if (*n >= *cap) {
+        size_t nc = *cap ? *cap * 2 : 4;
+        const char **nl = (const char **)realloc(*list, nc * sizeof(*nl));
+        if (!nl)
+            return -1;
+        *list = nl;
+        *cap = nc;
+    }
+    (*list)[(*n)++] = target;
+    return 0;
+}
+
+#define LXLSX_CHART_REL_TYPE "http://schemas.openxmlformats.org/officeDocument/2006/relationships/chart"
+#define LXLSX_CHART_CT       "application/vnd.openxmlformats-officedocument.drawingml.chart+xml"
+#define LXLSX_DML_CHART_NS   "http://schemas.openxmlformats.org/drawingml/2006/chart"
+
+/* Append one chart's oneCellAnchor + graphicFrame to a drawing buffer. Built in
+ * segments so no single fixed buffer can overflow (cf. the rels skeleton bug). */
+static int append_chart_anchor(lxlsx_edit_buf *draw, lxlsx_row_t row,
+                               lxlsx_col_t col, uint64_t cx, uint64_t cy,
+                               int anchor_id, size_t rel_idx)
+{
+    char num[256];
+
+    snprintf(num, sizeof(num),
+             "<xdr:oneCellAnchor>"
+             "<xdr:from><xdr:col>%u</xdr:col><xdr:colOff>0</xdr:colOff>"
+             "<xdr:row>%u</xdr:row><xdr:rowOff>0</xdr:rowOff></xdr:from>"
+             "<xdr:ext cx=\"%llu\" cy=\"%llu\"/>",
+             (unsigned)col, (unsigned)row,
+             (unsigned long long)cx, (unsigned long long)cy);
+    if (buf_append_s(draw, num) != 0)
+        return -1;
+
+    if (buf_append_s(draw, "<xdr:graphicFrame macro=\"\"><xdr:nvGraphicFramePr>") != 0)
+        return -1;
+    snprintf(num, sizeof(num),
+             "<xdr:cNvPr id=\"%d\" name=\"Chart %d\"/>", anchor_id, anchor_id);
+    if (buf_append_s(draw, num) != 0)
+        return -1;
+    if (buf_append_s(draw,
+            "<xdr:cNvGraphicFramePr/></xdr:nvGraphicFramePr>"
+            "<xdr:xfrm><a:off x=\"0\" y=\"0\"/><a:ext cx=\"0\" cy=\"0\"/></xdr:xfrm>"
+            "<a:graphic><a:graphicData uri=\"" LXLSX_DML_CHART_NS "\">"
+            "<c:chart xmlns:c=\"" LXLSX_DML_CHART_NS "\""
+            " xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\"") != 0)
+        return -1;
+    snprintf(num, sizeof(num), " r:id=\"rId%zu\"/>", rel_idx);
+    if (buf_append_s(draw, num) != 0)
+        return -1;
+    if (buf_append_s(draw,
+            "</a:graphicData></a:graphic></xdr:graphicFrame>"
+            "<xdr:clientData/></xdr:oneCellAnchor>") != 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * Synthesise the parts behind the session's charts: one xl/charts/chartN.xml per
+ * chart (serialised here), a drawing part per worksheet whose graphicFrames
+ * reference the charts, the drawing rels, the worksheet rels (patched/created)
+ * and the content types. Mirrors prepare_images; the <drawing> ref is recorded
+ * on the dirty sheet. Charts share the drawing numbering via next_drawing_io.
+ */
+/* Append one image's oneCellAnchor (pic) to the drawing + its rels/content-type.
+ * rel_idx/anchor_id are this drawing's running counters; next_media is global. */
+static lxlsx_error append_image_object(lxlsx_composer *c, lxlsx_edit_image *im,
+                                       lxlsx_edit_buf *draw, lxlsx_edit_buf *drels,
+                                       lxlsx_edit_buf *ct,
+                                       const unsigned char *ctxml, size_t ctlen,
+                                       int *seen_png, int *seen_jpeg,
+                                       int *seen_bmp, int *seen_gif,
+                                       size_t *next_media,
+                                       size_t rel_idx, int anchor_id)
+{
+    const char *ct_str = image_ct_for_ext(im->extension);
+    char frag[512], needle[32], media_part[64];
+    long long xoff, yoff;
+    size_t media_num;
+    int *seen;
+
+    if (!ct_str)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+    media_num = (*next_media)++;
+
+    snprintf(media_part, sizeof(media_part),
+             "xl/media/image%zu.%s", media_num, im->extension);
+    composer_add_part(c, media_part, im->data, im->size, 0);
+
+    /* Default content type per extension (dedup vs existing + batch). */
+    seen = (strcmp(im->extension, "png") == 0)  ? seen_png  :
+           (strcmp(im->extension, "jpeg") == 0) ? seen_jpeg :
+           (strcmp(im->extension, "bmp") == 0)  ? seen_bmp  : seen_gif;
+    snprintf(needle, sizeof(needle), "Extension=\"%s\"", im->extension);
+    if (!*seen && !(ctxml && mem_find((const char *)ctxml, ctlen, needle))) {
+        snprintf(frag, sizeof(frag),
+                 "<Default Extension=\"%s\" ContentType=\"%s\"/>",
+                 im->extension, ct_str);
+        if (buf_append_s(ct, frag) != 0)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+    *seen = 1;
+
+    snprintf(frag, sizeof(frag),
+             "<Relationship Id=\"rId%zu\" Type=\"" LXLSX_IMG_REL_TYPE
+             "\" Target=\"../media/image%zu.%s\"/>",
+             rel_idx, media_num, im->extension);
+    if (buf_append_s(drels, frag) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    xoff = (long long)im->x_offset * 9525;
+    yoff = (long long)im->y_offset * 9525;
+    snprintf(frag, sizeof(frag),
+        "<xdr:oneCellAnchor>"
+        "<xdr:from><xdr:col>%u</xdr:col><xdr:colOff>%lld</xdr:colOff>"
+        "<xdr:row>%u</xdr:row><xdr:rowOff>%lld</xdr:rowOff></xdr:from>"
+        "<xdr:ext cx=\"%llu\" cy=\"%llu\"/>"
+        "<xdr:pic><xdr:nvPicPr><xdr:cNvPr id=\"%d\" name=\"Picture %d\"",
+        (unsigned)im->col, xoff, (unsigned)im->row, yoff,
+        (unsigned long long)im->cx, (unsigned long long)im->cy,
+        anchor_id, anchor_id);
+    if (buf_append_s(draw, frag) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    if (im->description && *im->description) {
+        if (buf_append_s(draw, " descr=\"") != 0 ||
+            append_attr_escaped(draw, im->description) != 0 ||
+            buf_append_s(draw, "\"") != 0)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+    snprintf(frag, sizeof(frag),
+        "/><xdr:cNvPicPr><a:picLocks noChangeAspect=\"1\"/></xdr:cNvPicPr></xdr:nvPicPr>"
+        "<xdr:blipFill>"
+        "<a:blip xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\" r:embed=\"rId%zu\"/>"
+        "<a:stretch><a:fillRect/></a:stretch></xdr:blipFill>"
+        "<xdr:spPr><a:xfrm><a:off x=\"0\" y=\"0\"/><a:ext cx=\"%llu\" cy=\"%llu\"/></a:xfrm>"
+        "<a:prstGeom prst=\"rect\"><a:avLst/></a:prstGeom></xdr:spPr>"
+        "</xdr:pic><xdr:clientData/></xdr:oneCellAnchor>",
+        rel_idx, (unsigned long long)im->cx, (unsigned long long)im->cy);
+    if (buf_append_s(draw, frag) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    return LXLSX_NO_ERROR;
+}
+
+/* Serialise one chart, add its part/rels/content-type and graphicFrame anchor. */
+static lxlsx_error append_chart_object(lxlsx_composer *c, lxlsx_edit_chart *ech,
+                                       lxlsx_edit_buf *draw, lxlsx_edit_buf *drels,
+                                       lxlsx_edit_buf *ct,
+                                       size_t *next_chart, size_t chart_seq,
+                                       size_t rel_idx, int anchor_id)
+{
+    char *chart_xml = NULL;
+    size_t chart_xml_len = 0, chart_num = (*next_chart)++;
+    char frag[256];
+    uint64_t cx, cy;
+    lxlsx_error err;
+
+    /* The chart id only needs to be unique enough for axis ids. */
+    ech->chart->id = (uint32_t)chart_seq;
+    err = lxlsx_chart_assemble_to_buffer(ech->chart, NULL, &chart_xml, &chart_xml_len);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+
+    snprintf(frag, sizeof(frag), "xl/charts/chart%zu.xml", chart_num);
+    composer_add_part(c, frag, (const unsigned char *)chart_xml, chart_xml_len, 1);
+    free(chart_xml);
+
+    snprintf(frag, sizeof(frag),
+             "<Override PartName=\"/xl/charts/chart%zu.xml\" ContentType=\"%s\"/>",
+             chart_num, LXLSX_CHART_CT);
+    if (buf_append_s(ct, frag) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    snprintf(frag, sizeof(frag),
+             "<Relationship Id=\"rId%zu\" Type=\"" LXLSX_CHART_REL_TYPE
+             "\" Target=\"../charts/chart%zu.xml\"/>",
+             rel_idx, chart_num);
+    if (buf_append_s(drels, frag) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    /* Default chart size 480x288 px in EMUs. */
+    cx = (uint64_t)(480.0 * 9525.0);
+    cy = (uint64_t)(288.0 * 9525.0);
+    if (append_chart_anchor(draw, ech->row, ech->col, cx, cy, anchor_id, rel_idx) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * Synthesise the drawing-hosted parts behind the session's images AND charts.
+ * One drawing per worksheet holds all of that sheet's images (pics) followed by
+ * its charts (graphicFrames), so a sheet may mix both. Each drawing gets its
+ * rels, the worksheet rels (patched/created), the content types and a <drawing>
+ * ref recorded on the dirty sheet. Drawing/anchor/rel ids run per drawing;
+ * media/chart part numbers and the drawing-part counter are global.
+ */
+static lxlsx_error prepare_drawings(lxlsx_edit_session *session,
+                                    lxlsx_composer *c,
+                                    lxlsx_dirty_sheet **sheets,
+                                    size_t *sheet_count,
+                                    size_t *sheet_cap,
+                                    size_t *next_drawing_io)
+{
+    size_t next_media, next_chart, chart_seq = 0, i, t;
+    lxlsx_edit_buf *ct;
+    unsigned char *ctxml = NULL;
+    size_t ctlen = 0;
+    int seen_png = 0, seen_jpeg = 0, seen_bmp = 0, seen_gif = 0;
+    const char **targets = NULL;
+    size_t ntargets = 0, tcap = 0;
+    char frag[512];
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    if (session->image_count == 0 && session->chart_count == 0)
+        return LXLSX_NO_ERROR;
+
+    next_media = max_existing_indexed(session, "xl/media/image") + 1;
+    next_chart = max_existing_indexed(session, "xl/charts/chart") + 1;
+
+    ct = composer_part_buf(c, "[Content_Types].xml", "</Types>");
+    if (!ct)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    {
+        int idx = lxlsx_source_package_find_first(session->package, "[Content_Types].xml");
+        if (idx >= 0) {
+            err = lxlsx_source_package_read_entry(session->package, (size_t)idx,
+                                                  &ctxml, &ctlen);
+            if (err != LXLSX_NO_ERROR)
+                return err;
+        }
+    }
+
+    /* Distinct worksheets touched by an image or a chart. */
+    for (i = 0; i < session->image_count; i++)
+        if (add_unique_target(&targets, &ntargets, &tcap, session->images[i].target) != 0) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done;
+        }
+    for (i = 0; i < session->chart_count; i++)
+        if (add_unique_target(&targets, &ntargets, &tcap, session->charts[i].target) != 0) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done;
+        }
+
+    for (t = 0; t < ntargets; t++) {
+        const char *target = targets[t];
+        size_t drawing_num, rel_idx = 1, ws_rid = 1;
+        int anchor_id = 1, ws_rels_idx;
+        lxlsx_edit_buf draw = {0}, drels = {0};
+        char drawing_part[64], drawing_rels_part[96], ws_rels_part[96];
+        lxlsx_dirty_sheet *ds = NULL;
+
+        drawing_num = (*next_drawing_io)++;
+        snprintf(drawing_part, sizeof(drawing_part),
+                 "xl/drawings/drawing%zu.xml", drawing_num);
+        if (derive_rels_path(drawing_part, drawing_rels_part, sizeof(drawing_rels_part)) != 0 ||
+            derive_rels_path(target, ws_rels_part, sizeof(ws_rels_part)) != 0) {
+            err = LXLSX_ERROR_PARAMETER_VALIDATION; goto done;
+        }
+
+        if (buf_append_s(&draw,
+                "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
+                "<xdr:wsDr xmlns:xdr=\"http://schemas.openxmlformats.org/drawingml/2006/spreadsheetDrawing\""
+                " xmlns:a=\"http://schemas.openxmlformats.org/drawingml/2006/main\">") != 0 ||
+            buf_append_s(&drels,
+                "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
+                "<Relationships xmlns=\"" LXLSX_PKG_RELS_NS "\">") != 0)
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+        /* Images first, then charts, all into this one drawing. */
+        for (i = 0; i < session->image_count && err == LXLSX_NO_ERROR; i++) {
+            if (strcmp(session->images[i].target, target) != 0)
+                continue;
+            err = append_image_object(c, &session->images[i], &draw, &drels, ct,
+                                      ctxml, ctlen, &seen_png, &seen_jpeg,
+                                      &seen_bmp, &seen_gif, &next_media,
+                                      rel_idx, anchor_id);
+            rel_idx++;
+            anchor_id++;
+        }
+        for (i = 0; i < session->chart_count && err == LXLSX_NO_ERROR; i++) {
+            if (strcmp(session->charts[i].target, target) != 0)
+                continue;
+            err = append_chart_object(c, &session->charts[i], &draw, &drels, ct,
+                                      &next_chart, ++chart_seq, rel_idx, anchor_id);
+            rel_idx++;
+            anchor_id++;
+        }
+
+        if (err == LXLSX_NO_ERROR &&
+            (buf_append_s(&draw, "</xdr:wsDr>") != 0 ||
+             buf_append_s(&drels, "</Relationships>") != 0))
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+        if (err == LXLSX_NO_ERROR) {
+            composer_add_part(c, drawing_part, (const unsigned char *)draw.data, draw.len, 1);
+            composer_add_part(c, drawing_rels_part, (const unsigned char *)drels.data, drels.len, 1);
+        }
+        free(draw.data);
+        free(drels.data);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+
+        snprintf(frag, sizeof(frag),
+                 "<Override PartName=\"/%s\" ContentType=\"" LXLSX_DRAW_CT "\"/>",
+                 drawing_part);
+        if (buf_append_s(ct, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+
+        /* Worksheet rels: drawing relationship — patch if present, else create. */
+        ws_rels_idx = lxlsx_source_package_find_first(session->package, ws_rels_part);
+        if (ws_rels_idx >= 0) {
+            unsigned char *rxml = NULL;
+            size_t rlen = 0;
+            lxlsx_edit_buf *wsr;
+            err = lxlsx_source_package_read_entry(session->package,
+                                                  (size_t)ws_rels_idx, &rxml, &rlen);
+            if (err != LXLSX_NO_ERROR) goto done;
+            ws_rid = scan_max_after(rxml, rlen, "Id=\"rId") + 1;
+            free(rxml);
+            wsr = composer_part_buf(c, ws_rels_part, "</Relationships>");
+            if (!wsr) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            snprintf(frag, sizeof(frag),
+                     "<Relationship Id=\"rId%zu\" Type=\"" LXLSX_DRAW_REL_TYPE
+                     "\" Target=\"../drawings/drawing%zu.xml\"/>",
+                     ws_rid, drawing_num);
+            if (buf_append_s(wsr, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+        } else {
+            char skel[512];
+            ws_rid = 1;
+            snprintf(skel, sizeof(skel),
+                "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
+                "<Relationships xmlns=\"" LXLSX_PKG_RELS_NS "\">"
+                "<Relationship Id=\"rId1\" Type=\"" LXLSX_DRAW_REL_TYPE
+                "\" Target=\"../drawings/drawing%zu.xml\"/></Relationships>",
+                drawing_num);
+            composer_add_part(c, ws_rels_part, (const unsigned char *)skel, strlen(skel), 1);
+        }
+
+        err = get_dirty_sheet(session, sheets, sheet_count, sheet_cap, target, &ds);
+        if (err != LXLSX_NO_ERROR) goto done;
+        if (ds->has_drawing) { err = LXLSX_ERROR_FEATURE_NOT_SUPPORTED; goto done; }
+        ds->has_drawing = 1;
+        ds->drawing_rid = ws_rid;
+
+        if (c->oom) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+    }
+
+done:
+    free(targets);
+    free(ctxml);
+    return err;
+}
+
+lxlsx_error lxlsx_edit_save_as(lxlsx_edit_session *session, const char *path)
+{
+    return lxlsx_edit_save_as_opt(session, path, NULL);
+}
+
+/* Write the package with the given changes, in place when asked to and
+ * saving over the source file. */
+static lxlsx_error save_package(
+    lxlsx_edit_session *session,
+    const char *path,
+    const lxlsx_edit_save_options *options,
+    const lxlsx_source_package_replacement *replacements,
+    size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
+    const lxlsx_source_package_addition *additions,
+    size_t addition_count)
+{
+    /* A cached copy of the file being overwritten is stale from here on,
+     * even if its size and modification time happen to stay the same. */
+    template_forget(path);
+
+    if (options && options->in_place && strcmp(path, session->path) == 0)
+        return lxlsx_source_package_save_in_place(
+            session->package, path, replacements, replacement_count,
+            streams, stream_count, additions, addition_count,
+            options->compact_ratio);
+
+    return lxlsx_source_package_save_streamed(session->package, path,
+                                             replacements, replacement_count,
+                                             streams, stream_count,
+                                             additions, addition_count);
+}
+
+lxlsx_error lxlsx_edit_save_as_opt(lxlsx_edit_session *session,
+                                   const char *path,
+                                   const lxlsx_edit_save_options *options)
+{
+    lxlsx_dirty_sheet *dirty_sheets = NULL;
+    size_t dirty_count = 0;
+    size_t dirty_cap = 0;
+    lxlsx_source_package_replacement *replacements = NULL;
+    lxlsx_source_package_stream_replacement *streams = NULL;
+    lxlsx_source_package_replacement styles_rep;
+    lxlsx_source_package_replacement *meta_reps = NULL;
+    lxlsx_source_package_addition *additions = NULL;
+    lxlsx_composer composer;
+    size_t add_count = 0, meta_count = 0;
+    int styles_produced = 0;
+    size_t rep_count;
+    size_t stream_count;
+    lxlsx_error err = LXLSX_NO_ERROR;
+    size_t i;
+
+    memset(&styles_rep, 0, sizeof(styles_rep));
+
+    if (!session || !path)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+    if (session->change_count == 0 && session->merge_count == 0 &&
+        session->col_count == 0 && session->row_dim_count == 0 &&
+        session->new_sheet_count == 0 && session->image_count == 0 &&
+        session->chart_count == 0 && session->append_count == 0)
+        return save_package(session, path, options, NULL, 0, NULL, 0, NULL, 0);
+
+    composer_init(&composer, session);
+
+    for (i = 0; i < session->change_count; i++) {
+        lxlsx_dirty_sheet *sheet = NULL;
+        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
+                              session->changes[i].target, &sheet);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        err = dirty_sheet_add_change(sheet, &session->changes[i]);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+    }
+
+    for (i = 0; i < session->merge_count; i++) {
+        lxlsx_dirty_sheet *sheet = NULL;
+        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
+                              session->merges[i].target, &sheet);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        err = dirty_sheet_add_merge(sheet, &session->merges[i]);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+    }
+
+    for (i = 0; i < session->col_count; i++) {
+        lxlsx_dirty_sheet *sheet = NULL;
+        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
+                              session->cols[i].target, &sheet);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        err = dirty_sheet_add_col(sheet, &session->cols[i]);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+    }
+
+    for (i = 0; i < session->row_dim_count; i++) {
+        lxlsx_dirty_sheet *sheet = NULL;
+        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
+                              session->row_dims[i].target, &sheet);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        err = dirty_sheet_add_row_dim(sheet, &session->row_dims[i]);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+    }
+
+    /* Sorted, the heights are applied with a cursor as the rows stream by. */
+    for (i = 0; i < dirty_count; i++) {
+        if (dirty_sheets[i].row_dim_count > 1)
+            qsort(dirty_sheets[i].row_dims, dirty_sheets[i].row_dim_count,
+                  sizeof(*dirty_sheets[i].row_dims), row_dim_cmp);
+    }
+
+    for (i = 0; i < session->append_count; i++) {
+        lxlsx_dirty_sheet *sheet = NULL;
+        if (!session->appends[i].row_open)
+            continue;
+        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
+                              session->appends[i].target, &sheet);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        sheet->append = &session->appends[i];
+    }
+
+    /* Resolve number-format restyles into styles.xml (sets per-change style
+     * indices that the cell patcher below reads). */
+    err = inject_cell_styles(session, &styles_rep, &styles_produced);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+
+    /* Build new-sheet parts + their workbook/rels/content-type registrations
+     * onto the composer (shared with future add-image/chart compositions). */
+    err = prepare_new_sheets(session, &composer);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+
+    /* Synthesise image + chart drawing parts. One drawing per worksheet holds
+     * both, so a sheet may mix images and charts; each records a <drawing> ref
+     * on its dirty sheet. */
+    {
+        size_t next_drawing =
+            max_existing_indexed(session, "xl/drawings/drawing") + 1;
+        err = prepare_drawings(session, &composer, &dirty_sheets, &dirty_count,
+                               &dirty_cap, &next_drawing);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+    }
+
+    /* Turn the composer's accumulated parts/fragments into additions + one
+     * replacement per patched metadata part. */
+    err = composer_finalize(&composer, &additions, &add_count,
+                            &meta_reps, &meta_count);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+
+    replacements = (lxlsx_source_package_replacement *)calloc(
+        1 + meta_count, sizeof(*replacements));
+    streams = (lxlsx_source_package_stream_replacement *)calloc(
+        dirty_count + 2, sizeof(*streams));
+    if (!replacements || !streams) {
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        goto done;
+    }
+
+    /* Dirty worksheets are patched while they stream from the source package
+     * into the output, so a large sheet is never held inflated in memory. */
+    for (i = 0; i < dirty_count; i++) {
+        streams[i].entry_index = dirty_sheets[i].entry_index;
+        streams[i].transform = patch_sheet_stream;
+        streams[i].ctx = &dirty_sheets[i];
+    }
+    stream_count = dirty_count;
+    if (session->append_strings && session->append_strings->unique_count > 0) {
+        int entry = lxlsx_source_package_find_first(
+            session->package, session->workbook->sst_path);
+        if (entry < 0) {
+            err = LXLSX_ERROR_ZIP_FILE_ADD;
+            goto done;
+        }
+        streams[stream_count].entry_index = (size_t)entry;
+        streams[stream_count].transform = patch_sst_stream;
+        streams[stream_count].ctx = session;
+        stream_count++;
+    }
+    rep_count = 0;
+    if (styles_produced) {
+        replacements[rep_count++] = styles_rep;
+    }
+    for (i = 0; i < meta_count; i++) {
+        replacements[rep_count++] = meta_reps[i];
+    }
+
+    err = save_package(session, path, options, replacements, rep_count,
+                       streams, stream_count, additions, add_count);
+
+done:
+    free(replacements);
+    free(streams);
+    free((void *)styles_rep.data);
+    for (i = 0; i < meta_count; i++)
+        free((void *)meta_reps[i].data);
+    free(meta_reps);
+    free(additions);
+    composer_free(&composer);
+    free_dirty_sheets(dirty_sheets, dirty_count);
+    return err;
+}
+
+/*
+ * Workbook concatenation (lxlsx_edit_concat()). The first file is the base:
+ * it is saved through an edit session with the worksheets of the other files
+ * added after its own. A worksheet whose style and shared string indices mean
+ * the same in the output keeps its compressed bytes; any other is streamed
+ * through concat_sheet_stream(), which renumbers them. The parts a worksheet
+ * reaches through its rels (drawings, charts, media, comments, tables...) are
+ * copied verbatim under fresh names. Only styles.xml, the shared strings, the
+ * workbook, its rels and the content types are rewritten.
+ */
+
+#define LXLSX_SST_REL_TYPE "http://schemas.openxmlformats.org/officeDocument/2006/relationships/sharedStrings"
+#define LXLSX_SST_CT       "application/vnd.openxmlformats-officedocument.spreadsheetml.sharedStrings+xml"
+#define LXLSX_SML_NS       "http://schemas.openxmlformats.org/spreadsheetml/2006/main"
+
+/* Excel's limit on the length of a worksheet name, in characters. */
+#define LXLSX_CONCAT_SHEET_NAME_MAX 31
+
+/* Custom number formats are numbered from here; lower ids are built in. */
+#define LXLSX_CONCAT_FIRST_NUM_FMT 164
+
+/*
+ * An attribute rewritten by append_tag_rewritten(). With `map`, a numeric
+ * value v below `count` becomes map[v] and any other value is kept; with
+ * `implicit_zero` as well, a tag without the attribute, which means index 0,
+ * gets it when map[0] isn't 0. Without `map`, the value becomes `text`, or
+ * the attribute is dropped if that is NULL.
+ */
+typedef struct {
+    const char *name;
+    const size_t *map;
+    size_t count;
+    const char *text;
+    int implicit_zero;
+} lxlsx_concat_attr;
+
+/* Style records of one collection of the output styles.xml (or the <si> items
+ * of its shared strings), de-duplicated by their XML. */
+typedef struct {
+    const char *list;           /* collection tag, e.g. "fonts" */
+    const char *item;           /* record tag, e.g. "font" */
+    lxlsx_hash_table *index;    /* record XML -> output index */
+    size_t count;               /* records in the output */
+    lxlsx_edit_buf added;       /* records appended after the base's own */
+    size_t added_count;
+} lxlsx_concat_records;
+
+/* Index maps of one source, by source index. A NULL map means the indices
+ * already match the output. */
+typedef struct {
+    size_t *num_fmt;
+    size_t num_fmt_count;
+    size_t *font;
+    size_t font_count;
+    size_t *fill;
+    size_t fill_count;
+    size_t *border;
+    size_t border_count;
+    size_t *xf;
+    size_t xf_count;
+    size_t *dxf;
+    size_t dxf_count;
+    size_t *sst;
+    size_t sst_count;
+} lxlsx_concat_maps;
+
+/* Context of concat_sheet_stream() for one worksheet. */
+typedef struct {
+    const lxlsx_concat_maps *maps;
+    int drop_tab_selected;      /* unselect the sheet so tabs aren't grouped */
+} lxlsx_concat_sheet;
+
+/* A part copied from a source, by its source and output names. */
+typedef struct {
+    char *from;
+    const char *to;             /* owned by lxlsx_concat.part_names */
+} lxlsx_concat_part;
+
+/* A source. Only package, maps and sheets are kept once it is merged: its
+ * worksheets are copied from the package, through the sheet contexts, when
+ * the output is saved. */
+typedef struct {
+    lxlsx_source_package *package;
+    lxlsx_reader_workbook *workbook;
+    unsigned char *types;       /* [Content_Types].xml */
+    size_t types_len;
+    unsigned char *rels;        /* the workbook rels */
+    size_t rels_len;
+    lxlsx_concat_maps maps;
+    lxlsx_concat_sheet *sheets; /* referenced by the additions, never moved */
+    lxlsx_concat_part *parts;
+    size_t part_count;
+    size_t part_cap;
+} lxlsx_concat_source;
+
+typedef struct {
+    lxlsx_edit_session *base;
+    lxlsx_composer composer;
+    lxlsx_concat_source *sources;
+    size_t source_count;
+    lxlsx_hash_table *part_names;   /* every part of the output */
+    lxlsx_hash_table *part_stems;   /* name stem -> next number to try */
+    lxlsx_hash_table *sheet_names;  /* lower-cased */
+    lxlsx_hash_table *table_names;  /* lower-cased */
+    lxlsx_hash_table *type_defaults;/* extensions with a Default content type */
+    size_t next_sheet_id;
+    size_t next_rid;
+    size_t next_table_id;
+    int tables_seeded;
+    unsigned char *styles;          /* the base's styles.xml, if any */
+    size_t styles_len;
+    int styles_seeded;
+    lxlsx_hash_table *num_fmt_codes;/* formatCode -> id */
+    size_t next_num_fmt;
+    lxlsx_edit_buf num_fmts_added;
+    size_t num_fmts_added_count;
+    lxlsx_concat_records fonts;
+    lxlsx_concat_records fills;
+    lxlsx_concat_records borders;
+    lxlsx_concat_records xfs;
+    lxlsx_concat_records dxfs;
+    unsigned char *sst;             /* the base's shared strings, if any */
+    size_t sst_len;
+    int sst_seeded;
+    lxlsx_concat_records strings;
+    size_t string_refs;             /* references to the appended strings */
+} lxlsx_concat;
+
+/* Copy a tag, rewriting the listed attributes and leaving every other byte
+ * as it was. */
+static int append_tag_rewritten(lxlsx_edit_buf *buf, const char *tag_start,
+                                const char *tag_end,
+                                const lxlsx_concat_attr *attrs,
+                                size_t attr_count)
+{
+    const char *p = tag_start + 1;
+    const char *copied = tag_start;
+    const char *attrs_end;
+    unsigned int seen = 0;
+    size_t i;
+
+    while (p < tag_end && !isspace((unsigned char)*p) &&
+           *p != '>' && *p != '/')
+        p++;
+
+    while (p < tag_end) {
+        const char *space = p;
+        const char *attr_start;
+        const char *attr_end;
+        const char *value_start;
+        const char *value_end;
+        const lxlsx_concat_attr *attr = NULL;
+        char quote;
+
+        while (p < tag_end && isspace((unsigned char)*p))
+            p++;
+        if (p >= tag_end || *p == '/' || *p == '>')
+            break;
+
+        attr_start = p;
+        while (p < tag_end && *p != '=' && !isspace((unsigned char)*p) &&
+               *p != '>' && *p != '/')
+            p++;
+        attr_end = p;
+        while (p < tag_end && *p != '"' && *p != '\'')
+            p++;
+        if (p >= tag_end)
+            break;
+        quote = *p++;
+        value_start = p;
+        while (p < tag_end && *p != quote)
+            p++;
+        if (p >= tag_end)
+            break;
+        value_end = p++;
+
+        for (i = 0; i < attr_count; i++) {
+            size_t len = strlen(attrs[i].name);
+            if ((size_t)(attr_end - attr_start) == len &&
+                memcmp(attr_start, attrs[i].name, len) == 0) {
+                attr = &attrs[i];
+                seen |= 1u << i;
+                break;
+            }
+        }
+        if (!attr)
+            continue;
+
+        if (attr->map) {
+            const char *d = value_start;
+            size_t v = 0;
+            while (d < value_end && *d >= '0' && *d <= '9')
+                v = v * 10 + (size_t)(*d++ - '0');
+            if (d == value_start || d != value_end || v >= attr->count)
+                continue;
+            if (buf_append(buf, copied, (size_t)(value_start - copied)) != 0 ||
+                buf_appendf(buf, "%zu", attr->map[v]) != 0)
+                return -1;
+        } else if (attr->text) {
+            if (buf_append(buf, copied, (size_t)(value_start - copied)) != 0 ||
+                buf_append_s(buf, attr->text) != 0)
+                return -1;
+        } else {
+            if (buf_append(buf, copied, (size_t)(space - copied)) != 0)
+                return -1;
+            copied = p;
+            continue;
+        }
+        copied = value_end;
+    }
+
+    /* Add the implicit index 0 where it maps elsewhere, after the last
+     * attribute. */
+    attrs_end = tag_end;
+    if (attrs_end > tag_start && attrs_end[-1] == '/')
+        attrs_end--;
+    while (attrs_end > copied && isspace((unsigned char)attrs_end[-1]))
+        attrs_end--;
+    for (i = 0; i < attr_count; i++) {
+        if (!attrs[i].implicit_zero || !attrs[i].map || !attrs[i].count ||
+            attrs[i].map[0] == 0 || (seen & (1u << i)))
+            continue;
+        if (buf_append(buf, copied, (size_t)(attrs_end - copied)) != 0 ||
+            buf_appendf(buf, " %s=\"%zu\"", attrs[i].name,
+                        attrs[i].map[0]) != 0)
+            return -1;
+        copied = attrs_end;
+    }
+
+    return buf_append(buf, copied, (size_t)(tag_end + 1 - copied));
+}
+
+static int attr_value_is(const char *tag_start, const char *tag_end,
+                         const char *name, const char *expected)
+{
+    const char *value;
+    size_t len;
+
+    return find_attr(tag_start, tag_end, name, &value, &len) &&
+           len == strlen(expected) && memcmp(value, expected, len) == 0;
+}
+
+static size_t attr_number(const char *tag_start, const char *tag_end,
+                          const char *name, int *found)
+{
+    const char *value;
+    size_t len, i, v = 0;
+
+    *found = 0;
+    if (!find_attr(tag_start, tag_end, name, &value, &len) || len == 0)
+        return 0;
+    for (i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9')
+            return 0;
+        v = v * 10 + (size_t)(value[i] - '0');
+    }
+    *found = 1;
+    return v;
+}
+
+/* ASCII lower-cased copy of [s, s+len) into buf, for case-insensitive keys. */
+static int buf_set_lower(lxlsx_edit_buf *buf, const char *s, size_t len)
+{
+    size_t i;
+
+    buf->len = 0;
+    if (buf_append(buf, s, len) != 0)
+        return -1;
+    for (i = 0; i < len; i++)
+        buf->data[i] = (char)tolower((unsigned char)buf->data[i]);
+    return 0;
+}
+
+/* Add a copy of the key to a set (a hash table with owned keys). */
+static lxlsx_error key_set_add(lxlsx_hash_table *set, const char *key,
+                               size_t len, void *value,
+                               lxlsx_hash_element **out)
+{
+    lxlsx_hash_element *element;
+    char *copy = (char *)malloc(len + 1);
+
+    if (!copy)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    memcpy(copy, key, len);
+    copy[len] = 0;
+    element = lxlsx_insert_hash_element(set, copy, value, len);
+    if (!element) {
+        free(copy);
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+    if (out)
+        *out = element;
+    return LXLSX_NO_ERROR;
+}
+
+static lxlsx_error read_part(const lxlsx_source_package *package,
+                             const char *name, unsigned char **xml,
+                             size_t *len)
+{
+    int index;
+
+    *xml = NULL;
+    *len = 0;
+    if (!name)
+        return LXLSX_NO_ERROR;
+    index = lxlsx_source_package_find_first(package, name);
+    if (index < 0)
+        return LXLSX_NO_ERROR;
+    return lxlsx_source_package_read_entry(package, (size_t)index, xml, len);
+}
+
+/* Whether two packages hold the same content under these part names. */
+static lxlsx_error parts_equal(const lxlsx_source_package *a, const char *a_name,
+                               const unsigned char *a_xml, size_t a_len,
+                               const lxlsx_source_package *b, const char *b_name,
+                               int *equal)
+{
+    const lxlsx_source_package_entry_info *a_info, *b_info;
+    int a_index = lxlsx_source_package_find_first(a, a_name);
+    int b_index = lxlsx_source_package_find_first(b, b_name);
+    unsigned char *b_xml = NULL;
+    size_t b_len = 0;
+    lxlsx_error err;
+
+    *equal = 0;
+    if (a_index < 0 || b_index < 0)
+        return LXLSX_NO_ERROR;
+    a_info = lxlsx_source_package_entry_info_at(a, (size_t)a_index);
+    b_info = lxlsx_source_package_entry_info_at(b, (size_t)b_index);
+    if (a_info->crc32 != b_info->crc32 ||
+        a_info->uncompressed_size != b_info->uncompressed_size)
+        return LXLSX_NO_ERROR;
+
+    err = lxlsx_source_package_read_entry(b, (size_t)b_index, &b_xml, &b_len);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    *equal = a_len == b_len && memcmp(a_xml, b_xml, a_len) == 0;
+    free(b_xml);
+    return LXLSX_NO_ERROR;
+}
+
+typedef lxlsx_error (*lxlsx_concat_record_cb)(void *ctx, const char *start,
+                                              const char *tag_end,
+                                              const char *end);
+
+/* Call `cb` with each <item> record of the <list> collection of xml: its
+ * start, the end of its start tag and its end. */
+static lxlsx_error each_record(const char *xml, size_t len, const char *list,
+                               const char *item, lxlsx_concat_record_cb cb,
+                               void *ctx)
+{
+    const char *p = xml;
+    const char *limit = xml + len;
+    lxlsx_edit_xml_tag tag;
+    lxlsx_edit_xml_tag close;
+    lxlsx_error err;
+
+    for (;;) {
+        if (!xml_next_tag(p, limit, &tag))
+            return LXLSX_NO_ERROR;
+        if (!tag.is_end && tag_name_is(&tag, list))
+            break;
+        p = tag.end + 1;
+    }
+    if (tag.is_self_closing)
+        return LXLSX_NO_ERROR;
 
-            num_id = next_numid++; nnum_add++;
-            snprintf(head, sizeof(head), "<numFmt numFmtId=\"%zu\" formatCode=\"", num_id);
-            if (buf_append_s(&numfmts, head) != 0 ||
-                append_attr_escaped(&numfmts, ch->number_format) != 0 ||
-                buf_append_s(&numfmts, "\"/>") != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-            if (emit_xf_fragment(&xfents, num_id, 0, 0, 0, NULL, 1) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-            nxf_add++;
-            ch->style_index = (int)next_xf++;
+    p = tag.end + 1;
+    while (xml_next_tag(p, limit, &tag)) {
+        const char *end;
 
-            if (ncode >= capcode) {
-                size_t nc = capcode ? capcode * 2 : 8;
-                const char **ncc = (const char **)realloc(codes, nc * sizeof(*ncc));
-                size_t *nx = (size_t *)realloc(code_xf, nc * sizeof(*nx));
-                if (!ncc || !nx) { free(ncc); free(nx); err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-                codes = ncc; code_xf = nx; capcode = nc;
-            }
-            codes[ncode] = ch->number_format; code_xf[ncode] = (size_t)ch->style_index; ncode++;
+        if (tag.is_end && tag_name_is(&tag, list))
+            break;
+        if (tag.is_end || !tag_name_is(&tag, item)) {
+            p = tag.end + 1;
+            continue;
+        }
+        if (tag.is_self_closing) {
+            end = tag.end + 1;
+        } else {
+            if (!find_matching_end_tag(tag.end + 1, limit, item, &close))
+                return LXLSX_ERROR_PARAMETER_VALIDATION;
+            end = close.end + 1;
         }
+        err = cb(ctx, tag.start, tag.end, end);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        p = end;
     }
 
-    if (nxf_add == 0)
-        goto done;
+    return LXLSX_NO_ERROR;
+}
 
-    /* Splice each collection (order doesn't matter between distinct tags). */
-    err = splice_collection((const char *)xml, xmllen, "fonts",
-                            fonts.data ? fonts.data : "", nfonts_add, "styleSheet", &b1, &l1);
-    if (err != LXLSX_NO_ERROR) goto done;
-    err = splice_collection(b1, l1, "fills",
-                            fills.data ? fills.data : "", nfills_add, "styleSheet", &b2, &l2);
-    if (err != LXLSX_NO_ERROR) goto done;
-    err = splice_collection(b2, l2, "borders",
-                            borders.data ? borders.data : "", nborders_add, "styleSheet", &b3, &l3);
-    if (err != LXLSX_NO_ERROR) goto done;
-    err = splice_collection(b3, l3, "numFmts",
-                            numfmts.data ? numfmts.data : "", nnum_add, "styleSheet", &b4, &l4);
-    if (err != LXLSX_NO_ERROR) goto done;
-    err = splice_collection(b4, l4, "cellXfs",
-                            xfents.data ? xfents.data : "", nxf_add, "styleSheet", &final, &finallen);
-    if (err != LXLSX_NO_ERROR) goto done;
+static int size_map_push(size_t **map, size_t *count, size_t *cap,
+                         size_t value)
+{
+    if (*count >= *cap) {
+        size_t next_cap = *cap ? *cap * 2 : 16;
+        size_t *next = (size_t *)realloc(*map, next_cap * sizeof(*next));
+        if (!next)
+            return -1;
+        *map = next;
+        *cap = next_cap;
+    }
+    (*map)[(*count)++] = value;
+    return 0;
+}
 
-    rep->entry_index = (size_t)entry;
-    rep->data = (const unsigned char *)final;
-    rep->size = finallen;
-    final = NULL;
-    *produced = 1;
+/* Drop a map that sends every index to itself: NULL means identity, and a
+ * sheet whose maps are all NULL is copied without being recompressed. */
+static void drop_identity_map(size_t **map, size_t *count)
+{
+    size_t i;
 
-done:
-    free(fmts); free(fmt_xf); free(codes); free(code_xf);
-    free(xml); free(b1); free(b2); free(b3); free(b4); free(final);
-    free(fonts.data); free(fills.data); free(borders.data);
-    free(numfmts.data); free(xfents.data);
-    return err;
+    if (!*map)
+        return;
+    for (i = 0; i < *count; i++)
+        if ((*map)[i] != i)
+            return;
+    free(*map);
+    *map = NULL;
+    *count = 0;
 }
 
-/* Largest N among existing xl/worksheets/sheetN.xml parts. */
-static size_t max_existing_sheet_num(lxlsx_edit_session *session)
+/* Merging the records of one collection into lxlsx_concat_records. */
+typedef struct {
+    lxlsx_concat_records *records;
+    const lxlsx_concat_attr *attrs;  /* rewritten in each record's start tag */
+    size_t attr_count;
+    int base;                        /* the base's own records */
+    size_t *map;                     /* source index -> output index */
+    size_t map_count;
+    size_t map_cap;
+    lxlsx_edit_buf key;
+} lxlsx_concat_record_merge;
+
+static lxlsx_error merge_record(void *ctx, const char *start,
+                                const char *tag_end, const char *end)
 {
-    size_t n = lxlsx_source_package_entry_count(session->package), i, maxv = 0;
-    for (i = 0; i < n; i++) {
-        const lxlsx_source_package_entry_info *info =
-            lxlsx_source_package_entry_info_at(session->package, i);
-        size_t pos = 19, v = 0;
-        int has = 0;
-        if (!info || info->name_len < 24) continue;
-        if (memcmp(info->name, "xl/worksheets/sheet", 19) != 0) continue;
-        while (pos < info->name_len && info->name[pos] >= '0' && info->name[pos] <= '9') {
-            v = v * 10 + (size_t)(info->name[pos] - '0'); pos++; has = 1;
+    lxlsx_concat_record_merge *m = (lxlsx_concat_record_merge *)ctx;
+    lxlsx_concat_records *r = m->records;
+    lxlsx_hash_element *element;
+    size_t index;
+    lxlsx_error err;
+
+    m->key.len = 0;
+    if (m->attr_count) {
+        if (append_tag_rewritten(&m->key, start, tag_end, m->attrs,
+                                 m->attr_count) != 0 ||
+            buf_append(&m->key, tag_end + 1, (size_t)(end - tag_end - 1)) != 0)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    } else if (buf_append(&m->key, start, (size_t)(end - start)) != 0) {
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+
+    element = lxlsx_hash_key_exists(r->index, m->key.data, m->key.len);
+    if (m->base) {
+        /* A duplicate still takes its index; lookups get the first one. */
+        if (!element) {
+            err = key_set_add(r->index, m->key.data, m->key.len,
+                              (void *)(uintptr_t)r->count, NULL);
+            if (err != LXLSX_NO_ERROR)
+                return err;
         }
-        if (has && info->name_len - pos == 4 &&
-            memcmp(info->name + pos, ".xml", 4) == 0 && v > maxv)
-            maxv = v;
+        r->count++;
+        return LXLSX_NO_ERROR;
     }
-    return maxv;
+
+    if (element) {
+        index = (size_t)(uintptr_t)element->value;
+    } else {
+        index = r->count++;
+        err = key_set_add(r->index, m->key.data, m->key.len,
+                          (void *)(uintptr_t)index, NULL);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        if (buf_append(&r->added, m->key.data, m->key.len) != 0)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        r->added_count++;
+    }
+    if (size_map_push(&m->map, &m->map_count, &m->map_cap, index) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    return LXLSX_NO_ERROR;
 }
 
-/* Largest integer following each occurrence of `needle` in [buf, buf+len). */
-static size_t scan_max_after(const unsigned char *buf, size_t len, const char *needle)
+/* Merge the records of xml into r; for a source, *map receives the output
+ * index of each of its records. */
+static lxlsx_error merge_records(lxlsx_concat_records *r, const char *xml,
+                                 size_t len, int base,
+                                 const lxlsx_concat_attr *attrs,
+                                 size_t attr_count, size_t **map,
+                                 size_t *map_count)
 {
-    const char *p = (const char *)buf, *end = p + len;
-    size_t maxv = 0;
-    while ((p = mem_find(p, (size_t)(end - p), needle)) != NULL) {
-        size_t v = 0;
-        p += strlen(needle);
-        while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (size_t)(*p++ - '0');
-        if (v > maxv) maxv = v;
+    lxlsx_concat_record_merge m;
+    lxlsx_error err;
+
+    memset(&m, 0, sizeof(m));
+    m.records = r;
+    m.attrs = attrs;
+    m.attr_count = attr_count;
+    m.base = base;
+    err = each_record(xml, len, r->list, r->item, merge_record, &m);
+    free(m.key.data);
+    if (err != LXLSX_NO_ERROR || base) {
+        free(m.map);
+        return err;
     }
-    return maxv;
+    *map = m.map;
+    *map_count = m.map_count;
+    return LXLSX_NO_ERROR;
 }
 
-/* Largest integer immediately following `prefix` across all part names (e.g.
- * "xl/media/image" -> highest existing image index, any extension). */
-static size_t max_existing_indexed(lxlsx_edit_session *session, const char *prefix)
+static lxlsx_error records_init(lxlsx_concat_records *r, const char *list,
+                                const char *item)
 {
-    size_t plen = strlen(prefix);
-    size_t n = lxlsx_source_package_entry_count(session->package), i, maxv = 0;
-    for (i = 0; i < n; i++) {
-        const lxlsx_source_package_entry_info *info =
-            lxlsx_source_package_entry_info_at(session->package, i);
-        size_t pos = plen, v = 0;
-        int has = 0;
-        if (!info || info->name_len <= plen) continue;
-        if (memcmp(info->name, prefix, plen) != 0) continue;
-        while (pos < info->name_len &&
-               info->name[pos] >= '0' && info->name[pos] <= '9') {
-            v = v * 10 + (size_t)(info->name[pos] - '0'); pos++; has = 1;
+    r->list = list;
+    r->item = item;
+    r->index = lxlsx_hash_new(128, 1, 0);
+    return r->index ? LXLSX_NO_ERROR : LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+}
+
+static void records_free(lxlsx_concat_records *r)
+{
+    lxlsx_hash_free(r->index);
+    free(r->added.data);
+}
+
+/* Merging the <numFmt> records, which are identified by id, not position. */
+typedef struct {
+    lxlsx_concat *st;
+    int base;
+    size_t *map;                /* source id -> output id */
+    size_t map_count;
+} lxlsx_concat_num_fmt_merge;
+
+static lxlsx_error merge_num_fmt(void *ctx, const char *start,
+                                 const char *tag_end, const char *end)
+{
+    lxlsx_concat_num_fmt_merge *m = (lxlsx_concat_num_fmt_merge *)ctx;
+    lxlsx_concat *st = m->st;
+    lxlsx_hash_element *element;
+    const char *code;
+    size_t code_len, id, out_id;
+    int found;
+    lxlsx_error err;
+
+    (void)end;
+    id = attr_number(start, tag_end, "numFmtId", &found);
+    if (!found || !find_attr(start, tag_end, "formatCode", &code, &code_len))
+        return LXLSX_NO_ERROR;
+
+    element = lxlsx_hash_key_exists(st->num_fmt_codes, (void *)code, code_len);
+    if (m->base) {
+        if (!element) {
+            err = key_set_add(st->num_fmt_codes, code, code_len,
+                              (void *)(uintptr_t)id, NULL);
+            if (err != LXLSX_NO_ERROR)
+                return err;
         }
-        if (has && v > maxv) maxv = v;
+        if (id >= st->next_num_fmt)
+            st->next_num_fmt = id + 1;
+        return LXLSX_NO_ERROR;
     }
-    return maxv;
+
+    if (element) {
+        out_id = (size_t)(uintptr_t)element->value;
+    } else if (id < LXLSX_CONCAT_FIRST_NUM_FMT) {
+        out_id = id;
+    } else {
+        out_id = st->next_num_fmt++;
+        err = key_set_add(st->num_fmt_codes, code, code_len,
+                          (void *)(uintptr_t)out_id, NULL);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        if (buf_appendf(&st->num_fmts_added, "<numFmt numFmtId=\"%zu\" formatCode=\"",
+                        out_id) != 0 ||
+            buf_append(&st->num_fmts_added, code, code_len) != 0 ||
+            buf_append_s(&st->num_fmts_added, "\"/>") != 0)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        st->num_fmts_added_count++;
+    }
+
+    /* The map is indexed by id; ids it doesn't cover are kept. */
+    if (id >= m->map_count) {
+        size_t *next = (size_t *)realloc(m->map, (id + 1) * sizeof(*next));
+        size_t i;
+        if (!next)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        for (i = m->map_count; i <= id; i++)
+            next[i] = i;
+        m->map = next;
+        m->map_count = id + 1;
+    }
+    m->map[id] = out_id;
+    return LXLSX_NO_ERROR;
 }
 
-/* Package content type for a supported image extension, or NULL. */
-static const char *image_ct_for_ext(const char *ext)
+static lxlsx_error merge_num_fmts(lxlsx_concat *st, const char *xml,
+                                  size_t len, int base,
+                                  lxlsx_concat_maps *maps)
 {
-    if (strcmp(ext, "png") == 0)  return "image/png";
-    if (strcmp(ext, "jpeg") == 0) return "image/jpeg";
-    if (strcmp(ext, "bmp") == 0)  return "image/bmp";
-    if (strcmp(ext, "gif") == 0)  return "image/gif";
-    return NULL;
+    lxlsx_concat_num_fmt_merge m;
+    lxlsx_error err;
+
+    memset(&m, 0, sizeof(m));
+    m.st = st;
+    m.base = base;
+    err = each_record(xml, len, "numFmts", "numFmt", merge_num_fmt, &m);
+    if (err != LXLSX_NO_ERROR || base) {
+        free(m.map);
+        return err;
+    }
+    maps->num_fmt = m.map;
+    maps->num_fmt_count = m.map_count;
+    return LXLSX_NO_ERROR;
 }
 
-/* "xl/worksheets/sheet1.xml" -> "xl/worksheets/_rels/sheet1.xml.rels". */
-static int derive_rels_path(const char *part, char *out, size_t outsz)
+/* Load the base's style records, once a source needs its styles merged. */
+static lxlsx_error seed_styles(lxlsx_concat *st)
 {
-    const char *slash = strrchr(part, '/');
-    int n;
-    if (!slash)
-        return -1;
-    n = snprintf(out, outsz, "%.*s/_rels/%s.rels",
-                 (int)(slash - part), part, slash + 1);
-    return (n > 0 && (size_t)n < outsz) ? 0 : -1;
+    const char *xml = (const char *)st->styles;
+    size_t len = st->styles_len;
+    lxlsx_error err;
+
+    if (st->styles_seeded)
+        return LXLSX_NO_ERROR;
+    st->styles_seeded = 1;
+    st->next_num_fmt = LXLSX_CONCAT_FIRST_NUM_FMT;
+
+    err = merge_num_fmts(st, xml, len, 1, NULL);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->fonts, xml, len, 1, NULL, 0, NULL, NULL);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->fills, xml, len, 1, NULL, 0, NULL, NULL);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->borders, xml, len, 1, NULL, 0, NULL, NULL);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->xfs, xml, len, 1, NULL, 0, NULL, NULL);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->dxfs, xml, len, 1, NULL, 0, NULL, NULL);
+    return err;
 }
 
-/* Read a package part, insert `insert` before `close_tag`, produce a replacement. */
-static lxlsx_error part_insert_before(lxlsx_edit_session *session,
-                                      const char *part, const char *close_tag,
-                                      const char *insert,
-                                      lxlsx_source_package_replacement *rep)
+/* Merge a source's styles.xml into the output and map its indices. Cell
+ * style records (cellStyleXfs) aren't merged: appended xfs use the Normal
+ * one. */
+static lxlsx_error merge_styles(lxlsx_concat *st, lxlsx_concat_source *src)
 {
+    lxlsx_concat_maps *maps = &src->maps;
     unsigned char *xml = NULL;
-    size_t xmllen = 0;
-    int idx;
-    const char *pos;
-    lxlsx_edit_buf out = {0};
+    size_t len = 0;
+    lxlsx_concat_attr xf_attrs[5];
+    int equal = 0;
     lxlsx_error err;
 
-    idx = lxlsx_source_package_find_first(session->package, part);
-    if (idx < 0) return LXLSX_ERROR_ZIP_FILE_ADD;
-    err = lxlsx_source_package_read_entry(session->package, (size_t)idx, &xml, &xmllen);
-    if (err != LXLSX_NO_ERROR) return err;
-    pos = mem_find((const char *)xml, xmllen, close_tag);
-    if (!pos) { free(xml); return LXLSX_ERROR_PARAMETER_VALIDATION; }
+    if (!st->styles || !src->workbook->styles_path)
+        return LXLSX_NO_ERROR;
+    err = parts_equal(st->base->package, st->base->workbook->styles_path,
+                      st->styles, st->styles_len, src->package,
+                      src->workbook->styles_path, &equal);
+    if (err != LXLSX_NO_ERROR || equal)
+        return err;
 
-    if (buf_append(&out, (const char *)xml, (size_t)(pos - (const char *)xml)) != 0 ||
-        buf_append_s(&out, insert) != 0 ||
-        buf_append(&out, pos, xmllen - (size_t)(pos - (const char *)xml)) != 0) {
-        free(xml); free(out.data); return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    err = seed_styles(st);
+    if (err == LXLSX_NO_ERROR)
+        err = read_part(src->package, src->workbook->styles_path, &xml, &len);
+    if (err != LXLSX_NO_ERROR || !xml)
+        return err;
+
+    err = merge_num_fmts(st, (const char *)xml, len, 0, maps);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->fonts, (const char *)xml, len, 0, NULL, 0,
+                            &maps->font, &maps->font_count);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->fills, (const char *)xml, len, 0, NULL, 0,
+                            &maps->fill, &maps->fill_count);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->borders, (const char *)xml, len, 0, NULL, 0,
+                            &maps->border, &maps->border_count);
+    drop_identity_map(&maps->num_fmt, &maps->num_fmt_count);
+    drop_identity_map(&maps->font, &maps->font_count);
+    drop_identity_map(&maps->fill, &maps->fill_count);
+    drop_identity_map(&maps->border, &maps->border_count);
+    if (err == LXLSX_NO_ERROR) {
+        size_t n = 0;
+        /* Ids with no map keep their value; xfId points at Normal. */
+        memset(xf_attrs, 0, sizeof(xf_attrs));
+        if (maps->num_fmt) {
+            xf_attrs[n].name = "numFmtId";
+            xf_attrs[n].map = maps->num_fmt;
+            xf_attrs[n++].count = maps->num_fmt_count;
+        }
+        if (maps->font) {
+            xf_attrs[n].name = "fontId";
+            xf_attrs[n].map = maps->font;
+            xf_attrs[n++].count = maps->font_count;
+        }
+        if (maps->fill) {
+            xf_attrs[n].name = "fillId";
+            xf_attrs[n].map = maps->fill;
+            xf_attrs[n++].count = maps->fill_count;
+        }
+        if (maps->border) {
+            xf_attrs[n].name = "borderId";
+            xf_attrs[n].map = maps->border;
+            xf_attrs[n++].count = maps->border_count;
+        }
+        xf_attrs[n].name = "xfId";
+        xf_attrs[n++].text = "0";
+        err = merge_records(&st->xfs, (const char *)xml, len, 0, xf_attrs, n,
+                            &maps->xf, &maps->xf_count);
     }
+    if (err == LXLSX_NO_ERROR)
+        err = merge_records(&st->dxfs, (const char *)xml, len, 0, NULL, 0,
+                            &maps->dxf, &maps->dxf_count);
+    drop_identity_map(&maps->xf, &maps->xf_count);
+    drop_identity_map(&maps->dxf, &maps->dxf_count);
+
     free(xml);
-    rep->entry_index = (size_t)idx;
-    rep->data = (const unsigned char *)out.data;
-    rep->size = out.len;
-    return LXLSX_NO_ERROR;
+    return err;
+}
+
+/* Merge a source's shared strings into the output and map their indices. */
+static lxlsx_error merge_shared_strings(lxlsx_concat *st,
+                                        lxlsx_concat_source *src)
+{
+    lxlsx_concat_maps *maps = &src->maps;
+    unsigned char *xml = NULL;
+    size_t len = 0;
+    const char *p, *limit;
+    lxlsx_edit_xml_tag tag;
+    int equal = 0;
+    int found;
+    lxlsx_error err;
+
+    if (!src->workbook->sst_path)
+        return LXLSX_NO_ERROR;
+    if (st->sst) {
+        err = parts_equal(st->base->package, st->base->workbook->sst_path,
+                          st->sst, st->sst_len, src->package,
+                          src->workbook->sst_path, &equal);
+        if (err != LXLSX_NO_ERROR || equal)
+            return err;
+    }
+
+    if (!st->sst_seeded) {
+        st->sst_seeded = 1;
+        if (st->sst) {
+            err = merge_records(&st->strings, (const char *)st->sst,
+                                st->sst_len, 1, NULL, 0, NULL, NULL);
+            if (err != LXLSX_NO_ERROR)
+                return err;
+        }
+    }
+
+    err = read_part(src->package, src->workbook->sst_path, &xml, &len);
+    if (err != LXLSX_NO_ERROR || !xml)
+        return err;
+    err = merge_records(&st->strings, (const char *)xml, len, 0, NULL, 0,
+                        &maps->sst, &maps->sst_count);
+
+    /* Carry the source's reference count over to the output's. */
+    p = (const char *)xml;
+    limit = p + len;
+    while (err == LXLSX_NO_ERROR && xml_next_tag(p, limit, &tag)) {
+        if (!tag.is_end && tag_name_is(&tag, "sst")) {
+            size_t count = attr_number(tag.start, tag.end, "count", &found);
+            st->string_refs += found ? count : maps->sst_count;
+            break;
+        }
+        p = tag.end + 1;
+    }
+    drop_identity_map(&maps->sst, &maps->sst_count);
+
+    free(xml);
+    return err;
+}
+
+static lxlsx_error concat_emit_string_index(lxlsx_edit_sheet_stream *s,
+                                            const lxlsx_concat_maps *maps,
+                                            const char *start,
+                                            const char *end)
+{
+    const char *d = start;
+    size_t v = 0;
+    char num[32];
+
+    while (d < end && *d >= '0' && *d <= '9')
+        v = v * 10 + (size_t)(*d++ - '0');
+    if (d == start || d != end || v >= maps->sst_count)
+        return sheet_stream_emit(s, start, (size_t)(end - start));
+    snprintf(num, sizeof(num), "%zu", maps->sst[v]);
+    return sheet_stream_emit(s, num, strlen(num));
 }
 
-#define LXLSX_WS_REL_TYPE "http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet"
-#define LXLSX_WS_CT "application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml"
+/*
+ * Stream a worksheet into the output with its style indices (cells, rows,
+ * columns, conditional formats) and shared string indices renumbered. Only
+ * the window of not yet written bytes is held in memory.
+ */
+static lxlsx_error concat_sheet_stream(void *ctx,
+                                       lxlsx_source_package_entry_stream *in,
+                                       lxlsx_source_package_sink *out)
+{
+    const lxlsx_concat_sheet *sheet = (const lxlsx_concat_sheet *)ctx;
+    const lxlsx_concat_maps *maps = sheet->maps;
+    lxlsx_edit_sheet_stream s;
+    lxlsx_edit_buf tag_buf = {0};
+    int shared = 0;
+    int in_value = 0;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    memset(&s, 0, sizeof(s));
+    s.in = in;
+    s.out = out;
+
+    while (err == LXLSX_NO_ERROR) {
+        const char *p, *limit, *lt;
+        lxlsx_edit_xml_tag tag;
+
+        err = sheet_stream_fill(&s);
+        if (err != LXLSX_NO_ERROR)
+            break;
+        p = s.window.data + s.pos;
+        limit = s.window.data + s.window.len;
+
+        while (err == LXLSX_NO_ERROR &&
+               (lt = xml_next_tag(p, limit, &tag)) != NULL) {
+            lxlsx_concat_attr attr;
+            int rewrite = 0;
+
+            if (in_value)
+                err = concat_emit_string_index(&s, maps, p, lt);
+            else
+                err = sheet_stream_emit(&s, p, (size_t)(lt - p));
+            in_value = 0;
+            if (err != LXLSX_NO_ERROR)
+                break;
+
+            memset(&attr, 0, sizeof(attr));
+            if (tag_name_is(&tag, "c")) {
+                if (tag.is_end) {
+                    shared = 0;
+                } else {
+                    shared = !tag.is_self_closing &&
+                             attr_value_is(tag.start, tag.end, "t", "s");
+                    attr.name = "s";
+                    attr.map = maps->xf;
+                    attr.count = maps->xf_count;
+                    attr.implicit_zero = 1;
+                }
+            } else if (tag_name_is(&tag, "v")) {
+                in_value = shared && maps->sst && !tag.is_end &&
+                           !tag.is_self_closing;
+            } else if (tag.is_end) {
+                /* nothing to rewrite */
+            } else if (tag_name_is(&tag, "row")) {
+                attr.name = "s";
+                attr.map = maps->xf;
+                attr.count = maps->xf_count;
+                attr.implicit_zero = 1;
+            } else if (tag_name_is(&tag, "col")) {
+                attr.name = "style";
+                attr.map = maps->xf;
+                attr.count = maps->xf_count;
+                attr.implicit_zero = 1;
+            } else if (tag_name_is(&tag, "cfRule")) {
+                attr.name = "dxfId";
+                attr.map = maps->dxf;
+                attr.count = maps->dxf_count;
+            } else if (tag_name_is(&tag, "sheetView") &&
+                       sheet->drop_tab_selected) {
+                attr.name = "tabSelected";
+                rewrite = 1;
+            }
+
+            if (attr.map || rewrite) {
+                tag_buf.len = 0;
+                if (append_tag_rewritten(&tag_buf, tag.start, tag.end,
+                                         &attr, 1) != 0)
+                    err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                else
+                    err = sheet_stream_emit(&s, tag_buf.data, tag_buf.len);
+            } else {
+                err = sheet_stream_emit(&s, tag.start,
+                                        (size_t)(tag.end + 1 - tag.start));
+            }
+            p = tag.end + 1;
+            s.pos = (size_t)(p - s.window.data);
+        }
 
-/*
- * Multi-part composition accumulator. Collects brand-new parts (additions) and
- * per-part fragment insertions (materialised as replacements at finalize time),
- * aggregating every insertion that targets the same part into ONE replacement.
- *
- * That aggregation is the point: several features patch the same metadata part
- * (e.g. [Content_Types].xml gets a worksheet Override from add-sheet and an
- * image Default from add-image). Patching it twice independently — each off the
- * original bytes — would drop one. A brand-new rels part is just an addition, so
- * no separate "create rels" path is needed. add-sheet uses this today;
- * add-image/chart build on the same API. Borrowed `data` pointers handed to
- * composer_add_part must outlive the save (callers pass session-owned buffers).
- */
-typedef struct {
-    char          *part;       /* host part to patch (owned) */
-    char          *close_tag;  /* token to insert the fragment before (owned) */
-    lxlsx_edit_buf frag;       /* aggregated fragment */
-} lxlsx_composer_patch;
+        if (err == LXLSX_NO_ERROR && s.eof) {
+            err = sheet_stream_emit(&s, p, (size_t)(limit - p));
+            break;
+        }
+    }
 
-typedef struct {
-    lxlsx_edit_session            *session;
-    lxlsx_source_package_addition *adds;   /* names always owned; data owned iff adds_owned[i] */
-    int                           *adds_owned;
-    size_t                         add_count, add_cap;
-    lxlsx_composer_patch          *patches;
-    size_t                         patch_count, patch_cap;
-    int                            oom;    /* sticky out-of-memory flag */
-} lxlsx_composer;
+    free(s.window.data);
+    free(tag_buf.data);
+    return err;
+}
 
-static void composer_init(lxlsx_composer *c, lxlsx_edit_session *session)
+/* Whether a worksheet is selected (its tab is highlighted), judging by the
+ * sheet views at the top of the part. */
+static lxlsx_error sheet_is_selected(const lxlsx_source_package *package,
+                                     size_t index, int *selected)
 {
-    memset(c, 0, sizeof(*c));
-    c->session = session;
+    lxlsx_source_package_entry_stream *in = NULL;
+    char head[LXLSX_EDIT_STREAM_CHUNK + 1];
+    size_t len = 0;
+    const char *data;
+    lxlsx_error err;
+
+    *selected = 0;
+    err = lxlsx_source_package_entry_stream_open(package, index, &in);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    while (len < LXLSX_EDIT_STREAM_CHUNK) {
+        size_t got = 0;
+        err = lxlsx_source_package_entry_stream_read(
+            in, head + len, LXLSX_EDIT_STREAM_CHUNK - len, &got);
+        if (err != LXLSX_NO_ERROR || got == 0)
+            break;
+        len += got;
+    }
+    lxlsx_source_package_entry_stream_close(in);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    head[len] = 0;
+
+    data = mem_find(head, len, "<sheetData");
+    if (data)
+        len = (size_t)(data - head);
+    *selected = mem_find(head, len, "tabSelected=\"1\"") != NULL ||
+                mem_find(head, len, "tabSelected=\"true\"") != NULL;
+    return LXLSX_NO_ERROR;
 }
 
-static void composer_free(lxlsx_composer *c)
+/* A fresh output name for a copy of part `name`: the same directory and stem
+ * with the first free number, e.g. xl/media/image1.png -> image4.png. The
+ * name is owned by st->part_names. */
+static lxlsx_error concat_part_name(lxlsx_concat *st, const char *name,
+                                    const char **out)
 {
-    size_t i;
-    for (i = 0; i < c->add_count; i++) {
-        free((void *)(uintptr_t)c->adds[i].name);
-        if (c->adds_owned[i])
-            free((void *)(uintptr_t)c->adds[i].data);
+    const char *slash = strrchr(name, '/');
+    const char *base = slash ? slash + 1 : name;
+    const char *dot = strrchr(base, '.');
+    const char *ext = dot ? dot : "";
+    const char *stem_end = dot ? dot : name + strlen(name);
+    lxlsx_hash_element *stem;
+    lxlsx_hash_element *element;
+    lxlsx_edit_buf buf = {0};
+    size_t n;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    while (stem_end > base && stem_end[-1] >= '0' && stem_end[-1] <= '9')
+        stem_end--;
+
+    stem = lxlsx_hash_key_exists(st->part_stems, (void *)name,
+                                 (size_t)(stem_end - name));
+    if (!stem) {
+        err = key_set_add(st->part_stems, name, (size_t)(stem_end - name),
+                          (void *)(uintptr_t)1, &stem);
+        if (err != LXLSX_NO_ERROR)
+            return err;
     }
-    free(c->adds);
-    free(c->adds_owned);
-    for (i = 0; i < c->patch_count; i++) {
-        free(c->patches[i].part);
-        free(c->patches[i].close_tag);
-        free(c->patches[i].frag.data);
+
+    for (n = (size_t)(uintptr_t)stem->value;; n++) {
+        buf.len = 0;
+        if (buf_append(&buf, name, (size_t)(stem_end - name)) != 0 ||
+            buf_appendf(&buf, "%zu%s", n, ext) != 0) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            break;
+        }
+        if (lxlsx_hash_key_exists(st->part_names, buf.data, buf.len))
+            continue;
+        err = key_set_add(st->part_names, buf.data, buf.len, NULL, &element);
+        if (err == LXLSX_NO_ERROR) {
+            stem->value = (void *)(uintptr_t)(n + 1);
+            *out = (const char *)element->key;
+        }
+        break;
     }
-    free(c->patches);
-    memset(c, 0, sizeof(*c));
+
+    free(buf.data);
+    return err;
 }
 
-/* Append a brand-new part. `name` is always copied. `data` is copied when
- * copy != 0 (callers passing a temporary buffer); when copy == 0 the data is
- * borrowed and must outlive the save (session-owned buffers like image bytes or
- * a new sheet's XML) — this avoids duplicating large payloads. */
-static void composer_add_part(lxlsx_composer *c, const char *name,
-                              const unsigned char *data, size_t size, int copy)
+/* Give the copy `to` of a source part the content type the part has in its
+ * source, as an Override or through its extension's Default. */
+static lxlsx_error concat_part_type(lxlsx_concat *st,
+                                    lxlsx_concat_source *src,
+                                    const char *from, const char *to)
 {
-    lxlsx_source_package_addition *a;
-    char *name_copy;
-    unsigned char *data_ptr;
-    if (c->oom)
-        return;
-    if (c->add_count >= c->add_cap) {
-        size_t cap = c->add_cap ? c->add_cap * 2 : 4;
-        lxlsx_source_package_addition *next = (lxlsx_source_package_addition *)
-            realloc(c->adds, cap * sizeof(*next));
-        int *owned;
-        if (!next) { c->oom = 1; return; }
-        c->adds = next;
-        owned = (int *)realloc(c->adds_owned, cap * sizeof(*owned));
-        if (!owned) { c->oom = 1; return; }
-        c->adds_owned = owned;
-        c->add_cap = cap;
+    const char *p = (const char *)src->types;
+    const char *limit = p + src->types_len;
+    const char *dot = strrchr(from, '.');
+    const char *ext = dot && !strchr(dot, '/') ? dot + 1 : "";
+    const char *default_type = NULL;
+    size_t default_len = 0;
+    lxlsx_edit_buf *ct;
+    lxlsx_edit_buf key = {0};
+    lxlsx_edit_xml_tag tag;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    ct = composer_part_buf(&st->composer, "[Content_Types].xml", "</Types>");
+    if (!ct)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    while (xml_next_tag(p, limit, &tag)) {
+        const char *value;
+        const char *type;
+        size_t value_len, type_len;
+
+        p = tag.end + 1;
+        if (tag.is_end ||
+            !find_attr(tag.start, tag.end, "ContentType", &type, &type_len))
+            continue;
+        if (tag_name_is(&tag, "Override") &&
+            find_attr(tag.start, tag.end, "PartName", &value, &value_len) &&
+            value_len == strlen(from) + 1 && value[0] == '/' &&
+            lxlsx_strncasecmp(value + 1, from, value_len - 1) == 0) {
+            if (buf_append_s(ct, "<Override PartName=\"/") != 0 ||
+                append_attr_escaped(ct, to) != 0 ||
+                buf_append_s(ct, "\" ContentType=\"") != 0 ||
+                buf_append(ct, type, type_len) != 0 ||
+                buf_append_s(ct, "\"/>") != 0)
+                return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            return LXLSX_NO_ERROR;
+        }
+        if (tag_name_is(&tag, "Default") &&
+            find_attr(tag.start, tag.end, "Extension", &value, &value_len) &&
+            value_len == strlen(ext) && lxlsx_strncasecmp(value, ext, value_len) == 0) {
+            default_type = type;
+            default_len = type_len;
+        }
     }
-    name_copy = strdup(name);
-    if (!name_copy) { c->oom = 1; return; }
-    if (copy && size) {
-        data_ptr = (unsigned char *)malloc(size);
-        if (!data_ptr) { free(name_copy); c->oom = 1; return; }
-        memcpy(data_ptr, data, size);
-    } else {
-        data_ptr = (unsigned char *)data;  /* borrowed (or empty) */
+
+    if (!default_type)
+        return LXLSX_NO_ERROR;
+    if (buf_set_lower(&key, ext, strlen(ext)) != 0)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    if (!lxlsx_hash_key_exists(st->type_defaults, key.data, key.len)) {
+        err = key_set_add(st->type_defaults, key.data, key.len, NULL, NULL);
+        if (err == LXLSX_NO_ERROR &&
+            (buf_append_s(ct, "<Default Extension=\"") != 0 ||
+             append_attr_escaped(ct, ext) != 0 ||
+             buf_append_s(ct, "\" ContentType=\"") != 0 ||
+             buf_append(ct, default_type, default_len) != 0 ||
+             buf_append_s(ct, "\"/>") != 0))
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
     }
-    a = &c->adds[c->add_count];
-    a->name = name_copy;
-    a->data = data_ptr;
-    a->size = size;
-    c->adds_owned[c->add_count] = (copy && size) ? 1 : 0;
-    c->add_count++;
+    free(key.data);
+    return err;
 }
 
-/* Return the aggregation buffer for `part` (created on first use), so the caller
- * can append fragments to it. Insertions accumulate before `close_tag`. NULL on
- * OOM (the sticky flag is also set, so callers may defer the check). */
-static lxlsx_edit_buf *composer_part_buf(lxlsx_composer *c, const char *part,
-                                         const char *close_tag)
+/* Read the ids and names of the base's tables, once a source has one. */
+static lxlsx_error seed_tables(lxlsx_concat *st)
 {
+    const lxlsx_source_package *package = st->base->package;
+    size_t count = lxlsx_source_package_entry_count(package);
+    lxlsx_edit_buf key = {0};
     size_t i;
-    lxlsx_composer_patch *p;
-    if (c->oom)
-        return NULL;
-    for (i = 0; i < c->patch_count; i++) {
-        if (strcmp(c->patches[i].part, part) == 0)
-            return &c->patches[i].frag;
-    }
-    if (c->patch_count >= c->patch_cap) {
-        size_t cap = c->patch_cap ? c->patch_cap * 2 : 4;
-        lxlsx_composer_patch *next = (lxlsx_composer_patch *)
-            realloc(c->patches, cap * sizeof(*next));
-        if (!next) { c->oom = 1; return NULL; }
-        c->patches = next;
-        c->patch_cap = cap;
-    }
-    p = &c->patches[c->patch_count];
-    memset(p, 0, sizeof(*p));
-    p->part = strdup(part);
-    p->close_tag = strdup(close_tag);
-    if (!p->part || !p->close_tag) {
-        free(p->part);
-        free(p->close_tag);
-        c->oom = 1;
-        return NULL;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    if (st->tables_seeded)
+        return LXLSX_NO_ERROR;
+    st->tables_seeded = 1;
+    st->next_table_id = 1;
+
+    for (i = 0; i < count && err == LXLSX_NO_ERROR; i++) {
+        const lxlsx_source_package_entry_info *info =
+            lxlsx_source_package_entry_info_at(package, i);
+        unsigned char *xml = NULL;
+        size_t len = 0, id;
+        const char *name;
+        size_t name_len;
+        lxlsx_edit_xml_tag tag;
+        const char *p;
+        int found;
+
+        if (info->name_len < 14 || memcmp(info->name, "xl/tables/", 10) != 0 ||
+            memcmp(info->name + info->name_len - 4, ".xml", 4) != 0)
+            continue;
+        err = lxlsx_source_package_read_entry(package, i, &xml, &len);
+        if (err != LXLSX_NO_ERROR)
+            break;
+        p = (const char *)xml;
+        while (xml_next_tag(p, (const char *)xml + len, &tag)) {
+            if (!tag.is_end && tag_name_is(&tag, "table")) {
+                id = attr_number(tag.start, tag.end, "id", &found);
+                if (found && id >= st->next_table_id)
+                    st->next_table_id = id + 1;
+                if (find_attr(tag.start, tag.end, "displayName", &name,
+                              &name_len)) {
+                    if (buf_set_lower(&key, name, name_len) != 0)
+                        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                    else if (!lxlsx_hash_key_exists(st->table_names, key.data,
+                                                    key.len))
+                        err = key_set_add(st->table_names, key.data, key.len,
+                                          NULL, NULL);
+                }
+                break;
+            }
+            p = tag.end + 1;
+        }
+        free(xml);
     }
-    c->patch_count++;
-    return &p->frag;
+
+    free(key.data);
+    return err;
 }
 
-/* Materialise: additions array (caller frees the array, not the borrowed data)
- * plus one replacement per patched part (caller frees each .data and the
- * array). */
-static lxlsx_error composer_finalize(lxlsx_composer *c,
-                                     lxlsx_source_package_addition **add_out,
-                                     size_t *n_add_out,
-                                     lxlsx_source_package_replacement **rep_out,
-                                     size_t *n_rep_out)
+/* Copy a table part with a fresh id, renaming it if its name is taken. */
+static lxlsx_error concat_copy_table(lxlsx_concat *st,
+                                     lxlsx_concat_source *src, size_t index,
+                                     const char *to)
 {
-    lxlsx_source_package_addition *adds = NULL;
-    lxlsx_source_package_replacement *reps = NULL;
-    size_t i, produced = 0;
+    unsigned char *xml = NULL;
+    size_t len = 0;
+    const char *p;
+    const char *limit;
+    const char *name = NULL;
+    size_t name_len = 0;
+    lxlsx_edit_xml_tag tag;
+    lxlsx_edit_buf out = {0};
+    lxlsx_edit_buf new_name = {0};
+    lxlsx_edit_buf key = {0};
+    lxlsx_concat_attr attrs[3];
+    char id[32];
+    size_t n;
     lxlsx_error err;
 
-    *add_out = NULL; *n_add_out = 0; *rep_out = NULL; *n_rep_out = 0;
-    if (c->oom)
-        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    err = seed_tables(st);
+    if (err == LXLSX_NO_ERROR)
+        err = lxlsx_source_package_read_entry(src->package, index, &xml, &len);
+    if (err != LXLSX_NO_ERROR)
+        return err;
 
-    if (c->add_count) {
-        adds = (lxlsx_source_package_addition *)calloc(c->add_count, sizeof(*adds));
-        if (!adds)
-            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-        memcpy(adds, c->adds, c->add_count * sizeof(*adds));
+    p = (const char *)xml;
+    limit = p + len;
+    while (xml_next_tag(p, limit, &tag)) {
+        if (!tag.is_end && tag_name_is(&tag, "table"))
+            break;
+        p = tag.end + 1;
+        tag.start = NULL;
     }
-    if (c->patch_count) {
-        reps = (lxlsx_source_package_replacement *)
-            calloc(c->patch_count, sizeof(*reps));
-        if (!reps) { free(adds); return LXLSX_ERROR_MEMORY_MALLOC_FAILED; }
+    if (!tag.start ||
+        !find_attr(tag.start, tag.end, "displayName", &name, &name_len)) {
+        composer_add_part(&st->composer, to, xml, len, 1);
+        free(xml);
+        return LXLSX_NO_ERROR;
     }
-    for (i = 0; i < c->patch_count; i++) {
-        err = part_insert_before(c->session, c->patches[i].part,
-                                 c->patches[i].close_tag,
-                                 c->patches[i].frag.data ? c->patches[i].frag.data : "",
-                                 &reps[produced]);
-        if (err != LXLSX_NO_ERROR) {
-            size_t j;
-            for (j = 0; j < produced; j++)
-                free((void *)reps[j].data);
-            free(reps);
-            free(adds);
-            return err;
+
+    for (n = 1;; n++) {
+        new_name.len = 0;
+        if (buf_append(&new_name, name, name_len) != 0 ||
+            (n > 1 && buf_appendf(&new_name, "_%zu", n) != 0) ||
+            buf_set_lower(&key, new_name.data, new_name.len) != 0) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            goto done;
         }
-        produced++;
+        if (!lxlsx_hash_key_exists(st->table_names, key.data, key.len))
+            break;
+    }
+    err = key_set_add(st->table_names, key.data, key.len, NULL, NULL);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+
+    snprintf(id, sizeof(id), "%zu", st->next_table_id++);
+    memset(attrs, 0, sizeof(attrs));
+    attrs[0].name = "id";
+    attrs[0].text = id;
+    attrs[1].name = "name";
+    attrs[1].text = new_name.data;
+    attrs[2].name = "displayName";
+    attrs[2].text = new_name.data;
+    if (buf_append(&out, (const char *)xml, (size_t)(tag.start - (const char *)xml)) != 0 ||
+        append_tag_rewritten(&out, tag.start, tag.end, attrs, 3) != 0 ||
+        buf_append(&out, tag.end + 1, (size_t)(limit - tag.end - 1)) != 0) {
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        goto done;
     }
+    composer_add_part(&st->composer, to, (const unsigned char *)out.data,
+                      out.len, 1);
+
+done:
+    free(xml);
+    free(out.data);
+    free(new_name.data);
+    free(key.data);
+    return err;
+}
+
+/* Append a part copied from another package, verbatim or through
+ * `transform`. */
+static void composer_add_copy(lxlsx_composer *c, const char *name,
+                              const lxlsx_source_package *source,
+                              size_t source_index,
+                              lxlsx_source_package_transform transform,
+                              void *ctx)
+{
+    lxlsx_source_package_addition *a;
+
+    composer_add_part(c, name, NULL, 0, 0);
+    if (c->oom)
+        return;
+    a = &c->adds[c->add_count - 1];
+    a->source = source;
+    a->source_index = source_index;
+    a->transform = transform;
+    a->ctx = ctx;
+}
 
-    *add_out = adds;
-    *n_add_out = c->add_count;
-    *rep_out = reps;
-    *n_rep_out = produced;
-    return LXLSX_NO_ERROR;
+static int rel_type_is(const char *type, size_t type_len, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    return type_len > len && type[type_len - len - 1] == '/' &&
+           memcmp(type + type_len - len, suffix, len) == 0;
 }
 
+typedef enum {
+    LXLSX_CONCAT_PART,
+    LXLSX_CONCAT_SHEET,
+    LXLSX_CONCAT_TABLE
+} lxlsx_concat_part_kind;
+
 /*
- * Register the session's new worksheets onto a composer: a new sheetN.xml part
- * each, plus <sheet>/<Relationship>/<Override> fragments for workbook.xml, its
- * rels and [Content_Types].xml.
+ * Copy part `from` of a source into the output under a fresh name, together
+ * with everything its rels reach; *to receives the new name, or NULL if the
+ * source has no such part. `sheet` is the transform context of a worksheet,
+ * or NULL to copy it verbatim.
  */
-static lxlsx_error prepare_new_sheets(lxlsx_edit_session *session,
-                                      lxlsx_composer *c)
+static lxlsx_error concat_copy_part(lxlsx_concat *st, lxlsx_concat_source *src,
+                                    const char *from,
+                                    lxlsx_concat_part_kind kind,
+                                    lxlsx_concat_sheet *sheet,
+                                    const char **to)
 {
-    lxlsx_edit_buf *wb, *rel, *ct;
-    unsigned char *wbxml = NULL, *relxml = NULL;
-    size_t wblen = 0, rellen = 0;
-    size_t next_num, next_sid, next_rid, i;
-    int idx;
-    lxlsx_error err = LXLSX_NO_ERROR;
+    char rels_from[512], rels_to[512];
+    unsigned char *rels = NULL;
+    size_t rels_len = 0;
+    lxlsx_edit_buf out = {0};
+    lxlsx_concat_part *part;
+    const char *name = NULL;
+    int index;
+    size_t i;
+    lxlsx_error err;
 
-    if (session->new_sheet_count == 0)
+    *to = NULL;
+    for (i = 0; i < src->part_count; i++) {
+        if (strcmp(src->parts[i].from, from) == 0) {
+            *to = src->parts[i].to;
+            return LXLSX_NO_ERROR;
+        }
+    }
+    index = lxlsx_source_package_find_first(src->package, from);
+    if (index < 0)
         return LXLSX_NO_ERROR;
 
-    next_num = max_existing_sheet_num(session) + 1;
-
-    /* Parse next sheetId from workbook.xml and next rId from its rels. */
-    idx = lxlsx_source_package_find_first(session->package, "xl/workbook.xml");
-    if (idx < 0) { err = LXLSX_ERROR_ZIP_FILE_ADD; goto done; }
-    err = lxlsx_source_package_read_entry(session->package, (size_t)idx, &wbxml, &wblen);
-    if (err != LXLSX_NO_ERROR) goto done;
-    next_sid = scan_max_after(wbxml, wblen, "sheetId=\"") + 1;
-
-    idx = lxlsx_source_package_find_first(session->package, "xl/_rels/workbook.xml.rels");
-    if (idx < 0) { err = LXLSX_ERROR_ZIP_FILE_ADD; goto done; }
-    err = lxlsx_source_package_read_entry(session->package, (size_t)idx, &relxml, &rellen);
-    if (err != LXLSX_NO_ERROR) goto done;
-    next_rid = scan_max_after(relxml, rellen, "Id=\"rId") + 1;
-
-    wb  = composer_part_buf(c, "xl/workbook.xml", "</sheets>");
-    rel = composer_part_buf(c, "xl/_rels/workbook.xml.rels", "</Relationships>");
-    ct  = composer_part_buf(c, "[Content_Types].xml", "</Types>");
-    if (!wb || !rel || !ct) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+    err = concat_part_name(st, from, &name);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    if (src->part_count >= src->part_cap) {
+        size_t cap = src->part_cap ? src->part_cap * 2 : 16;
+        lxlsx_concat_part *next = (lxlsx_concat_part *)
+            realloc(src->parts, cap * sizeof(*next));
+        if (!next)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        src->parts = next;
+        src->part_cap = cap;
+    }
+    part = &src->parts[src->part_count];
+    part->from = strdup(from);
+    part->to = name;
+    if (!part->from)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    src->part_count++;
+    *to = name;
 
-    for (i = 0; i < session->new_sheet_count; i++) {
-        lxlsx_edit_new_sheet *s = &session->new_sheets[i];
-        char fn[48], frag[256];
-        size_t num = next_num + i, sid = next_sid + i, rid = next_rid + i;
+    err = concat_part_type(st, src, from, name);
+    if (err != LXLSX_NO_ERROR)
+        return err;
 
-        snprintf(fn, sizeof(fn), "xl/worksheets/sheet%zu.xml", num);
-        composer_add_part(c, fn, (const unsigned char *)s->xml, s->xml_len, 0);
+    /* The rels: each internal target is copied too and pointed at its copy,
+     * which sits in the same directory under a new file name. */
+    if (derive_rels_path(from, rels_from, sizeof(rels_from)) == 0 &&
+        derive_rels_path(name, rels_to, sizeof(rels_to)) == 0) {
+        err = read_part(src->package, rels_from, &rels, &rels_len);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+    }
+    if (rels) {
+        const char *p = (const char *)rels;
+        const char *limit = p + rels_len;
+        lxlsx_edit_xml_tag tag;
 
-        if (buf_append_s(wb, "<sheet name=\"") != 0 ||
-            append_attr_escaped(wb, s->name) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-        snprintf(frag, sizeof(frag), "\" sheetId=\"%zu\" r:id=\"rId%zu\"/>", sid, rid);
-        if (buf_append_s(wb, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+        while (err == LXLSX_NO_ERROR && xml_next_tag(p, limit, &tag)) {
+            const char *type;
+            const char *target;
+            size_t type_len, target_len;
+            char *target_copy;
+            char *child;
+            const char *child_to = NULL;
+            const char *child_base;
+            const char *target_dir_end;
+            lxlsx_concat_attr attr;
+            lxlsx_edit_buf new_target = {0};
+
+            if (buf_append(&out, p, (size_t)(tag.start - p)) != 0) {
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                break;
+            }
+            p = tag.end + 1;
+            if (tag.is_end || !tag_name_is(&tag, "Relationship") ||
+                attr_value_is(tag.start, tag.end, "TargetMode", "External") ||
+                !find_attr(tag.start, tag.end, "Type", &type, &type_len) ||
+                !find_attr(tag.start, tag.end, "Target", &target, &target_len)) {
+                if (buf_append(&out, tag.start, (size_t)(p - tag.start)) != 0)
+                    err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                continue;
+            }
+            if (rel_type_is(type, type_len, "pivotTable")) {
+                err = LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+                break;
+            }
 
-        snprintf(frag, sizeof(frag),
-                 "<Relationship Id=\"rId%zu\" Type=\"%s\" Target=\"worksheets/sheet%zu.xml\"/>",
-                 rid, LXLSX_WS_REL_TYPE, num);
-        if (buf_append_s(rel, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            target_copy = dup_range(target, target_len);
+            child = target_copy ? lxlsx_reader_zip_resolve_path(from, target_copy) : NULL;
+            free(target_copy);
+            if (!child) {
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                break;
+            }
+            err = concat_copy_part(st, src, child,
+                                   rel_type_is(type, type_len, "table")
+                                       ? LXLSX_CONCAT_TABLE : LXLSX_CONCAT_PART,
+                                   NULL, &child_to);
+            free(child);
+            if (err != LXLSX_NO_ERROR)
+                break;
+            if (!child_to) {
+                if (buf_append(&out, tag.start, (size_t)(p - tag.start)) != 0)
+                    err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                continue;
+            }
 
-        snprintf(frag, sizeof(frag),
-                 "<Override PartName=\"/xl/worksheets/sheet%zu.xml\" ContentType=\"%s\"/>",
-                 num, LXLSX_WS_CT);
-        if (buf_append_s(ct, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+            child_base = strrchr(child_to, '/');
+            child_base = child_base ? child_base + 1 : child_to;
+            target_dir_end = target + target_len;
+            while (target_dir_end > target && target_dir_end[-1] != '/')
+                target_dir_end--;
+            memset(&attr, 0, sizeof(attr));
+            attr.name = "Target";
+            if (buf_append(&new_target, target, (size_t)(target_dir_end - target)) != 0 ||
+                append_attr_escaped(&new_target, child_base) != 0) {
+                free(new_target.data);
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                break;
+            }
+            attr.text = new_target.data;
+            if (append_tag_rewritten(&out, tag.start, tag.end, &attr, 1) != 0)
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            free(new_target.data);
+        }
+        if (err == LXLSX_NO_ERROR &&
+            buf_append(&out, p, (size_t)(limit - p)) != 0)
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        if (err == LXLSX_NO_ERROR)
+            err = key_set_add(st->part_names, rels_to, strlen(rels_to),
+                              NULL, NULL);
+        if (err == LXLSX_NO_ERROR)
+            composer_add_part(&st->composer, rels_to,
+                              (const unsigned char *)out.data, out.len, 1);
+        free(rels);
+        free(out.data);
+        if (err != LXLSX_NO_ERROR)
+            return err;
     }
 
-    if (c->oom)
-        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-
-done:
-    free(wbxml);
-    free(relxml);
-    return err;
+    if (kind == LXLSX_CONCAT_TABLE)
+        return concat_copy_table(st, src, (size_t)index, name);
+    if (kind == LXLSX_CONCAT_SHEET && sheet)
+        composer_add_copy(&st->composer, name, src->package, (size_t)index,
+                          concat_sheet_stream, sheet);
+    else
+        composer_add_copy(&st->composer, name, src->package, (size_t)index,
+                          NULL, NULL);
+    return st->composer.oom ? LXLSX_ERROR_MEMORY_MALLOC_FAILED : LXLSX_NO_ERROR;
 }
 
-#define LXLSX_IMG_REL_TYPE  "http://schemas.openxmlformats.org/officeDocument/2006/relationships/image"
-#define LXLSX_DRAW_REL_TYPE "http://schemas.openxmlformats.org/officeDocument/2006/relationships/drawing"
-#define LXLSX_DRAW_CT       "application/vnd.openxmlformats-officedocument.drawing+xml"
-#define LXLSX_PKG_RELS_NS   "http://schemas.openxmlformats.org/package/2006/relationships"
+/* Number of UTF-8 characters in [s, s+len). */
+static size_t utf8_chars(const char *s, size_t len)
+{
+    size_t i, n = 0;
+    for (i = 0; i < len; i++)
+        if (((unsigned char)s[i] & 0xC0) != 0x80)
+            n++;
+    return n;
+}
 
-/*
- * Synthesise the parts behind the session's images: one media part per image, a
- * drawing part + its rels per worksheet, the content-type entries, and the
- * worksheet rels (patched or created). The worksheet's own <drawing r:id> ref
- * is left to the dirty-sheet patch loop (so it composes with cell edits on the
- * same sheet) — recorded here via has_drawing/drawing_rid. Images are anchored
- * with oneCellAnchor sized from the precomputed EMU extents.
- */
-/* Append target to the list if not already present (linear; lists are tiny). */
-static int add_unique_target(const char ***list, size_t *n, size_t *cap,
-                             const char *target)
+/* A worksheet name not yet used in the output: the name itself, or else
+ * "Name (2)", "Name (3)"... shortened to fit Excel's limit. */
+static lxlsx_error concat_sheet_name(lxlsx_concat *st, const char *name,
+                                     lxlsx_edit_buf *out)
 {
-    size_t i;
-    for (i = 0; i < *n; i++)
-        if (strcmp((*list)[i], target) == 0)
-            return 0;
-    if (*n >= *cap) {
-        size_t nc = *cap ? *cap * 2 : 4;
-        const char **nl = (const char **)realloc(*list, nc * sizeof(*nl));
-        if (!nl)
-            return -1;
-        *list = nl;
-        *cap = nc;
+    lxlsx_edit_buf key = {0};
+    size_t name_len = strlen(name);
+    size_t n;
+    lxlsx_error err;
+
+    for (n = 1;; n++) {
+        size_t keep = name_len;
+        char suffix[32] = "";
+
+        if (n > 1) {
+            size_t room;
+            snprintf(suffix, sizeof(suffix), " (%zu)", n);
+            room = LXLSX_CONCAT_SHEET_NAME_MAX - strlen(suffix);
+            while (keep > 0 && utf8_chars(name, keep) > room)
+                keep--;
+            while (keep > 0 && ((unsigned char)name[keep] & 0xC0) == 0x80)
+                keep--;
+        }
+        out->len = 0;
+        if (buf_append(out, name, keep) != 0 ||
+            buf_append_s(out, suffix) != 0 ||
+            buf_set_lower(&key, out->data, out->len) != 0) {
+            free(key.data);
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        }
+        if (!lxlsx_hash_key_exists(st->sheet_names, key.data, key.len))
+            break;
     }
-    (*list)[(*n)++] = target;
-    return 0;
-}
 
-#define LXLSX_CHART_REL_TYPE "http://schemas.openxmlformats.org/officeDocument/2006/relationships/chart"
-#define LXLSX_CHART_CT       "application/vnd.openxmlformats-officedocument.drawingml.chart+xml"
-#define LXLSX_DML_CHART_NS   "http://schemas.openxmlformats.org/drawingml/2006/chart"
+    err = key_set_add(st->sheet_names, key.data, key.len, NULL, NULL);
+    free(key.data);
+    return err;
+}
 
-/* Append one chart's oneCellAnchor + graphicFrame to a drawing buffer. Built in
- * segments so no single fixed buffer can overflow (cf. the rels skeleton bug). */
-static int append_chart_anchor(lxlsx_edit_buf *draw, lxlsx_row_t row,
-                               lxlsx_col_t col, uint64_t cx, uint64_t cy,
-                               int anchor_id, size_t rel_idx)
+/* The relationship type of a source's workbook rel, or the worksheet one. */
+static lxlsx_error source_sheet_rel_type(const lxlsx_concat_source *src,
+                                         const char *rel_id,
+                                         lxlsx_edit_buf *type)
 {
-    char num[256];
+    const char *p = (const char *)src->rels;
+    const char *limit = p + src->rels_len;
+    lxlsx_edit_xml_tag tag;
 
-    snprintf(num, sizeof(num),
-             "<xdr:oneCellAnchor>"
-             "<xdr:from><xdr:col>%u</xdr:col><xdr:colOff>0</xdr:colOff>"
-             "<xdr:row>%u</xdr:row><xdr:rowOff>0</xdr:rowOff></xdr:from>"
-             "<xdr:ext cx=\"%llu\" cy=\"%llu\"/>",
-             (unsigned)col, (unsigned)row,
-             (unsigned long long)cx, (unsigned long long)cy);
-    if (buf_append_s(draw, num) != 0)
-        return -1;
+    type->len = 0;
+    while (rel_id && xml_next_tag(p, limit, &tag)) {
+        const char *value;
+        size_t len;
 
-    if (buf_append_s(draw, "<xdr:graphicFrame macro=\"\"><xdr:nvGraphicFramePr>") != 0)
-        return -1;
-    snprintf(num, sizeof(num),
-             "<xdr:cNvPr id=\"%d\" name=\"Chart %d\"/>", anchor_id, anchor_id);
-    if (buf_append_s(draw, num) != 0)
-        return -1;
-    if (buf_append_s(draw,
-            "<xdr:cNvGraphicFramePr/></xdr:nvGraphicFramePr>"
-            "<xdr:xfrm><a:off x=\"0\" y=\"0\"/><a:ext cx=\"0\" cy=\"0\"/></xdr:xfrm>"
-            "<a:graphic><a:graphicData uri=\"" LXLSX_DML_CHART_NS "\">"
-            "<c:chart xmlns:c=\"" LXLSX_DML_CHART_NS "\""
-            " xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\"") != 0)
-        return -1;
-    snprintf(num, sizeof(num), " r:id=\"rId%zu\"/>", rel_idx);
-    if (buf_append_s(draw, num) != 0)
-        return -1;
-    if (buf_append_s(draw,
-            "</a:graphicData></a:graphic></xdr:graphicFrame>"
-            "<xdr:clientData/></xdr:oneCellAnchor>") != 0)
-        return -1;
-    return 0;
+        p = tag.end + 1;
+        if (!tag.is_end && tag_name_is(&tag, "Relationship") &&
+            attr_value_is(tag.start, tag.end, "Id", rel_id) &&
+            find_attr(tag.start, tag.end, "Type", &value, &len))
+            return buf_append(type, value, len) == 0
+                ? LXLSX_NO_ERROR : LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+    return buf_append_s(type, LXLSX_WS_REL_TYPE) == 0
+        ? LXLSX_NO_ERROR : LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 }
 
-/*
- * Synthesise the parts behind the session's charts: one xl/charts/chartN.xml per
- * chart (serialised here), a drawing part per worksheet whose graphicFrames
- * reference the charts, the drawing rels, the worksheet rels (patched/created)
- * and the content types. Mirrors prepare_images; the <drawing> ref is recorded
- * on the dirty sheet. Charts share the drawing numbering via next_drawing_io.
- */
-/* Append one image's oneCellAnchor (pic) to the drawing + its rels/content-type.
- * rel_idx/anchor_id are this drawing's running counters; next_media is global. */
-static lxlsx_error append_image_object(lxlsx_composer *c, lxlsx_edit_image *im,
-                                       lxlsx_edit_buf *draw, lxlsx_edit_buf *drels,
-                                       lxlsx_edit_buf *ct,
-                                       const unsigned char *ctxml, size_t ctlen,
-                                       int *seen_png, int *seen_jpeg,
-                                       int *seen_bmp, int *seen_gif,
-                                       size_t *next_media,
-                                       size_t rel_idx, int anchor_id)
+/* Copy the worksheets of a source and register them in the workbook. */
+static lxlsx_error concat_source_sheets(lxlsx_concat *st,
+                                        lxlsx_concat_source *src)
 {
-    const char *ct_str = image_ct_for_ext(im->extension);
-    char frag[512], needle[32], media_part[64];
-    long long xoff, yoff;
-    size_t media_num;
-    int *seen;
+    const lxlsx_reader_workbook *wb = src->workbook;
+    const lxlsx_concat_maps *maps = &src->maps;
+    int renumber = maps->xf || maps->dxf || maps->sst;
+    lxlsx_edit_buf name = {0};
+    lxlsx_edit_buf type = {0};
+    lxlsx_edit_buf *wb_xml, *rels;
+    size_t i;
+    lxlsx_error err = LXLSX_NO_ERROR;
 
-    if (!ct_str)
-        return LXLSX_ERROR_PARAMETER_VALIDATION;
-    media_num = (*next_media)++;
+    wb_xml = composer_part_buf(&st->composer, "xl/workbook.xml", "</sheets>");
+    rels = composer_part_buf(&st->composer, "xl/_rels/workbook.xml.rels",
+                             "</Relationships>");
+    if (!wb_xml || !rels)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
-    snprintf(media_part, sizeof(media_part),
-             "xl/media/image%zu.%s", media_num, im->extension);
-    composer_add_part(c, media_part, im->data, im->size, 0);
+    for (i = 0; i < wb->sheet_count && err == LXLSX_NO_ERROR; i++) {
+        const lxlsx_reader_sheet_info *info = &wb->sheets[i];
+        lxlsx_concat_sheet *sheet = &src->sheets[i];
+        const char *to = NULL;
+        int index = lxlsx_source_package_find_first(src->package, info->target);
+        int selected = 0;
 
-    /* Default content type per extension (dedup vs existing + batch). */
-    seen = (strcmp(im->extension, "png") == 0)  ? seen_png  :
-           (strcmp(im->extension, "jpeg") == 0) ? seen_jpeg :
-           (strcmp(im->extension, "bmp") == 0)  ? seen_bmp  : seen_gif;
-    snprintf(needle, sizeof(needle), "Extension=\"%s\"", im->extension);
-    if (!*seen && !(ctxml && mem_find((const char *)ctxml, ctlen, needle))) {
-        snprintf(frag, sizeof(frag),
-                 "<Default Extension=\"%s\" ContentType=\"%s\"/>",
-                 im->extension, ct_str);
-        if (buf_append_s(ct, frag) != 0)
-            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        if (index < 0) {
+            err = LXLSX_ERROR_ZIP_FILE_ADD;
+            break;
+        }
+        err = sheet_is_selected(src->package, (size_t)index, &selected);
+        if (err != LXLSX_NO_ERROR)
+            break;
+        sheet->maps = maps;
+        sheet->drop_tab_selected = selected;
+
+        err = concat_copy_part(st, src, info->target, LXLSX_CONCAT_SHEET,
+                               renumber || selected ? sheet : NULL, &to);
+        if (err == LXLSX_NO_ERROR)
+            err = concat_sheet_name(st, info->name ? info->name : "Sheet", &name);
+        if (err == LXLSX_NO_ERROR)
+            err = source_sheet_rel_type(src, info->rel_id, &type);
+        if (err != LXLSX_NO_ERROR)
+            break;
+
+        if (buf_append_s(wb_xml, "<sheet name=\"") != 0 ||
+            append_attr_escaped(wb_xml, name.data) != 0 ||
+            buf_appendf(wb_xml, "\" sheetId=\"%zu\"", st->next_sheet_id++) != 0 ||
+            (info->visibility == LXLSX_READER_SHEET_HIDDEN &&
+             buf_append_s(wb_xml, " state=\"hidden\"") != 0) ||
+            (info->visibility == LXLSX_READER_SHEET_VERY_HIDDEN &&
+             buf_append_s(wb_xml, " state=\"veryHidden\"") != 0) ||
+            buf_appendf(wb_xml, " r:id=\"rId%zu\"/>", st->next_rid) != 0 ||
+            buf_appendf(rels, "<Relationship Id=\"rId%zu\" Type=\"",
+                        st->next_rid++) != 0 ||
+            buf_append(rels, type.data, type.len) != 0 ||
+            buf_append_s(rels, "\" Target=\"") != 0 ||
+            (strncmp(to, "xl/", 3) == 0
+                 ? append_attr_escaped(rels, to + 3)
+                 : (buf_append_s(rels, "/") != 0 ||
+                    append_attr_escaped(rels, to) != 0)) != 0 ||
+            buf_append_s(rels, "\"/>") != 0)
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
     }
-    *seen = 1;
 
-    snprintf(frag, sizeof(frag),
-             "<Relationship Id=\"rId%zu\" Type=\"" LXLSX_IMG_REL_TYPE
-             "\" Target=\"../media/image%zu.%s\"/>",
-             rel_idx, media_num, im->extension);
-    if (buf_append_s(drels, frag) != 0)
-        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    free(name.data);
+    free(type.data);
+    return err;
+}
 
-    xoff = (long long)im->x_offset * 9525;
-    yoff = (long long)im->y_offset * 9525;
-    snprintf(frag, sizeof(frag),
-        "<xdr:oneCellAnchor>"
-        "<xdr:from><xdr:col>%u</xdr:col><xdr:colOff>%lld</xdr:colOff>"
-        "<xdr:row>%u</xdr:row><xdr:rowOff>%lld</xdr:rowOff></xdr:from>"
-        "<xdr:ext cx=\"%llu\" cy=\"%llu\"/>"
-        "<xdr:pic><xdr:nvPicPr><xdr:cNvPr id=\"%d\" name=\"Picture %d\"",
-        (unsigned)im->col, xoff, (unsigned)im->row, yoff,
-        (unsigned long long)im->cx, (unsigned long long)im->cy,
-        anchor_id, anchor_id);
-    if (buf_append_s(draw, frag) != 0)
+/* The base's styles.xml with the merged records added. */
+static lxlsx_error concat_styles_xml(lxlsx_concat *st, char **out,
+                                     size_t *out_len)
+{
+    static const char *const dxfs_before[] = {
+        "<tableStyles", "<colors", "<extLst", "</styleSheet>"
+    };
+    struct {
+        const char *tag;
+        const lxlsx_edit_buf *entries;
+        size_t added;
+    } lists[6];
+    char *xml;
+    size_t len = st->styles_len;
+    size_t i;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    xml = (char *)malloc(len + 1);
+    if (!xml)
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-    if (im->description && *im->description) {
-        if (buf_append_s(draw, " descr=\"") != 0 ||
-            append_attr_escaped(draw, im->description) != 0 ||
-            buf_append_s(draw, "\"") != 0)
+    memcpy(xml, st->styles, len);
+    xml[len] = 0;
+
+    /* dxfs goes after cellStyles, not first in the styleSheet where
+     * splice_collection() would create it. */
+    if (st->dxfs.added_count && !mem_find(xml, len, "<dxfs")) {
+        lxlsx_edit_buf with = {0};
+        const char *at = NULL;
+        for (i = 0; i < sizeof(dxfs_before) / sizeof(dxfs_before[0]) && !at; i++)
+            at = mem_find(xml, len, dxfs_before[i]);
+        if (!at) {
+            free(xml);
+            return LXLSX_ERROR_PARAMETER_VALIDATION;
+        }
+        if (buf_append(&with, xml, (size_t)(at - xml)) != 0 ||
+            buf_append_s(&with, "<dxfs count=\"0\"/>") != 0 ||
+            buf_append(&with, at, len - (size_t)(at - xml)) != 0) {
+            free(xml);
+            free(with.data);
             return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        }
+        free(xml);
+        xml = with.data;
+        len = with.len;
     }
-    snprintf(frag, sizeof(frag),
-        "/><xdr:cNvPicPr><a:picLocks noChangeAspect=\"1\"/></xdr:cNvPicPr></xdr:nvPicPr>"
-        "<xdr:blipFill>"
-        "<a:blip xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\" r:embed=\"rId%zu\"/>"
-        "<a:stretch><a:fillRect/></a:stretch></xdr:blipFill>"
-        "<xdr:spPr><a:xfrm><a:off x=\"0\" y=\"0\"/><a:ext cx=\"%llu\" cy=\"%llu\"/></a:xfrm>"
-        "<a:prstGeom prst=\"rect\"><a:avLst/></a:prstGeom></xdr:spPr>"
-        "</xdr:pic><xdr:clientData/></xdr:oneCellAnchor>",
-        rel_idx, (unsigned long long)im->cx, (unsigned long long)im->cy);
-    if (buf_append_s(draw, frag) != 0)
-        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    lists[0].tag = "numFmts";
+    lists[0].entries = &st->num_fmts_added;
+    lists[0].added = st->num_fmts_added_count;
+    lists[1].tag = "fonts";
+    lists[1].entries = &st->fonts.added;
+    lists[1].added = st->fonts.added_count;
+    lists[2].tag = "fills";
+    lists[2].entries = &st->fills.added;
+    lists[2].added = st->fills.added_count;
+    lists[3].tag = "borders";
+    lists[3].entries = &st->borders.added;
+    lists[3].added = st->borders.added_count;
+    lists[4].tag = "cellXfs";
+    lists[4].entries = &st->xfs.added;
+    lists[4].added = st->xfs.added_count;
+    lists[5].tag = "dxfs";
+    lists[5].entries = &st->dxfs.added;
+    lists[5].added = st->dxfs.added_count;
+
+    for (i = 0; i < 6 && err == LXLSX_NO_ERROR; i++) {
+        char *next = NULL;
+        size_t next_len = 0;
+        if (!lists[i].added)
+            continue;
+        err = splice_collection(xml, len, lists[i].tag, lists[i].entries->data,
+                                lists[i].added, "styleSheet", &next, &next_len);
+        if (err == LXLSX_NO_ERROR) {
+            free(xml);
+            xml = next;
+            len = next_len;
+        }
+    }
+
+    if (err != LXLSX_NO_ERROR) {
+        free(xml);
+        return err;
+    }
+    *out = xml;
+    *out_len = len;
     return LXLSX_NO_ERROR;
 }
 
-/* Serialise one chart, add its part/rels/content-type and graphicFrame anchor. */
-static lxlsx_error append_chart_object(lxlsx_composer *c, lxlsx_edit_chart *ech,
-                                       lxlsx_edit_buf *draw, lxlsx_edit_buf *drels,
-                                       lxlsx_edit_buf *ct,
-                                       size_t *next_chart, size_t chart_seq,
-                                       size_t rel_idx, int anchor_id)
+/* The base's shared strings with the merged ones added, or a new part. */
+static lxlsx_error concat_sst_xml(lxlsx_concat *st, char **out,
+                                  size_t *out_len)
 {
-    char *chart_xml = NULL;
-    size_t chart_xml_len = 0, chart_num = (*next_chart)++;
-    char frag[256];
-    uint64_t cx, cy;
-    lxlsx_error err;
+    const char *xml = (const char *)st->sst;
+    const char *limit = xml + st->sst_len;
+    const char *p = xml;
+    lxlsx_edit_xml_tag tag;
+    lxlsx_edit_xml_tag close;
+    lxlsx_edit_buf buf = {0};
+    size_t refs = st->string_refs;
+    int found;
+
+    if (!xml) {
+        if (buf_appendf(&buf,
+                        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+                        "<sst xmlns=\"" LXLSX_SML_NS "\" count=\"%zu\" uniqueCount=\"%zu\">",
+                        refs, st->strings.count) != 0 ||
+            buf_append(&buf, st->strings.added.data, st->strings.added.len) != 0 ||
+            buf_append_s(&buf, "</sst>") != 0)
+            goto oom;
+        *out = buf.data;
+        *out_len = buf.len;
+        return LXLSX_NO_ERROR;
+    }
 
-    /* The chart id only needs to be unique enough for axis ids. */
-    ech->chart->id = (uint32_t)chart_seq;
-    err = lxlsx_chart_assemble_to_buffer(ech->chart, NULL, &chart_xml, &chart_xml_len);
-    if (err != LXLSX_NO_ERROR)
-        return err;
+    for (;;) {
+        if (!xml_next_tag(p, limit, &tag))
+            return LXLSX_ERROR_PARAMETER_VALIDATION;
+        if (!tag.is_end && tag_name_is(&tag, "sst"))
+            break;
+        p = tag.end + 1;
+    }
+    refs += attr_number(tag.start, tag.end, "count", &found);
+    if (!found)
+        refs += st->strings.count - st->strings.added_count;
+
+    if (buf_append(&buf, xml, (size_t)(tag.start - xml)) != 0 ||
+        buf_append_open_tag_without(&buf, tag.start, tag.end, "count",
+                                    "uniqueCount") != 0 ||
+        buf_appendf(&buf, " count=\"%zu\" uniqueCount=\"%zu\">", refs,
+                    st->strings.count) != 0)
+        goto oom;
+    if (tag.is_self_closing) {
+        if (buf_append(&buf, st->strings.added.data, st->strings.added.len) != 0 ||
+            buf_append_matching_end_tag(&buf, tag.start, tag.end) != 0 ||
+            buf_append(&buf, tag.end + 1, (size_t)(limit - tag.end - 1)) != 0)
+            goto oom;
+    } else {
+        if (!find_matching_end_tag(tag.end + 1, limit, "sst", &close)) {
+            free(buf.data);
+            return LXLSX_ERROR_PARAMETER_VALIDATION;
+        }
+        if (buf_append(&buf, tag.end + 1, (size_t)(close.start - tag.end - 1)) != 0 ||
+            buf_append(&buf, st->strings.added.data, st->strings.added.len) != 0 ||
+            buf_append(&buf, close.start, (size_t)(limit - close.start)) != 0)
+            goto oom;
+    }
+    *out = buf.data;
+    *out_len = buf.len;
+    return LXLSX_NO_ERROR;
 
-    snprintf(frag, sizeof(frag), "xl/charts/chart%zu.xml", chart_num);
-    composer_add_part(c, frag, (const unsigned char *)chart_xml, chart_xml_len, 1);
-    free(chart_xml);
+oom:
+    free(buf.data);
+    return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+}
 
-    snprintf(frag, sizeof(frag),
-             "<Override PartName=\"/xl/charts/chart%zu.xml\" ContentType=\"%s\"/>",
-             chart_num, LXLSX_CHART_CT);
-    if (buf_append_s(ct, frag) != 0)
+/* Register a new shared strings part for a base that has none. */
+static lxlsx_error concat_add_sst(lxlsx_concat *st, char *data, size_t len)
+{
+    lxlsx_edit_buf *rels = composer_part_buf(&st->composer,
+                                             "xl/_rels/workbook.xml.rels",
+                                             "</Relationships>");
+    lxlsx_edit_buf *ct = composer_part_buf(&st->composer,
+                                           "[Content_Types].xml", "</Types>");
+
+    if (!rels || !ct ||
+        buf_appendf(rels, "<Relationship Id=\"rId%zu\" Type=\"%s\" "
+                    "Target=\"sharedStrings.xml\"/>", st->next_rid++,
+                    LXLSX_SST_REL_TYPE) != 0 ||
+        buf_appendf(ct, "<Override PartName=\"/xl/sharedStrings.xml\" "
+                    "ContentType=\"%s\"/>", LXLSX_SST_CT) != 0)
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    composer_add_part(&st->composer, "xl/sharedStrings.xml",
+                      (const unsigned char *)data, len, 1);
+    return st->composer.oom ? LXLSX_ERROR_MEMORY_MALLOC_FAILED : LXLSX_NO_ERROR;
+}
 
-    snprintf(frag, sizeof(frag),
-             "<Relationship Id=\"rId%zu\" Type=\"" LXLSX_CHART_REL_TYPE
-             "\" Target=\"../charts/chart%zu.xml\"/>",
-             rel_idx, chart_num);
-    if (buf_append_s(drels, frag) != 0)
-        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+/* Drop what a source only needs while it is merged. */
+static void concat_source_trim(lxlsx_concat_source *src)
+{
+    size_t i;
 
-    /* Default chart size 480x288 px in EMUs. */
-    cx = (uint64_t)(480.0 * 9525.0);
-    cy = (uint64_t)(288.0 * 9525.0);
-    if (append_chart_anchor(draw, ech->row, ech->col, cx, cy, anchor_id, rel_idx) != 0)
-        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-    return LXLSX_NO_ERROR;
+    for (i = 0; i < src->part_count; i++)
+        free(src->parts[i].from);
+    free(src->parts);
+    src->parts = NULL;
+    src->part_count = src->part_cap = 0;
+    free(src->types);
+    src->types = NULL;
+    free(src->rels);
+    src->rels = NULL;
+    if (src->workbook)
+        lxlsx_reader_workbook_close(src->workbook);
+    src->workbook = NULL;
 }
 
-/*
- * Synthesise the drawing-hosted parts behind the session's images AND charts.
- * One drawing per worksheet holds all of that sheet's images (pics) followed by
- * its charts (graphicFrames), so a sheet may mix both. Each drawing gets its
- * rels, the worksheet rels (patched/created), the content types and a <drawing>
- * ref recorded on the dirty sheet. Drawing/anchor/rel ids run per drawing;
- * media/chart part numbers and the drawing-part counter are global.
- */
-static lxlsx_error prepare_drawings(lxlsx_edit_session *session,
-                                    lxlsx_composer *c,
-                                    lxlsx_dirty_sheet **sheets,
-                                    size_t *sheet_count,
-                                    size_t *sheet_cap,
-                                    size_t *next_drawing_io)
+/* Open the source at path and merge it into the output: its styles, shared
+ * strings and worksheets. */
+static lxlsx_error concat_add_source(lxlsx_concat *st,
+                                     lxlsx_concat_source *src,
+                                     const char *path)
 {
-    size_t next_media, next_chart, chart_seq = 0, i, t;
-    lxlsx_edit_buf *ct;
-    unsigned char *ctxml = NULL;
-    size_t ctlen = 0;
-    int seen_png = 0, seen_jpeg = 0, seen_bmp = 0, seen_gif = 0;
-    const char **targets = NULL;
-    size_t ntargets = 0, tcap = 0;
-    char frag[512];
-    lxlsx_error err = LXLSX_NO_ERROR;
-
-    if (session->image_count == 0 && session->chart_count == 0)
-        return LXLSX_NO_ERROR;
+    char rels_path[512];
+    lxlsx_error err;
 
-    next_media = max_existing_indexed(session, "xl/media/image") + 1;
-    next_chart = max_existing_indexed(session, "xl/charts/chart") + 1;
+    /* The shared strings are merged from the part's XML; the reader need not
+     * parse them. */
+    err = open_source_ex(path, LXLSX_READER_SST_MODE_STREAMING, &src->package,
+                         &src->workbook);
+    if (err != LXLSX_NO_ERROR)
+        return err;
 
-    ct = composer_part_buf(c, "[Content_Types].xml", "</Types>");
-    if (!ct)
+    src->sheets = (lxlsx_concat_sheet *)calloc(
+        src->workbook->sheet_count ? src->workbook->sheet_count : 1,
+        sizeof(*src->sheets));
+    if (!src->sheets)
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
-    {
-        int idx = lxlsx_source_package_find_first(session->package, "[Content_Types].xml");
-        if (idx >= 0) {
-            err = lxlsx_source_package_read_entry(session->package, (size_t)idx,
-                                                  &ctxml, &ctlen);
-            if (err != LXLSX_NO_ERROR)
-                return err;
-        }
-    }
-
-    /* Distinct worksheets touched by an image or a chart. */
-    for (i = 0; i < session->image_count; i++)
-        if (add_unique_target(&targets, &ntargets, &tcap, session->images[i].target) != 0) {
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done;
-        }
-    for (i = 0; i < session->chart_count; i++)
-        if (add_unique_target(&targets, &ntargets, &tcap, session->charts[i].target) != 0) {
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done;
-        }
-
-    for (t = 0; t < ntargets; t++) {
-        const char *target = targets[t];
-        size_t drawing_num, rel_idx = 1, ws_rid = 1;
-        int anchor_id = 1, ws_rels_idx;
-        lxlsx_edit_buf draw = {0}, drels = {0};
-        char drawing_part[64], drawing_rels_part[96], ws_rels_part[96];
-        lxlsx_dirty_sheet *ds = NULL;
+    err = read_part(src->package, "[Content_Types].xml", &src->types,
+                    &src->types_len);
+    if (err == LXLSX_NO_ERROR &&
+        derive_rels_path(src->workbook->workbook_path, rels_path,
+                         sizeof(rels_path)) == 0)
+        err = read_part(src->package, rels_path, &src->rels, &src->rels_len);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_styles(st, src);
+    if (err == LXLSX_NO_ERROR)
+        err = merge_shared_strings(st, src);
+    if (err == LXLSX_NO_ERROR)
+        err = concat_source_sheets(st, src);
+    if (err == LXLSX_NO_ERROR)
+        concat_source_trim(src);
+    return err;
+}
 
-        drawing_num = (*next_drawing_io)++;
-        snprintf(drawing_part, sizeof(drawing_part),
-                 "xl/drawings/drawing%zu.xml", drawing_num);
-        if (derive_rels_path(drawing_part, drawing_rels_part, sizeof(drawing_rels_part)) != 0 ||
-            derive_rels_path(target, ws_rels_part, sizeof(ws_rels_part)) != 0) {
-            err = LXLSX_ERROR_PARAMETER_VALIDATION; goto done;
-        }
+static void concat_free(lxlsx_concat *st)
+{
+    size_t i;
 
-        if (buf_append_s(&draw,
-                "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
-                "<xdr:wsDr xmlns:xdr=\"http://schemas.openxmlformats.org/drawingml/2006/spreadsheetDrawing\""
-                " xmlns:a=\"http://schemas.openxmlformats.org/drawingml/2006/main\">") != 0 ||
-            buf_append_s(&drels,
-                "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
-                "<Relationships xmlns=\"" LXLSX_PKG_RELS_NS "\">") != 0)
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    for (i = 0; i < st->source_count; i++) {
+        lxlsx_concat_source *src = &st->sources[i];
+        lxlsx_concat_maps *maps = &src->maps;
+        concat_source_trim(src);
+        free(maps->num_fmt);
+        free(maps->font);
+        free(maps->fill);
+        free(maps->border);
+        free(maps->xf);
+        free(maps->dxf);
+        free(maps->sst);
+        free(src->sheets);
+        if (src->package)
+            lxlsx_source_package_close(src->package);
+    }
+    free(st->sources);
+    composer_free(&st->composer);
+    lxlsx_hash_free(st->part_names);
+    lxlsx_hash_free(st->part_stems);
+    lxlsx_hash_free(st->sheet_names);
+    lxlsx_hash_free(st->table_names);
+    lxlsx_hash_free(st->type_defaults);
+    lxlsx_hash_free(st->num_fmt_codes);
+    free(st->num_fmts_added.data);
+    records_free(&st->fonts);
+    records_free(&st->fills);
+    records_free(&st->borders);
+    records_free(&st->xfs);
+    records_free(&st->dxfs);
+    records_free(&st->strings);
+    free(st->styles);
+    free(st->sst);
+    if (st->base)
+        lxlsx_edit_close(st->base);
+}
 
-        /* Images first, then charts, all into this one drawing. */
-        for (i = 0; i < session->image_count && err == LXLSX_NO_ERROR; i++) {
-            if (strcmp(session->images[i].target, target) != 0)
-                continue;
-            err = append_image_object(c, &session->images[i], &draw, &drels, ct,
-                                      ctxml, ctlen, &seen_png, &seen_jpeg,
-                                      &seen_bmp, &seen_gif, &next_media,
-                                      rel_idx, anchor_id);
-            rel_idx++;
-            anchor_id++;
-        }
-        for (i = 0; i < session->chart_count && err == LXLSX_NO_ERROR; i++) {
-            if (strcmp(session->charts[i].target, target) != 0)
-                continue;
-            err = append_chart_object(c, &session->charts[i], &draw, &drels, ct,
-                                      &next_chart, ++chart_seq, rel_idx, anchor_id);
-            rel_idx++;
-            anchor_id++;
-        }
+/* Set up the output from the base: the names, ids and defaults in use. */
+static lxlsx_error concat_init(lxlsx_concat *st, const char *base_path)
+{
+    const lxlsx_source_package *package;
+    unsigned char *xml = NULL;
+    size_t len = 0, count, i;
+    lxlsx_edit_buf key = {0};
+    lxlsx_error err;
 
-        if (err == LXLSX_NO_ERROR &&
-            (buf_append_s(&draw, "</xdr:wsDr>") != 0 ||
-             buf_append_s(&drels, "</Relationships>") != 0))
-            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    st->base = lxlsx_edit_open(base_path);
+    if (!st->base)
+        return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+    package = st->base->package;
+    composer_init(&st->composer, st->base);
+
+    st->part_names = lxlsx_hash_new(128, 1, 0);
+    st->part_stems = lxlsx_hash_new(32, 1, 0);
+    st->sheet_names = lxlsx_hash_new(32, 1, 0);
+    st->table_names = lxlsx_hash_new(32, 1, 0);
+    st->type_defaults = lxlsx_hash_new(32, 1, 0);
+    st->num_fmt_codes = lxlsx_hash_new(64, 1, 0);
+    if (!st->part_names || !st->part_stems || !st->sheet_names ||
+        !st->table_names || !st->type_defaults || !st->num_fmt_codes ||
+        records_init(&st->fonts, "fonts", "font") != LXLSX_NO_ERROR ||
+        records_init(&st->fills, "fills", "fill") != LXLSX_NO_ERROR ||
+        records_init(&st->borders, "borders", "border") != LXLSX_NO_ERROR ||
+        records_init(&st->xfs, "cellXfs", "xf") != LXLSX_NO_ERROR ||
+        records_init(&st->dxfs, "dxfs", "dxf") != LXLSX_NO_ERROR ||
+        records_init(&st->strings, "sst", "si") != LXLSX_NO_ERROR)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
-        if (err == LXLSX_NO_ERROR) {
-            composer_add_part(c, drawing_part, (const unsigned char *)draw.data, draw.len, 1);
-            composer_add_part(c, drawing_rels_part, (const unsigned char *)drels.data, drels.len, 1);
-        }
-        free(draw.data);
-        free(drels.data);
+    count = lxlsx_source_package_entry_count(package);
+    for (i = 0; i < count; i++) {
+        const lxlsx_source_package_entry_info *info =
+            lxlsx_source_package_entry_info_at(package, i);
+        if (lxlsx_hash_key_exists(st->part_names, (void *)info->name,
+                                  info->name_len))
+            continue;
+        err = key_set_add(st->part_names, info->name, info->name_len, NULL, NULL);
         if (err != LXLSX_NO_ERROR)
-            goto done;
+            return err;
+    }
 
-        snprintf(frag, sizeof(frag),
-                 "<Override PartName=\"/%s\" ContentType=\"" LXLSX_DRAW_CT "\"/>",
-                 drawing_part);
-        if (buf_append_s(ct, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
+    for (i = 0; i < st->base->workbook->sheet_count; i++) {
+        const char *name = st->base->workbook->sheets[i].name;
+        if (!name)
+            continue;
+        if (buf_set_lower(&key, name, strlen(name)) != 0) {
+            free(key.data);
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        }
+        if (!lxlsx_hash_key_exists(st->sheet_names, key.data, key.len)) {
+            err = key_set_add(st->sheet_names, key.data, key.len, NULL, NULL);
+            if (err != LXLSX_NO_ERROR) {
+                free(key.data);
+                return err;
+            }
+        }
+    }
 
-        /* Worksheet rels: drawing relationship — patch if present, else create. */
-        ws_rels_idx = lxlsx_source_package_find_first(session->package, ws_rels_part);
-        if (ws_rels_idx >= 0) {
-            unsigned char *rxml = NULL;
-            size_t rlen = 0;
-            lxlsx_edit_buf *wsr;
-            err = lxlsx_source_package_read_entry(session->package,
-                                                  (size_t)ws_rels_idx, &rxml, &rlen);
-            if (err != LXLSX_NO_ERROR) goto done;
-            ws_rid = scan_max_after(rxml, rlen, "Id=\"rId") + 1;
-            free(rxml);
-            wsr = composer_part_buf(c, ws_rels_part, "</Relationships>");
-            if (!wsr) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-            snprintf(frag, sizeof(frag),
-                     "<Relationship Id=\"rId%zu\" Type=\"" LXLSX_DRAW_REL_TYPE
-                     "\" Target=\"../drawings/drawing%zu.xml\"/>",
-                     ws_rid, drawing_num);
-            if (buf_append_s(wsr, frag) != 0) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-        } else {
-            char skel[512];
-            ws_rid = 1;
-            snprintf(skel, sizeof(skel),
-                "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>"
-                "<Relationships xmlns=\"" LXLSX_PKG_RELS_NS "\">"
-                "<Relationship Id=\"rId1\" Type=\"" LXLSX_DRAW_REL_TYPE
-                "\" Target=\"../drawings/drawing%zu.xml\"/></Relationships>",
-                drawing_num);
-            composer_add_part(c, ws_rels_part, (const unsigned char *)skel, strlen(skel), 1);
+    err = read_part(package, "[Content_Types].xml", &xml, &len);
+    if (err == LXLSX_NO_ERROR && xml) {
+        const char *p = (const char *)xml;
+        lxlsx_edit_xml_tag tag;
+        while (err == LXLSX_NO_ERROR &&
+               xml_next_tag(p, (const char *)xml + len, &tag)) {
+            const char *ext;
+            size_t ext_len;
+            p = tag.end + 1;
+            if (tag.is_end || !tag_name_is(&tag, "Default") ||
+                !find_attr(tag.start, tag.end, "Extension", &ext, &ext_len))
+                continue;
+            if (buf_set_lower(&key, ext, ext_len) != 0)
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            else if (!lxlsx_hash_key_exists(st->type_defaults, key.data, key.len))
+                err = key_set_add(st->type_defaults, key.data, key.len, NULL, NULL);
         }
+    }
+    free(xml);
+    free(key.data);
+    if (err != LXLSX_NO_ERROR)
+        return err;
 
-        err = get_dirty_sheet(session, sheets, sheet_count, sheet_cap, target, &ds);
-        if (err != LXLSX_NO_ERROR) goto done;
-        if (ds->has_drawing) { err = LXLSX_ERROR_FEATURE_NOT_SUPPORTED; goto done; }
-        ds->has_drawing = 1;
-        ds->drawing_rid = ws_rid;
+    err = read_part(package, "xl/workbook.xml", &xml, &len);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    if (!xml)
+        return LXLSX_ERROR_ZIP_FILE_ADD;
+    st->next_sheet_id = scan_max_after(xml, len, "sheetId=\"") + 1;
+    free(xml);
 
-        if (c->oom) { err = LXLSX_ERROR_MEMORY_MALLOC_FAILED; goto done; }
-    }
+    err = read_part(package, "xl/_rels/workbook.xml.rels", &xml, &len);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    if (!xml)
+        return LXLSX_ERROR_ZIP_FILE_ADD;
+    st->next_rid = scan_max_after(xml, len, "Id=\"rId") + 1;
+    free(xml);
 
-done:
-    free(targets);
-    free(ctxml);
+    err = read_part(package, st->base->workbook->styles_path, &st->styles,
+                    &st->styles_len);
+    if (err == LXLSX_NO_ERROR)
+        err = read_part(package, st->base->workbook->sst_path, &st->sst,
+                        &st->sst_len);
     return err;
 }
 
-lxlsx_error lxlsx_edit_save_as(lxlsx_edit_session *session, const char *path)
+lxlsx_error lxlsx_edit_concat(const char *const *paths, size_t path_count,
+                              const char *out)
 {
-    lxlsx_dirty_sheet *dirty_sheets = NULL;
-    size_t dirty_count = 0;
-    size_t dirty_cap = 0;
-    lxlsx_source_package_replacement *replacements = NULL;
-    lxlsx_source_package_replacement styles_rep;
-    lxlsx_source_package_replacement *meta_reps = NULL;
+    lxlsx_concat st;
     lxlsx_source_package_addition *additions = NULL;
-    lxlsx_composer composer;
-    size_t add_count = 0, meta_count = 0;
-    int styles_produced = 0;
-    size_t rep_count;
-    lxlsx_error err = LXLSX_NO_ERROR;
+    lxlsx_source_package_replacement *meta_reps = NULL;
+    lxlsx_source_package_replacement *replacements = NULL;
+    size_t add_count = 0, meta_count = 0, rep_count = 0;
+    char *styles = NULL;
+    char *sst = NULL;
+    size_t styles_len = 0, sst_len = 0;
     size_t i;
+    lxlsx_error err;
 
-    memset(&styles_rep, 0, sizeof(styles_rep));
-
-    if (!session || !path)
+    if (!paths || path_count == 0 || !out)
         return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
-    if (session->change_count == 0 && session->merge_count == 0 &&
-        session->col_count == 0 && session->row_dim_count == 0 &&
-        session->new_sheet_count == 0 && session->image_count == 0 &&
-        session->chart_count == 0)
-        return lxlsx_source_package_save_copy(session->package, path);
+    for (i = 0; i < path_count; i++)
+        if (!paths[i])
+            return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
 
-    composer_init(&composer, session);
+    memset(&st, 0, sizeof(st));
+    err = concat_init(&st, paths[0]);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
 
-    for (i = 0; i < session->change_count; i++) {
-        lxlsx_dirty_sheet *sheet = NULL;
-        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
-                              session->changes[i].target, &sheet);
-        if (err != LXLSX_NO_ERROR)
-            goto done;
-        err = dirty_sheet_add_change(sheet, &session->changes[i]);
-        if (err != LXLSX_NO_ERROR)
-            goto done;
+    st.sources = (lxlsx_concat_source *)calloc(path_count, sizeof(*st.sources));
+    if (!st.sources) {
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        goto done;
     }
-
-    for (i = 0; i < session->merge_count; i++) {
-        lxlsx_dirty_sheet *sheet = NULL;
-        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
-                              session->merges[i].target, &sheet);
-        if (err != LXLSX_NO_ERROR)
-            goto done;
-        err = dirty_sheet_add_merge(sheet, &session->merges[i]);
+    /* One source at a time: each is parsed, merged and trimmed to its
+     * package before the next is opened. */
+    for (i = 1; i < path_count; i++) {
+        err = concat_add_source(&st, &st.sources[st.source_count++], paths[i]);
         if (err != LXLSX_NO_ERROR)
             goto done;
     }
 
-    for (i = 0; i < session->col_count; i++) {
-        lxlsx_dirty_sheet *sheet = NULL;
-        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
-                              session->cols[i].target, &sheet);
-        if (err != LXLSX_NO_ERROR)
-            goto done;
-        err = dirty_sheet_add_col(sheet, &session->cols[i]);
+    if (st.num_fmts_added_count || st.fonts.added_count ||
+        st.fills.added_count || st.borders.added_count ||
+        st.xfs.added_count || st.dxfs.added_count) {
+        err = concat_styles_xml(&st, &styles, &styles_len);
         if (err != LXLSX_NO_ERROR)
             goto done;
     }
-
-    for (i = 0; i < session->row_dim_count; i++) {
-        lxlsx_dirty_sheet *sheet = NULL;
-        err = get_dirty_sheet(session, &dirty_sheets, &dirty_count, &dirty_cap,
-                              session->row_dims[i].target, &sheet);
-        if (err != LXLSX_NO_ERROR)
-            goto done;
-        err = dirty_sheet_add_row_dim(sheet, &session->row_dims[i]);
+    if (st.strings.added_count || st.string_refs) {
+        err = concat_sst_xml(&st, &sst, &sst_len);
+        if (err == LXLSX_NO_ERROR && !st.sst)
+            err = concat_add_sst(&st, sst, sst_len);
         if (err != LXLSX_NO_ERROR)
             goto done;
     }
 
-    /* Resolve number-format restyles into styles.xml (sets per-change style
-     * indices that the cell patcher below reads). */
-    err = inject_cell_styles(session, &styles_rep, &styles_produced);
+    err = composer_finalize(&st.composer, &additions, &add_count,
+                            &meta_reps, &meta_count);
     if (err != LXLSX_NO_ERROR)
         goto done;
 
-    /* Build new-sheet parts + their workbook/rels/content-type registrations
-     * onto the composer (shared with future add-image/chart compositions). */
-    err = prepare_new_sheets(session, &composer);
-    if (err != LXLSX_NO_ERROR)
+    replacements = (lxlsx_source_package_replacement *)
+        calloc(meta_count + 2, sizeof(*replacements));
+    if (!replacements) {
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
         goto done;
+    }
+    for (i = 0; i < meta_count; i++)
+        replacements[rep_count++] = meta_reps[i];
+    if (styles) {
+        replacements[rep_count].entry_index = (size_t)
+            lxlsx_source_package_find_first(st.base->package,
+                                            st.base->workbook->styles_path);
+        replacements[rep_count].data = (const unsigned char *)styles;
+        replacements[rep_count++].size = styles_len;
+    }
+    if (sst && st.sst) {
+        replacements[rep_count].entry_index = (size_t)
+            lxlsx_source_package_find_first(st.base->package,
+                                            st.base->workbook->sst_path);
+        replacements[rep_count].data = (const unsigned char *)sst;
+        replacements[rep_count++].size = sst_len;
+    }
 
-    /* Synthesise image + chart drawing parts. One drawing per worksheet holds
-     * both, so a sheet may mix images and charts; each records a <drawing> ref
-     * on its dirty sheet. */
-    {
-        size_t next_drawing =
-            max_existing_indexed(session, "xl/drawings/drawing") + 1;
-        err = prepare_drawings(session, &composer, &dirty_sheets, &dirty_count,
-                               &dirty_cap, &next_drawing);
+    err = save_package(st.base, out, NULL, replacements, rep_count, NULL, 0,
+                       additions, add_count);
+
+done:
+    for (i = 0; i < meta_count; i++)
+        free((void *)meta_reps[i].data);
+    free(meta_reps);
+    free(replacements);
+    free(additions);
+    free(styles);
+    free(sst);
+    concat_free(&st);
+    return err;
+}
+
+/*
+ * Sheet extraction: the output holds the parts reachable from the package
+ * root, except the other sheets and what only they reach. Kept parts are
+ * copied with their compressed bytes; only workbook.xml, its rels and
+ * [Content_Types].xml are rewritten.
+ */
+
+typedef struct {
+    lxlsx_source_package *package;
+    lxlsx_reader_workbook *workbook;
+    const lxlsx_reader_sheet_info *sheet;   /* the sheet extracted */
+    lxlsx_hash_table *keep;                 /* part names of the output */
+} lxlsx_extract;
+
+/* Whether a workbook relationship of this type is a sheet of any kind. */
+static int rel_type_is_sheet(const char *type, size_t type_len)
+{
+    return rel_type_is(type, type_len, "worksheet") ||
+           rel_type_is(type, type_len, "chartsheet") ||
+           rel_type_is(type, type_len, "dialogsheet") ||
+           rel_type_is(type, type_len, "xlMacrosheet") ||
+           rel_type_is(type, type_len, "xlIntlMacrosheet");
+}
+
+/* Whether a workbook relationship is left out of the output: the other
+ * sheets, the calculation chain (it lists their cells) and pivot caches
+ * (their pivot tables stay behind). */
+static int extract_drops_rel(const lxlsx_extract *st, const char *tag_start,
+                             const char *tag_end)
+{
+    const char *type;
+    size_t type_len;
+
+    if (!find_attr(tag_start, tag_end, "Type", &type, &type_len))
+        return 0;
+    if (rel_type_is_sheet(type, type_len))
+        return !st->sheet->rel_id ||
+               !attr_value_is(tag_start, tag_end, "Id", st->sheet->rel_id);
+    return rel_type_is(type, type_len, "calcChain") ||
+           rel_type_is(type, type_len, "pivotCacheDefinition");
+}
+
+/* Keep `part` and everything its rels reach. `rels_name` is its rels part. */
+static lxlsx_error extract_keep(lxlsx_extract *st, const char *part,
+                                const char *rels_name)
+{
+    unsigned char *rels = NULL;
+    size_t rels_len = 0;
+    const char *p, *limit;
+    lxlsx_edit_xml_tag tag;
+    int is_workbook = strcmp(part, st->workbook->workbook_path) == 0;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    if (*part) {
+        if (lxlsx_hash_key_exists(st->keep, (void *)part, strlen(part)) ||
+            lxlsx_source_package_find_first(st->package, part) < 0)
+            return LXLSX_NO_ERROR;
+        err = key_set_add(st->keep, part, strlen(part), NULL, NULL);
         if (err != LXLSX_NO_ERROR)
-            goto done;
+            return err;
     }
 
-    for (i = 0; i < dirty_count; i++) {
-        if (dirty_sheets[i].change_count > 0) {
-            err = patch_xml_with_changes(&dirty_sheets[i].xml,
-                                         &dirty_sheets[i].xml_len,
-                                         dirty_sheets[i].changes,
-                                         dirty_sheets[i].change_count);
-            if (err != LXLSX_NO_ERROR)
-                goto done;
+    err = read_part(st->package, rels_name, &rels, &rels_len);
+    if (err != LXLSX_NO_ERROR || !rels)
+        return err;
+    err = key_set_add(st->keep, rels_name, strlen(rels_name), NULL, NULL);
+
+    p = (const char *)rels;
+    limit = p + rels_len;
+    while (err == LXLSX_NO_ERROR && xml_next_tag(p, limit, &tag)) {
+        const char *target, *type;
+        size_t target_len, type_len;
+        char *target_copy, *child;
+        char child_rels[512];
+
+        p = tag.end + 1;
+        if (tag.is_end || !tag_name_is(&tag, "Relationship") ||
+            attr_value_is(tag.start, tag.end, "TargetMode", "External") ||
+            !find_attr(tag.start, tag.end, "Target", &target, &target_len))
+            continue;
+        if (is_workbook && extract_drops_rel(st, tag.start, tag.end))
+            continue;
+        if (find_attr(tag.start, tag.end, "Type", &type, &type_len) &&
+            rel_type_is(type, type_len, "pivotTable")) {
+            err = LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+            break;
         }
-        if (dirty_sheets[i].merge_count > 0) {
-            err = patch_xml_with_merges(&dirty_sheets[i].xml,
-                                        &dirty_sheets[i].xml_len,
-                                        dirty_sheets[i].merges,
-                                        dirty_sheets[i].merge_count);
-            if (err != LXLSX_NO_ERROR)
-                goto done;
+
+        target_copy = dup_range(target, target_len);
+        child = target_copy ? lxlsx_reader_zip_resolve_path(part, target_copy) : NULL;
+        free(target_copy);
+        if (!child) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            break;
         }
-        if (dirty_sheets[i].col_count > 0) {
-            err = patch_xml_with_cols(&dirty_sheets[i].xml,
-                                      &dirty_sheets[i].xml_len,
-                                      dirty_sheets[i].cols,
-                                      dirty_sheets[i].col_count);
-            if (err != LXLSX_NO_ERROR)
-                goto done;
+        if (derive_rels_path(child, child_rels, sizeof(child_rels)) == 0)
+            err = extract_keep(st, child, child_rels);
+        else if (!lxlsx_hash_key_exists(st->keep, child, strlen(child)) &&
+                 lxlsx_source_package_find_first(st->package, child) >= 0)
+            err = key_set_add(st->keep, child, strlen(child), NULL, NULL);
+        free(child);
+    }
+
+    free(rels);
+    return err;
+}
+
+/* Whether a formula refers to sheet `name` (as it is escaped in the XML),
+ * either as name! or as 'name'!. */
+static int formula_refers_to(const char *formula, size_t len, const char *name)
+{
+    size_t name_len = strlen(name);
+    size_t i;
+
+    for (i = 0; i + name_len < len; i++) {
+        char before = i ? formula[i - 1] : '=';
+
+        if (lxlsx_strncasecmp(formula + i, name, name_len) != 0)
+            continue;
+        if (formula[i + name_len] == '!' &&
+            !isalnum((unsigned char)before) && before != '_' &&
+            before != '.' && before != '\'')
+            return 1;
+        if (before == '\'' && formula[i + name_len] == '\'' &&
+            i + name_len + 1 < len && formula[i + name_len + 1] == '!')
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * workbook.xml with only the extracted <sheet>. Names scoped to the other
+ * sheets, or referring to them, are dropped; names scoped to the extracted
+ * one are rescoped to it. Pivot caches and the active tab go too.
+ */
+static lxlsx_error extract_workbook_xml(const lxlsx_extract *st,
+                                        const char *xml, size_t len,
+                                        lxlsx_edit_buf *out)
+{
+    const char *p = xml;
+    const char *limit = xml + len;
+    const char *copied = xml;
+    lxlsx_edit_xml_tag tag, close;
+    lxlsx_edit_buf *dropped = NULL;     /* names of the other sheets */
+    size_t dropped_count = 0, sheet_index = 0, i;
+    int found, position = -1;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    /* First pass: the position of the sheet and the names of the others. */
+    while (err == LXLSX_NO_ERROR && xml_next_tag(p, limit, &tag)) {
+        const char *name;
+        size_t name_len;
+
+        p = tag.end + 1;
+        if (tag.is_end || !tag_name_is(&tag, "sheet"))
+            continue;
+        if (st->sheet->rel_id &&
+            attr_value_is(tag.start, tag.end, "id", st->sheet->rel_id)) {
+            position = (int)sheet_index;
+        } else if (find_attr(tag.start, tag.end, "name", &name, &name_len)) {
+            lxlsx_edit_buf *next = (lxlsx_edit_buf *)
+                realloc(dropped, (dropped_count + 1) * sizeof(*next));
+            if (!next) {
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+                break;
+            }
+            dropped = next;
+            memset(&dropped[dropped_count], 0, sizeof(*dropped));
+            if (buf_append(&dropped[dropped_count++], name, name_len) != 0)
+                err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
         }
-        if (dirty_sheets[i].row_dim_count > 0) {
-            err = patch_xml_with_row_dims(&dirty_sheets[i].xml,
-                                          &dirty_sheets[i].xml_len,
-                                          dirty_sheets[i].row_dims,
-                                          dirty_sheets[i].row_dim_count);
-            if (err != LXLSX_NO_ERROR)
-                goto done;
+        sheet_index++;
+    }
+    if (err == LXLSX_NO_ERROR && position < 0)
+        err = LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    p = xml;
+    while (err == LXLSX_NO_ERROR && xml_next_tag(p, limit, &tag)) {
+        const char *skip_to = NULL;
+        int rewrite = 0;
+        lxlsx_concat_attr attrs[2];
+        size_t attr_count = 0;
+
+        p = tag.end + 1;
+        if (tag.is_end)
+            continue;
+
+        memset(attrs, 0, sizeof(attrs));
+        if (tag_name_is(&tag, "sheet")) {
+            if (!attr_value_is(tag.start, tag.end, "id", st->sheet->rel_id))
+                skip_to = p;
+            else {
+                /* A workbook's only sheet can't be hidden. */
+                attrs[attr_count++].name = "state";
+                rewrite = 1;
+            }
+        } else if (tag_name_is(&tag, "pivotCaches")) {
+            if (tag.is_self_closing)
+                skip_to = p;
+            else if (find_matching_end_tag(p, limit, "pivotCaches", &close))
+                skip_to = close.end + 1;
+        } else if (tag_name_is(&tag, "workbookView")) {
+            attrs[attr_count++].name = "activeTab";
+            attrs[attr_count++].name = "firstSheet";
+            rewrite = 1;
+        } else if (tag_name_is(&tag, "definedName")) {
+            size_t scope = attr_number(tag.start, tag.end, "localSheetId", &found);
+            const char *end = p;
+            int keep;
+
+            if (!tag.is_self_closing &&
+                find_matching_end_tag(p, limit, "definedName", &close))
+                end = close.start;
+            if (found) {
+                keep = scope == (size_t)position;
+            } else {
+                keep = 1;
+                for (i = 0; i < dropped_count && keep; i++)
+                    keep = !formula_refers_to(p, (size_t)(end - p),
+                                              dropped[i].data);
+            }
+            if (!keep) {
+                skip_to = end == p ? p : close.end + 1;
+            } else if (found) {
+                attrs[attr_count].name = "localSheetId";
+                attrs[attr_count++].text = "0";
+                rewrite = 1;
+            }
         }
-        if (dirty_sheets[i].has_drawing) {
-            err = patch_xml_with_drawing(&dirty_sheets[i].xml,
-                                         &dirty_sheets[i].xml_len,
-                                         dirty_sheets[i].drawing_rid);
-            if (err != LXLSX_NO_ERROR)
-                goto done;
+
+        if (!skip_to && !rewrite)
+            continue;
+        if (buf_append(out, copied, (size_t)(tag.start - copied)) != 0) {
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            break;
+        }
+        if (skip_to) {
+            copied = p = skip_to;
+            continue;
         }
+        if (append_tag_rewritten(out, tag.start, tag.end, attrs, attr_count) != 0)
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        copied = p;
     }
+    if (err == LXLSX_NO_ERROR &&
+        buf_append(out, copied, (size_t)(limit - copied)) != 0)
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
-    /* Turn the composer's accumulated parts/fragments into additions + one
-     * replacement per patched metadata part. */
-    err = composer_finalize(&composer, &additions, &add_count,
-                            &meta_reps, &meta_count);
+    for (i = 0; i < dropped_count; i++)
+        free(dropped[i].data);
+    free(dropped);
+    return err;
+}
+
+/* Copy xml without the <item> elements whose `attr` names a part that isn't
+ * kept: relationships (their targets resolved against `source`) or content
+ * type overrides (their part names absolute). */
+static lxlsx_error extract_filter_xml(const lxlsx_extract *st,
+                                      const char *xml, size_t len,
+                                      const char *item, const char *attr,
+                                      const char *source, lxlsx_edit_buf *out)
+{
+    const char *p = xml;
+    const char *limit = xml + len;
+    const char *copied = xml;
+    lxlsx_edit_xml_tag tag, close;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    while (err == LXLSX_NO_ERROR && xml_next_tag(p, limit, &tag)) {
+        const char *value;
+        size_t value_len;
+        char *name, *part;
+        int kept;
+
+        p = tag.end + 1;
+        if (tag.is_end || !tag_name_is(&tag, item) ||
+            attr_value_is(tag.start, tag.end, "TargetMode", "External") ||
+            !find_attr(tag.start, tag.end, attr, &value, &value_len))
+            continue;
+
+        name = dup_range(value, value_len);
+        part = !name ? NULL : source ? lxlsx_reader_zip_resolve_path(source, name)
+                                     : lxlsx_reader_zip_join_path("", name);
+        free(name);
+        if (!part)
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        kept = lxlsx_hash_key_exists(st->keep, part, strlen(part)) != NULL;
+        free(part);
+        if (kept)
+            continue;
+
+        if (buf_append(out, copied, (size_t)(tag.start - copied)) != 0)
+            err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        if (!tag.is_self_closing &&
+            find_matching_end_tag(p, limit, item, &close))
+            p = close.end + 1;
+        copied = p;
+    }
+    if (err == LXLSX_NO_ERROR &&
+        buf_append(out, copied, (size_t)(limit - copied)) != 0)
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    return err;
+}
+
+lxlsx_error lxlsx_edit_extract_sheet(const char *path, const char *sheet_name,
+                                     const char *out)
+{
+    /* The output is built from additions only, onto an empty archive. */
+    static const unsigned char empty_zip[22] = { 0x50, 0x4b, 0x05, 0x06 };
+    lxlsx_extract st;
+    lxlsx_source_package *empty = NULL;
+    lxlsx_source_package_addition *additions = NULL;
+    lxlsx_edit_buf *rewritten = NULL;
+    char rels_path[512];
+    size_t count, add_count = 0, i;
+    lxlsx_error err;
+
+    if (!path || !sheet_name || !out)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    /* Only the sheet list is read; the shared strings are copied as bytes. */
+    memset(&st, 0, sizeof(st));
+    err = open_source_ex(path, LXLSX_READER_SST_MODE_STREAMING, &st.package,
+                         &st.workbook);
     if (err != LXLSX_NO_ERROR)
+        return err;
+
+    for (i = 0; i < st.workbook->sheet_count && !st.sheet; i++) {
+        if (st.workbook->sheets[i].name &&
+            strcmp(st.workbook->sheets[i].name, sheet_name) == 0)
+            st.sheet = &st.workbook->sheets[i];
+    }
+    if (!st.sheet || !st.workbook->workbook_path) {
+        err = LXLSX_ERROR_WORKSHEET_INDEX_OUT_OF_RANGE;
         goto done;
+    }
 
-    replacements = (lxlsx_source_package_replacement *)calloc(
-        dirty_count + 1 + meta_count, sizeof(*replacements));
-    if (!replacements) {
+    st.keep = lxlsx_hash_new(128, 1, 0);
+    count = lxlsx_source_package_entry_count(st.package);
+    additions = (lxlsx_source_package_addition *)
+        calloc(count ? count : 1, sizeof(*additions));
+    rewritten = (lxlsx_edit_buf *)calloc(count ? count : 1, sizeof(*rewritten));
+    if (!st.keep || !additions || !rewritten) {
         err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
         goto done;
     }
 
-    for (i = 0; i < dirty_count; i++) {
-        replacements[i].entry_index = dirty_sheets[i].entry_index;
-        replacements[i].data = dirty_sheets[i].xml;
-        replacements[i].size = dirty_sheets[i].xml_len;
-    }
-    rep_count = dirty_count;
-    if (styles_produced) {
-        replacements[rep_count++] = styles_rep;
-    }
-    for (i = 0; i < meta_count; i++) {
-        replacements[rep_count++] = meta_reps[i];
+    err = extract_keep(&st, "", "_rels/.rels");
+    if (err == LXLSX_NO_ERROR)
+        err = key_set_add(st.keep, "[Content_Types].xml",
+                          strlen("[Content_Types].xml"), NULL, NULL);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+    if (derive_rels_path(st.workbook->workbook_path, rels_path,
+                         sizeof(rels_path)) != 0)
+        rels_path[0] = 0;
+
+    /* In package order; unchanged parts keep their compressed bytes. */
+    for (i = 0; i < count && err == LXLSX_NO_ERROR; i++) {
+        const lxlsx_source_package_entry_info *info =
+            lxlsx_source_package_entry_info_at(st.package, i);
+        lxlsx_source_package_addition *a = &additions[add_count];
+        unsigned char *xml = NULL;
+        size_t len = 0;
+        int is_workbook, is_rels, is_types;
+
+        if (!lxlsx_hash_key_exists(st.keep, (void *)info->name, info->name_len) ||
+            lxlsx_source_package_find_first(st.package, info->name) != (int)i)
+            continue;
+        a->name = info->name;
+
+        is_workbook = strcmp(info->name, st.workbook->workbook_path) == 0;
+        is_rels = strcmp(info->name, rels_path) == 0;
+        is_types = strcmp(info->name, "[Content_Types].xml") == 0;
+        if (!is_workbook && !is_rels && !is_types) {
+            a->source = st.package;
+            a->source_index = i;
+            add_count++;
+            continue;
+        }
+
+        err = lxlsx_source_package_read_entry(st.package, i, &xml, &len);
+        if (err != LXLSX_NO_ERROR)
+            break;
+        if (is_workbook)
+            err = extract_workbook_xml(&st, (const char *)xml, len,
+                                       &rewritten[i]);
+        else if (is_rels)
+            err = extract_filter_xml(&st, (const char *)xml, len,
+                                     "Relationship", "Target",
+                                     st.workbook->workbook_path, &rewritten[i]);
+        else
+            err = extract_filter_xml(&st, (const char *)xml, len,
+                                     "Override", "PartName", NULL,
+                                     &rewritten[i]);
+        free(xml);
+        a->data = (const unsigned char *)rewritten[i].data;
+        a->size = rewritten[i].len;
+        add_count++;
     }
 
-    err = lxlsx_source_package_save_with_changes(session->package, path,
-                                                 replacements, rep_count,
+    if (err == LXLSX_NO_ERROR)
+        err = lxlsx_source_package_open_memory(empty_zip, sizeof(empty_zip),
+                                               &empty);
+    if (err == LXLSX_NO_ERROR) {
+        template_forget(out);
+        err = lxlsx_source_package_save_streamed(empty, out, NULL, 0, NULL, 0,
                                                  additions, add_count);
+    }
 
 done:
-    free(replacements);
-    free((void *)styles_rep.data);
-    for (i = 0; i < meta_count; i++)
-        free((void *)meta_reps[i].data);
-    free(meta_reps);
+    if (rewritten) {
+        for (i = 0; i < count; i++)
+            free(rewritten[i].data);
+    }
+    free(rewritten);
     free(additions);
-    composer_free(&composer);
-    free_dirty_sheets(dirty_sheets, dirty_count);
+    lxlsx_hash_free(st.keep);
+    if (empty)
+        lxlsx_source_package_close(empty);
+    lxlsx_reader_workbook_close(st.workbook);
+    lxlsx_source_package_close(st.package);
     return err;
 }
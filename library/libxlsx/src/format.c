@@ -164,6 +164,26 @@ mem_error:
     return NULL;
 }
 
+/*
+ * Returns a format struct suitable for hashing as a lookup key when formats
+ * are interned by content: the properties only, without the file handle or
+ * any index already assigned.
+ */
+lxlsx_format *
+lxlsx_format_get_intern_key(lxlsx_format *self)
+{
+    lxlsx_format *key = _get_format_key(self);
+
+    if (!key)
+        return NULL;
+
+    key->file = NULL;
+    key->xf_index = LXLSX_PROPERTY_UNSET;
+    key->dxf_index = LXLSX_PROPERTY_UNSET;
+
+    return key;
+}
+
 /*
  * Returns a font struct suitable for hashing as a lookup key.
  */
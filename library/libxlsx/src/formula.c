@@ -13,8 +13,16 @@
 #include <string.h>
 
 #include "libxlsx/formula.h"
+#include "libxlsx/hash_table.h"
 #include "libxlsx/utility.h"
 
+/* Sheet bounds, as LXLSX_ROW_MAX/LXLSX_COL_MAX in worksheet.h. */
+#define FORMULA_ROW_MAX 1048576
+#define FORMULA_COL_MAX 16384
+
+/* Marks a reference in a cache key, it can't appear in a formula we cache. */
+#define FORMULA_KEY_REF '\x01'
+
 /* ===================================================================== *
  * Value helpers
  * ===================================================================== */
@@ -103,6 +111,8 @@ typedef struct {
     size_t pos, n;
     tok cur;
     int failed;     /* parse error */
+    lxlsx_row_t anchor_row;  /* cell the formula is compiled for */
+    lxlsx_col_t anchor_col;
 } pstate;
 
 static int is_idstart(char c) {
@@ -219,17 +229,50 @@ typedef enum {
     N_NUM, N_STR, N_BOOL, N_ERR, N_REF, N_RANGE, N_UNARY, N_BINARY, N_FUNC, N_NAME
 } node_kind;
 
+/* Relative parts of a reference, stored as offsets from the anchor cell. */
+#define REL_ROW 0x1
+#define REL_COL 0x2
+
+/* Supported functions, resolved from the name once at parse time. */
+typedef enum {
+    F_UNKNOWN = 0,
+    F_ABS, F_AND, F_AVERAGE, F_CONCAT, F_CONCATENATE, F_COUNT,
+    F_COUNTA, F_IF, F_IFERROR, F_INT, F_LEFT, F_LEN,
+    F_LOWER, F_MAX, F_MID, F_MIN, F_MOD, F_NOT,
+    F_OR, F_POWER, F_RIGHT, F_ROUND, F_ROUNDDOWN, F_ROUNDUP,
+    F_SQRT, F_SUM, F_TRIM, F_UPPER
+} func_id;
+
+static const char *const func_names[] = {
+    NULL,
+    "ABS", "AND", "AVERAGE", "CONCAT", "CONCATENATE", "COUNT",
+    "COUNTA", "IF", "IFERROR", "INT", "LEFT", "LEN",
+    "LOWER", "MAX", "MID", "MIN", "MOD", "NOT",
+    "OR", "POWER", "RIGHT", "ROUND", "ROUNDDOWN", "ROUNDUP",
+    "SQRT", "SUM", "TRIM", "UPPER"
+};
+
+static func_id func_lookup(const char *name)
+{
+    size_t i;
+    for (i = 1; i < sizeof(func_names) / sizeof(func_names[0]); i++)
+        if (lxlsx_strcasecmp(name, func_names[i]) == 0) return (func_id)i;
+    return F_UNKNOWN;
+}
+
 typedef struct node {
     node_kind kind;
     double num;
     char *str;
     int boolean;
     lxlsx_formula_error err;
-    lxlsx_row_t row, row2;
-    lxlsx_col_t col, col2;
+    int32_t row, row2;      /* 0-based, or an offset when relative */
+    int32_t col, col2;
+    uint8_t rel, rel2;      /* REL_* flags of the first and second corner */
     char op[3];
     struct node *a, *b;
     char *fname;
+    func_id fid;
     struct node **args;
     int nargs;
 } node;
@@ -254,8 +297,10 @@ static void node_free(node *n)
     free(n);
 }
 
-/* Parse "A1" / "$A$1" / "Sheet1!A1" into 0-based row/col. Returns 1 on success. */
-static int parse_ref(const char *s, size_t len, lxlsx_row_t *row, lxlsx_col_t *col)
+/* Parse "A1" / "$A$1" / "Sheet1!A1" into 0-based row/col and the REL_* flags
+ * of the parts without a '$'. Returns 1 on success. */
+static int parse_ref(const char *s, size_t len, lxlsx_row_t *row, lxlsx_col_t *col,
+                     uint8_t *rel)
 {
     size_t i = 0;
     /* drop sheet qualifier */
@@ -263,7 +308,8 @@ static int parse_ref(const char *s, size_t len, lxlsx_row_t *row, lxlsx_col_t *c
     if (bang) { size_t off = (size_t)(bang - s) + 1; s += off; len -= off; }
 
     unsigned long c = 0; int have_col = 0;
-    if (i < len && s[i] == '$') i++;
+    *rel = REL_ROW | REL_COL;
+    if (i < len && s[i] == '$') { *rel &= (uint8_t)~REL_COL; i++; }
     while (i < len) {
         char ch = s[i];
         if (ch >= 'a' && ch <= 'z') ch = (char)(ch - 'a' + 'A');
@@ -271,11 +317,11 @@ static int parse_ref(const char *s, size_t len, lxlsx_row_t *row, lxlsx_col_t *c
         else break;
     }
     if (!have_col) return 0;
-    if (i < len && s[i] == '$') i++;
+    if (i < len && s[i] == '$') { *rel &= (uint8_t)~REL_ROW; i++; }
     unsigned long r = 0; int have_row = 0;
     while (i < len && s[i] >= '0' && s[i] <= '9') { r = r * 10 + (unsigned long)(s[i] - '0'); have_row = 1; i++; }
     if (!have_row || i != len) return 0;
-    if (c == 0 || r == 0) return 0;
+    if (c == 0 || r == 0 || c > FORMULA_COL_MAX || r > FORMULA_ROW_MAX) return 0;
     *col = (lxlsx_col_t)(c - 1);
     *row = (lxlsx_row_t)(r - 1);
     return 1;
@@ -346,14 +392,18 @@ static node *parse_atom(pstate *p)
             fn->fname = malloc(len + 1);
             if (!fn->fname) { node_free(fn); p->failed = 1; return NULL; }
             memcpy(fn->fname, s, len); fn->fname[len] = '\0';
+            fn->fid = func_lookup(fn->fname);
             return parse_args(p, fn);
         }
         /* not a call: restore and treat as ref or name */
         *p = save;
-        lxlsx_row_t row; lxlsx_col_t col;
-        if (parse_ref(s, len, &row, &col)) {
+        lxlsx_row_t row; lxlsx_col_t col; uint8_t rel;
+        if (parse_ref(s, len, &row, &col, &rel)) {
             node *n = node_new(N_REF); if (!n) { p->failed = 1; return NULL; }
-            n->row = row; n->col = col; lex_next(p); return n;
+            n->rel = rel;
+            n->row = (int32_t)row - ((rel & REL_ROW) ? (int32_t)p->anchor_row : 0);
+            n->col = (int32_t)col - ((rel & REL_COL) ? (int32_t)p->anchor_col : 0);
+            lex_next(p); return n;
         }
         node *n = node_new(N_NAME); if (!n) { p->failed = 1; return NULL; }
         lex_next(p); return n;  /* unknown name -> #NAME? at eval */
@@ -371,8 +421,8 @@ static node *parse_range(pstate *p)
         if (right && right->kind == N_REF) {
             node *rng = node_new(N_RANGE);
             if (!rng) { node_free(left); node_free(right); p->failed = 1; return NULL; }
-            rng->row = left->row; rng->col = left->col;
-            rng->row2 = right->row; rng->col2 = right->col;
+            rng->row = left->row; rng->col = left->col; rng->rel = left->rel;
+            rng->row2 = right->row; rng->col2 = right->col; rng->rel2 = right->rel;
             node_free(left); node_free(right);
             return rng;
         }
@@ -456,7 +506,10 @@ static node *parse_expr(pstate *p)
 
 typedef struct {
     lxlsx_formula_resolver resolver;
+    lxlsx_formula_range_resolver range_resolver;
     void *ctx;
+    lxlsx_row_t anchor_row;  /* cell the formula is evaluated for */
+    lxlsx_col_t anchor_col;
 } ev;
 
 static lxlsx_value eval(ev *e, node *n);
@@ -516,6 +569,27 @@ static lxlsx_value resolve_cell(ev *e, lxlsx_row_t row, lxlsx_col_t col)
     return out;
 }
 
+/* Bind a compiled reference to the anchor cell. Returns 0 if it falls off the
+ * sheet, which is a #REF! in Excel. */
+static int bind_ref(ev *e, int32_t row, int32_t col, uint8_t rel,
+                    lxlsx_row_t *out_row, lxlsx_col_t *out_col)
+{
+    int64_t r = (int64_t)row + ((rel & REL_ROW) ? (int64_t)e->anchor_row : 0);
+    int64_t c = (int64_t)col + ((rel & REL_COL) ? (int64_t)e->anchor_col : 0);
+    if (r < 0 || r >= FORMULA_ROW_MAX || c < 0 || c >= FORMULA_COL_MAX) return 0;
+    *out_row = (lxlsx_row_t)r;
+    *out_col = (lxlsx_col_t)c;
+    return 1;
+}
+
+static lxlsx_value resolve_ref(ev *e, int32_t row, int32_t col, uint8_t rel)
+{
+    lxlsx_row_t r;
+    lxlsx_col_t c;
+    if (!bind_ref(e, row, col, rel, &r, &c)) return val_error(LXLSX_FERR_REF);
+    return resolve_cell(e, r, c);
+}
+
 /* Iterate a range, calling cb for each cell value (cb takes ownership-free
  * borrow; the value is freed by the iterator). Stops early if cb returns 0. */
 typedef int (*range_cb)(void *acc, const lxlsx_value *v);
@@ -524,8 +598,14 @@ static void iterate_range(ev *e, node *n, range_cb cb, void *acc)
 {
     lxlsx_row_t r;
     lxlsx_col_t c;
-    lxlsx_row_t r1 = n->row, r2 = n->row2;
-    lxlsx_col_t c1 = n->col, c2 = n->col2;
+    lxlsx_row_t r1, r2;
+    lxlsx_col_t c1, c2;
+    if (!bind_ref(e, n->row, n->col, n->rel, &r1, &c1) ||
+        !bind_ref(e, n->row2, n->col2, n->rel2, &r2, &c2)) {
+        lxlsx_value v = val_error(LXLSX_FERR_REF);
+        cb(acc, &v);
+        return;
+    }
     if (r1 > r2) { lxlsx_row_t t = r1; r1 = r2; r2 = t; }
     if (c1 > c2) { lxlsx_col_t t = c1; c1 = c2; c2 = t; }
     for (r = r1; r <= r2; r++) {
@@ -557,12 +637,70 @@ static int agg_cb(void *a, const lxlsx_value *v)
     return 1;
 }
 
+struct lxlsx_range_sink {
+    agg *g;
+};
+
+int lxlsx_range_sink_numbers(lxlsx_range_sink *sink, const double *numbers,
+                             size_t count)
+{
+    agg *g = sink->g;
+    double sum, minv, maxv;
+    size_t i;
+
+    if (g->err) return 0;
+    if (count == 0) return 1;
+
+    if (!g->has) { g->minv = g->maxv = numbers[0]; g->has = 1; }
+    sum = g->sum; minv = g->minv; maxv = g->maxv;
+
+    /* Branch-free so the min/max reduction can be vectorized. */
+    for (i = 0; i < count; i++) {
+        double d = numbers[i];
+        sum += d;
+        minv = d < minv ? d : minv;
+        maxv = d > maxv ? d : maxv;
+    }
+
+    g->sum = sum; g->minv = minv; g->maxv = maxv;
+    g->count += (long)count;
+    g->counta += (long)count;
+    return 1;
+}
+
+int lxlsx_range_sink_value(lxlsx_range_sink *sink, const lxlsx_value *value)
+{
+    if (sink->g->err) return 0;
+    return agg_cb(sink->g, value);
+}
+
+/* Feed a range into an aggregate, in bulk when the caller can walk ranges. */
+static void agg_range(ev *e, node *n, agg *g)
+{
+    lxlsx_range_sink sink;
+    lxlsx_row_t r1, r2;
+    lxlsx_col_t c1, c2;
+
+    if (!e->range_resolver) { iterate_range(e, n, agg_cb, g); return; }
+
+    if (!bind_ref(e, n->row, n->col, n->rel, &r1, &c1) ||
+        !bind_ref(e, n->row2, n->col2, n->rel2, &r2, &c2)) {
+        g->err = LXLSX_FERR_REF;
+        return;
+    }
+    if (r1 > r2) { lxlsx_row_t t = r1; r1 = r2; r2 = t; }
+    if (c1 > c2) { lxlsx_col_t t = c1; c1 = c2; c2 = t; }
+
+    sink.g = g;
+    e->range_resolver(e->ctx, r1, c1, r2, c2, &sink);
+}
+
 /* Feed one argument node into an aggregate: ranges iterate, scalars count once
  * (scalars DO coerce text/bool to number for SUM, per Excel direct-arg rules). */
 static void agg_feed(ev *e, node *arg, agg *g, int numeric_scalar)
 {
     if (g->err) return;
-    if (arg->kind == N_RANGE) { iterate_range(e, arg, agg_cb, g); return; }
+    if (arg->kind == N_RANGE) { agg_range(e, arg, g); return; }
     lxlsx_value v = eval(e, arg);
     if (v.kind == LXLSX_VAL_ERROR) { g->err = v.error; lxlsx_value_free(&v); return; }
     if (v.kind != LXLSX_VAL_BLANK) g->counta++;
@@ -584,35 +722,30 @@ static void agg_feed(ev *e, node *arg, agg *g, int numeric_scalar)
     lxlsx_value_free(&v);
 }
 
-static int streq_ci(const char *a, const char *b)
-{
-    return lxlsx_strcasecmp(a, b) == 0;
-}
-
 /* Evaluate function call. */
 static lxlsx_value eval_func(ev *e, node *n)
 {
-    const char *fn = n->fname;
+    func_id fid = n->fid;
     int i;
 
     /* Aggregates over args/ranges. */
-    if (streq_ci(fn, "SUM") || streq_ci(fn, "AVERAGE") || streq_ci(fn, "MIN") ||
-        streq_ci(fn, "MAX") || streq_ci(fn, "COUNT") || streq_ci(fn, "COUNTA")) {
+    if (fid == F_SUM || fid == F_AVERAGE || fid == F_MIN ||
+        fid == F_MAX || fid == F_COUNT || fid == F_COUNTA) {
         agg g; memset(&g, 0, sizeof(g));
-        int numeric_scalar = !streq_ci(fn, "COUNT") && !streq_ci(fn, "COUNTA");
+        int numeric_scalar = fid != F_COUNT && fid != F_COUNTA;
         for (i = 0; i < n->nargs; i++) agg_feed(e, n->args[i], &g, numeric_scalar);
         if (g.err) return val_error(g.err);
-        if (streq_ci(fn, "SUM")) return val_number(g.sum);
-        if (streq_ci(fn, "COUNT")) return val_number((double)g.count);
-        if (streq_ci(fn, "COUNTA")) return val_number((double)g.counta);
-        if (streq_ci(fn, "AVERAGE"))
+        if (fid == F_SUM) return val_number(g.sum);
+        if (fid == F_COUNT) return val_number((double)g.count);
+        if (fid == F_COUNTA) return val_number((double)g.counta);
+        if (fid == F_AVERAGE)
             return g.count ? val_number(g.sum / (double)g.count) : val_error(LXLSX_FERR_DIV0);
-        if (streq_ci(fn, "MIN")) return val_number(g.has ? g.minv : 0.0);
-        if (streq_ci(fn, "MAX")) return val_number(g.has ? g.maxv : 0.0);
+        if (fid == F_MIN) return val_number(g.has ? g.minv : 0.0);
+        if (fid == F_MAX) return val_number(g.has ? g.maxv : 0.0);
     }
 
     /* IF(cond, a, [b]) */
-    if (streq_ci(fn, "IF")) {
+    if (fid == F_IF) {
         if (n->nargs < 2) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value c = eval(e, n->args[0]);
         if (value_is_error(&c)) return c;
@@ -623,7 +756,7 @@ static lxlsx_value eval_func(ev *e, node *n)
         if (n->nargs >= 3) return eval(e, n->args[2]);
         return val_bool(0);
     }
-    if (streq_ci(fn, "IFERROR")) {
+    if (fid == F_IFERROR) {
         if (n->nargs < 2) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value v = eval(e, n->args[0]);
         if (value_is_error(&v)) { lxlsx_value_free(&v); return eval(e, n->args[1]); }
@@ -631,8 +764,8 @@ static lxlsx_value eval_func(ev *e, node *n)
     }
 
     /* Logical AND/OR/NOT */
-    if (streq_ci(fn, "AND") || streq_ci(fn, "OR")) {
-        int is_and = streq_ci(fn, "AND");
+    if (fid == F_AND || fid == F_OR) {
+        int is_and = fid == F_AND;
         int result = is_and ? 1 : 0;
         for (i = 0; i < n->nargs; i++) {
             lxlsx_value v = eval(e, n->args[i]);
@@ -645,7 +778,7 @@ static lxlsx_value eval_func(ev *e, node *n)
         }
         return val_bool(result);
     }
-    if (streq_ci(fn, "NOT")) {
+    if (fid == F_NOT) {
         if (n->nargs != 1) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value v = eval(e, n->args[0]);
         if (value_is_error(&v)) return v;
@@ -656,17 +789,17 @@ static lxlsx_value eval_func(ev *e, node *n)
     }
 
     /* Single-number math functions */
-    if (streq_ci(fn, "ABS") || streq_ci(fn, "INT") || streq_ci(fn, "SQRT") ||
-        streq_ci(fn, "ROUND") || streq_ci(fn, "ROUNDUP") || streq_ci(fn, "ROUNDDOWN") ||
-        streq_ci(fn, "MOD") || streq_ci(fn, "POWER")) {
+    if (fid == F_ABS || fid == F_INT || fid == F_SQRT ||
+        fid == F_ROUND || fid == F_ROUNDUP || fid == F_ROUNDDOWN ||
+        fid == F_MOD || fid == F_POWER) {
         if (n->nargs < 1) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value a = eval(e, n->args[0]);
         if (value_is_error(&a)) return a;
         lxlsx_formula_error er; double x = to_number(&a, &er); lxlsx_value_free(&a);
         if (er) return val_error(er);
-        if (streq_ci(fn, "ABS")) return val_number(fabs(x));
-        if (streq_ci(fn, "INT")) return val_number(floor(x));
-        if (streq_ci(fn, "SQRT")) return x < 0 ? val_error(LXLSX_FERR_NUM) : val_number(sqrt(x));
+        if (fid == F_ABS) return val_number(fabs(x));
+        if (fid == F_INT) return val_number(floor(x));
+        if (fid == F_SQRT) return x < 0 ? val_error(LXLSX_FERR_NUM) : val_number(sqrt(x));
         double y = 0.0;
         if (n->nargs >= 2) {
             lxlsx_value b = eval(e, n->args[1]);
@@ -674,21 +807,21 @@ static lxlsx_value eval_func(ev *e, node *n)
             y = to_number(&b, &er); lxlsx_value_free(&b);
             if (er) return val_error(er);
         }
-        if (streq_ci(fn, "POWER")) return val_number(pow(x, y));
-        if (streq_ci(fn, "MOD")) {
+        if (fid == F_POWER) return val_number(pow(x, y));
+        if (fid == F_MOD) {
             if (y == 0.0) return val_error(LXLSX_FERR_DIV0);
             double m = fmod(x, y); if (m != 0.0 && ((m < 0) != (y < 0))) m += y;
             return val_number(m);
         }
         /* ROUND family: y = digits */
         double f = pow(10.0, y);
-        if (streq_ci(fn, "ROUND"))     return val_number(round(x * f) / f);
-        if (streq_ci(fn, "ROUNDUP"))   return val_number((x < 0 ? floor(x * f) : ceil(x * f)) / f);
-        if (streq_ci(fn, "ROUNDDOWN")) return val_number((x < 0 ? ceil(x * f) : floor(x * f)) / f);
+        if (fid == F_ROUND)     return val_number(round(x * f) / f);
+        if (fid == F_ROUNDUP)   return val_number((x < 0 ? floor(x * f) : ceil(x * f)) / f);
+        if (fid == F_ROUNDDOWN) return val_number((x < 0 ? ceil(x * f) : floor(x * f)) / f);
     }
 
     /* Text functions */
-    if (streq_ci(fn, "CONCATENATE") || streq_ci(fn, "CONCAT")) {
+    if (fid == F_CONCATENATE || fid == F_CONCAT) {
         size_t cap = 16, len = 0; char *buf = malloc(cap);
         if (!buf) return val_error(LXLSX_FERR_VALUE);
         buf[0] = '\0';
@@ -703,7 +836,7 @@ static lxlsx_value eval_func(ev *e, node *n)
         }
         return val_string_take(buf);
     }
-    if (streq_ci(fn, "LEN")) {
+    if (fid == F_LEN) {
         if (n->nargs != 1) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value v = eval(e, n->args[0]);
         if (value_is_error(&v)) return v;
@@ -711,14 +844,14 @@ static lxlsx_value eval_func(ev *e, node *n)
         double l = s ? (double)strlen(s) : 0; free(s);
         return val_number(l);
     }
-    if (streq_ci(fn, "UPPER") || streq_ci(fn, "LOWER") || streq_ci(fn, "TRIM")) {
+    if (fid == F_UPPER || fid == F_LOWER || fid == F_TRIM) {
         if (n->nargs != 1) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value v = eval(e, n->args[0]);
         if (value_is_error(&v)) return v;
         char *s = to_string(&v); lxlsx_value_free(&v);
         if (!s) return val_error(LXLSX_FERR_VALUE);
-        if (streq_ci(fn, "UPPER")) { char *q = s; for (; *q; q++) *q = (char)toupper((unsigned char)*q); }
-        else if (streq_ci(fn, "LOWER")) { char *q = s; for (; *q; q++) *q = (char)tolower((unsigned char)*q); }
+        if (fid == F_UPPER) { char *q = s; for (; *q; q++) *q = (char)toupper((unsigned char)*q); }
+        else if (fid == F_LOWER) { char *q = s; for (; *q; q++) *q = (char)tolower((unsigned char)*q); }
         else { /* TRIM: collapse runs of spaces, strip ends */
             char *r = s, *w = s; int sp = 1;
             for (; *r; r++) { if (*r == ' ') { if (!sp) { *w++ = ' '; sp = 1; } }
@@ -727,7 +860,7 @@ static lxlsx_value eval_func(ev *e, node *n)
         }
         return val_string_take(s);
     }
-    if (streq_ci(fn, "LEFT") || streq_ci(fn, "RIGHT")) {
+    if (fid == F_LEFT || fid == F_RIGHT) {
         if (n->nargs < 1) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value v = eval(e, n->args[0]);
         if (value_is_error(&v)) return v;
@@ -742,12 +875,12 @@ static lxlsx_value eval_func(ev *e, node *n)
         if (k < 0) { free(s); return val_error(LXLSX_FERR_VALUE); }
         if (k > sl) k = sl;
         lxlsx_value out;
-        if (streq_ci(fn, "LEFT")) out = val_string_copy(s, (size_t)k);
+        if (fid == F_LEFT) out = val_string_copy(s, (size_t)k);
         else out = val_string_copy(s + (sl - k), (size_t)k);
         free(s);
         return out;
     }
-    if (streq_ci(fn, "MID")) {
+    if (fid == F_MID) {
         if (n->nargs != 3) return val_error(LXLSX_FERR_VALUE);
         lxlsx_value v = eval(e, n->args[0]);
         if (value_is_error(&v)) return v;
@@ -780,10 +913,10 @@ static lxlsx_value eval(ev *e, node *n)
     case N_BOOL: return val_bool(n->boolean);
     case N_ERR:  return val_error(n->err);
     case N_NAME: return val_error(LXLSX_FERR_NAME);
-    case N_REF:  return resolve_cell(e, n->row, n->col);
+    case N_REF:  return resolve_ref(e, n->row, n->col, n->rel);
     case N_RANGE: {
         /* A bare range used as a scalar resolves to its top-left cell. */
-        return resolve_cell(e, n->row, n->col);
+        return resolve_ref(e, n->row, n->col, n->rel);
     }
     case N_FUNC: return eval_func(e, n);
     case N_UNARY: {
@@ -862,41 +995,609 @@ static lxlsx_value eval(ev *e, node *n)
 }
 
 /* ===================================================================== *
- * Public entry
+ * Compilation and the compiled-formula cache
  * ===================================================================== */
 
-lxlsx_error lxlsx_formula_eval(const char *formula,
-                               lxlsx_formula_resolver resolver, void *ctx,
-                               lxlsx_value *out)
+/* Parse a formula (without the leading '=') for the given anchor cell. A
+ * formula that doesn't parse compiles to #NAME?. Returns NULL on OOM. */
+static node *compile(const char *formula, size_t n,
+                     lxlsx_row_t row, lxlsx_col_t col)
 {
     pstate p;
-    ev e;
     node *root;
 
-    if (!formula || !out)
-        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
-
-    *out = val_blank();
-
-    /* Skip a leading '=' if present. */
-    if (*formula == '=') formula++;
-
     p.src = formula;
     p.pos = 0;
-    p.n = strlen(formula);
+    p.n = n;
     p.failed = 0;
+    p.anchor_row = row;
+    p.anchor_col = col;
     lex_next(&p);
 
     root = parse_expr(&p);
     if (!root || p.failed || p.cur.kind != TK_END) {
         node_free(root);
-        *out = val_error(LXLSX_FERR_NAME);  /* unparseable -> surfaced in-band */
-        return LXLSX_NO_ERROR;
+        root = node_new(N_ERR);
+        if (root) root->err = LXLSX_FERR_NAME;  /* surfaced in-band */
+    }
+    return root;
+}
+
+/* Append a decimal integer; key building is on the per-cell path, so this
+ * avoids the cost of sprintf(). */
+static size_t key_int(char *out, long v)
+{
+    char tmp[24];
+    size_t len = 0, i = 0;
+    unsigned long u = v < 0 ? (unsigned long)(-v) : (unsigned long)v;
+    if (v < 0) out[len++] = '-';
+    do { tmp[i++] = (char)('0' + u % 10); u /= 10; } while (u);
+    while (i) out[len++] = tmp[--i];
+    return len;
+}
+
+/* Append the R1C1 form of a reference relative to the anchor cell. */
+static size_t key_ref(char *out, lxlsx_row_t row, lxlsx_col_t col, uint8_t rel,
+                      lxlsx_row_t anchor_row, lxlsx_col_t anchor_col)
+{
+    size_t len = 0;
+    out[len++] = FORMULA_KEY_REF;
+    out[len++] = 'R';
+    if (rel & REL_ROW) {
+        out[len++] = '[';
+        len += key_int(out + len, (long)row - (long)anchor_row);
+        out[len++] = ']';
+    }
+    else {
+        len += key_int(out + len, (long)row + 1);
+    }
+    out[len++] = 'C';
+    if (rel & REL_COL) {
+        out[len++] = '[';
+        len += key_int(out + len, (long)col - (long)anchor_col);
+        out[len++] = ']';
+    }
+    else {
+        len += key_int(out + len, (long)col + 1);
+    }
+    return len;
+}
+
+/* Longest key_ref() output: "\1R[-1048575]C[-16383]". */
+#define KEY_REF_MAX 24
+
+/* Make room for more bytes past len in a key that starts out in the caller's
+ * buf and moves to a growing malloc'd buffer once it outgrows it. */
+static int key_reserve(char **key, size_t *cap, const char *buf, size_t len,
+                       size_t more)
+{
+    size_t want = *cap;
+    char *grown;
+
+    if (len + more <= *cap)
+        return 1;
+
+    while (want < len + more)
+        want *= 2;
+    if (*key == buf) {
+        grown = malloc(want);
+        if (grown) memcpy(grown, *key, len);
+    }
+    else {
+        grown = realloc(*key, want);
+    }
+    if (!grown)
+        return 0;
+
+    *key = grown;
+    *cap = want;
+    return 1;
+}
+
+/*
+ * Build the cache key of a formula: its text with every cell reference
+ * rewritten in R1C1 form relative to the anchor cell, so B2*C2 in D2 and
+ * B3*C3 in D3 share a key and a compiled formula. Uses the parser's lexer so
+ * that names, function names and string literals are never rewritten. The
+ * key is written to buf (cap bytes) while it fits, and grown into a malloc'd
+ * buffer otherwise.
+ */
+static char *cache_key(const char *formula, size_t n, lxlsx_row_t row,
+                       lxlsx_col_t col, char *buf, size_t cap, size_t *key_len)
+{
+    char *key = buf;
+    size_t len = 0, copied = 0;
+    pstate p;
+
+    memset(&p, 0, sizeof(p));
+    p.src = formula;
+    p.n = n;
+    lex_next(&p);
+
+    while (p.cur.kind != TK_END) {
+        if (p.cur.kind == TK_NAME) {
+            const char *s = p.cur.start;
+            size_t slen = p.cur.len;
+            lxlsx_row_t r; lxlsx_col_t c; uint8_t rel;
+            lex_next(&p);
+            if (p.cur.kind != TK_LPAREN && parse_ref(s, slen, &r, &c, &rel)) {
+                const char *bang = memchr(s, '!', slen);
+                size_t upto = (size_t)((bang ? bang + 1 : s) - formula);
+                if (!key_reserve(&key, &cap, buf, len,
+                                 upto - copied + KEY_REF_MAX))
+                    goto fail;
+                memcpy(key + len, formula + copied, upto - copied);
+                len += upto - copied;
+                len += key_ref(key + len, r, c, rel, row, col);
+                copied = (size_t)(s + slen - formula);
+            }
+            continue;
+        }
+        lex_next(&p);
+    }
+
+    if (!key_reserve(&key, &cap, buf, len, n - copied + 1))
+        goto fail;
+    memcpy(key + len, formula + copied, n - copied);
+    len += n - copied;
+    key[len] = '\0';
+    *key_len = len;
+    return key;
+
+fail:
+    if (key != buf) free(key);
+    return NULL;
+}
+
+lxlsx_formula_cache *lxlsx_formula_cache_new(uint32_t max_entries)
+{
+    lxlsx_formula_cache *cache = calloc(1, sizeof(lxlsx_formula_cache));
+    if (!cache) return NULL;
+
+    cache->max_entries = max_entries ? max_entries
+                                     : LXLSX_FORMULA_CACHE_DEFAULT_ENTRIES;
+    cache->compiled = lxlsx_hash_new(128, 1, 0);
+    if (!cache->compiled) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/* Free the compiled formulas and the table holding them. */
+static void cache_drop(lxlsx_formula_cache *cache)
+{
+    lxlsx_hash_element *element;
+
+    if (!cache->compiled) return;
+
+    LXLSX_FOREACH_ORDERED(element, cache->compiled) {
+        node_free(element->value);
     }
+    lxlsx_hash_free(cache->compiled);
+    cache->compiled = NULL;
+    cache->entries = 0;
+}
+
+void lxlsx_formula_cache_free(lxlsx_formula_cache *cache)
+{
+    if (!cache) return;
+
+    cache_drop(cache);
+    free(cache);
+}
+
+/* Look up or compile the formula for the anchor cell. *owned is set when the
+ * result isn't held by the cache and must be freed by the caller. */
+static node *cache_fetch(lxlsx_formula_cache *cache, const char *formula,
+                         size_t n, lxlsx_row_t row, lxlsx_col_t col, int *owned)
+{
+    char buf[256];
+    char *key;
+    size_t key_len;
+    lxlsx_hash_element *element;
+    node *root;
+
+    *owned = 1;
+    if (!cache || !cache->compiled || memchr(formula, FORMULA_KEY_REF, n))
+        return compile(formula, n, row, col);
+
+    key = cache_key(formula, n, row, col, buf, sizeof(buf), &key_len);
+    if (!key)
+        return compile(formula, n, row, col);
+
+    element = lxlsx_hash_key_exists(cache->compiled, key, key_len);
+    if (element) {
+        cache->hits++;
+        if (key != buf) free(key);
+        *owned = 0;
+        return element->value;
+    }
+
+    cache->misses++;
+    root = compile(formula, n, row, col);
+    if (!root) {
+        if (key != buf) free(key);
+        return NULL;
+    }
+
+    /* Full: start over rather than track recency on every hit. */
+    if (cache->entries >= cache->max_entries) {
+        cache_drop(cache);
+        cache->compiled = lxlsx_hash_new(128, 1, 0);
+    }
+
+    if (key == buf) key = lxlsx_strdup(buf);
+    if (cache->compiled && key &&
+        lxlsx_insert_hash_element(cache->compiled, key, root, key_len)) {
+        cache->entries++;
+        *owned = 0;
+    }
+    else {
+        free(key);
+    }
+    return root;
+}
+
+/* ===================================================================== *
+ * Public entry
+ * ===================================================================== */
+
+lxlsx_error lxlsx_formula_eval_at(lxlsx_formula_cache *cache,
+                                  const char *formula,
+                                  lxlsx_row_t row, lxlsx_col_t col,
+                                  lxlsx_formula_resolver resolver,
+                                  lxlsx_formula_range_resolver range_resolver,
+                                  void *ctx, lxlsx_value *out)
+{
+    return lxlsx_formula_eval_copied(cache, formula, row, col, row, col,
+                                     resolver, range_resolver, ctx, out);
+}
+
+lxlsx_error lxlsx_formula_eval_copied(lxlsx_formula_cache *cache,
+                                      const char *formula,
+                                      lxlsx_row_t from_row,
+                                      lxlsx_col_t from_col,
+                                      lxlsx_row_t row, lxlsx_col_t col,
+                                      lxlsx_formula_resolver resolver,
+                                      lxlsx_formula_range_resolver range_resolver,
+                                      void *ctx, lxlsx_value *out)
+{
+    ev e;
+    node *root;
+    int owned;
+
+    if (!formula || !out)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    *out = val_blank();
+
+    /* Skip a leading '=' if present. */
+    if (*formula == '=') formula++;
+
+    /* Compiled for the cell it was written in, bound to the one it is in. */
+    root = cache_fetch(cache, formula, strlen(formula), from_row, from_col,
+                       &owned);
+    if (!root)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
 
     e.resolver = resolver;
+    e.range_resolver = range_resolver;
     e.ctx = ctx;
+    e.anchor_row = row;
+    e.anchor_col = col;
     *out = eval(&e, root);
-    node_free(root);
+    if (owned) node_free(root);
+    return LXLSX_NO_ERROR;
+}
+
+lxlsx_error lxlsx_formula_eval(const char *formula,
+                               lxlsx_formula_resolver resolver, void *ctx,
+                               lxlsx_value *out)
+{
+    return lxlsx_formula_eval_at(NULL, formula, 0, 0, resolver, NULL, ctx, out);
+}
+
+/* Pass the references under n, bound to the anchor cell, to visit. */
+static void visit_refs(ev *e, node *n, lxlsx_formula_ref_visitor visit,
+                       void *ctx)
+{
+    lxlsx_row_t r1, r2;
+    lxlsx_col_t c1, c2;
+    int i;
+
+    if (!n) return;
+
+    if (n->kind == N_REF) {
+        if (bind_ref(e, n->row, n->col, n->rel, &r1, &c1))
+            visit(ctx, r1, c1, r1, c1);
+        return;
+    }
+
+    if (n->kind == N_RANGE) {
+        if (!bind_ref(e, n->row, n->col, n->rel, &r1, &c1) ||
+            !bind_ref(e, n->row2, n->col2, n->rel2, &r2, &c2))
+            return;
+        if (r1 > r2) { lxlsx_row_t t = r1; r1 = r2; r2 = t; }
+        if (c1 > c2) { lxlsx_col_t t = c1; c1 = c2; c2 = t; }
+        visit(ctx, r1, c1, r2, c2);
+        return;
+    }
+
+    visit_refs(e, n->a, visit, ctx);
+    visit_refs(e, n->b, visit, ctx);
+    for (i = 0; i < n->nargs; i++) visit_refs(e, n->args[i], visit, ctx);
+}
+
+lxlsx_error lxlsx_formula_refs_at(lxlsx_formula_cache *cache,
+                                  const char *formula,
+                                  lxlsx_row_t row, lxlsx_col_t col,
+                                  lxlsx_formula_ref_visitor visit, void *ctx)
+{
+    return lxlsx_formula_refs_copied(cache, formula, row, col, row, col,
+                                     visit, ctx);
+}
+
+lxlsx_error lxlsx_formula_refs_copied(lxlsx_formula_cache *cache,
+                                      const char *formula,
+                                      lxlsx_row_t from_row,
+                                      lxlsx_col_t from_col,
+                                      lxlsx_row_t row, lxlsx_col_t col,
+                                      lxlsx_formula_ref_visitor visit,
+                                      void *ctx)
+{
+    ev e;
+    node *root;
+    int owned;
+
+    if (!formula || !visit)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    if (*formula == '=') formula++;
+
+    root = cache_fetch(cache, formula, strlen(formula), from_row, from_col,
+                       &owned);
+    if (!root)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    memset(&e, 0, sizeof(e));
+    e.anchor_row = row;
+    e.anchor_col = col;
+    visit_refs(&e, root, visit, ctx);
+    if (owned) node_free(root);
     return LXLSX_NO_ERROR;
 }
+
+char *lxlsx_formula_relative_key(const char *formula, lxlsx_row_t row,
+                                 lxlsx_col_t col, char *buf, size_t cap,
+                                 size_t *key_len)
+{
+    size_t n;
+
+    if (!formula || !buf || !key_len) return NULL;
+    if (*formula == '=') formula++;
+
+    n = strlen(formula);
+    if (memchr(formula, FORMULA_KEY_REF, n))
+        return NULL;
+
+    return cache_key(formula, n, row, col, buf, cap, key_len);
+}
+
+int lxlsx_formula_same_relative(const char *a, lxlsx_row_t a_row,
+                                lxlsx_col_t a_col, const char *b,
+                                lxlsx_row_t b_row, lxlsx_col_t b_col)
+{
+    char buf_a[256], buf_b[256];
+    char *key_a, *key_b;
+    size_t len_a = 0, len_b = 0;
+    int same;
+
+    key_a = lxlsx_formula_relative_key(a, a_row, a_col, buf_a, sizeof(buf_a),
+                                       &len_a);
+    if (!key_a) return 0;
+
+    key_b = lxlsx_formula_relative_key(b, b_row, b_col, buf_b, sizeof(buf_b),
+                                       &len_b);
+    same = key_b && len_a == len_b && memcmp(key_a, key_b, len_a) == 0;
+
+    if (key_a != buf_a) free(key_a);
+    if (key_b && key_b != buf_b) free(key_b);
+    return same;
+}
+
+/* ===================================================================== *
+ * Column evaluation
+ * ===================================================================== */
+
+/* Rows evaluated per pass over the expression. */
+#define FORMULA_COLUMN_BLOCK 1024
+
+typedef struct {
+    lxlsx_formula_column_resolver resolver;
+    void *ctx;
+    lxlsx_row_t first_row;  /* cell the block's first row is evaluated for */
+    lxlsx_col_t col;
+    size_t count;
+    double *scratch;        /* one block per level of the expression */
+    uint8_t *numeric;
+    uint8_t *done;
+} vec;
+
+/* Plain arithmetic on numbers and cells evaluates the same way for every row
+ * of a column, so it can be done on whole vectors. */
+static int vec_supported(const node *n)
+{
+    switch (n->kind) {
+    case N_NUM:
+    case N_REF:
+        return 1;
+    case N_UNARY:
+        return vec_supported(n->a);
+    case N_BINARY:
+        return n->op[0] && strchr("+-*/^", n->op[0]) && n->op[1] == '\0' &&
+               vec_supported(n->a) && vec_supported(n->b);
+    default:
+        return 0;
+    }
+}
+
+/* Scratch blocks needed to evaluate n. */
+static int vec_depth(const node *n)
+{
+    int a, b;
+    if (n->kind == N_UNARY) return vec_depth(n->a);
+    if (n->kind != N_BINARY) return 0;
+    a = vec_depth(n->a);
+    b = vec_depth(n->b);
+    return 1 + (a > b ? a : b);
+}
+
+/* Load the cells a reference reads for the rows of the block. Rows whose
+ * cell isn't a number, or is off the sheet, are left to the scalar path. */
+static void vec_load(vec *v, const node *n, double *out)
+{
+    int64_t row = (int64_t)n->row + ((n->rel & REL_ROW) ? (int64_t)v->first_row : 0);
+    int64_t col = (int64_t)n->col + ((n->rel & REL_COL) ? (int64_t)v->col : 0);
+    size_t first = 0, last = v->count, i;
+    double value;
+    uint8_t numeric;
+
+    if (col < 0 || col >= FORMULA_COL_MAX) {
+        memset(v->done, 0, v->count);
+        return;
+    }
+
+    if (!(n->rel & REL_ROW)) {
+        v->resolver(v->ctx, (lxlsx_row_t)row, (lxlsx_col_t)col, 1, &value, &numeric);
+        for (i = 0; i < v->count; i++) out[i] = value;
+        if (!numeric) memset(v->done, 0, v->count);
+        return;
+    }
+
+    if (row < 0) first = (size_t)(-row) < v->count ? (size_t)(-row) : v->count;
+    if (row + (int64_t)v->count > FORMULA_ROW_MAX)
+        last = row >= FORMULA_ROW_MAX ? 0 : (size_t)(FORMULA_ROW_MAX - row);
+    if (last < first) last = first;
+
+    for (i = 0; i < first; i++) { out[i] = 0.0; v->done[i] = 0; }
+    for (i = last; i < v->count; i++) { out[i] = 0.0; v->done[i] = 0; }
+    if (last == first) return;
+
+    v->resolver(v->ctx, (lxlsx_row_t)(row + (int64_t)first), (lxlsx_col_t)col,
+                (uint32_t)(last - first), out + first, v->numeric);
+    for (i = first; i < last; i++) v->done[i] &= v->numeric[i - first];
+}
+
+/* Evaluate n for every row of the block into out. The loops carry no
+ * branches so that the compiler can vectorize them. */
+static void vec_eval(vec *v, const node *n, double *out, int level)
+{
+    double *tmp;
+    size_t i, count = v->count;
+
+    switch (n->kind) {
+    case N_NUM:
+        for (i = 0; i < count; i++) out[i] = n->num;
+        return;
+
+    case N_REF:
+        vec_load(v, n, out);
+        return;
+
+    case N_UNARY:
+        vec_eval(v, n->a, out, level);
+        if (n->op[0] == '-')
+            for (i = 0; i < count; i++) out[i] = -out[i];
+        else if (n->op[0] == '%')
+            for (i = 0; i < count; i++) out[i] = out[i] / 100.0;
+        return;
+
+    case N_BINARY:
+        tmp = v->scratch + (size_t)level * FORMULA_COLUMN_BLOCK;
+        vec_eval(v, n->a, out, level + 1);
+        vec_eval(v, n->b, tmp, level + 1);
+        switch (n->op[0]) {
+        case '+':
+            for (i = 0; i < count; i++) out[i] = out[i] + tmp[i];
+            break;
+        case '-':
+            for (i = 0; i < count; i++) out[i] = out[i] - tmp[i];
+            break;
+        case '*':
+            for (i = 0; i < count; i++) out[i] = out[i] * tmp[i];
+            break;
+        case '/':
+            /* A zero divisor is #DIV/0!, which the scalar path reports. */
+            for (i = 0; i < count; i++) v->done[i] &= tmp[i] != 0.0;
+            for (i = 0; i < count; i++) out[i] = out[i] / tmp[i];
+            break;
+        default:
+            for (i = 0; i < count; i++) out[i] = pow(out[i], tmp[i]);
+            break;
+        }
+        return;
+
+    default:
+        return;
+    }
+}
+
+lxlsx_error lxlsx_formula_eval_column(lxlsx_formula_cache *cache,
+                                      const char *formula,
+                                      lxlsx_row_t first_row, lxlsx_col_t col,
+                                      uint32_t count,
+                                      lxlsx_formula_column_resolver resolver,
+                                      void *ctx, double *results, uint8_t *done)
+{
+    lxlsx_error err = LXLSX_NO_ERROR;
+    vec v;
+    node *root;
+    int owned;
+    uint32_t offset;
+
+    if (!formula || !resolver || (count && (!results || !done)))
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    if (*formula == '=') formula++;
+
+    root = cache_fetch(cache, formula, strlen(formula), first_row, col, &owned);
+    if (!root)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    if (!vec_supported(root)) {
+        if (owned) node_free(root);
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+    }
+
+    if (!count) {
+        if (owned) node_free(root);
+        return LXLSX_NO_ERROR;
+    }
+
+    memset(&v, 0, sizeof(v));
+    v.resolver = resolver;
+    v.ctx = ctx;
+    v.col = col;
+    v.scratch = malloc(((size_t)vec_depth(root) + 1) * FORMULA_COLUMN_BLOCK * sizeof(double));
+    v.numeric = malloc(FORMULA_COLUMN_BLOCK);
+    if (!v.scratch || !v.numeric) {
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        goto done;
+    }
+
+    /* The compiled offsets are relative: bind them to each block's first row. */
+    for (offset = 0; offset < count; offset += FORMULA_COLUMN_BLOCK) {
+        v.first_row = first_row + offset;
+        v.count = count - offset < FORMULA_COLUMN_BLOCK ? count - offset : FORMULA_COLUMN_BLOCK;
+        v.done = done + offset;
+        memset(v.done, 1, v.count);
+        vec_eval(&v, root, results + offset, 0);
+    }
+
+done:
+    free(v.scratch);
+    free(v.numeric);
+    if (owned) node_free(root);
+    return err;
+}
@@ -15,104 +15,124 @@
 #include "libxlsx/hash_table.h"
 
 /*
- * Calculate the hash key using the FNV function. See:
- * http://en.wikipedia.org/wiki/Fowler-Noll-Vo_hash_function
+ * The table uses open addressing with linear probing over a power of two
+ * array of slots. Slots hold the upper hash bits and the 1-based index of the
+ * element in the insertion ordered element array. The load factor is kept at
+ * or below 1/2 so the element array is sized at half the slot count.
  */
-STATIC size_t
-_generate_hash_key(void *data, size_t data_len, size_t num_buckets)
+#define LXLSX_HASH_MIN_BUCKETS 8
+#define LXLSX_HASH_MAX_BUCKETS (UINT32_C(1) << 31)
+#define LXLSX_HASH_MULTIPLIER  UINT64_C(0x9E3779B97F4A7C15)
+
+#define LXLSX_HASH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/*
+ * Calculate the hash key 8 bytes at a time with a multiply and rotate mix
+ * and a final avalanche so that the low bits used for the slot index depend
+ * on all of the key bytes.
+ */
+STATIC uint64_t
+_generate_hash_key(const void *data, size_t data_len)
 {
-    unsigned char *p = data;
-    size_t hash = 2166136261U;
-    size_t i;
+    const unsigned char *p = data;
+    uint64_t hash = (uint64_t) data_len * LXLSX_HASH_MULTIPLIER;
+    uint64_t word;
+
+    while (data_len >= 8) {
+        memcpy(&word, p, 8);
+        hash = (LXLSX_HASH_ROTL(hash, 5) ^ word) * LXLSX_HASH_MULTIPLIER;
+        p += 8;
+        data_len -= 8;
+    }
 
-    for (i = 0; i < data_len; i++)
-        hash = (hash * 16777619) ^ p[i];
+    if (data_len) {
+        word = 0;
+        memcpy(&word, p, data_len);
+        hash = (LXLSX_HASH_ROTL(hash, 5) ^ word) * LXLSX_HASH_MULTIPLIER;
+    }
+
+    hash ^= hash >> 32;
+    hash *= LXLSX_HASH_MULTIPLIER;
+    hash ^= hash >> 29;
 
-    return hash % num_buckets;
+    return hash;
 }
 
-static struct lxlsx_hash_bucket_list *
-_new_bucket_list(void)
+/*
+ * Find the slot for a key: either the slot holding it or the empty slot
+ * where it would be inserted.
+ */
+static lxlsx_hash_slot *
+_find_slot(lxlsx_hash_table *lxlsx_hash, void *key, size_t key_len,
+           uint64_t hash)
 {
-    struct lxlsx_hash_bucket_list *list;
+    uint32_t mask = lxlsx_hash->num_buckets - 1;
+    uint32_t tag = (uint32_t) (hash >> 32);
+    uint32_t i = (uint32_t) hash & mask;
+    lxlsx_hash_slot *slot;
+    lxlsx_hash_element *element;
 
-    list = calloc(1, sizeof(struct lxlsx_hash_bucket_list));
-    if (!list)
-        return NULL;
+    for (;;) {
+        slot = &lxlsx_hash->buckets[i];
 
-    SLIST_INIT(list);
-    return list;
-}
+        if (!slot->index)
+            return slot;
 
-static void
-_free_bucket_lists(struct lxlsx_hash_bucket_list **buckets, size_t num_buckets)
-{
-    size_t i;
+        if (slot->hash == tag) {
+            element = &lxlsx_hash->elements[slot->index - 1];
 
-    if (!buckets)
-        return;
+            if (element->key_len == key_len &&
+                memcmp(element->key, key, key_len) == 0)
+                return slot;
+        }
 
-    for (i = 0; i < num_buckets; i++)
-        free(buckets[i]);
+        i = (i + 1) & mask;
+    }
 }
 
+/*
+ * Grow the slot and element arrays to num_buckets and re-insert the
+ * existing elements using their cached hashes.
+ */
 static int
 _resize_hash_table(lxlsx_hash_table *lxlsx_hash, uint32_t num_buckets)
 {
-    struct lxlsx_hash_bucket_list **buckets;
-    lxlsx_hash_element *element;
-    uint32_t used_buckets = 0;
+    lxlsx_hash_slot *buckets;
+    lxlsx_hash_element *elements;
+    uint32_t mask = num_buckets - 1;
+    uint32_t i;
 
-    if (!lxlsx_hash || num_buckets <= lxlsx_hash->num_buckets)
-        return 0;
-
-    buckets = calloc(num_buckets, sizeof(struct lxlsx_hash_bucket_list *));
+    buckets = calloc(num_buckets, sizeof(lxlsx_hash_slot));
     if (!buckets)
         return -1;
 
-    STAILQ_FOREACH(element, lxlsx_hash->order_list, lxlsx_hash_order_pointers) {
-        size_t hash_key = _generate_hash_key(element->key, element->key_len,
-                                             num_buckets);
-        struct lxlsx_hash_bucket_list *list = buckets[hash_key];
-
-        if (!list) {
-            list = _new_bucket_list();
-            if (!list) {
-                _free_bucket_lists(buckets, num_buckets);
-                free(buckets);
-                return -1;
-            }
-            buckets[hash_key] = list;
-            used_buckets++;
-        }
+    elements = realloc(lxlsx_hash->elements,
+                       (size_t) (num_buckets / 2) *
+                       sizeof(lxlsx_hash_element));
+    if (!elements) {
+        free(buckets);
+        return -1;
+    }
+
+    for (i = 0; i < lxlsx_hash->unique_count; i++) {
+        uint64_t hash = elements[i].hash;
+        uint32_t j = (uint32_t) hash & mask;
+
+        while (buckets[j].index)
+            j = (j + 1) & mask;
 
-        SLIST_INSERT_HEAD(list, element, lxlsx_hash_list_pointers);
+        buckets[j].hash = (uint32_t) (hash >> 32);
+        buckets[j].index = i + 1;
     }
 
-    _free_bucket_lists(lxlsx_hash->buckets, lxlsx_hash->num_buckets);
     free(lxlsx_hash->buckets);
     lxlsx_hash->buckets = buckets;
+    lxlsx_hash->elements = elements;
     lxlsx_hash->num_buckets = num_buckets;
-    lxlsx_hash->used_buckets = used_buckets;
 
     return 0;
 }
 
-static void
-_maybe_resize_hash_table(lxlsx_hash_table *lxlsx_hash)
-{
-    if (!lxlsx_hash || lxlsx_hash->num_buckets == 0)
-        return;
-
-    if (lxlsx_hash->unique_count < lxlsx_hash->num_buckets * 2)
-        return;
-
-    if (lxlsx_hash->num_buckets > UINT32_MAX / 2)
-        return;
-
-    (void)_resize_hash_table(lxlsx_hash, lxlsx_hash->num_buckets * 2);
-}
-
 /*
  * Check if an element exists in the hash table and return a pointer
  * to it if it does.
@@ -120,30 +140,13 @@ _maybe_resize_hash_table(lxlsx_hash_table *lxlsx_hash)
 lxlsx_hash_element *
 lxlsx_hash_key_exists(lxlsx_hash_table *lxlsx_hash, void *key, size_t key_len)
 {
-    size_t hash_key = _generate_hash_key(key, key_len, lxlsx_hash->num_buckets);
-    struct lxlsx_hash_bucket_list *list;
-    lxlsx_hash_element *element;
+    uint64_t hash = _generate_hash_key(key, key_len);
+    lxlsx_hash_slot *slot = _find_slot(lxlsx_hash, key, key_len, hash);
 
-    if (!lxlsx_hash->buckets[hash_key]) {
-        /* The key isn't in the LXLSX_HASH hash table. */
+    if (!slot->index)
         return NULL;
-    }
-    else {
-        /* The key is already in the table or there is a hash collision. */
-        list = lxlsx_hash->buckets[hash_key];
-
-        /* Iterate over the keys in the bucket's linked list. */
-        SLIST_FOREACH(element, list, lxlsx_hash_list_pointers) {
-            if (element->key_len == key_len &&
-                memcmp(element->key, key, key_len) == 0) {
-                /* The key already exists in the table. */
-                return element;
-            }
-        }
 
-        /* Key doesn't exist in the list so this is a hash collision. */
-        return NULL;
-    }
+    return &lxlsx_hash->elements[slot->index - 1];
 }
 
 /*
@@ -154,97 +157,99 @@ lxlsx_hash_element *
 lxlsx_insert_hash_element(lxlsx_hash_table *lxlsx_hash, void *key, void *value,
                         size_t key_len)
 {
-    size_t hash_key;
-    struct lxlsx_hash_bucket_list *list = NULL;
-    lxlsx_hash_element *element = NULL;
-
-    _maybe_resize_hash_table(lxlsx_hash);
-    hash_key = _generate_hash_key(key, key_len, lxlsx_hash->num_buckets);
-
-    if (!lxlsx_hash->buckets[hash_key]) {
-        /* The key isn't in the LXLSX_HASH hash table. */
+    uint64_t hash = _generate_hash_key(key, key_len);
+    lxlsx_hash_slot *slot = _find_slot(lxlsx_hash, key, key_len, hash);
+    lxlsx_hash_element *element;
 
-        /* Create a linked list in the bucket to hold the lxlsx_hash keys. */
-        list = _new_bucket_list();
-        GOTO_LABEL_ON_MEM_ERROR(list, mem_error1);
+    if (slot->index) {
+        /* The key already exists in the table. Update the value. */
+        element = &lxlsx_hash->elements[slot->index - 1];
 
-        /* Create an lxlsx_hash element to add to the linked list. */
-        element = calloc(1, sizeof(lxlsx_hash_element));
-        GOTO_LABEL_ON_MEM_ERROR(element, mem_error1);
+        if (lxlsx_hash->free_value)
+            free(element->value);
 
-        /* Store the key and value. */
-        element->key = key;
         element->value = value;
-        element->key_len = key_len;
+        return element;
+    }
 
-        /* Add the lxlsx_hash element to the bucket's linked list. */
-        SLIST_INSERT_HEAD(list, element, lxlsx_hash_list_pointers);
+    /* Keep the load factor at or below 1/2. */
+    if (lxlsx_hash->unique_count >= lxlsx_hash->num_buckets / 2) {
+        if (lxlsx_hash->num_buckets >= LXLSX_HASH_MAX_BUCKETS)
+            return NULL;
 
-        /* Also add it to the insertion order linked list. */
-        STAILQ_INSERT_TAIL(lxlsx_hash->order_list, element,
-                           lxlsx_hash_order_pointers);
+        if (_resize_hash_table(lxlsx_hash, lxlsx_hash->num_buckets * 2))
+            return NULL;
 
-        /* Store the bucket list at the hash index. */
-        lxlsx_hash->buckets[hash_key] = list;
+        slot = _find_slot(lxlsx_hash, key, key_len, hash);
+    }
 
-        lxlsx_hash->used_buckets++;
-        lxlsx_hash->unique_count++;
+    /* Store the key and value at the end of the insertion order array. */
+    element = &lxlsx_hash->elements[lxlsx_hash->unique_count];
+    element->key = key;
+    element->value = value;
+    element->key_len = key_len;
+    element->hash = hash;
 
-        return element;
-    }
-    else {
-        /* The key is already in the table or there is a hash collision. */
-        list = lxlsx_hash->buckets[hash_key];
+    lxlsx_hash->unique_count++;
 
-        /* Iterate over the keys in the bucket's linked list. */
-        SLIST_FOREACH(element, list, lxlsx_hash_list_pointers) {
-            if (element->key_len == key_len &&
-                memcmp(element->key, key, key_len) == 0) {
-                /* The key already exists in the table. Update the value. */
-                if (lxlsx_hash->free_value)
-                    free(element->value);
-
-                element->value = value;
-                return element;
-            }
-        }
+    slot->hash = (uint32_t) (hash >> 32);
+    slot->index = lxlsx_hash->unique_count;
 
-        /* Key doesn't exist in the list so this is a hash collision.
-         * Create an lxlsx_hash element to add to the linked list. */
-        element = calloc(1, sizeof(lxlsx_hash_element));
-        GOTO_LABEL_ON_MEM_ERROR(element, mem_error2);
+    return element;
+}
 
-        /* Store the key and value. */
-        element->key = key;
-        element->value = value;
-        element->key_len = key_len;
+/*
+ * Remove the most recently inserted element, freeing its key and value as
+ * configured. The slots after it in its probe run are shifted back so that
+ * lookups of the other keys still find them.
+ */
+void
+lxlsx_hash_remove_last(lxlsx_hash_table *lxlsx_hash)
+{
+    uint32_t mask = lxlsx_hash->num_buckets - 1;
+    lxlsx_hash_element *element;
+    uint32_t i, j, home;
+
+    if (!lxlsx_hash->unique_count)
+        return;
 
-        /* Add the lxlsx_hash element to the bucket linked list. */
-        SLIST_INSERT_HEAD(list, element, lxlsx_hash_list_pointers);
+    element = &lxlsx_hash->elements[lxlsx_hash->unique_count - 1];
+    i = (uint32_t) element->hash & mask;
+    while (lxlsx_hash->buckets[i].index != lxlsx_hash->unique_count)
+        i = (i + 1) & mask;
 
-        /* Also add it to the insertion order linked list. */
-        STAILQ_INSERT_TAIL(lxlsx_hash->order_list, element,
-                           lxlsx_hash_order_pointers);
+    for (j = (i + 1) & mask; lxlsx_hash->buckets[j].index;
+         j = (j + 1) & mask) {
+        home = (uint32_t) lxlsx_hash->elements[lxlsx_hash->buckets[j].index
+                                               - 1].hash & mask;
 
-        lxlsx_hash->unique_count++;
+        /* Leave a slot whose home lies after the hole, up to itself. */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
 
-        return element;
+        lxlsx_hash->buckets[i] = lxlsx_hash->buckets[j];
+        i = j;
     }
+    lxlsx_hash->buckets[i].hash = 0;
+    lxlsx_hash->buckets[i].index = 0;
 
-mem_error1:
-    free(list);
+    if (lxlsx_hash->free_key)
+        free(element->key);
+    if (lxlsx_hash->free_value)
+        free(element->value);
 
-mem_error2:
-    free(element);
-    return NULL;
+    lxlsx_hash->unique_count--;
 }
 
 /*
- * Create a new LXLSX_HASH hash table object.
+ * Create a new LXLSX_HASH hash table object. The number of buckets is a
+ * sizing hint: it is rounded up to a power of two and grows as needed.
  */
 lxlsx_hash_table *
 lxlsx_hash_new(uint32_t num_buckets, uint8_t free_key, uint8_t free_value)
 {
+    uint32_t size = LXLSX_HASH_MIN_BUCKETS;
+
     /* Create the new hash table. */
     lxlsx_hash_table *lxlsx_hash = calloc(1, sizeof(lxlsx_hash_table));
     RETURN_ON_MEM_ERROR(lxlsx_hash, NULL);
@@ -252,24 +257,17 @@ lxlsx_hash_new(uint32_t num_buckets, uint8_t free_key, uint8_t free_value)
     lxlsx_hash->free_key = free_key;
     lxlsx_hash->free_value = free_value;
 
-    /* Add the lxlsx_hash element buckets. */
-    lxlsx_hash->buckets =
-        calloc(num_buckets, sizeof(struct lxlsx_hash_bucket_list *));
-    GOTO_LABEL_ON_MEM_ERROR(lxlsx_hash->buckets, mem_error);
-
-    /* Add a list for tracking the insertion order. */
-    lxlsx_hash->order_list = calloc(1, sizeof(struct lxlsx_hash_order_list));
-    GOTO_LABEL_ON_MEM_ERROR(lxlsx_hash->order_list, mem_error);
-
-    /* Initialize the order list. */
-    STAILQ_INIT(lxlsx_hash->order_list);
+    while (size < num_buckets && size < LXLSX_HASH_MAX_BUCKETS)
+        size *= 2;
 
-    /* Store the number of buckets to calculate the load factor. */
-    lxlsx_hash->num_buckets = num_buckets;
+    /* Add the slots and the insertion ordered element array. */
+    if (_resize_hash_table(lxlsx_hash, size))
+        goto mem_error;
 
     return lxlsx_hash;
 
 mem_error:
+    LXLSX_MEM_ERROR();
     lxlsx_hash_free(lxlsx_hash);
     return NULL;
 }
@@ -280,28 +278,20 @@ mem_error:
 void
 lxlsx_hash_free(lxlsx_hash_table *lxlsx_hash)
 {
-    lxlsx_hash_element *element;
-    lxlsx_hash_element *element_temp;
+    uint32_t i;
 
     if (!lxlsx_hash)
         return;
 
-    /* Free the lxlsx_hash_elements and data using the ordered linked list. */
-    if (lxlsx_hash->order_list) {
-        STAILQ_FOREACH_SAFE(element, lxlsx_hash->order_list,
-                            lxlsx_hash_order_pointers, element_temp) {
-            if (lxlsx_hash->free_key)
-                free(element->key);
-            if (lxlsx_hash->free_value)
-                free(element->value);
-            free(element);
-        }
+    /* Free the keys and data held by the elements. */
+    for (i = 0; i < lxlsx_hash->unique_count; i++) {
+        if (lxlsx_hash->free_key)
+            free(lxlsx_hash->elements[i].key);
+        if (lxlsx_hash->free_value)
+            free(lxlsx_hash->elements[i].value);
     }
 
-    /* Free the buckets from the hash table. */
-    _free_bucket_lists(lxlsx_hash->buckets, lxlsx_hash->num_buckets);
-
-    free(lxlsx_hash->order_list);
+    free(lxlsx_hash->elements);
     free(lxlsx_hash->buckets);
     free(lxlsx_hash);
 }
@@ -0,0 +1,1110 @@
+/*
+ * libxlsx
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Formula evaluation for read-side worksheets: the cells formulas refer to
+ * are streamed on demand into a column store and formula cells are evaluated
+ * from it (see reader_eval.h).
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "libxlsx/reader_eval.h"
+#include "libxlsx/workbook.h"
+#include "libxlsx/utility.h"
+
+/* Kinds of a cell held in the column store. */
+enum reader_eval_kind {
+    READER_EVAL_BLANK = 0,
+    READER_EVAL_NUMBER,
+    READER_EVAL_BOOL,
+    READER_EVAL_STRING,  /* value indexes lxlsx_reader_eval.strings */
+    READER_EVAL_ERROR,   /* value is the lxlsx_formula_error */
+    READER_EVAL_FORMULA  /* value indexes lxlsx_reader_eval.formulas */
+};
+
+/* Evaluation states of a formula cell. */
+enum reader_eval_state {
+    READER_EVAL_PENDING = 0,
+    READER_EVAL_PUSHED,    /* on the stack, its references not looked at */
+    READER_EVAL_EXPANDED,  /* on the stack above the formulas it refers to */
+    READER_EVAL_DONE
+};
+
+/* Numbers passed to the formula engine per lxlsx_range_sink_numbers() call. */
+#define READER_EVAL_RANGE_RUN 256
+
+/* Rows held for a column from first_row on: a kind and a value each. Rows
+ * from first_row + count up to the stream position are blank. */
+typedef struct reader_eval_column {
+    lxlsx_col_t col;
+    lxlsx_row_t first_row;
+    lxlsx_row_t want_row;      /* first row asked for, read on the next pass */
+    lxlsx_row_t backfill_end;  /* rows before it are read on this pass */
+    uint32_t count;
+    uint32_t size;
+    uint8_t *kinds;
+    double *values;
+} reader_eval_column;
+
+typedef struct reader_eval_formula {
+    char *text;              /* owned formula text */
+    const char *formula;     /* text, or that of its shared formula */
+    lxlsx_row_t from_row;    /* cell the formula was written in */
+    lxlsx_col_t from_col;
+    lxlsx_row_t row;
+    lxlsx_col_t col;
+    uint8_t state;
+    lxlsx_value result;
+} reader_eval_formula;
+
+/* The first cell of a shared formula group, by si. */
+typedef struct reader_eval_shared {
+    char *formula;
+    lxlsx_row_t row;
+    lxlsx_col_t col;
+} reader_eval_shared;
+
+typedef struct reader_eval_ref {
+    lxlsx_row_t first_row;
+    lxlsx_row_t last_row;
+    lxlsx_col_t first_col;
+    lxlsx_col_t last_col;
+} reader_eval_ref;
+
+struct lxlsx_reader_eval {
+    lxlsx_reader_workbook *workbook;
+    lxlsx_reader_worksheet *worksheet;
+    char *sheet_name;
+
+    lxlsx_formula_cache *cache;
+    lxlsx_formula_cache *own_cache;
+
+    /* Rows before pos have been streamed; need is the last row asked for. */
+    lxlsx_row_t pos;
+    lxlsx_row_t need;
+    uint8_t eof;
+
+    /* Columns held, by column number. */
+    reader_eval_column *columns;
+    uint32_t column_count;
+    uint32_t column_size;
+
+    char **strings;
+    uint32_t string_count;
+    uint32_t string_size;
+
+    reader_eval_formula *formulas;
+    uint32_t formula_count;
+    uint32_t formula_size;
+
+    reader_eval_shared *shared;
+    uint32_t shared_size;
+
+    /* References of the formula being looked at. */
+    reader_eval_ref *refs;
+    uint32_t ref_count;
+    uint32_t ref_size;
+    uint8_t ref_failed;
+
+    /* Formulas being evaluated, see _reader_eval_run(). */
+    uint32_t *stack;
+    uint32_t stack_count;
+    uint32_t stack_size;
+
+    /* First error met while resolving, returned by the public call. */
+    lxlsx_error error;
+
+    lxlsx_reader_eval_stats stats;
+};
+
+/*****************************************************************************
+ *
+ * The column store.
+ *
+ ****************************************************************************/
+
+/* Grow an array of *size elements to hold at least count. */
+STATIC int
+_reader_eval_grow(void **array, uint32_t *size, uint32_t count,
+                  size_t element_size)
+{
+    uint32_t new_size = *size ? *size : 16;
+    void *grown;
+
+    if (count <= *size)
+        return LXLSX_TRUE;
+
+    while (new_size < count)
+        new_size *= 2;
+
+    grown = realloc(*array, (size_t) new_size * element_size);
+    if (!grown) {
+        LXLSX_MEM_ERROR();
+        return LXLSX_FALSE;
+    }
+
+    *array = grown;
+    *size = new_size;
+    return LXLSX_TRUE;
+}
+
+/* Binary search for a column; *index gets its position or where it goes. */
+STATIC reader_eval_column *
+_reader_eval_column(lxlsx_reader_eval *self, lxlsx_col_t col, uint32_t *index)
+{
+    uint32_t low = 0, high = self->column_count, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (self->columns[mid].col < col)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (index)
+        *index = low;
+
+    if (low < self->column_count && self->columns[low].col == col)
+        return &self->columns[low];
+
+    return NULL;
+}
+
+/* Hold count rows in a column, the new ones blank. */
+STATIC int
+_reader_eval_column_grow(reader_eval_column *column, uint32_t count)
+{
+    uint32_t size = column->size ? column->size : 16;
+    uint8_t *kinds;
+    double *values;
+
+    if (count <= column->count)
+        return LXLSX_TRUE;
+
+    if (count > column->size) {
+        while (size < count)
+            size *= 2;
+
+        kinds = realloc(column->kinds, size);
+        RETURN_ON_MEM_ERROR(kinds, LXLSX_FALSE);
+        column->kinds = kinds;
+
+        values = realloc(column->values, (size_t) size * sizeof(double));
+        RETURN_ON_MEM_ERROR(values, LXLSX_FALSE);
+        column->values = values;
+
+        column->size = size;
+    }
+
+    memset(column->kinds + column->count, READER_EVAL_BLANK,
+           count - column->count);
+    column->count = count;
+    return LXLSX_TRUE;
+}
+
+/*
+ * Ask for the cells of a range. Columns not held yet are added; rows above
+ * those held are read on the next pass over the worksheet, rows below it as
+ * the stream goes on.
+ */
+STATIC lxlsx_error
+_reader_eval_request(lxlsx_reader_eval *self, lxlsx_row_t first_row,
+                     lxlsx_col_t first_col, lxlsx_row_t last_row,
+                     lxlsx_col_t last_col)
+{
+    reader_eval_column *column;
+    uint32_t missing = 0;
+    uint32_t index, from, to;
+    lxlsx_col_t col;
+
+    if (last_row > self->need)
+        self->need = last_row;
+
+    for (col = first_col;; col++) {
+        column = _reader_eval_column(self, col, NULL);
+        if (!column)
+            missing++;
+        else if (first_row < column->want_row)
+            column->want_row = first_row;
+        if (col == last_col)
+            break;
+    }
+
+    if (!missing)
+        return LXLSX_NO_ERROR;
+
+    if (!_reader_eval_grow((void **) &self->columns, &self->column_size,
+                           self->column_count + missing,
+                           sizeof(reader_eval_column)))
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    /* Merge the new columns in from the back, in one pass. */
+    _reader_eval_column(self, first_col, &index);
+    from = self->column_count;
+    to = self->column_count + missing;
+
+    while (from > index && self->columns[from - 1].col > last_col)
+        self->columns[--to] = self->columns[--from];
+
+    for (col = last_col;; col--) {
+        if (from > index && self->columns[from - 1].col == col) {
+            self->columns[--to] = self->columns[--from];
+        }
+        else {
+            column = &self->columns[--to];
+            memset(column, 0, sizeof(*column));
+            column->col = col;
+            column->first_row = first_row > self->pos ? first_row : self->pos;
+            column->want_row = first_row;
+        }
+        if (col == first_col)
+            break;
+    }
+
+    self->column_count += missing;
+    return LXLSX_NO_ERROR;
+}
+
+/* Map an error cell's text to the engine's error kind. */
+STATIC lxlsx_formula_error
+_reader_eval_error_kind(const char *code)
+{
+    lxlsx_formula_error error;
+
+    for (error = LXLSX_FERR_NULL; error <= LXLSX_FERR_NA; error++) {
+        if (strcmp(code, lxlsx_formula_error_string(error)) == 0)
+            return error;
+    }
+
+    return LXLSX_FERR_VALUE;
+}
+
+/* Remember the first cell of a shared formula group. */
+STATIC lxlsx_error
+_reader_eval_add_shared(lxlsx_reader_eval *self, const lxlsx_cell *cell)
+{
+    const lxlsx_cell_formula *formula = cell->data.reader.value.formula;
+    reader_eval_shared *shared;
+    uint32_t size = self->shared_size;
+
+    if (!formula || formula->kind != LXLSX_FORMULA_SHARED || formula->si < 0
+        || !formula->formula.len)
+        return LXLSX_NO_ERROR;
+
+    if ((uint32_t) formula->si >= self->shared_size) {
+        if (!_reader_eval_grow((void **) &self->shared, &size,
+                               (uint32_t) formula->si + 1,
+                               sizeof(reader_eval_shared)))
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        memset(self->shared + self->shared_size, 0,
+               (size - self->shared_size) * sizeof(reader_eval_shared));
+        self->shared_size = size;
+    }
+
+    shared = &self->shared[formula->si];
+    if (shared->formula)
+        return LXLSX_NO_ERROR;
+
+    shared->formula = malloc(formula->formula.len + 1);
+    RETURN_ON_MEM_ERROR(shared->formula, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+    memcpy(shared->formula, formula->formula.ptr, formula->formula.len);
+    shared->formula[formula->formula.len] = '\0';
+    shared->row = cell->row_num - 1;
+    shared->col = cell->col_num - 1;
+
+    return LXLSX_NO_ERROR;
+}
+
+/* Set up the formula of a cell: its own text, or its shared formula's. */
+STATIC lxlsx_error
+_reader_eval_formula_init(lxlsx_reader_eval *self, const lxlsx_cell *cell,
+                          reader_eval_formula *entry)
+{
+    const lxlsx_cell_formula *formula = cell->data.reader.value.formula;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->row = entry->from_row = cell->row_num - 1;
+    entry->col = entry->from_col = cell->col_num - 1;
+
+    if (!formula)
+        return LXLSX_NO_ERROR;
+
+    if (formula->formula.len) {
+        entry->text = malloc(formula->formula.len + 1);
+        RETURN_ON_MEM_ERROR(entry->text, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+        memcpy(entry->text, formula->formula.ptr, formula->formula.len);
+        entry->text[formula->formula.len] = '\0';
+        entry->formula = entry->text;
+    }
+    else if (formula->si >= 0 && (uint32_t) formula->si < self->shared_size
+             && self->shared[formula->si].formula) {
+        entry->formula = self->shared[formula->si].formula;
+        entry->from_row = self->shared[formula->si].row;
+        entry->from_col = self->shared[formula->si].col;
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+/* Hold a cell read from the worksheet if its column and row are asked for. */
+STATIC lxlsx_error
+_reader_eval_store(lxlsx_reader_eval *self, const lxlsx_cell *cell)
+{
+    reader_eval_column *column;
+    lxlsx_row_t row = cell->row_num - 1;
+    lxlsx_error err;
+    uint32_t index;
+    char *string;
+
+    if (!cell->row_num || !cell->col_num)
+        return LXLSX_NO_ERROR;
+
+    if (cell->type == FORMULA_CELL && row >= self->pos) {
+        err = _reader_eval_add_shared(self, cell);
+        if (err)
+            return err;
+    }
+
+    column = _reader_eval_column(self, cell->col_num - 1, NULL);
+    if (!column || row < column->first_row)
+        return LXLSX_NO_ERROR;
+
+    /* Rows before the stream position are only read again to backfill. */
+    if (row < self->pos && row >= column->backfill_end)
+        return LXLSX_NO_ERROR;
+
+    index = row - column->first_row;
+    if (!_reader_eval_column_grow(column, index + 1))
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    switch (cell->type) {
+    case NUMBER_CELL:
+        column->kinds[index] = READER_EVAL_NUMBER;
+        column->values[index] = cell->data.reader.value.number;
+        break;
+    case DATETIME_CELL:
+        /* The serial number, not the converted timestamp. */
+        column->kinds[index] = READER_EVAL_NUMBER;
+        column->values[index] = cell->data.reader.raw.ptr
+            ? strtod(cell->data.reader.raw.ptr, NULL) : 0.0;
+        break;
+    case BOOLEAN_CELL:
+        column->kinds[index] = READER_EVAL_BOOL;
+        column->values[index] = cell->data.reader.value.boolean ? 1.0 : 0.0;
+        break;
+    case ERROR_CELL:
+        column->kinds[index] = READER_EVAL_ERROR;
+        column->values[index] =
+            _reader_eval_error_kind(cell->data.reader.value.error_code);
+        break;
+    case STRING_CELL:
+    case INLINE_STRING_CELL:
+    case INLINE_RICH_STRING_CELL:
+        if (!_reader_eval_grow((void **) &self->strings, &self->string_size,
+                               self->string_count + 1, sizeof(char *)))
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        string = malloc(cell->data.reader.value.string.len + 1);
+        RETURN_ON_MEM_ERROR(string, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+        if (cell->data.reader.value.string.len)
+            memcpy(string, cell->data.reader.value.string.ptr,
+                   cell->data.reader.value.string.len);
+        string[cell->data.reader.value.string.len] = '\0';
+        column->kinds[index] = READER_EVAL_STRING;
+        column->values[index] = self->string_count;
+        self->strings[self->string_count++] = string;
+        break;
+    case FORMULA_CELL:
+        if (!_reader_eval_grow((void **) &self->formulas, &self->formula_size,
+                               self->formula_count + 1,
+                               sizeof(reader_eval_formula)))
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+        err = _reader_eval_formula_init(self, cell,
+                                        &self->formulas[self->formula_count]);
+        if (err)
+            return err;
+        column->kinds[index] = READER_EVAL_FORMULA;
+        column->values[index] = self->formula_count++;
+        break;
+    default:
+        column->kinds[index] = READER_EVAL_BLANK;
+        break;
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+/*****************************************************************************
+ *
+ * Streaming the worksheet.
+ *
+ ****************************************************************************/
+
+STATIC lxlsx_error
+_reader_eval_open_stream(lxlsx_reader_eval *self)
+{
+    lxlsx_reader_worksheet_close(self->worksheet);
+    self->worksheet = NULL;
+
+    if (lxlsx_reader_workbook_get_worksheet_by_name(
+            self->workbook, self->sheet_name,
+            LXLSX_READER_SKIP_EMPTY_CELLS | LXLSX_READER_DEFER_METADATA,
+            &self->worksheet) != LXLSX_READER_NO_ERROR)
+        return LXLSX_ERROR_ZIP_FILE_OPERATION;
+
+    self->stats.passes++;
+    return LXLSX_NO_ERROR;
+}
+
+/* Read the next row of the stream into the column store. */
+STATIC lxlsx_error
+_reader_eval_next_row(lxlsx_reader_eval *self)
+{
+    lxlsx_reader_error rc;
+    lxlsx_error err;
+    lxlsx_cell cell;
+    size_t row_num;
+
+    rc = lxlsx_reader_worksheet_next_row(self->worksheet);
+    if (rc == LXLSX_READER_ERROR_END_OF_DATA) {
+        self->eof = LXLSX_TRUE;
+        return LXLSX_NO_ERROR;
+    }
+    if (rc != LXLSX_READER_NO_ERROR) {
+        self->eof = LXLSX_TRUE;
+        return LXLSX_ERROR_ZIP_FILE_OPERATION;
+    }
+
+    while ((rc = lxlsx_reader_worksheet_next_cell(self->worksheet, &cell))
+           == LXLSX_READER_NO_ERROR) {
+        err = _reader_eval_store(self, &cell);
+        if (err)
+            return err;
+    }
+
+    row_num = lxlsx_reader_worksheet_current_row(self->worksheet);
+    if (row_num > self->pos)
+        self->pos = (lxlsx_row_t) row_num;
+
+    self->stats.rows++;
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * Read the rows asked for. Columns asked for above the rows they hold are
+ * backfilled by streaming the worksheet again from the start up to where it
+ * was; the stream then goes on down to the last row asked for.
+ */
+STATIC lxlsx_error
+_reader_eval_fill(lxlsx_reader_eval *self)
+{
+    reader_eval_column *column;
+    lxlsx_row_t pos = self->pos;
+    uint8_t eof = self->eof;
+    uint8_t backfill = LXLSX_FALSE;
+    lxlsx_error err = LXLSX_NO_ERROR;
+    uint32_t shift, i;
+
+    for (i = 0; i < self->column_count; i++) {
+        column = &self->columns[i];
+        if (column->want_row >= column->first_row)
+            continue;
+
+        /* Nothing held yet that far down: just start holding earlier. */
+        if (column->want_row >= pos) {
+            column->first_row = column->want_row;
+            continue;
+        }
+
+        /* The pass goes over the rows above anyway: hold them all, so that
+         * a chain of formulas up the column needs no further pass. */
+        column->want_row = 0;
+        shift = column->first_row;
+        if (column->count) {
+            if (!_reader_eval_column_grow(column, column->count + shift))
+                return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+            memmove(column->kinds + shift, column->kinds,
+                    column->count - shift);
+            memmove(column->values + shift, column->values,
+                    (column->count - shift) * sizeof(double));
+            memset(column->kinds, READER_EVAL_BLANK, shift);
+        }
+
+        column->backfill_end = column->first_row;
+        column->first_row = column->want_row;
+        backfill = LXLSX_TRUE;
+    }
+
+    if (backfill) {
+        err = _reader_eval_open_stream(self);
+        self->eof = LXLSX_FALSE;
+
+        /* Back to where the stream was. */
+        while (!err && !self->eof && self->pos <= pos)
+            err = _reader_eval_next_row(self);
+
+        for (i = 0; i < self->column_count; i++)
+            self->columns[i].backfill_end = 0;
+
+        if (err)
+            return err;
+        if (eof)
+            self->eof = LXLSX_TRUE;
+    }
+
+    while (!err && !self->eof && self->pos <= self->need)
+        err = _reader_eval_next_row(self);
+
+    return err;
+}
+
+/*****************************************************************************
+ *
+ * Evaluation.
+ *
+ ****************************************************************************/
+
+STATIC lxlsx_error _reader_eval_run(lxlsx_reader_eval *self, uint32_t base);
+
+/* Ask for a range and read it; errors are kept for the public call. */
+STATIC void
+_reader_eval_load(lxlsx_reader_eval *self, lxlsx_row_t first_row,
+                  lxlsx_col_t first_col, lxlsx_row_t last_row,
+                  lxlsx_col_t last_col)
+{
+    lxlsx_error err;
+
+    err = _reader_eval_request(self, first_row, first_col, last_row, last_col);
+    if (!err)
+        err = _reader_eval_fill(self);
+    if (err && !self->error)
+        self->error = err;
+}
+
+/* Push a formula onto the evaluation stack. */
+STATIC lxlsx_error
+_reader_eval_push(lxlsx_reader_eval *self, uint32_t formula)
+{
+    if (!_reader_eval_grow((void **) &self->stack, &self->stack_size,
+                           self->stack_count + 1, sizeof(uint32_t)))
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    self->formulas[formula].state = READER_EVAL_PUSHED;
+    self->stack[self->stack_count++] = formula;
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * The value of a held cell, a formula's result once evaluated. Strings are
+ * borrowed. A formula referred to while it is being evaluated reads as 0.
+ */
+STATIC void
+_reader_eval_value(lxlsx_reader_eval *self, lxlsx_row_t row, lxlsx_col_t col,
+                   lxlsx_value *out)
+{
+    reader_eval_column *column;
+    reader_eval_formula *formula;
+    uint32_t index, base;
+    lxlsx_error err;
+
+    out->kind = LXLSX_VAL_BLANK;
+    out->number = 0.0;
+    out->string = NULL;
+    out->error = LXLSX_FERR_NONE;
+
+    column = _reader_eval_column(self, col, NULL);
+    if (!column || row < column->first_row
+        || row - column->first_row >= column->count)
+        return;
+
+    index = row - column->first_row;
+    switch (column->kinds[index]) {
+    case READER_EVAL_NUMBER:
+        out->kind = LXLSX_VAL_NUMBER;
+        out->number = column->values[index];
+        break;
+    case READER_EVAL_BOOL:
+        out->kind = LXLSX_VAL_BOOL;
+        out->number = column->values[index];
+        break;
+    case READER_EVAL_STRING:
+        out->kind = LXLSX_VAL_STRING;
+        out->string = self->strings[(uint32_t) column->values[index]];
+        break;
+    case READER_EVAL_ERROR:
+        out->kind = LXLSX_VAL_ERROR;
+        out->error = (lxlsx_formula_error) column->values[index];
+        break;
+    case READER_EVAL_FORMULA:
+        index = (uint32_t) column->values[index];
+
+        /* Normally evaluated already, from the references looked at before
+         * the formula referring to it. */
+        if (self->formulas[index].state < READER_EVAL_EXPANDED) {
+            base = self->stack_count;
+            err = _reader_eval_push(self, index);
+            if (!err)
+                err = _reader_eval_run(self, base);
+            if (err && !self->error)
+                self->error = err;
+        }
+
+        formula = &self->formulas[index];
+        if (formula->state == READER_EVAL_DONE) {
+            *out = formula->result;
+        }
+        else if (formula->state == READER_EVAL_EXPANDED) {
+            out->kind = LXLSX_VAL_NUMBER;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Resolve a cell for the formula engine, streaming it in if needed. */
+STATIC void
+_reader_eval_resolver(void *ctx, lxlsx_row_t row, lxlsx_col_t col,
+                      lxlsx_value *out)
+{
+    lxlsx_reader_eval *self = ctx;
+
+    _reader_eval_load(self, row, col, row, col);
+    _reader_eval_value(self, row, col, out);
+
+    /* The engine frees the strings it is handed. */
+    if (out->kind == LXLSX_VAL_STRING) {
+        out->string = lxlsx_strdup(out->string);
+        if (!out->string)
+            out->kind = LXLSX_VAL_BLANK;
+    }
+}
+
+/*
+ * Resolve a range for the aggregate functions, row by row as the sink
+ * expects. Rows past the last one held in the range are blank.
+ */
+STATIC void
+_reader_eval_range_resolver(void *ctx, lxlsx_row_t first_row,
+                            lxlsx_col_t first_col, lxlsx_row_t last_row,
+                            lxlsx_col_t last_col, lxlsx_range_sink *sink)
+{
+    lxlsx_reader_eval *self = ctx;
+    double numbers[READER_EVAL_RANGE_RUN];
+    reader_eval_column *column;
+    lxlsx_row_t end = first_row;
+    lxlsx_value value;
+    size_t count = 0;
+    lxlsx_row_t row;
+    lxlsx_col_t col;
+    uint32_t index;
+
+    _reader_eval_load(self, first_row, first_col, last_row, last_col);
+
+    _reader_eval_column(self, first_col, &index);
+    for (; index < self->column_count; index++) {
+        column = &self->columns[index];
+        if (column->col > last_col)
+            break;
+        if (column->first_row + column->count > end)
+            end = column->first_row + column->count;
+    }
+    if (end <= first_row)
+        return;
+
+    for (row = first_row; row < end && row <= last_row; row++) {
+        for (col = first_col;; col++) {
+            _reader_eval_value(self, row, col, &value);
+
+            if (value.kind == LXLSX_VAL_NUMBER) {
+                numbers[count++] = value.number;
+                if (count == READER_EVAL_RANGE_RUN) {
+                    if (!lxlsx_range_sink_numbers(sink, numbers, count))
+                        return;
+                    count = 0;
+                }
+            }
+            else if (value.kind != LXLSX_VAL_BLANK) {
+                if (count > 0 && !lxlsx_range_sink_numbers(sink, numbers, count))
+                    return;
+                count = 0;
+
+                if (!lxlsx_range_sink_value(sink, &value))
+                    return;
+            }
+
+            if (col == last_col)
+                break;
+        }
+    }
+
+    if (count > 0)
+        lxlsx_range_sink_numbers(sink, numbers, count);
+}
+
+/* Collect a formula's references, see lxlsx_formula_refs_copied(). */
+STATIC void
+_reader_eval_add_ref(void *ctx, lxlsx_row_t first_row, lxlsx_col_t first_col,
+                     lxlsx_row_t last_row, lxlsx_col_t last_col)
+{
+    lxlsx_reader_eval *self = ctx;
+    reader_eval_ref *ref;
+
+    if (!_reader_eval_grow((void **) &self->refs, &self->ref_size,
+                           self->ref_count + 1, sizeof(reader_eval_ref))) {
+        self->ref_failed = LXLSX_TRUE;
+        return;
+    }
+
+    ref = &self->refs[self->ref_count++];
+    ref->first_row = first_row;
+    ref->last_row = last_row;
+    ref->first_col = first_col;
+    ref->last_col = last_col;
+}
+
+/*
+ * Read the cells a formula refers to, in one go, and push the formula cells
+ * among them that aren't evaluated yet. Those already being evaluated are on
+ * a circular reference and are left out.
+ */
+STATIC lxlsx_error
+_reader_eval_expand(lxlsx_reader_eval *self, const char *formula,
+                    lxlsx_row_t from_row, lxlsx_col_t from_col,
+                    lxlsx_row_t row, lxlsx_col_t col)
+{
+    reader_eval_column *column;
+    reader_eval_ref *ref;
+    lxlsx_row_t first, last;
+    lxlsx_error err;
+    uint32_t i, index, k, formula_index;
+
+    self->ref_count = 0;
+    self->ref_failed = LXLSX_FALSE;
+    err = lxlsx_formula_refs_copied(self->cache, formula, from_row, from_col,
+                                    row, col, _reader_eval_add_ref, self);
+    if (!err && self->ref_failed)
+        err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    for (i = 0; !err && i < self->ref_count; i++) {
+        ref = &self->refs[i];
+        err = _reader_eval_request(self, ref->first_row, ref->first_col,
+                                   ref->last_row, ref->last_col);
+    }
+    if (!err)
+        err = _reader_eval_fill(self);
+    if (err)
+        return err;
+
+    for (i = 0; i < self->ref_count; i++) {
+        ref = &self->refs[i];
+        _reader_eval_column(self, ref->first_col, &index);
+
+        for (; index < self->column_count; index++) {
+            column = &self->columns[index];
+            if (column->col > ref->last_col)
+                break;
+            if (!column->count || ref->last_row < column->first_row)
+                continue;
+
+            first = ref->first_row > column->first_row
+                ? ref->first_row : column->first_row;
+            last = column->first_row + column->count - 1;
+            if (ref->last_row < last)
+                last = ref->last_row;
+
+            for (k = first - column->first_row;
+                 k <= last - column->first_row; k++) {
+                if (column->kinds[k] != READER_EVAL_FORMULA)
+                    continue;
+
+                formula_index = (uint32_t) column->values[k];
+                if (self->formulas[formula_index].state < READER_EVAL_EXPANDED) {
+                    err = _reader_eval_push(self, formula_index);
+                    if (err)
+                        return err;
+                }
+            }
+        }
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * Evaluate the formulas on the stack above base. Each is looked at twice:
+ * first its references are read and the formulas among them pushed above it,
+ * then, with those evaluated, it is evaluated itself. An explicit stack
+ * rather than recursion keeps long chains of formulas, such as a running
+ * total down a column, off the C stack.
+ */
+STATIC lxlsx_error
+_reader_eval_run(lxlsx_reader_eval *self, uint32_t base)
+{
+    reader_eval_formula *formula;
+    lxlsx_value result;
+    lxlsx_error err;
+    uint32_t index;
+
+    while (self->stack_count > base) {
+        index = self->stack[self->stack_count - 1];
+        formula = &self->formulas[index];
+
+        if (formula->state == READER_EVAL_DONE) {
+            self->stack_count--;
+            continue;
+        }
+
+        if (!formula->formula) {
+            formula->state = READER_EVAL_DONE;
+            continue;
+        }
+
+        if (formula->state != READER_EVAL_EXPANDED) {
+            formula->state = READER_EVAL_EXPANDED;
+            err = _reader_eval_expand(self, formula->formula,
+                                      formula->from_row, formula->from_col,
+                                      formula->row, formula->col);
+            if (err)
+                goto error;
+            continue;
+        }
+
+        err = lxlsx_formula_eval_copied(self->cache, formula->formula,
+                                        formula->from_row, formula->from_col,
+                                        formula->row, formula->col,
+                                        _reader_eval_resolver,
+                                        _reader_eval_range_resolver, self,
+                                        &result);
+        if (err)
+            goto error;
+
+        /* The table may have grown while the formula was evaluated. */
+        formula = &self->formulas[index];
+        formula->result = result;
+        formula->state = READER_EVAL_DONE;
+        self->stats.evaluated++;
+        self->stack_count--;
+    }
+
+    return LXLSX_NO_ERROR;
+
+error:
+    /* Formulas left half-way are looked at again on the next call. */
+    while (self->stack_count > base) {
+        index = self->stack[--self->stack_count];
+        if (self->formulas[index].state != READER_EVAL_DONE)
+            self->formulas[index].state = READER_EVAL_PENDING;
+    }
+    return err;
+}
+
+/* Hand over a value, copying a borrowed string. */
+STATIC lxlsx_error
+_reader_eval_copy(const lxlsx_value *value, lxlsx_value *out)
+{
+    *out = *value;
+
+    if (value->kind == LXLSX_VAL_STRING) {
+        out->string = lxlsx_strdup(value->string ? value->string : "");
+        RETURN_ON_MEM_ERROR(out->string, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+/* Return and clear the first error met while resolving. */
+STATIC lxlsx_error
+_reader_eval_result(lxlsx_reader_eval *self, lxlsx_error err)
+{
+    if (!err)
+        err = self->error;
+    self->error = LXLSX_NO_ERROR;
+    return err;
+}
+
+/*****************************************************************************
+ *
+ * Public functions.
+ *
+ ****************************************************************************/
+
+lxlsx_reader_error
+lxlsx_reader_eval_open(const char *filename, const char *sheet_name,
+                       lxlsx_formula_cache *cache, lxlsx_reader_eval **out)
+{
+    lxlsx_reader_eval *self;
+    lxlsx_reader_error rc;
+
+    if (!filename || !out)
+        return LXLSX_READER_ERROR_NULL_PARAMETER;
+
+    *out = NULL;
+
+    self = calloc(1, sizeof(lxlsx_reader_eval));
+    if (!self)
+        return LXLSX_READER_ERROR_MEMORY_MALLOC_FAILED;
+
+    /* A handle of its own: a worksheet stream holds its file's zip entry. */
+    rc = lxlsx_reader_workbook_open(filename, &self->workbook);
+    if (rc != LXLSX_READER_NO_ERROR)
+        goto error;
+
+    rc = LXLSX_READER_ERROR_MEMORY_MALLOC_FAILED;
+    if (sheet_name) {
+        self->sheet_name = lxlsx_strdup(sheet_name);
+        if (!self->sheet_name)
+            goto error;
+    }
+
+    self->cache = cache;
+    if (!cache) {
+        self->own_cache = lxlsx_formula_cache_new(0);
+        if (!self->own_cache)
+            goto error;
+        self->cache = self->own_cache;
+    }
+
+    /* Check the worksheet is there; its data is read on demand. */
+    if (_reader_eval_open_stream(self) != LXLSX_NO_ERROR) {
+        rc = LXLSX_READER_ERROR_SHEET_NOT_FOUND;
+        goto error;
+    }
+
+    *out = self;
+    return LXLSX_READER_NO_ERROR;
+
+error:
+    lxlsx_reader_eval_close(self);
+    return rc;
+}
+
+lxlsx_error
+lxlsx_reader_eval_cell(lxlsx_reader_eval *self, const lxlsx_cell *cell,
+                       lxlsx_value *out)
+{
+    reader_eval_formula formula;
+    lxlsx_value value;
+    lxlsx_error err;
+    uint32_t base;
+
+    if (!self || !cell || !out || !cell->row_num || !cell->col_num)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    memset(out, 0, sizeof(*out));
+
+    if (cell->type != FORMULA_CELL)
+        return lxlsx_reader_eval_at(self, cell->row_num - 1,
+                                    cell->col_num - 1, out);
+
+    err = _reader_eval_add_shared(self, cell);
+    if (!err)
+        err = _reader_eval_formula_init(self, cell, &formula);
+    if (err)
+        return err;
+
+    if (!formula.formula) {
+        free(formula.text);
+        return LXLSX_NO_ERROR;
+    }
+
+    /* The formula cells it refers to first, then the formula itself. */
+    base = self->stack_count;
+    err = _reader_eval_expand(self, formula.formula,
+                              formula.from_row, formula.from_col,
+                              formula.row, formula.col);
+    if (!err)
+        err = _reader_eval_run(self, base);
+    if (!err)
+        err = lxlsx_formula_eval_copied(self->cache, formula.formula,
+                                        formula.from_row, formula.from_col,
+                                        formula.row, formula.col,
+                                        _reader_eval_resolver,
+                                        _reader_eval_range_resolver, self,
+                                        &value);
+    free(formula.text);
+    self->stack_count = base;
+
+    if (!err)
+        *out = value;
+
+    return _reader_eval_result(self, err);
+}
+
+lxlsx_error
+lxlsx_reader_eval_at(lxlsx_reader_eval *self, lxlsx_row_t row,
+                     lxlsx_col_t col, lxlsx_value *out)
+{
+    lxlsx_value value;
+    lxlsx_error err;
+
+    if (!self || !out)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    memset(out, 0, sizeof(*out));
+
+    _reader_eval_load(self, row, col, row, col);
+    _reader_eval_value(self, row, col, &value);
+    err = _reader_eval_copy(&value, out);
+
+    return _reader_eval_result(self, err);
+}
+
+void
+lxlsx_reader_eval_stats_get(const lxlsx_reader_eval *self,
+                            lxlsx_reader_eval_stats *stats)
+{
+    uint32_t i;
+
+    if (!stats)
+        return;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!self)
+        return;
+
+    *stats = self->stats;
+    stats->columns = self->column_count;
+    for (i = 0; i < self->column_count; i++)
+        stats->cells += self->columns[i].count;
+}
+
+void
+lxlsx_reader_eval_close(lxlsx_reader_eval *self)
+{
+    uint32_t i;
+
+    if (!self)
+        return;
+
+    lxlsx_reader_worksheet_close(self->worksheet);
+    lxlsx_reader_workbook_close(self->workbook);
+    lxlsx_formula_cache_free(self->own_cache);
+
+    for (i = 0; i < self->column_count; i++) {
+        free(self->columns[i].kinds);
+        free(self->columns[i].values);
+    }
+    free(self->columns);
+
+    for (i = 0; i < self->string_count; i++)
+        free(self->strings[i]);
+    free(self->strings);
+
+    for (i = 0; i < self->formula_count; i++) {
+        free(self->formulas[i].text);
+        lxlsx_value_free(&self->formulas[i].result);
+    }
+    free(self->formulas);
+
+    for (i = 0; i < self->shared_size; i++)
+        free(self->shared[i].formula);
+    free(self->shared);
+
+    free(self->refs);
+    free(self->stack);
+    free(self->sheet_name);
+    free(self);
+}
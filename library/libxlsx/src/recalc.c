@@ -0,0 +1,1272 @@
+/*
+ * libxlsx
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Formula recalculation for write-side worksheets: collect the formula cells,
+ * link each to the formula cells it refers to, order them topologically and
+ * evaluate each once (see recalc.h).
+ */
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libxlsx/recalc.h"
+#include "libxlsx/utility.h"
+
+/* A formula cell of the graph, or a range node (cell NULL): a segment of a
+ * column's formula cells that the references covering it depend on at once. */
+typedef struct recalc_node {
+    lxlsx_cell *cell;
+    lxlsx_row_t row;
+    lxlsx_col_t col;
+    uint32_t first_ref;  /* its references, in lxlsx_recalc.refs */
+    uint32_t ref_count;
+    uint32_t pending;    /* formulas it still waits for while ordering */
+    uint32_t level;      /* longest chain of formulas it depends on */
+    uint8_t dirty;
+    uint8_t circular;
+} recalc_node;
+
+typedef struct recalc_ref {
+    lxlsx_row_t first_row;
+    lxlsx_row_t last_row;
+    lxlsx_col_t first_col;
+    lxlsx_col_t last_col;
+} recalc_ref;
+
+typedef struct recalc_pos {
+    lxlsx_row_t row;
+    lxlsx_col_t col;
+} recalc_pos;
+
+/* Formula cell `to` refers to formula cell `from`. */
+typedef struct recalc_edge {
+    uint32_t from;
+    uint32_t to;
+} recalc_edge;
+
+struct lxlsx_recalc {
+    /* Used when the caller passes no cache. */
+    lxlsx_formula_cache *cache;
+
+    /* Formula cells in row-major order, then the range nodes, and the
+     * references of the formula cells. */
+    recalc_node *nodes;
+    uint32_t node_count;
+    uint32_t graph_count;
+    recalc_ref *refs;
+    uint32_t ref_count;
+    uint32_t ref_size;
+    uint8_t ref_failed;
+
+    /* The formulas referring to node i are dependents[dependent_start[i]]
+     * up to dependents[dependent_start[i + 1]]. */
+    uint32_t *dependent_start;
+    uint32_t *dependents;
+
+    /* Topological order of every node that isn't circular, range nodes
+     * included. */
+    uint32_t *topo;
+    uint32_t topo_count;
+
+    /* Topological order of the formulas that aren't circular, by level and
+     * then column-major, so that independent formulas copied down a column
+     * are next to each other. */
+    uint32_t *order;
+    uint32_t order_count;
+
+    /* Non-formula cells written since the last pass. */
+    recalc_pos *changed;
+    uint32_t changed_count;
+    uint32_t changed_size;
+
+    /* Formula cells were written: build the graph again on the next pass. */
+    uint8_t stale;
+};
+
+/* Numbers passed to the formula engine per lxlsx_range_sink_numbers() call. */
+#define RECALC_RANGE_RUN 256
+
+/* Formulas copied down a column are evaluated a column at a time from this
+ * many rows on. */
+#define RECALC_COLUMN_MIN 16
+
+/*****************************************************************************
+ *
+ * Resolving cells.
+ *
+ ****************************************************************************/
+
+/*
+ * Read a cell as a formula value. Formula cells read as their cached result,
+ * which the pass keeps up to date in evaluation order. Strings are borrowed.
+ */
+STATIC void
+_recalc_cell_value(const lxlsx_cell *cell, lxlsx_value *out)
+{
+    out->kind = LXLSX_VAL_BLANK;
+    out->number = 0.0;
+    out->string = NULL;
+    out->error = LXLSX_FERR_NONE;
+
+    switch (cell->type) {
+    case NUMBER_CELL:
+        out->kind = LXLSX_VAL_NUMBER;
+        out->number = cell->data.writer.value.number;
+        break;
+    case BOOLEAN_CELL:
+        out->kind = LXLSX_VAL_BOOL;
+        out->number = cell->data.writer.value.boolean ? 1.0 : 0.0;
+        break;
+    case STRING_CELL:
+        if (cell->data.writer.value.shared_string.string) {
+            out->kind = LXLSX_VAL_STRING;
+            out->string =
+                (char *) cell->data.writer.value.shared_string.string;
+        }
+        break;
+    case INLINE_STRING_CELL:
+        if (cell->data.writer.value.string) {
+            out->kind = LXLSX_VAL_STRING;
+            out->string = (char *) cell->data.writer.value.string;
+        }
+        break;
+    case FORMULA_CELL:
+        if (cell->data.writer.value.formula->result_string) {
+            out->kind = LXLSX_VAL_STRING;
+            out->string =
+                (char *) cell->data.writer.value.formula->result_string;
+        }
+        else {
+            out->kind = LXLSX_VAL_NUMBER;
+            out->number = cell->data.writer.value.formula->result;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+STATIC void
+_recalc_resolver(void *ctx, lxlsx_row_t row_num, lxlsx_col_t col_num,
+                 lxlsx_value *out)
+{
+    lxlsx_worksheet *worksheet = ctx;
+    lxlsx_row *row;
+    lxlsx_cell *cell;
+
+    out->kind = LXLSX_VAL_BLANK;
+    out->number = 0.0;
+    out->string = NULL;
+    out->error = LXLSX_FERR_NONE;
+
+    row = lxlsx_worksheet_find_row(worksheet, row_num);
+    if (!row)
+        return;
+
+    cell = lxlsx_worksheet_find_cell_in_row(row, col_num);
+    if (!cell)
+        return;
+
+    _recalc_cell_value(cell, out);
+
+    /* The engine owns the strings a resolver returns. */
+    if (out->kind == LXLSX_VAL_STRING) {
+        out->string = lxlsx_strdup(out->string);
+        if (!out->string)
+            out->kind = LXLSX_VAL_BLANK;
+    }
+}
+
+STATIC void
+_recalc_range_resolver(void *ctx, lxlsx_row_t first_row, lxlsx_col_t first_col,
+                       lxlsx_row_t last_row, lxlsx_col_t last_col,
+                       lxlsx_range_sink *sink)
+{
+    lxlsx_worksheet *worksheet = ctx;
+    double numbers[RECALC_RANGE_RUN];
+    size_t count = 0;
+    lxlsx_row *row;
+    lxlsx_cell *cell;
+    lxlsx_value value;
+
+    for (row = lxlsx_worksheet_find_row_from(worksheet, first_row);
+         row && row->row_num <= last_row;
+         row = lxlsx_worksheet_next_row(row)) {
+
+        for (cell = lxlsx_worksheet_find_cell_from(row, first_col);
+             cell && cell->col_num <= last_col;
+             cell = lxlsx_worksheet_next_cell(cell)) {
+
+            _recalc_cell_value(cell, &value);
+
+            if (value.kind == LXLSX_VAL_NUMBER) {
+                numbers[count++] = value.number;
+                if (count == RECALC_RANGE_RUN) {
+                    if (!lxlsx_range_sink_numbers(sink, numbers, count))
+                        return;
+                    count = 0;
+                }
+                continue;
+            }
+
+            if (value.kind == LXLSX_VAL_BLANK)
+                continue;
+
+            if (count && !lxlsx_range_sink_numbers(sink, numbers, count))
+                return;
+            count = 0;
+
+            if (!lxlsx_range_sink_value(sink, &value))
+                return;
+        }
+    }
+
+    if (count)
+        lxlsx_range_sink_numbers(sink, numbers, count);
+}
+
+/*
+ * Resolve a column of cells as numbers for lxlsx_formula_eval_column(). One
+ * tree search per row present in the range; missing rows are blank.
+ */
+STATIC void
+_recalc_column_resolver(void *ctx, lxlsx_row_t first_row, lxlsx_col_t col_num,
+                        uint32_t count, double *values, uint8_t *numeric)
+{
+    lxlsx_worksheet *worksheet = ctx;
+    lxlsx_row *row;
+    lxlsx_cell *cell;
+    lxlsx_value value;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        values[i] = 0.0;
+        numeric[i] = LXLSX_TRUE;
+    }
+
+    for (row = lxlsx_worksheet_find_row_from(worksheet, first_row);
+         row && row->row_num - first_row < count;
+         row = lxlsx_worksheet_next_row(row)) {
+
+        cell = lxlsx_worksheet_find_cell_in_row(row, col_num);
+        if (!cell)
+            continue;
+
+        _recalc_cell_value(cell, &value);
+        i = row->row_num - first_row;
+
+        if (value.kind == LXLSX_VAL_NUMBER || value.kind == LXLSX_VAL_BOOL)
+            values[i] = value.number;
+        else if (value.kind != LXLSX_VAL_BLANK)
+            numeric[i] = LXLSX_FALSE;
+    }
+}
+
+/*****************************************************************************
+ *
+ * Building the graph.
+ *
+ ****************************************************************************/
+
+/* Free the graph, keeping the cache and the changed cell buffer. */
+STATIC void
+_recalc_reset(lxlsx_recalc *self)
+{
+    free(self->nodes);
+    free(self->refs);
+    free(self->dependent_start);
+    free(self->dependents);
+    free(self->topo);
+    free(self->order);
+
+    self->nodes = NULL;
+    self->node_count = 0;
+    self->graph_count = 0;
+    self->refs = NULL;
+    self->ref_count = 0;
+    self->ref_size = 0;
+    self->ref_failed = LXLSX_FALSE;
+    self->dependent_start = NULL;
+    self->dependents = NULL;
+    self->topo = NULL;
+    self->topo_count = 0;
+    self->order = NULL;
+    self->order_count = 0;
+    self->changed_count = 0;
+}
+
+STATIC void
+_recalc_add_ref(void *ctx, lxlsx_row_t first_row, lxlsx_col_t first_col,
+                lxlsx_row_t last_row, lxlsx_col_t last_col)
+{
+    lxlsx_recalc *self = ctx;
+    recalc_ref *refs;
+    uint32_t size;
+
+    if (self->ref_count == self->ref_size) {
+        size = self->ref_size ? self->ref_size * 2 : 64;
+        refs = realloc(self->refs, size * sizeof(recalc_ref));
+        if (!refs) {
+            self->ref_failed = LXLSX_TRUE;
+            return;
+        }
+
+        self->refs = refs;
+        self->ref_size = size;
+    }
+
+    self->refs[self->ref_count].first_row = first_row;
+    self->refs[self->ref_count].last_row = last_row;
+    self->refs[self->ref_count].first_col = first_col;
+    self->refs[self->ref_count].last_col = last_col;
+    self->ref_count++;
+}
+
+/*
+ * Whether a formula refers to another worksheet, e.g. Sheet2!A1 or
+ * 'My sheet'!A1. References resolve on the formula's own worksheet only, so
+ * such formulas keep the result they were written with.
+ */
+STATIC uint8_t
+_recalc_sheet_qualified(const char *formula)
+{
+    const char *p = formula;
+
+    while (p && *p) {
+        if (*p == '"') {
+            /* A string literal; "" is an escaped quote. */
+            for (p++; *p; p++) {
+                if (*p == '"' && p[1] != '"')
+                    break;
+                if (*p == '"')
+                    p++;
+            }
+            if (*p)
+                p++;
+            continue;
+        }
+
+        if (*p == '#') {
+            /* An error literal such as #DIV/0! or #NAME?. */
+            for (p++; *p && (isalnum((unsigned char) *p) || *p == '/'
+                             || *p == '_'); p++)
+                ;
+            if (*p == '!' || *p == '?')
+                p++;
+            continue;
+        }
+
+        if (*p == '!')
+            return LXLSX_TRUE;
+        p++;
+    }
+
+    return LXLSX_FALSE;
+}
+
+/* Collect the formula cells of the worksheet and their references. Formulas
+ * referring to other worksheets are left out. */
+STATIC lxlsx_error
+_recalc_collect(lxlsx_recalc *self, lxlsx_worksheet *worksheet,
+                lxlsx_formula_cache *cache)
+{
+    recalc_node *node;
+    lxlsx_row *row;
+    lxlsx_cell *cell;
+    lxlsx_error err;
+    uint32_t count = 0;
+
+    for (row = lxlsx_worksheet_find_row_from(worksheet, 0); row;
+         row = lxlsx_worksheet_next_row(row)) {
+        for (cell = lxlsx_worksheet_find_cell_from(row, 0); cell;
+             cell = lxlsx_worksheet_next_cell(cell)) {
+            if (cell->type == FORMULA_CELL
+                && !_recalc_sheet_qualified(
+                       cell->data.writer.value.formula->formula))
+                count++;
+        }
+    }
+
+    if (!count)
+        return LXLSX_NO_ERROR;
+
+    self->nodes = calloc(count, sizeof(recalc_node));
+    RETURN_ON_MEM_ERROR(self->nodes, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+
+    for (row = lxlsx_worksheet_find_row_from(worksheet, 0); row;
+         row = lxlsx_worksheet_next_row(row)) {
+        for (cell = lxlsx_worksheet_find_cell_from(row, 0); cell;
+             cell = lxlsx_worksheet_next_cell(cell)) {
+            if (cell->type != FORMULA_CELL
+                || _recalc_sheet_qualified(
+                       cell->data.writer.value.formula->formula))
+                continue;
+
+            node = &self->nodes[self->node_count++];
+            node->cell = cell;
+            node->row = row->row_num;
+            node->col = cell->col_num;
+            node->first_ref = self->ref_count;
+
+            err = lxlsx_formula_refs_at(cache,
+                                        cell->data.writer.value.formula->formula,
+                                        node->row, node->col,
+                                        _recalc_add_ref, self);
+            if (err)
+                return err;
+            if (self->ref_failed)
+                return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+            node->ref_count = self->ref_count - node->first_ref;
+        }
+    }
+
+    self->graph_count = self->node_count;
+    return LXLSX_NO_ERROR;
+}
+
+typedef struct recalc_edges {
+    recalc_edge *edges;
+    size_t count;
+    size_t size;
+} recalc_edges;
+
+STATIC lxlsx_error
+_recalc_add_edge(recalc_edges *edges, uint32_t from, uint32_t to)
+{
+    recalc_edge *new_edges;
+    size_t size;
+
+    if (edges->count == edges->size) {
+        if (edges->size > SIZE_MAX / 2 / sizeof(recalc_edge))
+            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+        size = edges->size ? edges->size * 2 : 64;
+        new_edges = realloc(edges->edges, size * sizeof(recalc_edge));
+        RETURN_ON_MEM_ERROR(new_edges, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+
+        edges->edges = new_edges;
+        edges->size = size;
+    }
+
+    edges->edges[edges->count].from = from;
+    edges->edges[edges->count].to = to;
+    edges->count++;
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * Add the range nodes of a column holding `count` formula cells, col_nodes in
+ * row order: a segment tree whose node p (1 to count - 1) covers its children
+ * 2p and 2p + 1, and whose leaf count + i is formula cell col_nodes[i]. Node p
+ * is nodes[*base + p - 1].
+ */
+STATIC lxlsx_error
+_recalc_add_tree(lxlsx_recalc *self, recalc_edges *edges,
+                 const uint32_t *col_nodes, uint32_t count, lxlsx_col_t col,
+                 uint32_t *base)
+{
+    recalc_node *nodes;
+    lxlsx_error err;
+    uint32_t p, child, c;
+
+    if (self->graph_count > UINT32_MAX - count)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    nodes = realloc(self->nodes,
+                    ((size_t) self->graph_count + count - 1)
+                    * sizeof(recalc_node));
+    RETURN_ON_MEM_ERROR(nodes, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+    self->nodes = nodes;
+
+    *base = self->graph_count;
+    memset(&nodes[*base], 0, (size_t) (count - 1) * sizeof(recalc_node));
+    for (p = 1; p < count; p++)
+        nodes[*base + p - 1].col = col;
+    self->graph_count += count - 1;
+
+    for (p = 1; p < count; p++) {
+        for (c = 0; c < 2; c++) {
+            child = 2 * p + c;
+            err = _recalc_add_edge(edges,
+                                   child >= count ? col_nodes[child - count]
+                                                  : *base + child - 1,
+                                   *base + p - 1);
+            if (err)
+                return err;
+        }
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * Link each formula cell to the formula cells inside its references. Those
+ * are looked up by column, each column's formula cells being in row order. A
+ * reference covering several of them is linked to the range nodes covering
+ * them instead, a few per reference, so that e.g. a running total down a
+ * column of formulas doesn't need an edge per pair of rows.
+ */
+STATIC lxlsx_error
+_recalc_link(lxlsx_recalc *self)
+{
+    lxlsx_error err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    recalc_edges edges = {NULL, 0, 0};
+    uint32_t *col_start = NULL;
+    uint32_t *col_nodes = NULL;
+    uint32_t *tree_base = NULL;
+    lxlsx_col_t max_col = 0;
+    lxlsx_col_t col;
+    recalc_ref *ref;
+    uint32_t low, high, mid, end;
+    uint32_t count, first, last, from;
+    uint32_t i;
+    size_t k;
+
+    for (i = 0; i < self->node_count; i++) {
+        if (self->nodes[i].col > max_col)
+            max_col = self->nodes[i].col;
+    }
+
+    col_start = calloc((size_t) max_col + 2, sizeof(uint32_t));
+    GOTO_LABEL_ON_MEM_ERROR(col_start, mem_error);
+    col_nodes = malloc(self->node_count * sizeof(uint32_t));
+    GOTO_LABEL_ON_MEM_ERROR(col_nodes, mem_error);
+    tree_base = calloc((size_t) max_col + 1, sizeof(uint32_t));
+    GOTO_LABEL_ON_MEM_ERROR(tree_base, mem_error);
+
+    /* A counting sort by column keeps the row order within a column. */
+    for (i = 0; i < self->node_count; i++)
+        col_start[self->nodes[i].col + 1]++;
+    for (col = 0; col <= max_col; col++)
+        col_start[col + 1] += col_start[col];
+    for (i = 0; i < self->node_count; i++)
+        col_nodes[col_start[self->nodes[i].col]++] = i;
+    for (col = max_col + 1; col > 0; col--)
+        col_start[col] = col_start[col - 1];
+    col_start[0] = 0;
+
+    for (i = 0; i < self->node_count; i++) {
+        for (k = 0; k < self->nodes[i].ref_count; k++) {
+            ref = &self->refs[self->nodes[i].first_ref + k];
+
+            for (col = ref->first_col; col <= ref->last_col && col <= max_col;
+                 col++) {
+                low = col_start[col];
+                high = col_start[col + 1];
+
+                while (low < high) {
+                    mid = low + (high - low) / 2;
+                    if (self->nodes[col_nodes[mid]].row < ref->first_row)
+                        low = mid + 1;
+                    else
+                        high = mid;
+                }
+
+                end = low;
+                high = col_start[col + 1];
+                while (end < high) {
+                    mid = end + (high - end) / 2;
+                    if (self->nodes[col_nodes[mid]].row <= ref->last_row)
+                        end = mid + 1;
+                    else
+                        high = mid;
+                }
+
+                if (low == end)
+                    continue;
+
+                if (end - low == 1) {
+                    err = _recalc_add_edge(&edges, col_nodes[low], i);
+                    if (err)
+                        goto mem_error;
+                    continue;
+                }
+
+                count = col_start[col + 1] - col_start[col];
+                if (!tree_base[col]) {
+                    err = _recalc_add_tree(self, &edges,
+                                           col_nodes + col_start[col], count,
+                                           col, &tree_base[col]);
+                    if (err)
+                        goto mem_error;
+                }
+
+                /* The segment tree nodes covering [low, end). */
+                first = low - col_start[col] + count;
+                last = end - col_start[col] + count;
+                while (first < last) {
+                    if (first & 1) {
+                        from = first >= count ? col_nodes[col_start[col] + first - count]
+                                              : tree_base[col] + first - 1;
+                        err = _recalc_add_edge(&edges, from, i);
+                        if (err)
+                            goto mem_error;
+                        first++;
+                    }
+                    if (last & 1) {
+                        last--;
+                        from = last >= count ? col_nodes[col_start[col] + last - count]
+                                             : tree_base[col] + last - 1;
+                        err = _recalc_add_edge(&edges, from, i);
+                        if (err)
+                            goto mem_error;
+                    }
+                    first /= 2;
+                    last /= 2;
+                }
+            }
+        }
+    }
+
+    err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    self->dependent_start = calloc((size_t) self->graph_count + 1,
+                                   sizeof(uint32_t));
+    GOTO_LABEL_ON_MEM_ERROR(self->dependent_start, mem_error);
+
+    if (edges.count) {
+        if (edges.count > UINT32_MAX)
+            goto mem_error;
+        self->dependents = malloc(edges.count * sizeof(uint32_t));
+        GOTO_LABEL_ON_MEM_ERROR(self->dependents, mem_error);
+    }
+
+    for (k = 0; k < edges.count; k++) {
+        self->dependent_start[edges.edges[k].from + 1]++;
+        self->nodes[edges.edges[k].to].pending++;
+    }
+    for (i = 0; i < self->graph_count; i++)
+        self->dependent_start[i + 1] += self->dependent_start[i];
+
+    /* Fill using dependent_start itself as the insertion cursor of each node,
+     * shifted back into place afterwards. */
+    for (k = 0; k < edges.count; k++)
+        self->dependents[self->dependent_start[edges.edges[k].from]++] =
+            edges.edges[k].to;
+    for (i = self->graph_count; i > 0; i--)
+        self->dependent_start[i] = self->dependent_start[i - 1];
+    self->dependent_start[0] = 0;
+
+    err = LXLSX_NO_ERROR;
+
+mem_error:
+    free(edges.edges);
+    free(col_start);
+    free(col_nodes);
+    free(tree_base);
+    return err;
+}
+
+/*
+ * Order the formula cells that aren't circular by level, then column, then
+ * row. Formulas of one level don't depend on each other, so this is an order
+ * to evaluate them in, and it puts a formula copied down a column into one
+ * run.
+ */
+STATIC lxlsx_error
+_recalc_order_by_level(lxlsx_recalc *self)
+{
+    lxlsx_error err = LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    uint32_t *by_col = NULL;
+    uint32_t *start = NULL;
+    uint32_t max_level = 0;
+    lxlsx_col_t max_col = 0;
+    recalc_node *node;
+    uint32_t i, size;
+
+    if (!self->order_count)
+        return LXLSX_NO_ERROR;
+
+    for (i = 0; i < self->node_count; i++) {
+        node = &self->nodes[i];
+        if (node->circular)
+            continue;
+        if (node->level > max_level)
+            max_level = node->level;
+        if (node->col > max_col)
+            max_col = node->col;
+    }
+
+    size = (max_level > max_col ? max_level : max_col) + 2;
+    start = calloc(size, sizeof(uint32_t));
+    GOTO_LABEL_ON_MEM_ERROR(start, mem_error);
+    by_col = malloc(self->order_count * sizeof(uint32_t));
+    GOTO_LABEL_ON_MEM_ERROR(by_col, mem_error);
+
+    /* Two stable counting sorts: nodes are in row-major order to begin
+     * with, sort them by column and then by level. */
+    for (i = 0; i < self->node_count; i++) {
+        if (!self->nodes[i].circular)
+            start[self->nodes[i].col + 1]++;
+    }
+    for (i = 1; i <= (uint32_t) max_col + 1; i++)
+        start[i] += start[i - 1];
+    for (i = 0; i < self->node_count; i++) {
+        if (!self->nodes[i].circular)
+            by_col[start[self->nodes[i].col]++] = i;
+    }
+
+    memset(start, 0, size * sizeof(uint32_t));
+    for (i = 0; i < self->order_count; i++)
+        start[self->nodes[by_col[i]].level + 1]++;
+    for (i = 1; i <= max_level + 1; i++)
+        start[i] += start[i - 1];
+    for (i = 0; i < self->order_count; i++)
+        self->order[start[self->nodes[by_col[i]].level]++] = by_col[i];
+
+    err = LXLSX_NO_ERROR;
+
+mem_error:
+    free(start);
+    free(by_col);
+    return err;
+}
+
+/*
+ * Order the formula cells so that each comes after the formula cells it
+ * refers to. Those left waiting are on a circular reference or behind one.
+ */
+STATIC lxlsx_error
+_recalc_order(lxlsx_recalc *self)
+{
+    recalc_node *node;
+    uint32_t head = 0;
+    uint32_t level;
+    uint32_t i, k;
+
+    self->topo = malloc(self->graph_count * sizeof(uint32_t));
+    RETURN_ON_MEM_ERROR(self->topo, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+
+    for (i = 0; i < self->graph_count; i++) {
+        if (!self->nodes[i].pending)
+            self->topo[self->topo_count++] = i;
+    }
+
+    /* The order doubles as the queue of nodes ready to evaluate. */
+    while (head < self->topo_count) {
+        i = self->topo[head++];
+
+        for (k = self->dependent_start[i]; k < self->dependent_start[i + 1];
+             k++) {
+            node = &self->nodes[self->dependents[k]];
+            if (--node->pending == 0)
+                self->topo[self->topo_count++] = self->dependents[k];
+        }
+    }
+
+    for (i = 0; i < self->graph_count; i++)
+        self->nodes[i].circular = self->nodes[i].pending != 0;
+
+    /* Each node's level is final once the order reaches it. A range node
+     * passes on the level of its formula cells without adding one. */
+    for (i = 0; i < self->topo_count; i++) {
+        node = &self->nodes[self->topo[i]];
+        level = node->cell ? node->level + 1 : node->level;
+
+        for (k = self->dependent_start[self->topo[i]];
+             k < self->dependent_start[self->topo[i] + 1]; k++) {
+            if (self->nodes[self->dependents[k]].level < level)
+                self->nodes[self->dependents[k]].level = level;
+        }
+    }
+
+    for (i = 0; i < self->node_count; i++) {
+        if (!self->nodes[i].circular)
+            self->order_count++;
+    }
+
+    self->order = malloc((self->order_count ? self->order_count : 1)
+                         * sizeof(uint32_t));
+    RETURN_ON_MEM_ERROR(self->order, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+
+    return _recalc_order_by_level(self);
+}
+
+STATIC lxlsx_error
+_recalc_build(lxlsx_recalc *self, lxlsx_worksheet *worksheet,
+              lxlsx_formula_cache *cache)
+{
+    lxlsx_error err;
+
+    _recalc_reset(self);
+
+    err = _recalc_collect(self, worksheet, cache);
+    if (err || !self->node_count)
+        return err;
+
+    err = _recalc_link(self);
+    if (err)
+        return err;
+
+    return _recalc_order(self);
+}
+
+/*****************************************************************************
+ *
+ * Tracking changes.
+ *
+ ****************************************************************************/
+
+STATIC int
+_recalc_pos_cmp(const void *a, const void *b)
+{
+    const recalc_pos *pos_a = a;
+    const recalc_pos *pos_b = b;
+
+    if (pos_a->row != pos_b->row)
+        return pos_a->row < pos_b->row ? -1 : 1;
+    if (pos_a->col != pos_b->col)
+        return pos_a->col < pos_b->col ? -1 : 1;
+    return 0;
+}
+
+/* Find the graph node of a cell, if it holds a formula. */
+STATIC recalc_node *
+_recalc_find(lxlsx_recalc *self, lxlsx_row_t row, lxlsx_col_t col)
+{
+    uint32_t low = 0;
+    uint32_t high = self->node_count;
+    uint32_t mid;
+    recalc_node *node;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        node = &self->nodes[mid];
+
+        if (node->row == row && node->col == col)
+            return node;
+
+        if (node->row < row || (node->row == row && node->col < col))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return NULL;
+}
+
+/*
+ * Mark the formulas referring to a changed cell, then everything depending
+ * on them: the topological order visits each formula after its inputs.
+ */
+STATIC void
+_recalc_mark_changed(lxlsx_recalc *self)
+{
+    recalc_node *node;
+    recalc_ref *ref;
+    uint32_t low, high, mid;
+    uint32_t i, j, k;
+
+    qsort(self->changed, self->changed_count, sizeof(recalc_pos),
+          _recalc_pos_cmp);
+
+    /* Range nodes aren't evaluated: clear them of the last pass. */
+    for (i = self->node_count; i < self->graph_count; i++)
+        self->nodes[i].dirty = LXLSX_FALSE;
+
+    for (i = 0; i < self->node_count; i++) {
+        node = &self->nodes[i];
+
+        for (k = 0; k < node->ref_count && !node->dirty; k++) {
+            ref = &self->refs[node->first_ref + k];
+            low = 0;
+            high = self->changed_count;
+
+            while (low < high) {
+                mid = low + (high - low) / 2;
+                if (self->changed[mid].row < ref->first_row)
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+
+            for (j = low; j < self->changed_count
+                 && self->changed[j].row <= ref->last_row; j++) {
+                if (self->changed[j].col >= ref->first_col
+                    && self->changed[j].col <= ref->last_col) {
+                    node->dirty = LXLSX_TRUE;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < self->topo_count; i++) {
+        node = &self->nodes[self->topo[i]];
+        if (!node->dirty)
+            continue;
+
+        for (k = self->dependent_start[self->topo[i]];
+             k < self->dependent_start[self->topo[i] + 1]; k++)
+            self->nodes[self->dependents[k]].dirty = LXLSX_TRUE;
+    }
+}
+
+/*
+ * Record a cell written to a worksheet that has been recalculated. Writing a
+ * formula cell, or over one, changes the graph itself.
+ */
+void
+lxlsx_recalc_cell_written(lxlsx_recalc *self, lxlsx_row_t row,
+                          lxlsx_col_t col, const lxlsx_cell *cell)
+{
+    recalc_pos *changed;
+    uint32_t size;
+
+    if (self->stale)
+        return;
+
+    if (cell->type == FORMULA_CELL || _recalc_find(self, row, col)
+        || self->changed_count == LXLSX_RECALC_CHANGED_MAX) {
+        self->stale = LXLSX_TRUE;
+        return;
+    }
+
+    if (self->changed_count == self->changed_size) {
+        size = self->changed_size ? self->changed_size * 2 : 64;
+        changed = realloc(self->changed, size * sizeof(recalc_pos));
+        if (!changed) {
+            self->stale = LXLSX_TRUE;
+            return;
+        }
+
+        self->changed = changed;
+        self->changed_size = size;
+    }
+
+    self->changed[self->changed_count].row = row;
+    self->changed[self->changed_count].col = col;
+    self->changed_count++;
+}
+
+/*****************************************************************************
+ *
+ * Evaluation.
+ *
+ ****************************************************************************/
+
+/* Store a result as the formula's cached value, taking its string. */
+STATIC void
+_recalc_store(lxlsx_cell_writer_formula *formula, lxlsx_value *value)
+{
+    char *string = NULL;
+    double number = 0.0;
+
+    switch (value->kind) {
+    case LXLSX_VAL_NUMBER:
+    case LXLSX_VAL_BOOL:
+        number = value->number;
+        break;
+    case LXLSX_VAL_STRING:
+        string = value->string ? value->string : lxlsx_strdup("");
+        value->string = NULL;
+        break;
+    case LXLSX_VAL_ERROR:
+        string = lxlsx_strdup(lxlsx_formula_error_string(value->error));
+        break;
+    default:
+        break;
+    }
+
+    free((void *) formula->result_string);
+    formula->result_string = string;
+    formula->result = number;
+}
+
+/* Evaluate the formulas of order[start] up to order[start + count] one by one. */
+STATIC lxlsx_error
+_recalc_eval_nodes(lxlsx_recalc *self, lxlsx_worksheet *worksheet,
+                   lxlsx_formula_cache *cache, uint32_t start, uint32_t count)
+{
+    lxlsx_cell_writer_formula *formula;
+    recalc_node *node;
+    lxlsx_value value;
+    lxlsx_error err;
+    uint32_t i;
+
+    for (i = start; i < start + count; i++) {
+        node = &self->nodes[self->order[i]];
+        formula = node->cell->data.writer.value.formula;
+
+        err = lxlsx_formula_eval_at(cache, formula->formula,
+                                    node->row, node->col,
+                                    _recalc_resolver, _recalc_range_resolver,
+                                    worksheet, &value);
+        if (err)
+            return err;
+
+        _recalc_store(formula, &value);
+        lxlsx_value_free(&value);
+        node->dirty = LXLSX_FALSE;
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+/*
+ * Count the formulas from order[start] on that are one formula copied down a
+ * column: same level, consecutive rows, and due for evaluation. *column is
+ * set when the run is to be evaluated a column at a time. A stretch too short
+ * for that, or whose first formula the engine can't vectorize, is returned
+ * whole to be evaluated one by one; the formulas of any other are compared
+ * with the first.
+ */
+STATIC uint32_t
+_recalc_run(lxlsx_recalc *self, lxlsx_formula_cache *cache, uint32_t start,
+            uint8_t all, uint8_t *column)
+{
+    recalc_node *first = &self->nodes[self->order[start]];
+    recalc_node *previous = first;
+    recalc_node *node;
+    char first_buf[256], node_buf[256];
+    char *first_key, *node_key;
+    size_t first_len = 0, node_len = 0;
+    uint32_t limit = 1;
+    uint32_t count = 1;
+    int same;
+
+    *column = LXLSX_FALSE;
+    while (start + limit < self->order_count) {
+        node = &self->nodes[self->order[start + limit]];
+
+        if (node->level != first->level || node->col != first->col
+            || node->row != previous->row + 1 || (!all && !node->dirty))
+            break;
+
+        previous = node;
+        limit++;
+    }
+
+    if (limit < RECALC_COLUMN_MIN)
+        return limit;
+
+    /* The first formula of a run must be one the engine can vectorize. */
+    if (lxlsx_formula_eval_column(cache,
+                                  first->cell->data.writer.value.formula->formula,
+                                  first->row, first->col, 0,
+                                  _recalc_column_resolver, NULL,
+                                  NULL, NULL) != LXLSX_NO_ERROR)
+        return limit;
+
+    first_key = lxlsx_formula_relative_key(
+        first->cell->data.writer.value.formula->formula, first->row,
+        first->col, first_buf, sizeof(first_buf), &first_len);
+    if (!first_key)
+        return limit;
+
+    while (count < limit) {
+        node = &self->nodes[self->order[start + count]];
+        node_key = lxlsx_formula_relative_key(
+            node->cell->data.writer.value.formula->formula, node->row,
+            node->col, node_buf, sizeof(node_buf), &node_len);
+
+        same = node_key && node_len == first_len
+               && memcmp(node_key, first_key, first_len) == 0;
+
+        if (node_key && node_key != node_buf)
+            free(node_key);
+        if (!same)
+            break;
+
+        count++;
+    }
+
+    if (first_key != first_buf)
+        free(first_key);
+
+    *column = count >= RECALC_COLUMN_MIN;
+    return count;
+}
+
+/*
+ * Evaluate a run of one formula copied down a column as whole columns of
+ * numbers. The rows the engine leaves, e.g. those reading a string, are
+ * evaluated one by one.
+ */
+STATIC lxlsx_error
+_recalc_eval_column(lxlsx_recalc *self, lxlsx_worksheet *worksheet,
+                    lxlsx_formula_cache *cache, uint32_t start, uint32_t count,
+                    uint32_t *vectorized)
+{
+    recalc_node *first = &self->nodes[self->order[start]];
+    recalc_node *node;
+    lxlsx_value value;
+    lxlsx_error err;
+    double *results;
+    uint8_t *done;
+    uint32_t i;
+
+    results = malloc(count * sizeof(double));
+    done = malloc(count);
+    if (!results || !done) {
+        free(results);
+        free(done);
+        LXLSX_MEM_ERROR();
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+
+    err = lxlsx_formula_eval_column(cache,
+                                    first->cell->data.writer.value.formula->formula,
+                                    first->row, first->col, count,
+                                    _recalc_column_resolver, worksheet,
+                                    results, done);
+
+    for (i = 0; !err && i < count; i++) {
+        if (!done[i]) {
+            err = _recalc_eval_nodes(self, worksheet, cache, start + i, 1);
+            continue;
+        }
+
+        node = &self->nodes[self->order[start + i]];
+        value.kind = LXLSX_VAL_NUMBER;
+        value.number = results[i];
+        _recalc_store(node->cell->data.writer.value.formula, &value);
+        node->dirty = LXLSX_FALSE;
+        (*vectorized)++;
+    }
+
+    free(results);
+    free(done);
+    return err;
+}
+
+lxlsx_error
+lxlsx_recalc_worksheet(lxlsx_worksheet *worksheet, lxlsx_formula_cache *cache,
+                       lxlsx_recalc_stats *stats)
+{
+    lxlsx_recalc *self;
+    recalc_node *node;
+    lxlsx_value value;
+    lxlsx_error err;
+    uint8_t all = LXLSX_FALSE;
+    uint8_t column;
+    uint32_t evaluated = 0;
+    uint32_t vectorized = 0;
+    uint32_t run;
+    uint32_t i;
+
+    if (stats)
+        memset(stats, 0, sizeof(lxlsx_recalc_stats));
+
+    if (!worksheet)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    if (worksheet->optimize || worksheet->is_edit)
+        return LXLSX_NO_ERROR;
+
+    if (!worksheet->recalc) {
+        worksheet->recalc = calloc(1, sizeof(lxlsx_recalc));
+        RETURN_ON_MEM_ERROR(worksheet->recalc,
+                            LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+        worksheet->recalc->stale = LXLSX_TRUE;
+    }
+
+    self = worksheet->recalc;
+
+    if (!cache) {
+        if (!self->cache)
+            self->cache = lxlsx_formula_cache_new(0);
+        RETURN_ON_MEM_ERROR(self->cache, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+        cache = self->cache;
+    }
+
+    if (self->stale) {
+        err = _recalc_build(self, worksheet, cache);
+        if (err) {
+            _recalc_reset(self);
+            return err;
+        }
+
+        self->stale = LXLSX_FALSE;
+        all = LXLSX_TRUE;
+    }
+    else if (self->changed_count) {
+        _recalc_mark_changed(self);
+        self->changed_count = 0;
+    }
+
+    for (i = 0; all && i < self->node_count; i++) {
+        node = &self->nodes[i];
+        if (!node->circular)
+            continue;
+
+        value.kind = LXLSX_VAL_BLANK;
+        _recalc_store(node->cell->data.writer.value.formula, &value);
+    }
+
+    for (i = 0; i < self->order_count; i += run) {
+        node = &self->nodes[self->order[i]];
+        run = 1;
+        if (!all && !node->dirty)
+            continue;
+
+        run = _recalc_run(self, cache, i, all, &column);
+        if (column)
+            err = _recalc_eval_column(self, worksheet, cache, i, run,
+                                      &vectorized);
+        else
+            err = _recalc_eval_nodes(self, worksheet, cache, i, run);
+
+        if (err) {
+            self->stale = LXLSX_TRUE;
+            return err;
+        }
+
+        evaluated += run;
+    }
+
+    if (stats) {
+        stats->formulas = self->node_count;
+        stats->evaluated = evaluated;
+        stats->vectorized = vectorized;
+        stats->circular = self->node_count - self->order_count;
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+lxlsx_error
+lxlsx_recalc_workbook(lxlsx_workbook *workbook, lxlsx_formula_cache *cache,
+                      lxlsx_recalc_stats *stats)
+{
+    lxlsx_worksheet *worksheet;
+    lxlsx_recalc_stats sheet_stats;
+    lxlsx_error err;
+
+    if (stats)
+        memset(stats, 0, sizeof(lxlsx_recalc_stats));
+
+    if (!workbook)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    LXLSX_FOREACH_WORKSHEET(worksheet, workbook) {
+        err = lxlsx_recalc_worksheet(worksheet, cache, &sheet_stats);
+        if (err)
+            return err;
+
+        if (stats) {
+            stats->formulas += sheet_stats.formulas;
+            stats->evaluated += sheet_stats.evaluated;
+            stats->vectorized += sheet_stats.vectorized;
+            stats->circular += sheet_stats.circular;
+        }
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+void
+lxlsx_recalc_free(lxlsx_recalc *self)
+{
+    if (!self)
+        return;
+
+    _recalc_reset(self);
+    free(self->changed);
+    lxlsx_formula_cache_free(self->cache);
+    free(self);
+}
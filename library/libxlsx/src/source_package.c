@@ -9,6 +9,20 @@
 #include <string.h>
 #include <limits.h>
 
+#ifdef _WIN32
+#include <io.h>
+#define zip_fseek _fseeki64
+#define zip_ftell _ftelli64
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#define zip_fseek fseeko
+#define zip_ftell ftello
+#endif
+
 #include <zlib.h>
 
 #include "libxlsx/source_package.h"
@@ -17,10 +31,27 @@
 #define ZIP_CENTRAL_FILE_SIG 0x02014b50u
 #define ZIP_EOCD_SIG         0x06054b50u
 #define ZIP64_LOCATOR_SIG    0x07064b50u
+#define ZIP64_EOCD_SIG       0x06064b50u
+#define ZIP_DESCRIPTOR_SIG   0x08074b50u
+
+/* ZIP64 extended information extra field, and the 32/16-bit field values that
+ * say "see that field". */
+#define ZIP64_EXTRA_ID       0x0001u
+#define ZIP64_VERSION        45
+#define ZIP_MAX32            0xffffffffu
+#define ZIP_MAX16            0xffffu
 
 #define ZIP_METHOD_STORE     0
 #define ZIP_METHOD_DEFLATE   8
 
+/* Output buffer for streamed (transformed) replacements. */
+#define ZIP_STREAM_CHUNK     65536
+
+/* A streamed replacement of an entry at least this large gets room for a
+ * ZIP64 extra field in its local header up front. Smaller ones that still
+ * outgrow 4 GB have their data shifted to make room afterwards. */
+#define ZIP64_STREAM_RESERVE 0x40000000u
+
 /* Editing needs raw local-file-record offsets so untouched ZIP members can be
  * copied byte-for-byte, including their original extra fields and optional data
  * descriptors. That is why this module keeps a small central-directory parser
@@ -47,6 +78,9 @@ typedef struct {
     size_t local_offset;
     size_t local_record_size;
     size_t data_offset;
+
+    int central_zip64;  /* the central record carries a ZIP64 extra field */
+    int local_zip64;    /* ...and the local header: 64-bit data descriptor */
 } lxlsx_source_entry;
 
 typedef struct {
@@ -54,9 +88,34 @@ typedef struct {
     size_t entry_index;
 } lxlsx_source_local_order;
 
+struct lxlsx_source_package_entry_stream {
+    const lxlsx_source_entry *entry;
+    const unsigned char *next;      /* compressed bytes not yet fed in */
+    uint64_t remaining;
+    uint64_t produced;
+    z_stream zs;
+    int inflating;
+    int done;
+};
+
+struct lxlsx_source_package_sink {
+    FILE *fp;
+    z_stream zs;
+    int deflating;
+    uint32_t crc;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    unsigned char out[ZIP_STREAM_CHUNK];
+};
+
 struct lxlsx_source_package {
     unsigned char *data;
     size_t         size;
+    size_t         mapped;  /* data maps the file rather than being malloc'd */
+#ifndef _WIN32
+    dev_t          dev;     /* the mapped file */
+    ino_t          ino;
+#endif
     lxlsx_source_entry *entries;
     size_t         entry_count;
     size_t         central_offset;
@@ -93,7 +152,20 @@ static void put_le32(unsigned char *p, uint32_t v)
     p[3] = (unsigned char)((v >> 24) & 0xff);
 }
 
-static int has_zip64_extra(const unsigned char *extra, size_t len)
+static uint64_t read_le64(const unsigned char *p)
+{
+    return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)(v & 0xffffffffu));
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* Find an extra field block by id; data and size receive its payload. */
+static int find_extra(const unsigned char *extra, size_t len, uint16_t id,
+                      const unsigned char **data, size_t *size)
 {
     size_t pos = 0;
     while (pos + 4 <= len) {
@@ -101,12 +173,48 @@ static int has_zip64_extra(const unsigned char *extra, size_t len)
         uint16_t data_size = read_le16(extra + pos + 2);
         pos += 4;
         if (pos + data_size > len)
+            return 0;
+        if (header_id == id) {
+            *data = extra + pos;
+            *size = data_size;
             return 1;
-        if (header_id == 0x0001)
-            return 1;
+        }
         pos += data_size;
     }
-    return pos != len;
+    return 0;
+}
+
+/* Build the ZIP64 extra field of a central record: the sizes and offset that
+ * do not fit their 32-bit fields, in that order. Returns its length, 0 when
+ * none is needed. */
+static size_t zip64_central_extra(unsigned char *out, uint64_t uncompressed,
+                                  uint64_t compressed, uint64_t offset)
+{
+    size_t len = 4;
+
+    if (uncompressed >= ZIP_MAX32) {
+        put_le64(out + len, uncompressed);
+        len += 8;
+    }
+    if (compressed >= ZIP_MAX32) {
+        put_le64(out + len, compressed);
+        len += 8;
+    }
+    if (offset >= ZIP_MAX32) {
+        put_le64(out + len, offset);
+        len += 8;
+    }
+    if (len == 4)
+        return 0;
+
+    put_le16(out, ZIP64_EXTRA_ID);
+    put_le16(out + 2, (uint16_t)(len - 4));
+    return len;
+}
+
+static uint32_t field32(uint64_t value)
+{
+    return value >= ZIP_MAX32 ? ZIP_MAX32 : (uint32_t)value;
 }
 
 static lxlsx_error write_all(FILE *fp, const void *buf, size_t len)
@@ -132,17 +240,29 @@ static lxlsx_error write_le32(FILE *fp, uint32_t v)
     return write_all(fp, buf, sizeof(buf));
 }
 
-static lxlsx_error current_offset(FILE *fp, uint32_t *out)
+static lxlsx_error write_le64(FILE *fp, uint64_t v)
+{
+    unsigned char buf[8];
+    put_le64(buf, v);
+    return write_all(fp, buf, sizeof(buf));
+}
+
+static lxlsx_error current_offset(FILE *fp, uint64_t *out)
 {
-    long pos = ftell(fp);
+    int64_t pos = (int64_t)zip_ftell(fp);
     if (pos < 0)
         return LXLSX_ERROR_ZIP_FILE_OPERATION;
-    if ((unsigned long)pos > 0xffffffffUL)
-        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
-    *out = (uint32_t)pos;
+    *out = (uint64_t)pos;
     return LXLSX_NO_ERROR;
 }
 
+static lxlsx_error seek_to(FILE *fp, uint64_t offset)
+{
+    return zip_fseek(fp, (int64_t)offset, SEEK_SET) == 0
+        ? LXLSX_NO_ERROR
+        : LXLSX_ERROR_ZIP_FILE_OPERATION;
+}
+
 static int local_order_cmp(const void *a, const void *b)
 {
     const lxlsx_source_local_order *left =
@@ -221,6 +341,9 @@ static lxlsx_error parse_local_headers(lxlsx_source_package *package)
         size_t name_len;
         size_t extra_len;
         size_t data_offset;
+        size_t record_end;
+        const unsigned char *zip64;
+        size_t zip64_len;
         size_t next_offset = i + 1 < package->entry_count
             ? order[i + 1].local_offset
             : package->central_offset;
@@ -237,14 +360,28 @@ static lxlsx_error parse_local_headers(lxlsx_source_package *package)
         data_offset = local_offset + 30 + name_len + extra_len;
         if (data_offset > package->size)
             goto bad_zip;
-        if (data_offset + (size_t)e->info.compressed_size > package->size)
+        e->local_zip64 = find_extra(package->data + local_offset + 30 + name_len,
+                                    extra_len, ZIP64_EXTRA_ID,
+                                    &zip64, &zip64_len);
+        if (e->info.compressed_size > (uint64_t)(package->size - data_offset))
             goto bad_zip;
 
-        if (next_offset < data_offset + (size_t)e->info.compressed_size)
+        record_end = data_offset + (size_t)e->info.compressed_size;
+        if (e->info.flags & 0x0008) {
+            /* Data descriptor, with or without its optional signature; its
+             * sizes are 64-bit when the local header has a ZIP64 field. */
+            size_t descriptor = e->local_zip64 ? 20 : 12;
+            record_end += record_end + 4 <= next_offset &&
+                          read_le32(package->data + record_end) == ZIP_DESCRIPTOR_SIG
+                        ? descriptor + 4 : descriptor;
+        }
+        if (next_offset < record_end)
             goto bad_zip;
 
+        /* Bytes between record_end and next_offset are dead space, e.g. the
+         * superseded records left behind by an in-place save. */
         e->data_offset = data_offset;
-        e->local_record_size = next_offset - local_offset;
+        e->local_record_size = record_end - local_offset;
     }
 
     free(order);
@@ -271,9 +408,12 @@ static lxlsx_error parse_central_directory(lxlsx_source_package *package)
         uint16_t name_len;
         uint16_t extra_len;
         uint16_t comment_len;
-        uint32_t compressed_size;
-        uint32_t uncompressed_size;
-        uint32_t local_offset;
+        uint64_t compressed_size;
+        uint64_t uncompressed_size;
+        uint64_t local_offset;
+        uint32_t disk_start;
+        const unsigned char *zip64 = NULL;
+        size_t zip64_len = 0;
         char *name;
 
         if (pos + 46 > package->central_offset + package->central_size)
@@ -292,13 +432,44 @@ static lxlsx_error parse_central_directory(lxlsx_source_package *package)
         compressed_size = read_le32(data + pos + 20);
         uncompressed_size = read_le32(data + pos + 24);
         local_offset = read_le32(data + pos + 42);
-        if (compressed_size == 0xffffffffu ||
-            uncompressed_size == 0xffffffffu ||
-            local_offset == 0xffffffffu) {
-            return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+        disk_start = read_le16(data + pos + 34);
+
+        /* Fields set to all ones continue in the ZIP64 extra field, in the
+         * order uncompressed size, compressed size, offset, disk. */
+        e->central_zip64 = find_extra(data + pos + 46 + name_len, extra_len,
+                                      ZIP64_EXTRA_ID, &zip64, &zip64_len);
+        if (uncompressed_size == ZIP_MAX32 || compressed_size == ZIP_MAX32 ||
+            local_offset == ZIP_MAX32 || disk_start == ZIP_MAX16) {
+            size_t at = 0;
+
+            if (!e->central_zip64)
+                return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+            if (uncompressed_size == ZIP_MAX32) {
+                if (at + 8 > zip64_len)
+                    return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+                uncompressed_size = read_le64(zip64 + at);
+                at += 8;
+            }
+            if (compressed_size == ZIP_MAX32) {
+                if (at + 8 > zip64_len)
+                    return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+                compressed_size = read_le64(zip64 + at);
+                at += 8;
+            }
+            if (local_offset == ZIP_MAX32) {
+                if (at + 8 > zip64_len)
+                    return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+                local_offset = read_le64(zip64 + at);
+                at += 8;
+            }
+            if (disk_start == ZIP_MAX16) {
+                if (at + 4 > zip64_len)
+                    return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+                disk_start = read_le32(zip64 + at);
+            }
         }
-        if (has_zip64_extra(data + pos + 46 + name_len, extra_len))
-            return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+        if (local_offset >= package->size)
+            return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
 
         name = (char *)malloc((size_t)name_len + 1);
         if (!name)
@@ -318,7 +489,7 @@ static lxlsx_error parse_central_directory(lxlsx_source_package *package)
         e->version_needed = read_le16(data + pos + 6);
         e->mod_time = read_le16(data + pos + 12);
         e->mod_date = read_le16(data + pos + 14);
-        e->disk_start = read_le16(data + pos + 34);
+        e->disk_start = disk_start != 0 ? ZIP_MAX16 : 0;
         e->internal_attr = read_le16(data + pos + 36);
         e->central_offset = pos;
         e->central_size = 46 + name_len + extra_len + comment_len;
@@ -327,7 +498,7 @@ static lxlsx_error parse_central_directory(lxlsx_source_package *package)
         e->central_extra_len = extra_len;
         e->central_comment_offset = pos + 46 + name_len + extra_len;
         e->central_comment_len = comment_len;
-        e->local_offset = local_offset;
+        e->local_offset = (size_t)local_offset;
 
         if (e->disk_start != 0)
             return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
@@ -350,23 +521,19 @@ static lxlsx_error parse_central_directory(lxlsx_source_package *package)
 static lxlsx_error parse_package(lxlsx_source_package *package)
 {
     const unsigned char *eocd;
-    uint16_t disk_no;
-    uint16_t central_disk;
-    uint16_t entries_disk;
-    uint16_t entries_total;
-    uint32_t central_size;
-    uint32_t central_offset;
+    uint32_t disk_no;
+    uint32_t central_disk;
+    uint64_t entries_disk;
+    uint64_t entries_total;
+    uint64_t central_size;
+    uint64_t central_offset;
+    size_t directory_end;
     lxlsx_error err;
 
     err = find_eocd(package->data, package->size, &package->eocd_offset);
     if (err != LXLSX_NO_ERROR)
         return err;
 
-    if (package->eocd_offset >= 20 &&
-        read_le32(package->data + package->eocd_offset - 20) == ZIP64_LOCATOR_SIG) {
-        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
-    }
-
     eocd = package->data + package->eocd_offset;
     disk_no = read_le16(eocd + 4);
     central_disk = read_le16(eocd + 6);
@@ -374,17 +541,43 @@ static lxlsx_error parse_package(lxlsx_source_package *package)
     entries_total = read_le16(eocd + 10);
     central_size = read_le32(eocd + 12);
     central_offset = read_le32(eocd + 16);
+    directory_end = package->eocd_offset;
+
+    if (package->eocd_offset >= 20 &&
+        read_le32(package->data + package->eocd_offset - 20) == ZIP64_LOCATOR_SIG) {
+        /* ZIP64: the locator points at a ZIP64 EOCD record, which has the
+         * full-width directory fields. */
+        const unsigned char *locator = package->data + package->eocd_offset - 20;
+        uint64_t record = read_le64(locator + 8);
+
+        if (read_le32(locator + 4) != 0 || read_le32(locator + 16) > 1)
+            return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+        if (record > package->eocd_offset - 20 ||
+            package->eocd_offset - 20 - record < 56)
+            return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+        eocd = package->data + record;
+        if (read_le32(eocd) != ZIP64_EOCD_SIG)
+            return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+
+        disk_no = read_le32(eocd + 16);
+        central_disk = read_le32(eocd + 20);
+        entries_disk = read_le64(eocd + 24);
+        entries_total = read_le64(eocd + 32);
+        central_size = read_le64(eocd + 40);
+        central_offset = read_le64(eocd + 48);
+        directory_end = (size_t)record;
+    }
 
     if (disk_no != 0 || central_disk != 0 || entries_disk != entries_total)
         return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
-    if (entries_total == 0xffff || central_size == 0xffffffffu ||
-        central_offset == 0xffffffffu) {
-        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
-    }
+    if (central_offset > directory_end ||
+        central_size > directory_end - central_offset ||
+        entries_total > central_size / 46)
+        return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
 
-    package->central_offset = central_offset;
-    package->central_size = central_size;
-    package->entry_count = entries_total;
+    package->central_offset = (size_t)central_offset;
+    package->central_size = (size_t)central_size;
+    package->entry_count = (size_t)entries_total;
     package->global_comment_offset = package->eocd_offset + 22;
     package->global_comment_len = read_le16(eocd + 20);
 
@@ -401,7 +594,7 @@ static lxlsx_error parse_package(lxlsx_source_package *package)
 static lxlsx_error slurp_file(const char *path, unsigned char **out, size_t *out_len)
 {
     FILE *fp;
-    long size;
+    uint64_t size;
     unsigned char *buf;
     size_t got;
 
@@ -412,16 +605,16 @@ static lxlsx_error slurp_file(const char *path, unsigned char **out, size_t *out
     if (!fp)
         return LXLSX_ERROR_CREATING_XLSX_FILE;
 
-    if (fseek(fp, 0, SEEK_END) != 0) {
+    if (zip_fseek(fp, 0, SEEK_END) != 0 ||
+        current_offset(fp, &size) != LXLSX_NO_ERROR) {
         fclose(fp);
         return LXLSX_ERROR_ZIP_FILE_OPERATION;
     }
-    size = ftell(fp);
-    if (size < 0) {
+    if (size > SIZE_MAX) {
         fclose(fp);
-        return LXLSX_ERROR_ZIP_FILE_OPERATION;
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
     }
-    if (fseek(fp, 0, SEEK_SET) != 0) {
+    if (zip_fseek(fp, 0, SEEK_SET) != 0) {
         fclose(fp);
         return LXLSX_ERROR_ZIP_FILE_OPERATION;
     }
@@ -443,23 +636,93 @@ static lxlsx_error slurp_file(const char *path, unsigned char **out, size_t *out
     return LXLSX_NO_ERROR;
 }
 
-static lxlsx_error source_package_open_memory_owned(unsigned char *data,
-                                                    size_t len,
-                                                    lxlsx_source_package **out)
+static void release_data(unsigned char *data, size_t mapped)
+{
+#ifndef _WIN32
+    if (mapped) {
+        munmap(data, mapped);
+        return;
+    }
+#endif
+    free(data);
+}
+
+#ifndef _WIN32
+/* Map the file instead of reading it: the local records are paged in as they
+ * are read and stay evictable, so a package of any size costs address space
+ * rather than memory. Fails for anything that isn't a plain non-empty file,
+ * which is then read whole instead. */
+static lxlsx_error map_file(const char *path, unsigned char **out,
+                            size_t *out_len, struct stat *st)
+{
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return LXLSX_ERROR_CREATING_XLSX_FILE;
+    if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode) || st->st_size <= 0 ||
+        (uint64_t)st->st_size > SIZE_MAX) {
+        close(fd);
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+    }
+
+    data = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return LXLSX_ERROR_ZIP_FILE_OPERATION;
+
+    *out = (unsigned char *)data;
+    *out_len = (size_t)st->st_size;
+    return LXLSX_NO_ERROR;
+}
+
+/* An in-place save writes over the central directory and EOCD of the mapped
+ * file. Make private copies of the pages holding them, so that the package,
+ * and readers borrowing its data, keep seeing the directory they parsed. */
+static lxlsx_error snapshot_directory(lxlsx_source_package *package)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = package->central_offset - package->central_offset % page;
+    volatile unsigned char *p;
+    size_t pos;
+
+    if (mprotect(package->data + start, package->mapped - start,
+                 PROT_READ | PROT_WRITE) != 0)
+        return LXLSX_ERROR_ZIP_FILE_OPERATION;
+    for (pos = start; pos < package->size; pos += page) {
+        p = package->data + pos;
+        *p = *p;
+    }
+    if (mprotect(package->data + start, package->mapped - start,
+                 PROT_READ) != 0)
+        return LXLSX_ERROR_ZIP_FILE_OPERATION;
+    return LXLSX_NO_ERROR;
+}
+#endif
+
+static lxlsx_error source_package_open_owned(unsigned char *data,
+                                             size_t len, size_t mapped,
+                                             lxlsx_source_package **out)
 {
     lxlsx_source_package *package;
     lxlsx_error err;
 
     package = (lxlsx_source_package *)calloc(1, sizeof(*package));
     if (!package) {
-        free(data);
+        release_data(data, mapped);
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
     }
 
     package->data = data;
     package->size = len;
+    package->mapped = mapped;
 
     err = parse_package(package);
+#ifndef _WIN32
+    if (err == LXLSX_NO_ERROR && mapped)
+        err = snapshot_directory(package);
+#endif
     if (err != LXLSX_NO_ERROR) {
         lxlsx_source_package_close(package);
         return err;
@@ -480,11 +743,26 @@ lxlsx_error lxlsx_source_package_open(const char *path,
         return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
     *out = NULL;
 
+#ifndef _WIN32
+    {
+        struct stat st;
+
+        if (path && map_file(path, &buf, &len, &st) == LXLSX_NO_ERROR) {
+            err = source_package_open_owned(buf, len, len, out);
+            if (err == LXLSX_NO_ERROR) {
+                (*out)->dev = st.st_dev;
+                (*out)->ino = st.st_ino;
+            }
+            return err;
+        }
+    }
+#endif
+
     err = slurp_file(path, &buf, &len);
     if (err != LXLSX_NO_ERROR)
         return err;
 
-    return source_package_open_memory_owned(buf, len, out);
+    return source_package_open_owned(buf, len, 0, out);
 }
 
 lxlsx_error lxlsx_source_package_open_memory(const void *data, size_t len,
@@ -502,7 +780,7 @@ lxlsx_error lxlsx_source_package_open_memory(const void *data, size_t len,
     if (len != 0)
         memcpy(copy, data, len);
 
-    return source_package_open_memory_owned(copy, len, out);
+    return source_package_open_owned(copy, len, 0, out);
 }
 
 void lxlsx_source_package_close(lxlsx_source_package *package)
@@ -510,7 +788,7 @@ void lxlsx_source_package_close(lxlsx_source_package *package)
     if (!package)
         return;
     free_entries(package);
-    free(package->data);
+    release_data(package->data, package->mapped);
     free(package);
 }
 
@@ -555,7 +833,12 @@ lxlsx_error lxlsx_source_package_read_entry(const lxlsx_source_package *package,
                                             size_t *out_len)
 {
     const lxlsx_source_entry *e;
+    lxlsx_source_package_entry_stream *stream = NULL;
     unsigned char *buf;
+    size_t size;
+    size_t len = 0;
+    size_t got = 0;
+    lxlsx_error err;
 
     if (!package || !out || !out_len)
         return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
@@ -567,54 +850,161 @@ lxlsx_error lxlsx_source_package_read_entry(const lxlsx_source_package *package,
     e = &package->entries[index];
     if (e->info.uncompressed_size > (uint64_t)((size_t)-1) - 1)
         return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
-    if (e->info.compressed_size > UINT_MAX ||
-        e->info.uncompressed_size > UINT_MAX) {
-        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+    size = (size_t)e->info.uncompressed_size;
+
+    err = lxlsx_source_package_entry_stream_open(package, index, &stream);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+
+    buf = (unsigned char *)malloc(size + 1);
+    if (!buf) {
+        lxlsx_source_package_entry_stream_close(stream);
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    }
+
+    /* The stream checks the inflated length against the recorded size. */
+    do {
+        err = lxlsx_source_package_entry_stream_read(stream, buf + len,
+                                                     size - len, &got);
+        len += got;
+    } while (err == LXLSX_NO_ERROR && got > 0 && len < size);
+    if (err == LXLSX_NO_ERROR && len == size && !stream->done) {
+        unsigned char extra;
+        err = lxlsx_source_package_entry_stream_read(stream, &extra, 1, &got);
+        if (err == LXLSX_NO_ERROR && got != 0)
+            err = LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
     }
+    if (err == LXLSX_NO_ERROR && len != size)
+        err = LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+    lxlsx_source_package_entry_stream_close(stream);
+    if (err != LXLSX_NO_ERROR) {
+        free(buf);
+        return err;
+    }
+
+    buf[size] = 0;
+    *out = buf;
+    *out_len = size;
+    return LXLSX_NO_ERROR;
+}
 
-    buf = (unsigned char *)malloc((size_t)e->info.uncompressed_size + 1);
-    if (!buf)
+void lxlsx_source_package_free_buffer(void *buffer)
+{
+    free(buffer);
+}
+
+lxlsx_error lxlsx_source_package_entry_stream_open(
+    const lxlsx_source_package *package,
+    size_t index,
+    lxlsx_source_package_entry_stream **out)
+{
+    const lxlsx_source_entry *e;
+    lxlsx_source_package_entry_stream *stream;
+
+    if (!package || !out)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+    *out = NULL;
+    if (index >= package->entry_count)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    e = &package->entries[index];
+    if (e->info.compression_method != ZIP_METHOD_STORE &&
+        e->info.compression_method != ZIP_METHOD_DEFLATE)
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+    if (e->info.compression_method == ZIP_METHOD_STORE &&
+        e->info.compressed_size != e->info.uncompressed_size)
+        return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+
+    stream = (lxlsx_source_package_entry_stream *)calloc(1, sizeof(*stream));
+    if (!stream)
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    stream->entry = e;
+    stream->next = package->data + e->data_offset;
+    stream->remaining = e->info.compressed_size;
 
-    if (e->info.compression_method == ZIP_METHOD_STORE) {
-        if (e->info.compressed_size != e->info.uncompressed_size) {
-            free(buf);
-            return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+    if (e->info.compression_method == ZIP_METHOD_DEFLATE) {
+        if (inflateInit2(&stream->zs, -MAX_WBITS) != Z_OK) {
+            free(stream);
+            return LXLSX_ERROR_ZIP_FILE_OPERATION;
         }
-        memcpy(buf, package->data + e->data_offset, (size_t)e->info.uncompressed_size);
-    } else if (e->info.compression_method == ZIP_METHOD_DEFLATE) {
-        z_stream zs;
+        stream->inflating = 1;
+    }
+
+    *out = stream;
+    return LXLSX_NO_ERROR;
+}
+
+lxlsx_error lxlsx_source_package_entry_stream_read(
+    lxlsx_source_package_entry_stream *stream,
+    void *buf,
+    size_t cap,
+    size_t *got)
+{
+    size_t n;
+
+    if (!stream || !buf || !got)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+    *got = 0;
+    if (stream->done || cap == 0)
+        return LXLSX_NO_ERROR;
+
+    if (!stream->inflating) {
+        n = stream->remaining < cap ? (size_t)stream->remaining : cap;
+        memcpy(buf, stream->next, n);
+        stream->next += n;
+        stream->remaining -= n;
+        stream->produced += n;
+        stream->done = stream->remaining == 0;
+        *got = n;
+        return LXLSX_NO_ERROR;
+    }
+
+    if (cap > UINT_MAX)
+        cap = UINT_MAX;
+    stream->zs.next_out = (Bytef *)buf;
+    stream->zs.avail_out = (uInt)cap;
+
+    while (stream->zs.avail_out > 0) {
         int zrc;
-        memset(&zs, 0, sizeof(zs));
-        zs.next_in = (Bytef *)(package->data + e->data_offset);
-        zs.avail_in = (uInt)e->info.compressed_size;
-        zs.next_out = buf;
-        zs.avail_out = (uInt)e->info.uncompressed_size;
-        zrc = inflateInit2(&zs, -MAX_WBITS);
-        if (zrc != Z_OK) {
-            free(buf);
-            return LXLSX_ERROR_ZIP_FILE_OPERATION;
+
+        if (stream->zs.avail_in == 0) {
+            if (stream->remaining == 0)
+                return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+            n = stream->remaining < UINT_MAX ? (size_t)stream->remaining
+                                             : UINT_MAX;
+            stream->zs.next_in = (Bytef *)stream->next;
+            stream->zs.avail_in = (uInt)n;
+            stream->next += n;
+            stream->remaining -= n;
         }
-        zrc = inflate(&zs, Z_FINISH);
-        inflateEnd(&zs);
-        if (zrc != Z_STREAM_END || zs.total_out != e->info.uncompressed_size) {
-            free(buf);
-            return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+
+        zrc = inflate(&stream->zs, Z_NO_FLUSH);
+        if (zrc == Z_STREAM_END) {
+            stream->done = 1;
+            break;
         }
-    } else {
-        free(buf);
-        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+        if (zrc != Z_OK)
+            return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
     }
 
-    buf[e->info.uncompressed_size] = 0;
-    *out = buf;
-    *out_len = (size_t)e->info.uncompressed_size;
+    n = cap - stream->zs.avail_out;
+    stream->produced += n;
+    if (stream->done &&
+        stream->produced != stream->entry->info.uncompressed_size)
+        return LXLSX_ERROR_ZIP_BAD_ZIP_FILE;
+
+    *got = n;
     return LXLSX_NO_ERROR;
 }
 
-void lxlsx_source_package_free_buffer(void *buffer)
+void lxlsx_source_package_entry_stream_close(
+    lxlsx_source_package_entry_stream *stream)
 {
-    free(buffer);
+    if (!stream)
+        return;
+    if (stream->inflating)
+        inflateEnd(&stream->zs);
+    free(stream);
 }
 
 lxlsx_error lxlsx_source_package_entry_raw_local_record(
@@ -636,21 +1026,110 @@ lxlsx_error lxlsx_source_package_entry_raw_local_record(
     return LXLSX_NO_ERROR;
 }
 
+/* Whether path is the file the package is mapped from. */
+static int package_maps_file(const lxlsx_source_package *package,
+                             const char *path)
+{
+#ifndef _WIN32
+    struct stat st;
+
+    return package && package->mapped && stat(path, &st) == 0 &&
+           st.st_dev == package->dev && st.st_ino == package->ino;
+#else
+    (void)package;
+    (void)path;
+    return 0;
+#endif
+}
+
+/*
+ * Open path for writing a whole package. Truncating a file that a package
+ * being read is mapped from would pull the pages out from under it, so the
+ * package is then written to a temporary file next to it, which replaces it
+ * in close_output(); the mapping keeps the old file alive until it is closed.
+ */
+static FILE *open_output(const char *path, int mapped, char **tmp_path)
+{
+    *tmp_path = NULL;
+#ifndef _WIN32
+    if (mapped) {
+        struct stat st;
+        size_t len = strlen(path);
+        FILE *fp;
+        int fd;
+
+        *tmp_path = (char *)malloc(len + sizeof(".XXXXXX"));
+        if (!*tmp_path)
+            return NULL;
+        memcpy(*tmp_path, path, len);
+        memcpy(*tmp_path + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+        fd = mkstemp(*tmp_path);
+        if (fd < 0) {
+            free(*tmp_path);
+            *tmp_path = NULL;
+            return NULL;
+        }
+        if (stat(path, &st) == 0)
+            fchmod(fd, st.st_mode & 07777);
+        fp = fdopen(fd, "wb");
+        if (!fp) {
+            close(fd);
+            remove(*tmp_path);
+            free(*tmp_path);
+            *tmp_path = NULL;
+        }
+        return fp;
+    }
+#else
+    (void)mapped;
+#endif
+    return fopen(path, "wb");
+}
+
+/* Close a file from open_output(): on error the output is removed, otherwise
+ * a temporary file is moved over path. */
+static lxlsx_error close_output(FILE *fp, const char *path, char *tmp_path,
+                                lxlsx_error err)
+{
+    if (fclose(fp) != 0 && err == LXLSX_NO_ERROR)
+        err = LXLSX_ERROR_ZIP_FILE_OPERATION;
+    if (err == LXLSX_NO_ERROR && tmp_path && rename(tmp_path, path) != 0)
+        err = LXLSX_ERROR_ZIP_FILE_OPERATION;
+    if (err != LXLSX_NO_ERROR)
+        remove(tmp_path ? tmp_path : path);
+    free(tmp_path);
+    return err;
+}
+
 lxlsx_error lxlsx_source_package_save_copy(const lxlsx_source_package *package,
                                            const char *path)
 {
     FILE *fp;
+    char *tmp_path;
     lxlsx_error err;
 
     if (!package || !path)
         return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
-    fp = fopen(path, "wb");
+    fp = open_output(path, package_maps_file(package, path), &tmp_path);
     if (!fp)
         return LXLSX_ERROR_CREATING_XLSX_FILE;
     err = write_all(fp, package->data, package->size);
-    if (fclose(fp) != 0 && err == LXLSX_NO_ERROR)
-        err = LXLSX_ERROR_ZIP_FILE_OPERATION;
-    return err;
+    return close_output(fp, path, tmp_path, err);
+}
+
+static const lxlsx_source_package_stream_replacement *find_stream(
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
+    size_t entry_index)
+{
+    size_t i;
+    const lxlsx_source_package_stream_replacement *found = NULL;
+    for (i = 0; i < stream_count; i++) {
+        if (streams[i].entry_index == entry_index)
+            found = &streams[i];
+    }
+    return found;
 }
 
 static const lxlsx_source_package_replacement *find_replacement(
@@ -717,21 +1196,244 @@ static lxlsx_error deflate_raw_data(const unsigned char *data,
     return LXLSX_NO_ERROR;
 }
 
+static lxlsx_error sink_deflate(lxlsx_source_package_sink *sink, int flush)
+{
+    lxlsx_error err;
+    int zrc;
+
+    do {
+        size_t have;
+
+        sink->zs.next_out = sink->out;
+        sink->zs.avail_out = sizeof(sink->out);
+        zrc = deflate(&sink->zs, flush);
+        if (zrc == Z_STREAM_ERROR)
+            return LXLSX_ERROR_ZIP_FILE_OPERATION;
+        have = sizeof(sink->out) - sink->zs.avail_out;
+        err = write_all(sink->fp, sink->out, have);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        sink->compressed_size += have;
+    } while (sink->zs.avail_out == 0);
+
+    if (flush == Z_FINISH && zrc != Z_STREAM_END)
+        return LXLSX_ERROR_ZIP_FILE_OPERATION;
+    return LXLSX_NO_ERROR;
+}
+
+lxlsx_error lxlsx_source_package_sink_write(lxlsx_source_package_sink *sink,
+                                            const void *data,
+                                            size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    lxlsx_error err;
+
+    if (!sink || (!data && len != 0))
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+
+    sink->uncompressed_size += len;
+
+    while (len > 0) {
+        size_t n = len < UINT_MAX ? len : UINT_MAX;
+
+        sink->crc = (uint32_t)crc32(sink->crc, p, (uInt)n);
+        if (sink->deflating) {
+            sink->zs.next_in = (Bytef *)p;
+            sink->zs.avail_in = (uInt)n;
+            err = sink_deflate(sink, Z_NO_FLUSH);
+        } else {
+            sink->compressed_size += n;
+            err = write_all(sink->fp, p, n);
+        }
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        p += n;
+        len -= n;
+    }
+
+    return LXLSX_NO_ERROR;
+}
+
+/* Where and how a rewritten or added entry was written. */
+typedef struct {
+    uint64_t offset;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint32_t crc;
+    uint16_t method;
+    uint16_t version_needed;
+    uint16_t mod_time;
+    uint16_t mod_date;
+} lxlsx_source_written;
+
+/* Move the bytes in [from, end) of fp up by `by` bytes, back to front. */
+static lxlsx_error shift_file_data(FILE *fp, uint64_t from, uint64_t end,
+                                   size_t by)
+{
+    unsigned char *chunk = (unsigned char *)malloc(ZIP_STREAM_CHUNK);
+    uint64_t pos = end;
+    lxlsx_error err = LXLSX_NO_ERROR;
+
+    if (!chunk)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+
+    while (pos > from && err == LXLSX_NO_ERROR) {
+        size_t n = pos - from < ZIP_STREAM_CHUNK ? (size_t)(pos - from)
+                                                 : ZIP_STREAM_CHUNK;
+        pos -= n;
+        err = seek_to(fp, pos);
+        if (err == LXLSX_NO_ERROR && fread(chunk, 1, n, fp) != n)
+            err = LXLSX_ERROR_ZIP_FILE_OPERATION;
+        if (err == LXLSX_NO_ERROR)
+            err = seek_to(fp, pos + by);
+        if (err == LXLSX_NO_ERROR)
+            err = write_all(fp, chunk, n);
+    }
+
+    free(chunk);
+    return err;
+}
+
+/* Write a transformed replacement. Sizes and CRC are only known once the
+ * transform has run, so the local header is written with zeroes and patched
+ * afterwards, keeping the record identical to a buffered replacement.
+ *
+ * Output past 4 GB needs a ZIP64 extra field in the local header. Entries that
+ * are already large get an empty one up front; for the others the data is
+ * moved up to make room in the rare case they outgrow the 32-bit fields. */
+static lxlsx_error write_streamed_local(
+    FILE *fp,
+    const lxlsx_source_package *package,
+    const lxlsx_source_entry *entry,
+    const char *name,
+    size_t name_len,
+    lxlsx_source_package_transform transform,
+    void *ctx,
+    lxlsx_source_written *out)
+{
+    lxlsx_source_package_entry_stream *in = NULL;
+    lxlsx_source_package_sink *sink;
+    unsigned char zip64[20];
+    uint64_t offset;
+    uint64_t end;
+    uint16_t method = entry->info.compression_method;
+    uint16_t version_needed = entry->version_needed > 20
+                            ? entry->version_needed : 20;
+    int reserve = entry->info.uncompressed_size >= ZIP64_STREAM_RESERVE ||
+                  entry->info.compressed_size >= ZIP64_STREAM_RESERVE;
+    lxlsx_error err;
+
+    if (method != ZIP_METHOD_DEFLATE && method != ZIP_METHOD_STORE)
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+
+    err = current_offset(fp, &offset);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+    out->offset = offset;
+
+    sink = (lxlsx_source_package_sink *)calloc(1, sizeof(*sink));
+    if (!sink)
+        return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
+    sink->fp = fp;
+    sink->crc = (uint32_t)crc32(0L, Z_NULL, 0);
+    if (method == ZIP_METHOD_DEFLATE) {
+        if (deflateInit2(&sink->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(sink);
+            return LXLSX_ERROR_ZIP_FILE_OPERATION;
+        }
+        sink->deflating = 1;
+    }
+
+    memset(zip64, 0, sizeof(zip64));
+    if ((err = write_le32(fp, ZIP_LOCAL_FILE_SIG)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, version_needed)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, method)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, entry->mod_time)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, entry->mod_date)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le32(fp, 0)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le32(fp, 0)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le32(fp, 0)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, (uint16_t)name_len)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, reserve ? sizeof(zip64) : 0)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_all(fp, name, name_len)) != LXLSX_NO_ERROR) goto done;
+    if (reserve && (err = write_all(fp, zip64, sizeof(zip64))) != LXLSX_NO_ERROR) goto done;
+
+    err = lxlsx_source_package_entry_stream_open(
+        package, (size_t)(entry - package->entries), &in);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+    err = transform(ctx, in, sink);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+    if (sink->deflating) {
+        sink->zs.avail_in = 0;
+        err = sink_deflate(sink, Z_FINISH);
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+    }
+
+    /* Not SEEK_END: an in-place save writes over the old central directory. */
+    err = current_offset(fp, &end);
+    if (err != LXLSX_NO_ERROR)
+        goto done;
+
+    if (!reserve && (sink->compressed_size >= ZIP_MAX32 ||
+                     sink->uncompressed_size >= ZIP_MAX32)) {
+        uint64_t data = offset + 30 + name_len;
+
+        err = shift_file_data(fp, data, end, sizeof(zip64));
+        if (err != LXLSX_NO_ERROR)
+            goto done;
+        end += sizeof(zip64);
+        reserve = 1;
+    }
+
+    out->crc = sink->crc;
+    out->method = method;
+    out->mod_time = entry->mod_time;
+    out->mod_date = entry->mod_date;
+    out->compressed_size = sink->compressed_size;
+    out->uncompressed_size = sink->uncompressed_size;
+    out->version_needed = reserve && version_needed < ZIP64_VERSION
+                        ? ZIP64_VERSION : version_needed;
+
+    if ((err = seek_to(fp, offset + 4)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le16(fp, out->version_needed)) != LXLSX_NO_ERROR) goto done;
+    if ((err = seek_to(fp, offset + 14)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le32(fp, out->crc)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le32(fp, reserve ? ZIP_MAX32 : (uint32_t)out->compressed_size)) != LXLSX_NO_ERROR) goto done;
+    if ((err = write_le32(fp, reserve ? ZIP_MAX32 : (uint32_t)out->uncompressed_size)) != LXLSX_NO_ERROR) goto done;
+    if (reserve) {
+        put_le16(zip64, ZIP64_EXTRA_ID);
+        put_le16(zip64 + 2, 16);
+        put_le64(zip64 + 4, out->uncompressed_size);
+        put_le64(zip64 + 12, out->compressed_size);
+        if ((err = seek_to(fp, offset + 28)) != LXLSX_NO_ERROR) goto done;
+        if ((err = write_le16(fp, sizeof(zip64))) != LXLSX_NO_ERROR) goto done;
+        if ((err = seek_to(fp, offset + 30 + name_len)) != LXLSX_NO_ERROR) goto done;
+        if ((err = write_all(fp, zip64, sizeof(zip64))) != LXLSX_NO_ERROR) goto done;
+    }
+    err = seek_to(fp, end);
+
+done:
+    lxlsx_source_package_entry_stream_close(in);
+    if (sink->deflating)
+        deflateEnd(&sink->zs);
+    free(sink);
+    return err;
+}
+
 static lxlsx_error write_replacement_local(
     FILE *fp,
     const lxlsx_source_entry *entry,
     const lxlsx_source_package_replacement *replacement,
-    uint32_t *new_offset,
-    uint32_t *crc_out,
-    uint16_t *method_out,
-    uint16_t *version_needed_out,
-    uint32_t *compressed_size_out,
-    uint32_t *uncompressed_size_out)
+    lxlsx_source_written *out)
 {
     const unsigned char *payload = replacement->data;
     unsigned char *compressed = NULL;
     size_t payload_size = replacement->size;
-    uint32_t offset;
     uint32_t crc;
     uint16_t method;
     uint16_t version_needed;
@@ -742,14 +1444,12 @@ static lxlsx_error write_replacement_local(
     if (replacement->size > UINT_MAX)
         return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
 
-    err = current_offset(fp, &offset);
+    err = current_offset(fp, &out->offset);
     if (err != LXLSX_NO_ERROR)
         return err;
-    *new_offset = offset;
 
     crc = crc32(0L, Z_NULL, 0);
     crc = crc32(crc, replacement->data, (uInt)replacement->size);
-    *crc_out = crc;
 
     method = entry->info.compression_method;
     version_needed = entry->version_needed > 20 ? entry->version_needed : 20;
@@ -768,10 +1468,11 @@ static lxlsx_error write_replacement_local(
         return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
     }
 
-    *method_out = method;
-    *version_needed_out = version_needed;
-    *compressed_size_out = (uint32_t)payload_size;
-    *uncompressed_size_out = (uint32_t)replacement->size;
+    out->crc = crc;
+    out->method = method;
+    out->version_needed = version_needed;
+    out->compressed_size = payload_size;
+    out->uncompressed_size = replacement->size;
 
     if ((err = write_le32(fp, ZIP_LOCAL_FILE_SIG)) != LXLSX_NO_ERROR) goto done;
     if ((err = write_le16(fp, version_needed)) != LXLSX_NO_ERROR) goto done;
@@ -792,37 +1493,63 @@ done:
     return err;
 }
 
+/* Write the extra fields of a source central record minus its ZIP64 block,
+ * which the caller rebuilds for the new sizes and offset. */
+static lxlsx_error write_extra_without_zip64(FILE *fp,
+                                             const unsigned char *extra,
+                                             size_t len, size_t *written)
+{
+    size_t pos = 0;
+    lxlsx_error err;
+
+    *written = 0;
+    while (pos + 4 <= len) {
+        size_t block = 4 + (size_t)read_le16(extra + pos + 2);
+        if (pos + block > len)
+            break;
+        if (read_le16(extra + pos) != ZIP64_EXTRA_ID) {
+            err = write_all(fp, extra + pos, block);
+            if (err != LXLSX_NO_ERROR)
+                return err;
+            *written += block;
+        }
+        pos += block;
+    }
+    return LXLSX_NO_ERROR;
+}
+
 static lxlsx_error write_replacement_central(
     FILE *fp,
     const lxlsx_source_package *package,
     const lxlsx_source_entry *entry,
-    uint32_t new_offset,
-    uint32_t crc,
-    uint16_t method,
-    uint16_t version_needed,
-    uint32_t compressed_size,
-    uint32_t uncompressed_size)
+    const lxlsx_source_written *w)
 {
+    unsigned char zip64[28];
+    size_t zip64_len = zip64_central_extra(zip64, w->uncompressed_size,
+                                           w->compressed_size, w->offset);
+    uint16_t version_needed = zip64_len && w->version_needed < ZIP64_VERSION
+                            ? ZIP64_VERSION : w->version_needed;
     lxlsx_error err;
 
     if ((err = write_le32(fp, ZIP_CENTRAL_FILE_SIG)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, entry->version_made_by)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, version_needed)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le16(fp, method)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, w->method)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, entry->mod_time)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, entry->mod_date)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le32(fp, crc)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le32(fp, compressed_size)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le32(fp, uncompressed_size)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, w->crc)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, field32(w->compressed_size))) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, field32(w->uncompressed_size))) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, (uint16_t)entry->info.name_len)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, (uint16_t)zip64_len)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, (uint16_t)entry->central_comment_len)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, entry->internal_attr)) != LXLSX_NO_ERROR) return err;
     if ((err = write_le32(fp, entry->info.external_attr)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le32(fp, new_offset)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, field32(w->offset))) != LXLSX_NO_ERROR) return err;
     if ((err = write_all(fp, entry->info.name, entry->info.name_len)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_all(fp, zip64, zip64_len)) != LXLSX_NO_ERROR) return err;
     return write_all(fp, package->data + entry->central_comment_offset,
                      entry->central_comment_len);
 }
@@ -831,20 +1558,60 @@ static lxlsx_error write_preserved_central(
     FILE *fp,
     const lxlsx_source_package *package,
     const lxlsx_source_entry *entry,
-    uint32_t new_offset)
+    uint64_t new_offset)
 {
+    const unsigned char *record = package->data + entry->central_offset;
+    unsigned char head[46];
+    unsigned char zip64[28];
+    size_t zip64_len;
+    size_t extra_len;
+    uint16_t version_needed;
+    uint64_t extra_at;
+    uint64_t end;
     lxlsx_error err;
-    unsigned char off[4];
 
-    err = write_all(fp, package->data + entry->central_offset, 42);
-    if (err != LXLSX_NO_ERROR)
+    /* Common case: copy the record, only the offset changes. */
+    if (!entry->central_zip64 && new_offset < ZIP_MAX32) {
+        memcpy(head, record, 42);
+        put_le32(head + 42, (uint32_t)new_offset);
+        err = write_all(fp, head, sizeof(head));
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        return write_all(fp, record + 46, entry->central_size - 46);
+    }
+
+    /* Otherwise rebuild the ZIP64 extra field for the sizes and new offset. */
+    zip64_len = zip64_central_extra(zip64, entry->info.uncompressed_size,
+                                    entry->info.compressed_size, new_offset);
+    memcpy(head, record, sizeof(head));
+    version_needed = read_le16(head + 6);
+    if (zip64_len && version_needed < ZIP64_VERSION)
+        put_le16(head + 6, ZIP64_VERSION);
+    put_le32(head + 20, field32(entry->info.compressed_size));
+    put_le32(head + 24, field32(entry->info.uncompressed_size));
+    put_le16(head + 34, 0);
+    put_le32(head + 42, field32(new_offset));
+
+    if ((err = current_offset(fp, &extra_at)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_all(fp, head, sizeof(head))) != LXLSX_NO_ERROR) return err;
+    if ((err = write_all(fp, entry->info.name, entry->info.name_len)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_all(fp, zip64, zip64_len)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_extra_without_zip64(fp, package->data + entry->central_extra_offset,
+                                         entry->central_extra_len,
+                                         &extra_len)) != LXLSX_NO_ERROR)
         return err;
-    put_le32(off, new_offset);
-    err = write_all(fp, off, sizeof(off));
-    if (err != LXLSX_NO_ERROR)
+    if ((err = write_all(fp, package->data + entry->central_comment_offset,
+                         entry->central_comment_len)) != LXLSX_NO_ERROR)
         return err;
-    return write_all(fp, package->data + entry->central_offset + 46,
-                     entry->central_size - 46);
+
+    /* Patch the extra field length now that it is known. */
+    extra_len += zip64_len;
+    if (extra_len > ZIP_MAX16)
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+    if ((err = current_offset(fp, &end)) != LXLSX_NO_ERROR) return err;
+    if ((err = seek_to(fp, extra_at + 30)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, (uint16_t)extra_len)) != LXLSX_NO_ERROR) return err;
+    return seek_to(fp, end);
 }
 
 /* DOS date for 1980-01-01 (a fixed, valid timestamp for new parts). */
@@ -863,25 +1630,98 @@ static int name_is_precompressed_media(const char *name)
            strcmp(dot, ".bmp") == 0;
 }
 
+/* Copy an entry of another package under a new name: the compressed bytes
+ * are written out as they are, only the local header is new. */
+static lxlsx_error write_copied_local(FILE *fp,
+                                      const lxlsx_source_entry *entry,
+                                      const unsigned char *data,
+                                      const char *name, size_t name_len,
+                                      lxlsx_source_written *out)
+{
+    unsigned char zip64[20];
+    int large = entry->info.compressed_size >= ZIP_MAX32 ||
+                entry->info.uncompressed_size >= ZIP_MAX32;
+    uint16_t version_needed = entry->version_needed > 20
+                            ? entry->version_needed : 20;
+    lxlsx_error err;
+
+    /* Encrypted entries carry their own header bytes; not copied. */
+    if (entry->info.flags & 0x0001)
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+    if (large && version_needed < ZIP64_VERSION)
+        version_needed = ZIP64_VERSION;
+
+    err = current_offset(fp, &out->offset);
+    if (err != LXLSX_NO_ERROR)
+        return err;
+
+    out->crc = entry->info.crc32;
+    out->method = entry->info.compression_method;
+    out->compressed_size = entry->info.compressed_size;
+    out->uncompressed_size = entry->info.uncompressed_size;
+    out->version_needed = version_needed;
+    out->mod_time = entry->mod_time;
+    out->mod_date = entry->mod_date;
+
+    put_le16(zip64, ZIP64_EXTRA_ID);
+    put_le16(zip64 + 2, 16);
+    put_le64(zip64 + 4, out->uncompressed_size);
+    put_le64(zip64 + 12, out->compressed_size);
+
+    if ((err = write_le32(fp, ZIP_LOCAL_FILE_SIG)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, version_needed)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, out->method)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, out->mod_time)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, out->mod_date)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, out->crc)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, large ? ZIP_MAX32 : (uint32_t)out->compressed_size)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, large ? ZIP_MAX32 : (uint32_t)out->uncompressed_size)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, (uint16_t)name_len)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, large ? sizeof(zip64) : 0)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_all(fp, name, name_len)) != LXLSX_NO_ERROR) return err;
+    if (large && (err = write_all(fp, zip64, sizeof(zip64))) != LXLSX_NO_ERROR) return err;
+    return write_all(fp, data + entry->data_offset,
+                     (size_t)entry->info.compressed_size);
+}
+
 static lxlsx_error write_addition_local(
     FILE *fp, const lxlsx_source_package_addition *add,
-    uint32_t *offset_out, uint32_t *crc_out,
-    uint32_t *comp_out, uint32_t *uncomp_out, uint16_t *method_out)
+    lxlsx_source_written *out)
 {
     unsigned char *compressed = NULL;
     const unsigned char *payload;
     size_t comp_size = 0, payload_size, name_len;
     uint16_t method;
-    uint32_t offset, crc;
+    uint32_t crc;
     lxlsx_error err;
 
-    if (!add->name || (!add->data && add->size != 0))
+    if (!add->name)
         return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
     name_len = strlen(add->name);
-    if (add->size > UINT_MAX || name_len > 0xFFFF)
+    if (name_len > 0xFFFF)
         return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
 
-    err = current_offset(fp, &offset);
+    if (add->source) {
+        const lxlsx_source_entry *entry;
+
+        if (add->source_index >= add->source->entry_count)
+            return LXLSX_ERROR_PARAMETER_VALIDATION;
+        entry = &add->source->entries[add->source_index];
+        if (add->transform)
+            return write_streamed_local(fp, add->source, entry, add->name,
+                                        name_len, add->transform, add->ctx,
+                                        out);
+        return write_copied_local(fp, entry, add->source->data, add->name,
+                                  name_len, out);
+    }
+
+    if (!add->data && add->size != 0)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+    if (add->size > UINT_MAX)
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+
+    err = current_offset(fp, &out->offset);
     if (err != LXLSX_NO_ERROR) return err;
 
     crc = crc32(0L, Z_NULL, 0);
@@ -908,11 +1748,13 @@ static lxlsx_error write_addition_local(
         }
     }
 
-    *offset_out = offset;
-    *crc_out = crc;
-    *comp_out = (uint32_t)payload_size;
-    *uncomp_out = (uint32_t)add->size;
-    *method_out = method;
+    out->crc = crc;
+    out->compressed_size = payload_size;
+    out->uncompressed_size = add->size;
+    out->method = method;
+    out->version_needed = 20;
+    out->mod_time = LXLSX_ZIP_DEF_TIME;
+    out->mod_date = LXLSX_ZIP_DEF_DATE;
 
     if ((err = write_le32(fp, ZIP_LOCAL_FILE_SIG)) != LXLSX_NO_ERROR) goto done;
     if ((err = write_le16(fp, 20)) != LXLSX_NO_ERROR) goto done;          /* version needed */
@@ -935,137 +1777,135 @@ done:
 
 static lxlsx_error write_addition_central(
     FILE *fp, const lxlsx_source_package_addition *add,
-    uint32_t offset, uint32_t crc, uint32_t comp_size, uint32_t uncomp_size,
-    uint16_t method)
+    const lxlsx_source_written *w)
 {
+    unsigned char zip64[28];
+    size_t zip64_len = zip64_central_extra(zip64, w->uncompressed_size,
+                                           w->compressed_size, w->offset);
     size_t name_len = strlen(add->name);
+    uint16_t version = zip64_len && w->version_needed < ZIP64_VERSION
+                     ? ZIP64_VERSION : w->version_needed;
     lxlsx_error err;
 
     if ((err = write_le32(fp, ZIP_CENTRAL_FILE_SIG)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le16(fp, 20)) != LXLSX_NO_ERROR) return err;         /* version made by */
-    if ((err = write_le16(fp, 20)) != LXLSX_NO_ERROR) return err;         /* version needed */
+    if ((err = write_le16(fp, version)) != LXLSX_NO_ERROR) return err;    /* version made by */
+    if ((err = write_le16(fp, version)) != LXLSX_NO_ERROR) return err;    /* version needed */
     if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;          /* flags */
-    if ((err = write_le16(fp, method)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le16(fp, LXLSX_ZIP_DEF_TIME)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le16(fp, LXLSX_ZIP_DEF_DATE)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le32(fp, crc)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le32(fp, comp_size)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le32(fp, uncomp_size)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, w->method)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, w->mod_time)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, w->mod_date)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, w->crc)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, field32(w->compressed_size))) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, field32(w->uncompressed_size))) != LXLSX_NO_ERROR) return err;
     if ((err = write_le16(fp, (uint16_t)name_len)) != LXLSX_NO_ERROR) return err;
-    if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;          /* extra len */
+    if ((err = write_le16(fp, (uint16_t)zip64_len)) != LXLSX_NO_ERROR) return err; /* extra len */
     if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;          /* comment len */
     if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;          /* disk start */
     if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;          /* internal attr */
     if ((err = write_le32(fp, 0)) != LXLSX_NO_ERROR) return err;          /* external attr */
-    if ((err = write_le32(fp, offset)) != LXLSX_NO_ERROR) return err;
-    return write_all(fp, add->name, name_len);
+    if ((err = write_le32(fp, field32(w->offset))) != LXLSX_NO_ERROR) return err;
+    if ((err = write_all(fp, add->name, name_len)) != LXLSX_NO_ERROR) return err;
+    return write_all(fp, zip64, zip64_len);
 }
 
-static lxlsx_error save_internal(
+/* End of central directory, preceded by the ZIP64 record and locator when
+ * the entry count, directory size or offset do not fit the classic one. */
+static lxlsx_error write_end_of_directory(FILE *fp,
+                                          const lxlsx_source_package *package,
+                                          uint64_t total_entries,
+                                          uint64_t central_offset,
+                                          uint64_t central_size)
+{
+    uint64_t record;
+    lxlsx_error err;
+    int zip64 = total_entries >= ZIP_MAX16 || central_offset >= ZIP_MAX32 ||
+                central_size >= ZIP_MAX32;
+
+    if (zip64) {
+        if ((err = current_offset(fp, &record)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le32(fp, ZIP64_EOCD_SIG)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le64(fp, 44)) != LXLSX_NO_ERROR) return err;     /* record size */
+        if ((err = write_le16(fp, ZIP64_VERSION)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le16(fp, ZIP64_VERSION)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le32(fp, 0)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le32(fp, 0)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le64(fp, total_entries)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le64(fp, total_entries)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le64(fp, central_size)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le64(fp, central_offset)) != LXLSX_NO_ERROR) return err;
+
+        if ((err = write_le32(fp, ZIP64_LOCATOR_SIG)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le32(fp, 0)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le64(fp, record)) != LXLSX_NO_ERROR) return err;
+        if ((err = write_le32(fp, 1)) != LXLSX_NO_ERROR) return err;
+    }
+
+    if ((err = write_le32(fp, ZIP_EOCD_SIG)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, zip64 ? ZIP_MAX16 : (uint16_t)total_entries)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, zip64 ? ZIP_MAX16 : (uint16_t)total_entries)) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, field32(central_size))) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le32(fp, field32(central_offset))) != LXLSX_NO_ERROR) return err;
+    if ((err = write_le16(fp, (uint16_t)package->global_comment_len)) != LXLSX_NO_ERROR) return err;
+    return write_all(fp, package->data + package->global_comment_offset,
+                     package->global_comment_len);
+}
+
+/* Write the local records, central directory and EOCD of the saved package
+ * at the current position of fp. An in-place save leaves the preserved local
+ * records where they are and only writes the changed and added ones. */
+static lxlsx_error write_package(
+    FILE *fp,
     const lxlsx_source_package *package,
-    const char *path,
     const lxlsx_source_package_replacement *replacements,
     size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
     const lxlsx_source_package_addition *additions,
-    size_t addition_count)
+    size_t addition_count,
+    int in_place)
 {
-    FILE *fp;
-    uint32_t *new_offsets;
-    uint32_t *new_crcs;
-    uint16_t *new_methods;
-    uint16_t *new_versions;
-    uint32_t *new_compressed_sizes;
-    uint32_t *new_uncompressed_sizes;
-    uint32_t central_offset;
-    uint32_t central_size;
-    uint32_t end_offset;
-    uint32_t *add_offsets = NULL, *add_crcs = NULL;
-    uint32_t *add_comp = NULL, *add_uncomp = NULL;
-    uint16_t *add_methods = NULL;
-    size_t total_entries;
+    lxlsx_source_written *written;
+    lxlsx_source_written *added;
+    uint64_t central_offset = 0;
+    uint64_t end_offset = 0;
     size_t i;
     lxlsx_error err = LXLSX_NO_ERROR;
 
-    if (!package || !path)
-        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
-    if ((!replacements || replacement_count == 0) &&
-        (!additions || addition_count == 0))
-        return lxlsx_source_package_save_copy(package, path);
-    if (!additions)
-        addition_count = 0;
-
-    new_offsets = (uint32_t *)calloc(package->entry_count, sizeof(*new_offsets));
-    new_crcs = (uint32_t *)calloc(package->entry_count, sizeof(*new_crcs));
-    new_methods = (uint16_t *)calloc(package->entry_count, sizeof(*new_methods));
-    new_versions = (uint16_t *)calloc(package->entry_count, sizeof(*new_versions));
-    new_compressed_sizes = (uint32_t *)calloc(package->entry_count,
-                                             sizeof(*new_compressed_sizes));
-    new_uncompressed_sizes = (uint32_t *)calloc(package->entry_count,
-                                               sizeof(*new_uncompressed_sizes));
-    if (!new_offsets || !new_crcs || !new_methods || !new_versions ||
-        !new_compressed_sizes || !new_uncompressed_sizes) {
-        free(new_offsets);
-        free(new_crcs);
-        free(new_methods);
-        free(new_versions);
-        free(new_compressed_sizes);
-        free(new_uncompressed_sizes);
+    written = (lxlsx_source_written *)calloc(package->entry_count + addition_count + 1,
+                                             sizeof(*written));
+    if (!written)
         return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-    }
-
-    if (addition_count > 0) {
-        add_offsets = (uint32_t *)calloc(addition_count, sizeof(*add_offsets));
-        add_crcs = (uint32_t *)calloc(addition_count, sizeof(*add_crcs));
-        add_comp = (uint32_t *)calloc(addition_count, sizeof(*add_comp));
-        add_uncomp = (uint32_t *)calloc(addition_count, sizeof(*add_uncomp));
-        add_methods = (uint16_t *)calloc(addition_count, sizeof(*add_methods));
-        if (!add_offsets || !add_crcs || !add_comp || !add_uncomp || !add_methods) {
-            free(new_offsets); free(new_crcs); free(new_methods);
-            free(new_versions); free(new_compressed_sizes); free(new_uncompressed_sizes);
-            free(add_offsets); free(add_crcs); free(add_comp); free(add_uncomp); free(add_methods);
-            return LXLSX_ERROR_MEMORY_MALLOC_FAILED;
-        }
-    }
-
-    fp = fopen(path, "wb");
-    if (!fp) {
-        free(new_offsets);
-        free(new_crcs);
-        free(new_methods);
-        free(new_versions);
-        free(new_compressed_sizes);
-        free(new_uncompressed_sizes);
-        free(add_offsets); free(add_crcs); free(add_comp); free(add_uncomp); free(add_methods);
-        return LXLSX_ERROR_CREATING_XLSX_FILE;
-    }
+    added = written + package->entry_count;
 
     for (i = 0; i < package->entry_count && err == LXLSX_NO_ERROR; i++) {
         const lxlsx_source_entry *entry = &package->entries[i];
         const lxlsx_source_package_replacement *replacement =
             find_replacement(replacements, replacement_count, i);
-
-        if (replacement) {
-            err = write_replacement_local(fp, entry, replacement,
-                                          &new_offsets[i], &new_crcs[i],
-                                          &new_methods[i], &new_versions[i],
-                                          &new_compressed_sizes[i],
-                                          &new_uncompressed_sizes[i]);
+        const lxlsx_source_package_stream_replacement *stream =
+            find_stream(streams, stream_count, i);
+
+        if (stream) {
+            err = write_streamed_local(fp, package, entry, entry->info.name,
+                                       entry->info.name_len, stream->transform,
+                                       stream->ctx, &written[i]);
+        } else if (replacement) {
+            err = write_replacement_local(fp, entry, replacement, &written[i]);
+        } else if (in_place) {
+            written[i].offset = entry->local_offset;
         } else {
-            err = current_offset(fp, &new_offsets[i]);
+            err = current_offset(fp, &written[i].offset);
             if (err == LXLSX_NO_ERROR) {
                 err = write_all(fp, package->data + entry->local_offset,
                                 entry->local_record_size);
             }
-            new_crcs[i] = entry->info.crc32;
         }
     }
 
     /* Append local records for brand-new parts. */
-    for (i = 0; i < addition_count && err == LXLSX_NO_ERROR; i++) {
-        err = write_addition_local(fp, &additions[i], &add_offsets[i],
-                                   &add_crcs[i], &add_comp[i], &add_uncomp[i],
-                                   &add_methods[i]);
-    }
+    for (i = 0; i < addition_count && err == LXLSX_NO_ERROR; i++)
+        err = write_addition_local(fp, &additions[i], &added[i]);
 
     if (err == LXLSX_NO_ERROR)
         err = current_offset(fp, &central_offset);
@@ -1074,61 +1914,195 @@ static lxlsx_error save_internal(
         const lxlsx_source_entry *entry = &package->entries[i];
         const lxlsx_source_package_replacement *replacement =
             find_replacement(replacements, replacement_count, i);
-        if (replacement) {
-            err = write_replacement_central(fp, package, entry,
-                                            new_offsets[i], new_crcs[i],
-                                            new_methods[i], new_versions[i],
-                                            new_compressed_sizes[i],
-                                            new_uncompressed_sizes[i]);
-        } else {
-            err = write_preserved_central(fp, package, entry, new_offsets[i]);
-        }
+        if (replacement || find_stream(streams, stream_count, i))
+            err = write_replacement_central(fp, package, entry, &written[i]);
+        else
+            err = write_preserved_central(fp, package, entry, written[i].offset);
     }
 
     /* Central records for the new parts. */
-    for (i = 0; i < addition_count && err == LXLSX_NO_ERROR; i++) {
-        err = write_addition_central(fp, &additions[i], add_offsets[i],
-                                     add_crcs[i], add_comp[i], add_uncomp[i],
-                                     add_methods[i]);
+    for (i = 0; i < addition_count && err == LXLSX_NO_ERROR; i++)
+        err = write_addition_central(fp, &additions[i], &added[i]);
+
+    if (err == LXLSX_NO_ERROR)
+        err = current_offset(fp, &end_offset);
+    if (err == LXLSX_NO_ERROR)
+        err = write_end_of_directory(fp, package,
+                                     package->entry_count + addition_count,
+                                     central_offset,
+                                     end_offset - central_offset);
+
+    free(written);
+    return err;
+}
+
+static lxlsx_error save_internal(
+    const lxlsx_source_package *package,
+    const char *path,
+    const lxlsx_source_package_replacement *replacements,
+    size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
+    const lxlsx_source_package_addition *additions,
+    size_t addition_count)
+{
+    FILE *fp;
+    char *tmp_path;
+    int mapped;
+    size_t i;
+    lxlsx_error err;
+
+    if (!package || !path)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+    if ((!replacements || replacement_count == 0) &&
+        (!streams || stream_count == 0) &&
+        (!additions || addition_count == 0))
+        return lxlsx_source_package_save_copy(package, path);
+    if (!additions)
+        addition_count = 0;
+    if (!streams)
+        stream_count = 0;
+
+    /* Parts copied from other packages are read while writing too. */
+    mapped = package_maps_file(package, path);
+    for (i = 0; i < addition_count && !mapped; i++)
+        mapped = package_maps_file(additions[i].source, path);
+
+    fp = open_output(path, mapped, &tmp_path);
+    if (!fp)
+        return LXLSX_ERROR_CREATING_XLSX_FILE;
+
+    err = write_package(fp, package, replacements, replacement_count,
+                        streams, stream_count, additions, addition_count, 0);
+
+    return close_output(fp, path, tmp_path, err);
+}
+
+/* Bytes of the local-record area no central entry points at, plus those of
+ * the records the given changes supersede. */
+static size_t dead_bytes_after(
+    const lxlsx_source_package *package,
+    const lxlsx_source_package_replacement *replacements,
+    size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count)
+{
+    size_t live = 0;
+    size_t i;
+
+    for (i = 0; i < package->entry_count; i++) {
+        if (find_replacement(replacements, replacement_count, i) ||
+            find_stream(streams, stream_count, i))
+            continue;
+        live += package->entries[i].local_record_size;
     }
+    return package->central_offset - live;
+}
 
-    total_entries = package->entry_count + addition_count;
-    /* The non-ZIP64 EOCD entry count is 16-bit; refuse to silently truncate. */
-    if (err == LXLSX_NO_ERROR && total_entries > 0xfffe)
-        err = LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+/* Whether the file at fp still is the snapshot the package was read from.
+ * Only the central directory and EOCD are compared: an in-place save
+ * rewrites exactly those, and any other writer rewrites them too. */
+static int file_matches_package(FILE *fp, const lxlsx_source_package *package)
+{
+    unsigned char chunk[4096];
+    size_t pos = package->central_offset;
+    uint64_t size;
 
+    if (zip_fseek(fp, 0, SEEK_END) != 0 ||
+        current_offset(fp, &size) != LXLSX_NO_ERROR ||
+        size != package->size)
+        return 0;
+    if (seek_to(fp, pos) != LXLSX_NO_ERROR)
+        return 0;
+
+    while (pos < package->size) {
+        size_t want = package->size - pos < sizeof(chunk)
+                    ? package->size - pos : sizeof(chunk);
+        if (fread(chunk, 1, want, fp) != want ||
+            memcmp(chunk, package->data + pos, want) != 0)
+            return 0;
+        pos += want;
+    }
+    return 1;
+}
+
+static int truncate_file(FILE *fp, uint64_t size)
+{
+    if (fflush(fp) != 0)
+        return -1;
+#ifdef _WIN32
+    return _chsize_s(_fileno(fp), (__int64)size);
+#else
+    return ftruncate(fileno(fp), (off_t)size);
+#endif
+}
+
+lxlsx_error lxlsx_source_package_save_in_place(
+    const lxlsx_source_package *package,
+    const char *path,
+    const lxlsx_source_package_replacement *replacements,
+    size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
+    const lxlsx_source_package_addition *additions,
+    size_t addition_count,
+    double compact_ratio)
+{
+    FILE *fp;
+    uint64_t end;
+    lxlsx_error err;
+
+    if (!package || !path)
+        return LXLSX_ERROR_NULL_PARAMETER_IGNORED;
+    if (!replacements)
+        replacement_count = 0;
+    if (!streams)
+        stream_count = 0;
+    if (!additions)
+        addition_count = 0;
+    if (compact_ratio <= 0)
+        compact_ratio = LXLSX_SOURCE_PACKAGE_COMPACT_RATIO;
+
+    /* Too much of the file would be superseded records: compact instead. */
+    if ((double)dead_bytes_after(package, replacements, replacement_count,
+                                 streams, stream_count)
+        > compact_ratio * (double)package->size)
+        return save_internal(package, path, replacements, replacement_count,
+                             streams, stream_count, additions, addition_count);
+
+    fp = fopen(path, "r+b");
+    if (!fp || !file_matches_package(fp, package)) {
+        /* Not the file we read: write the whole snapshot out instead. */
+        if (fp)
+            fclose(fp);
+        return save_internal(package, path, replacements, replacement_count,
+                             streams, stream_count, additions, addition_count);
+    }
+    if (replacement_count == 0 && stream_count == 0 && addition_count == 0)
+        return fclose(fp) == 0 ? LXLSX_NO_ERROR : LXLSX_ERROR_ZIP_FILE_OPERATION;
+
+    /* The new records and directory go over the old directory; the local
+     * records before it are not touched. */
+    err = seek_to(fp, package->central_offset);
     if (err == LXLSX_NO_ERROR)
-        err = current_offset(fp, &end_offset);
+        err = write_package(fp, package, replacements, replacement_count,
+                            streams, stream_count, additions, addition_count, 1);
     if (err == LXLSX_NO_ERROR) {
-        central_size = end_offset - central_offset;
-        if ((err = write_le32(fp, ZIP_EOCD_SIG)) != LXLSX_NO_ERROR) goto done;
-        if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) goto done;
-        if ((err = write_le16(fp, 0)) != LXLSX_NO_ERROR) goto done;
-        if ((err = write_le16(fp, (uint16_t)total_entries)) != LXLSX_NO_ERROR) goto done;
-        if ((err = write_le16(fp, (uint16_t)total_entries)) != LXLSX_NO_ERROR) goto done;
-        if ((err = write_le32(fp, central_size)) != LXLSX_NO_ERROR) goto done;
-        if ((err = write_le32(fp, central_offset)) != LXLSX_NO_ERROR) goto done;
-        if ((err = write_le16(fp, (uint16_t)package->global_comment_len)) != LXLSX_NO_ERROR) goto done;
-        err = write_all(fp, package->data + package->global_comment_offset,
-                        package->global_comment_len);
+        if (current_offset(fp, &end) != LXLSX_NO_ERROR ||
+            truncate_file(fp, end) != 0)
+            err = LXLSX_ERROR_ZIP_FILE_OPERATION;
+    }
+
+    if (err != LXLSX_NO_ERROR) {
+        /* Put the original directory back so the file stays as it was. */
+        if (seek_to(fp, package->central_offset) == LXLSX_NO_ERROR &&
+            write_all(fp, package->data + package->central_offset,
+                      package->size - package->central_offset) == LXLSX_NO_ERROR)
+            truncate_file(fp, package->size);
     }
 
-done:
     if (fclose(fp) != 0 && err == LXLSX_NO_ERROR)
         err = LXLSX_ERROR_ZIP_FILE_OPERATION;
-    free(new_offsets);
-    free(new_crcs);
-    free(new_methods);
-    free(new_versions);
-    free(new_compressed_sizes);
-    free(new_uncompressed_sizes);
-    free(add_offsets);
-    free(add_crcs);
-    free(add_comp);
-    free(add_uncomp);
-    free(add_methods);
-    if (err != LXLSX_NO_ERROR)
-        remove(path);
     return err;
 }
 
@@ -1138,7 +2112,8 @@ lxlsx_error lxlsx_source_package_save_with_replacements(
     const lxlsx_source_package_replacement *replacements,
     size_t replacement_count)
 {
-    return save_internal(package, path, replacements, replacement_count, NULL, 0);
+    return save_internal(package, path, replacements, replacement_count,
+                         NULL, 0, NULL, 0);
 }
 
 lxlsx_error lxlsx_source_package_save_with_changes(
@@ -1150,5 +2125,19 @@ lxlsx_error lxlsx_source_package_save_with_changes(
     size_t addition_count)
 {
     return save_internal(package, path, replacements, replacement_count,
-                         additions, addition_count);
+                         NULL, 0, additions, addition_count);
+}
+
+lxlsx_error lxlsx_source_package_save_streamed(
+    const lxlsx_source_package *package,
+    const char *path,
+    const lxlsx_source_package_replacement *replacements,
+    size_t replacement_count,
+    const lxlsx_source_package_stream_replacement *streams,
+    size_t stream_count,
+    const lxlsx_source_package_addition *additions,
+    size_t addition_count)
+{
+    return save_internal(package, path, replacements, replacement_count,
+                         streams, stream_count, additions, addition_count);
 }
@@ -1155,7 +1155,7 @@ _write_alignment(lxlsx_styles *self, lxlsx_format *format)
     if (format->reading_order == 2)
         LXLSX_PUSH_ATTRIBUTES_STR("readingOrder", "2");
 
-    if (!STAILQ_EMPTY(&attributes))
+    if (!LXLSX_ATTRIBUTES_EMPTY())
         lxlsx_xml_empty_tag(self->file, "alignment", &attributes);
 
     LXLSX_FREE_ATTRIBUTES();
@@ -337,7 +337,7 @@ lxlsx_theme_assemble_xml_file(lxlsx_theme *self)
     int i = 0;
 
     while (strlen(lxlsx_theme_strs[i])) {
-        fprintf(self->file, "%s", lxlsx_theme_strs[i]);
+        fputs(lxlsx_theme_strs[i], self->file);
         i++;
     }
 }
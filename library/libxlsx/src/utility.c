@@ -23,10 +23,6 @@
 
 #define LXLSX_TMPFILE_BUFFER_SIZE (64 * 1024)
 
-#ifdef USE_DTOA_LIBRARY
-#include "libxlsx/third_party/emyg_dtoa.h"
-#endif
-
 char *error_strings[LXLSX_MAX_ERRNO + 1] = {
     "No error.",
     "Memory error, failed to malloc() required memory.",
@@ -747,15 +743,14 @@ done:
 }
 
 /*
- * Use third party function to handle sprintf of doubles for locale portable
+ * Use the dtoa formatter to handle sprintf of doubles for locale portable
  * code.
  */
 #ifdef USE_DTOA_LIBRARY
 int
 lxlsx_sprintf_dbl(char *data, double number)
 {
-    emyg_dtoa(number, data);
-    return 0;
+    return (int) lxlsx_dtoa(number, data);
 }
 #endif
 
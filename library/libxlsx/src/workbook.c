@@ -284,6 +284,7 @@ lxlsx_workbook_free(lxlsx_workbook *workbook)
 
     lxlsx_hash_free(workbook->used_xf_formats);
     lxlsx_hash_free(workbook->used_dxf_formats);
+    lxlsx_hash_free(workbook->interned_formats);
     lxlsx_sst_free(workbook->sst);
     free((void *) workbook->options.tmpdir);
     free(workbook->ordered_charts);
@@ -833,7 +834,8 @@ mem_error:
 /*
  * Populate the data cache of a chart data series by reading the data from the
  * relevant worksheet and adding it to the cached in the range object as a
- * list of points.
+ * list of points. Ranges that captured their values as the cells were written
+ * already hold the points so they only need to be linked into the cache.
  *
  * Note, the data cache isn't strictly required by Excel but it helps if the
  * chart is embedded in another application such as PowerPoint and it also
@@ -848,7 +850,7 @@ _populate_range_data_cache(lxlsx_workbook *self, lxlsx_series_range *range)
     lxlsx_row *row_obj;
     lxlsx_cell *cell_obj;
     struct lxlsx_series_data_point *data_point;
-    uint16_t num_data_points = 0;
+    uint32_t num_data_points = 0;
 
     /* If ignore_cache is set then don't try to populate the cache. This flag
      * may be set manually, for testing, or due to a case where the cache
@@ -857,6 +859,22 @@ _populate_range_data_cache(lxlsx_workbook *self, lxlsx_series_range *range)
     if (range->ignore_cache)
         return;
 
+    /* Use the values captured as the worksheet cells were written. */
+    if (range->captured) {
+        for (num_data_points = 0; num_data_points < range->num_captured;
+             num_data_points++) {
+            data_point = &range->captured[num_data_points];
+
+            if (data_point->is_string)
+                range->has_string_cache = LXLSX_TRUE;
+
+            STAILQ_INSERT_TAIL(range->data_cache, data_point, list_pointers);
+        }
+
+        range->num_data_points = num_data_points;
+        return;
+    }
+
     /* Currently we only handle 2D ranges so ensure either the rows or cols
      * are the same.
      */
@@ -896,22 +914,10 @@ _populate_range_data_cache(lxlsx_workbook *self, lxlsx_series_range *range)
             }
 
             cell_obj = lxlsx_worksheet_find_cell_in_row(row_obj, col_num);
+            lxlsx_worksheet_fill_data_point(data_point, cell_obj);
 
-            if (cell_obj) {
-                if (cell_obj->type == NUMBER_CELL) {
-                    data_point->number = cell_obj->data.writer.value.number;
-                }
-
-                if (cell_obj->type == STRING_CELL) {
-                    data_point->string = lxlsx_strdup(
-                        cell_obj->data.writer.value.shared_string.string);
-                    data_point->is_string = LXLSX_TRUE;
-                    range->has_string_cache = LXLSX_TRUE;
-                }
-            }
-            else {
-                data_point->no_data = LXLSX_TRUE;
-            }
+            if (data_point->is_string)
+                range->has_string_cache = LXLSX_TRUE;
 
             STAILQ_INSERT_TAIL(range->data_cache, data_point, list_pointers);
             num_data_points++;
@@ -922,6 +928,70 @@ _populate_range_data_cache(lxlsx_workbook *self, lxlsx_series_range *range)
 
 }
 
+/*
+ * Split a chart range formula such as Sheet1!$A$1:$A$5, in place, into the
+ * unquoted sheet name and the cell range. Returns the cell range or NULL if
+ * the formula isn't a simple sheet range.
+ */
+STATIC char *
+_split_range_formula(char *formula, char **sheetname)
+{
+    char *tmp_str;
+
+    /* Ignore non-contiguous range like (Sheet1!$A$1:$A$2,Sheet1!$A$4:$A$5) */
+    if (formula[0] == '(')
+        return NULL;
+
+    /* Check for valid formula. Note, This needs stronger validation. */
+    tmp_str = strchr(formula, '!');
+
+    /* Check for empty string. */
+    if (tmp_str == NULL || lxlsx_str_is_empty(tmp_str))
+        return NULL;
+
+    /* Split the formulas into sheetname and row-col data. */
+    *tmp_str = '\0';
+    tmp_str++;
+    *sheetname = formula;
+
+    if (lxlsx_str_is_empty(tmp_str) || lxlsx_str_is_empty(*sheetname))
+        return NULL;
+
+    /* Remove any worksheet quoting. */
+    if ((*sheetname)[0] == '\'')
+        (*sheetname)++;
+    if (strlen(*sheetname) > 0
+        && (*sheetname)[strlen(*sheetname) - 1] == '\'') {
+        (*sheetname)[strlen(*sheetname) - 1] = '\0';
+    }
+
+    return tmp_str;
+}
+
+/*
+ * Set the sheet name and row-col dimensions of a range from the parts of its
+ * formula.
+ */
+STATIC void
+_set_range_dimensions(lxlsx_series_range *range, const char *sheetname,
+                      const char *cells)
+{
+    range->sheetname = lxlsx_strdup(sheetname);
+    range->first_row = lxlsx_name_to_row(cells);
+    range->first_col = lxlsx_name_to_col(cells);
+
+    if (strchr(cells, ':')) {
+        /* 2D range. */
+        range->last_row = lxlsx_name_to_row_2(cells);
+        range->last_col = lxlsx_name_to_col_2(cells);
+    }
+    else {
+        /* 1D range. */
+        range->last_row = range->first_row;
+        range->last_col = range->first_col;
+    }
+}
+
 /* Convert a chart range such as Sheet1!$A$1:$A$5 to a sheet name and row-col
  * dimensions, or vice-versa. This gives us the dimensions to read data back
  * from the worksheet.
@@ -931,8 +1001,8 @@ _populate_range_dimensions(lxlsx_workbook *self, lxlsx_series_range *range)
 {
 
     char formula[LXLSX_MAX_FORMULA_RANGE_LENGTH] = { 0 };
-    char *tmp_str;
-    char *sheetname;
+    char *sheetname = NULL;
+    char *cells;
 
     /* If neither the range formula or sheetname is defined then this probably
      * isn't a valid range.
@@ -948,71 +1018,26 @@ _populate_range_dimensions(lxlsx_workbook *self, lxlsx_series_range *range)
     if (range->sheetname)
         return;
 
-    /* Ignore non-contiguous range like (Sheet1!$A$1:$A$2,Sheet1!$A$4:$A$5) */
-    if (range->formula[0] == '(') {
-        range->ignore_cache = LXLSX_TRUE;
-        return;
-    }
-
     /* Create a copy of the formula to modify and parse into parts. */
     lxlsx_snprintf(formula, LXLSX_MAX_FORMULA_RANGE_LENGTH, "%s", range->formula);
 
-    /* Check for valid formula. Note, This needs stronger validation. */
-    tmp_str = strchr(formula, '!');
+    cells = _split_range_formula(formula, &sheetname);
 
-    if (tmp_str == NULL) {
+    if (!cells) {
         range->ignore_cache = LXLSX_TRUE;
         return;
     }
-    else {
-        /* Check for empty string. */
-        if (lxlsx_str_is_empty(tmp_str)) {
-            range->ignore_cache = LXLSX_TRUE;
-            return;
-        }
-
-        /* Split the formulas into sheetname and row-col data. */
-        *tmp_str = '\0';
-        tmp_str++;
-        sheetname = formula;
-
-        if (lxlsx_str_is_empty(tmp_str) || lxlsx_str_is_empty(sheetname)) {
-            range->ignore_cache = LXLSX_TRUE;
-            return;
-        }
-
-        /* Remove any worksheet quoting. */
-        if (sheetname[0] == '\'')
-            sheetname++;
-        if (strlen(sheetname) > 0 && sheetname[strlen(sheetname) - 1] == '\'') {
-            sheetname[strlen(sheetname) - 1] = '\0';
-        }
-
-        /* Check that the sheetname exists. */
-        if (!lxlsx_workbook_get_worksheet_by_name(self, sheetname)) {
-            LXLSX_WARN_FORMAT2("lxlsx_workbook_add_chart(): worksheet name '%s' "
-                             "in chart formula '%s' doesn't exist.",
-                             sheetname, range->formula);
-            range->ignore_cache = LXLSX_TRUE;
-            return;
-        }
-
-        range->sheetname = lxlsx_strdup(sheetname);
-        range->first_row = lxlsx_name_to_row(tmp_str);
-        range->first_col = lxlsx_name_to_col(tmp_str);
-
-        if (strchr(tmp_str, ':')) {
-            /* 2D range. */
-            range->last_row = lxlsx_name_to_row_2(tmp_str);
-            range->last_col = lxlsx_name_to_col_2(tmp_str);
-        }
-        else {
-            /* 1D range. */
-            range->last_row = range->first_row;
-            range->last_col = range->first_col;
-        }
 
+    /* Check that the sheetname exists. */
+    if (!lxlsx_workbook_get_worksheet_by_name(self, sheetname)) {
+        LXLSX_WARN_FORMAT2("lxlsx_workbook_add_chart(): worksheet name '%s' "
+                         "in chart formula '%s' doesn't exist.",
+                         sheetname, range->formula);
+        range->ignore_cache = LXLSX_TRUE;
+        return;
     }
+
+    _set_range_dimensions(range, sheetname, cells);
 }
 
 /* Set the range dimensions and set the data cache.
@@ -1950,6 +1975,10 @@ lxlsx_workbook_new_opt(const char *filename, lxlsx_workbook_options *options)
     workbook->used_dxf_formats = lxlsx_hash_new(128, 1, 0);
     GOTO_LABEL_ON_MEM_ERROR(workbook->used_dxf_formats, mem_error);
 
+    /* Add a hash table to look up formats by their properties. */
+    workbook->interned_formats = lxlsx_hash_new(128, 1, 0);
+    GOTO_LABEL_ON_MEM_ERROR(workbook->interned_formats, mem_error);
+
     /* Add the worksheets list. */
     workbook->lxlsx_custom_properties =
         calloc(1, sizeof(struct lxlsx_custom_properties));
@@ -1975,6 +2004,8 @@ lxlsx_workbook_new_opt(const char *filename, lxlsx_workbook_options *options)
         workbook->options.use_zip64 = options->use_zip64;
         workbook->options.output_buffer = options->output_buffer;
         workbook->options.output_buffer_size = options->output_buffer_size;
+        workbook->options.constant_memory_window =
+            options->constant_memory_window;
     }
 
     workbook->max_url_length = 2079;
@@ -1991,6 +2022,13 @@ mem_error:
 
 lxlsx_workbook *
 lxlsx_workbook_open(const char *filename)
+{
+    return lxlsx_workbook_open_opt(filename, NULL);
+}
+
+lxlsx_workbook *
+lxlsx_workbook_open_opt(const char *filename,
+                        const lxlsx_edit_open_options *options)
 {
     lxlsx_workbook *workbook;
     lxlsx_edit_session *session;
@@ -2000,7 +2038,7 @@ lxlsx_workbook_open(const char *filename)
     if (!filename)
         return NULL;
 
-    session = lxlsx_edit_open(filename);
+    session = lxlsx_edit_open_opt(filename, options);
     if (!session)
         return NULL;
 
@@ -2088,6 +2126,13 @@ _workbook_flush_added_sheets(lxlsx_workbook *workbook)
 
 lxlsx_error
 lxlsx_workbook_save_as(lxlsx_workbook *workbook, const char *path)
+{
+    return lxlsx_workbook_save_as_opt(workbook, path, NULL);
+}
+
+lxlsx_error
+lxlsx_workbook_save_as_opt(lxlsx_workbook *workbook, const char *path,
+                           const lxlsx_edit_save_options *options)
 {
     lxlsx_error err;
 
@@ -2099,8 +2144,9 @@ lxlsx_workbook_save_as(lxlsx_workbook *workbook, const char *path)
         if (err != LXLSX_NO_ERROR)
             return err;
 
-        return lxlsx_edit_save_as(workbook->edit_session,
-                                  path ? path : workbook->filename);
+        return lxlsx_edit_save_as_opt(workbook->edit_session,
+                                      path ? path : workbook->filename,
+                                      options);
     }
 
     return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
@@ -2123,7 +2169,7 @@ lxlsx_workbook_add_worksheet(lxlsx_workbook *self, const char *sheetname)
     lxlsx_worksheet_name *lxlsx_worksheet_name = NULL;
     lxlsx_error error;
     lxlsx_worksheet_init_data init_data =
-        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
     char *new_name = NULL;
 
     if (sheetname) {
@@ -2163,6 +2209,8 @@ lxlsx_workbook_add_worksheet(lxlsx_workbook *self, const char *sheetname)
      * uses inline strings too. Existing sheets opened for editing are created
      * before is_edit is set (see lxlsx_workbook_open) and stay non-optimized. */
     init_data.optimize = self->options.constant_memory || self->is_edit;
+    init_data.optimize_window =
+        self->options.constant_memory ? self->options.constant_memory_window : 0;
     init_data.active_sheet = &self->active_sheet;
     init_data.first_sheet = &self->first_sheet;
     init_data.tmpdir = self->options.tmpdir;
@@ -2213,7 +2261,7 @@ lxlsx_workbook_add_chartsheet(lxlsx_workbook *self, const char *sheetname)
     lxlsx_chartsheet_name *lxlsx_chartsheet_name = NULL;
     lxlsx_error error;
     lxlsx_worksheet_init_data init_data =
-        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
     char *new_name = NULL;
 
     if (sheetname) {
@@ -2304,12 +2352,59 @@ lxlsx_workbook_add_chart(lxlsx_workbook *self, uint8_t type)
     /* Create a new chart object. */
     chart = lxlsx_chart_new(type);
 
-    if (chart)
+    if (chart) {
+        chart->workbook = self;
         STAILQ_INSERT_TAIL(self->charts, chart, list_pointers);
+    }
 
     return chart;
 }
 
+/*
+ * Start capturing the values of a chart range as the worksheet cells it
+ * refers to are written, so that the chart data cache doesn't have to be read
+ * back from the worksheet at close. Ranges that can't be resolved yet, for
+ * example because the worksheet hasn't been added, are left to be read back
+ * at close as before.
+ */
+lxlsx_error
+lxlsx_workbook_capture_chart_range(lxlsx_workbook *self,
+                                   lxlsx_series_range *range)
+{
+    char formula[LXLSX_MAX_FORMULA_RANGE_LENGTH] = { 0 };
+    lxlsx_worksheet *worksheet;
+    char *sheetname = NULL;
+    char *cells;
+
+    if (!range || range->ignore_cache)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    if (range->sheetname) {
+        worksheet = lxlsx_workbook_get_worksheet_by_name(self,
+                                                         range->sheetname);
+    }
+    else {
+        if (!range->formula)
+            return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+        lxlsx_snprintf(formula, LXLSX_MAX_FORMULA_RANGE_LENGTH, "%s",
+                       range->formula);
+
+        cells = _split_range_formula(formula, &sheetname);
+        if (!cells)
+            return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+        worksheet = lxlsx_workbook_get_worksheet_by_name(self, sheetname);
+        if (worksheet)
+            _set_range_dimensions(range, sheetname, cells);
+    }
+
+    if (!worksheet)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    return lxlsx_worksheet_capture_range(worksheet, range);
+}
+
 /*
  * Add a new format to the Excel workbook.
  */
@@ -2329,6 +2424,51 @@ lxlsx_workbook_add_format(lxlsx_workbook *self)
     return format;
 }
 
+/*
+ * Return the workbook format with the same properties as `format`, adding a
+ * copy of it the first time those properties are seen.
+ */
+lxlsx_format *
+lxlsx_workbook_intern_format(lxlsx_workbook *self, lxlsx_format *format)
+{
+    lxlsx_format *key;
+    lxlsx_format *interned;
+    lxlsx_format bookkeeping;
+    lxlsx_hash_element *hash_element;
+
+    key = lxlsx_format_get_intern_key(format);
+    RETURN_ON_MEM_ERROR(key, NULL);
+
+    hash_element = lxlsx_hash_key_exists(self->interned_formats, key,
+                                         sizeof(lxlsx_format));
+    if (hash_element) {
+        free(key);
+        return hash_element->value;
+    }
+
+    interned = lxlsx_workbook_add_format(self);
+    if (!interned) {
+        free(key);
+        return NULL;
+    }
+
+    /* Take every property from the key but keep the workbook links. */
+    memcpy(&bookkeeping, interned, sizeof(lxlsx_format));
+    memcpy(interned, key, sizeof(lxlsx_format));
+    interned->xf_format_indices = bookkeeping.xf_format_indices;
+    interned->dxf_format_indices = bookkeeping.dxf_format_indices;
+    interned->num_xf_formats = bookkeeping.num_xf_formats;
+    interned->num_dxf_formats = bookkeeping.num_dxf_formats;
+    interned->list_pointers = bookkeeping.list_pointers;
+
+    /* The format is still usable if it can't be remembered. */
+    if (!lxlsx_insert_hash_element(self->interned_formats, key, interned,
+                                   sizeof(lxlsx_format)))
+        free(key);
+
+    return interned;
+}
+
 /*
  * Run workbook finalization and package the xlsx, WITHOUT freeing the workbook.
  * Split out of lxlsx_workbook_close() so callers that own the workbook lifetime
@@ -3499,16 +3639,16 @@ lxlsx_reader_error lxlsx_reader_workbook_open_fd(int fd, lxlsx_reader_workbook *
 
 static lxlsx_reader_error workbook_open_memory_common(const void *data, size_t len,
                                                       int take_copy,
+                                                      const lxlsx_reader_open_options *opts,
                                                       lxlsx_reader_workbook **out)
 {
     lxlsx_reader_workbook *wb;
-    lxlsx_reader_open_options opts = {0};
     lxlsx_reader_error     rc;
 
     if (!data || !out) return LXLSX_READER_ERROR_NULL_PARAMETER;
     wb = (lxlsx_reader_workbook *)calloc(1, sizeof(*wb));
     if (!wb) return LXLSX_READER_ERROR_MEMORY_MALLOC_FAILED;
-    wb->opts = opts;
+    if (opts) wb->opts = *opts;
 
     wb->zip = take_copy
         ? lxlsx_reader_zip_open_memory(data, len)
@@ -3527,18 +3667,52 @@ static lxlsx_reader_error workbook_open_memory_common(const void *data, size_t l
 
 lxlsx_reader_error lxlsx_reader_workbook_open_memory(const void *data, size_t len, lxlsx_reader_workbook **out)
 {
-    return workbook_open_memory_common(data, len, 1, out);
+    return workbook_open_memory_common(data, len, 1, NULL, out);
 }
 
 lxlsx_reader_error lxlsx_reader_workbook_open_memory_borrowed(const void *data, size_t len, lxlsx_reader_workbook **out)
 {
-    return workbook_open_memory_common(data, len, 0, out);
+    return workbook_open_memory_common(data, len, 0, NULL, out);
+}
+
+lxlsx_reader_error lxlsx_reader_workbook_open_memory_borrowed_ex(const void *data, size_t len,
+                                                const lxlsx_reader_open_options *opts,
+                                                lxlsx_reader_workbook **out)
+{
+    return workbook_open_memory_common(data, len, 0, opts, out);
+}
+
+lxlsx_reader_error lxlsx_reader_workbook_open_view(const lxlsx_reader_workbook *base,
+                                          const void *data, size_t len,
+                                          lxlsx_reader_workbook **out)
+{
+    lxlsx_reader_workbook *wb;
+
+    if (!base || !data || !out) return LXLSX_READER_ERROR_NULL_PARAMETER;
+    wb = (lxlsx_reader_workbook *)malloc(sizeof(*wb));
+    if (!wb) return LXLSX_READER_ERROR_MEMORY_MALLOC_FAILED;
+    *wb = *base;
+    wb->base = base;
+
+    /* Only one zip entry can be open per handle, so the view reads through
+     * its own handle on the same bytes. */
+    wb->zip = lxlsx_reader_zip_open_memory_borrowed(data, len);
+    if (!wb->zip) { free(wb); return LXLSX_READER_ERROR_FILE_OPEN_FAILED; }
+
+    *out = wb;
+    return LXLSX_READER_NO_ERROR;
 }
 
 void lxlsx_reader_workbook_close(lxlsx_reader_workbook *wb)
 {
     size_t i;
     if (!wb) return;
+    if (wb->base) {
+        /* A view owns its zip handle only. */
+        lxlsx_reader_zip_close(wb->zip);
+        free(wb);
+        return;
+    }
     for (i = 0; i < wb->sheet_count; i++) {
         free(wb->sheets[i].name);
         free(wb->sheets[i].rel_id);
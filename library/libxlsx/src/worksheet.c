@@ -15,9 +15,11 @@
 #include "libxlsx/xmlwriter.h"
 #include "libxlsx/worksheet.h"
 #include "libxlsx/format.h"
+#include "libxlsx/recalc.h"
 #include "libxlsx/utility.h"
 
 #include <ctype.h>
+#include <math.h>
 
 #ifdef USE_OPENSSL_MD5
 #include <openssl/md5.h>
@@ -40,6 +42,8 @@
  * Forward declarations.
  */
 STATIC void _worksheet_write_rows(lxlsx_worksheet *self);
+STATIC void _worksheet_flush_window(lxlsx_worksheet *self,
+                                    lxlsx_row_t first_kept);
 STATIC int _row_cmp(lxlsx_row *row1, lxlsx_row *row2);
 STATIC int _cell_cmp(lxlsx_cell *cell1, lxlsx_cell *cell2);
 STATIC int _drawing_rel_id_cmp(lxlsx_drawing_rel_id *tuple1,
@@ -97,6 +101,176 @@ lxlsx_worksheet_find_cell_in_row(lxlsx_row *row, lxlsx_col_t col_num)
     return RB_FIND(lxlsx_table_cells, row->cells, &tmp_cell);
 }
 
+/*
+ * Find the first row at or after row_num, to walk the rows of a range in
+ * order with lxlsx_worksheet_next_row() instead of a lookup per row.
+ */
+lxlsx_row *
+lxlsx_worksheet_find_row_from(lxlsx_worksheet *self, lxlsx_row_t row_num)
+{
+    lxlsx_row tmp_row;
+
+    tmp_row.row_num = row_num;
+
+    return RB_NFIND(lxlsx_table_rows, self->table, &tmp_row);
+}
+
+/*
+ * Get the row after row in the worksheet, or NULL.
+ */
+lxlsx_row *
+lxlsx_worksheet_next_row(lxlsx_row *row)
+{
+    return RB_NEXT(lxlsx_table_rows, NULL, row);
+}
+
+/*
+ * Find the first cell at or after col_num in a row.
+ */
+lxlsx_cell *
+lxlsx_worksheet_find_cell_from(lxlsx_row *row, lxlsx_col_t col_num)
+{
+    lxlsx_cell tmp_cell;
+
+    if (!row)
+        return NULL;
+
+    tmp_cell.col_num = col_num;
+
+    return RB_NFIND(lxlsx_table_cells, row->cells, &tmp_cell);
+}
+
+/*
+ * Get the cell after cell in its row, or NULL.
+ */
+lxlsx_cell *
+lxlsx_worksheet_next_cell(lxlsx_cell *cell)
+{
+    return RB_NEXT(lxlsx_table_cells, NULL, cell);
+}
+
+/*
+ * Set a chart data point from a worksheet cell, or mark it as having no data
+ * if there is no cell.
+ */
+void
+lxlsx_worksheet_fill_data_point(lxlsx_series_data_point *data_point,
+                                lxlsx_cell *cell)
+{
+    free(data_point->string);
+    data_point->string = NULL;
+    data_point->number = 0;
+    data_point->is_string = LXLSX_FALSE;
+    data_point->no_data = cell ? LXLSX_FALSE : LXLSX_TRUE;
+
+    if (!cell)
+        return;
+
+    if (cell->type == NUMBER_CELL) {
+        data_point->number = cell->data.writer.value.number;
+    }
+    else if (cell->type == STRING_CELL) {
+        data_point->string =
+            lxlsx_strdup(cell->data.writer.value.shared_string.string);
+        data_point->is_string = LXLSX_TRUE;
+    }
+    else if (cell->type == INLINE_STRING_CELL) {
+        data_point->string = lxlsx_strdup(cell->data.writer.value.string);
+        data_point->is_string = LXLSX_TRUE;
+    }
+}
+
+/*
+ * Start capturing the values of a 1D chart range as its cells are written.
+ * Cells that have already been written are read now. In constant_memory mode
+ * rows that have already been flushed can't be read back, so ranges that
+ * start in them aren't captured.
+ */
+lxlsx_error
+lxlsx_worksheet_capture_range(lxlsx_worksheet *self, lxlsx_series_range *range)
+{
+    lxlsx_series_data_point *captured;
+    lxlsx_series_range **chart_ranges;
+    lxlsx_row_t row_num;
+    lxlsx_col_t col_num;
+    lxlsx_row *row = NULL;
+    uint32_t num_points;
+    uint32_t size;
+    uint32_t i = 0;
+
+    if (range->captured)
+        return LXLSX_NO_ERROR;
+
+    if (range->first_row != range->last_row
+        && range->first_col != range->last_col)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    if (range->last_row < range->first_row
+        || range->last_col < range->first_col)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    if (self->optimize && range->first_row < self->optimize_row->row_num)
+        return LXLSX_ERROR_PARAMETER_VALIDATION;
+
+    if (self->chart_range_count == self->chart_range_size) {
+        size = self->chart_range_size ? self->chart_range_size * 2 : 8;
+        chart_ranges = realloc(self->chart_ranges,
+                               size * sizeof(lxlsx_series_range *));
+        RETURN_ON_MEM_ERROR(chart_ranges, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+
+        self->chart_ranges = chart_ranges;
+        self->chart_range_size = size;
+    }
+
+    num_points = (uint32_t) (range->last_row - range->first_row + 1)
+        * (uint32_t) (range->last_col - range->first_col + 1);
+
+    captured = calloc(num_points, sizeof(lxlsx_series_data_point));
+    RETURN_ON_MEM_ERROR(captured, LXLSX_ERROR_MEMORY_MALLOC_FAILED);
+
+    /* Read any cells in the range that have already been written. */
+    for (row_num = range->first_row; row_num <= range->last_row; row_num++) {
+        if (!self->optimize || self->optimize_window)
+            row = lxlsx_worksheet_find_row(self, row_num);
+
+        for (col_num = range->first_col; col_num <= range->last_col;
+             col_num++) {
+            lxlsx_cell *cell = NULL;
+
+            if (!self->optimize || self->optimize_window)
+                cell = lxlsx_worksheet_find_cell_in_row(row, col_num);
+            else if (row_num == self->optimize_row->row_num)
+                cell = self->array[col_num];
+
+            lxlsx_worksheet_fill_data_point(&captured[i++], cell);
+        }
+    }
+
+    range->captured = captured;
+    range->num_captured = num_points;
+
+    if (self->chart_range_count == 0) {
+        self->chart_first_row = range->first_row;
+        self->chart_last_row = range->last_row;
+        self->chart_first_col = range->first_col;
+        self->chart_last_col = range->last_col;
+    }
+    else {
+        if (range->first_row < self->chart_first_row)
+            self->chart_first_row = range->first_row;
+        if (range->last_row > self->chart_last_row)
+            self->chart_last_row = range->last_row;
+        if (range->first_col < self->chart_first_col)
+            self->chart_first_col = range->first_col;
+        if (range->last_col > self->chart_last_col)
+            self->chart_last_col = range->last_col;
+    }
+
+    self->chart_ranges[self->chart_range_count++] = range;
+
+    return LXLSX_NO_ERROR;
+}
+
 /*
  * Create a new worksheet object.
  */
@@ -302,6 +476,8 @@ lxlsx_worksheet_new(lxlsx_worksheet_init_data *init_data)
         worksheet->hidden = init_data->hidden;
         worksheet->sst = init_data->sst;
         worksheet->optimize = init_data->optimize;
+        if (init_data->optimize && init_data->optimize_window > 1)
+            worksheet->optimize_window = init_data->optimize_window;
         worksheet->active_sheet = init_data->active_sheet;
         worksheet->first_sheet = init_data->first_sheet;
         worksheet->default_url_format = init_data->default_url_format;
@@ -822,6 +998,11 @@ lxlsx_worksheet_free(lxlsx_worksheet *worksheet)
 
     _free_filter_rules(worksheet);
 
+    /* The captured points themselves are owned by the chart ranges. */
+    free(worksheet->chart_ranges);
+
+    lxlsx_recalc_free(worksheet->recalc);
+
     if (worksheet->array) {
         for (col = 0; col < LXLSX_COL_MAX; col++) {
             _free_cell(worksheet->array[col]);
@@ -1170,6 +1351,18 @@ _get_row(lxlsx_worksheet *self, lxlsx_row_t row_num)
         row = _get_row_list(self->table, row_num);
         return row;
     }
+    else if (self->optimize_window) {
+        /* Windowed constant_memory mode: optimize_row->row_num is the lowest
+         * row that is still editable. Moving past the top of the window
+         * flushes the rows that fall out of it. */
+        if (row_num < self->optimize_row->row_num)
+            return NULL;
+
+        if (row_num - self->optimize_row->row_num >= self->optimize_window)
+            _worksheet_flush_window(self, row_num - self->optimize_window + 1);
+
+        return _get_row_list(self->table, row_num);
+    }
     else {
         if (row_num < self->optimize_row->row_num) {
             return NULL;
@@ -1187,6 +1380,40 @@ _get_row(lxlsx_worksheet *self, lxlsx_row_t row_num)
     }
 }
 
+/*
+ * Copy a newly written cell into any chart ranges that capture it.
+ */
+STATIC void
+_capture_chart_cell(lxlsx_worksheet *self, lxlsx_row_t row_num,
+                    lxlsx_col_t col_num, lxlsx_cell *cell)
+{
+    lxlsx_series_range *range;
+    uint32_t index;
+    uint32_t i;
+
+    if (row_num < self->chart_first_row || row_num > self->chart_last_row
+        || col_num < self->chart_first_col || col_num > self->chart_last_col)
+        return;
+
+    for (i = 0; i < self->chart_range_count; i++) {
+        range = self->chart_ranges[i];
+
+        /* The range was redefined after it started capturing. */
+        if (!range->captured)
+            continue;
+
+        if (row_num < range->first_row || row_num > range->last_row
+            || col_num < range->first_col || col_num > range->last_col)
+            continue;
+
+        index = (row_num - range->first_row)
+            * (uint32_t) (range->last_col - range->first_col + 1)
+            + (col_num - range->first_col);
+
+        lxlsx_worksheet_fill_data_point(&range->captured[index], cell);
+    }
+}
+
 /*
  * Insert a cell object in the cell list of a row object.
  */
@@ -1222,21 +1449,35 @@ _insert_cell(lxlsx_worksheet *self, lxlsx_row_t row_num, lxlsx_col_t col_num,
 {
     lxlsx_row *row = _get_row(self, row_num);
 
-    if (!self->optimize) {
+    if (!self->optimize || self->optimize_window) {
+        if (!row) {
+            _free_cell(cell);
+            return;
+        }
+
         row->data_changed = LXLSX_TRUE;
         _insert_cell_list(row->cells, cell, col_num);
     }
     else {
-        if (row) {
-            row->data_changed = LXLSX_TRUE;
+        if (!row) {
+            _free_cell(cell);
+            return;
+        }
 
-            /* Overwrite an existing cell if necessary. */
-            if (self->array[col_num])
-                _free_cell(self->array[col_num]);
+        row->data_changed = LXLSX_TRUE;
 
-            self->array[col_num] = cell;
-        }
+        /* Overwrite an existing cell if necessary. */
+        if (self->array[col_num])
+            _free_cell(self->array[col_num]);
+
+        self->array[col_num] = cell;
     }
+
+    if (self->chart_range_count)
+        _capture_chart_cell(self, row_num, col_num, cell);
+
+    if (self->recalc)
+        lxlsx_recalc_cell_written(self->recalc, row_num, col_num, cell);
 }
 
 /*
@@ -1264,6 +1505,9 @@ _insert_cell_placeholder(lxlsx_worksheet *self, lxlsx_row_t row_num,
     row = _get_row(self, row_num);
     if (!RB_FIND(lxlsx_table_cells, row->cells, cell)) {
         _insert_cell_list(row->cells, cell, col_num);
+
+        if (self->chart_range_count)
+            _capture_chart_cell(self, row_num, col_num, cell);
     }
     else {
         _free_cell(cell);
@@ -4496,6 +4740,17 @@ _obuf_write(lxlsx_worksheet *self, const char *s, size_t n)
     self->obuf_len += n;
 }
 
+/* Hand a finished cell fragment to the stream buffer in constant_memory mode,
+ * or straight to the sheet file otherwise. */
+static inline void
+_cell_write(lxlsx_worksheet *self, const char *s, size_t n)
+{
+    if (self->optimize)
+        _obuf_write(self, s, n);
+    else
+        (void) fwrite(s, 1, n, self->file);
+}
+
 /* Write an unsigned 32-bit value as decimal at `p`, return the digit count. */
 static inline int
 _u32_dec(char *p, uint32_t v)
@@ -4602,68 +4857,43 @@ STATIC void
 _write_number_cell(lxlsx_worksheet *self, char *range,
                    int32_t style_index, lxlsx_cell *cell)
 {
-    /* constant_memory fast path: assemble straight into the stream buffer. */
-    if (self->optimize) {
-        char buf[64 + LXLSX_ATTR_32];
-        double value = cell->data.writer.value.number;
-        int n = _cell_ref_prefix(buf, cell->row_num, cell->col_num,
-                                 style_index);
-        buf[n++] = '>';
-        buf[n++] = '<';
-        buf[n++] = 'v';
-        buf[n++] = '>';
-
-        /* Integer fast path: most bulk numeric data is integral, and the
-         * general double formatter (emyg_dtoa) dominates the write profile.
-         * An integral value in safe int64 range formats byte-identically via
-         * a plain itoa, skipping the float algorithm entirely. The bound stays
-         * inside INT64_MAX/MIN so the cast and negation below are well-defined. */
-        if (value >= -9.2e18 && value <= 9.2e18
-            && value == (double) (int64_t) value) {
-            n += _i64_dec(buf + n, (int64_t) value);
-        }
-        else {
-            char num[LXLSX_ATTR_32];
-#ifdef USE_DTOA_LIBRARY
-            lxlsx_sprintf_dbl(num, value);
-#else
-            lxlsx_snprintf(num, LXLSX_ATTR_32, "%.16G", value);
-#endif
-            {
-                size_t len = strlen(num);
-                memcpy(buf + n, num, len);
-                n += (int) len;
-            }
-        }
+    char buf[64 + LXLSX_ATTR_32];
+    double value = cell->data.writer.value.number;
+    int n = _cell_ref_prefix(buf, cell->row_num, cell->col_num, style_index);
 
-        memcpy(buf + n, "</v></c>", 8);
-        n += 8;
-        _obuf_write(self, buf, (size_t) n);
-        return;
-    }
+    (void) range;
 
-#ifdef USE_DTOA_LIBRARY
-    char data[LXLSX_ATTR_32];
-
-    lxlsx_sprintf_dbl(data, cell->data.writer.value.number);
+    buf[n++] = '>';
+    buf[n++] = '<';
+    buf[n++] = 'v';
+    buf[n++] = '>';
 
-    if (style_index)
-        fprintf(self->file,
-                "<c r=\"%s\" s=\"%d\"><v>%s</v></c>",
-                range, style_index, data);
-    else
-        fprintf(self->file, "<c r=\"%s\"><v>%s</v></c>", range, data);
+    /* Integer fast path: most bulk numeric data is integral, and the general
+     * double formatter dominates the write profile. Below 1e16 both
+     * lxlsx_dtoa and "%.16G" print an integral value as plain digits, so a
+     * plain itoa is byte-identical; larger values switch to exponent form
+     * and take the general formatter, as does -0. */
+    if (value > -1e16 && value < 1e16 && value == (double) (int64_t) value
+        && (value != 0 || !signbit(value))) {
+        n += _i64_dec(buf + n, (int64_t) value);
+    }
+    else {
+#ifdef USE_DTOA_LIBRARY
+        n += (int) lxlsx_dtoa(value, buf + n);
 #else
-    if (style_index)
-        fprintf(self->file,
-                "<c r=\"%s\" s=\"%d\"><v>%.16G</v></c>",
-                range, style_index, cell->data.writer.value.number);
-    else
-        fprintf(self->file,
-                "<c r=\"%s\"><v>%.16G</v></c>", range,
-                cell->data.writer.value.number);
+        char num[LXLSX_ATTR_32];
+        size_t len;
 
+        lxlsx_snprintf(num, LXLSX_ATTR_32, "%.16G", value);
+        len = strlen(num);
+        memcpy(buf + n, num, len);
+        n += (int) len;
 #endif
+    }
+
+    memcpy(buf + n, "</v></c>", 8);
+    n += 8;
+    _cell_write(self, buf, (size_t) n);
 }
 
 /*
@@ -4674,29 +4904,17 @@ STATIC void
 _write_string_cell(lxlsx_worksheet *self, char *range,
                    int32_t style_index, lxlsx_cell *cell)
 {
-    /* constant_memory fast path. */
-    if (self->optimize) {
-        char buf[80];
-        int n = _cell_ref_prefix(buf, cell->row_num, cell->col_num,
-                                 style_index);
-        memcpy(buf + n, " t=\"s\"><v>", 10);
-        n += 10;
-        n += _u32_dec(buf + n, (uint32_t) cell->data.writer.value.shared_string.id);
-        memcpy(buf + n, "</v></c>", 8);
-        n += 8;
-        _obuf_write(self, buf, (size_t) n);
-        return;
-    }
+    char buf[80];
+    int n = _cell_ref_prefix(buf, cell->row_num, cell->col_num, style_index);
 
-    if (style_index)
-        fprintf(self->file,
-                "<c r=\"%s\" s=\"%d\" t=\"s\"><v>%d</v></c>",
-                range, style_index,
-                cell->data.writer.value.shared_string.id);
-    else
-        fprintf(self->file,
-                "<c r=\"%s\" t=\"s\"><v>%d</v></c>",
-                range, cell->data.writer.value.shared_string.id);
+    (void) range;
+
+    memcpy(buf + n, " t=\"s\"><v>", 10);
+    n += 10;
+    n += _u32_dec(buf + n, (uint32_t) cell->data.writer.value.shared_string.id);
+    memcpy(buf + n, "</v></c>", 8);
+    n += 8;
+    _cell_write(self, buf, (size_t) n);
 }
 
 /*
@@ -4707,59 +4925,46 @@ STATIC void
 _write_inline_string_cell(lxlsx_worksheet *self, char *range,
                           int32_t style_index, lxlsx_cell *cell)
 {
-    char *string = lxlsx_escape_data(cell->data.writer.value.string);
-    size_t slen = strlen(string);
+    const char *value = cell->data.writer.value.string;
+    size_t slen = strlen(value);
+    char *string = NULL;
+    char buf[96];
+    int preserve;
+    int n;
 
-    /* constant_memory fast path. The escaped string may exceed the buffer, so
-     * it is appended through _obuf_write which streams oversized fragments. */
-    if (self->optimize) {
-        char buf[96];
-        int preserve = slen
-            && (isspace((unsigned char) string[0])
-                || isspace((unsigned char) string[slen - 1]));
-        int n = _cell_ref_prefix(buf, cell->row_num, cell->col_num,
-                                 style_index);
-        if (preserve) {
-            memcpy(buf + n, " t=\"inlineStr\"><is><t xml:space=\"preserve\">", 43);
-            n += 43;
-        }
-        else {
-            memcpy(buf + n, " t=\"inlineStr\"><is><t>", 22);
-            n += 22;
-        }
-        _obuf_write(self, buf, (size_t) n);
-        _obuf_write(self, string, slen);
-        _obuf_write(self, "</t></is></c>", 13);
-        free(string);
-        return;
+    (void) range;
+
+    /* Most strings have nothing to escape and are written as is, without
+     * an escaped copy. */
+    if (lxlsx_xml_escape_scan(value, slen) != slen) {
+        string = lxlsx_escape_data(value);
+        if (!string)
+            return;
+
+        value = string;
+        slen = strlen(string);
     }
 
-    /* Add attribute to preserve leading or trailing whitespace. */
-    if (isspace((unsigned char) string[0])
-        || isspace((unsigned char) string[slen - 1])) {
+    preserve = slen
+        && (isspace((unsigned char) value[0])
+            || isspace((unsigned char) value[slen - 1]));
+    n = _cell_ref_prefix(buf, cell->row_num, cell->col_num, style_index);
 
-        if (style_index)
-            fprintf(self->file,
-                    "<c r=\"%s\" s=\"%d\" t=\"inlineStr\"><is>"
-                    "<t xml:space=\"preserve\">%s</t></is></c>",
-                    range, style_index, string);
-        else
-            fprintf(self->file,
-                    "<c r=\"%s\" t=\"inlineStr\"><is>"
-                    "<t xml:space=\"preserve\">%s</t></is></c>",
-                    range, string);
+    /* Add attribute to preserve leading or trailing whitespace. The escaped
+     * string may exceed the buffer, so it is written as its own fragment. */
+    if (preserve) {
+        memcpy(buf + n, " t=\"inlineStr\"><is><t xml:space=\"preserve\">", 43);
+        n += 43;
     }
     else {
-        if (style_index)
-            fprintf(self->file,
-                    "<c r=\"%s\" s=\"%d\" t=\"inlineStr\">"
-                    "<is><t>%s</t></is></c>", range, style_index, string);
-        else
-            fprintf(self->file,
-                    "<c r=\"%s\" t=\"inlineStr\">"
-                    "<is><t>%s</t></is></c>", range, string);
+        memcpy(buf + n, " t=\"inlineStr\"><is><t>", 22);
+        n += 22;
     }
 
+    _cell_write(self, buf, (size_t) n);
+    _cell_write(self, value, slen);
+    _cell_write(self, "</t></is></c>", 13);
+
     free(string);
 }
 
@@ -4783,6 +4988,41 @@ _write_inline_rich_string_cell(lxlsx_worksheet *self, char *range,
                 "<is>%s</is></c>", range, string);
 }
 
+/*
+ * Write out the <f> element of a formula cell, as a plain or shared formula.
+ */
+STATIC void
+_write_formula_element(lxlsx_worksheet *self, lxlsx_cell *cell)
+{
+    const lxlsx_cell_writer_formula *formula =
+        cell->data.writer.value.formula;
+    struct lxlsx_xml_attribute_list attributes;
+    struct lxlsx_xml_attribute *attribute;
+    char range[LXLSX_MAX_CELL_RANGE_LENGTH];
+
+    if (formula->shared == LXLSX_SHARED_FORMULA_NONE) {
+        lxlsx_xml_data_element(self->file, "f", formula->formula, NULL);
+        return;
+    }
+
+    LXLSX_INIT_ATTRIBUTES();
+    LXLSX_PUSH_ATTRIBUTES_STR("t", "shared");
+
+    if (formula->shared == LXLSX_SHARED_FORMULA_ANCHOR) {
+        lxlsx_rowcol_to_range(range, cell->row_num, cell->col_num,
+                              formula->shared_last_row, cell->col_num);
+        LXLSX_PUSH_ATTRIBUTES_STR("ref", range);
+        LXLSX_PUSH_ATTRIBUTES_INT("si", formula->shared_si);
+        lxlsx_xml_data_element(self->file, "f", formula->formula, &attributes);
+    }
+    else {
+        LXLSX_PUSH_ATTRIBUTES_INT("si", formula->shared_si);
+        lxlsx_xml_empty_tag(self->file, "f", &attributes);
+    }
+
+    LXLSX_FREE_ATTRIBUTES();
+}
+
 /*
  * Write out a formula worksheet cell with a numeric result.
  */
@@ -4794,7 +5034,7 @@ _write_formula_num_cell(lxlsx_worksheet *self, lxlsx_cell *cell)
     char data[LXLSX_ATTR_32];
 
     lxlsx_sprintf_dbl(data, formula->result);
-    lxlsx_xml_data_element(self->file, "f", formula->formula, NULL);
+    _write_formula_element(self, cell);
     lxlsx_xml_data_element(self->file, "v", data, NULL);
 }
 
@@ -4807,7 +5047,7 @@ _write_formula_str_cell(lxlsx_worksheet *self, lxlsx_cell *cell)
     const lxlsx_cell_writer_formula *formula =
         cell->data.writer.value.formula;
 
-    lxlsx_xml_data_element(self->file, "f", formula->formula, NULL);
+    _write_formula_element(self, cell);
     lxlsx_xml_data_element(self->file, "v", formula->result_string, NULL);
 }
 
@@ -4917,12 +5157,6 @@ _write_cell(lxlsx_worksheet *self, lxlsx_cell *cell, lxlsx_format *row_format)
     lxlsx_col_t col_num = cell->col_num;
     int32_t style_index = 0;
 
-    /* In constant_memory mode the hot cell writers below build their own cell
-     * reference from row/col, so skip the snprintf-backed range conversion
-     * here; cold cell types recompute it after flushing the stream buffer. */
-    if (!self->optimize)
-        lxlsx_rowcol_to_cell(range, row_num, col_num);
-
     if (cell->data.writer.format) {
         style_index = lxlsx_format_get_xf_index(cell->data.writer.format);
     }
@@ -4950,13 +5184,13 @@ _write_cell(lxlsx_worksheet *self, lxlsx_cell *cell, lxlsx_format *row_format)
     }
 
     /* Remaining cell types are rare in bulk writes and still use the fprintf /
-     * lxlsx_xml path writing directly to self->file. In constant_memory mode,
-     * flush the stream buffer (to preserve ordering) and materialise the cell
-     * reference that the hot path skipped. */
-    if (self->optimize) {
+     * lxlsx_xml path writing directly to self->file. The hot writers above
+     * build their own cell reference, so the range is only materialised here,
+     * after flushing the constant_memory stream buffer to preserve ordering. */
+    if (self->optimize)
         _obuf_flush(self);
-        lxlsx_rowcol_to_cell(range, row_num, col_num);
-    }
+
+    lxlsx_rowcol_to_cell(range, row_num, col_num);
 
     if (cell->type == INLINE_RICH_STRING_CELL) {
         _write_inline_rich_string_cell(self, range, style_index, cell);
@@ -5016,6 +5250,248 @@ _write_cell(lxlsx_worksheet *self, lxlsx_cell *cell, lxlsx_format *row_format)
     LXLSX_FREE_ATTRIBUTES();
 }
 
+/*
+ * Characters that can continue a function, defined name or cell reference.
+ */
+STATIC int
+_formula_is_name_char(char c)
+{
+    return isalnum((unsigned char) c) || c == '_' || c == '.' || c == '\\';
+}
+
+/*
+ * Parse an A1 style cell reference such as "B2" or "$B$2" at the start of a
+ * formula token. Returns the length of the reference or 0 if the token isn't
+ * a cell reference, for example a function name like "LOG10(" or a name.
+ */
+STATIC size_t
+_formula_parse_cell_ref(const char *formula, lxlsx_row_t *row_num,
+                        uint8_t *row_absolute)
+{
+    const char *p = formula;
+    uint32_t col_num = 0;
+    uint32_t row = 0;
+    int letters = 0;
+    int digits = 0;
+
+    if (*p == '$')
+        p++;
+
+    while (isalpha((unsigned char) *p) && letters < 4) {
+        col_num = col_num * 26 + (toupper((unsigned char) *p) - 'A' + 1);
+        letters++;
+        p++;
+    }
+
+    if (letters == 0 || letters > 3 || col_num > LXLSX_COL_MAX)
+        return 0;
+
+    *row_absolute = (*p == '$');
+    if (*p == '$')
+        p++;
+
+    while (isdigit((unsigned char) *p) && digits < 8) {
+        row = row * 10 + (*p - '0');
+        digits++;
+        p++;
+    }
+
+    if (digits == 0 || digits > 7 || row == 0 || row > LXLSX_ROW_MAX)
+        return 0;
+
+    if (_formula_is_name_char(*p) || *p == '(' || *p == '!' || *p == '$')
+        return 0;
+
+    *row_num = row;
+    return (size_t) (p - formula);
+}
+
+/*
+ * Check if the formula "below" is the formula "above" copied down one row,
+ * i.e. the same text apart from relative row numbers, which are one higher.
+ * Absolute rows, literals, sheet names and structured references must match
+ * exactly. Formulas with whole row references like "1:3" are rejected since
+ * they can't be checked without a full parser.
+ */
+STATIC uint8_t
+_formula_is_row_shift(const char *above, const char *below)
+{
+    const char *a = above;
+    const char *b = below;
+    uint8_t last_was_ref = LXLSX_FALSE;
+    int bracket_depth = 0;
+    char quote = 0;
+
+    while (*a && *b) {
+        size_t a_len;
+        size_t b_len;
+        lxlsx_row_t a_row;
+        lxlsx_row_t b_row;
+        uint8_t a_absolute;
+        uint8_t b_absolute;
+
+        /* String literals, quoted sheet names and [...] are compared as is. */
+        if (quote || bracket_depth) {
+            if (*a != *b)
+                return LXLSX_FALSE;
+
+            if (quote && *a == quote) {
+                if (a[1] == quote && b[1] == quote) {
+                    a++;
+                    b++;
+                }
+                else {
+                    quote = 0;
+                }
+            }
+            else if (!quote && *a == '[') {
+                bracket_depth++;
+            }
+            else if (!quote && *a == ']') {
+                bracket_depth--;
+            }
+
+            a++;
+            b++;
+            continue;
+        }
+
+        if (a == above || !_formula_is_name_char(a[-1])) {
+            a_len = _formula_parse_cell_ref(a, &a_row, &a_absolute);
+            b_len = _formula_parse_cell_ref(b, &b_row, &b_absolute);
+
+            if (a_len || b_len) {
+                if (!a_len || !b_len || a_absolute != b_absolute)
+                    return LXLSX_FALSE;
+
+                /* The column part, up to the row number, must be identical. */
+                while (isdigit((unsigned char) a[a_len - 1]))
+                    a_len--;
+                while (isdigit((unsigned char) b[b_len - 1]))
+                    b_len--;
+
+                if (a_len != b_len || memcmp(a, b, a_len) != 0)
+                    return LXLSX_FALSE;
+
+                if (a_absolute ? b_row != a_row : b_row != a_row + 1)
+                    return LXLSX_FALSE;
+
+                while (isdigit((unsigned char) a[a_len]))
+                    a_len++;
+                while (isdigit((unsigned char) b[b_len]))
+                    b_len++;
+
+                a += a_len;
+                b += b_len;
+                last_was_ref = LXLSX_TRUE;
+                continue;
+            }
+        }
+
+        if (*a != *b)
+            return LXLSX_FALSE;
+
+        /* Reject row ranges such as "1:3" or "$2:$2". */
+        if (*a == ':') {
+            if (!last_was_ref && a > above && isdigit((unsigned char) a[-1]))
+                return LXLSX_FALSE;
+
+            if (isdigit((unsigned char) a[1])
+                || (a[1] == '$' && isdigit((unsigned char) a[2])))
+                return LXLSX_FALSE;
+        }
+
+        if (*a == '"' || *a == '\'')
+            quote = *a;
+        else if (*a == '[')
+            bracket_depth++;
+
+        last_was_ref = LXLSX_FALSE;
+        a++;
+        b++;
+    }
+
+    return *a == '\0' && *b == '\0';
+}
+
+/*
+ * Group runs of formulas in a column where each formula is the one above it
+ * copied down a row, so that they can be written as a shared formula: the
+ * first cell (the anchor) carries the formula text and the range and the
+ * other cells only refer to it by its shared index.
+ *
+ * This is only done when the full worksheet data is in memory. In
+ * constant_memory mode the anchor is written before its followers are known.
+ */
+STATIC void
+_worksheet_prepare_shared_formulas(lxlsx_worksheet *self)
+{
+    struct shared_formula_column {
+        lxlsx_cell *previous;
+        lxlsx_cell *anchor;
+    } *columns = NULL;
+    lxlsx_row *row;
+    lxlsx_cell *cell;
+    uint32_t next_si = 0;
+
+    RB_FOREACH(row, lxlsx_table_rows, self->table) {
+        if (!row->data_changed)
+            continue;
+
+        RB_FOREACH(cell, lxlsx_table_cells, row->cells) {
+            lxlsx_cell_writer_formula *formula;
+            lxlsx_cell_writer_formula *anchor;
+            struct shared_formula_column *column;
+
+            if (cell->col_num > self->dim_colmax)
+                continue;
+
+            if (cell->type != FORMULA_CELL) {
+                if (columns)
+                    columns[cell->col_num].previous = NULL;
+                continue;
+            }
+
+            if (!columns) {
+                columns = calloc((size_t) self->dim_colmax + 1,
+                                 sizeof(struct shared_formula_column));
+                if (!columns)
+                    return;
+            }
+
+            column = &columns[cell->col_num];
+            formula = cell->data.writer.value.formula;
+            formula->shared = LXLSX_SHARED_FORMULA_NONE;
+
+            if (column->previous
+                && column->previous->row_num + 1 == cell->row_num
+                && formula->formula
+                && _formula_is_row_shift(column->previous->data.writer.value.
+                                         formula->formula,
+                                         formula->formula)) {
+
+                anchor = column->anchor->data.writer.value.formula;
+
+                if (anchor->shared == LXLSX_SHARED_FORMULA_NONE) {
+                    anchor->shared = LXLSX_SHARED_FORMULA_ANCHOR;
+                    anchor->shared_si = next_si++;
+                }
+
+                anchor->shared_last_row = cell->row_num;
+                formula->shared = LXLSX_SHARED_FORMULA_FOLLOWER;
+                formula->shared_si = anchor->shared_si;
+            }
+            else {
+                column->anchor = cell;
+            }
+
+            column->previous = cell;
+        }
+    }
+
+    free(columns);
+}
+
 /*
  * Write out the worksheet data as a series of rows and cells.
  */
@@ -5027,6 +5503,8 @@ _worksheet_write_rows(lxlsx_worksheet *self)
     int32_t block_num = -1;
     char spans[LXLSX_MAX_CELL_RANGE_LENGTH] = { 0 };
 
+    _worksheet_prepare_shared_formulas(self);
+
     RB_FOREACH(row, lxlsx_table_rows, self->table) {
 
         if (RB_EMPTY(row->cells)) {
@@ -5056,6 +5534,83 @@ _worksheet_write_rows(lxlsx_worksheet *self)
     }
 }
 
+/*
+ * Write the opening <row> tag of a constant_memory row that has cell data.
+ * Emit it straight into the stream buffer for the common plain-row case;
+ * fall back to the attribute builder (after flushing) when the row carries
+ * formatting.
+ */
+STATIC void
+_write_optimized_row_start(lxlsx_worksheet *self, lxlsx_row *row)
+{
+    int plain = !row->format && !row->height_changed && !row->hidden
+        && !row->level && !row->collapsed && self->excel_version != 2010;
+
+    if (plain) {
+        char rb[24];
+        int n = 0;
+        rb[n++] = '<';
+        rb[n++] = 'r';
+        rb[n++] = 'o';
+        rb[n++] = 'w';
+        rb[n++] = ' ';
+        rb[n++] = 'r';
+        rb[n++] = '=';
+        rb[n++] = '"';
+        n += _u32_dec(rb + n, (uint32_t) (row->row_num + 1));
+        rb[n++] = '"';
+        rb[n++] = '>';
+        _obuf_write(self, rb, (size_t) n);
+    }
+    else {
+        _obuf_flush(self);
+        _write_row(self, row, NULL);
+    }
+}
+
+/*
+ * Flush the rows below first_kept from the row window of a windowed
+ * constant_memory worksheet, in row order, and free them. Rows at or above
+ * first_kept stay in the RB tree and remain editable.
+ */
+STATIC void
+_worksheet_flush_window(lxlsx_worksheet *self, lxlsx_row_t first_kept)
+{
+    lxlsx_row *row;
+    lxlsx_cell *cell;
+
+    while ((row = RB_MIN(lxlsx_table_rows, self->table)) != NULL
+           && row->row_num < first_kept) {
+
+        if (!row->data_changed) {
+            /* Row data only. No cells. */
+            if (row->row_changed) {
+                _obuf_flush(self);
+                _write_row(self, row, NULL);
+            }
+        }
+        else {
+            _write_optimized_row_start(self, row);
+
+            RB_FOREACH(cell, lxlsx_table_cells, row->cells) {
+                _write_cell(self, cell, row->format);
+            }
+
+            _obuf_write(self, "</row>", 6);
+        }
+
+        RB_REMOVE(lxlsx_table_rows, self->table, row);
+        if (self->table->cached_row == row) {
+            self->table->cached_row = NULL;
+            self->table->cached_row_num = LXLSX_ROW_MAX + 1;
+        }
+        _free_row(row);
+    }
+
+    if (first_kept > self->optimize_row->row_num)
+        self->optimize_row->row_num = first_kept;
+}
+
 /*
  * Write out the worksheet data as a single row with cells. This method is
  * used when memory optimization is on. A single row is written and the data
@@ -5068,6 +5623,14 @@ lxlsx_worksheet_write_single_row(lxlsx_worksheet *self)
     lxlsx_row *row = self->optimize_row;
     lxlsx_col_t col;
 
+    /* In windowed mode every row still held in the window is written. */
+    if (self->optimize_window) {
+        row = RB_MAX(lxlsx_table_rows, self->table);
+        if (row)
+            _worksheet_flush_window(self, row->row_num + 1);
+        return;
+    }
+
     /* skip row if it doesn't contain row formatting, cell data or a comment. */
     if (!(row->row_changed || row->data_changed))
         return;
@@ -5080,32 +5643,7 @@ lxlsx_worksheet_write_single_row(lxlsx_worksheet *self)
         _write_row(self, row, NULL);
     }
     else {
-        /* Row and cell data. Emit the row opener straight into the stream
-         * buffer for the common plain-row case; fall back to the attribute
-         * builder (after flushing) when the row carries formatting. */
-        int plain = !row->format && !row->height_changed && !row->hidden
-            && !row->level && !row->collapsed && self->excel_version != 2010;
-
-        if (plain) {
-            char rb[24];
-            int n = 0;
-            rb[n++] = '<';
-            rb[n++] = 'r';
-            rb[n++] = 'o';
-            rb[n++] = 'w';
-            rb[n++] = ' ';
-            rb[n++] = 'r';
-            rb[n++] = '=';
-            rb[n++] = '"';
-            n += _u32_dec(rb + n, (uint32_t) (row->row_num + 1));
-            rb[n++] = '"';
-            rb[n++] = '>';
-            _obuf_write(self, rb, (size_t) n);
-        }
-        else {
-            _obuf_flush(self);
-            _write_row(self, row, NULL);
-        }
+        _write_optimized_row_start(self, row);
 
         for (col = self->dim_colmin; col <= self->dim_colmax; col++) {
             if (self->array[col]) {
@@ -9569,6 +10107,21 @@ lxlsx_worksheet_set_row_opt(lxlsx_worksheet *self,
     return LXLSX_NO_ERROR;
 }
 
+/*
+ * Start appending rows below the existing data of an opened worksheet.
+ */
+lxlsx_error
+lxlsx_worksheet_append_rows(lxlsx_worksheet *self,
+                            const lxlsx_edit_append_options *options,
+                            lxlsx_row_t *first_row)
+{
+    if (!_worksheet_is_edit(self))
+        return LXLSX_ERROR_FEATURE_NOT_SUPPORTED;
+
+    return lxlsx_edit_append_begin(self->edit_session, self->edit_sheet_name,
+                                   options, first_row);
+}
+
 /*
  * Set the properties of a row.
  */
@@ -14,6 +14,19 @@
 #include <ctype.h>
 #include "libxlsx/xmlwriter.h"
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LXLSX_SCAN_SSE2
+#if defined(__GNUC__) || defined(__clang__)
+#include <immintrin.h>
+#define LXLSX_SCAN_AVX2
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #define LXLSX_AMP  "&amp;"
 #define LXLSX_LT   "&lt;"
 #define LXLSX_GT   "&gt;"
@@ -21,9 +34,10 @@
 #define LXLSX_NL   "&#xA;"
 
 /* Defines. */
-#define LXLSX_MAX_ENCODED_ATTRIBUTE_LENGTH (LXLSX_MAX_ATTRIBUTE_LENGTH*6)
 #define LXLSX_XML_FILE_WRITE_BUFFER_SIZE 8192
 
+/* Tag output is assembled in a stack buffer and handed to stdio with one
+ * fwrite() per buffer instead of one fprintf() per token. */
 typedef struct {
     FILE *file;
     char buffer[LXLSX_XML_FILE_WRITE_BUFFER_SIZE];
@@ -32,18 +46,317 @@ typedef struct {
 } lxlsx_xml_file_write_buffer;
 
 /* Forward declarations. */
-STATIC char *_escape_attributes(struct lxlsx_xml_attribute *attribute);
-
 char *lxlsx_escape_data(const char *data);
 
-STATIC void _fprint_escaped_attributes(FILE *xmlfile,
-                                       struct lxlsx_xml_attribute_list *attributes);
+STATIC int _file_write_buffer_flush(lxlsx_xml_file_write_buffer *buffer);
 
-STATIC void _fprint_escaped_data(FILE *xmlfile, const char *data);
+STATIC void _buffer_write(lxlsx_xml_file_write_buffer *buffer,
+                          const char *data, size_t len);
 
-STATIC int _file_write_buffer_flush(lxlsx_xml_file_write_buffer *buffer);
+STATIC void _buffer_write_attributes(lxlsx_xml_file_write_buffer *buffer,
+                                     struct lxlsx_xml_attribute_list *attributes,
+                                     uint8_t escape);
+
+STATIC void _buffer_write_escaped_data(lxlsx_xml_file_write_buffer *buffer,
+                                       const char *data);
+
+#define _BUFFER_INIT(buf, xmlfile)                             \
+    do {                                                       \
+        (buf).file = (xmlfile);                                \
+        (buf).len = 0;                                         \
+        (buf).error = 0;                                       \
+    } while (0)
+
+#define _BUFFER_PUTC(buf, c)                                   \
+    do {                                                       \
+        if ((buf)->len == sizeof((buf)->buffer))               \
+            _file_write_buffer_flush(buf);                     \
+        (buf)->buffer[(buf)->len++] = (c);                     \
+    } while (0)
+
+#define _BUFFER_LITERAL(buf, literal)                          \
+    _buffer_write((buf), (literal), sizeof(literal) - 1)
+
+/*****************************************************************************
+ *
+ * Byte scan kernels.
+ *
+ * The string writers only need to know where the first byte that has to be
+ * escaped is; in the common case there is none and the string is written as
+ * is. The kernels below find that byte 16 (SSE2) or 32 (AVX2) bytes at a
+ * time. The variant is picked once through cpuid by lxlsx_scan_init(), with
+ * a scalar fallback on other targets.
+ *
+ ****************************************************************************/
+
+typedef size_t (*lxlsx_scan_fn)(const char *data, size_t len);
+
+/* Bytes flagged by lxlsx_has_control_characters(): < 0x20 except \t, \n. */
+#define _IS_CONTROL(c) ((unsigned char) (c) < 0x20 && (c) != '\t' && (c) != '\n')
+
+#define _IS_ESCAPE(c) ((c) == '&' || (c) == '<' || (c) == '>')
+
+STATIC size_t
+_escape_scan_scalar(const char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (_IS_ESCAPE(data[i]))
+            return i;
+    }
+
+    return len;
+}
+
+STATIC size_t
+_control_scan_scalar(const char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (_IS_CONTROL(data[i]))
+            return i;
+    }
+
+    return len;
+}
+
+STATIC size_t
+_non_ascii_scan_scalar(const char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if ((unsigned char) data[i] & 0x80)
+            return i;
+    }
+
+    return len;
+}
+
+#ifdef LXLSX_SCAN_SSE2
+static inline int
+_first_bit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int) index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+STATIC size_t
+_escape_scan_sse2(const char *data, size_t len)
+{
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp),
+                                                _mm_cmpeq_epi8(v, lt)),
+                                   _mm_cmpeq_epi8(v, gt));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(hit);
+
+        if (mask)
+            return i + _first_bit(mask);
+    }
+
+    return i + _escape_scan_scalar(data + i, len - i);
+}
+
+STATIC size_t
+_control_scan_sse2(const char *data, size_t len)
+{
+    const __m128i max = _mm_set1_epi8(0x1F);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, max), v);
+        __m128i allowed = _mm_or_si128(_mm_cmpeq_epi8(v, tab),
+                                       _mm_cmpeq_epi8(v, nl));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_andnot_si128(allowed, low));
+
+        if (mask)
+            return i + _first_bit(mask);
+    }
+
+    return i + _control_scan_scalar(data + i, len - i);
+}
+
+STATIC size_t
+_non_ascii_scan_sse2(const char *data, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(v);
+
+        if (mask)
+            return i + _first_bit(mask);
+    }
+
+    return i + _non_ascii_scan_scalar(data + i, len - i);
+}
+#endif
+
+#ifdef LXLSX_SCAN_AVX2
+__attribute__((target("avx2"))) STATIC size_t
+_escape_scan_avx2(const char *data, size_t len)
+{
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, amp),
+                                                      _mm256_cmpeq_epi8(v, lt)),
+                                      _mm256_cmpeq_epi8(v, gt));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(hit);
+
+        if (mask)
+            return i + _first_bit(mask);
+    }
+
+    return i + _escape_scan_sse2(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) STATIC size_t
+_control_scan_avx2(const char *data, size_t len)
+{
+    const __m256i max = _mm256_set1_epi8(0x1F);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max), v);
+        __m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+                                          _mm256_cmpeq_epi8(v, nl));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_andnot_si256(allowed, low));
+
+        if (mask)
+            return i + _first_bit(mask);
+    }
+
+    return i + _control_scan_sse2(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) STATIC size_t
+_non_ascii_scan_avx2(const char *data, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(v);
+
+        if (mask)
+            return i + _first_bit(mask);
+    }
+
+    return i + _non_ascii_scan_sse2(data + i, len - i);
+}
+#endif
+
+STATIC size_t _escape_scan_resolve(const char *data, size_t len);
+STATIC size_t _control_scan_resolve(const char *data, size_t len);
+STATIC size_t _non_ascii_scan_resolve(const char *data, size_t len);
+
+static lxlsx_scan_fn _escape_scan = _escape_scan_resolve;
+static lxlsx_scan_fn _control_scan = _control_scan_resolve;
+static lxlsx_scan_fn _non_ascii_scan = _non_ascii_scan_resolve;
+
+/*
+ * Select the scan kernels for the running CPU. Called from the extension's
+ * MINIT; the kernels also resolve themselves on first use.
+ */
+void
+lxlsx_scan_init(void)
+{
+#if defined(LXLSX_SCAN_AVX2)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        _escape_scan = _escape_scan_avx2;
+        _control_scan = _control_scan_avx2;
+        _non_ascii_scan = _non_ascii_scan_avx2;
+        return;
+    }
+#endif
+
+#if defined(LXLSX_SCAN_SSE2)
+    _escape_scan = _escape_scan_sse2;
+    _control_scan = _control_scan_sse2;
+    _non_ascii_scan = _non_ascii_scan_sse2;
+#else
+    _escape_scan = _escape_scan_scalar;
+    _control_scan = _control_scan_scalar;
+    _non_ascii_scan = _non_ascii_scan_scalar;
+#endif
+}
+
+STATIC size_t
+_escape_scan_resolve(const char *data, size_t len)
+{
+    lxlsx_scan_init();
+    return _escape_scan(data, len);
+}
+
+STATIC size_t
+_control_scan_resolve(const char *data, size_t len)
+{
+    lxlsx_scan_init();
+    return _control_scan(data, len);
+}
+
+STATIC size_t
+_non_ascii_scan_resolve(const char *data, size_t len)
+{
+    lxlsx_scan_init();
+    return _non_ascii_scan(data, len);
+}
+
+/*
+ * Return the offset of the first '&', '<' or '>' in data, or len.
+ */
+size_t
+lxlsx_xml_escape_scan(const char *data, size_t len)
+{
+    return _escape_scan(data, len);
+}
+
+/*
+ * Return the offset of the first control character that needs _xHHHH_
+ * escaping in data, or len.
+ */
+size_t
+lxlsx_control_char_scan(const char *data, size_t len)
+{
+    return _control_scan(data, len);
+}
+
+/*
+ * Return the offset of the first byte >= 0x80 in data, or len.
+ */
+size_t
+lxlsx_non_ascii_scan(const char *data, size_t len)
+{
+    return _non_ascii_scan(data, len);
+}
 
-STATIC int _fwrite_escaped_data(FILE *xmlfile, const char *data);
 
 /*
  * Write the XML declaration.
@@ -51,8 +364,24 @@ STATIC int _fwrite_escaped_data(FILE *xmlfile, const char *data);
 void
 lxlsx_xml_declaration(FILE *xmlfile)
 {
-    fprintf(xmlfile, "<?xml version=\"1.0\" "
-            "encoding=\"UTF-8\" standalone=\"yes\"?>\n");
+    static const char declaration[] = "<?xml version=\"1.0\" "
+        "encoding=\"UTF-8\" standalone=\"yes\"?>\n";
+
+    fwrite(declaration, 1, sizeof(declaration) - 1, xmlfile);
+}
+
+/*
+ * Write the "<tag attributes" opening shared by the start, empty and data
+ * element writers.
+ */
+STATIC void
+_buffer_write_tag_open(lxlsx_xml_file_write_buffer *buffer, const char *tag,
+                       struct lxlsx_xml_attribute_list *attributes,
+                       uint8_t escape)
+{
+    _BUFFER_PUTC(buffer, '<');
+    _buffer_write(buffer, tag, strlen(tag));
+    _buffer_write_attributes(buffer, attributes, escape);
 }
 
 /*
@@ -62,11 +391,12 @@ void
 lxlsx_xml_start_tag(FILE *xmlfile,
                   const char *tag, struct lxlsx_xml_attribute_list *attributes)
 {
-    fprintf(xmlfile, "<%s", tag);
-
-    _fprint_escaped_attributes(xmlfile, attributes);
+    lxlsx_xml_file_write_buffer buffer;
 
-    fprintf(xmlfile, ">");
+    _BUFFER_INIT(buffer, xmlfile);
+    _buffer_write_tag_open(&buffer, tag, attributes, LXLSX_TRUE);
+    _BUFFER_PUTC(&buffer, '>');
+    _file_write_buffer_flush(&buffer);
 }
 
 /*
@@ -78,17 +408,12 @@ lxlsx_xml_start_tag_unencoded(FILE *xmlfile,
                             const char *tag,
                             struct lxlsx_xml_attribute_list *attributes)
 {
-    struct lxlsx_xml_attribute *attribute;
-
-    fprintf(xmlfile, "<%s", tag);
-
-    if (attributes) {
-        STAILQ_FOREACH(attribute, attributes, list_entries) {
-            fprintf(xmlfile, " %s=\"%s\"", attribute->key, attribute->value);
-        }
-    }
+    lxlsx_xml_file_write_buffer buffer;
 
-    fprintf(xmlfile, ">");
+    _BUFFER_INIT(buffer, xmlfile);
+    _buffer_write_tag_open(&buffer, tag, attributes, LXLSX_FALSE);
+    _BUFFER_PUTC(&buffer, '>');
+    _file_write_buffer_flush(&buffer);
 }
 
 /*
@@ -97,7 +422,13 @@ lxlsx_xml_start_tag_unencoded(FILE *xmlfile,
 void
 lxlsx_xml_end_tag(FILE *xmlfile, const char *tag)
 {
-    fprintf(xmlfile, "</%s>", tag);
+    lxlsx_xml_file_write_buffer buffer;
+
+    _BUFFER_INIT(buffer, xmlfile);
+    _BUFFER_LITERAL(&buffer, "</");
+    _buffer_write(&buffer, tag, strlen(tag));
+    _BUFFER_PUTC(&buffer, '>');
+    _file_write_buffer_flush(&buffer);
 }
 
 /*
@@ -107,11 +438,12 @@ void
 lxlsx_xml_empty_tag(FILE *xmlfile,
                   const char *tag, struct lxlsx_xml_attribute_list *attributes)
 {
-    fprintf(xmlfile, "<%s", tag);
-
-    _fprint_escaped_attributes(xmlfile, attributes);
+    lxlsx_xml_file_write_buffer buffer;
 
-    fprintf(xmlfile, "/>");
+    _BUFFER_INIT(buffer, xmlfile);
+    _buffer_write_tag_open(&buffer, tag, attributes, LXLSX_TRUE);
+    _BUFFER_LITERAL(&buffer, "/>");
+    _file_write_buffer_flush(&buffer);
 }
 
 /*
@@ -123,17 +455,12 @@ lxlsx_xml_empty_tag_unencoded(FILE *xmlfile,
                             const char *tag,
                             struct lxlsx_xml_attribute_list *attributes)
 {
-    struct lxlsx_xml_attribute *attribute;
-
-    fprintf(xmlfile, "<%s", tag);
-
-    if (attributes) {
-        STAILQ_FOREACH(attribute, attributes, list_entries) {
-            fprintf(xmlfile, " %s=\"%s\"", attribute->key, attribute->value);
-        }
-    }
+    lxlsx_xml_file_write_buffer buffer;
 
-    fprintf(xmlfile, "/>");
+    _BUFFER_INIT(buffer, xmlfile);
+    _buffer_write_tag_open(&buffer, tag, attributes, LXLSX_FALSE);
+    _BUFFER_LITERAL(&buffer, "/>");
+    _file_write_buffer_flush(&buffer);
 }
 
 /*
@@ -144,15 +471,17 @@ lxlsx_xml_data_element(FILE *xmlfile,
                      const char *tag,
                      const char *data, struct lxlsx_xml_attribute_list *attributes)
 {
-    fprintf(xmlfile, "<%s", tag);
-
-    _fprint_escaped_attributes(xmlfile, attributes);
-
-    fprintf(xmlfile, ">");
-
-    _fprint_escaped_data(xmlfile, data);
-
-    fprintf(xmlfile, "</%s>", tag);
+    lxlsx_xml_file_write_buffer buffer;
+    size_t tag_len = strlen(tag);
+
+    _BUFFER_INIT(buffer, xmlfile);
+    _buffer_write_tag_open(&buffer, tag, attributes, LXLSX_TRUE);
+    _BUFFER_PUTC(&buffer, '>');
+    _buffer_write_escaped_data(&buffer, data);
+    _BUFFER_LITERAL(&buffer, "</");
+    _buffer_write(&buffer, tag, tag_len);
+    _BUFFER_PUTC(&buffer, '>');
+    _file_write_buffer_flush(&buffer);
 }
 
 /*
@@ -161,60 +490,13 @@ lxlsx_xml_data_element(FILE *xmlfile,
 void
 lxlsx_xml_rich_si_element(FILE *xmlfile, const char *string)
 {
-    fprintf(xmlfile, "<si>%s</si>", string);
-}
-
-/*
- * Escape XML characters in attributes.
- */
-STATIC char *
-_escape_attributes(struct lxlsx_xml_attribute *attribute)
-{
-    size_t attr_len = strlen(attribute->value);
-    char *encoded;
-    char *p_encoded;
-    char *p_attr = attribute->value;
-
-    if (attr_len > ((size_t)-1) / 6 - 1)
-        return NULL;
-
-    encoded = (char *) calloc(attr_len * 6 + 1, 1);
-    if (!encoded)
-        return NULL;
-
-    p_encoded = encoded;
-
-    while (*p_attr) {
-        switch (*p_attr) {
-            case '&':
-                memcpy(p_encoded, LXLSX_AMP, sizeof(LXLSX_AMP) - 1);
-                p_encoded += sizeof(LXLSX_AMP) - 1;
-                break;
-            case '<':
-                memcpy(p_encoded, LXLSX_LT, sizeof(LXLSX_LT) - 1);
-                p_encoded += sizeof(LXLSX_LT) - 1;
-                break;
-            case '>':
-                memcpy(p_encoded, LXLSX_GT, sizeof(LXLSX_GT) - 1);
-                p_encoded += sizeof(LXLSX_GT) - 1;
-                break;
-            case '"':
-                memcpy(p_encoded, LXLSX_QUOT, sizeof(LXLSX_QUOT) - 1);
-                p_encoded += sizeof(LXLSX_QUOT) - 1;
-                break;
-            case '\n':
-                memcpy(p_encoded, LXLSX_NL, sizeof(LXLSX_NL) - 1);
-                p_encoded += sizeof(LXLSX_NL) - 1;
-                break;
-            default:
-                *p_encoded = *p_attr;
-                p_encoded++;
-                break;
-        }
-        p_attr++;
-    }
+    lxlsx_xml_file_write_buffer buffer;
 
-    return encoded;
+    _BUFFER_INIT(buffer, xmlfile);
+    _BUFFER_LITERAL(&buffer, "<si>");
+    _buffer_write(&buffer, string, strlen(string));
+    _BUFFER_LITERAL(&buffer, "</si>");
+    _file_write_buffer_flush(&buffer);
 }
 
 STATIC int
@@ -228,7 +510,7 @@ _buffer_write_callback(void *userdata, const char *data, size_t len)
 
 /*
  * Escape XML characters in data sections of tags and send escaped chunks to a
- * caller supplied writer. This differs from _escape_attributes() in that
+ * caller supplied writer. This differs from the attribute escaping in that
  * double quotes are not escaped by Excel.
  */
 int
@@ -236,18 +518,27 @@ lxlsx_xml_escape_data_write(const char *data,
                             lxlsx_xml_write_callback write_cb,
                             void *userdata)
 {
-    const char *chunk;
-    const char *p;
+    size_t len;
+    size_t pos = 0;
 
     if (!data || !write_cb)
         return -1;
 
-    chunk = data;
-    for (p = data; *p; p++) {
-        const char *escaped = NULL;
-        size_t escaped_len = 0;
+    len = strlen(data);
+
+    while (pos < len) {
+        size_t run = lxlsx_xml_escape_scan(data + pos, len - pos);
+        const char *escaped;
+        size_t escaped_len;
 
-        switch (*p) {
+        if (run && write_cb(userdata, data + pos, run) != 0)
+            return -1;
+
+        pos += run;
+        if (pos == len)
+            break;
+
+        switch (data[pos]) {
             case '&':
                 escaped = LXLSX_AMP;
                 escaped_len = sizeof(LXLSX_AMP) - 1;
@@ -256,34 +547,26 @@ lxlsx_xml_escape_data_write(const char *data,
                 escaped = LXLSX_LT;
                 escaped_len = sizeof(LXLSX_LT) - 1;
                 break;
-            case '>':
+            default:
                 escaped = LXLSX_GT;
                 escaped_len = sizeof(LXLSX_GT) - 1;
                 break;
-            default:
-                break;
         }
 
-        if (!escaped)
-            continue;
-
-        if (p > chunk && write_cb(userdata, chunk, (size_t)(p - chunk)) != 0)
-            return -1;
         if (write_cb(userdata, escaped, escaped_len) != 0)
             return -1;
-        chunk = p + 1;
+        pos++;
     }
 
-    if (p > chunk)
-        return write_cb(userdata, chunk, (size_t)(p - chunk));
-
     return 0;
 }
 
 char *
 lxlsx_escape_data(const char *data)
 {
-    size_t encoded_len = (strlen(data) * 5 + 1);
+    size_t len = strlen(data);
+    size_t first = lxlsx_xml_escape_scan(data, len);
+    size_t encoded_len = first == len ? len + 1 : len * 5 + 1;
 
     char *encoded = (char *) calloc(encoded_len, 1);
     char *p_encoded = encoded;
@@ -291,6 +574,11 @@ lxlsx_escape_data(const char *data)
     if (!encoded)
         return NULL;
 
+    if (first == len) {
+        memcpy(encoded, data, len);
+        return encoded;
+    }
+
     if (lxlsx_xml_escape_data_write(data, _buffer_write_callback,
                                     &p_encoded) != 0) {
         free(encoded);
@@ -306,15 +594,9 @@ lxlsx_escape_data(const char *data)
 uint8_t
 lxlsx_has_control_characters(const char *string)
 {
-    while (*string) {
-        /* 0xE0 == 0b11100000 masks values > 0x19 == 0b00011111. */
-        if (!(*string & 0xE0) && *string != 0x0A && *string != 0x09)
-            return LXLSX_TRUE;
+    size_t len = strlen(string);
 
-        string++;
-    }
-
-    return LXLSX_FALSE;
+    return lxlsx_control_char_scan(string, len) != len;
 }
 
 /*
@@ -435,30 +717,68 @@ lxlsx_escape_url_characters(const char *string, uint8_t escape_hash)
     return encoded;
 }
 
-/* Write out escaped attributes. */
+/* Write out the attributes, escaped or as is. */
 STATIC void
-_fprint_escaped_attributes(FILE *xmlfile,
-                           struct lxlsx_xml_attribute_list *attributes)
+_buffer_write_attributes(lxlsx_xml_file_write_buffer *buffer,
+                         struct lxlsx_xml_attribute_list *attributes,
+                         uint8_t escape)
 {
-    struct lxlsx_xml_attribute *attribute;
+    size_t i;
 
-    if (attributes) {
-        STAILQ_FOREACH(attribute, attributes, list_entries) {
-            fprintf(xmlfile, " %s=", attribute->key);
+    if (!attributes)
+        return;
 
-            if (!strpbrk(attribute->value, "&<>\"\n")) {
-                fprintf(xmlfile, "\"%s\"", attribute->value);
-            }
-            else {
-                char *encoded = _escape_attributes(attribute);
+    for (i = 0; i < attributes->count; i++) {
+        struct lxlsx_xml_attribute *attribute = &attributes->items[i];
+        const char *chunk = attribute->value;
+        const char *p = attribute->value;
 
-                if (encoded) {
-                    fprintf(xmlfile, "\"%s\"", encoded);
+        _BUFFER_PUTC(buffer, ' ');
+        _buffer_write(buffer, attribute->key, attribute->key_len);
+        _BUFFER_LITERAL(buffer, "=\"");
 
-                    free(encoded);
-                }
+        if (!escape) {
+            _buffer_write(buffer, attribute->value, attribute->value_len);
+            _BUFFER_PUTC(buffer, '"');
+            continue;
+        }
+
+        for (; *p; p++) {
+            const char *escaped;
+            size_t escaped_len;
+
+            switch (*p) {
+                case '&':
+                    escaped = LXLSX_AMP;
+                    escaped_len = sizeof(LXLSX_AMP) - 1;
+                    break;
+                case '<':
+                    escaped = LXLSX_LT;
+                    escaped_len = sizeof(LXLSX_LT) - 1;
+                    break;
+                case '>':
+                    escaped = LXLSX_GT;
+                    escaped_len = sizeof(LXLSX_GT) - 1;
+                    break;
+                case '"':
+                    escaped = LXLSX_QUOT;
+                    escaped_len = sizeof(LXLSX_QUOT) - 1;
+                    break;
+                case '\n':
+                    escaped = LXLSX_NL;
+                    escaped_len = sizeof(LXLSX_NL) - 1;
+                    break;
+                default:
+                    continue;
             }
+
+            _buffer_write(buffer, chunk, (size_t)(p - chunk));
+            _buffer_write(buffer, escaped, escaped_len);
+            chunk = p + 1;
         }
+
+        _buffer_write(buffer, chunk, (size_t)(p - chunk));
+        _BUFFER_PUTC(buffer, '"');
     }
 }
 
@@ -478,96 +798,183 @@ _file_write_buffer_flush(lxlsx_xml_file_write_buffer *buffer)
     return 0;
 }
 
-STATIC int
-_fwrite_escaped_data(FILE *xmlfile, const char *data)
+/* Copy bytes into the buffer. Runs longer than the buffer go straight to
+ * the file. */
+STATIC void
+_buffer_write(lxlsx_xml_file_write_buffer *buffer, const char *data,
+              size_t len)
 {
-    lxlsx_xml_file_write_buffer buffer;
-
-    buffer.file = xmlfile;
-    buffer.len = 0;
-    buffer.error = 0;
+    if (len == 0)
+        return;
 
-    while (*data) {
-        const char *escaped = NULL;
-        size_t write_len = 1;
+    if (sizeof(buffer->buffer) - buffer->len < len) {
+        _file_write_buffer_flush(buffer);
 
-        switch (*data) {
-            case '&':
-                escaped = LXLSX_AMP;
-                write_len = sizeof(LXLSX_AMP) - 1;
-                break;
-            case '<':
-                escaped = LXLSX_LT;
-                write_len = sizeof(LXLSX_LT) - 1;
-                break;
-            case '>':
-                escaped = LXLSX_GT;
-                write_len = sizeof(LXLSX_GT) - 1;
-                break;
-            default:
-                break;
+        if (len >= sizeof(buffer->buffer)) {
+            if (fwrite(data, 1, len, buffer->file) != len)
+                buffer->error = 1;
+            return;
         }
+    }
 
-        if (sizeof(buffer.buffer) - buffer.len < write_len &&
-            _file_write_buffer_flush(&buffer) != 0)
-            return -1;
+    memcpy(buffer->buffer + buffer->len, data, len);
+    buffer->len += len;
+}
 
-        if (escaped)
-            memcpy(buffer.buffer + buffer.len, escaped, write_len);
-        else
-            buffer.buffer[buffer.len] = *data;
-        buffer.len += write_len;
-        data++;
-    }
+STATIC int
+_buffer_escaped_data_callback(void *userdata, const char *data, size_t len)
+{
+    lxlsx_xml_file_write_buffer *buffer = userdata;
+
+    _buffer_write(buffer, data, len);
 
-    return _file_write_buffer_flush(&buffer);
+    return buffer->error ? -1 : 0;
 }
 
 /* Write out escaped XML data. */
 STATIC void
-_fprint_escaped_data(FILE *xmlfile, const char *data)
+_buffer_write_escaped_data(lxlsx_xml_file_write_buffer *buffer,
+                           const char *data)
 {
-    /* Escape the data section of the XML element. */
-    if (!strpbrk(data, "&<>")) {
-        fprintf(xmlfile, "%s", data);
+    lxlsx_xml_escape_data_write(data, _buffer_escaped_data_callback, buffer);
+}
+
+/*
+ * Store "key\0value\0" for a new attribute. Values are truncated to
+ * LXLSX_MAX_ATTRIBUTE_LENGTH - 1 bytes as before. The text goes into the
+ * list's stack pool and only spills to the heap once the pool is full.
+ */
+STATIC struct lxlsx_xml_attribute *
+_push_attribute(struct lxlsx_xml_attribute_list *attributes, const char *key,
+                const char *value, size_t value_len)
+{
+    struct lxlsx_xml_attribute *attribute;
+    size_t key_len = strlen(key);
+    size_t size;
+    char *data;
+
+    if (key_len >= LXLSX_MAX_ATTRIBUTE_LENGTH)
+        key_len = LXLSX_MAX_ATTRIBUTE_LENGTH - 1;
+
+    if (value_len >= LXLSX_MAX_ATTRIBUTE_LENGTH)
+        value_len = LXLSX_MAX_ATTRIBUTE_LENGTH - 1;
+
+    if (attributes->count == attributes->capacity) {
+        size_t capacity = attributes->capacity * 2;
+        struct lxlsx_xml_attribute *items;
+
+        if (attributes->items == attributes->inline_items) {
+            items = malloc(capacity * sizeof(struct lxlsx_xml_attribute));
+            if (items)
+                memcpy(items, attributes->inline_items,
+                       sizeof(attributes->inline_items));
+        }
+        else {
+            items = realloc(attributes->items,
+                            capacity * sizeof(struct lxlsx_xml_attribute));
+        }
+
+        if (!items)
+            return NULL;
+
+        attributes->items = items;
+        attributes->capacity = capacity;
+    }
+
+    attribute = &attributes->items[attributes->count];
+    size = key_len + value_len + 2;
+
+    if (sizeof(attributes->pool) - attributes->pool_len >= size) {
+        data = attributes->pool + attributes->pool_len;
+        attributes->pool_len += size;
+        attribute->heap = LXLSX_FALSE;
     }
     else {
-        _fwrite_escaped_data(xmlfile, data);
+        data = malloc(size);
+        if (!data)
+            return NULL;
+        attribute->heap = LXLSX_TRUE;
     }
+
+    memcpy(data, key, key_len);
+    data[key_len] = '\0';
+    memcpy(data + key_len + 1, value, value_len);
+    data[key_len + 1 + value_len] = '\0';
+
+    attribute->key = data;
+    attribute->value = data + key_len + 1;
+    attribute->key_len = (uint16_t) key_len;
+    attribute->value_len = (uint16_t) value_len;
+
+    attributes->count++;
+
+    return attribute;
 }
 
-/* Create a new string XML attribute. */
-struct lxlsx_xml_attribute *
-lxlsx_new_attribute_str(const char *key, const char *value)
+/* Reset an attribute list to the empty, stack only, state. */
+void
+lxlsx_xml_attributes_init(struct lxlsx_xml_attribute_list *attributes)
+{
+    attributes->items = attributes->inline_items;
+    attributes->count = 0;
+    attributes->capacity = LXLSX_XML_INLINE_ATTRIBUTES;
+    attributes->pool_len = 0;
+}
+
+/* Release any heap spill and leave the list empty. */
+void
+lxlsx_xml_attributes_free(struct lxlsx_xml_attribute_list *attributes)
 {
-    struct lxlsx_xml_attribute *attribute = malloc(sizeof(struct lxlsx_xml_attribute));
+    size_t i;
+
+    for (i = 0; i < attributes->count; i++) {
+        if (attributes->items[i].heap)
+            free(attributes->items[i].key);
+    }
 
-    LXLSX_ATTRIBUTE_COPY(attribute->key, key);
-    LXLSX_ATTRIBUTE_COPY(attribute->value, value);
+    if (attributes->items != attributes->inline_items)
+        free(attributes->items);
 
-    return attribute;
+    lxlsx_xml_attributes_init(attributes);
 }
 
-/* Create a new integer XML attribute. */
+/* Add a string XML attribute. */
 struct lxlsx_xml_attribute *
-lxlsx_new_attribute_int(const char *key, int32_t value)
+lxlsx_xml_push_attribute_str(struct lxlsx_xml_attribute_list *attributes,
+                             const char *key, const char *value)
 {
-    struct lxlsx_xml_attribute *attribute = malloc(sizeof(struct lxlsx_xml_attribute));
+    return _push_attribute(attributes, key, value, strlen(value));
+}
 
-    LXLSX_ATTRIBUTE_COPY(attribute->key, key);
-    lxlsx_snprintf(attribute->value, LXLSX_MAX_ATTRIBUTE_LENGTH, "%d", value);
+/* Add an integer XML attribute. */
+struct lxlsx_xml_attribute *
+lxlsx_xml_push_attribute_int(struct lxlsx_xml_attribute_list *attributes,
+                             const char *key, int32_t value)
+{
+    char buffer[LXLSX_ATTR_32];
+    char *p = buffer + sizeof(buffer);
+    uint32_t number = value < 0 ? 0U - (uint32_t) value : (uint32_t) value;
 
-    return attribute;
+    do {
+        *--p = (char) ('0' + number % 10);
+        number /= 10;
+    } while (number);
+
+    if (value < 0)
+        *--p = '-';
+
+    return _push_attribute(attributes, key, p,
+                           (size_t) (buffer + sizeof(buffer) - p));
 }
 
-/* Create a new double XML attribute. */
+/* Add a double XML attribute. */
 struct lxlsx_xml_attribute *
-lxlsx_new_attribute_dbl(const char *key, double value)
+lxlsx_xml_push_attribute_dbl(struct lxlsx_xml_attribute_list *attributes,
+                             const char *key, double value)
 {
-    struct lxlsx_xml_attribute *attribute = malloc(sizeof(struct lxlsx_xml_attribute));
+    char buffer[LXLSX_ATTR_32];
 
-    LXLSX_ATTRIBUTE_COPY(attribute->key, key);
-    lxlsx_sprintf_dbl(attribute->value, value);
+    lxlsx_sprintf_dbl(buffer, value);
 
-    return attribute;
+    return _push_attribute(attributes, key, buffer, strlen(buffer));
 }
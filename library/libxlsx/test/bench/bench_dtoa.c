@@ -0,0 +1,101 @@
+/*
+ * Micro-benchmark for lxlsx_dtoa() against emyg_dtoa() and "%.16G".
+ *
+ * Build and run with "make bench" from library/libxlsx/test (after a "make
+ * clean", add CFLAGS=-O2 to time optimized library code). Optionally pass
+ * the number of values to format as the first argument.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libxlsx/utility.h"
+#include "libxlsx/third_party/emyg_dtoa.h"
+
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double *
+_make_values(size_t count, int kind)
+{
+    double *values = malloc(count * sizeof(double));
+    uint64_t state = UINT64_C(0x9E3779B97F4A7C15);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        if (kind == 0) {
+            /* Two decimal place amounts. */
+            values[i] = (double) (state % 100000000) / 100.0;
+        }
+        else {
+            /* Random doubles in (0, 1) scaled over a wide range. */
+            values[i] = (double) (state >> 11) / 9007199254740992.0
+                        * (double) (1 + (state & 0xFFFF));
+        }
+    }
+
+    return values;
+}
+
+static void
+_run(const char *name, const double *values, size_t count)
+{
+    char buffer[LXLSX_ATTR_32];
+    size_t checksum = 0;
+    double start;
+    size_t i;
+
+    start = _now();
+    for (i = 0; i < count; i++)
+        checksum += lxlsx_dtoa(values[i], buffer);
+    printf("%-10s lxlsx_dtoa  %8.1f ns/value (%zu)\n", name,
+           (_now() - start) * 1e9 / count, checksum);
+
+    checksum = 0;
+    start = _now();
+    for (i = 0; i < count; i++) {
+        emyg_dtoa(values[i], buffer);
+        checksum += strlen(buffer);
+    }
+    printf("%-10s emyg_dtoa   %8.1f ns/value (%zu)\n", name,
+           (_now() - start) * 1e9 / count, checksum);
+
+    checksum = 0;
+    start = _now();
+    for (i = 0; i < count; i++)
+        checksum += (size_t) snprintf(buffer, sizeof(buffer), "%.16G",
+                                      values[i]);
+    printf("%-10s %%.16G      %8.1f ns/value (%zu)\n", name,
+           (_now() - start) * 1e9 / count, checksum);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? (size_t) strtoul(argv[1], NULL, 10) : 2000000;
+    double *amounts = _make_values(count, 0);
+    double *doubles = _make_values(count, 1);
+
+    _run("amounts", amounts, count);
+    _run("doubles", doubles, count);
+
+    free(amounts);
+    free(doubles);
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Micro-benchmark for the lxlsx_hash_table used for format and style
+ * de-duplication, against a chained table with an FNV hash and a fixed
+ * bucket count as used by upstream libxlsxwriter.
+ *
+ * Build and run with "make bench" from library/libxlsx/test (after a "make
+ * clean", add CFLAGS=-O2 to time optimized library code). Optionally pass
+ * the number of unique format keys as the first argument.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libxlsx/format.h"
+#include "libxlsx/hash_table.h"
+
+/* Each unique key is looked up this many times, as for repeated cells. */
+#define LOOKUPS_PER_KEY 8
+
+typedef struct chained_element {
+    void *key;
+    void *value;
+    size_t key_len;
+    struct chained_element *next;
+} chained_element;
+
+typedef struct chained_table {
+    size_t num_buckets;
+    chained_element **buckets;
+} chained_table;
+
+static size_t
+_fnv_hash(const void *data, size_t data_len, size_t num_buckets)
+{
+    const unsigned char *p = data;
+    size_t hash = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < data_len; i++)
+        hash = (hash * 16777619) ^ p[i];
+
+    return hash % num_buckets;
+}
+
+static chained_element *
+_chained_find(chained_table *table, void *key, size_t key_len)
+{
+    chained_element *element;
+
+    element = table->buckets[_fnv_hash(key, key_len, table->num_buckets)];
+    for (; element; element = element->next)
+        if (element->key_len == key_len
+            && memcmp(element->key, key, key_len) == 0)
+            return element;
+
+    return NULL;
+}
+
+static void
+_chained_insert(chained_table *table, void *key, void *value, size_t key_len)
+{
+    size_t index = _fnv_hash(key, key_len, table->num_buckets);
+    chained_element *element = calloc(1, sizeof(chained_element));
+
+    element->key = key;
+    element->value = value;
+    element->key_len = key_len;
+    element->next = table->buckets[index];
+    table->buckets[index] = element;
+}
+
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build format sized keys that differ in a few properties, like real styles. */
+static lxlsx_format *
+_make_keys(size_t count)
+{
+    lxlsx_format *keys = calloc(count, sizeof(lxlsx_format));
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        keys[i].font_size = 11;
+        keys[i].font_color = (lxlsx_color_t) (i * 2654435761U);
+        keys[i].bg_color = (lxlsx_color_t) (i / 7);
+        keys[i].num_format_index = (uint16_t) (i % 50);
+        keys[i].bold = (uint8_t) (i & 1);
+    }
+
+    return keys;
+}
+
+static void
+_run_hash_table(lxlsx_format *keys, size_t count)
+{
+    lxlsx_hash_table *table = lxlsx_hash_new(128, 0, 0);
+    size_t found = 0;
+    double start = _now();
+    size_t i;
+    int j;
+
+    for (i = 0; i < count; i++)
+        lxlsx_insert_hash_element(table, &keys[i], &keys[i],
+                                  sizeof(lxlsx_format));
+
+    for (j = 0; j < LOOKUPS_PER_KEY; j++)
+        for (i = 0; i < count; i++)
+            found += lxlsx_hash_key_exists(table, &keys[i],
+                                           sizeof(lxlsx_format)) != NULL;
+
+    printf("open addressing  %10.1f ns/op (%zu found)\n",
+           (_now() - start) * 1e9 / (count * (LOOKUPS_PER_KEY + 1)), found);
+
+    lxlsx_hash_free(table);
+}
+
+static void
+_run_chained(lxlsx_format *keys, size_t count)
+{
+    chained_table table;
+    chained_element *element;
+    chained_element *next;
+    size_t found = 0;
+    double start = _now();
+    size_t i;
+    int j;
+
+    table.num_buckets = 128;
+    table.buckets = calloc(table.num_buckets, sizeof(chained_element *));
+
+    for (i = 0; i < count; i++)
+        if (!_chained_find(&table, &keys[i], sizeof(lxlsx_format)))
+            _chained_insert(&table, &keys[i], &keys[i], sizeof(lxlsx_format));
+
+    for (j = 0; j < LOOKUPS_PER_KEY; j++)
+        for (i = 0; i < count; i++)
+            found += _chained_find(&table, &keys[i],
+                                   sizeof(lxlsx_format)) != NULL;
+
+    printf("chained FNV      %10.1f ns/op (%zu found)\n",
+           (_now() - start) * 1e9 / (count * (LOOKUPS_PER_KEY + 1)), found);
+
+    for (i = 0; i < table.num_buckets; i++) {
+        for (element = table.buckets[i]; element; element = next) {
+            next = element->next;
+            free(element);
+        }
+    }
+    free(table.buckets);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? (size_t) strtoul(argv[1], NULL, 10) : 20000;
+    lxlsx_format *keys = _make_keys(count);
+
+    printf("%zu unique keys of %zu bytes\n", count, sizeof(lxlsx_format));
+    _run_hash_table(keys, count);
+    _run_chained(keys, count);
+
+    free(keys);
+    return 0;
+}
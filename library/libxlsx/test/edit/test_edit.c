@@ -26,6 +26,20 @@ static const char *DIM_XLSX = "fixtures/edit_dim.xlsx";
 static const char *ADDSHEET_XLSX = "fixtures/edit_addsheet.xlsx";
 static const char *IMAGE_XLSX = "fixtures/edit_image.xlsx";
 static const char *CHART_XLSX = "fixtures/edit_chart.xlsx";
+static const char *LARGE_XLSX = "fixtures/edit_large.xlsx";
+static const char *LARGE_OUT_XLSX = "fixtures/edit_large_out.xlsx";
+static const char *APPEND_XLSX = "fixtures/edit_append.xlsx";
+static const char *APPEND_OUT_XLSX = "fixtures/edit_append_out.xlsx";
+static const char *IN_PLACE_XLSX = "fixtures/edit_in_place.xlsx";
+static const char *TEMPLATE_XLSX = "fixtures/edit_template.xlsx";
+static const char *TEMPLATE_OUT_XLSX = "fixtures/edit_template_out.xlsx";
+static const char *TEMPLATE_OUT2_XLSX = "fixtures/edit_template_out2.xlsx";
+static const char *CONCAT_A_XLSX = "fixtures/edit_concat_a.xlsx";
+static const char *CONCAT_B_XLSX = "fixtures/edit_concat_b.xlsx";
+static const char *CONCAT_C_XLSX = "fixtures/edit_concat_c.xlsx";
+static const char *CONCAT_OUT_XLSX = "fixtures/edit_concat_out.xlsx";
+static const char *EXTRACT_XLSX = "fixtures/edit_extract.xlsx";
+static const char *EXTRACT_OUT_XLSX = "fixtures/edit_extract_out.xlsx";
 
 static void assert_ok(lxlsx_error err)
 {
@@ -117,29 +131,41 @@ static void assert_xml_contains(const unsigned char *xml, const char *needle)
     TEST_ASSERT_NOT_NULL_MESSAGE(strstr((const char *)xml, needle), needle);
 }
 
-static void write_sheet_xml_override(const char *source_path,
-                                     const char *output_path,
-                                     const char *sheet_xml)
+static void write_parts_override(const char *source_path,
+                                 const char *output_path,
+                                 const char *const *names,
+                                 const char *const *xml, size_t count)
 {
     lxlsx_source_package *package = NULL;
-    lxlsx_source_package_replacement replacement;
-    int sheet_index;
+    lxlsx_source_package_replacement replacements[4];
+    int index;
+    size_t i;
 
+    TEST_ASSERT_TRUE(count <= 4);
     remove(output_path);
     assert_ok(lxlsx_source_package_open(source_path, &package));
-    sheet_index = lxlsx_source_package_find_first(package,
-                                                  "xl/worksheets/sheet1.xml");
-    TEST_ASSERT_GREATER_OR_EQUAL_INT(0, sheet_index);
-
-    replacement.entry_index = (size_t)sheet_index;
-    replacement.data = (const unsigned char *)sheet_xml;
-    replacement.size = strlen(sheet_xml);
+    for (i = 0; i < count; i++) {
+        index = lxlsx_source_package_find_first(package, names[i]);
+        TEST_ASSERT_GREATER_OR_EQUAL_INT(0, index);
+        replacements[i].entry_index = (size_t)index;
+        replacements[i].data = (const unsigned char *)xml[i];
+        replacements[i].size = strlen(xml[i]);
+    }
     assert_ok(lxlsx_source_package_save_with_replacements(
-        package, output_path, &replacement, 1));
+        package, output_path, replacements, count));
 
     lxlsx_source_package_close(package);
 }
 
+static void write_sheet_xml_override(const char *source_path,
+                                     const char *output_path,
+                                     const char *sheet_xml)
+{
+    const char *name = "xl/worksheets/sheet1.xml";
+
+    write_parts_override(source_path, output_path, &name, &sheet_xml, 1);
+}
+
 static void assert_number_cell_in_sheet(const char *path, const char *sheet_name,
                                         size_t row, size_t col, double expected)
 {
@@ -747,6 +773,59 @@ static void test_edit_injects_cell_format(void)
     lxlsx_source_package_close(package);
 }
 
+/* Formats differing only in number format or alignment get their own xf. */
+static void test_edit_keeps_distinct_cell_formats(void)
+{
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+    lxlsx_format *formats[3];
+    lxlsx_source_package *package;
+    int idx;
+    size_t i;
+    unsigned char *sheet = NULL;
+    size_t sheet_len = 0;
+    char needle[32];
+    unsigned long xf[3];
+    const char *p;
+
+    write_edit_workbook(SOURCE_XLSX, 1.0, 111.0);
+    remove(NUMFMT_XLSX);
+
+    workbook = lxlsx_workbook_open(SOURCE_XLSX);
+    TEST_ASSERT_NOT_NULL(workbook);
+    worksheet = lxlsx_workbook_get_worksheet_by_name(workbook, "Edit");
+    TEST_ASSERT_NOT_NULL(worksheet);
+
+    for (i = 0; i < 3; i++) {
+        formats[i] = lxlsx_workbook_add_format(workbook);
+        TEST_ASSERT_NOT_NULL(formats[i]);
+        lxlsx_format_set_bold(formats[i]);
+    }
+    lxlsx_format_set_num_format(formats[1], "0.00");
+    lxlsx_format_set_align(formats[2], LXLSX_ALIGN_CENTER);
+    for (i = 0; i < 3; i++)
+        assert_ok(lxlsx_worksheet_write_number(worksheet, 5 + (lxlsx_row_t)i,
+                                               0, 1.5, formats[i]));
+    assert_ok(lxlsx_workbook_save_as(workbook, NUMFMT_XLSX));
+    lxlsx_workbook_free(workbook);
+
+    assert_ok(lxlsx_source_package_open(NUMFMT_XLSX, &package));
+    idx = lxlsx_source_package_find_first(package, "xl/worksheets/sheet1.xml");
+    TEST_ASSERT_TRUE(idx >= 0);
+    assert_ok(lxlsx_source_package_read_entry(package, (size_t)idx, &sheet, &sheet_len));
+    for (i = 0; i < 3; i++) {
+        snprintf(needle, sizeof(needle), "<c r=\"A%u\" s=\"", (unsigned)(6 + i));
+        p = strstr((const char *)sheet, needle);
+        TEST_ASSERT_NOT_NULL(p);
+        xf[i] = strtoul(p + strlen(needle), NULL, 10);
+    }
+    TEST_ASSERT_TRUE(xf[0] != xf[1]);
+    TEST_ASSERT_TRUE(xf[0] != xf[2]);
+    TEST_ASSERT_TRUE(xf[1] != xf[2]);
+    free(sheet);
+    lxlsx_source_package_close(package);
+}
+
 static void test_edit_adds_worksheet(void)
 {
     static const char *SHEET_XML =
@@ -1178,6 +1257,726 @@ static void test_edit_uses_open_time_snapshot(void)
     assert_number_cell(SNAPSHOT_XLSX, 1, 4, 111.0);
 }
 
+/* Enough rows that the sheet spans many inflate chunks and rows straddle
+ * chunk boundaries while the patcher streams it. */
+#define LARGE_ROWS 20000
+
+static void test_edit_streams_large_sheet(void)
+{
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+    lxlsx_edit_session *session;
+    unsigned char *xml = NULL;
+    size_t xml_len = 0;
+    const char *p;
+    const char *last_row;
+    const char *new_row;
+    size_t rows = 0;
+    int row;
+
+    remove(LARGE_XLSX);
+    remove(LARGE_OUT_XLSX);
+    workbook = lxlsx_workbook_new(LARGE_XLSX);
+    TEST_ASSERT_NOT_NULL(workbook);
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Edit");
+    TEST_ASSERT_NOT_NULL(worksheet);
+    for (row = 0; row < LARGE_ROWS; row++) {
+        assert_ok(lxlsx_worksheet_write_number(worksheet, (lxlsx_row_t)row, 0,
+                                               row, NULL));
+        assert_ok(lxlsx_worksheet_write_number(worksheet, (lxlsx_row_t)row, 1,
+                                               row * 2, NULL));
+    }
+    assert_ok(lxlsx_workbook_close(workbook));
+
+    session = lxlsx_edit_open(LARGE_XLSX);
+    TEST_ASSERT_NOT_NULL(session);
+    assert_ok(lxlsx_edit_set_number(session, "Edit", 0, 0, 42.0));
+    assert_ok(lxlsx_edit_set_string(session, "Edit", 12345, 1, "mid"));
+    assert_ok(lxlsx_edit_set_number(session, "Edit", 25000, 0, 7.0));
+    /* Heights set out of row order are applied as the rows stream by. */
+    assert_ok(lxlsx_edit_set_row_height(session, "Edit", 25000, 44.0));
+    assert_ok(lxlsx_edit_set_row_height(session, "Edit", 12345, 22.0));
+    assert_ok(lxlsx_edit_set_row_height(session, "Edit", 7000, 33.0));
+    assert_ok(lxlsx_edit_set_row_height(session, "Edit", 100, 11.0));
+    assert_ok(lxlsx_edit_set_merge(session, "Edit", 3, 0, 3, 1));
+    assert_ok(lxlsx_edit_set_column(session, "Edit", 0, 0, 12.0));
+    assert_ok(lxlsx_edit_save_as(session, LARGE_OUT_XLSX));
+    lxlsx_edit_close(session);
+
+    xml = read_sheet_xml(LARGE_OUT_XLSX, &xml_len);
+    assert_xml_contains(xml, "<col min=\"1\" max=\"1\" width=\"12\" customWidth=\"1\"/>");
+    assert_xml_contains(xml, "<c r=\"A1\"><v>42</v></c>");
+    assert_xml_contains(xml, "<c r=\"A10000\"><v>9999</v></c>");
+    assert_xml_contains(xml, "<c r=\"B12346\" t=\"inlineStr\"><is><t>mid</t></is></c>");
+    assert_xml_contains(xml, "<row r=\"101\" spans=\"1:2\" ht=\"11\" customHeight=\"1\">");
+    assert_xml_contains(xml, "<row r=\"7001\" spans=\"1:2\" ht=\"33\" customHeight=\"1\">");
+    assert_xml_contains(xml, "<row r=\"12346\" spans=\"1:2\" ht=\"22\" customHeight=\"1\">");
+    assert_xml_contains(xml, "<mergeCell ref=\"A4:B4\"/>");
+
+    /* The new row follows the last existing one, with its height applied. */
+    last_row = strstr((const char *)xml, "<row r=\"20000\"");
+    new_row = strstr((const char *)xml,
+                     "<row r=\"25001\" ht=\"44\" customHeight=\"1\">"
+                     "<c r=\"A25001\"><v>7</v></c></row></sheetData>");
+    TEST_ASSERT_NOT_NULL(last_row);
+    TEST_ASSERT_NOT_NULL(new_row);
+    TEST_ASSERT_TRUE(last_row < new_row);
+
+    for (p = (const char *)xml; (p = strstr(p, "<row ")) != NULL; p++)
+        rows++;
+    TEST_ASSERT_EQUAL_size_t(LARGE_ROWS + 1, rows);
+
+    free(xml);
+    assert_number_cell(LARGE_OUT_XLSX, 20000, 2, 39998.0);
+    assert_number_cell(LARGE_OUT_XLSX, 25001, 1, 7.0);
+}
+
+static void write_append_template(const char *path)
+{
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+
+    remove(path);
+    workbook = lxlsx_workbook_new(path);
+    TEST_ASSERT_NOT_NULL(workbook);
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Edit");
+    TEST_ASSERT_NOT_NULL(worksheet);
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 0, 0, "Name", NULL));
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 0, 1, "Amount", NULL));
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 1, 0, "first", NULL));
+    assert_ok(lxlsx_worksheet_write_number(worksheet, 1, 1, 1.0, NULL));
+    assert_ok(lxlsx_workbook_close(workbook));
+}
+
+static unsigned char *read_part(const char *path, const char *name)
+{
+    lxlsx_source_package *package = NULL;
+    unsigned char *xml = NULL;
+    size_t len = 0;
+    int idx;
+
+    assert_ok(lxlsx_source_package_open(path, &package));
+    idx = lxlsx_source_package_find_first(package, name);
+    TEST_ASSERT_TRUE(idx >= 0);
+    assert_ok(lxlsx_source_package_read_entry(package, (size_t)idx, &xml, &len));
+    lxlsx_source_package_close(package);
+    return xml;
+}
+
+static void test_edit_appends_rows_with_shared_strings(void)
+{
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+    lxlsx_format *format;
+    lxlsx_edit_append_options options = {1};
+    lxlsx_row_t first = 0;
+    lxlsx_row_t again = 0;
+    lxlsx_row_t row;
+    unsigned char *xml;
+    size_t xml_len = 0;
+    const char *p;
+    char needle[64];
+    unsigned long xf_count;
+    size_t rows = 0;
+
+    write_append_template(APPEND_XLSX);
+    remove(APPEND_OUT_XLSX);
+
+    workbook = lxlsx_workbook_open(APPEND_XLSX);
+    TEST_ASSERT_NOT_NULL(workbook);
+    worksheet = lxlsx_workbook_get_worksheet_by_name(workbook, "Edit");
+    TEST_ASSERT_NOT_NULL(worksheet);
+
+    /* An edit of an existing row still goes through the change list. */
+    assert_ok(lxlsx_worksheet_write_number(worksheet, 1, 1, 5.0, NULL));
+
+    assert_ok(lxlsx_worksheet_append_rows(worksheet, &options, &first));
+    TEST_ASSERT_EQUAL_INT(2, (int)first);
+
+    format = lxlsx_workbook_add_format(workbook);
+    TEST_ASSERT_NOT_NULL(format);
+    lxlsx_format_set_num_format(format, "0.00");
+
+    for (row = first; row < first + 100; row++) {
+        assert_ok(lxlsx_worksheet_write_string(worksheet, row, 0,
+                                               row & 1 ? "odd" : "even", NULL));
+        assert_ok(lxlsx_worksheet_write_number(worksheet, row, 1, row * 1.5,
+                                               format));
+        assert_ok(lxlsx_worksheet_write_boolean(worksheet, row, 2, 1, NULL));
+    }
+    row = first + 99;
+    assert_ok(lxlsx_worksheet_set_row(worksheet, row, 30.0, NULL));
+
+    /* Cells arrive in order; the last one can be rewritten. */
+    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_PARAMETER_VALIDATION,
+                          lxlsx_worksheet_write_number(worksheet, first, 0,
+                                                       1.0, NULL));
+    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_PARAMETER_VALIDATION,
+                          lxlsx_worksheet_write_number(worksheet, row, 1,
+                                                       1.0, NULL));
+    /* A string added by a rewritten cell goes with it. */
+    assert_ok(lxlsx_worksheet_write_string(worksheet, row, 2, "typo", NULL));
+    assert_ok(lxlsx_worksheet_write_number(worksheet, row, 2, 9.0, NULL));
+
+    assert_ok(lxlsx_worksheet_append_rows(worksheet, &options, &again));
+    TEST_ASSERT_EQUAL_INT(row + 1, (int)again);
+
+    assert_ok(lxlsx_workbook_save_as(workbook, APPEND_OUT_XLSX));
+    lxlsx_workbook_free(workbook);
+
+    /* Only one xf is added for the repeated format, after the existing ones. */
+    xml = read_part(APPEND_XLSX, "xl/styles.xml");
+    p = strstr((const char *)xml, "<cellXfs count=\"");
+    TEST_ASSERT_NOT_NULL(p);
+    xf_count = strtoul(p + strlen("<cellXfs count=\""), NULL, 10);
+    free(xml);
+    xml = read_part(APPEND_OUT_XLSX, "xl/styles.xml");
+    snprintf(needle, sizeof(needle), "<cellXfs count=\"%lu\"", xf_count + 1);
+    assert_xml_contains(xml, needle);
+    free(xml);
+
+    xml = read_part(APPEND_OUT_XLSX, "xl/sharedStrings.xml");
+    assert_xml_contains(xml, "uniqueCount=\"5\"");
+    assert_xml_contains(xml, "<si><t>even</t></si><si><t>odd</t></si></sst>");
+    TEST_ASSERT_NULL(strstr((const char *)xml, "typo"));
+    free(xml);
+
+    xml = read_sheet_xml(APPEND_OUT_XLSX, &xml_len);
+    snprintf(needle, sizeof(needle),
+             "<c r=\"A3\" t=\"s\"><v>3</v></c><c r=\"B3\" s=\"%lu\">",
+             xf_count);
+    assert_xml_contains(xml, needle);
+    assert_xml_contains(xml, "<row r=\"102\" ht=\"30\" customHeight=\"1\">");
+    assert_xml_contains(xml, "<c r=\"C102\"><v>9</v></c></row></sheetData>");
+    for (p = (const char *)xml; (p = strstr(p, "<row ")) != NULL; p++)
+        rows++;
+    TEST_ASSERT_EQUAL_size_t(102, rows);
+    free(xml);
+
+    assert_number_cell(APPEND_OUT_XLSX, 2, 2, 5.0);
+    assert_string_cell(APPEND_OUT_XLSX, 3, 1, "even");
+    assert_string_cell(APPEND_OUT_XLSX, 4, 1, "odd");
+    assert_number_cell(APPEND_OUT_XLSX, 4, 2, 4.5);
+    assert_boolean_cell(APPEND_OUT_XLSX, 101, 3, 1);
+    assert_number_cell(APPEND_OUT_XLSX, 102, 3, 9.0);
+}
+
+static void test_edit_appends_rows_inline(void)
+{
+    lxlsx_edit_session *session;
+    lxlsx_row_t first = 0;
+    unsigned char *xml;
+    size_t xml_len = 0;
+
+    write_append_template(APPEND_XLSX);
+    remove(APPEND_OUT_XLSX);
+
+    session = lxlsx_edit_open(APPEND_XLSX);
+    TEST_ASSERT_NOT_NULL(session);
+
+    /* A pending edit below the existing rows moves the append region down. */
+    assert_ok(lxlsx_edit_set_number(session, "Edit", 4, 0, 7.0));
+    assert_ok(lxlsx_edit_append_begin(session, "Edit", NULL, &first));
+    TEST_ASSERT_EQUAL_INT(5, (int)first);
+
+    assert_ok(lxlsx_edit_set_string(session, "Edit", 5, 0, "a<b"));
+    assert_ok(lxlsx_edit_set_formula(session, "Edit", 5, 1, "=A5*2", "14"));
+    assert_ok(lxlsx_edit_set_number_format(session, "Edit", 5, 1, "0.0%"));
+    assert_ok(lxlsx_edit_set_number(session, "Edit", 7, 0, 0.25));
+    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_PARAMETER_VALIDATION,
+                          lxlsx_edit_set_row_height(session, "Edit", 5, 20.0));
+    assert_ok(lxlsx_edit_save_as(session, APPEND_OUT_XLSX));
+    lxlsx_edit_close(session);
+
+    xml = read_sheet_xml(APPEND_OUT_XLSX, &xml_len);
+    assert_xml_contains(xml, "<row r=\"5\"><c r=\"A5\"><v>7</v></c></row>"
+                             "<row r=\"6\"><c r=\"A6\" t=\"inlineStr\">"
+                             "<is><t>a&lt;b</t></is></c><c r=\"B6\" s=\"");
+    assert_xml_contains(xml, "<row r=\"8\"><c r=\"A8\"><v>0.25</v></c></row>"
+                             "</sheetData>");
+    free(xml);
+
+    xml = read_part(APPEND_OUT_XLSX, "xl/styles.xml");
+    assert_xml_contains(xml, "formatCode=\"0.0%\"");
+    free(xml);
+
+    assert_string_cell(APPEND_OUT_XLSX, 1, 2, "Amount");
+    assert_string_cell(APPEND_OUT_XLSX, 6, 1, "a<b");
+    assert_formula_cell(APPEND_OUT_XLSX, 6, 2, "A5*2", "14");
+    assert_number_cell(APPEND_OUT_XLSX, 8, 1, 0.25);
+}
+
+static long file_size(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    long size;
+
+    TEST_ASSERT_NOT_NULL(fp);
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static void test_edit_saves_in_place(void)
+{
+    lxlsx_edit_session *session;
+    lxlsx_edit_save_options options = {1, 0};
+    long before;
+    long after;
+
+    write_edit_workbook(IN_PLACE_XLSX, 1.0, 111.0);
+    before = file_size(IN_PLACE_XLSX);
+
+    session = lxlsx_edit_open(IN_PLACE_XLSX);
+    TEST_ASSERT_NOT_NULL(session);
+    assert_ok(lxlsx_edit_set_number(session, "Edit", 0, 0, 42.0));
+    assert_ok(lxlsx_edit_save_as_opt(session, IN_PLACE_XLSX, &options));
+    lxlsx_edit_close(session);
+
+    /* The old sheet record stays behind, so the file only grows. */
+    after = file_size(IN_PLACE_XLSX);
+    TEST_ASSERT_TRUE(after > before);
+    assert_number_cell(IN_PLACE_XLSX, 1, 1, 42.0);
+    assert_number_cell(IN_PLACE_XLSX, 1, 4, 111.0);
+
+    /* Saving over an in-place saved file again stacks another revision. */
+    session = lxlsx_edit_open(IN_PLACE_XLSX);
+    TEST_ASSERT_NOT_NULL(session);
+    assert_ok(lxlsx_edit_set_string(session, "Edit", 1, 0, "again"));
+    assert_ok(lxlsx_edit_save_as_opt(session, IN_PLACE_XLSX, &options));
+    lxlsx_edit_close(session);
+    assert_number_cell(IN_PLACE_XLSX, 1, 1, 42.0);
+    assert_string_cell(IN_PLACE_XLSX, 2, 1, "again");
+
+    /* A save that is not in place compacts the package. */
+    before = file_size(IN_PLACE_XLSX);
+    session = lxlsx_edit_open(IN_PLACE_XLSX);
+    TEST_ASSERT_NOT_NULL(session);
+    assert_ok(lxlsx_edit_set_number(session, "Edit", 0, 0, 7.0));
+    assert_ok(lxlsx_edit_save_as(session, IN_PLACE_XLSX));
+    lxlsx_edit_close(session);
+    TEST_ASSERT_TRUE(file_size(IN_PLACE_XLSX) < before);
+    assert_number_cell(IN_PLACE_XLSX, 1, 1, 7.0);
+    assert_string_cell(IN_PLACE_XLSX, 2, 1, "again");
+}
+
+static void test_edit_template_cache_shares_sources(void)
+{
+    lxlsx_edit_open_options options = {1};
+    lxlsx_edit_session *first;
+    lxlsx_edit_session *second;
+    lxlsx_edit_session *third;
+
+    lxlsx_edit_template_cache_clear();
+    write_edit_workbook(TEMPLATE_XLSX, 1.0, 111.0);
+
+    /* Sessions on the unchanged file share the parsed workbook. */
+    first = lxlsx_edit_open_opt(TEMPLATE_XLSX, &options);
+    second = lxlsx_edit_open_opt(TEMPLATE_XLSX, &options);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_TRUE(lxlsx_edit_sheet_name(first, 0) ==
+                     lxlsx_edit_sheet_name(second, 0));
+
+    /* Each session still saves only its own changes. */
+    assert_ok(lxlsx_edit_set_number(first, "Edit", 0, 0, 10.0));
+    assert_ok(lxlsx_edit_set_string(second, "Edit", 1, 0, "second"));
+    assert_ok(lxlsx_edit_save_as(first, TEMPLATE_OUT_XLSX));
+    assert_ok(lxlsx_edit_save_as(second, TEMPLATE_OUT2_XLSX));
+    assert_number_cell(TEMPLATE_OUT_XLSX, 1, 1, 10.0);
+    assert_number_cell(TEMPLATE_OUT2_XLSX, 1, 1, 1.0);
+    assert_string_cell(TEMPLATE_OUT2_XLSX, 2, 1, "second");
+
+    /* Closing one session leaves the shared template usable. */
+    lxlsx_edit_close(first);
+    assert_ok(lxlsx_edit_save_as(second, TEMPLATE_OUT2_XLSX));
+    assert_string_cell(TEMPLATE_OUT2_XLSX, 2, 1, "second");
+
+    /* A rewritten template is read again. */
+    write_edit_workbook(TEMPLATE_XLSX, 2.0, 222.0);
+    third = lxlsx_edit_open_opt(TEMPLATE_XLSX, &options);
+    TEST_ASSERT_NOT_NULL(third);
+    TEST_ASSERT_TRUE(lxlsx_edit_sheet_name(third, 0) !=
+                     lxlsx_edit_sheet_name(second, 0));
+    assert_ok(lxlsx_edit_save_as(third, TEMPLATE_OUT_XLSX));
+    assert_number_cell(TEMPLATE_OUT_XLSX, 1, 1, 2.0);
+    lxlsx_edit_close(second);
+    lxlsx_edit_close(third);
+
+    /* Templates over the budget are not kept. */
+    lxlsx_edit_template_cache_limit(1);
+    first = lxlsx_edit_open_opt(TEMPLATE_XLSX, &options);
+    second = lxlsx_edit_open_opt(TEMPLATE_XLSX, &options);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_TRUE(lxlsx_edit_sheet_name(first, 0) !=
+                     lxlsx_edit_sheet_name(second, 0));
+    lxlsx_edit_close(first);
+    lxlsx_edit_close(second);
+    lxlsx_edit_template_cache_limit(0);
+    lxlsx_edit_template_cache_clear();
+}
+
+static double first_number(lxlsx_reader_worksheet *worksheet)
+{
+    lxlsx_cell cell;
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_worksheet_next_row(worksheet));
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_worksheet_next_cell(worksheet, &cell));
+    TEST_ASSERT_EQUAL_INT(NUMBER_CELL, cell.type);
+    return cell.data.reader.value.number;
+}
+
+static void test_edit_reader_shares_template(void)
+{
+    lxlsx_edit_open_options options = {1};
+    lxlsx_edit_template_stats before, after;
+    lxlsx_edit_session *first;
+    lxlsx_edit_session *second;
+    lxlsx_reader_workbook *first_reader = NULL;
+    lxlsx_reader_workbook *second_reader = NULL;
+    lxlsx_reader_worksheet *first_sheet = NULL;
+    lxlsx_reader_worksheet *second_sheet = NULL;
+
+    lxlsx_edit_template_cache_clear();
+    write_edit_workbook(TEMPLATE_XLSX, 3.0, 333.0);
+
+    /* Only the first open reads the template; readers parse nothing. */
+    lxlsx_edit_template_cache_stats(&before);
+    first = lxlsx_edit_open_opt(TEMPLATE_XLSX, &options);
+    second = lxlsx_edit_open_opt(TEMPLATE_XLSX, &options);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_edit_open_reader(first, &first_reader));
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_edit_open_reader(second, &second_reader));
+    lxlsx_edit_template_cache_stats(&after);
+    TEST_ASSERT_TRUE(after.misses == before.misses + 1);
+    TEST_ASSERT_TRUE(after.hits == before.hits + 1);
+    TEST_ASSERT_EQUAL_INT(1, after.entries);
+    TEST_ASSERT_TRUE(lxlsx_reader_workbook_sheet_name(first_reader, 0) ==
+                     lxlsx_edit_sheet_name(first, 0));
+
+    /* The readers stream their worksheets side by side. */
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_workbook_get_worksheet_by_name(
+                              first_reader, "Edit", LXLSX_READER_SKIP_NONE,
+                              &first_sheet));
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_workbook_get_worksheet_by_name(
+                              second_reader, "Edit", LXLSX_READER_SKIP_NONE,
+                              &second_sheet));
+    TEST_ASSERT_EQUAL_DOUBLE(3.0, first_number(first_sheet));
+    TEST_ASSERT_EQUAL_DOUBLE(3.0, first_number(second_sheet));
+
+    /* Sessions still save while their readers are open. */
+    assert_ok(lxlsx_edit_set_number(first, "Edit", 0, 0, 30.0));
+    assert_ok(lxlsx_edit_save_as(first, TEMPLATE_OUT_XLSX));
+    assert_number_cell(TEMPLATE_OUT_XLSX, 1, 1, 30.0);
+
+    lxlsx_reader_worksheet_close(first_sheet);
+    lxlsx_reader_worksheet_close(second_sheet);
+    lxlsx_reader_workbook_close(first_reader);
+    lxlsx_reader_workbook_close(second_reader);
+    lxlsx_edit_close(first);
+    lxlsx_edit_close(second);
+    lxlsx_edit_template_cache_clear();
+}
+
+static void write_concat_base(const char *path, int cover)
+{
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+    lxlsx_format *bold;
+
+    remove(path);
+    workbook = lxlsx_workbook_new(path);
+    TEST_ASSERT_NOT_NULL(workbook);
+    bold = lxlsx_workbook_add_format(workbook);
+    lxlsx_format_set_bold(bold);
+    if (cover)
+        TEST_ASSERT_NOT_NULL(lxlsx_workbook_add_worksheet(workbook, "Cover"));
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Data");
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 0, 0, "one", bold));
+    assert_ok(lxlsx_worksheet_write_number(worksheet, 0, 1, 1, NULL));
+    assert_ok(lxlsx_worksheet_write_number(worksheet, 1, 1, 2, NULL));
+    assert_ok(lxlsx_worksheet_add_table(worksheet, 3, 0, 4, 1, NULL));
+    assert_ok(lxlsx_workbook_close(workbook));
+}
+
+static void write_concat_other(const char *path)
+{
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+    lxlsx_format *italic;
+    lxlsx_format *decimals;
+
+    remove(path);
+    workbook = lxlsx_workbook_new(path);
+    TEST_ASSERT_NOT_NULL(workbook);
+    italic = lxlsx_workbook_add_format(workbook);
+    lxlsx_format_set_italic(italic);
+    decimals = lxlsx_workbook_add_format(workbook);
+    lxlsx_format_set_num_format(decimals, "0.000");
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Data");
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 0, 0, "two", italic));
+    assert_ok(lxlsx_worksheet_write_number(worksheet, 0, 1, 2.5, decimals));
+    assert_ok(lxlsx_worksheet_write_number(worksheet, 1, 1, 3, NULL));
+    assert_ok(lxlsx_worksheet_add_table(worksheet, 3, 0, 4, 1, NULL));
+    assert_ok(lxlsx_worksheet_write_comment(worksheet, 0, 0, "note"));
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Notes");
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 0, 0, "one", NULL));
+    assert_ok(lxlsx_workbook_close(workbook));
+}
+
+static const lxlsx_source_package_entry_info *
+find_entry(lxlsx_source_package *package, const char *name)
+{
+    int index = lxlsx_source_package_find_first(package, name);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, index >= 0, name);
+    return lxlsx_source_package_entry_info_at(package, (size_t)index);
+}
+
+static unsigned char *read_part_xml(lxlsx_source_package *package,
+                                    const char *name)
+{
+    unsigned char *xml = NULL;
+    size_t len = 0;
+    int index = lxlsx_source_package_find_first(package, name);
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, index >= 0, name);
+    assert_ok(lxlsx_source_package_read_entry(package, (size_t)index,
+                                              &xml, &len));
+    return xml;
+}
+
+static void test_edit_concat_workbooks(void)
+{
+    const char *paths[3];
+    lxlsx_edit_session *session;
+    lxlsx_source_package *out = NULL;
+    lxlsx_source_package *copied = NULL;
+    const lxlsx_source_package_entry_info *source_info;
+    const lxlsx_source_package_entry_info *out_info;
+    unsigned char *xml;
+
+    write_concat_base(CONCAT_A_XLSX, 0);
+    write_concat_other(CONCAT_B_XLSX);
+    write_concat_base(CONCAT_C_XLSX, 1);
+    remove(CONCAT_OUT_XLSX);
+
+    paths[0] = CONCAT_A_XLSX;
+    paths[1] = CONCAT_B_XLSX;
+    paths[2] = CONCAT_C_XLSX;
+    assert_ok(lxlsx_edit_concat(paths, 3, CONCAT_OUT_XLSX));
+
+    session = lxlsx_edit_open(CONCAT_OUT_XLSX);
+    TEST_ASSERT_NOT_NULL(session);
+    TEST_ASSERT_EQUAL_size_t(5, lxlsx_edit_sheet_count(session));
+    TEST_ASSERT_EQUAL_STRING("Data", lxlsx_edit_sheet_name(session, 0));
+    TEST_ASSERT_EQUAL_STRING("Data (2)", lxlsx_edit_sheet_name(session, 1));
+    TEST_ASSERT_EQUAL_STRING("Notes", lxlsx_edit_sheet_name(session, 2));
+    TEST_ASSERT_EQUAL_STRING("Cover", lxlsx_edit_sheet_name(session, 3));
+    TEST_ASSERT_EQUAL_STRING("Data (3)", lxlsx_edit_sheet_name(session, 4));
+    lxlsx_edit_close(session);
+
+    assert_string_cell_in_sheet(CONCAT_OUT_XLSX, "Data", 1, 1, "one");
+    assert_string_cell_in_sheet(CONCAT_OUT_XLSX, "Data (2)", 1, 1, "two");
+    assert_number_cell_in_sheet(CONCAT_OUT_XLSX, "Data (2)", 1, 2, 2.5);
+    assert_string_cell_in_sheet(CONCAT_OUT_XLSX, "Notes", 1, 1, "one");
+    assert_string_cell_in_sheet(CONCAT_OUT_XLSX, "Data (3)", 1, 1, "one");
+    assert_number_cell_in_sheet(CONCAT_OUT_XLSX, "Data (3)", 2, 2, 2);
+
+    assert_ok(lxlsx_source_package_open(CONCAT_OUT_XLSX, &out));
+
+    /* The last file has the base's styles and strings: its unselected sheet
+     * is copied without being recompressed. */
+    assert_ok(lxlsx_source_package_open(CONCAT_C_XLSX, &copied));
+    source_info = find_entry(copied, "xl/worksheets/sheet2.xml");
+    out_info = find_entry(out, "xl/worksheets/sheet5.xml");
+    TEST_ASSERT_EQUAL_INT((int)source_info->crc32, (int)out_info->crc32);
+    TEST_ASSERT_TRUE(source_info->compressed_size == out_info->compressed_size);
+    lxlsx_source_package_close(copied);
+
+    /* The other file's styles are merged; its cells point at them. */
+    xml = read_part_xml(out, "xl/styles.xml");
+    assert_xml_contains(xml, "<i/>");
+    assert_xml_contains(xml, "formatCode=\"0.000\"");
+    free(xml);
+
+    /* Its table is renumbered and renamed, its comments come along. */
+    xml = read_part_xml(out, "xl/tables/table2.xml");
+    assert_xml_contains(xml, "id=\"2\"");
+    assert_xml_contains(xml, "displayName=\"Table1_2\"");
+    free(xml);
+    xml = read_part_xml(out, "xl/worksheets/_rels/sheet2.xml.rels");
+    assert_xml_contains(xml, "Target=\"../tables/table2.xml\"");
+    assert_xml_contains(xml, "Target=\"../comments1.xml\"");
+    free(xml);
+    xml = read_part_xml(out, "[Content_Types].xml");
+    assert_xml_contains(xml, "PartName=\"/xl/comments1.xml\"");
+    assert_xml_contains(xml, "PartName=\"/xl/worksheets/sheet5.xml\"");
+    assert_xml_contains(xml, "Extension=\"vml\"");
+    free(xml);
+
+    lxlsx_source_package_close(out);
+}
+
+static void test_edit_concat_default_style(void)
+{
+    const char *paths[2];
+    const char *names[2];
+    const char *xml[2];
+    lxlsx_workbook *workbook;
+    lxlsx_source_package *out = NULL;
+    unsigned char *sheet;
+
+    /* The other file's default cell format uses Arial 10, not Calibri 11. */
+    remove(CONCAT_C_XLSX);
+    workbook = lxlsx_workbook_new(CONCAT_C_XLSX);
+    TEST_ASSERT_NOT_NULL(workbook);
+    assert_ok(lxlsx_worksheet_write_number(
+        lxlsx_workbook_add_worksheet(workbook, "Plain"), 0, 0, 1, NULL));
+    assert_ok(lxlsx_workbook_close(workbook));
+
+    names[0] = "xl/styles.xml";
+    xml[0] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<styleSheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
+        "<fonts count=\"1\"><font><sz val=\"10\"/><name val=\"Arial\"/>"
+        "<family val=\"2\"/></font></fonts>"
+        "<fills count=\"2\"><fill><patternFill patternType=\"none\"/></fill>"
+        "<fill><patternFill patternType=\"gray125\"/></fill></fills>"
+        "<borders count=\"1\"><border><left/><right/><top/><bottom/>"
+        "<diagonal/></border></borders>"
+        "<cellStyleXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\""
+        " borderId=\"0\"/></cellStyleXfs>"
+        "<cellXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\""
+        " borderId=\"0\" xfId=\"0\"/></cellXfs>"
+        "<cellStyles count=\"1\"><cellStyle name=\"Normal\" xfId=\"0\""
+        " builtinId=\"0\"/></cellStyles>"
+        "<dxfs count=\"0\"/></styleSheet>";
+    names[1] = "xl/worksheets/sheet1.xml";
+    xml[1] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
+        "<dimension ref=\"A1:B1\"/>"
+        "<cols><col min=\"1\" max=\"1\" width=\"5\" customWidth=\"1\"/></cols>"
+        "<sheetData><row r=\"1\"><c r=\"A1\"><v>1</v></c><c r=\"B1\"/></row>"
+        "</sheetData></worksheet>";
+    write_parts_override(CONCAT_C_XLSX, CONCAT_B_XLSX, names, xml, 2);
+
+    write_concat_base(CONCAT_A_XLSX, 0);
+    remove(CONCAT_OUT_XLSX);
+    paths[0] = CONCAT_A_XLSX;
+    paths[1] = CONCAT_B_XLSX;
+    assert_ok(lxlsx_edit_concat(paths, 2, CONCAT_OUT_XLSX));
+    assert_number_cell_in_sheet(CONCAT_OUT_XLSX, "Plain", 1, 1, 1);
+
+    /* Cells, rows and columns without a style get the Arial one, the xf
+     * after the base's default and bold ones. */
+    assert_ok(lxlsx_source_package_open(CONCAT_OUT_XLSX, &out));
+    sheet = read_part_xml(out, "xl/worksheets/sheet2.xml");
+    assert_xml_contains(sheet, "<col min=\"1\" max=\"1\" width=\"5\""
+                               " customWidth=\"1\" style=\"2\"/>");
+    assert_xml_contains(sheet, "<row r=\"1\" s=\"2\">");
+    assert_xml_contains(sheet, "<c r=\"A1\" s=\"2\"><v>1</v></c>");
+    assert_xml_contains(sheet, "<c r=\"B1\" s=\"2\"/>");
+    free(sheet);
+    sheet = read_part_xml(out, "xl/styles.xml");
+    assert_xml_contains(sheet, "<name val=\"Arial\"/>");
+    free(sheet);
+    lxlsx_source_package_close(out);
+}
+
+static void write_extract_source(const char *path)
+{
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+
+    remove(path);
+    workbook = lxlsx_workbook_new(path);
+    TEST_ASSERT_NOT_NULL(workbook);
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Data");
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 0, 0, "two", NULL));
+    assert_ok(lxlsx_worksheet_add_table(worksheet, 3, 0, 4, 1, NULL));
+    assert_ok(lxlsx_worksheet_write_comment(worksheet, 0, 0, "note"));
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Notes");
+    assert_ok(lxlsx_worksheet_write_string(worksheet, 0, 0, "one", NULL));
+    assert_ok(lxlsx_worksheet_write_number(worksheet, 0, 1, 4, NULL));
+    assert_ok(lxlsx_worksheet_add_table(worksheet, 3, 0, 4, 1, NULL));
+    assert_ok(lxlsx_workbook_define_name(workbook, "Global", "=Data!$A$1"));
+    assert_ok(lxlsx_workbook_define_name(workbook, "Other", "=Notes!$A$1"));
+    assert_ok(lxlsx_workbook_define_name(workbook, "Data!Mine", "=Data!$A$1"));
+    assert_ok(lxlsx_workbook_define_name(workbook, "Notes!Local", "=Notes!$B$1"));
+    assert_ok(lxlsx_workbook_close(workbook));
+}
+
+static void test_edit_extract_sheet(void)
+{
+    lxlsx_edit_session *session;
+    lxlsx_source_package *out = NULL;
+    lxlsx_source_package *source = NULL;
+    const lxlsx_source_package_entry_info *source_info;
+    const lxlsx_source_package_entry_info *out_info;
+    unsigned char *xml;
+
+    write_extract_source(EXTRACT_XLSX);
+    remove(EXTRACT_OUT_XLSX);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_WORKSHEET_INDEX_OUT_OF_RANGE,
+                          lxlsx_edit_extract_sheet(EXTRACT_XLSX, "Missing",
+                                                   EXTRACT_OUT_XLSX));
+    assert_ok(lxlsx_edit_extract_sheet(EXTRACT_XLSX, "Notes", EXTRACT_OUT_XLSX));
+
+    session = lxlsx_edit_open(EXTRACT_OUT_XLSX);
+    TEST_ASSERT_NOT_NULL(session);
+    TEST_ASSERT_EQUAL_size_t(1, lxlsx_edit_sheet_count(session));
+    TEST_ASSERT_EQUAL_STRING("Notes", lxlsx_edit_sheet_name(session, 0));
+    lxlsx_edit_close(session);
+    assert_string_cell_in_sheet(EXTRACT_OUT_XLSX, "Notes", 1, 1, "one");
+    assert_number_cell_in_sheet(EXTRACT_OUT_XLSX, "Notes", 1, 2, 4);
+
+    /* The sheet and its table are copied without being recompressed. */
+    assert_ok(lxlsx_source_package_open(EXTRACT_XLSX, &source));
+    assert_ok(lxlsx_source_package_open(EXTRACT_OUT_XLSX, &out));
+    source_info = find_entry(source, "xl/worksheets/sheet2.xml");
+    out_info = find_entry(out, "xl/worksheets/sheet2.xml");
+    TEST_ASSERT_EQUAL_INT((int)source_info->crc32, (int)out_info->crc32);
+    TEST_ASSERT_TRUE(source_info->compressed_size == out_info->compressed_size);
+    TEST_ASSERT_NOT_NULL(find_entry(out, "xl/tables/table2.xml"));
+    TEST_ASSERT_NOT_NULL(find_entry(out, "xl/styles.xml"));
+    lxlsx_source_package_close(source);
+
+    /* The other sheet and the parts only it reaches are left out. */
+    TEST_ASSERT_TRUE(lxlsx_source_package_find_first(out, "xl/worksheets/sheet1.xml") < 0);
+    TEST_ASSERT_TRUE(lxlsx_source_package_find_first(out, "xl/tables/table1.xml") < 0);
+    TEST_ASSERT_TRUE(lxlsx_source_package_find_first(out, "xl/comments1.xml") < 0);
+
+    xml = read_part_xml(out, "xl/workbook.xml");
+    TEST_ASSERT_NULL(strstr((const char *)xml, "name=\"Data\""));
+    TEST_ASSERT_NULL(strstr((const char *)xml, "Global"));
+    TEST_ASSERT_NULL(strstr((const char *)xml, "Mine"));
+    assert_xml_contains(xml, "name=\"Other\"");
+    assert_xml_contains(xml, "name=\"Local\" localSheetId=\"0\"");
+    free(xml);
+    xml = read_part_xml(out, "xl/_rels/workbook.xml.rels");
+    TEST_ASSERT_NULL(strstr((const char *)xml, "sheet1.xml"));
+    assert_xml_contains(xml, "Target=\"worksheets/sheet2.xml\"");
+    free(xml);
+    xml = read_part_xml(out, "[Content_Types].xml");
+    TEST_ASSERT_NULL(strstr((const char *)xml, "/xl/worksheets/sheet1.xml"));
+    TEST_ASSERT_NULL(strstr((const char *)xml, "/xl/comments1.xml"));
+    assert_xml_contains(xml, "PartName=\"/xl/tables/table2.xml\"");
+    free(xml);
+
+    lxlsx_source_package_close(out);
+}
+
 int main(void)
 {
     UNITY_BEGIN();
@@ -1196,6 +1995,7 @@ int main(void)
     RUN_TEST(test_edit_merge_orders_after_protection);
     RUN_TEST(test_edit_injects_number_format);
     RUN_TEST(test_edit_injects_cell_format);
+    RUN_TEST(test_edit_keeps_distinct_cell_formats);
     RUN_TEST(test_edit_sets_dimensions);
     RUN_TEST(test_edit_adds_worksheet);
     RUN_TEST(test_edit_add_sheet_via_workbook_api);
@@ -1204,5 +2004,14 @@ int main(void)
     RUN_TEST(test_edit_inserts_chart);
     RUN_TEST(test_edit_mixes_image_and_chart);
     RUN_TEST(test_edit_uses_open_time_snapshot);
+    RUN_TEST(test_edit_streams_large_sheet);
+    RUN_TEST(test_edit_appends_rows_with_shared_strings);
+    RUN_TEST(test_edit_appends_rows_inline);
+    RUN_TEST(test_edit_saves_in_place);
+    RUN_TEST(test_edit_template_cache_shares_sources);
+    RUN_TEST(test_edit_reader_shares_template);
+    RUN_TEST(test_edit_concat_workbooks);
+    RUN_TEST(test_edit_concat_default_style);
+    RUN_TEST(test_edit_extract_sheet);
     return UNITY_END();
 }
@@ -17,6 +17,11 @@ static const char *RAW_COPY_XLSX = "fixtures/edit_raw_copy.xlsx";
 static const char *DUP_ZIP = "fixtures/edit_duplicate.zip";
 static const char *DUP_NOOP_ZIP = "fixtures/edit_duplicate_noop.zip";
 static const char *ADDED_XLSX = "fixtures/edit_added.xlsx";
+static const char *STREAMED_XLSX = "fixtures/edit_streamed.xlsx";
+static const char *IN_PLACE_XLSX = "fixtures/edit_in_place.xlsx";
+static const char *ZIP64_ZIP = "fixtures/edit_zip64.zip";
+static const char *ZIP64_SAVED_ZIP = "fixtures/edit_zip64_saved.zip";
+static const char *MANY_PARTS_XLSX = "fixtures/edit_many_parts.xlsx";
 
 #define ZIP_METHOD_DEFLATE 8
 
@@ -259,7 +264,7 @@ static void test_duplicate_entries_noop_save_preserves_bytes(void)
     assert_files_equal(DUP_ZIP, DUP_NOOP_ZIP);
 }
 
-static void test_zip64_entries_are_explicitly_unsupported(void)
+static void test_malformed_zip64_entries_are_rejected(void)
 {
     unsigned char data[46 + 5 + 4 + 22];
     size_t pos = 0;
@@ -302,11 +307,223 @@ static void test_zip64_entries_are_explicitly_unsupported(void)
 #undef PUT16
 #undef PUT32
 
-    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_FEATURE_NOT_SUPPORTED,
+    /* The sizes and offset point at a ZIP64 extra field with no data. */
+    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_ZIP_BAD_ZIP_FILE,
                           lxlsx_source_package_open_memory(data, pos, &package));
     TEST_ASSERT_NULL(package);
 }
 
+static void put_le64_file(FILE *fp, unsigned long value)
+{
+    put_le32_file(fp, value);
+    put_le32_file(fp, 0);
+}
+
+/* Two STORE entries written the way ZIP64 writers do: 0xffffffff in every
+ * 32-bit size and offset field, the real values in ZIP64 extra fields, and a
+ * ZIP64 end of central directory record. */
+static void write_zip64_zip(void)
+{
+    static const char *names[2] = { "a.txt", "b.txt" };
+    static const char *payloads[2] = { "zip64 first", "zip64 second part" };
+    unsigned long offsets[2];
+    unsigned long crcs[2];
+    unsigned long central_offset;
+    unsigned long central_end;
+    FILE *fp;
+    int i;
+
+    remove(ZIP64_ZIP);
+    fp = fopen(ZIP64_ZIP, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+
+    for (i = 0; i < 2; i++) {
+        size_t len = strlen(payloads[i]);
+
+        offsets[i] = (unsigned long)ftell(fp);
+        crcs[i] = crc32(0L, Z_NULL, 0);
+        crcs[i] = crc32(crcs[i], (const Bytef *)payloads[i], (uInt)len);
+        put_le32_file(fp, 0x04034b50UL);
+        put_le16_file(fp, 45);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le32_file(fp, crcs[i]);
+        put_le32_file(fp, 0xffffffffUL);
+        put_le32_file(fp, 0xffffffffUL);
+        put_le16_file(fp, 5);
+        put_le16_file(fp, 20);
+        TEST_ASSERT_EQUAL_INT(5, (int)fwrite(names[i], 1, 5, fp));
+        put_le16_file(fp, 0x0001);
+        put_le16_file(fp, 16);
+        put_le64_file(fp, (unsigned long)len);
+        put_le64_file(fp, (unsigned long)len);
+        TEST_ASSERT_EQUAL_INT((int)len, (int)fwrite(payloads[i], 1, len, fp));
+    }
+
+    central_offset = (unsigned long)ftell(fp);
+    for (i = 0; i < 2; i++) {
+        size_t len = strlen(payloads[i]);
+
+        put_le32_file(fp, 0x02014b50UL);
+        put_le16_file(fp, 45);
+        put_le16_file(fp, 45);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le32_file(fp, crcs[i]);
+        put_le32_file(fp, 0xffffffffUL);
+        put_le32_file(fp, 0xffffffffUL);
+        put_le16_file(fp, 5);
+        put_le16_file(fp, 28);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le16_file(fp, 0);
+        put_le32_file(fp, 0);
+        put_le32_file(fp, 0xffffffffUL);
+        TEST_ASSERT_EQUAL_INT(5, (int)fwrite(names[i], 1, 5, fp));
+        put_le16_file(fp, 0x0001);
+        put_le16_file(fp, 24);
+        put_le64_file(fp, (unsigned long)len);
+        put_le64_file(fp, (unsigned long)len);
+        put_le64_file(fp, offsets[i]);
+    }
+    central_end = (unsigned long)ftell(fp);
+
+    put_le32_file(fp, 0x06064b50UL);
+    put_le64_file(fp, 44);
+    put_le16_file(fp, 45);
+    put_le16_file(fp, 45);
+    put_le32_file(fp, 0);
+    put_le32_file(fp, 0);
+    put_le64_file(fp, 2);
+    put_le64_file(fp, 2);
+    put_le64_file(fp, central_end - central_offset);
+    put_le64_file(fp, central_offset);
+
+    put_le32_file(fp, 0x07064b50UL);
+    put_le32_file(fp, 0);
+    put_le64_file(fp, central_end);
+    put_le32_file(fp, 1);
+
+    put_le32_file(fp, 0x06054b50UL);
+    put_le16_file(fp, 0);
+    put_le16_file(fp, 0);
+    put_le16_file(fp, 0xffff);
+    put_le16_file(fp, 0xffff);
+    put_le32_file(fp, 0xffffffffUL);
+    put_le32_file(fp, 0xffffffffUL);
+    put_le16_file(fp, 0);
+
+    fclose(fp);
+}
+
+static void test_zip64_package_round_trips(void)
+{
+    lxlsx_source_package *package = NULL;
+    lxlsx_source_package *saved = NULL;
+    lxlsx_source_package_replacement repl;
+    const lxlsx_source_package_entry_info *info;
+    const char *replaced = "replaced";
+    unsigned char *content = NULL;
+    size_t content_len = 0;
+
+    write_zip64_zip();
+    remove(ZIP64_SAVED_ZIP);
+
+    assert_ok(lxlsx_source_package_open(ZIP64_ZIP, &package));
+    TEST_ASSERT_EQUAL_size_t(2, lxlsx_source_package_entry_count(package));
+    info = lxlsx_source_package_entry_info_at(package, 1);
+    TEST_ASSERT_NOT_NULL(info);
+    TEST_ASSERT_EQUAL_INT(17, (int)info->uncompressed_size);
+    assert_ok(lxlsx_source_package_read_entry(package, 1, &content, &content_len));
+    TEST_ASSERT_EQUAL_size_t(17, content_len);
+    TEST_ASSERT_EQUAL_INT(0, memcmp("zip64 second part", content, content_len));
+    free(content);
+
+    repl.entry_index = 0;
+    repl.data = (const unsigned char *)replaced;
+    repl.size = strlen(replaced);
+    assert_ok(lxlsx_source_package_save_with_replacements(package, ZIP64_SAVED_ZIP,
+                                                          &repl, 1));
+    lxlsx_source_package_close(package);
+
+    /* The preserved entry keeps its ZIP64 local record; both still read. */
+    assert_ok(lxlsx_source_package_open(ZIP64_SAVED_ZIP, &saved));
+    assert_ok(lxlsx_source_package_read_entry(saved, 0, &content, &content_len));
+    TEST_ASSERT_EQUAL_STRING(replaced, (const char *)content);
+    free(content);
+    assert_ok(lxlsx_source_package_read_entry(saved, 1, &content, &content_len));
+    TEST_ASSERT_EQUAL_size_t(17, content_len);
+    TEST_ASSERT_EQUAL_INT(0, memcmp("zip64 second part", content, content_len));
+    free(content);
+    lxlsx_source_package_close(saved);
+}
+
+#define MANY_PARTS 65535
+
+static void test_many_additions_write_zip64_directory(void)
+{
+    lxlsx_source_package *package = NULL;
+    lxlsx_source_package *saved = NULL;
+    lxlsx_source_package_addition *adds;
+    char (*names)[32];
+    unsigned char *data;
+    unsigned char *content = NULL;
+    size_t data_len = 0;
+    size_t content_len = 0;
+    size_t source_count;
+    size_t i;
+    int idx;
+
+    write_source_workbook();
+    remove(MANY_PARTS_XLSX);
+
+    adds = (lxlsx_source_package_addition *)calloc(MANY_PARTS, sizeof(*adds));
+    names = calloc(MANY_PARTS, sizeof(*names));
+    TEST_ASSERT_NOT_NULL(adds);
+    TEST_ASSERT_NOT_NULL(names);
+    for (i = 0; i < MANY_PARTS; i++) {
+        snprintf(names[i], sizeof(names[i]), "xl/media/image%u.png", (unsigned)i);
+        adds[i].name = names[i];
+        adds[i].data = (const unsigned char *)names[i];
+        adds[i].size = strlen(names[i]);
+    }
+
+    assert_ok(lxlsx_source_package_open(SOURCE_XLSX, &package));
+    source_count = lxlsx_source_package_entry_count(package);
+    assert_ok(lxlsx_source_package_save_with_changes(package, MANY_PARTS_XLSX,
+                                                     NULL, 0, adds, MANY_PARTS));
+    lxlsx_source_package_close(package);
+
+    /* Too many entries for the classic EOCD: it holds sentinels and a ZIP64
+     * record with its locator precedes it. */
+    data = slurp(MANY_PARTS_XLSX, &data_len);
+    TEST_ASSERT_EQUAL_INT(0xff, data[data_len - 22 + 10]);
+    TEST_ASSERT_EQUAL_INT(0xff, data[data_len - 22 + 11]);
+    TEST_ASSERT_EQUAL_INT(0x50, data[data_len - 42]);
+    TEST_ASSERT_EQUAL_INT(0x4b, data[data_len - 41]);
+    TEST_ASSERT_EQUAL_INT(0x06, data[data_len - 40]);
+    TEST_ASSERT_EQUAL_INT(0x07, data[data_len - 39]);
+    free(data);
+
+    assert_ok(lxlsx_source_package_open(MANY_PARTS_XLSX, &saved));
+    TEST_ASSERT_EQUAL_size_t(source_count + MANY_PARTS,
+                             lxlsx_source_package_entry_count(saved));
+    idx = lxlsx_source_package_find_first(saved, "xl/media/image65534.png");
+    TEST_ASSERT_TRUE(idx >= 0);
+    assert_ok(lxlsx_source_package_read_entry(saved, (size_t)idx,
+                                              &content, &content_len));
+    TEST_ASSERT_EQUAL_INT(0, memcmp(names[MANY_PARTS - 1], content, content_len));
+    free(content);
+    lxlsx_source_package_close(saved);
+
+    free(names);
+    free(adds);
+}
+
 static void test_save_with_additions_appends_new_part(void)
 {
     lxlsx_source_package *package = NULL, *saved = NULL;
@@ -320,6 +537,7 @@ static void test_save_with_additions_appends_new_part(void)
     remove(ADDED_XLSX);
 
     assert_ok(lxlsx_source_package_open(SOURCE_XLSX, &package));
+    memset(&add, 0, sizeof(add));
     add.name = "xl/extra.xml";
     add.data = (const unsigned char *)payload;
     add.size = strlen(payload);
@@ -339,13 +557,240 @@ static void test_save_with_additions_appends_new_part(void)
     lxlsx_source_package_close(saved);
 }
 
+static const char STREAM_SUFFIX[] = "\n<!-- edit replacement -->\n";
+
+/* Copy the entry through in small pieces, then append a suffix. */
+static lxlsx_error append_suffix_transform(void *ctx,
+                                           lxlsx_source_package_entry_stream *in,
+                                           lxlsx_source_package_sink *out)
+{
+    unsigned char chunk[7];
+    size_t got = 0;
+    size_t *total = (size_t *)ctx;
+    lxlsx_error err;
+
+    do {
+        err = lxlsx_source_package_entry_stream_read(in, chunk, sizeof(chunk),
+                                                     &got);
+        if (err == LXLSX_NO_ERROR)
+            err = lxlsx_source_package_sink_write(out, chunk, got);
+        if (err != LXLSX_NO_ERROR)
+            return err;
+        *total += got;
+    } while (got > 0);
+
+    return lxlsx_source_package_sink_write(out, STREAM_SUFFIX,
+                                           sizeof(STREAM_SUFFIX) - 1);
+}
+
+static void test_streamed_replacement_matches_buffered(void)
+{
+    lxlsx_source_package *source = NULL;
+    lxlsx_source_package *saved = NULL;
+    lxlsx_source_package_replacement repl;
+    lxlsx_source_package_stream_replacement stream;
+    unsigned char *sheet_xml = NULL;
+    unsigned char *replacement;
+    unsigned char *content = NULL;
+    size_t sheet_xml_len = 0;
+    size_t content_len = 0;
+    size_t streamed = 0;
+    int sheet_index;
+
+    write_source_workbook();
+    remove(RAW_COPY_XLSX);
+    remove(STREAMED_XLSX);
+
+    assert_ok(lxlsx_source_package_open(SOURCE_XLSX, &source));
+    sheet_index = lxlsx_source_package_find_first(source, "xl/worksheets/sheet1.xml");
+    TEST_ASSERT_GREATER_OR_EQUAL_INT(0, sheet_index);
+
+    assert_ok(lxlsx_source_package_read_entry(source, (size_t)sheet_index,
+                                              &sheet_xml, &sheet_xml_len));
+    replacement = (unsigned char *)malloc(sheet_xml_len + sizeof(STREAM_SUFFIX));
+    TEST_ASSERT_NOT_NULL(replacement);
+    memcpy(replacement, sheet_xml, sheet_xml_len);
+    memcpy(replacement + sheet_xml_len, STREAM_SUFFIX, sizeof(STREAM_SUFFIX) - 1);
+
+    repl.entry_index = (size_t)sheet_index;
+    repl.data = replacement;
+    repl.size = sheet_xml_len + sizeof(STREAM_SUFFIX) - 1;
+    assert_ok(lxlsx_source_package_save_with_replacements(
+        source, RAW_COPY_XLSX, &repl, 1));
+
+    stream.entry_index = (size_t)sheet_index;
+    stream.transform = append_suffix_transform;
+    stream.ctx = &streamed;
+    assert_ok(lxlsx_source_package_save_streamed(source, STREAMED_XLSX,
+                                                 NULL, 0, &stream, 1,
+                                                 NULL, 0));
+    TEST_ASSERT_EQUAL_size_t(sheet_xml_len, streamed);
+
+    /* Same bytes as the buffered path, including the patched local header. */
+    assert_files_equal(RAW_COPY_XLSX, STREAMED_XLSX);
+
+    assert_ok(lxlsx_source_package_open(STREAMED_XLSX, &saved));
+    assert_ok(lxlsx_source_package_read_entry(saved, (size_t)sheet_index,
+                                              &content, &content_len));
+    TEST_ASSERT_EQUAL_size_t(repl.size, content_len);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(replacement, content, content_len));
+
+    lxlsx_source_package_free_buffer(content);
+    lxlsx_source_package_free_buffer(sheet_xml);
+    free(replacement);
+    lxlsx_source_package_close(saved);
+    lxlsx_source_package_close(source);
+}
+
+static void write_file(const char *path, const unsigned char *data, size_t len)
+{
+    FILE *fp = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL_size_t(len, fwrite(data, 1, len, fp));
+    fclose(fp);
+}
+
+/* Offset of the central directory recorded in a comment-less EOCD. */
+static size_t eocd_central_offset(const unsigned char *data, size_t len)
+{
+    const unsigned char *p = data + len - 22 + 16;
+    return (size_t)p[0] | ((size_t)p[1] << 8) | ((size_t)p[2] << 16) |
+           ((size_t)p[3] << 24);
+}
+
+static void test_in_place_save_appends_changed_parts(void)
+{
+    lxlsx_source_package *package = NULL;
+    lxlsx_source_package *saved = NULL;
+    lxlsx_source_package_replacement repl;
+    lxlsx_source_package_addition add;
+    const char *payload = "<x>hi</x>";
+    const char *sheet = "<worksheet>in place</worksheet>";
+    unsigned char *original;
+    unsigned char *data;
+    unsigned char *content = NULL;
+    size_t original_len = 0;
+    size_t data_len = 0;
+    size_t content_len = 0;
+    size_t central_offset;
+    int sheet_index;
+    int idx;
+
+    write_source_workbook();
+    original = slurp(SOURCE_XLSX, &original_len);
+    write_file(IN_PLACE_XLSX, original, original_len);
+    central_offset = eocd_central_offset(original, original_len);
+
+    assert_ok(lxlsx_source_package_open(IN_PLACE_XLSX, &package));
+    sheet_index = lxlsx_source_package_find_first(package, "xl/worksheets/sheet1.xml");
+    TEST_ASSERT_GREATER_OR_EQUAL_INT(0, sheet_index);
+    repl.entry_index = (size_t)sheet_index;
+    repl.data = (const unsigned char *)sheet;
+    repl.size = strlen(sheet);
+    memset(&add, 0, sizeof(add));
+    add.name = "xl/extra.xml";
+    add.data = (const unsigned char *)payload;
+    add.size = strlen(payload);
+    assert_ok(lxlsx_source_package_save_in_place(package, IN_PLACE_XLSX,
+                                                 &repl, 1, NULL, 0,
+                                                 &add, 1, 0));
+    lxlsx_source_package_close(package);
+
+    /* Everything before the old central directory is left as it was. */
+    data = slurp(IN_PLACE_XLSX, &data_len);
+    TEST_ASSERT_TRUE(data_len > central_offset);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(original, data, central_offset));
+    TEST_ASSERT_TRUE(eocd_central_offset(data, data_len) > central_offset);
+    free(data);
+
+    assert_ok(lxlsx_source_package_open(IN_PLACE_XLSX, &saved));
+    assert_ok(lxlsx_source_package_read_entry(saved, (size_t)sheet_index,
+                                              &content, &content_len));
+    TEST_ASSERT_EQUAL_STRING(sheet, (const char *)content);
+    free(content);
+    idx = lxlsx_source_package_find_first(saved, "xl/extra.xml");
+    TEST_ASSERT_TRUE(idx >= 0);
+    assert_ok(lxlsx_source_package_read_entry(saved, (size_t)idx,
+                                              &content, &content_len));
+    TEST_ASSERT_EQUAL_STRING(payload, (const char *)content);
+    free(content);
+
+    /* Past the compaction ratio the package is rewritten without the dead
+     * sheet record, as a save to a new path would be. */
+    remove(RAW_COPY_XLSX);
+    assert_ok(lxlsx_source_package_save_with_replacements(saved, RAW_COPY_XLSX,
+                                                          &repl, 1));
+    assert_ok(lxlsx_source_package_save_in_place(saved, IN_PLACE_XLSX,
+                                                 &repl, 1, NULL, 0,
+                                                 NULL, 0, 0.0001));
+    lxlsx_source_package_close(saved);
+    assert_files_equal(RAW_COPY_XLSX, IN_PLACE_XLSX);
+
+    free(original);
+}
+
+/* A package keeps reading its snapshot after a save replaces its file. */
+static void test_save_over_source_keeps_package_readable(void)
+{
+    lxlsx_source_package *package = NULL;
+    lxlsx_source_package *saved = NULL;
+    lxlsx_source_package_replacement repl;
+    const char *sheet = "<worksheet>replaced</worksheet>";
+    unsigned char *before = NULL, *after = NULL;
+    size_t before_len = 0, after_len = 0;
+    int styles;
+    int sheet_index;
+
+    write_source_workbook();
+    remove(RAW_COPY_XLSX);
+    assert_ok(lxlsx_source_package_open(SOURCE_XLSX, &package));
+    assert_ok(lxlsx_source_package_save_copy(package, RAW_COPY_XLSX));
+    lxlsx_source_package_close(package);
+
+    assert_ok(lxlsx_source_package_open(RAW_COPY_XLSX, &package));
+    styles = lxlsx_source_package_find_first(package, "xl/styles.xml");
+    sheet_index = lxlsx_source_package_find_first(package, "xl/worksheets/sheet1.xml");
+    TEST_ASSERT_TRUE(styles >= 0 && sheet_index >= 0);
+    assert_ok(lxlsx_source_package_read_entry(package, (size_t)styles,
+                                              &before, &before_len));
+
+    repl.entry_index = (size_t)sheet_index;
+    repl.data = (const unsigned char *)sheet;
+    repl.size = strlen(sheet);
+    assert_ok(lxlsx_source_package_save_with_replacements(package, RAW_COPY_XLSX,
+                                                          &repl, 1));
+    assert_ok(lxlsx_source_package_save_copy(package, RAW_COPY_XLSX));
+    assert_ok(lxlsx_source_package_save_with_replacements(package, RAW_COPY_XLSX,
+                                                          &repl, 1));
+
+    assert_ok(lxlsx_source_package_read_entry(package, (size_t)styles,
+                                              &after, &after_len));
+    TEST_ASSERT_EQUAL_size_t(before_len, after_len);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(before, after, before_len));
+    free(after);
+    lxlsx_source_package_close(package);
+
+    assert_ok(lxlsx_source_package_open(RAW_COPY_XLSX, &saved));
+    assert_ok(lxlsx_source_package_read_entry(saved, (size_t)sheet_index,
+                                              &after, &after_len));
+    TEST_ASSERT_EQUAL_STRING(sheet, (const char *)after);
+    free(after);
+    free(before);
+    lxlsx_source_package_close(saved);
+}
+
 int main(void)
 {
     UNITY_BEGIN();
     RUN_TEST(test_noop_save_is_byte_identical);
     RUN_TEST(test_replacement_preserves_untouched_raw_local_record);
     RUN_TEST(test_duplicate_entries_noop_save_preserves_bytes);
-    RUN_TEST(test_zip64_entries_are_explicitly_unsupported);
+    RUN_TEST(test_malformed_zip64_entries_are_rejected);
+    RUN_TEST(test_zip64_package_round_trips);
+    RUN_TEST(test_many_additions_write_zip64_directory);
     RUN_TEST(test_save_with_additions_appends_new_part);
+    RUN_TEST(test_streamed_replacement_matches_buffered);
+    RUN_TEST(test_in_place_save_appends_changed_parts);
+    RUN_TEST(test_save_over_source_keeps_package_readable);
     return UNITY_END();
 }
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -85,6 +86,7 @@ static void test_aggregates(void)
     assert_num("MAX(A1:A3)", 30);
     assert_num("COUNT(A1:C1)", 1);    /* only A1 is a number */
     assert_num("COUNTA(A1:C1)", 3);   /* A1, B1, C1 non-blank */
+    assert_num("SUM(\"2\", TRUE, A1)", 13);  /* direct args coerce */
 }
 
 static void test_logical(void)
@@ -137,6 +139,284 @@ static void test_errors(void)
     assert_err("SUM(A1:A3) + 1/0", LXLSX_FERR_DIV0); /* error propagation */
 }
 
+static lxlsx_value evalf_at(lxlsx_formula_cache *cache, const char *f,
+                            lxlsx_row_t row, lxlsx_col_t col)
+{
+    lxlsx_value v;
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+                          lxlsx_formula_eval_at(cache, f, row, col, resolver, NULL, NULL, &v));
+    return v;
+}
+
+static void test_cache_relative(void)
+{
+    lxlsx_formula_cache *cache = lxlsx_formula_cache_new(0);
+    lxlsx_value v;
+    TEST_ASSERT_NOT_NULL(cache);
+
+    /* D1..D3 = A1*2..A3*2: one compile, then bound to each row. */
+    v = evalf_at(cache, "=A1*2", 0, 3);
+    TEST_ASSERT_TRUE(fabs(20 - v.number) < 1e-9);
+    v = evalf_at(cache, "A2*2", 1, 3);
+    TEST_ASSERT_TRUE(fabs(40 - v.number) < 1e-9);
+    v = evalf_at(cache, "A3*2", 2, 3);
+    TEST_ASSERT_TRUE(fabs(60 - v.number) < 1e-9);
+    TEST_ASSERT_EQUAL_INT(1, cache->misses);
+    TEST_ASSERT_EQUAL_INT(2, cache->hits);
+
+    /* Absolute rows stay put; the same text elsewhere is a different key. */
+    v = evalf_at(cache, "$A$1+A2", 1, 3);
+    TEST_ASSERT_TRUE(fabs(30 - v.number) < 1e-9);
+    v = evalf_at(cache, "$A$1+A3", 2, 3);
+    TEST_ASSERT_TRUE(fabs(40 - v.number) < 1e-9);
+    v = evalf_at(cache, "$A$1+A2", 2, 3);
+    TEST_ASSERT_TRUE(fabs(30 - v.number) < 1e-9);
+    TEST_ASSERT_EQUAL_INT(3, cache->misses);
+    TEST_ASSERT_EQUAL_INT(3, cache->hits);
+
+    /* Ranges, function names that look like references and literals. */
+    v = evalf_at(cache, "SUM(A1:A3)&\"A1\"", 5, 1);
+    TEST_ASSERT_EQUAL_STRING("60A1", v.string);
+    lxlsx_value_free(&v);
+    v = evalf_at(cache, "SUM(A2:A4)&\"A1\"", 6, 1);
+    TEST_ASSERT_EQUAL_STRING("50A1", v.string);
+    lxlsx_value_free(&v);
+    v = evalf_at(cache, "LOG10(100)+A1", 0, 1);
+    TEST_ASSERT_EQUAL_INT(LXLSX_VAL_ERROR, v.kind);  /* LOG10 isn't supported */
+    TEST_ASSERT_EQUAL_INT(4, cache->hits);
+    TEST_ASSERT_EQUAL_INT(5, cache->misses);
+
+    /* A key longer than the stack buffer still hits. */
+    {
+        char long_a[512], long_b[512];
+        size_t i, len_a = 0, len_b = 0;
+        for (i = 0; i < 100; i++) {
+            len_a += (size_t)sprintf(long_a + len_a, i ? "+A1" : "A1");
+            len_b += (size_t)sprintf(long_b + len_b, i ? "+A2" : "A2");
+        }
+        v = evalf_at(cache, long_a, 0, 3);
+        TEST_ASSERT_TRUE(fabs(1000 - v.number) < 1e-9);
+        v = evalf_at(cache, long_b, 1, 3);
+        TEST_ASSERT_TRUE(fabs(2000 - v.number) < 1e-9);
+        TEST_ASSERT_EQUAL_INT(5, cache->hits);
+        TEST_ASSERT_EQUAL_INT(6, cache->misses);
+    }
+
+    lxlsx_formula_cache_free(cache);
+}
+
+static void test_cache_bounded(void)
+{
+    lxlsx_formula_cache *cache = lxlsx_formula_cache_new(2);
+    lxlsx_value v;
+
+    v = evalf_at(cache, "1+1", 0, 0);
+    v = evalf_at(cache, "1+2", 0, 0);
+    TEST_ASSERT_EQUAL_INT(2, cache->entries);
+    v = evalf_at(cache, "1+3", 0, 0);
+    TEST_ASSERT_EQUAL_INT(1, cache->entries);
+    TEST_ASSERT_TRUE(fabs(4 - v.number) < 1e-9);
+
+    /* Unparseable formulas are cached as #NAME? too. */
+    v = evalf_at(cache, "1+(", 0, 0);
+    TEST_ASSERT_EQUAL_INT(LXLSX_FERR_NAME, v.error);
+    v = evalf_at(cache, "1+(", 4, 4);
+    TEST_ASSERT_EQUAL_INT(LXLSX_FERR_NAME, v.error);
+    TEST_ASSERT_EQUAL_INT(1, cache->hits);
+    TEST_ASSERT_EQUAL_INT(4, cache->misses);
+
+    /* Without a cache the formula is compiled for the call. */
+    v = evalf_at(NULL, "A2+1", 1, 0);
+    TEST_ASSERT_TRUE(fabs(21 - v.number) < 1e-9);
+
+    lxlsx_formula_cache_free(cache);
+}
+
+/* Range resolver over the mock grid: yields A1:A3 as one numeric run and B1,
+ * C1 as values, and records how often it was called. */
+static int range_calls;
+
+static void range_resolver(void *ctx, lxlsx_row_t first_row, lxlsx_col_t first_col,
+                           lxlsx_row_t last_row, lxlsx_col_t last_col,
+                           lxlsx_range_sink *sink)
+{
+    double numbers[3];
+    size_t count = 0;
+    lxlsx_row_t row;
+    lxlsx_value v;
+    (void) ctx;
+
+    range_calls++;
+    if (first_col == 0)
+        for (row = first_row; row <= last_row && row < 3; row++)
+            numbers[count++] = 10.0 * (row + 1);
+    if (count && !lxlsx_range_sink_numbers(sink, numbers, count))
+        return;
+
+    if (first_row == 0 && first_col <= 1 && last_col >= 1) {
+        v.kind = LXLSX_VAL_STRING; v.number = 0; v.error = LXLSX_FERR_NONE;
+        v.string = "hello";  /* borrowed */
+        if (!lxlsx_range_sink_value(sink, &v)) return;
+    }
+    if (first_row == 0 && first_col <= 2 && last_col >= 2) {
+        v.kind = LXLSX_VAL_BOOL; v.number = 1; v.string = NULL;
+        if (!lxlsx_range_sink_value(sink, &v)) return;
+    }
+    if (last_row >= 9) {
+        v.kind = LXLSX_VAL_ERROR; v.number = 0; v.string = NULL; v.error = LXLSX_FERR_NA;
+        if (!lxlsx_range_sink_value(sink, &v)) return;
+        /* Anything after the error is ignored. */
+        TEST_ASSERT_FALSE(lxlsx_range_sink_numbers(sink, numbers, 1));
+    }
+}
+
+static lxlsx_value evalf_range(const char *f)
+{
+    lxlsx_value v;
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+                          lxlsx_formula_eval_at(NULL, f, 0, 0, resolver, range_resolver,
+                                                NULL, &v));
+    return v;
+}
+
+static void test_range_resolver(void)
+{
+    lxlsx_value v;
+
+    range_calls = 0;
+    v = evalf_range("SUM(A1:A3)");
+    TEST_ASSERT_TRUE(fabs(60 - v.number) < 1e-9);
+    v = evalf_range("AVERAGE(A1:A3)+MIN(A1:A3)*1000+MAX(A3:A1)*100000");
+    TEST_ASSERT_TRUE(fabs(20 + 10000 + 3000000 - v.number) < 1e-9);
+    v = evalf_range("COUNT(A1:C1)");
+    TEST_ASSERT_TRUE(fabs(1 - v.number) < 1e-9);
+    v = evalf_range("COUNTA(A1:C1)");
+    TEST_ASSERT_TRUE(fabs(3 - v.number) < 1e-9);
+    v = evalf_range("SUM(A1:A10)");
+    TEST_ASSERT_EQUAL_INT(LXLSX_VAL_ERROR, v.kind);
+    TEST_ASSERT_EQUAL_INT(LXLSX_FERR_NA, v.error);
+    TEST_ASSERT_EQUAL_INT(7, range_calls);
+
+    /* A bare range as a scalar still reads one cell. */
+    v = evalf_range("A2:A3+1");
+    TEST_ASSERT_TRUE(fabs(21 - v.number) < 1e-9);
+    TEST_ASSERT_EQUAL_INT(7, range_calls);
+}
+
+/* Collects the references lxlsx_formula_refs_at() visits as "r1:c1:r2:c2". */
+static char refs_seen[4][32];
+static int refs_count;
+
+static void refs_visit(void *ctx, lxlsx_row_t first_row, lxlsx_col_t first_col,
+                       lxlsx_row_t last_row, lxlsx_col_t last_col)
+{
+    (void) ctx;
+    TEST_ASSERT_TRUE(refs_count < 4);
+    snprintf(refs_seen[refs_count++], sizeof(refs_seen[0]), "%u:%u:%u:%u",
+             (unsigned) first_row, (unsigned) first_col,
+             (unsigned) last_row, (unsigned) last_col);
+}
+
+static void test_formula_refs(void)
+{
+    lxlsx_formula_cache *cache = lxlsx_formula_cache_new(0);
+    TEST_ASSERT_NOT_NULL(cache);
+
+    /* Ranges come normalized; literals and function names aren't refs. */
+    refs_count = 0;
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+        lxlsx_formula_refs_at(cache, "=$A$1+SUM(C5:D2)*IF(B3,1,\"A9\")", 1, 0,
+                              refs_visit, NULL));
+    TEST_ASSERT_EQUAL_INT(3, refs_count);
+    TEST_ASSERT_EQUAL_STRING("0:0:0:0", refs_seen[0]);
+    TEST_ASSERT_EQUAL_STRING("1:2:4:3", refs_seen[1]);
+    TEST_ASSERT_EQUAL_STRING("2:1:2:1", refs_seen[2]);
+
+    /* Bound to the cell the formula is in, from the cached compiled form. */
+    refs_count = 0;
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+        lxlsx_formula_refs_at(cache, "B2*2", 1, 3, refs_visit, NULL));
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+        lxlsx_formula_refs_at(cache, "B3*2", 2, 3, refs_visit, NULL));
+    TEST_ASSERT_EQUAL_INT(2, refs_count);
+    TEST_ASSERT_EQUAL_STRING("1:1:1:1", refs_seen[0]);
+    TEST_ASSERT_EQUAL_STRING("2:1:2:1", refs_seen[1]);
+    TEST_ASSERT_EQUAL_INT(1, cache->hits);
+
+    lxlsx_formula_cache_free(cache);
+}
+
+/* Column A holds row + 1, except row 5 which holds text and row 7 a 0. */
+static void column_resolver(void *ctx, lxlsx_row_t first_row, lxlsx_col_t col,
+                            uint32_t count, double *values, uint8_t *numeric)
+{
+    uint32_t i;
+    (void) ctx;
+
+    for (i = 0; i < count; i++) {
+        lxlsx_row_t row = first_row + i;
+        values[i] = col == 0 && row != 7 ? row + 1 : 0.0;
+        numeric[i] = !(col == 0 && row == 5);
+    }
+}
+
+static void test_eval_column(void)
+{
+    lxlsx_formula_cache *cache = lxlsx_formula_cache_new(0);
+    double results[2000];
+    uint8_t done[2000];
+    char buf[64];
+    char *key;
+    size_t key_len = 0, buf_len = 0;
+    uint32_t i;
+    TEST_ASSERT_NOT_NULL(cache);
+
+    /* =A2*2+$A$1 copied from row 1 down: row r reads A(r+1). */
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+        lxlsx_formula_eval_column(cache, "=A2*2+$A$1", 1, 1, 2000,
+                                  column_resolver, NULL, results, done));
+    for (i = 0; i < 2000; i++) {
+        if (i == 4) {
+            TEST_ASSERT_EQUAL_INT(0, done[i]);
+            continue;
+        }
+        TEST_ASSERT_EQUAL_INT(1, done[i]);
+        TEST_ASSERT_EQUAL_DOUBLE(((i + 1 == 7) ? 0.0 : i + 2) * 2 + 1, results[i]);
+    }
+
+    /* Division by zero is left to the scalar engine. */
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+        lxlsx_formula_eval_column(cache, "=-1/A7%", 6, 1, 3,
+                                  column_resolver, NULL, results, done));
+    TEST_ASSERT_EQUAL_INT(1, done[0]);
+    TEST_ASSERT_EQUAL_DOUBLE(-1 / 0.07, results[0]);
+    TEST_ASSERT_EQUAL_INT(0, done[1]);
+    TEST_ASSERT_EQUAL_INT(1, done[2]);
+
+    /* Functions aren't vectorized; count 0 only checks. */
+    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_FEATURE_NOT_SUPPORTED,
+        lxlsx_formula_eval_column(cache, "=SUM(A1:A2)", 0, 1, 0,
+                                  column_resolver, NULL, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+        lxlsx_formula_eval_column(cache, "=A1^2", 0, 1, 0,
+                                  column_resolver, NULL, NULL, NULL));
+
+    TEST_ASSERT_TRUE(lxlsx_formula_same_relative("A1*2", 0, 1, "A2*2", 1, 1));
+    TEST_ASSERT_FALSE(lxlsx_formula_same_relative("A1*2", 0, 1, "A1*2", 1, 1));
+
+    /* A key too long for the buffer is allocated. */
+    key = lxlsx_formula_relative_key("=A1*2", 0, 1, buf, 2, &key_len);
+    TEST_ASSERT_NOT_NULL(key);
+    TEST_ASSERT_TRUE(key != buf);
+    TEST_ASSERT_TRUE(key_len == strlen(key));
+    TEST_ASSERT_TRUE(lxlsx_formula_relative_key("A2*2", 1, 1, buf,
+                                                sizeof(buf), &buf_len) == buf);
+    TEST_ASSERT_TRUE(key_len == buf_len && memcmp(key, buf, key_len) == 0);
+    free(key);
+
+    lxlsx_formula_cache_free(cache);
+}
+
 int main(void)
 {
     UNITY_BEGIN();
@@ -148,5 +428,10 @@ int main(void)
     RUN_TEST(test_text);
     RUN_TEST(test_math_funcs);
     RUN_TEST(test_errors);
+    RUN_TEST(test_cache_relative);
+    RUN_TEST(test_cache_bounded);
+    RUN_TEST(test_range_resolver);
+    RUN_TEST(test_formula_refs);
+    RUN_TEST(test_eval_column);
     return UNITY_END();
 }
@@ -0,0 +1,211 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unity.h>
+
+#include "libxlsx.h"
+#include "libxlsx/reader_eval.h"
+
+#define READER_EVAL_XLSX "test_reader_eval.xlsx"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/*
+ * Sheet "Data", written with no cached formula results:
+ *   A1:A100   1..100
+ *   B1:B100   =A1*2 copied down (a shared formula)
+ *   C1        =SUM(B1:B100)
+ *   C2        =C1/B2
+ *   D1:D100   running total of column A
+ *   E1, E2    a circular reference
+ *   F1, F2    text and =F1&"!"
+ *   G1        =H5000+1, past the last row
+ */
+static void write_fixture(void)
+{
+    lxlsx_workbook *workbook = lxlsx_workbook_new(READER_EVAL_XLSX);
+    lxlsx_worksheet *ws = lxlsx_workbook_add_worksheet(workbook, "Data");
+    lxlsx_worksheet *other = lxlsx_workbook_add_worksheet(workbook, "Other");
+    lxlsx_row_t row;
+    char formula[32];
+
+    for (row = 0; row < 100; row++) {
+        lxlsx_worksheet_write_number(ws, row, 0, row + 1, NULL);
+        snprintf(formula, sizeof(formula), "=A%u*2", (unsigned) row + 1);
+        lxlsx_worksheet_write_formula(ws, row, 1, formula, NULL);
+        if (row == 0)
+            snprintf(formula, sizeof(formula), "=A1");
+        else
+            snprintf(formula, sizeof(formula), "=D%u+A%u",
+                     (unsigned) row, (unsigned) row + 1);
+        lxlsx_worksheet_write_formula(ws, row, 3, formula, NULL);
+    }
+    lxlsx_worksheet_write_formula(ws, 0, 2, "=SUM(B1:B100)", NULL);
+    lxlsx_worksheet_write_formula(ws, 1, 2, "=C1/B2", NULL);
+    lxlsx_worksheet_write_formula(ws, 0, 4, "=E2", NULL);
+    lxlsx_worksheet_write_formula(ws, 1, 4, "=E1+1", NULL);
+    lxlsx_worksheet_write_string(ws, 0, 5, "text", NULL);
+    lxlsx_worksheet_write_formula(ws, 1, 5, "=F1&\"!\"", NULL);
+    lxlsx_worksheet_write_formula(ws, 0, 6, "=H5000+1", NULL);
+
+    lxlsx_worksheet_write_number(other, 0, 0, 7, NULL);
+    lxlsx_worksheet_write_formula(other, 0, 1, "=A1*A1", NULL);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_workbook_close(workbook));
+}
+
+static void assert_number(lxlsx_reader_eval *eval, lxlsx_row_t row,
+                          lxlsx_col_t col, double expect)
+{
+    lxlsx_value value;
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+                          lxlsx_reader_eval_at(eval, row, col, &value));
+    TEST_ASSERT_EQUAL_INT(LXLSX_VAL_NUMBER, value.kind);
+    TEST_ASSERT_TRUE(fabs(expect - value.number) < 1e-9);
+}
+
+static void test_reader_eval_at(void)
+{
+    lxlsx_reader_eval *eval = NULL;
+    lxlsx_reader_eval_stats stats;
+    lxlsx_value value;
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+        lxlsx_reader_eval_open(READER_EVAL_XLSX, "Data", NULL, &eval));
+
+    /* Shared formula cells are evaluated from the group's first formula. */
+    assert_number(eval, 0, 2, 10100);
+    assert_number(eval, 1, 2, 2525);
+    assert_number(eval, 57, 1, 116);
+
+    /* C1 is read before its references are known, and the references of
+     * column B before those of its cells: two passes more. */
+    lxlsx_reader_eval_stats_get(eval, &stats);
+    TEST_ASSERT_EQUAL_INT(3, stats.passes);
+    TEST_ASSERT_EQUAL_INT(102, stats.evaluated);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+                          lxlsx_reader_eval_at(eval, 1, 5, &value));
+    TEST_ASSERT_EQUAL_INT(LXLSX_VAL_STRING, value.kind);
+    TEST_ASSERT_EQUAL_STRING("text!", value.string);
+    lxlsx_value_free(&value);
+
+    /* A circular reference reads as 0; past the last row is blank. */
+    assert_number(eval, 0, 4, 1);
+    assert_number(eval, 0, 6, 1);
+
+    lxlsx_reader_eval_close(eval);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+        lxlsx_reader_eval_open(READER_EVAL_XLSX, "Other", NULL, &eval));
+    assert_number(eval, 0, 1, 49);
+    lxlsx_reader_eval_close(eval);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_ERROR_SHEET_NOT_FOUND,
+        lxlsx_reader_eval_open(READER_EVAL_XLSX, "Missing", NULL, &eval));
+    TEST_ASSERT_NULL(eval);
+}
+
+static void test_reader_eval_streams_on_demand(void)
+{
+    lxlsx_reader_eval *eval = NULL;
+    lxlsx_reader_eval_stats stats;
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+        lxlsx_reader_eval_open(READER_EVAL_XLSX, NULL, NULL, &eval));
+
+    /* Only columns A and D, and only down to row 10. D10 refers up the
+     * columns: one more pass holds them from the top, for the whole chain. */
+    assert_number(eval, 9, 3, 55);
+    lxlsx_reader_eval_stats_get(eval, &stats);
+    TEST_ASSERT_EQUAL_INT(2, stats.passes);
+    TEST_ASSERT_EQUAL_INT(10 + 11, stats.rows);
+    TEST_ASSERT_EQUAL_INT(2, stats.columns);
+    TEST_ASSERT_EQUAL_INT(10, stats.evaluated);
+
+    /* Further down the same columns: the stream goes on. */
+    assert_number(eval, 99, 3, 5050);
+    lxlsx_reader_eval_stats_get(eval, &stats);
+    TEST_ASSERT_EQUAL_INT(2, stats.passes);
+    TEST_ASSERT_EQUAL_INT(10 + 100, stats.rows);
+    TEST_ASSERT_EQUAL_INT(100, stats.evaluated);
+
+    /* Another column from the top: read on another pass. */
+    assert_number(eval, 2, 1, 6);
+    lxlsx_reader_eval_stats_get(eval, &stats);
+    TEST_ASSERT_EQUAL_INT(3, stats.passes);
+    TEST_ASSERT_EQUAL_INT(3, stats.columns);
+    assert_number(eval, 99, 3, 5050);
+
+    lxlsx_reader_eval_close(eval);
+}
+
+/* Evaluate the formula cells of a worksheet while reading it. */
+static void test_reader_eval_cells(void)
+{
+    lxlsx_reader_workbook *workbook = NULL;
+    lxlsx_reader_worksheet *worksheet = NULL;
+    lxlsx_reader_eval *eval = NULL;
+    lxlsx_value value;
+    lxlsx_cell cell;
+    uint32_t formulas = 0;
+    double running = 0;
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+        lxlsx_reader_workbook_open(READER_EVAL_XLSX, &workbook));
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+        lxlsx_reader_workbook_get_worksheet_by_name(workbook, "Data", 0,
+                                                    &worksheet));
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+        lxlsx_reader_eval_open(READER_EVAL_XLSX, "Data", NULL, &eval));
+
+    while (lxlsx_reader_worksheet_next_row(worksheet) == LXLSX_READER_NO_ERROR) {
+        while (lxlsx_reader_worksheet_next_cell(worksheet, &cell)
+               == LXLSX_READER_NO_ERROR) {
+            if (cell.type != FORMULA_CELL)
+                continue;
+
+            TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR,
+                                  lxlsx_reader_eval_cell(eval, &cell, &value));
+            formulas++;
+
+            if (cell.col_num == 2) {
+                TEST_ASSERT_EQUAL_INT(LXLSX_VAL_NUMBER, value.kind);
+                TEST_ASSERT_EQUAL_DOUBLE(cell.row_num * 2.0, value.number);
+            }
+            else if (cell.col_num == 4) {
+                running += cell.row_num;
+                TEST_ASSERT_EQUAL_DOUBLE(running, value.number);
+            }
+            else if (cell.col_num == 3 && cell.row_num == 2) {
+                TEST_ASSERT_EQUAL_DOUBLE(2525, value.number);
+            }
+            lxlsx_value_free(&value);
+        }
+    }
+
+    TEST_ASSERT_EQUAL_INT(206, formulas);
+
+    lxlsx_reader_eval_close(eval);
+    lxlsx_reader_worksheet_close(worksheet);
+    lxlsx_reader_workbook_close(workbook);
+}
+
+int main(void)
+{
+    int failures;
+
+    UNITY_BEGIN();
+    write_fixture();
+    RUN_TEST(test_reader_eval_at);
+    RUN_TEST(test_reader_eval_streams_on_demand);
+    RUN_TEST(test_reader_eval_cells);
+    failures = UNITY_END();
+
+    remove(READER_EVAL_XLSX);
+    return failures;
+}
@@ -0,0 +1,281 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unity.h>
+
+#include "libxlsx.h"
+#include "libxlsx/recalc.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static lxlsx_cell_writer_formula *formula_at(lxlsx_worksheet *ws,
+                                             lxlsx_row_t row, lxlsx_col_t col)
+{
+    lxlsx_row *r = lxlsx_worksheet_find_row(ws, row);
+    lxlsx_cell *c = r ? lxlsx_worksheet_find_cell_in_row(r, col) : NULL;
+    TEST_ASSERT_NOT_NULL(c);
+    TEST_ASSERT_EQUAL_INT(FORMULA_CELL, c->type);
+    return c->data.writer.value.formula;
+}
+
+static void assert_result(lxlsx_worksheet *ws, lxlsx_row_t row, lxlsx_col_t col,
+                          double expect)
+{
+    lxlsx_cell_writer_formula *f = formula_at(ws, row, col);
+    TEST_ASSERT_NULL(f->result_string);
+    TEST_ASSERT_TRUE(fabs(expect - f->result) < 1e-9);
+}
+
+static void assert_result_str(lxlsx_worksheet *ws, lxlsx_row_t row,
+                              lxlsx_col_t col, const char *expect)
+{
+    TEST_ASSERT_EQUAL_STRING(expect, formula_at(ws, row, col)->result_string);
+}
+
+static void test_recalc_order(void)
+{
+    lxlsx_worksheet *ws = lxlsx_worksheet_new(NULL);
+    lxlsx_recalc_stats stats;
+
+    /* Formulas first, referring to each other and to inputs written later. */
+    lxlsx_worksheet_write_formula(ws, 0, 2, "=C2*2", NULL);
+    lxlsx_worksheet_write_formula(ws, 1, 2, "=SUM(A1:A3)", NULL);
+    lxlsx_worksheet_write_formula(ws, 2, 2, "=UPPER(D1)&\"!\"", NULL);
+    lxlsx_worksheet_write_formula(ws, 0, 3, "=LOWER(\"AB\")", NULL);
+    lxlsx_worksheet_write_formula(ws, 3, 2, "=1/0", NULL);
+    lxlsx_worksheet_write_number(ws, 0, 0, 1, NULL);
+    lxlsx_worksheet_write_number(ws, 1, 0, 2, NULL);
+    lxlsx_worksheet_write_number(ws, 2, 0, 3, NULL);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(5, stats.formulas);
+    TEST_ASSERT_EQUAL_INT(5, stats.evaluated);
+    TEST_ASSERT_EQUAL_INT(0, stats.circular);
+
+    assert_result(ws, 0, 2, 12);
+    assert_result(ws, 1, 2, 6);
+    assert_result_str(ws, 2, 2, "AB!");
+    assert_result_str(ws, 0, 3, "ab");
+    assert_result_str(ws, 3, 2, "#DIV/0!");
+
+    lxlsx_worksheet_free(ws);
+}
+
+static void test_recalc_circular(void)
+{
+    lxlsx_worksheet *ws = lxlsx_worksheet_new(NULL);
+    lxlsx_recalc_stats stats;
+
+    lxlsx_worksheet_write_formula_num(ws, 0, 0, "=B1+1", NULL, 5);
+    lxlsx_worksheet_write_formula_num(ws, 0, 1, "=A1+1", NULL, 5);
+    lxlsx_worksheet_write_formula_num(ws, 0, 2, "=B1*2", NULL, 5);
+    lxlsx_worksheet_write_formula_num(ws, 1, 0, "=A2", NULL, 5);
+    lxlsx_worksheet_write_formula_num(ws, 2, 0, "=SUM(A1:C1)+1", NULL, 5);
+    lxlsx_worksheet_write_formula_num(ws, 3, 0, "=4", NULL, 5);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(6, stats.formulas);
+    TEST_ASSERT_EQUAL_INT(1, stats.evaluated);
+    TEST_ASSERT_EQUAL_INT(5, stats.circular);
+
+    assert_result(ws, 0, 0, 0);
+    assert_result(ws, 0, 1, 0);
+    assert_result(ws, 0, 2, 0);
+    assert_result(ws, 1, 0, 0);
+    assert_result(ws, 2, 0, 0);
+    assert_result(ws, 3, 0, 4);
+
+    lxlsx_worksheet_free(ws);
+}
+
+static void test_recalc_incremental(void)
+{
+    lxlsx_worksheet *ws = lxlsx_worksheet_new(NULL);
+    lxlsx_recalc_stats stats;
+    lxlsx_row_t row;
+    char formula[16];
+
+    for (row = 0; row < 10; row++) {
+        snprintf(formula, sizeof(formula), "=A%u*10", (unsigned) row + 1);
+        lxlsx_worksheet_write_number(ws, row, 0, row + 1, NULL);
+        lxlsx_worksheet_write_formula(ws, row, 1, formula, NULL);
+    }
+    lxlsx_worksheet_write_formula(ws, 10, 1, "=SUM(B1:B10)", NULL);
+    lxlsx_worksheet_write_formula(ws, 11, 1, "=B11/2", NULL);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(12, stats.evaluated);
+    assert_result(ws, 10, 1, 550);
+    assert_result(ws, 11, 1, 275);
+
+    /* Nothing written: nothing to do. */
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(12, stats.formulas);
+    TEST_ASSERT_EQUAL_INT(0, stats.evaluated);
+
+    /* One input: its formula and the two depending on it. Writing a cell no
+     * formula refers to changes nothing. */
+    lxlsx_worksheet_write_number(ws, 4, 0, 100, NULL);
+    lxlsx_worksheet_write_number(ws, 20, 5, 1, NULL);
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(3, stats.evaluated);
+    assert_result(ws, 4, 1, 1000);
+    assert_result(ws, 10, 1, 1500);
+    assert_result(ws, 11, 1, 750);
+    assert_result(ws, 3, 1, 40);
+
+    /* A new formula changes the graph: everything is evaluated again. */
+    lxlsx_worksheet_write_formula(ws, 12, 1, "=B12+B11", NULL);
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(13, stats.formulas);
+    TEST_ASSERT_EQUAL_INT(13, stats.evaluated);
+    assert_result(ws, 12, 1, 2250);
+
+    /* So does replacing a formula with a value. */
+    lxlsx_worksheet_write_number(ws, 10, 1, 1, NULL);
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(12, stats.formulas);
+    assert_result(ws, 11, 1, 0.5);
+    assert_result(ws, 12, 1, 1.5);
+
+    lxlsx_worksheet_free(ws);
+}
+
+static void test_recalc_column(void)
+{
+    lxlsx_workbook *workbook = lxlsx_workbook_new("test_recalc_unused.xlsx");
+    lxlsx_worksheet *ws = lxlsx_workbook_add_worksheet(workbook, NULL);
+    lxlsx_recalc_stats stats;
+    lxlsx_row_t row;
+    char formula[32];
+
+    /* Column C and D are copied down; D depends on C of the same row. */
+    for (row = 0; row < 100; row++) {
+        lxlsx_worksheet_write_number(ws, row, 0, row + 1, NULL);
+        snprintf(formula, sizeof(formula), "=A%u*$B$1", (unsigned) row + 1);
+        lxlsx_worksheet_write_formula(ws, row, 2, formula, NULL);
+        snprintf(formula, sizeof(formula), "=C%u+1", (unsigned) row + 1);
+        lxlsx_worksheet_write_formula(ws, row, 3, formula, NULL);
+    }
+    lxlsx_worksheet_write_formula(ws, 100, 2, "=SUM(C1:C100)", NULL);
+    lxlsx_worksheet_write_number(ws, 0, 1, 2, NULL);
+    lxlsx_worksheet_write_string(ws, 9, 0, "x", NULL);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(201, stats.evaluated);
+    TEST_ASSERT_EQUAL_INT(198, stats.vectorized);
+    assert_result(ws, 0, 2, 2);
+    assert_result(ws, 99, 3, 201);
+    assert_result_str(ws, 9, 2, "#VALUE!");
+    assert_result_str(ws, 9, 3, "#VALUE!");
+    assert_result(ws, 100, 2, 10100 - 20);
+
+    /* Only the dirty part of a column runs again, still a column at a time. */
+    for (row = 40; row < 80; row++)
+        lxlsx_worksheet_write_number(ws, row, 0, row + 101, NULL);
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(81, stats.evaluated);
+    TEST_ASSERT_EQUAL_INT(80, stats.vectorized);
+    assert_result(ws, 39, 3, 81);
+    assert_result(ws, 50, 3, 303);
+    assert_result(ws, 100, 2, 10100 - 20 + 8000);
+
+    /* B1 feeds every formula of the column, so all of them run again. */
+    lxlsx_worksheet_write_number(ws, 0, 1, 3, NULL);
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(201, stats.evaluated);
+    assert_result(ws, 50, 3, 454);
+    assert_result(ws, 100, 2, 15150 - 30 + 12000);
+
+    lxlsx_workbook_free(workbook);
+}
+
+static void test_recalc_running_total(void)
+{
+    lxlsx_workbook *workbook = lxlsx_workbook_new("test_recalc_unused.xlsx");
+    lxlsx_worksheet *ws = lxlsx_workbook_add_worksheet(workbook, NULL);
+    lxlsx_recalc_stats stats;
+    lxlsx_row_t row;
+    char formula[32];
+
+    /* C is a running total of the formulas in B. */
+    for (row = 0; row < 3000; row++) {
+        lxlsx_worksheet_write_number(ws, row, 0, 1, NULL);
+        snprintf(formula, sizeof(formula), "=A%u*2", (unsigned) row + 1);
+        lxlsx_worksheet_write_formula(ws, row, 1, formula, NULL);
+        snprintf(formula, sizeof(formula), "=SUM($B$1:B%u)", (unsigned) row + 1);
+        lxlsx_worksheet_write_formula(ws, row, 2, formula, NULL);
+    }
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(6000, stats.evaluated);
+    TEST_ASSERT_EQUAL_INT(0, stats.circular);
+    assert_result(ws, 0, 2, 2);
+    assert_result(ws, 1499, 2, 3000);
+    assert_result(ws, 2999, 2, 6000);
+
+    /* An input near the end: its formula and the totals from there on. */
+    lxlsx_worksheet_write_number(ws, 2990, 0, 11, NULL);
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_worksheet(ws, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(11, stats.evaluated);
+    assert_result(ws, 2989, 2, 5980);
+    assert_result(ws, 2990, 2, 6002);
+    assert_result(ws, 2999, 2, 6020);
+
+    lxlsx_workbook_free(workbook);
+}
+
+static void test_recalc_workbook(void)
+{
+    lxlsx_workbook_options options = {0};
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *ws1, *ws2, *ws3;
+    lxlsx_recalc_stats stats;
+
+    options.constant_memory = LXLSX_TRUE;
+    workbook = lxlsx_workbook_new("test_recalc_unused.xlsx");
+    ws1 = lxlsx_workbook_add_worksheet(workbook, NULL);
+    ws2 = lxlsx_workbook_add_worksheet(workbook, NULL);
+
+    /* A formula referring to another sheet keeps the result it was written
+     * with, and a formula reading it sees that result. String and error
+     * literals with a '!' don't count as a sheet reference. */
+    lxlsx_worksheet_write_formula_num(ws1, 0, 0, "=Sheet2!A2+1", NULL, 6);
+    lxlsx_worksheet_write_number(ws1, 1, 0, 1, NULL);
+    lxlsx_worksheet_write_formula(ws1, 2, 0, "=A1*2", NULL);
+    lxlsx_worksheet_write_formula(ws1, 3, 0, "=IFERROR(#DIV/0!,\"Hi!\")&\"!\"", NULL);
+    lxlsx_worksheet_write_formula(ws2, 0, 0, "=A2*3", NULL);
+    lxlsx_worksheet_write_number(ws2, 1, 0, 5, NULL);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_workbook(workbook, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(3, stats.formulas);
+    TEST_ASSERT_EQUAL_INT(3, stats.evaluated);
+    assert_result(ws1, 0, 0, 6);
+    assert_result(ws1, 2, 0, 12);
+    assert_result_str(ws1, 3, 0, "Hi!!");
+    assert_result(ws2, 0, 0, 15);
+    lxlsx_workbook_free(workbook);
+
+    /* Rows of a constant_memory worksheet are gone by now: left alone. */
+    workbook = lxlsx_workbook_new_opt("test_recalc_unused.xlsx", &options);
+    ws3 = lxlsx_workbook_add_worksheet(workbook, NULL);
+    lxlsx_worksheet_write_formula_num(ws3, 0, 0, "=1+1", NULL, 7);
+    TEST_ASSERT_EQUAL_INT(LXLSX_NO_ERROR, lxlsx_recalc_workbook(workbook, NULL, &stats));
+    TEST_ASSERT_EQUAL_INT(0, stats.formulas);
+    lxlsx_workbook_free(workbook);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_recalc_order);
+    RUN_TEST(test_recalc_circular);
+    RUN_TEST(test_recalc_incremental);
+    RUN_TEST(test_recalc_column);
+    RUN_TEST(test_recalc_running_total);
+    RUN_TEST(test_recalc_workbook);
+    return UNITY_END();
+}
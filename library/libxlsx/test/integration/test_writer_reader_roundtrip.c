@@ -9,6 +9,7 @@ void setUp(void) {}
 void tearDown(void) {}
 
 static const char *ROUNDTRIP_XLSX = "fixtures/integration_roundtrip.xlsx";
+static const char *WINDOW_XLSX = "fixtures/integration_window.xlsx";
 
 static void assert_write_ok(lxlsx_error err)
 {
@@ -107,9 +108,92 @@ static void test_writer_output_is_readable_by_unified_reader(void)
     remove(ROUNDTRIP_XLSX);
 }
 
+static void assert_next_number(lxlsx_reader_worksheet *worksheet,
+                               int row, int col, double value)
+{
+    lxlsx_cell cell;
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_worksheet_next_cell(worksheet, &cell));
+    TEST_ASSERT_EQUAL_INT(NUMBER_CELL, cell.type);
+    TEST_ASSERT_EQUAL_INT(row, (int)cell.row_num);
+    TEST_ASSERT_EQUAL_INT(col, (int)cell.col_num);
+    TEST_ASSERT_EQUAL_DOUBLE(value, cell.data.reader.value.number);
+}
+
+static void test_constant_memory_window_keeps_recent_rows_editable(void)
+{
+    lxlsx_workbook_options options = {
+        .constant_memory = LXLSX_TRUE,
+        .constant_memory_window = 3
+    };
+    lxlsx_workbook *writer = NULL;
+    lxlsx_worksheet *sheet = NULL;
+    lxlsx_reader_workbook *workbook = NULL;
+    lxlsx_reader_worksheet *worksheet = NULL;
+    lxlsx_cell cell;
+
+    remove(WINDOW_XLSX);
+
+    writer = lxlsx_workbook_new_opt(WINDOW_XLSX, &options);
+    TEST_ASSERT_NOT_NULL(writer);
+    sheet = lxlsx_workbook_add_worksheet(writer, "Window");
+    TEST_ASSERT_NOT_NULL(sheet);
+
+    /* Rows 0-2 are all inside the window and can be written in any order. */
+    assert_write_ok(lxlsx_worksheet_write_number(sheet, 2, 0, 3, NULL));
+    assert_write_ok(lxlsx_worksheet_write_number(sheet, 0, 1, 12, NULL));
+    assert_write_ok(lxlsx_worksheet_write_number(sheet, 1, 0, 2, NULL));
+    assert_write_ok(lxlsx_worksheet_write_number(sheet, 0, 0, 1, NULL));
+
+    /* Row 4 moves the window to rows 2-4 and flushes rows 0 and 1. */
+    assert_write_ok(lxlsx_worksheet_write_number(sheet, 4, 0, 5, NULL));
+    TEST_ASSERT_EQUAL_INT(LXLSX_ERROR_WORKSHEET_INDEX_OUT_OF_RANGE,
+                          lxlsx_worksheet_write_number(sheet, 1, 1, 99, NULL));
+    assert_write_ok(lxlsx_worksheet_write_number(sheet, 2, 1, 32, NULL));
+
+    /* Rows still in the window are visible to the row lookup. */
+    TEST_ASSERT_NULL(lxlsx_worksheet_find_row(sheet, 1));
+    TEST_ASSERT_NOT_NULL(lxlsx_worksheet_find_cell_in_row(
+                             lxlsx_worksheet_find_row(sheet, 2), 1));
+
+    assert_write_ok(lxlsx_workbook_close(writer));
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_workbook_open(WINDOW_XLSX, &workbook));
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_workbook_get_worksheet_by_name(
+                              workbook, "Window", LXLSX_READER_SKIP_NONE, &worksheet));
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_worksheet_next_row(worksheet));
+    assert_next_number(worksheet, 1, 1, 1);
+    assert_next_number(worksheet, 1, 2, 12);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_worksheet_next_row(worksheet));
+    assert_next_number(worksheet, 2, 1, 2);
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_ERROR_END_OF_DATA,
+                          lxlsx_reader_worksheet_next_cell(worksheet, &cell));
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_worksheet_next_row(worksheet));
+    assert_next_number(worksheet, 3, 1, 3);
+    assert_next_number(worksheet, 3, 2, 32);
+
+    TEST_ASSERT_EQUAL_INT(LXLSX_READER_NO_ERROR,
+                          lxlsx_reader_worksheet_next_row(worksheet));
+    assert_next_number(worksheet, 5, 1, 5);
+
+    lxlsx_reader_worksheet_close(worksheet);
+    lxlsx_reader_workbook_close(workbook);
+    remove(WINDOW_XLSX);
+}
+
 int main(void)
 {
     UNITY_BEGIN();
     RUN_TEST(test_writer_output_is_readable_by_unified_reader);
+    RUN_TEST(test_constant_memory_window_keeps_recent_rows_editable);
     return UNITY_END();
 }
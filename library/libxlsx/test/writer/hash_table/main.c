@@ -0,0 +1,16 @@
+/*
+ * Test runner for xmlwriter using ctest.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright 2014-2026, John McNamara, jmcnamara@cpan.org.
+ *
+ */
+#define CTEST_MAIN
+
+#include "../ctest.h"
+
+int main(int argc, const char *argv[])
+{
+    return ctest_main(argc, argv);
+}
+
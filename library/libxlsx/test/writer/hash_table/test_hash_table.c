@@ -0,0 +1,129 @@
+/*
+ * Tests for the libxlsxwriter library.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright 2014-2026, John McNamara, jmcnamara@cpan.org.
+ *
+ */
+
+#include "../ctest.h"
+#include "../helper.h"
+
+#include "../../../include/libxlsx/hash_table.h"
+
+#include <stdio.h>
+
+// Test insertion, lookup and growth well past the initial bucket count.
+CTEST(hash_table, insert_and_grow) {
+    lxlsx_hash_table *hash = lxlsx_hash_new(8, 1, 1);
+    lxlsx_hash_element *element;
+    char probe[16];
+    int i;
+
+    for (i = 0; i < 5000; i++) {
+        char *key = malloc(16);
+        int *value = malloc(sizeof(int));
+
+        snprintf(key, 16, "key%d", i);
+        *value = i;
+        element = lxlsx_insert_hash_element(hash, key, value, strlen(key));
+        ASSERT_NOT_NULL(element);
+    }
+
+    ASSERT_EQUAL(5000, hash->unique_count);
+    ASSERT_TRUE(hash->num_buckets >= 10000);
+
+    for (i = 0; i < 5000; i++) {
+        snprintf(probe, sizeof(probe), "key%d", i);
+        element = lxlsx_hash_key_exists(hash, probe, strlen(probe));
+        ASSERT_NOT_NULL(element);
+        ASSERT_EQUAL(i, *(int *) element->value);
+    }
+
+    ASSERT_NULL(lxlsx_hash_key_exists(hash, "key5000", 7));
+
+    /* A key that is a prefix of another key is a different key. */
+    ASSERT_NULL(lxlsx_hash_key_exists(hash, "key1", 3));
+
+    lxlsx_hash_free(hash);
+}
+
+// Test that re-inserting a key updates the value and keeps the order.
+CTEST(hash_table, update_and_order) {
+    lxlsx_hash_table *hash = lxlsx_hash_new(128, 0, 0);
+    lxlsx_hash_element *element;
+    char *keys[] = {"c", "a", "b"};
+    int values[] = {1, 2, 3, 4};
+    int i = 0;
+
+    lxlsx_insert_hash_element(hash, keys[0], &values[0], 1);
+    lxlsx_insert_hash_element(hash, keys[1], &values[1], 1);
+    lxlsx_insert_hash_element(hash, keys[2], &values[2], 1);
+    element = lxlsx_insert_hash_element(hash, keys[1], &values[3], 1);
+
+    ASSERT_EQUAL(3, hash->unique_count);
+    ASSERT_EQUAL(4, *(int *) element->value);
+
+    LXLSX_FOREACH_ORDERED(element, hash) {
+        ASSERT_STR(keys[i], (char *) element->key);
+        i++;
+    }
+
+    ASSERT_EQUAL(3, i);
+
+    lxlsx_hash_free(hash);
+}
+
+// Test that removing the last elements keeps the others reachable.
+CTEST(hash_table, remove_last) {
+    lxlsx_hash_table *hash = lxlsx_hash_new(8, 1, 0);
+    lxlsx_hash_element *element;
+    char probe[16];
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        char *key = malloc(16);
+
+        snprintf(key, 16, "key%d", i);
+        lxlsx_insert_hash_element(hash, key, NULL, strlen(key));
+    }
+
+    for (i = 999; i >= 500; i--)
+        lxlsx_hash_remove_last(hash);
+
+    ASSERT_EQUAL(500, hash->unique_count);
+
+    for (i = 0; i < 1000; i++) {
+        snprintf(probe, sizeof(probe), "key%d", i);
+        element = lxlsx_hash_key_exists(hash, probe, strlen(probe));
+        if (i < 500) {
+            ASSERT_NOT_NULL(element);
+            ASSERT_EQUAL(i, (int) (element - hash->elements));
+        }
+        else {
+            ASSERT_NULL(element);
+        }
+    }
+
+    /* A removed key can be added again, at the end. */
+    element = lxlsx_insert_hash_element(hash, strdup("key700"), NULL, 6);
+    ASSERT_EQUAL(500, (int) (element - hash->elements));
+    ASSERT_NOT_NULL(lxlsx_hash_key_exists(hash, "key700", 6));
+
+    lxlsx_hash_free(hash);
+}
+
+// Test that the hash depends on every byte of the key, including the tail.
+CTEST(hash_table, generate_hash_key) {
+    unsigned char key[37] = {0};
+    uint64_t hash = _generate_hash_key(key, sizeof(key));
+    size_t i;
+
+    for (i = 0; i < sizeof(key); i++) {
+        key[i] = 1;
+        ASSERT_TRUE(hash != _generate_hash_key(key, sizeof(key)));
+        key[i] = 0;
+    }
+
+    ASSERT_TRUE(_generate_hash_key(key, 8) != _generate_hash_key(key, 9));
+}
@@ -0,0 +1,168 @@
+/*
+ * Tests for the libxlsxwriter library.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright 2014-2026, John McNamara, jmcnamara@cpan.org.
+ *
+ */
+
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../ctest.h"
+#include "../helper.h"
+
+#include "../../../include/libxlsx/utility.h"
+#include "../../../include/libxlsx/third_party/emyg_dtoa.h"
+
+/* Count the significant digits of a formatted number. */
+static int
+_significant_digits(const char *str)
+{
+    int count = 0;
+    int trailing_zeros = 0;
+    int leading = 1;
+
+    for (; *str && *str != 'E' && *str != 'e'; str++) {
+        if (*str < '0' || *str > '9')
+            continue;
+
+        if (*str == '0' && leading)
+            continue;
+
+        leading = 0;
+        count++;
+        trailing_zeros = *str == '0' ? trailing_zeros + 1 : 0;
+    }
+
+    return count - trailing_zeros;
+}
+
+/*
+ * Check one value against the emyg_dtoa output it replaces: it must read
+ * back to the same double, be no longer, and have no shorter decimal that
+ * also reads back.
+ */
+static int
+_check_dtoa(double value)
+{
+    char got[LXLSX_DTOA_SIZE];
+    char old[LXLSX_ATTR_32];
+    char shorter[LXLSX_ATTR_32];
+    size_t len = lxlsx_dtoa(value, got);
+    int digits;
+
+    emyg_dtoa(value, old);
+
+    if (len != strlen(got) || strtod(got, NULL) != value
+        || len > strlen(old)) {
+        fprintf(stderr, "lxlsx_dtoa(%a) = \"%s\", emyg_dtoa = \"%s\"\n",
+                value, got, old);
+        return 1;
+    }
+
+    digits = _significant_digits(got);
+    if (digits > 1) {
+        snprintf(shorter, sizeof(shorter), "%.*e", digits - 2, value);
+        if (strtod(shorter, NULL) == value) {
+            fprintf(stderr, "lxlsx_dtoa(%a) = \"%s\", \"%s\" is shorter\n",
+                    value, got, shorter);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static double
+_from_bits(uint64_t bits)
+{
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Test lxlsx_dtoa() layout.
+CTEST(utility, lxlsx_dtoa) {
+
+    char got[LXLSX_DTOA_SIZE];
+    int i;
+
+    struct {
+        double value;
+        const char *expected;
+    } cases[] = {
+        {0.0, "0"},
+        {-0.0, "0"},
+        {1.0, "1"},
+        {-1.5, "-1.5"},
+        {0.1, "0.1"},
+        {123.456, "123.456"},
+        {1.0 / 3, "0.3333333333333333"},
+        {2.0 / 3, "0.6666666666666666"},
+        {405.67008985879335, "405.67008985879335"},
+        {0.000001, "0.000001"},
+        {0.0000012345, "0.0000012345"},
+        {1e-7, "1E-7"},
+        {1.25e-7, "1.25E-7"},
+        {12345678.9, "12345678.9"},
+        {9007199254740993.0, "9007199254740992"},
+        {1e16, "10000000000000000"},
+        {12345678901234567.0, "12345678901234568"},
+        {1e17, "1E+17"},
+        {1.5e300, "1.5E+300"},
+        {DBL_MAX, "1.7976931348623157E+308"},
+        {DBL_MIN, "2.2250738585072014E-308"},
+        {4.9406564584124654e-324, "5E-324"},
+        {-2.1161781688391864e18, "-2.1161781688391864E+18"},
+    };
+
+    for (i = 0; i < (int) (sizeof(cases) / sizeof(cases[0])); i++) {
+        size_t len = lxlsx_dtoa(cases[i].value, got);
+
+        ASSERT_STR(cases[i].expected, got);
+        ASSERT_EQUAL((int) strlen(cases[i].expected), (int) len);
+    }
+}
+
+// Test lxlsx_dtoa() round trips against the emyg_dtoa output.
+CTEST(utility, lxlsx_dtoa_roundtrip) {
+
+    uint64_t state = UINT64_C(0x9E3779B97F4A7C15);
+    uint64_t exponent;
+    int failures = 0;
+    int i;
+
+    /* Every binary exponent, both signs, with the boundary significands and
+     * a spread of pseudo random ones. */
+    for (exponent = 0; exponent < 0x7FF; exponent++) {
+        for (i = 0; i < 256; i++) {
+            uint64_t fraction;
+
+            if (i == 0)
+                fraction = 0;
+            else if (i == 1)
+                fraction = 1;
+            else if (i == 2)
+                fraction = (UINT64_C(1) << 52) - 1;
+            else {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                fraction = state & ((UINT64_C(1) << 52) - 1);
+            }
+
+            failures += _check_dtoa(_from_bits((exponent << 52) | fraction));
+            failures += _check_dtoa(
+                _from_bits((UINT64_C(1) << 63) | (exponent << 52) | fraction));
+        }
+    }
+
+    /* Two decimal place amounts, the bulk of financial exports. */
+    for (i = 0; i < 1000000; i++)
+        failures += _check_dtoa(i / 100.0 + 1000);
+
+    ASSERT_EQUAL(0, failures);
+}
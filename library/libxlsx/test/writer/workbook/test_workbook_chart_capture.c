@@ -0,0 +1,107 @@
+/*
+ * Tests for the libxlsxwriter library.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright 2014-2026, John McNamara, jmcnamara@cpan.org.
+ *
+ */
+
+#include "../ctest.h"
+#include "../helper.h"
+
+#include "../../../include/libxlsx/workbook.h"
+
+// Test that series data written after the chart is captured in constant_memory mode.
+CTEST(workbook, chart_capture01) {
+    lxlsx_workbook_options options = {0};
+    lxlsx_workbook *workbook;
+    lxlsx_worksheet *worksheet;
+    lxlsx_chart *chart;
+    lxlsx_chart_series *series;
+    lxlsx_series_data_point *data_point;
+    int row;
+    int i = 0;
+
+    options.constant_memory = LXLSX_TRUE;
+    workbook = lxlsx_workbook_new_opt(NULL, &options);
+    worksheet = lxlsx_workbook_add_worksheet(workbook, "Data");
+    chart = lxlsx_workbook_add_chart(workbook, LXLSX_CHART_COLUMN);
+    series = lxlsx_chart_add_series(chart, "=Data!$A$1:$A$4", "=Data!$B$1:$B$4");
+
+    ASSERT_NOT_NULL(series->categories->captured);
+    ASSERT_NOT_NULL(series->values->captured);
+
+    for (row = 0; row < 3; row++) {
+        lxlsx_worksheet_write_string(worksheet, row, 0, "name", NULL);
+        lxlsx_worksheet_write_number(worksheet, row, 1, row * 1.5, NULL);
+    }
+
+    /* Writes to flushed rows are dropped, so they aren't captured either. */
+    lxlsx_worksheet_write_number(worksheet, 0, 1, 99, NULL);
+
+    _populate_range_data_cache(workbook, series->categories);
+    _populate_range_data_cache(workbook, series->values);
+
+    ASSERT_EQUAL(4, series->values->num_data_points);
+    ASSERT_TRUE(series->categories->has_string_cache);
+    ASSERT_FALSE(series->values->has_string_cache);
+
+    STAILQ_FOREACH(data_point, series->values->data_cache, list_pointers) {
+        if (i < 3) {
+            ASSERT_FALSE(data_point->no_data);
+            ASSERT_DBL_NEAR(i * 1.5, data_point->number);
+        }
+        else {
+            ASSERT_TRUE(data_point->no_data);
+        }
+        i++;
+    }
+
+    ASSERT_EQUAL(4, i);
+
+    lxlsx_workbook_free(workbook);
+}
+
+// Test that cells written before the chart are read when capture starts.
+CTEST(workbook, chart_capture02) {
+    lxlsx_workbook *workbook = lxlsx_workbook_new(NULL);
+    lxlsx_worksheet *worksheet = lxlsx_workbook_add_worksheet(workbook, NULL);
+    lxlsx_chart *chart;
+    lxlsx_chart_series *series;
+
+    lxlsx_worksheet_write_number(worksheet, 0, 0, 1, NULL);
+    lxlsx_worksheet_write_number(worksheet, 1, 0, 2, NULL);
+
+    chart = lxlsx_workbook_add_chart(workbook, LXLSX_CHART_LINE);
+    series = lxlsx_chart_add_series(chart, NULL, "=Sheet1!$A$1:$A$3");
+
+    lxlsx_worksheet_write_number(worksheet, 2, 0, 3, NULL);
+    lxlsx_worksheet_write_number(worksheet, 1, 0, 5, NULL);
+
+    ASSERT_EQUAL(3, series->values->num_captured);
+    ASSERT_DBL_NEAR(1, series->values->captured[0].number);
+    ASSERT_DBL_NEAR(5, series->values->captured[1].number);
+    ASSERT_DBL_NEAR(3, series->values->captured[2].number);
+
+    /* Redefining the range drops the captured values. */
+    lxlsx_chart_series_set_values(series, "Sheet1", 0, 0, 1, 0);
+    ASSERT_NULL(series->values->captured);
+
+    lxlsx_worksheet_write_number(worksheet, 0, 0, 7, NULL);
+
+    lxlsx_workbook_free(workbook);
+}
+
+// Test that ranges on worksheets that don't exist yet aren't captured.
+CTEST(workbook, chart_capture03) {
+    lxlsx_workbook *workbook = lxlsx_workbook_new(NULL);
+    lxlsx_chart *chart = lxlsx_workbook_add_chart(workbook, LXLSX_CHART_LINE);
+    lxlsx_chart_series *series;
+
+    series = lxlsx_chart_add_series(chart, NULL, "=Later!$A$1:$A$3");
+
+    ASSERT_NULL(series->values->captured);
+    ASSERT_NULL(series->values->sheetname);
+
+    lxlsx_workbook_free(workbook);
+}
@@ -0,0 +1,62 @@
+/*
+ * Tests for the libxlsxwriter library.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright 2014-2026, John McNamara, jmcnamara@cpan.org.
+ *
+ */
+
+#include "../ctest.h"
+#include "../helper.h"
+
+#include "../../../include/libxlsx/workbook.h"
+
+static int
+_count_formats(lxlsx_workbook *workbook)
+{
+    lxlsx_format *format;
+    int count = 0;
+
+    STAILQ_FOREACH(format, workbook->formats, list_pointers) {
+        count++;
+    }
+
+    return count;
+}
+
+/* Test that formats with the same properties share one workbook format. */
+CTEST(workbook, intern_format01) {
+    lxlsx_workbook *workbook = lxlsx_workbook_new(NULL);
+    lxlsx_format *scratch = lxlsx_format_new();
+    lxlsx_format *bold1;
+    lxlsx_format *bold2;
+    lxlsx_format *red;
+    int i;
+    int before = _count_formats(workbook);
+
+    lxlsx_format_set_bold(scratch);
+    bold1 = lxlsx_workbook_intern_format(workbook, scratch);
+
+    for (i = 0; i < 1000; i++)
+        bold2 = lxlsx_workbook_intern_format(workbook, scratch);
+
+    ASSERT_TRUE(bold1 != NULL);
+    ASSERT_TRUE(bold1 != scratch);
+    ASSERT_TRUE(bold1 == bold2);
+    ASSERT_EQUAL(1, bold1->bold);
+    ASSERT_TRUE(bold1->xf_format_indices == workbook->used_xf_formats);
+
+    lxlsx_format_set_font_color(scratch, LXLSX_COLOR_RED);
+    red = lxlsx_workbook_intern_format(workbook, scratch);
+
+    ASSERT_TRUE(red != bold1);
+    ASSERT_EQUAL(LXLSX_COLOR_RED, red->font_color);
+    ASSERT_EQUAL(before + 2, _count_formats(workbook));
+
+    /* An interned format that already has an index still matches. */
+    lxlsx_format_get_xf_index(bold1);
+    ASSERT_TRUE(lxlsx_workbook_intern_format(workbook, bold1) == bold1);
+
+    lxlsx_format_free(scratch);
+    lxlsx_workbook_free(workbook);
+}
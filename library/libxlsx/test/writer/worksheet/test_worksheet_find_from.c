@@ -0,0 +1,39 @@
+/*
+ * Tests for the lib_xlsx_writer library.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright 2014-2026, John McNamara, jmcnamara@cpan.org.
+ *
+ */
+
+#include "../ctest.h"
+#include "../helper.h"
+
+#include "../../../include/libxlsx/worksheet.h"
+
+// Test walking the rows and cells of a range in order.
+CTEST(worksheet, find_row_and_cell_from) {
+    lxlsx_worksheet *worksheet = lxlsx_worksheet_new(NULL);
+    lxlsx_row *row;
+    lxlsx_cell *cell;
+
+    lxlsx_worksheet_write_number(worksheet, 1, 2, 1, NULL);
+    lxlsx_worksheet_write_number(worksheet, 1, 5, 2, NULL);
+    lxlsx_worksheet_write_number(worksheet, 4, 0, 3, NULL);
+
+    row = lxlsx_worksheet_find_row_from(worksheet, 0);
+    ASSERT_EQUAL(1, row->row_num);
+    ASSERT_TRUE(row == lxlsx_worksheet_find_row_from(worksheet, 1));
+
+    cell = lxlsx_worksheet_find_cell_from(row, 3);
+    ASSERT_EQUAL(5, cell->col_num);
+    ASSERT_NULL(lxlsx_worksheet_next_cell(cell));
+    ASSERT_NULL(lxlsx_worksheet_find_cell_from(row, 6));
+
+    row = lxlsx_worksheet_next_row(row);
+    ASSERT_EQUAL(4, row->row_num);
+    ASSERT_NULL(lxlsx_worksheet_next_row(row));
+    ASSERT_NULL(lxlsx_worksheet_find_row_from(worksheet, 5));
+
+    lxlsx_worksheet_free(worksheet);
+}
@@ -0,0 +1,105 @@
+/*
+ * Tests for the lib_xlsx_writer library.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ * Copyright 2014-2026, John McNamara, jmcnamara@cpan.org.
+ *
+ */
+
+#include "../ctest.h"
+#include "../helper.h"
+
+#include "../../../include/libxlsx/worksheet.h"
+
+// Test the detection of formulas that are copied down one row.
+CTEST(worksheet, formula_is_row_shift) {
+    ASSERT_TRUE(_formula_is_row_shift("B2*C2", "B3*C3"));
+    ASSERT_TRUE(_formula_is_row_shift("SUM($B$1:B2)", "SUM($B$1:B3)"));
+    ASSERT_TRUE(_formula_is_row_shift("$B2&\"B2\"", "$B3&\"B2\""));
+    ASSERT_TRUE(_formula_is_row_shift("'Sheet 2'!A9+LOG10(A9)",
+                                      "'Sheet 2'!A10+LOG10(A10)"));
+    ASSERT_TRUE(_formula_is_row_shift("VLOOKUP(A1,Data!$A:$B,2,0)",
+                                      "VLOOKUP(A2,Data!$A:$B,2,0)"));
+    ASSERT_TRUE(_formula_is_row_shift("PI()*2", "PI()*2"));
+
+    ASSERT_FALSE(_formula_is_row_shift("B2*C2", "B2*C2"));
+    ASSERT_FALSE(_formula_is_row_shift("B2*C2", "B3*C4"));
+    ASSERT_FALSE(_formula_is_row_shift("B2*C2", "B3*D3"));
+    ASSERT_FALSE(_formula_is_row_shift("B$2*C2", "B$3*C3"));
+    ASSERT_FALSE(_formula_is_row_shift("B2&\"B2\"", "B3&\"B3\""));
+    ASSERT_FALSE(_formula_is_row_shift("'B2'!A1", "'B3'!A2"));
+    ASSERT_FALSE(_formula_is_row_shift("Table1[@B2]", "Table1[@B3]"));
+    ASSERT_FALSE(_formula_is_row_shift("SUM(2:2)", "SUM(3:3)"));
+    ASSERT_FALSE(_formula_is_row_shift("SUM($2:$2)", "SUM($2:$2)"));
+    ASSERT_FALSE(_formula_is_row_shift("B2*C2", "B3*C3+1"));
+    ASSERT_FALSE(_formula_is_row_shift("B1048576", "B1048577"));
+}
+
+// Test that a column of copied down formulas is written as a shared formula.
+CTEST(worksheet, shared_formula01) {
+
+    char* got;
+    char exp[] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\">"
+          "<dimension ref=\"A1:B6\"/>"
+          "<sheetViews>"
+            "<sheetView tabSelected=\"1\" workbookViewId=\"0\"/>"
+          "</sheetViews>"
+          "<sheetFormatPr defaultRowHeight=\"15\"/>"
+          "<sheetData>"
+            "<row r=\"1\" spans=\"1:2\">"
+              "<c r=\"A1\"><v>1</v></c>"
+              "<c r=\"B1\"><f t=\"shared\" ref=\"B1:B3\" si=\"0\">A1*2</f><v>2</v></c>"
+            "</row>"
+            "<row r=\"2\" spans=\"1:2\">"
+              "<c r=\"A2\"><v>2</v></c>"
+              "<c r=\"B2\"><f t=\"shared\" si=\"0\"/><v>4</v></c>"
+            "</row>"
+            "<row r=\"3\" spans=\"1:2\">"
+              "<c r=\"A3\"><v>3</v></c>"
+              "<c r=\"B3\" t=\"str\"><f t=\"shared\" si=\"0\"/><v>x</v></c>"
+            "</row>"
+            "<row r=\"4\" spans=\"1:2\">"
+              "<c r=\"B4\"><f t=\"shared\" ref=\"B4:B5\" si=\"1\">A4*3</f><v>0</v></c>"
+            "</row>"
+            "<row r=\"5\" spans=\"1:2\">"
+              "<c r=\"A5\"><f t=\"shared\" ref=\"A5:A6\" si=\"2\">B4+1</f><v>0</v></c>"
+              "<c r=\"B5\"><f t=\"shared\" si=\"1\"/><v>0</v></c>"
+            "</row>"
+            "<row r=\"6\" spans=\"1:2\">"
+              "<c r=\"A6\"><f t=\"shared\" si=\"2\"/><v>0</v></c>"
+              "<c r=\"B6\"><f>A6*4</f><v>0</v></c>"
+            "</row>"
+          "</sheetData>"
+          "<pageMargins left=\"0.7\" right=\"0.7\" top=\"0.75\" bottom=\"0.75\" header=\"0.3\" footer=\"0.3\"/>"
+        "</worksheet>";
+
+    FILE* testfile = lxlsx_tmpfile(NULL);
+
+    lxlsx_worksheet *worksheet = lxlsx_worksheet_new(NULL);
+    worksheet->file = testfile;
+    lxlsx_worksheet_select(worksheet);
+
+    lxlsx_worksheet_write_number(worksheet, 0, 0, 1, NULL);
+    lxlsx_worksheet_write_number(worksheet, 1, 0, 2, NULL);
+    lxlsx_worksheet_write_number(worksheet, 2, 0, 3, NULL);
+
+    lxlsx_worksheet_write_formula_num(worksheet, 0, 1, "=A1*2", NULL, 2);
+    lxlsx_worksheet_write_formula_num(worksheet, 1, 1, "=A2*2", NULL, 4);
+    lxlsx_worksheet_write_formula_str(worksheet, 2, 1, "=A3*2", NULL, "x");
+
+    /* Formulas that aren't a copy of the one above end the group. */
+    lxlsx_worksheet_write_formula(worksheet, 3, 1, "=A4*3", NULL);
+    lxlsx_worksheet_write_formula(worksheet, 4, 1, "=A5*3", NULL);
+    lxlsx_worksheet_write_formula(worksheet, 5, 1, "=A6*4", NULL);
+
+    lxlsx_worksheet_write_formula(worksheet, 4, 0, "=B4+1", NULL);
+    lxlsx_worksheet_write_formula(worksheet, 5, 0, "=B5+1", NULL);
+
+    lxlsx_worksheet_assemble_xml_file(worksheet);
+
+    RUN_XLSX_STREQ_SHORT(exp, got);
+
+    lxlsx_worksheet_free(worksheet);
+}
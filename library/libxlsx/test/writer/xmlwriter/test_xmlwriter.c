@@ -225,3 +225,71 @@ CTEST(xmlwriter, lxlsx_xml_data_element_with_escapes) {
     LXLSX_FREE_ATTRIBUTES();
 }
 
+
+// Test attributes beyond the inline array and pool, which spill to the heap.
+CTEST(xmlwriter, lxlsx_xml_empty_tag_with_many_attributes) {
+
+    char* got;
+    char exp[8192] = "<foo";
+    char value[LXLSX_MAX_ATTRIBUTE_LENGTH + 10];
+    char key[16];
+    int i;
+    FILE* testfile = lxlsx_tmpfile(NULL);
+    struct lxlsx_xml_attribute_list attributes;
+    struct lxlsx_xml_attribute *attribute;
+
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+
+    LXLSX_INIT_ATTRIBUTES();
+
+    for (i = 0; i < LXLSX_XML_INLINE_ATTRIBUTES + 8; i++) {
+        snprintf(key, sizeof(key), "a%d", i);
+        LXLSX_PUSH_ATTRIBUTES_INT(key, -i);
+        snprintf(exp + strlen(exp), sizeof(exp) - strlen(exp), " a%d=\"%d\"", i, -i);
+    }
+
+    /* Values are truncated to LXLSX_MAX_ATTRIBUTE_LENGTH - 1 bytes. */
+    LXLSX_PUSH_ATTRIBUTES_STR("long", value);
+    value[LXLSX_MAX_ATTRIBUTE_LENGTH - 1] = '\0';
+    snprintf(exp + strlen(exp), sizeof(exp) - strlen(exp), " long=\"%s\"/>", value);
+
+    lxlsx_xml_empty_tag(testfile, "foo", &attributes);
+
+    RUN_XLSX_STREQ(exp, got);
+
+    LXLSX_FREE_ATTRIBUTES();
+}
+
+// Test the byte scan kernels against every position of a buffer.
+CTEST(xmlwriter, lxlsx_scan_kernels) {
+
+    char data[100];
+    const char special[] = { '&', '<', '>', '\x01', '\x1F', '\x80', '\xFF' };
+    size_t len, pos, i;
+
+    lxlsx_scan_init();
+
+    for (len = 0; len <= sizeof(data); len++) {
+        memset(data, 'a', sizeof(data));
+        data[len % sizeof(data)] = '\t';
+
+        ASSERT_EQUAL(len, lxlsx_xml_escape_scan(data, len));
+        ASSERT_EQUAL(len, lxlsx_control_char_scan(data, len));
+        ASSERT_EQUAL(len, lxlsx_non_ascii_scan(data, len));
+    }
+
+    for (i = 0; i < sizeof(special); i++) {
+        for (pos = 0; pos < sizeof(data); pos++) {
+            memset(data, '\n', sizeof(data));
+            data[pos] = special[i];
+
+            ASSERT_EQUAL(i < 3 ? pos : sizeof(data),
+                         lxlsx_xml_escape_scan(data, sizeof(data)));
+            ASSERT_EQUAL(i >= 3 && i < 5 ? pos : sizeof(data),
+                         lxlsx_control_char_scan(data, sizeof(data)));
+            ASSERT_EQUAL(i >= 5 ? pos : sizeof(data),
+                         lxlsx_non_ascii_scan(data, sizeof(data)));
+        }
+    }
+}
@@ -278,7 +278,11 @@ static __inline unsigned CountDecimalDigit32(uint32_t n) {
 }
 
 static __inline void DigitGen(const DiyFp W, const DiyFp Mp, uint64_t delta, char* buffer, int* len, int* K) {
-	static const uint32_t kPow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	/* 20 entries: the fraction loop below can run past 10^9 for some
+	 * subnormal and very short inputs. */
+	static const uint64_t kPow10[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+		10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+		10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL };
 	const DiyFp one = DiyFp_from_parts((uint64_t )(1) << -Mp.e, Mp.e);
 	const DiyFp wp_w = DiyFp_subtract(Mp, W);
 	uint32_t p1 = (uint32_t )(Mp.f >> -one.e);
@@ -332,7 +336,7 @@ static __inline void DigitGen(const DiyFp W, const DiyFp Mp, uint64_t delta, cha
 		kappa--;
 		if (p2 < delta) {
 			*K += kappa;
-			GrisuRound(buffer, *len, delta, p2, one.f, wp_w.f * kPow10[-kappa]);
+			GrisuRound(buffer, *len, delta, p2, one.f, wp_w.f * (-kappa < 20 ? kPow10[-kappa] : 0));
 			return;
 		}
 	}
@@ -0,0 +1,42 @@
+--TEST--
+Excel::autoSize() sampling and numeric width estimation
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+/* With a sample of 2 the first two cells of a column are measured, then
+ * every second one: row 3 (index 3) is skipped, rows 0, 1, 2 and 4 count. */
+$excel = new \Vtiful\Kernel\Excel($config);
+$excel->fileName('auto_size_sample.xlsx', 'S')
+    ->autoSize('A:D', 2)
+    ->data([
+        ['abc',  -12345,  1.25,                true],
+        ['ab',   7,       0.1 + 0.2,           false],
+        ['abcd', 1,       123456.5,            true],
+        [str_repeat('x', 40), 1234567890123, 1e20, true],
+        ['a',    22,      -0.5,                true],
+    ])
+    ->output();
+
+$reader = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('auto_size_sample.xlsx')
+    ->openSheet();
+
+echo "A (strings):  " . (int) $reader->getColumnOptions('A')['width'] . "\n";
+echo "B (integers): " . (int) $reader->getColumnOptions('B')['width'] . "\n";
+echo "C (doubles):  " . (int) $reader->getColumnOptions('C')['width'] . "\n";
+echo "D (booleans): " . (int) $reader->getColumnOptions('D')['width'] . "\n";
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/auto_size_sample.xlsx');
+?>
+--EXPECT--
+A (strings):  4
+B (integers): 6
+C (doubles):  8
+D (booleans): 5
@@ -0,0 +1,45 @@
+--TEST--
+computeFormula() recalculates formulas at output() so cells written later are seen
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+(new \Vtiful\Kernel\Excel($config))
+    ->fileName('compute_formula_recalc.xlsx', 'S')
+    ->computeFormula(true)
+    ->insertFormula(0, 2, '=C2*2')          // depends on a formula below it
+    ->insertFormula(1, 2, '=SUM(A1:A3)')    // inputs written afterwards
+    ->insertFormula(2, 2, '=B1&"!"')
+    ->insertFormula(3, 2, '=C5+1')          // circular
+    ->insertFormula(4, 2, '=C4+1')
+    ->insertText(0, 0, 1)
+    ->insertText(1, 0, 2)
+    ->insertText(2, 0, 3)
+    ->insertText(0, 1, 'done')
+    ->output();
+
+$rows = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('compute_formula_recalc.xlsx')
+    ->openSheet('S')
+    ->getSheetData();
+
+var_dump($rows[0][2]);
+var_dump($rows[1][2]);
+var_dump($rows[2][2]);
+var_dump($rows[3][2]);
+var_dump($rows[4][2]);
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/compute_formula_recalc.xlsx');
+?>
+--EXPECT--
+int(12)
+int(6)
+string(5) "done!"
+int(0)
+int(0)
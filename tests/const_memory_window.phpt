@@ -0,0 +1,87 @@
+--TEST--
+Const-memory row window: rows inside the window stay editable
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$excel = new \Vtiful\Kernel\Excel(['path' => './tests']);
+
+$file = $excel->constMemory('const_memory_window.xlsx', NULL, true, 3)
+    ->header(['name', 'age'])
+    ->data([
+        ['viest', 21],
+        ['wjx', 22],
+    ]);
+
+// Row 1 is still inside the window, so it can be overwritten.
+$file->insertText(1, 1, 30);
+
+$file->data([
+    ['abc', 23],
+    ['def', 24],
+]);
+
+// Row 1 has now been flushed.
+try {
+    $file->insertText(1, 1, 40);
+} catch (\Vtiful\Kernel\Exception $exception) {
+    echo $exception->getMessage() . PHP_EOL;
+}
+
+$file->output();
+
+$v = new \Vtiful\Kernel\Excel(['path' => './tests']);
+var_dump($v->openFile('const_memory_window.xlsx')->openSheet()->getSheetData());
+
+try {
+    $excel->constMemory('const_memory_window_invalid.xlsx', NULL, true, -1);
+} catch (\Vtiful\Kernel\Exception $exception) {
+    echo $exception->getCode() . PHP_EOL;
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/const_memory_window.xlsx');
+?>
+--EXPECT--
+Worksheet row or column index out of range.
+array(5) {
+  [0]=>
+  array(2) {
+    [0]=>
+    string(4) "name"
+    [1]=>
+    string(3) "age"
+  }
+  [1]=>
+  array(2) {
+    [0]=>
+    string(5) "viest"
+    [1]=>
+    int(30)
+  }
+  [2]=>
+  array(2) {
+    [0]=>
+    string(3) "wjx"
+    [1]=>
+    int(22)
+  }
+  [3]=>
+  array(2) {
+    [0]=>
+    string(3) "abc"
+    [1]=>
+    int(23)
+  }
+  [4]=>
+  array(2) {
+    [0]=>
+    string(3) "def"
+    [1]=>
+    int(24)
+  }
+}
+130
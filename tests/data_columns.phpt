@@ -0,0 +1,101 @@
+--TEST--
+Excel::dataColumns() columnar bulk write
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$excel = new \Vtiful\Kernel\Excel(['path' => './tests']);
+
+$excel->fileName('data_columns.xlsx')
+    ->header(['name', 'age', 'score', 'active'])
+    ->dataColumns([
+        ['viest', 'wjx', 'abc'],
+        ['21', 22, 23],
+        [1.5, 2, 3.25],
+        [1, 0, true],
+    ], [
+        1 => \Vtiful\Kernel\Excel::TYPE_INT,
+        2 => \Vtiful\Kernel\Excel::TYPE_DOUBLE,
+        3 => \Vtiful\Kernel\Excel::TYPE_BOOL,
+    ])
+    ->data([['tail', 24, 4.5, false]])
+    ->output();
+
+try {
+    $excel->fileName('data_columns_invalid.xlsx')
+        ->dataColumns([[1, 2]], [0 => 3]);
+} catch (\Vtiful\Kernel\Exception $exception) {
+    echo $exception->getCode() . PHP_EOL;
+    echo $exception->getMessage() . PHP_EOL;
+}
+
+$v = new \Vtiful\Kernel\Excel(['path' => './tests']);
+var_dump($v->openFile('data_columns.xlsx')->openSheet()->getSheetData());
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/data_columns.xlsx');
+@unlink(__DIR__ . '/data_columns_invalid.xlsx');
+?>
+--EXPECT--
+220
+Invalid data type
+array(5) {
+  [0]=>
+  array(4) {
+    [0]=>
+    string(4) "name"
+    [1]=>
+    string(3) "age"
+    [2]=>
+    string(5) "score"
+    [3]=>
+    string(6) "active"
+  }
+  [1]=>
+  array(4) {
+    [0]=>
+    string(5) "viest"
+    [1]=>
+    int(21)
+    [2]=>
+    float(1.5)
+    [3]=>
+    int(1)
+  }
+  [2]=>
+  array(4) {
+    [0]=>
+    string(3) "wjx"
+    [1]=>
+    int(22)
+    [2]=>
+    int(2)
+    [3]=>
+    int(0)
+  }
+  [3]=>
+  array(4) {
+    [0]=>
+    string(3) "abc"
+    [1]=>
+    int(23)
+    [2]=>
+    float(3.25)
+    [3]=>
+    int(1)
+  }
+  [4]=>
+  array(4) {
+    [0]=>
+    string(4) "tail"
+    [1]=>
+    int(24)
+    [2]=>
+    float(4.5)
+    [3]=>
+    int(0)
+  }
+}
@@ -0,0 +1,76 @@
+--TEST--
+Excel::dataFrom() streams rows from arrays and Traversables
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+function rows() {
+    yield ['viest', 21];
+    yield ['wjx', 22];
+}
+
+$excel = new \Vtiful\Kernel\Excel(['path' => './tests']);
+
+$file = $excel->constMemory('data_from.xlsx')
+    ->header(['name', 'age'])
+    ->dataFrom(rows())
+    ->dataFrom(new ArrayIterator([['abc', 23]]));
+
+try {
+    $file->dataFrom('rows');
+} catch (\Vtiful\Kernel\Exception $exception) {
+    echo $exception->getCode() . PHP_EOL;
+    echo $exception->getMessage() . PHP_EOL;
+}
+
+$file->dataFrom([['def', 24]])->output();
+
+$v = new \Vtiful\Kernel\Excel(['path' => './tests']);
+var_dump($v->openFile('data_from.xlsx')->openSheet()->getSheetData());
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/data_from.xlsx');
+?>
+--EXPECT--
+230
+The rows must be an array or Traversable
+array(5) {
+  [0]=>
+  array(2) {
+    [0]=>
+    string(4) "name"
+    [1]=>
+    string(3) "age"
+  }
+  [1]=>
+  array(2) {
+    [0]=>
+    string(5) "viest"
+    [1]=>
+    int(21)
+  }
+  [2]=>
+  array(2) {
+    [0]=>
+    string(3) "wjx"
+    [1]=>
+    int(22)
+  }
+  [3]=>
+  array(2) {
+    [0]=>
+    string(3) "abc"
+    [1]=>
+    int(23)
+  }
+  [4]=>
+  array(2) {
+    [0]=>
+    string(3) "def"
+    [1]=>
+    int(24)
+  }
+}
@@ -0,0 +1,70 @@
+--TEST--
+Excel::dateColumns() writes timestamp and DateTimeInterface columns as dates
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+date_default_timezone_set('Asia/Shanghai');
+
+$config = ['path' => './tests'];
+
+$excel = new \Vtiful\Kernel\Excel($config);
+
+$excel->fileName('date_columns.xlsx')
+    ->dateColumns([1 => 'yyyy-mm-dd', 'C' => null])
+    ->header(['name', 'day', 'at'])
+    ->data([
+        ['viest', 1700000000, new DateTime('2024-03-10 08:30:00')],
+        ['wjx', 1700000000, new DateTimeImmutable('2024-03-10 08:30:00', new DateTimeZone('America/New_York'))],
+    ])
+    ->insertDate(3, 0, new DateTime('2024-03-10 08:30:00'))
+    ->output();
+
+$excel->openFile('date_columns.xlsx')->openSheet();
+
+$types = [
+    \Vtiful\Kernel\Excel::TYPE_STRING,
+    \Vtiful\Kernel\Excel::TYPE_TIMESTAMP,
+    \Vtiful\Kernel\Excel::TYPE_TIMESTAMP,
+];
+
+var_dump($excel->nextRow($types));
+var_dump($excel->nextRow($types));
+var_dump($excel->nextRow($types));
+var_dump($excel->nextRow([\Vtiful\Kernel\Excel::TYPE_TIMESTAMP]));
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/date_columns.xlsx');
+?>
+--EXPECT--
+array(3) {
+  [0]=>
+  string(4) "name"
+  [1]=>
+  string(3) "day"
+  [2]=>
+  string(2) "at"
+}
+array(3) {
+  [0]=>
+  string(5) "viest"
+  [1]=>
+  int(1700000000)
+  [2]=>
+  int(1710030600)
+}
+array(3) {
+  [0]=>
+  string(3) "wjx"
+  [1]=>
+  int(1700000000)
+  [2]=>
+  int(1710030600)
+}
+array(1) {
+  [0]=>
+  int(1710030600)
+}
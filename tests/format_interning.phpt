@@ -0,0 +1,57 @@
+--TEST--
+Format builders with identical properties share one workbook format
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$excel = new \Vtiful\Kernel\Excel(['path' => './tests']);
+$excel->fileName('format_interning.xlsx');
+
+$handle = $excel->getHandle();
+
+$ids = [];
+for ($i = 0; $i < 100; $i++) {
+    $bold = (new \Vtiful\Kernel\Format($handle))->bold()->toResource();
+    $ids[$excel->registerFormat($bold)] = true;
+    $excel->insertText($i, 0, 'bold', null, $bold);
+}
+
+$italic = (new \Vtiful\Kernel\Format($handle))->italic()->toResource();
+
+/* A builder keeps its own properties: changing it after toResource() does
+ * not touch the shared format. */
+$builder = new \Vtiful\Kernel\Format($handle);
+$shared = $builder->bold()->toResource();
+$builder->italic();
+
+var_dump(array_keys($ids));
+var_dump($excel->registerFormat($italic));
+var_dump($excel->registerFormat($shared));
+var_dump($excel->registerFormat($builder->toResource()));
+
+$excel->insertText(100, 0, 'italic', null, $italic)->output();
+
+$reader = new \Vtiful\Kernel\Excel(['path' => './tests']);
+$reader->openFile('format_interning.xlsx')->openSheet();
+
+$styles = [];
+while (($row = $reader->nextRowWithFormula()) !== null) {
+    $styles[$row[0]['style_id']] = true;
+}
+var_dump(count($styles));
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/format_interning.xlsx');
+?>
+--EXPECT--
+array(1) {
+  [0]=>
+  int(0)
+}
+int(1)
+int(0)
+int(2)
+int(2)
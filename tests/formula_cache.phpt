@@ -0,0 +1,57 @@
+--TEST--
+computeFormula() compiles a formula copied down a column once
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+$excel = (new \Vtiful\Kernel\Excel($config))
+    ->fileName('formula_cache.xlsx')
+    ->computeFormula(true);
+
+var_dump($excel->formulaCacheStats()['entries']);
+
+for ($row = 0; $row < 100; $row++) {
+    $line = $row + 1;
+    $excel->insertText($row, 0, $row)
+        ->insertText($row, 1, 2)
+        ->insertFormula($row, 2, "=A{$line}*B{$line}+\$B\$1");
+}
+
+// In normal mode the formulas are evaluated once, at output().
+var_dump($excel->formulaCacheStats()['entries']);
+
+// evaluateFormula() shares the cache; its formulas are relative to A1.
+var_dump($excel->evaluateFormula('A100*B100'));
+var_dump($excel->evaluateFormula('A100*B100'));
+$stats = $excel->formulaCacheStats();
+echo $stats['hits'], ' ', $stats['misses'], ' ', $stats['entries'], PHP_EOL;
+
+$excel->output();
+
+$stats = $excel->formulaCacheStats();
+echo $stats['misses'], ' ', $stats['entries'], ' ', ($stats['hits'] >= 100 ? 'hit' : 'miss'), PHP_EOL;
+
+$rows = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('formula_cache.xlsx')
+    ->openSheet()
+    ->getSheetData();
+
+var_dump($rows[0][2], $rows[99][2]);
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/formula_cache.xlsx');
+?>
+--EXPECT--
+int(0)
+int(0)
+int(198)
+int(198)
+1 1 1
+2 2 hit
+int(2)
+int(200)
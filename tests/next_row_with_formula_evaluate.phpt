@@ -0,0 +1,49 @@
+--TEST--
+nextRowWithFormula(true) evaluates formula cells of the file being read
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+// Written without computeFormula(): the cached results are all 0.
+(new \Vtiful\Kernel\Excel($config))
+    ->fileName('next_row_with_formula_evaluate.xlsx', 'S')
+    ->insertText(0, 0, 10)
+    ->insertFormula(0, 1, '=A1*2')
+    ->insertFormula(0, 2, '=SUM(A1:A3)')
+    ->insertText(1, 0, 20)
+    ->insertFormula(1, 1, '=B1+A2')
+    ->insertText(2, 0, 30)
+    ->insertFormula(2, 1, '=A3/0')
+    ->insertText(2, 2, 'x')
+    ->insertFormula(3, 2, '=UPPER(C3)&C1')
+    ->output();
+
+$excel = new \Vtiful\Kernel\Excel($config);
+$excel->openFile('next_row_with_formula_evaluate.xlsx')->openSheet('S');
+
+$row = $excel->nextRowWithFormula();
+var_dump(isset($row[1]['evaluated']));
+
+while (($row = $excel->nextRowWithFormula(true)) !== NULL) {
+    ksort($row);
+    foreach ($row as $idx => $cell) {
+        if ($cell['type'] !== 'formula') {
+            continue;
+        }
+        printf("[%d] %s => %s\n", $idx, $cell['formula'], var_export($cell['evaluated'], true));
+    }
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/next_row_with_formula_evaluate.xlsx');
+?>
+--EXPECT--
+bool(false)
+[1] B1+A2 => 40
+[1] A3/0 => '#DIV/0!'
+[2] UPPER(C3)&C1 => 'X60'
@@ -0,0 +1,65 @@
+--TEST--
+appendRows writes data() rows below the last row of an opened template
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+$writer = new \Vtiful\Kernel\Excel($config);
+$writer->fileName('open_xlsx_edit_append_rows_source.xlsx', 'Data')
+    ->header(['name', 'amount'])
+    ->data([['first', 1]])
+    ->output();
+
+$excel = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('open_xlsx_edit_append_rows_source.xlsx')
+    ->openSheet('Data')
+    ->appendRows(true);
+echo $excel->getCurrentLine(), PHP_EOL;
+
+$out = $excel
+    ->data([['second', 2], ['third', 3.5], ['second', 4]])
+    ->output('open_xlsx_edit_append_rows_output.xlsx');
+echo basename($out), PHP_EOL;
+
+$rows = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('open_xlsx_edit_append_rows_output.xlsx')
+    ->openSheet('Data')
+    ->getSheetData();
+var_dump(count($rows));
+var_dump($rows[2]);
+var_dump($rows[4][0]);
+
+$xml = shell_exec('unzip -p ./tests/open_xlsx_edit_append_rows_output.xlsx xl/worksheets/sheet1.xml');
+echo "shared: " . (strpos($xml, '<c r="A3" t="s">') !== false ? 'yes' : 'no') . PHP_EOL;
+
+try {
+    (new \Vtiful\Kernel\Excel($config))
+        ->fileName('open_xlsx_edit_append_rows_plain.xlsx')
+        ->appendRows();
+} catch (\Vtiful\Kernel\Exception $e) {
+    echo $e->getCode(), PHP_EOL;
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/open_xlsx_edit_append_rows_source.xlsx');
+@unlink(__DIR__ . '/open_xlsx_edit_append_rows_output.xlsx');
+@unlink(__DIR__ . '/open_xlsx_edit_append_rows_plain.xlsx');
+?>
+--EXPECT--
+2
+open_xlsx_edit_append_rows_output.xlsx
+int(5)
+array(2) {
+  [0]=>
+  string(6) "second"
+  [1]=>
+  int(2)
+}
+string(6) "second"
+shared: yes
+135
@@ -0,0 +1,109 @@
+--TEST--
+concat appends the worksheets of several workbooks after the first one's
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+$excel = new \Vtiful\Kernel\Excel($config);
+$excel->fileName('open_xlsx_edit_concat_a.xlsx', 'Data')
+    ->header(['name', 'value'])
+    ->data([['one', 1]])
+    ->output();
+
+$excel = new \Vtiful\Kernel\Excel($config);
+$handle = $excel->fileName('open_xlsx_edit_concat_b.xlsx', 'Data')->getHandle();
+$format = (new \Vtiful\Kernel\Format($handle))->italic()->toResource();
+$excel->header(['name', 'value'])
+    ->data([['two', 2]])
+    ->insertText(2, 0, 'styled', null, $format);
+$excel->addSheet('Notes')
+    ->insertText(0, 0, 'note');
+$excel->output();
+
+$out = (new \Vtiful\Kernel\Excel($config))->concat(
+    ['open_xlsx_edit_concat_a.xlsx', 'open_xlsx_edit_concat_b.xlsx'],
+    'open_xlsx_edit_concat_out.xlsx'
+);
+echo basename($out), PHP_EOL;
+
+$reader = (new \Vtiful\Kernel\Excel($config))->openFile('open_xlsx_edit_concat_out.xlsx');
+var_dump($reader->sheetList());
+var_dump($reader->openSheet('Data')->getSheetData());
+var_dump($reader->openSheet('Data (2)')->getSheetData());
+var_dump($reader->openSheet('Notes')->getSheetData());
+
+try {
+    (new \Vtiful\Kernel\Excel($config))->concat(
+        ['open_xlsx_edit_concat_a.xlsx', 'open_xlsx_edit_concat_missing.xlsx'],
+        'open_xlsx_edit_concat_out.xlsx'
+    );
+    echo "missing: no-throw\n";
+} catch (\Vtiful\Kernel\Exception $e) {
+    echo "missing: throw\n";
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/open_xlsx_edit_concat_a.xlsx');
+@unlink(__DIR__ . '/open_xlsx_edit_concat_b.xlsx');
+@unlink(__DIR__ . '/open_xlsx_edit_concat_out.xlsx');
+?>
+--EXPECT--
+open_xlsx_edit_concat_out.xlsx
+array(3) {
+  [0]=>
+  string(4) "Data"
+  [1]=>
+  string(8) "Data (2)"
+  [2]=>
+  string(5) "Notes"
+}
+array(2) {
+  [0]=>
+  array(2) {
+    [0]=>
+    string(4) "name"
+    [1]=>
+    string(5) "value"
+  }
+  [1]=>
+  array(2) {
+    [0]=>
+    string(3) "one"
+    [1]=>
+    int(1)
+  }
+}
+array(3) {
+  [0]=>
+  array(2) {
+    [0]=>
+    string(4) "name"
+    [1]=>
+    string(5) "value"
+  }
+  [1]=>
+  array(2) {
+    [0]=>
+    string(3) "two"
+    [1]=>
+    int(2)
+  }
+  [2]=>
+  array(1) {
+    [0]=>
+    string(6) "styled"
+  }
+}
+array(1) {
+  [0]=>
+  array(1) {
+    [0]=>
+    string(4) "note"
+  }
+}
+missing: throw
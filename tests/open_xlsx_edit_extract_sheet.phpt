@@ -0,0 +1,72 @@
+--TEST--
+extractSheet writes one worksheet to a workbook of its own
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+$excel = new \Vtiful\Kernel\Excel($config);
+$excel->fileName('open_xlsx_edit_extract_sheet_source.xlsx', 'Data')
+    ->header(['name', 'value'])
+    ->data([['one', 1]])
+    ->insertComment(1, 0, 'note');
+$excel->addSheet('Notes')
+    ->insertText(0, 0, 'kept')
+    ->insertText(1, 0, 2);
+$excel->output();
+
+$out = (new \Vtiful\Kernel\Excel($config))->extractSheet(
+    'open_xlsx_edit_extract_sheet_source.xlsx',
+    'Notes',
+    'open_xlsx_edit_extract_sheet_out.xlsx'
+);
+echo basename($out), PHP_EOL;
+
+$reader = (new \Vtiful\Kernel\Excel($config))->openFile('open_xlsx_edit_extract_sheet_out.xlsx');
+var_dump($reader->sheetList());
+var_dump($reader->openSheet('Notes')->getSheetData());
+
+$names = shell_exec('unzip -l ./tests/open_xlsx_edit_extract_sheet_out.xlsx');
+echo "other sheet: " . (strpos($names, 'xl/worksheets/sheet1.xml') !== false ? 'yes' : 'no') . PHP_EOL;
+echo "comments: " . (strpos($names, 'comments1.xml') !== false ? 'yes' : 'no') . PHP_EOL;
+
+try {
+    (new \Vtiful\Kernel\Excel($config))->extractSheet(
+        'open_xlsx_edit_extract_sheet_source.xlsx',
+        'Missing',
+        'open_xlsx_edit_extract_sheet_out.xlsx'
+    );
+    echo "missing: no-throw\n";
+} catch (\Vtiful\Kernel\Exception $e) {
+    echo "missing: throw\n";
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/open_xlsx_edit_extract_sheet_source.xlsx');
+@unlink(__DIR__ . '/open_xlsx_edit_extract_sheet_out.xlsx');
+?>
+--EXPECT--
+open_xlsx_edit_extract_sheet_out.xlsx
+array(1) {
+  [0]=>
+  string(5) "Notes"
+}
+array(2) {
+  [0]=>
+  array(1) {
+    [0]=>
+    string(4) "kept"
+  }
+  [1]=>
+  array(1) {
+    [0]=>
+    int(2)
+  }
+}
+other sheet: no
+comments: no
+missing: throw
@@ -0,0 +1,51 @@
+--TEST--
+openFile with the template cache stamps independent copies of a template
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+$writer = new \Vtiful\Kernel\Excel($config);
+$writer->fileName('open_xlsx_edit_template_cache_source.xlsx', 'Invoice')
+    ->header(['item', 'amount'])
+    ->data([['base', 1]])
+    ->output();
+
+foreach (['first' => 10, 'second' => 20] as $name => $amount) {
+    (new \Vtiful\Kernel\Excel($config))
+        ->openFile('open_xlsx_edit_template_cache_source.xlsx', true)
+        ->openSheet('Invoice')
+        ->insertText(1, 1, $amount)
+        ->output('open_xlsx_edit_template_cache_' . $name . '.xlsx');
+}
+
+foreach (['first', 'second'] as $name) {
+    $rows = (new \Vtiful\Kernel\Excel($config))
+        ->openFile('open_xlsx_edit_template_cache_' . $name . '.xlsx')
+        ->openSheet('Invoice')
+        ->getSheetData();
+    var_dump($rows[1]);
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/open_xlsx_edit_template_cache_source.xlsx');
+@unlink(__DIR__ . '/open_xlsx_edit_template_cache_first.xlsx');
+@unlink(__DIR__ . '/open_xlsx_edit_template_cache_second.xlsx');
+?>
+--EXPECT--
+array(2) {
+  [0]=>
+  string(4) "base"
+  [1]=>
+  int(10)
+}
+array(2) {
+  [0]=>
+  string(4) "base"
+  [1]=>
+  int(20)
+}
@@ -0,0 +1,56 @@
+--TEST--
+openFile parses a cached template once, for editing and reading alike
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+$writer = new \Vtiful\Kernel\Excel($config);
+$writer->fileName('open_xlsx_edit_template_cache_stats.xlsx', 'Invoice')
+    ->header(['item', 'amount'])
+    ->data([['base', 1]])
+    ->output();
+
+$before = \Vtiful\Kernel\Excel::templateCacheStats();
+
+$first = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('open_xlsx_edit_template_cache_stats.xlsx', true);
+$afterFirst = \Vtiful\Kernel\Excel::templateCacheStats();
+
+$second = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('open_xlsx_edit_template_cache_stats.xlsx', true);
+$afterSecond = \Vtiful\Kernel\Excel::templateCacheStats();
+
+var_dump($afterFirst['misses'] - $before['misses']);
+var_dump($afterSecond['misses'] - $afterFirst['misses']);
+var_dump($afterSecond['hits'] - $afterFirst['hits']);
+
+var_dump($second->openSheet('Invoice')->getSheetData());
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/open_xlsx_edit_template_cache_stats.xlsx');
+?>
+--EXPECT--
+int(1)
+int(0)
+int(1)
+array(2) {
+  [0]=>
+  array(2) {
+    [0]=>
+    string(4) "item"
+    [1]=>
+    string(6) "amount"
+  }
+  [1]=>
+  array(2) {
+    [0]=>
+    string(4) "base"
+    [1]=>
+    int(1)
+  }
+}
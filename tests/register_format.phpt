@@ -0,0 +1,62 @@
+--TEST--
+Excel::registerFormat() ids are accepted by insertText, insertDate and column format maps
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+date_default_timezone_set('UTC');
+
+$excel = new \Vtiful\Kernel\Excel(['path' => './tests']);
+$excel->fileName('register_format.xlsx');
+
+$bold = (new \Vtiful\Kernel\Format($excel->getHandle()))->bold()->toResource();
+
+$money = $excel->registerFormat($bold, '#,##0.00');
+$day   = $excel->registerFormat(null, 'yyyy-mm-dd');
+
+var_dump($money, $day, $excel->registerFormat($bold, '#,##0.00'));
+
+$excel->header(['name', 'amount'])
+    ->data([
+        ['viest', 1.5],
+        ['wjx', 2],
+    ], ['B' => $money])
+    ->insertText(3, 1, 3.25, null, $money)
+    ->insertDate(3, 2, 1700000000, null, $day);
+
+try {
+    $excel->insertText(4, 0, 'x', null, 99);
+} catch (\Vtiful\Kernel\Exception $exception) {
+    echo $exception->getCode() . PHP_EOL;
+    echo $exception->getMessage() . PHP_EOL;
+}
+
+$excel->output();
+
+$v = new \Vtiful\Kernel\Excel(['path' => './tests']);
+$v->openFile('register_format.xlsx')->openSheet();
+$v->nextRow();
+
+while (($row = $v->nextRowWithFormula()) !== null) {
+    foreach ($row as $column => $cell) {
+        if ($column < 2 && $cell['style_id'] > 0) {
+            var_dump($cell['value']);
+        }
+    }
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/register_format.xlsx');
+?>
+--EXPECT--
+int(0)
+int(1)
+int(0)
+240
+Format id is not registered
+float(1.5)
+int(2)
+float(3.25)
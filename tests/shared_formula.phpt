@@ -0,0 +1,46 @@
+--TEST--
+insertFormula() copied down a column is written as a shared formula
+--SKIPIF--
+<?php
+require __DIR__ . '/include/skipif.inc';
+?>
+--FILE--
+<?php
+$config = ['path' => './tests'];
+
+$excel = (new \Vtiful\Kernel\Excel($config))->fileName('shared_formula.xlsx');
+
+for ($row = 1; $row <= 3; $row++) {
+    $excel->insertText($row - 1, 0, $row)
+        ->insertText($row - 1, 1, $row * 10)
+        ->insertFormula($row - 1, 2, "=A{$row}*B{$row}")
+        ->insertFormula($row - 1, 3, '=SUM($A$1:$A$3)');
+}
+
+$excel->output();
+
+$xml = shell_exec('unzip -p ./tests/shared_formula.xlsx xl/worksheets/sheet1.xml');
+echo 'anchor: ', (strpos($xml, '<f t="shared" ref="C1:C3" si="0">A1*B1</f>') !== false ? 'yes' : 'no'), PHP_EOL;
+echo 'followers: ', substr_count($xml, '<f t="shared" si="0"/>'), PHP_EOL;
+echo 'absolute: ', (strpos($xml, '<f t="shared" ref="D1:D3" si="1">SUM($A$1:$A$3)</f>') !== false ? 'yes' : 'no'), PHP_EOL;
+
+$rv = (new \Vtiful\Kernel\Excel($config))
+    ->openFile('shared_formula.xlsx')
+    ->openSheet(null, \Vtiful\Kernel\Excel::FORMULA_VERBOSE);
+
+while (($row = $rv->nextRowWithFormula()) !== null) {
+    $formula = $row[2]['formula'];
+    echo $formula['type'], ' ', $formula['si'], ' ', $formula['ref'] ?? '-', ' ', $formula['text'], PHP_EOL;
+}
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/shared_formula.xlsx');
+?>
+--EXPECT--
+anchor: yes
+followers: 2
+absolute: yes
+shared 0 C1:C3 A1*B1
+shared 0 - 
+shared 0 - 
@@ -57,6 +57,8 @@ PHP_MINIT_FUNCTION(xlswriter)
 
 	le_xls_writer = zend_register_list_destructors_ex(_php_vtiful_xls_close, NULL, VTIFUL_RESOURCE_NAME, module_number);
 
+	lxlsx_scan_init();
+
 	return SUCCESS;
 }
 /* }}} */
@@ -65,6 +67,8 @@ PHP_MINIT_FUNCTION(xlswriter)
  */
 PHP_MSHUTDOWN_FUNCTION(xlswriter)
 {
+	lxlsx_edit_template_cache_clear();
+
 	return SUCCESS;
 }
 /* }}} */